@@ -0,0 +1,297 @@
+/*
+ * Exercise arena-backed pmResults: build results of every value
+ * format with the __pmArena* routines, release them with pmFreeResult,
+ * __pmFreeResultValues and via a result that only borrows their value
+ * sets, round trip one through __pmEncodeResult/__pmDecodeResult and,
+ * given an archive, check the results from pmFetch are arena-backed.
+ * The number of PDU buffers in use is checked after each step.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include "localconfig.h"
+
+static int	inuse;
+
+static void
+outstanding(char *tag)
+{
+    int		alloc, nfree;
+
+    __pmCountPDUBuf(0, &alloc, &nfree);
+    printf("%s: %d buffer%s in use\n", tag, alloc - inuse,
+		alloc - inuse == 1 ? "" : "s");
+}
+
+static int
+is_arena(pmResult *rp)
+{
+    char	*base;
+
+    return __pmPDUBufRange((void *)rp, &base) > 0 && base == (char *)rp;
+}
+
+static void
+dump(pmResult *rp)
+{
+    pmValueSet	*vsp;
+    pmAtomValue	av;
+    int		i, j, type;
+    char	*p;
+
+    printf("numpmid: %d arena: %s\n", rp->numpmid, is_arena(rp) ? "yes" : "no");
+    for (i = 0; i < rp->numpmid; i++) {
+	vsp = rp->vset[i];
+	printf("  %s numval: %d", pmIDStr(vsp->pmid), vsp->numval);
+	if (vsp->numval < 0) {
+	    printf(" %s\n", pmErrStr(vsp->numval));
+	    continue;
+	}
+	if (vsp->numval > 0)
+	    printf(" valfmt: %d", vsp->valfmt);
+	putchar('\n');
+	for (j = 0; j < vsp->numval; j++) {
+	    pmValue	*vp = &vsp->vlist[j];
+
+	    printf("    inst %d: ", vp->inst);
+	    if (vsp->valfmt == PM_VAL_INSITU) {
+		printf("%d\n", vp->value.lval);
+		continue;
+	    }
+	    type = vp->value.pval->vtype;
+	    if (type == PM_TYPE_AGGREGATE) {
+		printf("aggregate[%d]", vp->value.pval->vlen - PM_VAL_HDR_SIZE);
+		for (p = vp->value.pval->vbuf;
+		     p < (char *)vp->value.pval + vp->value.pval->vlen; p++)
+		    printf(" %02x", *p & 0xff);
+		putchar('\n');
+		continue;
+	    }
+	    pmExtractValue(vsp->valfmt, vp, type, &av, type);
+	    switch (type) {
+	    case PM_TYPE_U64:
+		printf("%llu\n", (unsigned long long)av.ull);
+		break;
+	    case PM_TYPE_DOUBLE:
+		printf("%.6f\n", av.d);
+		break;
+	    case PM_TYPE_FLOAT:
+		printf("%.3f\n", (double)av.f);
+		break;
+	    case PM_TYPE_STRING:
+		printf("\"%s\"\n", av.cp);
+		free(av.cp);
+		break;
+	    default:
+		printf("type %d?\n", type);
+		break;
+	    }
+	}
+    }
+}
+
+/*
+ * A result with one pmValueSet of each flavour: insitu values, an
+ * error, no values, a set grown after it was added, and pmValueBlocks
+ * of every type that needs one.
+ */
+static pmResult *
+build(__pmResultArena *ap, int base)
+{
+    pmResult		*rp;
+    pmValueSet		*vsp;
+    pmValueBlock	*vbp;
+    pmAtomValue		av;
+    char		agg[] = { 0x01, 0x02, 0x03, 0x04, 0x05 };
+    char		str[32];
+    int			i, sts;
+
+    __pmArenaReset(ap);
+
+    vsp = __pmArenaValueSet(ap, pmid_build(base, 0, 1), 3);
+    for (i = 0; i < 3; i++) {
+	vsp->vlist[i].inst = i;
+	vsp->vlist[i].value.lval = base * 100 + i;
+    }
+
+    __pmArenaValueSet(ap, pmid_build(base, 0, 2), PM_ERR_PMID);
+    __pmArenaValueSet(ap, pmid_build(base, 0, 3), 0);
+
+    vsp = __pmArenaValueSet(ap, pmid_build(base, 0, 4), 1);
+    vsp->vlist[0].inst = 0;
+    vsp->vlist[0].value.lval = -1;
+    vsp = __pmArenaGrowValueSet(ap, 4);
+    vsp->numval = 4;
+    for (i = 1; i < 4; i++) {
+	vsp->vlist[i].inst = i;
+	vsp->vlist[i].value.lval = -1 - i;
+    }
+
+    vsp = __pmArenaValueSet(ap, pmid_build(base, 0, 5), 5);
+    vsp->vlist[0].inst = 10;
+    av.ull = 0xfedcba9876543210ULL + base;
+    sts = __pmArenaStuffValue(ap, &av, &vsp->vlist[0], PM_TYPE_U64);
+    vsp->vlist[1].inst = 11;
+    av.d = base + 0.125;
+    __pmArenaStuffValue(ap, &av, &vsp->vlist[1], PM_TYPE_DOUBLE);
+    vsp->vlist[2].inst = 12;
+    av.f = base + 0.5;
+    __pmArenaStuffValue(ap, &av, &vsp->vlist[2], PM_TYPE_FLOAT);
+    vsp->vlist[3].inst = 13;
+    snprintf(str, sizeof(str), "string value %d", base);
+    av.cp = str;
+    __pmArenaStuffValue(ap, &av, &vsp->vlist[3], PM_TYPE_STRING);
+    /* a pmValueBlock filled in by the caller */
+    vsp->vlist[4].inst = 14;
+    vbp = __pmArenaValueBlock(ap, PM_VAL_HDR_SIZE + sizeof(agg), &vsp->vlist[4]);
+    vbp->vlen = PM_VAL_HDR_SIZE + sizeof(agg);
+    vbp->vtype = PM_TYPE_AGGREGATE;
+    memcpy(vbp->vbuf, agg, sizeof(agg));
+    vsp->valfmt = sts;
+
+    if ((sts = __pmArenaResult(ap, &rp)) < 0) {
+	fprintf(stderr, "__pmArenaResult: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    return rp;
+}
+
+static void
+archive(char *name)
+{
+    pmResult	*rp;
+    pmLogLabel	label;
+    pmID	pmids[2];
+    char	*names[] = { "sample.seconds", "sample.colour" };
+    int		sts, n, arena;
+    int		before, nfree;
+
+    if ((sts = pmNewContext(PM_CONTEXT_ARCHIVE, name)) < 0) {
+	fprintf(stderr, "pmNewContext(%s): %s\n", name, pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmLookupName(2, names, pmids)) < 0) {
+	fprintf(stderr, "pmLookupName: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    __pmCountPDUBuf(0, &before, &nfree);
+
+    for (n = arena = 0; (sts = pmFetch(2, pmids, &rp)) >= 0; n++) {
+	arena += is_arena(rp);
+	pmFreeResult(rp);
+    }
+    printf("archive forward: %d results, %d arena-backed, %s\n",
+	    n, arena, pmErrStr(sts));
+
+    pmGetArchiveLabel(&label);
+    pmSetMode(PM_MODE_INTERP, &label.ll_start, 2500);
+    for (n = arena = 0; n < 20 && (sts = pmFetch(2, pmids, &rp)) >= 0; n++) {
+	arena += is_arena(rp);
+	pmFreeResult(rp);
+    }
+    printf("archive interp: %d results, %d arena-backed\n", n, arena);
+
+    /* the archive context may keep log records pinned until it is closed */
+    pmDestroyContext(pmWhichContext());
+    __pmCountPDUBuf(0, &n, &nfree);
+    printf("archive: %d buffer%s more in use\n", n - before,
+		n - before == 1 ? "" : "s");
+}
+
+int
+main(int argc, char **argv)
+{
+    __pmResultArena	arena;
+    pmResult		*rp, *rp2, *mixed;
+    __pmPDU		*pb;
+    int			c, i, sts, nfree;
+    int			errflag = 0;
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "D:")) != EOF) {
+	switch (c) {
+	case 'D':
+	    sts = __pmParseDebug(optarg);
+	    if (sts < 0) {
+		fprintf(stderr, "%s: unrecognized debug flag specification (%s)\n",
+		    pmProgname, optarg);
+		errflag++;
+	    }
+	    else
+		pmDebug |= sts;
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (errflag || argc > optind + 1) {
+	fprintf(stderr, "Usage: %s [-D debug] [archive]\n", pmProgname);
+	exit(1);
+    }
+
+    __pmCountPDUBuf(0, &inuse, &nfree);
+    memset(&arena, 0, sizeof(arena));
+
+    printf("=== build and pmFreeResult ===\n");
+    rp = build(&arena, 1);
+    dump(rp);
+    outstanding("built");
+    pmFreeResult(rp);
+    outstanding("pmFreeResult");
+
+    printf("=== __pmFreeResultValues ===\n");
+    rp = build(&arena, 2);
+    __pmFreeResultValues(rp);
+    outstanding("__pmFreeResultValues");
+
+    printf("=== borrowed value sets ===\n");
+    rp = build(&arena, 3);
+    rp2 = build(&arena, 4);
+    mixed = (pmResult *)malloc(sizeof(pmResult) + 3 * sizeof(pmValueSet *));
+    mixed->numpmid = 4;
+    mixed->vset[0] = rp->vset[0];
+    mixed->vset[1] = rp2->vset[4];
+    mixed->vset[2] = rp->vset[4];
+    mixed->vset[3] = rp2->vset[0];
+    dump(mixed);
+    outstanding("borrowed");
+    pmFreeResult(mixed);
+    outstanding("pmFreeResult");
+
+    printf("=== reuse ===\n");
+    for (i = 0; i < 1000; i++) {
+	rp = build(&arena, 5 + i % 7);
+	pmFreeResult(rp);
+    }
+    outstanding("1000 results");
+
+    printf("=== encode and decode ===\n");
+    rp = build(&arena, 6);
+    if ((sts = __pmEncodeResult(-1, rp, &pb)) < 0) {
+	fprintf(stderr, "__pmEncodeResult: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    pmFreeResult(rp);
+    if ((sts = __pmDecodeResult(pb, &rp)) < 0) {
+	fprintf(stderr, "__pmDecodeResult: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    __pmUnpinPDUBuf(pb);
+    dump(rp);
+    pmFreeResult(rp);
+    outstanding("decoded");
+
+    __pmArenaFree(&arena);
+
+    if (optind < argc) {
+	printf("=== archive ===\n");
+	archive(argv[optind]);
+    }
+
+    return 0;
+}
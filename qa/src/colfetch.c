@@ -0,0 +1,247 @@
+/*
+ * pmdaFetch through a PMDA_INTERFACE_7 column callback (-c) or the
+ * per-instance callback, over a table and a cache instance domain and
+ * a series of instance profiles set with pmAddProfile and pmDelProfile.
+ * Both callbacks produce the same values, so the output of the two
+ * should be the same.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pcp/pmda.h>
+
+#define DOMAIN	250
+
+static pmdaInstid	tabinsts[] = {
+    { 7, "seven" }, { 3, "three" }, { 11, "eleven" }, { 0, "zero" },
+    { 5, "five" }, { 2, "two" }, { 9, "nine" }, { 4, "four" },
+};
+
+static pmdaIndom	indomtab[] = {
+#define TAB_INDOM	0
+    { TAB_INDOM, sizeof(tabinsts) / sizeof(tabinsts[0]), tabinsts },
+#define CACHE_INDOM	1
+    { CACHE_INDOM, 0, NULL },
+};
+
+static pmdaMetric	metrictab[] = {
+    /* singular */
+    { NULL, { PMDA_PMID(0,0), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+    /* a value for every instance */
+    { NULL, { PMDA_PMID(0,1), PM_TYPE_U32, TAB_INDOM, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+    /* strings */
+    { NULL, { PMDA_PMID(0,2), PM_TYPE_STRING, TAB_INDOM, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+    /* no values for odd instances */
+    { NULL, { PMDA_PMID(0,3), PM_TYPE_64, TAB_INDOM, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+    /* an error for instance 5 */
+    { NULL, { PMDA_PMID(0,4), PM_TYPE_DOUBLE, TAB_INDOM, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+    /* an error for every instance */
+    { NULL, { PMDA_PMID(0,5), PM_TYPE_U32, TAB_INDOM, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+    /* the cache indom */
+    { NULL, { PMDA_PMID(0,6), PM_TYPE_U64, CACHE_INDOM, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+};
+#define NMETRICS	(sizeof(metrictab) / sizeof(metrictab[0]))
+
+static char	*strings[] = {
+    "zero", "one", "two", "three", "four", "five", "six",
+    "seven", "eight", "nine", "ten", "eleven",
+};
+
+static int
+value(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
+{
+    switch (pmid_item(mdesc->m_desc.pmid)) {
+    case 0:
+	atom->ul = 42;
+	break;
+    case 1:
+	atom->ul = inst * 10 + 1;
+	break;
+    case 2:
+	atom->cp = strings[inst];
+	break;
+    case 3:
+	if (inst & 1)
+	    return PMDA_FETCH_NOVALUES;
+	atom->ll = -(__int64_t)inst;
+	break;
+    case 4:
+	if (inst == 5)
+	    return PM_ERR_AGAIN;
+	atom->d = inst / 4.0;
+	break;
+    case 5:
+	return PM_ERR_APPVERSION;
+    case 6:
+	atom->ull = inst * 1000;
+	break;
+    default:
+	return PM_ERR_PMID;
+    }
+    return PMDA_FETCH_STATIC;
+}
+
+static int
+fetch_callback(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
+{
+    return value(mdesc, inst, atom);
+}
+
+static int
+fetch_column(pmdaMetric *mdesc, int numinst, const int *insts,
+		pmAtomValue *atoms, int *sts)
+{
+    int		i;
+
+    /* an error that cannot depend on the instance, once for the column */
+    if (pmid_item(mdesc->m_desc.pmid) == 5)
+	return PM_ERR_APPVERSION;
+    for (i = 0; i < numinst; i++)
+	sts[i] = value(mdesc, insts[i], &atoms[i]);
+    return 0;
+}
+
+static pmdaInterface	dispatch;
+
+static void
+report(char *title)
+{
+    __pmContext	*ctxp;
+    pmResult	*rp;
+    pmValueSet	*vsp;
+    pmID	pmids[NMETRICS];
+    int		i, j, sts;
+
+    printf("=== %s ===\n", title);
+    ctxp = __pmHandleToPtr(pmWhichContext());
+    sts = dispatch.version.any.profile(ctxp->c_instprof, dispatch.version.any.ext);
+    PM_UNLOCK(ctxp->c_lock);
+    if (sts < 0) {
+	printf("profile: %s\n", pmErrStr(sts));
+	return;
+    }
+    for (i = 0; i < NMETRICS; i++)
+	pmids[i] = metrictab[i].m_desc.pmid;
+    if ((sts = dispatch.version.any.fetch(NMETRICS, pmids, &rp, dispatch.version.any.ext)) < 0) {
+	printf("fetch: %s\n", pmErrStr(sts));
+	return;
+    }
+    for (i = 0; i < rp->numpmid; i++) {
+	vsp = rp->vset[i];
+	printf("%s:", pmIDStr(vsp->pmid));
+	if (vsp->numval < 0)
+	    printf(" %s", pmErrStr(vsp->numval));
+	else if (vsp->numval == 0)
+	    printf(" no values");
+	for (j = 0; j < vsp->numval; j++) {
+	    if (vsp->vlist[j].inst != PM_IN_NULL)
+		printf(" [%d]", vsp->vlist[j].inst);
+	    putchar(' ');
+	    pmPrintValue(stdout, vsp->valfmt, metrictab[i].m_desc.type,
+			 &vsp->vlist[j], 1);
+	}
+	putchar('\n');
+    }
+    __pmFreeResultValues(rp);
+}
+
+int
+main(int argc, char **argv)
+{
+    int		c, sts;
+    int		errflag = 0;
+    int		column = 0;
+    int		insts[3];
+    pmInDom	tab, cache;
+    char	*errmsg;
+    static char	*usage = "[-c]";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "c")) != EOF) {
+	switch (c) {
+	case 'c':	/* column callback */
+	    column = 1;
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (errflag || optind != argc) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    /* a local context with no PMDAs, just for its profile */
+    if ((errmsg = __pmSpecLocalPMDA("clear")) != NULL) {
+	fprintf(stderr, "%s: -K clear: %s\n", pmProgname, errmsg);
+	exit(1);
+    }
+    if ((sts = pmNewContext(PM_CONTEXT_LOCAL, NULL)) < 0) {
+	fprintf(stderr, "%s: pmNewContext: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+
+    pmdaDSO(&dispatch, PMDA_INTERFACE_7, "colfetch", NULL);
+    dispatch.domain = DOMAIN;
+    if (column)
+	pmdaSetFetchColumnCallBack(&dispatch, fetch_column);
+    else
+	pmdaSetFetchCallBack(&dispatch, fetch_callback);
+    pmdaInit(&dispatch, indomtab, sizeof(indomtab) / sizeof(indomtab[0]),
+		metrictab, NMETRICS);
+    if (dispatch.status != 0) {
+	fprintf(stderr, "%s: pmdaInit: %s\n", pmProgname, pmErrStr(dispatch.status));
+	exit(1);
+    }
+    tab = indomtab[TAB_INDOM].it_indom;
+    cache = indomtab[CACHE_INDOM].it_indom;
+
+    /* cache instances 0 to 3, with 2 inactive */
+    pmdaCacheStore(cache, PMDA_CACHE_ADD, "eight", NULL);
+    pmdaCacheStore(cache, PMDA_CACHE_ADD, "one", NULL);
+    pmdaCacheStore(cache, PMDA_CACHE_ADD, "three", NULL);
+    pmdaCacheStore(cache, PMDA_CACHE_ADD, "six", NULL);
+    pmdaCacheStore(cache, PMDA_CACHE_HIDE, "three", NULL);
+
+    report("no profile");
+
+    pmDelProfile(tab, 0, NULL);
+    insts[0] = 11; insts[1] = 0; insts[2] = 5;
+    pmAddProfile(tab, 3, insts);
+    report("three instances of the table indom");
+
+    pmAddProfile(tab, 0, NULL);
+    insts[0] = 3; insts[1] = 5;
+    pmDelProfile(tab, 2, insts);
+    report("all but two instances of the table indom");
+
+    pmDelProfile(tab, 0, NULL);
+    report("no instances of the table indom");
+
+    pmAddProfile(tab, 0, NULL);
+    pmDelProfile(PM_INDOM_NULL, 0, NULL);
+    insts[0] = 3; insts[1] = 2;
+    pmAddProfile(cache, 2, insts);
+    report("only an active and an inactive cache instance");
+
+    insts[0] = 2; insts[1] = 99;
+    pmAddProfile(tab, 2, insts);
+    report("an unknown instance as well");
+
+    pmAddProfile(PM_INDOM_NULL, 0, NULL);
+    report("everything again");
+
+    exit(0);
+}
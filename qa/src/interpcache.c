@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * Scroll back and forth through an archive in interpolate mode (as a
+ * charting client does), then report a checksum of the values seen and
+ * the interpolation read cache statistics.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+
+int
+main(int argc, char **argv)
+{
+    int		c;
+    int		sts;
+    int		errflag = 0;
+    int		size = 0;
+    int		sflag = 0;
+    int		samples = 60;
+    int		passes = 10;
+    int		tflag = 0;
+    int		i, j, k, pass;
+    int		numpmid;
+    char	*archive = NULL;
+    char	*endnum;
+    pmID	*pmidlist;
+    pmResult	*rp;
+    pmLogLabel	label;
+    pmAtomValue	atom;
+    pmDesc	desc;
+    pmInterpCacheStats	stats;
+    struct timeval	delta = { 10, 0 };
+    struct timeval	start, when, before, after;
+    double	sum = 0;
+    int		nvalues = 0;
+    static int	offset[] = { 0, 2, 1, 3 };	/* in quarter windows */
+    static char	*usage = "[-D debug] [-n samples] [-p passes] [-s cachesize] [-T] [-t delta] -a archive metric ...";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "a:D:n:p:s:Tt:")) != EOF) {
+	switch (c) {
+
+	case 'a':	/* archive */
+	    archive = optarg;
+	    break;
+
+#ifdef PCP_DEBUG
+	case 'D':	/* debug flag */
+	    sts = __pmParseDebug(optarg);
+	    if (sts < 0) {
+		fprintf(stderr, "%s: unrecognized debug flag specification (%s)\n",
+		    pmProgname, optarg);
+		errflag++;
+	    }
+	    else
+		pmDebug |= sts;
+	    break;
+#endif
+
+	case 'n':	/* samples per window */
+	    samples = atoi(optarg);
+	    break;
+
+	case 'p':	/* scrolling passes */
+	    passes = atoi(optarg);
+	    break;
+
+	case 's':	/* read cache size */
+	    size = atoi(optarg);
+	    sflag = 1;
+	    break;
+
+	case 'T':	/* report elapsed time */
+	    tflag = 1;
+	    break;
+
+	case 't':	/* interval between samples */
+	    if (pmParseInterval(optarg, &delta, &endnum) < 0) {
+		fprintf(stderr, "%s: illegal -t argument\n%s", pmProgname, endnum);
+		free(endnum);
+		errflag++;
+	    }
+	    break;
+
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+
+    if (errflag || archive == NULL || optind == argc ||
+	samples <= 0 || passes <= 0) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    if ((sts = pmNewContext(PM_CONTEXT_ARCHIVE, archive)) < 0) {
+	printf("%s: Cannot open archive \"%s\": %s\n", pmProgname, archive, pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmGetArchiveLabel(&label)) < 0) {
+	printf("%s: pmGetArchiveLabel: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    if (sflag && (sts = pmSetInterpCacheSize(size)) < 0) {
+	printf("%s: pmSetInterpCacheSize: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+
+    numpmid = argc - optind;
+    if ((pmidlist = (pmID *)malloc(numpmid * sizeof(pmID))) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmProgname);
+	exit(1);
+    }
+    if ((sts = pmLookupName(numpmid, &argv[optind], pmidlist)) < 0) {
+	printf("%s: pmLookupName: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+
+    /*
+     * Each pass shows a window of samples, scrolls forwards by half a
+     * window, back by a quarter, forwards by half again, and so on.
+     */
+    gettimeofday(&before, NULL);
+    start = label.ll_start;
+    for (pass = 0; pass < passes; pass++) {
+	for (k = 0; k < 4; k++) {
+	    when = start;
+	    when.tv_sec += offset[k] * samples / 4 * delta.tv_sec;
+	    if ((sts = pmSetMode(PM_MODE_INTERP, &when, (int)(delta.tv_sec * 1000 + delta.tv_usec / 1000))) < 0) {
+		printf("%s: pmSetMode: %s\n", pmProgname, pmErrStr(sts));
+		exit(1);
+	    }
+	    for (i = 0; i < samples; i++) {
+		if ((sts = pmFetch(numpmid, pmidlist, &rp)) < 0) {
+		    if (sts == PM_ERR_EOL)
+			break;
+		    printf("%s: pmFetch: %s\n", pmProgname, pmErrStr(sts));
+		    exit(1);
+		}
+		for (j = 0; j < rp->numpmid; j++) {
+		    pmValueSet	*vsp = rp->vset[j];
+		    if (vsp->numval <= 0)
+			continue;
+		    if (pmLookupDesc(vsp->pmid, &desc) < 0)
+			continue;
+		    if (pmExtractValue(vsp->valfmt, &vsp->vlist[0], desc.type,
+					&atom, PM_TYPE_DOUBLE) < 0)
+			continue;
+		    sum += atom.d;
+		    nvalues++;
+		}
+		pmFreeResult(rp);
+	    }
+	}
+	start.tv_sec += samples / 2 * delta.tv_sec;
+    }
+    gettimeofday(&after, NULL);
+
+    if ((sts = pmGetInterpCacheStats(&stats)) < 0) {
+	printf("%s: pmGetInterpCacheStats: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    printf("%d values, checksum %.10g\n", nvalues, sum);
+    printf("cache size %d count %d: %llu hits %llu misses %llu evictions\n",
+	stats.size, stats.count, (unsigned long long)stats.hit,
+	(unsigned long long)stats.miss, (unsigned long long)stats.evict);
+    if (tflag)
+	printf("%.3f msec\n", __pmtimevalSub(&after, &before) * 1000.0);
+
+    exit(0);
+}
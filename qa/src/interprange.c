@@ -0,0 +1,223 @@
+/*
+ * Compare pmFetchInterpRange against pmSetMode(PM_MODE_INTERP) and
+ * a pmFetch per step, for (metric, instance) pairs given as
+ * metric or metric[instance-name] on the command line.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <math.h>
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include "localconfig.h"
+
+static double
+fetch_one(pmID pmid, pmDesc *dp, int inst)
+{
+    pmResult	*rp;
+    pmAtomValue	av;
+    pmValueSet	*vsp;
+    double	v = NAN;
+    int		sts, j;
+
+    if ((sts = pmFetch(1, &pmid, &rp)) < 0) {
+	if (sts != PM_ERR_EOL)
+	    fprintf(stderr, "pmFetch: %s\n", pmErrStr(sts));
+	return v;
+    }
+    vsp = rp->vset[0];
+    for (j = 0; j < vsp->numval; j++) {
+	if (dp->indom != PM_INDOM_NULL && vsp->vlist[j].inst != inst)
+	    continue;
+	if (pmExtractValue(vsp->valfmt, &vsp->vlist[j], dp->type, &av, PM_TYPE_DOUBLE) >= 0)
+	    v = av.d;
+	break;
+    }
+    pmFreeResult(rp);
+    return v;
+}
+
+static void
+print_value(double v)
+{
+    if (isnan(v))
+	printf(" %12s", "?");
+    else
+	printf(" %12.6g", v);
+}
+
+int
+main(int argc, char **argv)
+{
+    int		c, sts, i, k;
+    int		errflag = 0;
+    int		count = 10;
+    double	offset = 0;
+    double	step = 1;
+    char	*archive = NULL;
+    char	*endnum;
+    char	*p;
+    int		npair;
+    char	**names;
+    pmID	*pmids;
+    int		*insts;
+    pmDesc	*descs;
+    double	*values;
+    double	v;
+    struct timeval	start, delta;
+    pmLogLabel	label;
+    int		mismatch = 0;
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "a:D:n:O:t:")) != EOF) {
+	switch (c) {
+	case 'a':
+	    archive = optarg;
+	    break;
+	case 'D':
+	    sts = __pmParseDebug(optarg);
+	    if (sts < 0) {
+		fprintf(stderr, "%s: unrecognized debug flag specification (%s)\n",
+		    pmProgname, optarg);
+		errflag++;
+	    }
+	    else
+		pmDebug |= sts;
+	    break;
+	case 'n':
+	    count = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0') {
+		fprintf(stderr, "%s: -n requires a numeric argument\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+	case 'O':
+	    offset = strtod(optarg, &endnum);
+	    if (*endnum != '\0') {
+		fprintf(stderr, "%s: -O requires a numeric argument\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+	case 't':
+	    step = strtod(optarg, &endnum);
+	    if (*endnum != '\0') {
+		fprintf(stderr, "%s: -t requires a numeric argument\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+
+    if (errflag || archive == NULL || optind == argc) {
+	fprintf(stderr,
+"Usage: %s [-D debug] -a archive [-n count] [-O offset] [-t step] metric[[inst]] ...\n",
+		pmProgname);
+	exit(1);
+    }
+
+    if ((sts = pmNewContext(PM_CONTEXT_ARCHIVE, archive)) < 0) {
+	fprintf(stderr, "%s: Cannot open archive \"%s\": %s\n",
+		pmProgname, archive, pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmGetArchiveLabel(&label)) < 0) {
+	fprintf(stderr, "%s: pmGetArchiveLabel: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+
+    npair = argc - optind;
+    names = &argv[optind];
+    pmids = (pmID *)malloc(npair * sizeof(pmID));
+    insts = (int *)malloc(npair * sizeof(int));
+    descs = (pmDesc *)malloc(npair * sizeof(pmDesc));
+    values = (double *)malloc(npair * count * sizeof(double));
+    if (pmids == NULL || insts == NULL || descs == NULL || values == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmProgname);
+	exit(1);
+    }
+
+    for (i = 0; i < npair; i++) {
+	char	*name = strdup(names[i]);
+	char	*inst = NULL;
+
+	if ((p = strchr(name, '[')) != NULL) {
+	    *p++ = '\0';
+	    inst = p;
+	    if ((p = strchr(inst, ']')) != NULL)
+		*p = '\0';
+	}
+	if ((sts = pmLookupName(1, &name, &pmids[i])) < 0) {
+	    fprintf(stderr, "%s: pmLookupName(%s): %s\n", pmProgname, name, pmErrStr(sts));
+	    exit(1);
+	}
+	if ((sts = pmLookupDesc(pmids[i], &descs[i])) < 0) {
+	    fprintf(stderr, "%s: pmLookupDesc(%s): %s\n", pmProgname, name, pmErrStr(sts));
+	    exit(1);
+	}
+	if (inst == NULL)
+	    insts[i] = PM_IN_NULL;
+	else if ((insts[i] = pmLookupInDomArchive(descs[i].indom, inst)) < 0) {
+	    fprintf(stderr, "%s: pmLookupInDomArchive(%s[%s]): %s\n",
+		    pmProgname, name, inst, pmErrStr(insts[i]));
+	    exit(1);
+	}
+	free(name);
+    }
+
+    start.tv_sec = label.ll_start.tv_sec + (int)offset;
+    start.tv_usec = label.ll_start.tv_usec + (int)((offset - (int)offset) * 1000000);
+    if (start.tv_usec >= 1000000) {
+	start.tv_sec++;
+	start.tv_usec -= 1000000;
+    }
+    delta.tv_sec = (int)step;
+    delta.tv_usec = (int)((step - (int)step) * 1000000);
+
+    sts = pmFetchInterpRange(npair, pmids, insts, &start, &delta, count, values);
+    if (sts < 0) {
+	printf("pmFetchInterpRange: %s\n", pmErrStr(sts));
+	exit(0);
+    }
+    printf("pmFetchInterpRange: %d values\n", sts);
+
+    printf("%4s", "step");
+    for (i = 0; i < npair; i++)
+	printf(" %12.12s", names[i]);
+    putchar('\n');
+    for (k = 0; k < count; k++) {
+	printf("%4d", k);
+	for (i = 0; i < npair; i++)
+	    print_value(values[i * count + k]);
+	putchar('\n');
+    }
+
+    /* now the long way, a pmFetch per step, and compare */
+    for (i = 0; i < npair; i++) {
+	if ((sts = pmSetMode(PM_MODE_INTERP, &start, (int)(step * 1000))) < 0) {
+	    fprintf(stderr, "%s: pmSetMode: %s\n", pmProgname, pmErrStr(sts));
+	    exit(1);
+	}
+	for (k = 0; k < count; k++) {
+	    v = fetch_one(pmids[i], &descs[i], insts[i]);
+	    if (isnan(v) && isnan(values[i * count + k]))
+		continue;
+	    if (isnan(v) || isnan(values[i * count + k]) ||
+		fabs(v - values[i * count + k]) > 1e-9 * fabs(v)) {
+		printf("%s step %d: pmFetch", names[i], k);
+		print_value(v);
+		printf(" pmFetchInterpRange");
+		print_value(values[i * count + k]);
+		putchar('\n');
+		mismatch++;
+	    }
+	}
+    }
+    printf("%d mismatches against pmFetch\n", mismatch);
+
+    return 0;
+}
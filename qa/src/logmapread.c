@@ -0,0 +1,159 @@
+/*
+ * Read every record of the first volume of an archive forwards, then
+ * backwards, twice over: through __pmLogRead() on the context's own
+ * stream (decoded from the volume's mapping when it can be) and on a
+ * separate stdio stream (peek mode, never mapped), and compare them.
+ * With -g, the volume is grown to the length of another volume once
+ * the first forward pass reaches its end, and the reads carry on.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+
+static __pmLogCtl	*lcp;
+static FILE		*peek;
+
+/* dump a result to a string, for comparison */
+static char *
+dump(pmResult *rp)
+{
+    char	*buf = NULL;
+    size_t	len = 0;
+    FILE	*f;
+
+    if ((f = open_memstream(&buf, &len)) == NULL) {
+	fprintf(stderr, "%s: open_memstream: %s\n", pmProgname, osstrerror());
+	exit(1);
+    }
+    __pmDumpResult(f, rp);
+    fclose(f);
+    return buf;
+}
+
+/*
+ * Read both streams in mode until either fails, and report how many
+ * records matched and how each one ended.
+ */
+static void
+pass(char *what, int mode)
+{
+    pmResult	*mrp, *srp;
+    char	*mbuf, *sbuf;
+    int		msts, ssts;
+    int		nrec = 0, differ = 0;
+
+    for ( ; ; ) {
+	msts = __pmLogRead(lcp, mode, NULL, &mrp, PMLOGREAD_NEXT);
+	ssts = __pmLogRead(lcp, mode, peek, &srp, PMLOGREAD_NEXT);
+	if (msts < 0 || ssts < 0)
+	    break;
+	mbuf = dump(mrp);
+	sbuf = dump(srp);
+	/* skip the result's address, which always differs */
+	if (strcmp(strstr(mbuf, "timestamp:"), strstr(sbuf, "timestamp:")) != 0) {
+	    if (differ++ == 0)
+		printf("first difference, record %d:\n%s---\n%s", nrec, mbuf, sbuf);
+	}
+	nrec++;
+	free(mbuf);
+	free(sbuf);
+	pmFreeResult(mrp);
+	pmFreeResult(srp);
+    }
+    if (msts >= 0)
+	pmFreeResult(mrp);
+    if (ssts >= 0)
+	pmFreeResult(srp);
+    printf("%s: %d records, %d different\n", what, nrec, differ);
+    printf("    end: %s", msts < 0 ? pmErrStr(msts) : "record");
+    printf(" vs %s\n", ssts < 0 ? pmErrStr(ssts) : "record");
+    if (ftell(lcp->l_mfp) != ftell(peek))
+	printf("    positions differ: %ld vs %ld\n",
+		ftell(lcp->l_mfp), ftell(peek));
+}
+
+/* append the rest of the volume from, to the volume to */
+static void
+grow(char *to, char *from)
+{
+    FILE	*in, *out;
+    char	buf[4096];
+    size_t	n;
+
+    if ((in = fopen(from, "r")) == NULL || (out = fopen(to, "a")) == NULL) {
+	fprintf(stderr, "%s: cannot grow %s from %s: %s\n",
+		pmProgname, to, from, osstrerror());
+	exit(1);
+    }
+    fseek(out, 0L, SEEK_END);
+    fseek(in, ftell(out), SEEK_SET);
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+	fwrite(buf, 1, n, out);
+    fclose(in);
+    fclose(out);
+}
+
+int
+main(int argc, char **argv)
+{
+    int		c, ctx;
+    int		errflag = 0;
+    char	*growfrom = NULL;
+    char	volume[MAXPATHLEN];
+    long	start;
+    __pmContext	*ctxp;
+    static char	*usage = "[-g volume] archive";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "g:")) != EOF) {
+	switch (c) {
+	case 'g':	/* grow the volume after the first pass */
+	    growfrom = optarg;
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (errflag || optind != argc - 1) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    if ((ctx = pmNewContext(PM_CONTEXT_ARCHIVE, argv[optind])) < 0) {
+	fprintf(stderr, "%s: Cannot open archive \"%s\": %s\n",
+		pmProgname, argv[optind], pmErrStr(ctx));
+	exit(1);
+    }
+    if ((ctxp = __pmHandleToPtr(ctx)) == NULL) {
+	fprintf(stderr, "%s: __pmHandleToPtr failed\n", pmProgname);
+	exit(1);
+    }
+    lcp = ctxp->c_archctl->ac_log;
+    PM_UNLOCK(ctxp->c_lock);
+    printf("volume %s mapped\n", lcp->l_mfmap != NULL ? "is" : "is not");
+
+    snprintf(volume, sizeof(volume), "%s.0", argv[optind]);
+    if ((peek = fopen(volume, "r")) == NULL) {
+	fprintf(stderr, "%s: Cannot open \"%s\": %s\n",
+		pmProgname, volume, osstrerror());
+	exit(1);
+    }
+    start = sizeof(__pmLogLabel) + 2 * sizeof(int);
+    fseek(lcp->l_mfp, start, SEEK_SET);
+    fseek(peek, start, SEEK_SET);
+
+    pass("forwards", PM_MODE_FORW);
+    if (growfrom != NULL) {
+	grow(volume, growfrom);
+	pass("forwards, after growing", PM_MODE_FORW);
+    }
+    pass("backwards", PM_MODE_BACK);
+    pass("forwards again", PM_MODE_FORW);
+
+    exit(0);
+}
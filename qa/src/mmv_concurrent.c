@@ -0,0 +1,330 @@
+/*
+ * Fetch MMV values through the mmv PMDA while threads update them:
+ * counters (sharded with -s, else updated by atomic adds), an elapsed
+ * time and a string, the last two written under the metric seqlock.
+ * Fetched counters and elapsed times must never go backwards, strings
+ * must never be torn, and the final values must count every update.
+ * With -d another thread takes the string's seqlock first and holds it
+ * across a sleep, as a writer descheduled mid-write would; the other
+ * writers must wait for it rather than take the lock over.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pcp/mmv_stats.h>
+#include <pcp/mmv_dev.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define MMV_DOMAIN	70
+#define CLUSTER		42
+#define STRLEN		200
+
+static mmv_instances_t	instances[] = {
+    { 0, "a" },
+    { 1, "b" },
+};
+
+static mmv_indom_t	indoms[] = {
+    {	.serial = 1,
+	.count = 2,
+	.instances = instances,
+    },
+};
+
+static mmv_metric_t	metrics[] = {
+    {	.name = "counter",
+	.item = 1,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+	.indom = 1,
+    },
+    {	.name = "total",
+	.item = 2,
+	.type = MMV_TYPE_DOUBLE,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+    },
+    {	.name = "busy",
+	.item = 3,
+	.type = MMV_TYPE_ELAPSED,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,1,0,0,PM_TIME_USEC,0),
+    },
+    {	.name = "state",
+	.item = 4,
+	.type = MMV_TYPE_STRING,
+	.semantics = MMV_SEM_INSTANT,
+    },
+};
+#define NMETRICS	(sizeof(metrics) / sizeof(metrics[0]))
+
+static void		*addr;
+static int		iterations = 100000;
+static int		running;
+static int		held;
+static int		stolen;
+
+static void *
+update(void *arg)
+{
+    int		me = (int)(long)arg;
+    int		i;
+    char	state[STRLEN + 1];
+    pmAtomValue	*a, *b, *total, *busy, *str;
+
+    a = mmv_lookup_value_desc(addr, "counter", "a");
+    b = mmv_lookup_value_desc(addr, "counter", "b");
+    total = mmv_lookup_value_desc(addr, "total", NULL);
+    busy = mmv_lookup_value_desc(addr, "busy", NULL);
+    str = mmv_lookup_value_desc(addr, "state", NULL);
+
+    /* each thread writes a string of one letter, so a torn read shows */
+    memset(state, 'A' + me, STRLEN);
+    state[STRLEN] = '\0';
+
+    for (i = 0; i < iterations; i++) {
+	mmv_inc_value(addr, a, 1);
+	mmv_inc_value(addr, b, 2);
+	mmv_inc_value(addr, total, 0.5);
+	mmv_inc_value(addr, busy, 3);
+	if (i % 64 == 0)
+	    mmv_set_string(addr, str, state, STRLEN);
+    }
+    __atomic_fetch_sub(&running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * Take the string's seqlock as mmv_set_string does, and write half the
+ * string before sleeping; nobody else may write it until we are done.
+ */
+static void *
+hold(void *arg)
+{
+    mmv_disk_value_t	*v;
+    mmv_disk_metric_t	*m;
+    mmv_disk_string_t	*s;
+    __uint32_t		seq;
+    int			i;
+
+    v = (mmv_disk_value_t *)mmv_lookup_value_desc(addr, "state", NULL);
+    m = (mmv_disk_metric_t *)((char *)addr + v->metric);
+    s = (mmv_disk_string_t *)((char *)addr + v->extra);
+
+    do {
+	seq = __atomic_load_n(&m->sequence, __ATOMIC_ACQUIRE) & ~1;
+    } while (!__atomic_compare_exchange_n(&m->sequence, &seq, seq + 1, 0,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    memset(s->payload, 'z', STRLEN / 2);
+    __atomic_store_n(&held, 1, __ATOMIC_RELEASE);
+
+    sleep(1);
+
+    if (__atomic_load_n(&m->sequence, __ATOMIC_RELAXED) != seq + 1)
+	stolen++;
+    for (i = 0; i < STRLEN / 2; i++)
+	if (s->payload[i] != 'z')
+	    stolen++;
+    memset(s->payload + STRLEN / 2, 'z', STRLEN / 2);
+    s->payload[STRLEN] = '\0';
+    __atomic_store_n(&held, 0, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&m->sequence, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * Fetch every value, check it against the previous fetch, and keep it.
+ * Returns the number of problems found.
+ */
+static int
+check(pmID *pmids, double *last, int verbose)
+{
+    pmResult	*rp;
+    pmValueSet	*vsp;
+    pmAtomValue	atom;
+    double	v;
+    char	*p;
+    int		i, j, sts, bad = 0;
+    int		holding;
+
+    /* a fetch may give up on the string while its writer holds the lock */
+    holding = __atomic_load_n(&held, __ATOMIC_ACQUIRE);
+    if ((sts = pmFetch(NMETRICS, pmids, &rp)) < 0) {
+	fprintf(stderr, "%s: pmFetch: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    for (i = 0; i < rp->numpmid; i++) {
+	vsp = rp->vset[i];
+	if (vsp->numval != (metrics[i].indom ? 2 : 1)) {
+	    printf("%s: numval %d\n", metrics[i].name, vsp->numval);
+	    bad++;
+	    continue;
+	}
+	for (j = 0; j < vsp->numval; j++) {
+	    if (metrics[i].type == MMV_TYPE_STRING) {
+		pmExtractValue(vsp->valfmt, &vsp->vlist[j],
+				PM_TYPE_STRING, &atom, PM_TYPE_STRING);
+		if (holding) {
+		    free(atom.cp);
+		    continue;
+		}
+		if (strlen(atom.cp) != STRLEN && atom.cp[0] != '\0') {
+		    printf("%s: length %d\n", metrics[i].name, (int)strlen(atom.cp));
+		    bad++;
+		}
+		for (p = atom.cp; *p; p++) {
+		    if (*p != atom.cp[0]) {
+			printf("%s: torn \"%s\"\n", metrics[i].name, atom.cp);
+			bad++;
+			break;
+		    }
+		}
+		if (verbose)
+		    printf("%s: %d characters\n", metrics[i].name,
+				(int)strlen(atom.cp));
+		free(atom.cp);
+		continue;
+	    }
+	    pmExtractValue(vsp->valfmt, &vsp->vlist[j],
+			    metrics[i].type == MMV_TYPE_DOUBLE ? PM_TYPE_DOUBLE :
+			    metrics[i].type == MMV_TYPE_U64 ? PM_TYPE_U64 : PM_TYPE_64,
+			    &atom, PM_TYPE_DOUBLE);
+	    v = atom.d;
+	    if (v < last[2 * i + j]) {
+		printf("%s[%d]: went backwards, %.1f after %.1f\n",
+			metrics[i].name, vsp->vlist[j].inst, v, last[2 * i + j]);
+		bad++;
+	    }
+	    last[2 * i + j] = v;
+	    if (verbose) {
+		if (metrics[i].indom)
+		    printf("%s[%s]: %.1f\n", metrics[i].name,
+			    instances[vsp->vlist[j].inst].external, v);
+		else
+		    printf("%s: %.1f\n", metrics[i].name, v);
+	    }
+	}
+    }
+    pmFreeResult(rp);
+    return bad;
+}
+
+int
+main(int argc, char **argv)
+{
+    int		c, i, sts;
+    int		errflag = 0;
+    int		dflag = 0;
+    int		nthreads = 4;
+    int		nfetch = 0;
+    int		bad = 0;
+    char	*errmsg;
+    char	*endnum;
+    pthread_t	*tids;
+    pthread_t	holder;
+    pmID	pmids[NMETRICS];
+    double	last[2 * NMETRICS];
+    mmv_stats_flags_t	flags = 0;
+    static char	*usage = "[-ds] [-K spec] [-n iterations] [-t threads]";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "dK:n:st:")) != EOF) {
+	switch (c) {
+	case 'd':	/* string lock holder descheduled */
+	    dflag = 1;
+	    break;
+	case 'K':	/* local PMDA spec */
+	    if ((errmsg = __pmSpecLocalPMDA(optarg)) != NULL) {
+		fprintf(stderr, "%s: -K %s: %s\n", pmProgname, optarg, errmsg);
+		errflag++;
+	    }
+	    break;
+	case 'n':	/* updates per thread */
+	    iterations = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || iterations <= 0) {
+		fprintf(stderr, "%s: -n requires a positive numeric argument\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+	case 's':	/* sharded counters */
+	    flags |= MMV_FLAG_SHARDED;
+	    break;
+	case 't':	/* updating threads */
+	    nthreads = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || nthreads <= 0 || nthreads > 26) {
+		fprintf(stderr, "%s: -t requires a numeric argument from 1 to 26\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (errflag || optind != argc) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    addr = mmv_stats_init("concurrent", CLUSTER, flags,
+			  metrics, NMETRICS, indoms, 1);
+    if (addr == NULL) {
+	fprintf(stderr, "%s: mmv_stats_init: %s\n", pmProgname, osstrerror());
+	exit(1);
+    }
+
+    if ((sts = pmNewContext(PM_CONTEXT_LOCAL, NULL)) < 0) {
+	fprintf(stderr, "%s: pmNewContext: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    for (i = 0; i < NMETRICS; i++)
+	pmids[i] = pmid_build(MMV_DOMAIN, CLUSTER, metrics[i].item);
+    memset(last, 0, sizeof(last));
+    bad += check(pmids, last, 0);
+
+    if ((tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t))) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmProgname);
+	exit(1);
+    }
+    if (dflag) {
+	if ((sts = pthread_create(&holder, NULL, hold, NULL)) != 0) {
+	    fprintf(stderr, "%s: pthread_create: %s\n", pmProgname, strerror(sts));
+	    exit(1);
+	}
+	while (!__atomic_load_n(&held, __ATOMIC_ACQUIRE))
+	    sched_yield();
+    }
+    running = nthreads;
+    for (i = 0; i < nthreads; i++) {
+	if ((sts = pthread_create(&tids[i], NULL, update, (void *)(long)i)) != 0) {
+	    fprintf(stderr, "%s: pthread_create: %s\n", pmProgname, strerror(sts));
+	    exit(1);
+	}
+    }
+    while (__atomic_load_n(&running, __ATOMIC_ACQUIRE) > 0) {
+	bad += check(pmids, last, 0);
+	nfetch++;
+    }
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    if (dflag) {
+	pthread_join(holder, NULL);
+	printf("string lock %s while its holder slept\n",
+		stolen ? "taken over" : "held");
+	bad += stolen;
+    }
+
+    printf("%d thread%s x %d updates%s, %s fetches during updates, %d problems\n",
+	    nthreads, nthreads == 1 ? "" : "s", iterations, flags ? ", sharded" : "",
+	    nfetch > 0 ? "some" : "no", bad);
+    bad += check(pmids, last, 1);
+
+    mmv_stats_stop("concurrent", addr);
+    exit(bad != 0);
+}
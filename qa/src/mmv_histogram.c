@@ -0,0 +1,108 @@
+/*
+ * Write an MMV file with two histograms, one with an instance domain,
+ * and record a fixed set of values in them - for checking mmvdump and
+ * the count, sum, bucket and percentile metrics of the mmv PMDA.
+ * -c and -i choose the cluster and the first item number, so that
+ * more than one such file can share a cluster, and -r records the
+ * values that many times over.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/mmv_stats.h>
+
+static mmv_instances_t	instances[] = {
+    { 0, "read" },
+    { 1, "write" },
+    { 2, "sync" },
+};
+
+static mmv_indom_t	indoms[] = {
+    {	.serial = 1,
+	.count = 3,
+	.instances = instances,
+	.shorttext = "I/O operations",
+    },
+};
+
+static mmv_metric_t	metrics[] = {
+    {	.name = "latency",
+	.item = 1,
+	.type = MMV_TYPE_HISTOGRAM,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,1,0,0,PM_TIME_USEC,0),
+	.shorttext = "request latency",
+    },
+    {	.name = "size",
+	.item = 2,
+	.type = MMV_TYPE_HISTOGRAM,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(1,0,0,PM_SPACE_BYTE,0,0),
+	.indom = 1,
+	.shorttext = "I/O sizes",
+    },
+};
+
+int
+main(int argc, char **argv)
+{
+    void	*addr;
+    pmAtomValue	*latency, *rd, *wr;
+    int		c, i, r;
+    int		repeat = 1;
+    int		cluster = 0;
+    int		item = 1;
+    char	*file = "histogram";
+
+    while ((c = getopt(argc, argv, "c:i:r:")) != EOF) {
+	switch (c) {
+	case 'c':
+	    cluster = atoi(optarg);
+	    break;
+	case 'i':
+	    item = atoi(optarg);
+	    break;
+	case 'r':
+	    repeat = atoi(optarg);
+	    break;
+	default:
+	    fprintf(stderr, "Usage: %s [-c cluster] [-i item] [-r repeat] [file]\n", argv[0]);
+	    return 1;
+	}
+    }
+    if (optind < argc)
+	file = argv[optind];
+    metrics[0].item = item;
+    metrics[1].item = item + 1;
+
+    addr = mmv_stats_init(file, cluster, 0, metrics, 2, indoms, 1);
+    if (!addr) {
+	fprintf(stderr, "mmv_stats_init failed : %s\n", strerror(errno));
+	return 1;
+    }
+
+    latency = mmv_lookup_value_desc(addr, "latency", NULL);
+    rd = mmv_lookup_value_desc(addr, "size", "read");
+    wr = mmv_lookup_value_desc(addr, "size", "write");
+    for (r = 0; r < repeat; r++) {
+	/* 1 to 1000, once each */
+	for (i = 1; i <= 1000; i++)
+	    mmv_record_value(addr, latency, i);
+
+	/* a few large values, and some small and huge ones; sync stays empty */
+	for (i = 0; i < 90; i++)
+	    mmv_record_value(addr, rd, 4096);
+	for (i = 0; i < 10; i++)
+	    mmv_record_value(addr, rd, 65536);
+	for (i = 0; i < 5; i++)
+	    mmv_record_value(addr, wr, 0);
+	for (i = 0; i < 4; i++)
+	    mmv_record_value(addr, wr, 7);
+	mmv_record_value(addr, wr, -1);		/* recorded as zero */
+	mmv_stats_record(addr, "size", "write", (double)(1ULL << 40));
+    }
+
+    mmv_stats_stop(file, addr);
+    return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ * Exercise the value indexes of libpcp_mmv (mmv_lookup_value_desc) and
+ * of the mmv PMDA: duplicate metric names, singular metrics looked up
+ * with and without an instance, a second file on the same cluster, and
+ * a metric renamed in place with a new generation number.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pcp/mmv_stats.h>
+#include <pcp/mmv_dev.h>
+
+#define MMV_DOMAIN	70
+#define CLUSTER		60
+
+static mmv_instances_t	instances1[] = {
+    { 0, "x" },
+    { 1, "y" },
+};
+
+static mmv_instances_t	instances2[] = {
+    { 2, "z" },
+};
+
+static mmv_indom_t	indoms1[] = {
+    {	.serial = 1,
+	.count = 2,
+	.instances = instances1,
+    },
+};
+
+static mmv_indom_t	indoms2[] = {
+    {	.serial = 1,
+	.count = 1,
+	.instances = instances2,
+    },
+};
+
+static mmv_metric_t	metrics1[] = {
+    {	.name = "dup",
+	.item = 1,
+	.type = MMV_TYPE_U32,
+	.semantics = MMV_SEM_INSTANT,
+    },
+    {	.name = "dup",
+	.item = 2,
+	.type = MMV_TYPE_U32,
+	.semantics = MMV_SEM_INSTANT,
+    },
+    {	.name = "multi",
+	.item = 3,
+	.type = MMV_TYPE_U32,
+	.semantics = MMV_SEM_INSTANT,
+	.indom = 1,
+    },
+    {	.name = "single",
+	.item = 4,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_INSTANT,
+    },
+    {	.name = "alpha",
+	.item = 5,
+	.type = MMV_TYPE_U32,
+	.semantics = MMV_SEM_INSTANT,
+    },
+};
+
+/* the same cluster, and an instance of item 3 the first file lacks */
+static mmv_metric_t	metrics2[] = {
+    {	.name = "multi",
+	.item = 3,
+	.type = MMV_TYPE_U32,
+	.semantics = MMV_SEM_INSTANT,
+	.indom = 1,
+    },
+    {	.name = "beta",
+	.item = 6,
+	.type = MMV_TYPE_U32,
+	.semantics = MMV_SEM_INSTANT,
+    },
+};
+
+static void	*addr1, *addr2;
+
+/* look a value up, and set it if found */
+static void
+lookup(void *addr, char *file, char *metric, char *inst, double val)
+{
+    pmAtomValue	*ap;
+
+    ap = mmv_lookup_value_desc(addr, metric, inst);
+    printf("lookup %s %s[%s]: %s", file, metric, inst ? inst : "NULL",
+		ap ? "found" : "not found");
+    if (ap != NULL) {
+	mmv_set_value(addr, ap, val);
+	printf(", set to %.0f", val);
+    }
+    putchar('\n');
+}
+
+/* fetch items 1 to 6 of the cluster through the PMDA */
+static void
+fetch(void)
+{
+    pmID	pmids[6];
+    pmResult	*rp;
+    pmValueSet	*vsp;
+    pmAtomValue	atom;
+    int		i, j, sts;
+
+    for (i = 0; i < 6; i++)
+	pmids[i] = pmid_build(MMV_DOMAIN, CLUSTER, i + 1);
+    if ((sts = pmFetch(6, pmids, &rp)) < 0) {
+	fprintf(stderr, "%s: pmFetch: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    for (i = 0; i < rp->numpmid; i++) {
+	vsp = rp->vset[i];
+	printf("fetch %s:", pmIDStr(vsp->pmid));
+	if (vsp->numval < 0)
+	    printf(" %s", pmErrStr(vsp->numval));
+	else if (vsp->numval == 0)
+	    printf(" no values");
+	for (j = 0; j < vsp->numval; j++) {
+	    pmExtractValue(vsp->valfmt, &vsp->vlist[j],
+			i == 3 ? PM_TYPE_U64 : PM_TYPE_U32, &atom, PM_TYPE_DOUBLE);
+	    if (vsp->vlist[j].inst == PM_IN_NULL)
+		printf(" %.0f", atom.d);
+	    else
+		printf(" [%d] %.0f", vsp->vlist[j].inst, atom.d);
+	}
+	putchar('\n');
+    }
+    pmFreeResult(rp);
+}
+
+/* rename a metric in place, with a new generation as writers must */
+static void
+rename_metric(void *addr, char *from, char *to)
+{
+    mmv_disk_header_t	*hdr = (mmv_disk_header_t *)addr;
+    mmv_disk_toc_t	*toc = (mmv_disk_toc_t *)((char *)addr + sizeof(*hdr));
+    mmv_disk_metric_t	*m;
+    int			i, j;
+
+    hdr->g2 = 0;
+    for (i = 0; i < hdr->tocs; i++) {
+	if (toc[i].type != MMV_TOC_METRICS)
+	    continue;
+	m = (mmv_disk_metric_t *)((char *)addr + toc[i].offset);
+	for (j = 0; j < toc[i].count; j++)
+	    if (strcmp(m[j].name, from) == 0)
+		strncpy(m[j].name, to, MMV_NAMEMAX);
+    }
+    hdr->g1++;
+    hdr->g2 = hdr->g1;
+}
+
+int
+main(int argc, char **argv)
+{
+    int		c, sts;
+    int		errflag = 0;
+    char	*errmsg;
+    static char	*usage = "[-K spec]";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "K:")) != EOF) {
+	switch (c) {
+	case 'K':	/* local PMDA spec */
+	    if ((errmsg = __pmSpecLocalPMDA(optarg)) != NULL) {
+		fprintf(stderr, "%s: -K %s: %s\n", pmProgname, optarg, errmsg);
+		errflag++;
+	    }
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (errflag || optind != argc) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    addr1 = mmv_stats_init("index1", CLUSTER, 0, metrics1,
+		sizeof(metrics1) / sizeof(metrics1[0]), indoms1, 1);
+    addr2 = mmv_stats_init("index2", CLUSTER, 0, metrics2,
+		sizeof(metrics2) / sizeof(metrics2[0]), indoms2, 1);
+    if (addr1 == NULL || addr2 == NULL) {
+	fprintf(stderr, "%s: mmv_stats_init: %s\n", pmProgname, osstrerror());
+	exit(1);
+    }
+    if ((sts = pmNewContext(PM_CONTEXT_LOCAL, NULL)) < 0) {
+	fprintf(stderr, "%s: pmNewContext: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+
+    printf("=== duplicate names, first one wins ===\n");
+    lookup(addr1, "index1", "dup", NULL, 11);
+
+    printf("\n=== singular and multi-instance metrics ===\n");
+    lookup(addr1, "index1", "single", NULL, 40);
+    lookup(addr1, "index1", "single", "x", 41);
+    lookup(addr1, "index1", "multi", NULL, 30);
+    lookup(addr1, "index1", "multi", "x", 30);
+    lookup(addr1, "index1", "multi", "y", 31);
+    lookup(addr1, "index1", "multi", "z", 32);
+    lookup(addr1, "index1", "nosuch", NULL, 0);
+
+    printf("\n=== two files on one cluster, one index each ===\n");
+    lookup(addr1, "index1", "beta", NULL, 0);
+    lookup(addr2, "index2", "beta", NULL, 60);
+    lookup(addr2, "index2", "multi", "z", 32);
+    lookup(addr1, "index1", "alpha", NULL, 50);
+    fetch();
+
+    printf("\n=== rename alpha to omega, with a new generation ===\n");
+    rename_metric(addr1, "alpha", "omega");
+    lookup(addr1, "index1", "alpha", NULL, 0);
+    lookup(addr1, "index1", "omega", NULL, 55);
+    lookup(addr1, "index1", "multi", "y", 33);
+    fetch();
+
+    mmv_stats_stop("index2", addr2);
+    mmv_stats_stop("index1", addr1);
+    exit(0);
+}
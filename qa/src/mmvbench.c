@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * Create an MMV file with a given number of metrics and instances, then
+ * time the application side lookups (mmv_stats_inc by name) and the PMDA
+ * side fetches of every value, to show how both scale with value count.
+ *
+ * By default values are fetched from pmcd on the local host; -L uses a
+ * local context instead, with the mmv DSO PMDA from pmcd.conf or -K.
+ *
+ * With -t, that many threads increment every value concurrently, and the
+ * fetched values are checked for lost updates.  -s uses sharded counters,
+ * -H histograms (each thread records a value, the counts are checked).
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pcp/mmv_stats.h>
+#include <pthread.h>
+
+static int		nmetrics = 100;
+static int		ninsts = 100;
+static int		histograms;
+static void		*addr;
+static mmv_metric_t	*metrics;
+static mmv_instances_t	*insts;
+
+static double
+since(struct timeval *start)
+{
+    struct timeval	now;
+
+    gettimeofday(&now, NULL);
+    return __pmtimevalSub(&now, start);
+}
+
+static void *
+update(void *arg)
+{
+    int		i, j;
+
+    (void)arg;
+    for (i = 0; i < nmetrics; i++)
+	for (j = 0; j < ninsts; j++)
+	    if (histograms)
+		mmv_stats_record(addr, metrics[i].name, insts[j].external, j);
+	    else
+		mmv_stats_inc(addr, metrics[i].name, insts[j].external);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    int		c;
+    int		sts;
+    int		errflag = 0;
+    int		count = 10;
+    int		local = 0;
+    int		nthreads = 1;
+    int		i, j, k;
+    mmv_stats_flags_t	flags = 0;
+    pthread_t	*tids;
+    char	*spec = NULL;
+    char	*errmsg;
+    char	name[MMV_NAMEMAX + 24];
+    char	**names;
+    pmID	*pmids;
+    pmResult	*rp;
+    pmAtomValue	atom;
+    mmv_indom_t		indom;
+    struct timeval	start;
+    double	elapsed;
+    static char	*usage = "[-HLs] [-K spec] [-c count] [-m metrics] [-i instances] [-t threads]";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "c:Hi:K:Lm:st:")) != EOF) {
+	switch (c) {
+
+	case 'c':	/* fetch count */
+	    count = atoi(optarg);
+	    break;
+
+	case 'H':	/* histograms */
+	    histograms = 1;
+	    break;
+
+	case 'i':	/* instances per metric */
+	    ninsts = atoi(optarg);
+	    break;
+
+	case 'K':	/* local PMDA spec */
+	    spec = optarg;
+	    break;
+
+	case 'L':	/* local context */
+	    local = 1;
+	    break;
+
+	case 'm':	/* number of metrics */
+	    nmetrics = atoi(optarg);
+	    break;
+
+	case 's':	/* sharded counters */
+	    flags |= MMV_FLAG_SHARDED;
+	    break;
+
+	case 't':	/* updating threads */
+	    nthreads = atoi(optarg);
+	    break;
+
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+
+    if (errflag || optind != argc || nmetrics <= 0 || ninsts <= 0 ||
+	count <= 0 || nthreads <= 0) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    metrics = (mmv_metric_t *)calloc(nmetrics, sizeof(mmv_metric_t));
+    insts = (mmv_instances_t *)calloc(ninsts, sizeof(mmv_instances_t));
+    names = (char **)calloc(nmetrics, sizeof(char *));
+    pmids = (pmID *)calloc(nmetrics, sizeof(pmID));
+    tids = (pthread_t *)calloc(nthreads, sizeof(pthread_t));
+    if (metrics == NULL || insts == NULL || names == NULL || pmids == NULL ||
+	tids == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmProgname);
+	exit(1);
+    }
+    for (i = 0; i < ninsts; i++) {
+	insts[i].internal = i;
+	snprintf(insts[i].external, MMV_NAMEMAX, "inst%d", i);
+    }
+    memset(&indom, 0, sizeof(indom));
+    indom.serial = 1;
+    indom.count = ninsts;
+    indom.instances = insts;
+    for (i = 0; i < nmetrics; i++) {
+	snprintf(metrics[i].name, MMV_NAMEMAX, "m%d", i);
+	metrics[i].item = i + 1;
+	metrics[i].type = histograms ? MMV_TYPE_HISTOGRAM : MMV_TYPE_U64;
+	metrics[i].semantics = MMV_SEM_COUNTER;
+	metrics[i].indom = 1;
+    }
+
+    addr = mmv_stats_init("mmvbench", 0, flags, metrics, nmetrics, &indom, 1);
+    if (addr == NULL) {
+	fprintf(stderr, "%s: mmv_stats_init: %s\n", pmProgname, osstrerror());
+	exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < nthreads; i++) {
+	if ((sts = pthread_create(&tids[i], NULL, update, NULL)) != 0) {
+	    fprintf(stderr, "%s: pthread_create: %s\n", pmProgname, strerror(sts));
+	    exit(1);
+	}
+    }
+    for (i = 0; i < nthreads; i++)
+	pthread_join(tids[i], NULL);
+    elapsed = since(&start);
+    printf("%d values: lookup by name %.3f usec per value, %d thread%s%s%s\n",
+	nmetrics * ninsts, elapsed * 1e6 / (nmetrics * ninsts),
+	nthreads, nthreads == 1 ? "" : "s", flags ? ", sharded" : "",
+	histograms ? ", histograms" : "");
+
+    if (local) {
+	if (spec != NULL && (errmsg = __pmSpecLocalPMDA(spec)) != NULL) {
+	    fprintf(stderr, "%s: -K %s: %s\n", pmProgname, spec, errmsg);
+	    exit(1);
+	}
+	sts = pmNewContext(PM_CONTEXT_LOCAL, NULL);
+    }
+    else
+	sts = pmNewContext(PM_CONTEXT_HOST, "local:");
+    if (sts < 0) {
+	fprintf(stderr, "%s: pmNewContext: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+
+    for (i = 0; i < nmetrics; i++) {
+	snprintf(name, sizeof(name), "mmv.mmvbench.%s%s", metrics[i].name,
+		histograms ? ".count" : "");
+	names[i] = strdup(name);
+    }
+    if ((sts = pmLookupName(nmetrics, names, pmids)) < 0) {
+	fprintf(stderr, "%s: pmLookupName: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < count; i++) {
+	if ((sts = pmFetch(nmetrics, pmids, &rp)) < 0) {
+	    fprintf(stderr, "%s: pmFetch: %s\n", pmProgname, pmErrStr(sts));
+	    exit(1);
+	}
+	for (j = 0; j < rp->numpmid; j++) {
+	    if (rp->vset[j]->numval != ninsts) {
+		fprintf(stderr, "%s: %s: %d values, expected %d\n", pmProgname,
+			names[j], rp->vset[j]->numval, ninsts);
+		exit(1);
+	    }
+	    for (k = 0; k < ninsts; k++) {
+		pmExtractValue(rp->vset[j]->valfmt, &rp->vset[j]->vlist[k],
+			PM_TYPE_U64, &atom, PM_TYPE_U64);
+		if (atom.ull != nthreads) {
+		    fprintf(stderr, "%s: %s[%d]: value %llu, expected %d\n",
+			pmProgname, names[j], rp->vset[j]->vlist[k].inst,
+			(unsigned long long)atom.ull, nthreads);
+		    exit(1);
+		}
+	    }
+	}
+	pmFreeResult(rp);
+    }
+    elapsed = since(&start);
+    printf("%d values: fetch %.3f msec, %.3f usec per value\n",
+	nmetrics * ninsts, elapsed * 1e3 / count,
+	elapsed * 1e6 / ((double)count * nmetrics * ninsts));
+
+    mmv_stats_stop("mmvbench", addr);
+    exit(0);
+}
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2026 Red Hat.
+ *
+ * exercise multi-threaded archive contexts - each thread repeatedly
+ * creates a context for every archive, switches between them fetching
+ * one record at a time until all are at the end, and destroys them;
+ * every pass must see the same records as a single-threaded pass
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pthread.h>
+
+typedef struct {
+    char		*name;		/* archive, or archive directory */
+    int			npmid;		/* metrics in its PMNS */
+    pmID		*pmidlist;
+    unsigned long	nrec;		/* records, from the reference pass */
+    __uint64_t		hash;		/* of all the records */
+} archive_t;
+
+static archive_t	*archive;
+static int		narchive;
+static int		iterations = 4;
+static int		nbad;
+
+static pthread_mutex_t	bad_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a, over everything in a result but its address */
+static __uint64_t
+hash(__uint64_t h, const void *p, size_t len)
+{
+    const unsigned char	*cp = (const unsigned char *)p;
+
+    while (len-- > 0) {
+	h ^= *cp++;
+	h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static __uint64_t
+hash_result(__uint64_t h, pmResult *rp)
+{
+    pmValueSet	*vsp;
+    pmValue	*vp;
+    int		i, j;
+
+    h = hash(h, &rp->timestamp.tv_sec, sizeof(rp->timestamp.tv_sec));
+    h = hash(h, &rp->timestamp.tv_usec, sizeof(rp->timestamp.tv_usec));
+    for (i = 0; i < rp->numpmid; i++) {
+	vsp = rp->vset[i];
+	h = hash(h, &vsp->pmid, sizeof(vsp->pmid));
+	h = hash(h, &vsp->numval, sizeof(vsp->numval));
+	for (j = 0; j < vsp->numval; j++) {
+	    vp = &vsp->vlist[j];
+	    h = hash(h, &vp->inst, sizeof(vp->inst));
+	    if (vsp->valfmt == PM_VAL_INSITU)
+		h = hash(h, &vp->value.lval, sizeof(vp->value.lval));
+	    else
+		h = hash(h, vp->value.pval, vp->value.pval->vlen);
+	}
+    }
+    return h;
+}
+
+static void
+dometric(const char *name, void *closure)
+{
+    archive_t	*ap = (archive_t *)closure;
+    char	*namelist[1];
+    pmID	pmid;
+
+    namelist[0] = (char *)name;
+    if (pmLookupName(1, namelist, &pmid) != 1 || pmid == PM_ID_NULL)
+	return;
+    ap->pmidlist = (pmID *)realloc(ap->pmidlist, (ap->npmid + 1) * sizeof(pmID));
+    if (ap->pmidlist == NULL) {
+	fprintf(stderr, "dometric: out of memory\n");
+	exit(1);
+    }
+    ap->pmidlist[ap->npmid++] = pmid;
+}
+
+/*
+ * Single-threaded reference pass over one archive, which also finds all
+ * the metrics to fetch.
+ */
+static void
+reference(archive_t *ap)
+{
+    int		ctx;
+    int		sts;
+    pmResult	*rp;
+
+    if ((ctx = pmNewContext(PM_CONTEXT_ARCHIVE, ap->name)) < 0) {
+	fprintf(stderr, "reference: pmNewContext(%s): %s\n", ap->name, pmErrStr(ctx));
+	exit(1);
+    }
+    if ((sts = pmTraversePMNS_r("", dometric, ap)) < 0) {
+	fprintf(stderr, "reference: pmTraversePMNS_r(%s): %s\n", ap->name, pmErrStr(sts));
+	exit(1);
+    }
+    ap->hash = 14695981039346656037ULL;
+    while ((sts = pmFetch(ap->npmid, ap->pmidlist, &rp)) >= 0) {
+	ap->hash = hash_result(ap->hash, rp);
+	ap->nrec++;
+	pmFreeResult(rp);
+    }
+    if (sts != PM_ERR_EOL) {
+	fprintf(stderr, "reference: pmFetch(%s): %s\n", ap->name, pmErrStr(sts));
+	exit(1);
+    }
+    pmDestroyContext(ctx);
+}
+
+static void
+bad(void)
+{
+    pthread_mutex_lock(&bad_lock);
+    nbad++;
+    pthread_mutex_unlock(&bad_lock);
+}
+
+static void *
+func(void *arg)
+{
+    int			me = (int)(long)arg;
+    int			*ctx;
+    int			*done;
+    unsigned long	*nrec;
+    __uint64_t		*h;
+    int			ndone;
+    int			it, i, j;
+    int			sts;
+    pmResult		*rp;
+
+    ctx = (int *)malloc(narchive * sizeof(int));
+    done = (int *)malloc(narchive * sizeof(int));
+    nrec = (unsigned long *)malloc(narchive * sizeof(unsigned long));
+    h = (__uint64_t *)malloc(narchive * sizeof(__uint64_t));
+    if (ctx == NULL || done == NULL || nrec == NULL || h == NULL) {
+	fprintf(stderr, "thread %d: out of memory\n", me);
+	exit(1);
+    }
+
+    for (it = 0; it < iterations; it++) {
+	/* create in a different order each time around */
+	for (i = 0; i < narchive; i++) {
+	    j = (me + it + i) % narchive;
+	    if ((ctx[j] = pmNewContext(PM_CONTEXT_ARCHIVE, archive[j].name)) < 0) {
+		printf("thread %d: pmNewContext(%s): %s\n", me, archive[j].name, pmErrStr(ctx[j]));
+		bad();
+		pthread_exit("botch");
+	    }
+	    done[j] = 0;
+	    nrec[j] = 0;
+	    h[j] = 14695981039346656037ULL;
+	}
+
+	/* one record from each context in turn */
+	for (ndone = 0; ndone < narchive; ) {
+	    for (j = 0; j < narchive; j++) {
+		if (done[j])
+		    continue;
+		if ((sts = pmUseContext(ctx[j])) < 0) {
+		    printf("thread %d: pmUseContext(%d): %s\n", me, ctx[j], pmErrStr(sts));
+		    bad();
+		    pthread_exit("botch");
+		}
+		if ((sts = pmFetch(archive[j].npmid, archive[j].pmidlist, &rp)) < 0) {
+		    if (sts != PM_ERR_EOL) {
+			printf("thread %d: pmFetch(%s): %s\n", me, archive[j].name, pmErrStr(sts));
+			bad();
+		    }
+		    done[j] = 1;
+		    ndone++;
+		    continue;
+		}
+		h[j] = hash_result(h[j], rp);
+		nrec[j]++;
+		pmFreeResult(rp);
+	    }
+	}
+
+	for (j = 0; j < narchive; j++) {
+	    if (nrec[j] != archive[j].nrec || h[j] != archive[j].hash) {
+		printf("thread %d: pass %d: %s: %lu records, %s\n", me, it,
+			archive[j].name, nrec[j],
+			h[j] != archive[j].hash ? "different" : "same");
+		bad();
+	    }
+	}
+	for (i = narchive - 1; i >= 0; i--) {
+	    j = (me + it + i) % narchive;
+	    if ((sts = pmDestroyContext(ctx[j])) < 0) {
+		printf("thread %d: pmDestroyContext(%d): %s\n", me, ctx[j], pmErrStr(sts));
+		bad();
+	    }
+	}
+    }
+
+    free(ctx);
+    free(done);
+    free(nrec);
+    free(h);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    int		c;
+    int		i;
+    int		sts;
+    int		errflag = 0;
+    int		nthread = 4;
+    char	*endnum;
+    pthread_t	*tids;
+    static char	*usage = "[-i iterations] [-t threads] archive ...";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "i:t:")) != EOF) {
+	switch (c) {
+	case 'i':	/* passes per thread */
+	    iterations = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || iterations <= 0) {
+		fprintf(stderr, "%s: -i requires a positive numeric argument\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+	case 't':	/* threads */
+	    nthread = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || nthread <= 0) {
+		fprintf(stderr, "%s: -t requires a positive numeric argument\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (errflag || optind >= argc) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    narchive = argc - optind;
+    archive = (archive_t *)calloc(narchive, sizeof(archive_t));
+    tids = (pthread_t *)calloc(nthread, sizeof(pthread_t));
+    if (archive == NULL || tids == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmProgname);
+	exit(1);
+    }
+    for (i = 0; i < narchive; i++) {
+	archive[i].name = argv[optind + i];
+	reference(&archive[i]);
+	printf("%s: %d metrics, %lu records\n", archive[i].name,
+		archive[i].npmid, archive[i].nrec);
+    }
+
+    for (i = 0; i < nthread; i++) {
+	if ((sts = pthread_create(&tids[i], NULL, func, (void *)(long)i)) != 0) {
+	    fprintf(stderr, "%s: pthread_create: %s\n", pmProgname, strerror(sts));
+	    exit(1);
+	}
+    }
+    for (i = 0; i < nthread; i++)
+	pthread_join(tids[i], NULL);
+
+    printf("%d threads x %d passes over %d archives: %d problems\n",
+	    nthread, iterations, narchive, nbad);
+
+    exit(nbad != 0);
+}
@@ -0,0 +1,146 @@
+/*
+ * Exercise the size-classed PDU buffer allocator: every size class and
+ * the large (malloc'd) case, pins and unpins via interior addresses,
+ * per-thread cache reuse, and buffers found in one thread but released
+ * in another.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pthread.h>
+#include "localconfig.h"
+
+#define NTHREAD	4
+#define NLOOP	2000
+#define NHOLD	64
+
+static int sizes[] = { 4, 128, 129, 500, 1024, 4000, 8192, 16384, 16385, 65536 };
+static int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+
+static char	*held[NTHREAD][NHOLD];
+
+static void
+outstanding(char *tag)
+{
+    int		alloc, nfree;
+
+    __pmCountPDUBuf(0, &alloc, &nfree);
+    printf("%s: %d buffer%s in use\n", tag, alloc, alloc == 1 ? "" : "s");
+}
+
+/*
+ * Each thread finds buffers of varying sizes, pins the last word of
+ * each and unpins the first, and holds on to the most recent NHOLD
+ * for the main thread to release.
+ */
+static void *
+worker(void *arg)
+{
+    int		me = (int)(long)arg;
+    int		i, j, size;
+    char	*buf;
+
+    for (i = 0; i < NLOOP; i++) {
+	size = sizes[(i + me) % nsizes];
+	if ((buf = (char *)__pmFindPDUBuf(size)) == NULL) {
+	    fprintf(stderr, "thread %d: __pmFindPDUBuf(%d) failed\n", me, size);
+	    return NULL;
+	}
+	memset(buf, me, size);
+	__pmPinPDUBuf(&buf[(size - 1) & ~(sizeof(int) - 1)]);
+	__pmUnpinPDUBuf(buf);
+	j = i % NHOLD;
+	if (held[me][j] != NULL)
+	    __pmUnpinPDUBuf(held[me][j]);
+	held[me][j] = buf;
+    }
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    __pmPDUBufStats	before, after;
+    pthread_t		tid[NTHREAD];
+    char		*buf, *again;
+    int			i, j, size, sts;
+    int			errflag = 0;
+    int			c;
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "D:")) != EOF) {
+	switch (c) {
+	case 'D':
+	    sts = __pmParseDebug(optarg);
+	    if (sts < 0) {
+		fprintf(stderr, "%s: unrecognized debug flag specification (%s)\n",
+		    pmProgname, optarg);
+		errflag++;
+	    }
+	    else
+		pmDebug |= sts;
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (errflag || optind != argc) {
+	fprintf(stderr, "Usage: %s [-D debug]\n", pmProgname);
+	exit(1);
+    }
+
+    printf("=== single thread ===\n");
+    for (i = 0; i < nsizes; i++) {
+	size = sizes[i];
+	__pmGetPDUBufStats(&before);
+	buf = (char *)__pmFindPDUBuf(size);
+	memset(buf, 0xa5, size);
+	/* pin via the middle and the last word, unpin via the first */
+	__pmPinPDUBuf(&buf[(size / 2) & ~(sizeof(int) - 1)]);
+	__pmPinPDUBuf(&buf[(size - 1) & ~(sizeof(int) - 1)]);
+	printf("size %d:", size);
+	printf(" range %d", __pmPDUBufRange(&buf[size - 1], &again) == size && again == buf);
+	printf(" beyond %d", __pmPDUBufRange(&buf[size + sizeof(int)], &again) != size);
+	for (j = 0; j < 3; j++)
+	    printf(" unpin %d", __pmUnpinPDUBuf(buf));
+	printf(" unpin %d", __pmUnpinPDUBuf(buf));
+	/* same size again in this thread is a cache hit, unless large */
+	again = (char *)__pmFindPDUBuf(size);
+	__pmGetPDUBufStats(&after);
+	printf(" hit %d miss %d large %d\n",
+		(int)(after.hit - before.hit), (int)(after.miss - before.miss),
+		(int)(after.large - before.large));
+	__pmUnpinPDUBuf(again);
+    }
+    outstanding("single thread");
+
+    printf("=== %d threads ===\n", NTHREAD);
+    for (i = 0; i < NTHREAD; i++) {
+	if ((sts = pthread_create(&tid[i], NULL, worker, (void *)(long)i)) != 0) {
+	    fprintf(stderr, "pthread_create: %s\n", strerror(sts));
+	    exit(1);
+	}
+    }
+    for (i = 0; i < NTHREAD; i++)
+	pthread_join(tid[i], NULL);
+    outstanding("threads done");
+
+    /* release the held buffers from the main thread */
+    for (i = 0; i < NTHREAD; i++) {
+	for (j = 0; j < NHOLD; j++) {
+	    if (held[i][j] != NULL && __pmUnpinPDUBuf(held[i][j]) != 1)
+		printf("thread %d held[%d]: unpin failed\n", i, j);
+	}
+    }
+    outstanding("all released");
+
+    __pmGetPDUBufStats(&after);
+    printf("large %d\n", (int)after.large);
+
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * Run pmie over an archive with a rule file of many copies of one rule
+ * expression, and report rule evaluations per second.  In the expression
+ * %d is replaced by the rule number, so the copies may differ.
+ *
+ * Run with -u to evaluate each operator separately (PMIE_NOFUSE) for a
+ * comparison with the fused evaluators.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <sys/wait.h>
+
+int
+main(int argc, char **argv)
+{
+    int		c;
+    int		sts;
+    int		errflag = 0;
+    int		nrules = 1000;
+    int		uflag = 0;
+    int		i;
+    int		fd;
+    long	samples;
+    char	*archive = NULL;
+    char	*expr = NULL;
+    char	*pmie = NULL;
+    char	*interval = "10sec";
+    char	*endnum;
+    char	*p;
+    char	config[MAXPATHLEN];
+    char	path[MAXPATHLEN];
+    FILE	*f;
+    pid_t	pid;
+    pmLogLabel	label;
+    struct timeval	delta;
+    struct timeval	end;
+    struct timeval	before, after;
+    double	elapsed;
+    static char	*usage = "[-u] [-n rules] [-p pmie] [-t interval] -a archive -e expr";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "a:e:n:p:t:u")) != EOF) {
+	switch (c) {
+
+	case 'a':	/* archive */
+	    archive = optarg;
+	    break;
+
+	case 'e':	/* rule expression */
+	    expr = optarg;
+	    break;
+
+	case 'n':	/* number of rules */
+	    nrules = atoi(optarg);
+	    break;
+
+	case 'p':	/* pmie binary */
+	    pmie = optarg;
+	    break;
+
+	case 't':	/* evaluation interval */
+	    interval = optarg;
+	    break;
+
+	case 'u':	/* unfused evaluators */
+	    uflag = 1;
+	    break;
+
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+
+    if (errflag || optind != argc || archive == NULL || expr == NULL ||
+	nrules <= 0) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    if (pmParseInterval(interval, &delta, &endnum) < 0) {
+	fprintf(stderr, "%s: illegal -t argument\n%s", pmProgname, endnum);
+	free(endnum);
+	exit(1);
+    }
+    if ((sts = pmNewContext(PM_CONTEXT_ARCHIVE, archive)) < 0) {
+	printf("%s: Cannot open archive \"%s\": %s\n", pmProgname, archive, pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmGetArchiveLabel(&label)) < 0) {
+	printf("%s: pmGetArchiveLabel: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    if ((sts = pmGetArchiveEnd(&end)) < 0) {
+	printf("%s: pmGetArchiveEnd: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    samples = (long)(__pmtimevalSub(&end, &label.ll_start) /
+			__pmtimevalToReal(&delta)) + 1;
+
+    snprintf(config, sizeof(config), "%s/pmiebench.XXXXXX", pmGetConfig("PCP_TMP_DIR"));
+    if ((fd = mkstemp(config)) < 0 || (f = fdopen(fd, "w")) == NULL) {
+	fprintf(stderr, "%s: cannot create \"%s\": %s\n", pmProgname, config, osstrerror());
+	exit(1);
+    }
+    for (i = 0; i < nrules; i++) {
+	fprintf(f, "r%d = ", i);
+	for (p = expr; *p; p++) {
+	    if (p[0] == '%' && p[1] == 'd') {
+		fprintf(f, "%d", i);
+		p++;
+	    }
+	    else
+		fputc(*p, f);
+	}
+	fputs(";\n", f);
+    }
+    fclose(f);
+
+    if (pmie == NULL) {
+	snprintf(path, sizeof(path), "%s/pmie", pmGetConfig("PCP_BIN_DIR"));
+	pmie = path;
+    }
+    if (uflag)
+	setenv("PMIE_NOFUSE", "1", 1);
+
+    gettimeofday(&before, NULL);
+    if ((pid = fork()) == 0) {
+	if (freopen("/dev/null", "w", stdout) == NULL)
+	    exit(1);
+	execl(pmie, "pmie", "-q", "-a", archive, "-t", interval, "-c", config, NULL);
+	fprintf(stderr, "%s: cannot run \"%s\": %s\n", pmProgname, pmie, osstrerror());
+	exit(1);
+    }
+    if (pid < 0) {
+	fprintf(stderr, "%s: fork: %s\n", pmProgname, osstrerror());
+	unlink(config);
+	exit(1);
+    }
+    waitpid(pid, &sts, 0);
+    gettimeofday(&after, NULL);
+    unlink(config);
+
+    if (!WIFEXITED(sts) || WEXITSTATUS(sts) != 0) {
+	fprintf(stderr, "%s: pmie failed\n", pmProgname);
+	exit(1);
+    }
+
+    elapsed = __pmtimevalSub(&after, &before);
+    printf("%d rules, %ld samples: %.0f evaluations in %.3f sec, %.0f per sec%s\n",
+	nrules, samples, (double)nrules * samples, elapsed,
+	(double)nrules * samples / elapsed, uflag ? " (unfused)" : "");
+
+    exit(0);
+}
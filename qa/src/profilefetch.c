@@ -0,0 +1,158 @@
+/*
+ * Fetch some metrics from pmcd once, optionally with an instance profile
+ * and after a wait, and report the values.  All the lookups are done
+ * before the wait.  With -k the client disconnects that many msecs after
+ * sending the fetch, whether or not the result has arrived.
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <sys/time.h>
+
+#define MAXINST	16
+
+static void
+disconnect(int sig)
+{
+    static char	msg[] = "disconnected\n";
+
+    if (write(1, msg, sizeof(msg) - 1) < 0)
+	_exit(1);
+    _exit(0);
+}
+
+static void
+msec_to_timeval(int msec, struct timeval *tv)
+{
+    tv->tv_sec = msec / 1000;
+    tv->tv_usec = (msec % 1000) * 1000;
+}
+
+int
+main(int argc, char **argv)
+{
+    int			c, i, j, sts;
+    int			errflag = 0;
+    int			ninst = 0;
+    int			insts[MAXINST];
+    int			delay = 0;
+    int			hangup = -1;
+    int			nmetrics;
+    char		*host = "local:";
+    char		*p, *endnum;
+    pmID		*pmids;
+    pmDesc		desc;
+    pmResult		*rp;
+    pmValueSet		*vsp;
+    struct timeval	tv;
+    struct itimerval	it;
+    static char		*usage = "[-h host] [-i inst[,inst...]] [-k msec] [-w msec] metric ...";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "h:i:k:w:")) != EOF) {
+	switch (c) {
+	case 'h':	/* pmcd host */
+	    host = optarg;
+	    break;
+	case 'i':	/* instance profile, for the indom of the first metric */
+	    for (p = strtok(optarg, ","); p != NULL; p = strtok(NULL, ",")) {
+		if (ninst == MAXINST) {
+		    fprintf(stderr, "%s: at most %d instances\n", pmProgname, MAXINST);
+		    errflag++;
+		    break;
+		}
+		insts[ninst++] = (int)strtol(p, &endnum, 10);
+		if (*endnum != '\0') {
+		    fprintf(stderr, "%s: -i requires numeric instances\n", pmProgname);
+		    errflag++;
+		    break;
+		}
+	    }
+	    break;
+	case 'k':	/* disconnect msecs after sending the fetch */
+	    hangup = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || hangup < 0) {
+		fprintf(stderr, "%s: -k requires a positive numeric argument\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+	case 'w':	/* msecs to wait before fetching */
+	    delay = (int)strtol(optarg, &endnum, 10);
+	    if (*endnum != '\0' || delay < 0) {
+		fprintf(stderr, "%s: -w requires a positive numeric argument\n", pmProgname);
+		errflag++;
+	    }
+	    break;
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+    if (errflag || optind >= argc) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    if ((sts = pmNewContext(PM_CONTEXT_HOST, host)) < 0) {
+	fprintf(stderr, "%s: Cannot connect to PMCD on host \"%s\": %s\n",
+		pmProgname, host, pmErrStr(sts));
+	exit(1);
+    }
+    nmetrics = argc - optind;
+    if ((pmids = (pmID *)malloc(nmetrics * sizeof(pmID))) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmProgname);
+	exit(1);
+    }
+    if ((sts = pmLookupName(nmetrics, &argv[optind], pmids)) < 0) {
+	fprintf(stderr, "%s: pmLookupName: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    if (ninst > 0) {
+	if ((sts = pmLookupDesc(pmids[0], &desc)) < 0) {
+	    fprintf(stderr, "%s: pmLookupDesc: %s\n", pmProgname, pmErrStr(sts));
+	    exit(1);
+	}
+	pmDelProfile(desc.indom, 0, NULL);
+	pmAddProfile(desc.indom, ninst, insts);
+    }
+
+    if (delay > 0) {
+	msec_to_timeval(delay, &tv);
+	__pmtimevalSleep(tv);
+    }
+    if (hangup >= 0) {
+	signal(SIGALRM, disconnect);
+	memset(&it, 0, sizeof(it));
+	msec_to_timeval(hangup, &it.it_value);
+	setitimer(ITIMER_REAL, &it, NULL);
+    }
+
+    if ((sts = pmFetch(nmetrics, pmids, &rp)) < 0) {
+	printf("pmFetch: %s\n", pmErrStr(sts));
+	exit(1);
+    }
+    for (i = 0; i < rp->numpmid; i++) {
+	vsp = rp->vset[i];
+	printf("%s:", argv[optind + i]);
+	if (vsp->numval < 0)
+	    printf(" %s", pmErrStr(vsp->numval));
+	else if (vsp->numval == 0)
+	    printf(" no values");
+	for (j = 0; j < vsp->numval; j++) {
+	    if (vsp->vlist[j].inst != PM_IN_NULL)
+		printf(" [%d]", vsp->vlist[j].inst);
+	    if (vsp->valfmt == PM_VAL_INSITU)
+		printf(" %d", vsp->vlist[j].value.lval);
+	    else
+		printf(" ?");
+	}
+	putchar('\n');
+    }
+    pmFreeResult(rp);
+
+    exit(0);
+}
@@ -0,0 +1,152 @@
+/*
+ * Slow, a daemon PMDA that takes its time over fetches, for exercising
+ * pmcd with PMDAs that are slow, time out or are restarted while client
+ * fetches are outstanding.
+ *
+ * slow.delay	msecs to sleep before answering each fetch (storable)
+ * slow.fetches	number of fetch requests received
+ * slow.pid	process id of the PMDA
+ * slow.value	a value for each of the instances "a", "b" and "c"
+ * slow.msecs	msecs since the PMDA started, after any delay
+ *
+ * Copyright (c) 2026 Red Hat.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+#include <pcp/pmda.h>
+
+static pmdaInstid	insts[] = {
+    { 0, "a" }, { 1, "b" }, { 2, "c" },
+};
+
+static pmdaIndom	indomtab[] = {
+#define VALUE_INDOM	0
+    { VALUE_INDOM, sizeof(insts) / sizeof(insts[0]), insts },
+};
+
+static pmdaMetric	metrictab[] = {
+    /* delay */
+    { NULL, { PMDA_PMID(0,0), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE,
+	PMDA_PMUNITS(0,1,0,0,PM_TIME_MSEC,0) } },
+    /* fetches */
+    { NULL, { PMDA_PMID(0,1), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER,
+	PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+    /* pid */
+    { NULL, { PMDA_PMID(0,2), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+    /* value */
+    { NULL, { PMDA_PMID(0,3), PM_TYPE_U32, VALUE_INDOM, PM_SEM_INSTANT,
+	PMDA_PMUNITS(0,0,0,0,0,0) } },
+    /* msecs */
+    { NULL, { PMDA_PMID(0,4), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER,
+	PMDA_PMUNITS(0,1,0,0,PM_TIME_MSEC,0) } },
+};
+
+static unsigned int	delay;
+static unsigned int	fetches;
+static struct timeval	start;
+
+static int
+slow_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
+{
+    struct timeval	now;
+
+    if (pmid_cluster(mdesc->m_desc.pmid) != 0)
+	return PM_ERR_PMID;
+    switch (pmid_item(mdesc->m_desc.pmid)) {
+    case 0:
+	atom->ul = delay;
+	break;
+    case 1:
+	atom->ul = fetches;
+	break;
+    case 2:
+	atom->ul = getpid();
+	break;
+    case 3:
+	atom->ul = (inst + 1) * 100;
+	break;
+    case 4:
+	__pmtimevalNow(&now);
+	atom->ull = (__uint64_t)(__pmtimevalSub(&now, &start) * 1000);
+	break;
+    default:
+	return PM_ERR_PMID;
+    }
+    return 1;
+}
+
+static int
+slow_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
+{
+    struct timespec	ts;
+
+    fetches++;
+    if (delay > 0) {
+	ts.tv_sec = delay / 1000;
+	ts.tv_nsec = (delay % 1000) * 1000000;
+	nanosleep(&ts, NULL);
+    }
+    return pmdaFetch(numpmid, pmidlist, resp, pmda);
+}
+
+static int
+slow_store(pmResult *result, pmdaExt *pmda)
+{
+    pmValueSet	*vsp;
+    int		i;
+
+    for (i = 0; i < result->numpmid; i++) {
+	vsp = result->vset[i];
+	if (pmid_cluster(vsp->pmid) != 0 || pmid_item(vsp->pmid) != 0)
+	    return PM_ERR_PERMISSION;
+	if (vsp->numval != 1 || vsp->valfmt != PM_VAL_INSITU)
+	    return PM_ERR_BADSTORE;
+	delay = vsp->vlist[0].value.lval;
+    }
+    return 0;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: %s [options]\n\n", pmProgname);
+    fputs("Options:\n"
+	  "  -D N       set pmDebug debugging flag to N\n"
+	  "  -d domain  use domain (numeric) for metrics domain of PMDA\n"
+	  "  -l logfile write log into logfile rather than using default log name\n",
+	  stderr);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    int			err = 0;
+    pmdaInterface	desc;
+
+    __pmSetProgname(argv[0]);
+
+    pmdaDaemon(&desc, PMDA_INTERFACE_5, pmProgname, 251, "slowpmda.log", NULL);
+    if (desc.status != 0) {
+	fprintf(stderr, "pmdaDaemon() failed!\n");
+	exit(1);
+    }
+    if (pmdaGetOpt(argc, argv, "D:d:l:", &desc, &err) != EOF)
+	err++;
+    if (err || optind != argc)
+	usage();
+
+    pmdaOpenLog(&desc);
+    __pmtimevalNow(&start);
+    desc.version.any.fetch = slow_fetch;
+    desc.version.any.store = slow_store;
+    pmdaSetFetchCallBack(&desc, slow_fetchCallBack);
+    pmdaInit(&desc, indomtab, sizeof(indomtab) / sizeof(indomtab[0]),
+		metrictab, sizeof(metrictab) / sizeof(metrictab[0]));
+    pmdaConnect(&desc);
+    pmdaMain(&desc);
+
+    exit(0);
+}
@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * Replay a captured /proc snapshot through the Linux PMDA (via a local
+ * context and $LINUX_STATSPATH) and report the fetch rate for metrics
+ * from each of the text-parsing clusters.  As the snapshot does not
+ * change, the values from the last fetch are checked against those
+ * from the first, and with -v they are reported too.
+ */
+
+#include <pcp/pmapi.h>
+#include <pcp/impl.h>
+
+static char *clusters[] = {
+    "kernel.percpu.cpu.user",		/* /proc/stat */
+    "mem.util.used",			/* /proc/meminfo */
+    "mem.vmstat.pgpgin",		/* /proc/vmstat */
+    "network.interface.in.bytes",	/* /proc/net/dev */
+    "disk.dev.read",			/* /proc/diskstats */
+    "network.ip.inreceives",		/* /proc/net/snmp */
+    "network.tcp.delayedacks",		/* /proc/net/netstat */
+};
+
+/* same instances and values, in the same order */
+static int
+same_values(pmValueSet *a, pmValueSet *b)
+{
+    int		j;
+
+    if (a->numval != b->numval || (a->numval > 0 && a->valfmt != b->valfmt))
+	return 0;
+    for (j = 0; j < a->numval; j++) {
+	if (a->vlist[j].inst != b->vlist[j].inst)
+	    return 0;
+	if (a->valfmt == PM_VAL_INSITU) {
+	    if (a->vlist[j].value.lval != b->vlist[j].value.lval)
+		return 0;
+	}
+	else if (a->vlist[j].value.pval->vlen != b->vlist[j].value.pval->vlen ||
+		 memcmp(a->vlist[j].value.pval, b->vlist[j].value.pval,
+			a->vlist[j].value.pval->vlen) != 0)
+	    return 0;
+    }
+    return 1;
+}
+
+static void
+print_values(char *name, pmID pmid, pmValueSet *vsp)
+{
+    pmDesc	desc;
+    char	*iname;
+    int		j, sts;
+
+    printf("%s", name);
+    if (vsp->numval <= 0) {
+	printf(" %s\n", vsp->numval == 0 ? "no values" : pmErrStr(vsp->numval));
+	return;
+    }
+    if ((sts = pmLookupDesc(pmid, &desc)) < 0) {
+	printf(" pmLookupDesc: %s\n", pmErrStr(sts));
+	return;
+    }
+    putchar('\n');
+    for (j = 0; j < vsp->numval; j++) {
+	if (desc.indom == PM_INDOM_NULL)
+	    printf("    value ");
+	else if (pmNameInDom(desc.indom, vsp->vlist[j].inst, &iname) >= 0) {
+	    printf("    inst [%d or \"%s\"] value ", vsp->vlist[j].inst, iname);
+	    free(iname);
+	}
+	else
+	    printf("    inst [%d or ???] value ", vsp->vlist[j].inst);
+	pmPrintValue(stdout, vsp->valfmt, desc.type, &vsp->vlist[j], 1);
+	putchar('\n');
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    int		c;
+    int		sts;
+    int		errflag = 0;
+    int		iterations = 2000;
+    int		iter;
+    int		i;
+    int		nmetrics;
+    int		verbose = 0;
+    char	**metrics;
+    char	*statspath = NULL;
+    char	*env;
+    pmID	pmid;
+    pmResult	*result;
+    pmResult	*first;
+    struct timeval      before, after;
+    double	delta;
+    static char	*usage = "[-v] [-i iterations] -s statspath [metric ...]";
+
+    __pmSetProgname(argv[0]);
+
+    while ((c = getopt(argc, argv, "D:i:s:v")) != EOF) {
+	switch (c) {
+#ifdef PCP_DEBUG
+
+	case 'D':	/* debug flag */
+	    sts = __pmParseDebug(optarg);
+	    if (sts < 0) {
+		fprintf(stderr, "%s: unrecognized debug flag specification (%s)\n",
+		    pmProgname, optarg);
+		errflag++;
+	    }
+	    else
+		pmDebug |= sts;
+	    break;
+#endif
+
+	case 'i':	/* iterations */
+	    iterations = atoi(optarg);
+	    break;
+
+	case 's':	/* root of the captured /proc snapshot */
+	    statspath = optarg;
+	    break;
+
+	case 'v':	/* report values from the last fetch */
+	    verbose = 1;
+	    break;
+
+	case '?':
+	default:
+	    errflag++;
+	    break;
+	}
+    }
+
+    if (errflag || statspath == NULL || iterations <= 0) {
+	fprintf(stderr, "Usage: %s %s\n", pmProgname, usage);
+	exit(1);
+    }
+
+    /* must be in place before the PMDA is attached */
+    if ((env = malloc(strlen(statspath) + 16)) == NULL) {
+	fprintf(stderr, "%s: out of memory\n", pmProgname);
+	exit(1);
+    }
+    sprintf(env, "LINUX_STATSPATH=%s", statspath);
+    putenv(env);
+
+    if ((sts = pmNewContext(PM_CONTEXT_LOCAL, NULL)) < 0) {
+	printf("%s: Cannot make standalone local connection: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+
+    /* non-flag args are argv[optind] ... argv[argc-1] */
+    if (optind < argc) {
+	metrics = &argv[optind];
+	nmetrics = argc - optind;
+    }
+    else {
+	metrics = clusters;
+	nmetrics = sizeof(clusters) / sizeof(clusters[0]);
+    }
+
+    for (i = 0; i < nmetrics; i++) {
+	if ((sts = pmLookupName(1, &metrics[i], &pmid)) < 0) {
+	    printf("%s: metric ``%s'' : %s\n", pmProgname, metrics[i], pmErrStr(sts));
+	    exit(1);
+	}
+
+	first = NULL;
+	gettimeofday(&before, (struct timezone *)0);
+	for (iter=0; iter < iterations; iter++) {
+	    sts = pmFetch(1, &pmid, &result);
+	    if (sts < 0) {
+		printf("%s: %s iteration %d : %s\n", pmProgname, metrics[i], iter, pmErrStr(sts));
+		exit(1);
+	    }
+	    if (iter == 0)
+		first = result;
+	    else if (iter < iterations - 1)
+		pmFreeResult(result);
+	}
+	gettimeofday(&after, (struct timezone *)0);
+
+	if (!same_values(first->vset[0], result->vset[0]))
+	    printf("%s: metric %s values from fetch 1 and %d differ\n",
+		pmProgname, metrics[i], iterations);
+	if (verbose)
+	    print_values(metrics[i], pmid, result->vset[0]);
+	if (result != first)
+	    pmFreeResult(result);
+	pmFreeResult(first);
+
+	delta = __pmtimevalSub(&after, &before);
+	printf("%s: metric %s %.2lf fetches/second %.2lf usec/fetch\n",
+	    pmProgname, metrics[i], (double)iterations / delta,
+	    delta * 1000000.0 / (double)iterations);
+    }
+
+    if ((sts = pmWhichContext()) < 0) {
+	printf("%s: pmWhichContext: %s\n", pmProgname, pmErrStr(sts));
+	exit(1);
+    }
+    pmDestroyContext(sts);
+
+    exit(0);
+}
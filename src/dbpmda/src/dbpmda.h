@@ -40,6 +40,7 @@ extern void printindom(FILE *, __pmInResult *);
 extern void dohelp(int, int);
 extern void dostatus(void);
 extern int fillResult(pmResult *, int);
+extern void freeFilledValues(pmResult *);
 extern void _dbDumpResult(FILE *, pmResult *, pmDesc *);
 
 /* pmda exerciser routines */
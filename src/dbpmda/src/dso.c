@@ -326,7 +326,7 @@ dodso(int pdu)
 	 
 	    sts = fillResult(result, desc.type);
 	    if (sts < 0) {
-		pmFreeResult(result);
+		__pmFreeResultValues(result);
 		return;
 	    }
 
@@ -334,6 +334,10 @@ dodso(int pdu)
 	    if (sts < 0)
 		printf("Error: DSO store() failed: %s\n", pmErrStr(sts));
 
+	    /* as for fetch, the skeleton is the DSO PMDA's, the values ours */
+	    freeFilledValues(result);
+	    __pmFreeResultValues(result);
+
 	    break;
 
 	case PDU_TEXT_REQ:
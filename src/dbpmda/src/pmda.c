@@ -530,6 +530,7 @@ dopmda(int pdu)
 
 	    printf("Sending Result...\n");
 	    sts = __pmSendResult(outfd, FROM_ANON, result);
+	    freeFilledValues(result);
 	    pmFreeResult(result);	
 	    __pmUnpinPDUBuf(pb);
 	    if (sts >= 0) {
@@ -751,6 +752,19 @@ dopmda(int pdu)
     }
 }
 
+/*
+ * Value sets of a decoded PDU or an arena-backed result are released
+ * with their PDU buffer, and their pmValueBlocks with them - but not
+ * those malloc'd by __pmStuffValue() in fillResult().
+ */
+static int
+inPDUBuf(pmValueSet *vsp)
+{
+    char	*base;
+
+    return __pmPDUBufRange((void *)vsp, &base) > 0;
+}
+
 int
 fillResult(pmResult *result, int type)
 {
@@ -759,6 +773,7 @@ fillResult(pmResult *result, int type)
     pmAtomValue	atom;
     pmValueSet	*vsp;
     char	*endbuf = NULL;
+    int		oldfmt;
 
     switch(type) {
     case PM_TYPE_32:
@@ -813,21 +828,27 @@ fillResult(pmResult *result, int type)
 
 	if (vsp->numval == 0) {
 	    printf("Error: %s not available!\n", pmIDStr(param.pmid));
-	    return PM_ERR_VALUE;
+	    sts = PM_ERR_VALUE;
+	    goto done;
 	}
 
 	if (vsp->numval < 0) {
 	    printf("Error: %s: %s\n", pmIDStr(param.pmid), pmErrStr(vsp->numval));
-	    return vsp->numval;
+	    sts = vsp->numval;
+	    goto done;
 	}
 
+	oldfmt = vsp->valfmt;
 	for (i = 0; i < vsp->numval; i++) {
 	    if (vsp->numval > 1)
 		printf("%s [%d]: ", pmIDStr(param.pmid), i);		
 	    else
 		printf("%s: ", pmIDStr(param.pmid));
 	    
-	    pmPrintValue(stdout, vsp->valfmt, type, &vsp->vlist[i], 1);
+	    pmPrintValue(stdout, oldfmt, type, &vsp->vlist[i], 1);
+	    /* a malloc'd value set owns its old value, about to be lost */
+	    if (oldfmt == PM_VAL_DPTR && !inPDUBuf(vsp))
+		free(vsp->vlist[i].value.pval);
 	    vsp->valfmt = __pmStuffValue(&atom, &vsp->vlist[i], type); 
 	    printf(" -> ");
 	    pmPrintValue(stdout, vsp->valfmt, type, &vsp->vlist[i], 1);
@@ -835,6 +856,26 @@ fillResult(pmResult *result, int type)
 	}
     }
 
+done:
+    if (type == PM_TYPE_STRING && atom.cp != NULL)
+	free(atom.cp);
     return sts;
 }
 
+/*
+ * Free the pmValueBlocks fillResult() stored into a result that the
+ * caller then releases as usual - pmFreeResult() and friends only free
+ * them for value sets that are not in a PDU buffer.
+ */
+void
+freeFilledValues(pmResult *result)
+{
+    pmValueSet	*vsp = result->vset[0];
+    int		i;
+
+    if (vsp->numval <= 0 || vsp->valfmt != PM_VAL_DPTR || !inPDUBuf(vsp))
+	return;
+    for (i = 0; i < vsp->numval; i++)
+	free(vsp->vlist[i].value.pval);
+}
+
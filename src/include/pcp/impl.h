@@ -435,6 +435,18 @@ typedef struct {
      * be at the end of this structure.
      */
     int		l_multi;	/* part of a multi-archive context */
+    /*
+     * (when reading) read-only mapping of the current metrics log
+     * volume, as it was when the volume was opened ... records beyond
+     * l_mfmaplen (a growing archive) are read via l_mfp
+     */
+    char	*l_mfmap;
+    size_t	l_mfmaplen;
+    /*
+     * (when reading via a context) serializes use of the files and
+     * position above by contexts sharing this __pmLogCtl
+     */
+    __pmMutex	l_lock;
 } __pmLogCtl;
 
 /* l_state values */
@@ -727,7 +739,7 @@ typedef struct {
     void		*ac_want;	/* used in interp.c */
     void		*ac_unbound;	/* used in interp.c */
     void		*ac_cache;	/* used in interp.c */
-    int			ac_cache_idx;	/* used in interp.c */
+    int			ac_cache_size;	/* used in interp.c */
     /*
      * These were added to the ABI in order to support multiple archives
      * in a single context. In order to maintain ABI compatibility they must
@@ -738,6 +750,7 @@ typedef struct {
     int			ac_num_logs;	/* The number of archives */
     int			ac_cur_log;	/* The currently open archive */
     __pmMultiLogCtl	**ac_log_list;	/* Current set of archives */
+    void		*ac_arena;	/* used in interp.c and logutil.c */
 } __pmArchCtl;
 
 /*
@@ -873,6 +886,16 @@ PCP_CALL extern __pmPDU *__pmFindPDUBuf(int);
 PCP_CALL extern void __pmPinPDUBuf(void *);
 PCP_CALL extern int __pmUnpinPDUBuf(void *);
 PCP_CALL extern void __pmCountPDUBuf(int, int *, int *);
+PCP_CALL extern int __pmPDUBufRange(void *, char **);
+
+/* PDU buffer allocator statistics, see __pmGetPDUBufStats */
+typedef struct {
+    __uint64_t	hit;		/* buffers reused from a per-thread cache */
+    __uint64_t	miss;		/* buffers taken from a shared slab */
+    __uint64_t	large;		/* buffers too big for a slab, malloc'd */
+    int		slabs;		/* slabs currently allocated */
+} __pmPDUBufStats;
+PCP_CALL extern void __pmGetPDUBufStats(__pmPDUBufStats *);
 
 #define PDU_START		0x7000
 #define PDU_ERROR		PDU_START
@@ -1217,6 +1240,41 @@ PCP_CALL extern void __pmResetIPC(int);
 /* safely insert an atom value into a pmValue */
 PCP_CALL extern int __pmStuffValue(const pmAtomValue *, pmValue *, int);
 
+/*
+ * Arena-backed pmResult construction.  pmValueSets and pmValueBlocks
+ * are staged in buffers owned by the caller (and reused from one
+ * result to the next), then __pmArenaResult() copies them with the
+ * pmResult into a single pinned PDU buffer.  pmFreeResult() and
+ * __pmFreeResultValues() recognise a pmResult that lies within a PDU
+ * buffer and release all of it by unpinning that buffer.
+ *
+ * A zeroed __pmResultArena is empty and ready for use.  A pmValueSet
+ * returned by __pmArenaValueSet() may move when the next one is added
+ * (or it is grown), and the pmValueBlock returned by
+ * __pmArenaValueBlock() may move when the next one is added, so fill
+ * in each one before moving on.  Until __pmArenaResult() is called, the
+ * pval of a staged PM_VAL_DPTR value is an offset, not a pointer.
+ */
+typedef struct {
+    int		ra_numpmid;	/* pmValueSets staged */
+    int		ra_maxpmid;
+    int		*ra_vsoff;	/* offset of each pmValueSet in ra_vs[] */
+    char	*ra_vs;		/* staged pmValueSets */
+    int		ra_vslen;
+    int		ra_vsmax;
+    char	*ra_vb;		/* staged pmValueBlocks */
+    int		ra_vblen;
+    int		ra_vbmax;
+} __pmResultArena;
+
+PCP_CALL extern void __pmArenaReset(__pmResultArena *);
+PCP_CALL extern pmValueSet *__pmArenaValueSet(__pmResultArena *, pmID, int);
+PCP_CALL extern pmValueSet *__pmArenaGrowValueSet(__pmResultArena *, int);
+PCP_CALL extern pmValueBlock *__pmArenaValueBlock(__pmResultArena *, int, pmValue *);
+PCP_CALL extern int __pmArenaStuffValue(__pmResultArena *, const pmAtomValue *, pmValue *, int);
+PCP_CALL extern int __pmArenaResult(__pmResultArena *, pmResult **);
+PCP_CALL extern void __pmArenaFree(__pmResultArena *);
+
 /* string conversion to value of given type, suitable for pmStore */
 PCP_CALL extern int __pmStringValue(const char *, pmAtomValue *, int);
 
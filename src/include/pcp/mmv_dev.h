@@ -15,7 +15,12 @@
 #ifndef PCP_MMV_DEV_H
 #define PCP_MMV_DEV_H
 
-#define MMV_VERSION	1
+/*
+ * Version 2 files add the shards section, version 3 the histograms
+ * section; files are written with the lowest version that describes
+ * them, so older PMDAs can still read files not using the new types.
+ */
+#define MMV_VERSION	3
 
 typedef enum mmv_toc_type {
     MMV_TOC_INDOMS	= 1,	/* mmv_disk_indom_t */
@@ -23,6 +28,8 @@ typedef enum mmv_toc_type {
     MMV_TOC_METRICS	= 3,	/* mmv_disk_metric_t */
     MMV_TOC_VALUES	= 4,	/* mmv_disk_value_t */
     MMV_TOC_STRINGS	= 5,	/* mmv_disk_string_t */
+    MMV_TOC_SHARDS	= 6,	/* mmv_disk_shard_t (version 2) */
+    MMV_TOC_HISTOGRAMS	= 7,	/* mmv_disk_histogram_t (version 3) */
 } mmv_toc_type_t;
 
 /* The way the Table Of Contents is written into the file */
@@ -58,7 +65,10 @@ typedef struct mmv_disk_metric {
     mmv_metric_sem_t	semantics;
     pmUnits		dimension;
     __int32_t		indom;		/* Instance domain number */
-    __uint32_t		padding;	/* zero filled, alignment bits */
+    union {
+	__uint32_t	padding;	/* zero filled, alignment bits */
+	__uint32_t	sequence;	/* STRING/ELAPSED seqlock (version 2) */
+    };
     __uint64_t		shorttext;	/* Offset of short help text string */
     __uint64_t		helptext;	/* Offset of long help text string */
 } mmv_disk_metric_t;
@@ -66,10 +76,49 @@ typedef struct mmv_disk_metric {
 typedef struct mmv_disk_value {
     pmAtomValue		value;		/* Union of all possible value types */
     __int64_t		extra;		/* INTEGRAL(starttime)/STRING(offset) */
+					/* or SHARDS(offset), version 2 only */
+					/* or HISTOGRAM(offset), version 3 */
     __uint64_t		metric;		/* Offset into the metric section */
     __uint64_t		instance;	/* Offset into the instance section */
 } mmv_disk_value_t;
 
+/*
+ * A sharded counter value is the sum of MMV_SHARDS shards, each in its
+ * own cache line, updated by the threads of the writing process.  The
+ * value itself stays zero.
+ */
+#define MMV_SHARDS	16
+#define MMV_CACHELINE	64
+
+typedef struct mmv_disk_shard {
+    pmAtomValue		value;		/* this shard's part of the value */
+    char		padding[MMV_CACHELINE - sizeof(pmAtomValue)];
+} mmv_disk_shard_t;
+
+/*
+ * A histogram value counts recorded values in log-linear buckets: values
+ * below MMV_HIST_SUB have a bucket each, then each power of two is split
+ * into MMV_HIST_SUB equal buckets, so a bucket's width is at most 1/8th
+ * of its lower bound.  The value itself stays zero.
+ */
+#define MMV_HIST_SUBBITS	3
+#define MMV_HIST_SUB		(1 << MMV_HIST_SUBBITS)
+#define MMV_HIST_BUCKETS	((64 - MMV_HIST_SUBBITS + 1) * MMV_HIST_SUB)
+
+/* lowest value counted in bucket b, and the number of values it counts */
+#define MMV_HIST_LOWER(b)	((b) < MMV_HIST_SUB ? (__uint64_t)(b) : \
+		(__uint64_t)(MMV_HIST_SUB + (b) % MMV_HIST_SUB) << \
+		((b) / MMV_HIST_SUB - 1))
+#define MMV_HIST_WIDTH(b)	((b) < MMV_HIST_SUB ? (__uint64_t)1 : \
+		(__uint64_t)1 << ((b) / MMV_HIST_SUB - 1))
+
+typedef struct mmv_disk_histogram {
+    __uint64_t		count;		/* Number of values recorded */
+    __uint64_t		sum;		/* Sum of values recorded */
+    __uint64_t		buckets[MMV_HIST_BUCKETS];
+    __uint64_t		padding[6];	/* zero filled, cache line multiple */
+} mmv_disk_histogram_t;
+
 typedef struct mmv_disk_header {
     char		magic[4];	/* MMV\0 */
     __int32_t		version;	/* version */
@@ -476,6 +476,26 @@ PCP_CALL extern int pmFetch(int, pmID *, pmResult **);
  */
 PCP_CALL extern int pmFetchArchive(pmResult **);
 
+/*
+ * Interpolated values for (metric, instance) pairs at count times
+ * start, start+step, ... from an archive, one column per pair
+ */
+PCP_CALL extern int pmFetchInterpRange(int, pmID *, int *,
+		const struct timeval *, const struct timeval *, int, double *);
+
+/*
+ * Cache of archive records read for interpolation in the current context
+ */
+typedef struct {
+    __uint64_t	hit;		/* records found in the cache */
+    __uint64_t	miss;		/* records read from the archive */
+    __uint64_t	evict;		/* records discarded to make room */
+    int		count;		/* records currently cached */
+    int		size;		/* maximum records cached */
+} pmInterpCacheStats;
+PCP_CALL extern int pmGetInterpCacheStats(pmInterpCacheStats *);
+PCP_CALL extern int pmSetInterpCacheSize(int);
+
 /*
  * struct timeval is sometimes 2 x 64-bit ... we use a 2 x 32-bit format for
  * PDUs, internally within libpcp and for (external) archive logs
@@ -30,7 +30,8 @@ extern "C" {
 #define PMDA_INTERFACE_5	5	/* client context in pmda and */
 					/* 4-state return from fetch callback */
 #define PMDA_INTERFACE_6	6	/* client security attributes in pmda */
-#define PMDA_INTERFACE_LATEST	6
+#define PMDA_INTERFACE_7	7	/* per-metric (column) fetch callback */
+#define PMDA_INTERFACE_LATEST	7
 
 /*
  * Type of I/O connection to PMCD (pmdaUnknown defaults to pmdaPipe)
@@ -75,6 +76,16 @@ typedef int (*pmdaFetchCallBack)(pmdaMetric *, unsigned int, pmAtomValue *);
 #define PMDA_FETCH_STATIC	1
 #define PMDA_FETCH_DYNAMIC	2	/* free avp->vp after __pmStuffValue */
 
+/*
+ * Type of function call back used by pmdaFetch for PMDA_INTERFACE_7 and
+ * later, to assign the values of one metric for all of the requested
+ * instances in a single call.  The arguments are the metric, the number
+ * of instances and the instance list (already filtered by the profile),
+ * then arrays of that many values and pmdaFetchCallBack-style return
+ * codes to be filled in.  A negative return applies to every instance.
+ */
+typedef int (*pmdaFetchColumnCallBack)(pmdaMetric *, int, const int *, pmAtomValue *, int *);
+
 /*
  * Type of function call back used by pmdaMain to clean up a pmResult structure
  * after a fetch.
@@ -150,6 +161,8 @@ typedef struct pmdaExt {
     /* added for PMDA_INTERFACE_5 */
     int		e_context;	/* client context id from pmcd */
     pmdaEndContextCallBack	e_endCallBack;	/* callback after client context closed */
+    /* added for PMDA_INTERFACE_7 */
+    pmdaFetchColumnCallBack	e_fetchColumnCallBack; /* callback to assign a metric's values in fetch */
 } pmdaExt;
 
 #define PMDA_EXT_FLAG_DIRECT	0x01	/* direct mapped PMID metric table */
@@ -239,8 +252,9 @@ typedef struct pmdaInterface {
 	} four, five;
 
 /*
- * Interface Version 6 (client context security attributes in PMDA).
- * PMDA_INTERFACE_6
+ * Interface Version 6 (client context security attributes in PMDA) and
+ * Version 7 (column fetch callback in libpcp_pmda, no new methods here).
+ * PMDA_INTERFACE_6, PMDA_INTERFACE_7
  */
 	struct {
 	    pmdaExt *ext;
@@ -254,7 +268,7 @@ typedef struct pmdaInterface {
 	    int     (*name)(pmID, char ***, pmdaExt *);
 	    int     (*children)(const char *, int, char ***, int **, pmdaExt *);
 	    int     (*attribute)(int, int, const char *, int, pmdaExt *);
-	} six;
+	} six, seven;
 
     } version;
 
@@ -400,8 +414,14 @@ typedef struct pmdaOptions {
  *
  * pmdaSetFetchCallBack
  *      Allows an application specific routine to be specified for completing a
- *      pmAtom structure with a metrics value. This must be set if pmdaFetch is
- *      used as the fetch callback.
+ *      pmAtom structure with a metrics value. This (or the column callback
+ *      below) must be set if pmdaFetch is used as the fetch callback.
+ *
+ * pmdaSetFetchColumnCallBack
+ *      For PMDA_INTERFACE_7 or later, allows an application specific routine
+ *      to be specified for completing the pmAtom structures for all of the
+ *      requested instances of a metric in one call.  If set, pmdaFetch uses
+ *      this in preference to the per-instance fetch callback.
  *
  * pmdaSetCheckCallBack
  *      Allows an application specific routine to be called upon receipt of any
@@ -435,6 +455,7 @@ PMDA_CALL extern void pmdaMain(pmdaInterface *);
 
 PMDA_CALL extern void pmdaSetResultCallBack(pmdaInterface *, pmdaResultCallBack);
 PMDA_CALL extern void pmdaSetFetchCallBack(pmdaInterface *, pmdaFetchCallBack);
+PMDA_CALL extern void pmdaSetFetchColumnCallBack(pmdaInterface *, pmdaFetchColumnCallBack);
 PMDA_CALL extern void pmdaSetCheckCallBack(pmdaInterface *, pmdaCheckCallBack);
 PMDA_CALL extern void pmdaSetDoneCallBack(pmdaInterface *, pmdaDoneCallBack);
 PMDA_CALL extern void pmdaSetEndContextCallBack(pmdaInterface *, pmdaEndContextCallBack);
@@ -449,7 +470,8 @@ PMDA_CALL extern void pmdaSetEndContextCallBack(pmdaInterface *, pmdaEndContextC
  *
  * pmdaFetch
  *	Resize the pmResult and call e_callback in the pmdaExt structure
- *	for each metric instance required by the profile.
+ *	for each metric instance required by the profile, or call
+ *	e_fetchColumnCallBack once per metric if that is set.
  *
  * pmdaInstance
  *	Return description of instances and instance domains.
@@ -17,14 +17,26 @@
  *
  * curcontext needs to be thread-private
  *
- * contexts[] et al and def_backoff[] et al are protected from changes
- * using the libpcp lock
+ * def_backoff[] et al are protected from changes using the libpcp lock
+ *
+ * contexts[], contexts_len and the c_type of each context are only
+ * changed with both the libpcp lock and contexts_lock held, so they may
+ * be read holding either one.  The libpcp lock serializes the creation
+ * and destruction of contexts (which may block for a long time, e.g.
+ * connecting to pmcd), while the lookup of an existing context in
+ * __pmHandleToPtr() and pmUseContext() needs only contexts_lock.  Nothing
+ * else is ever locked while holding contexts_lock.
  *
  * The actual contexts (__pmContext) are protected by the (recursive)
  * c_lock mutex which is intialized in pmNewContext() and pmDupContext(),
  * then locked in __pmHandleToPtr() ... it is the responsibility of all
  * __pmHandleToPtr() callers to call PM_UNLOCK(ctxp->c_lock) when they
  * are finished with the context.
+ *
+ * An archive's __pmLogCtl may be shared by several contexts, each with
+ * their own position in the archive (see __pmFindOrOpenArchive()), so
+ * while reading from the archive the l_lock mutex of the __pmLogCtl is
+ * held as well.  The order is always c_lock before l_lock.
  */
 
 #include "pmapi.h"
@@ -34,6 +46,11 @@
 
 static __pmContext	**contexts;		/* array of context ptrs */
 static int		contexts_len;		/* number of contexts */
+#ifdef PM_MULTI_THREAD
+static pthread_mutex_t	contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static void		*contexts_lock;
+#endif
 
 #ifdef PM_MULTI_THREAD
 #ifdef HAVE___THREAD
@@ -104,16 +121,16 @@ __pmContext *
 __pmHandleToPtr(int handle)
 {
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(contexts_lock);
     if (handle < 0 || handle >= contexts_len ||
 	contexts[handle]->c_type == PM_CONTEXT_FREE) {
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(contexts_lock);
 	return NULL;
     }
     else {
 	__pmContext	*sts;
 	sts = contexts[handle];
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(contexts_lock);
 	PM_LOCK(sts->c_lock);
 	return sts;
     }
@@ -124,14 +141,14 @@ __pmPtrToHandle(__pmContext *ctxp)
 {
     int		i;
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(contexts_lock);
     for (i = 0; i < contexts_len; i++) {
 	if (ctxp == contexts[i]) {
-	    PM_UNLOCK(__pmLock_libpcp);
+	    PM_UNLOCK(contexts_lock);
 	    return i;
 	}
     }
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(contexts_lock);
     return PM_CONTEXT_UNDEF;
 }
 
@@ -233,8 +250,8 @@ pmWhichContext(void)
      */
     int		sts;
 
+    /* curcontext is thread-private, so no locking is needed */
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
     if (PM_TPD(curcontext) > PM_CONTEXT_UNDEF)
 	sts = PM_TPD(curcontext);
     else
@@ -245,7 +262,6 @@ pmWhichContext(void)
 	fprintf(stderr, "pmWhichContext() -> %d, cur=%d\n",
 	    sts, PM_TPD(curcontext));
 #endif
-    PM_UNLOCK(__pmLock_libpcp);
     return sts;
 }
 
@@ -477,6 +493,7 @@ __pmFindOrOpenArchive(__pmContext *ctxp, const char *name, int multi_arch)
     __pmLogCtl	*lcp2;
     int		i;
     int		sts;
+    int		fresh = 0;
 
     /*
      * We're done with the current archive, if any. Close it, if necessary.
@@ -485,7 +502,8 @@ __pmFindOrOpenArchive(__pmContext *ctxp, const char *name, int multi_arch)
     acp = ctxp->c_archctl;
     lcp = acp->ac_log;
     if (lcp) {
-	if (--lcp->l_refcnt == 0)
+	/* l_refcnt is already 0 if the last __pmLogOpen() failed */
+	if (lcp->l_refcnt == 0 || --lcp->l_refcnt == 0)
 	    __pmLogClose(lcp);
 	else
 	    lcp = NULL;
@@ -523,8 +541,10 @@ __pmFindOrOpenArchive(__pmContext *ctxp, const char *name, int multi_arch)
 	 * Free the current archive controls, if necessary.
 	 */
 	if (lcp2 != NULL) {
-	    if (lcp)
+	    if (lcp) {
+		destroylock(&lcp->l_lock, "l_lock");
 		free(lcp);
+	    }
 	    ++lcp2->l_refcnt;
 	    acp->ac_log = lcp2;
 	    return 0;
@@ -536,16 +556,28 @@ __pmFindOrOpenArchive(__pmContext *ctxp, const char *name, int multi_arch)
      * Allocate a new log control block, if necessary.
      */
     if (lcp == NULL) {
+	fresh = 1;
 	if ((lcp = (__pmLogCtl *)malloc(sizeof(*lcp))) == NULL)
 	    __pmNoMem("__pmFindOrOpenArchive", sizeof(*lcp), PM_FATAL_ERR);
 	lcp->l_pmns = NULL;
 	lcp->l_multi = multi_arch;
+	/* recursive, like c_lock, as held across calls back into libpcp */
+	initcontextlock(&lcp->l_lock);
 	acp->ac_log = lcp;
     }
     sts = __pmLogOpen(name, ctxp);
     if (sts < 0) {
-	free(lcp);
-	acp->ac_log = NULL;
+	/*
+	 * When switching archives in a multi-archive context the caller
+	 * holds l_lock of the re-used lcp, so that one stays attached (and
+	 * closed, with l_refcnt of 0) until __pmArchCtlFree() ... only a
+	 * block allocated here can be released now.
+	 */
+	if (fresh) {
+	    destroylock(&lcp->l_lock, "l_lock");
+	    free(lcp);
+	    acp->ac_log = NULL;
+	}
     }
     else
 	lcp->l_refcnt = 1;
@@ -714,6 +746,7 @@ initarchive(__pmContext	*ctxp, const char *name)
     acp->ac_log_list = NULL;
     acp->ac_log = NULL;
     acp->ac_mark_done = 0;
+    acp->ac_arena = NULL;
 
     /*
      * The list of names may contain one or more directories. Examine the
@@ -848,6 +881,7 @@ initarchive(__pmContext	*ctxp, const char *name)
     acp->ac_want = NULL;
     acp->ac_unbound = NULL;
     acp->ac_cache = NULL;
+    acp->ac_cache_size = 0;	/* default */
 
     return 0; /* success */
 
@@ -876,8 +910,11 @@ initarchive(__pmContext	*ctxp, const char *name)
 	free(acp->ac_log_list);
     }
     if (acp) {
-	if (acp->ac_log && --acp->ac_log->l_refcnt == 0)
+	if (acp->ac_log &&
+	    (acp->ac_log->l_refcnt == 0 || --acp->ac_log->l_refcnt == 0)) {
+	    destroylock(&acp->ac_log->l_lock, "l_lock");
 	    free(acp->ac_log);
+	}
 	free(acp);
     }
     return sts;
@@ -908,39 +945,53 @@ pmNewContext(int type, const char *name)
     /* See if we can reuse a free context */
     for (i = 0; i < contexts_len; i++) {
 	if (contexts[i]->c_type == PM_CONTEXT_FREE) {
-	    PM_TPD(curcontext) = i;
 	    new = contexts[i];
-	    goto INIT_CONTEXT;
+	    break;
 	}
     }
 
     /* Create a new one */
-    if (contexts == NULL)
-	list = (__pmContext **)malloc(sizeof(__pmContext *));
-    else
-	list = (__pmContext **)realloc((void *)contexts, (1+contexts_len) * sizeof(__pmContext *));
-    new = (__pmContext *)malloc(sizeof(__pmContext));
-    if (list == NULL || new == NULL) {
-	/* fail : nothing changed, but new may have been allocated (in theory) */
-	if (new)
-	    memset(new, 0, sizeof(__pmContext));
+    if (new == NULL && (new = (__pmContext *)malloc(sizeof(__pmContext))) == NULL) {
 	sts = -oserror();
 	goto FAILED;
     }
 
-    contexts = list;
-    PM_TPD(curcontext) = contexts_len;
-    contexts[contexts_len] = new;
-    contexts_len++;
-
-INIT_CONTEXT:
     /*
-     * Set up the default state
+     * Set up the default state, including c_lock, before the context
+     * can be seen by other threads ... a reused slot has to remain
+     * PM_CONTEXT_FREE while it is cleared, so do that under contexts_lock
      */
+    PM_LOCK(contexts_lock);
     memset(new, 0, sizeof(__pmContext));
+    new->c_type = PM_CONTEXT_FREE;
+    PM_UNLOCK(contexts_lock);
     initcontextlock(&new->c_lock);
-    new->c_type = (type & PM_CONTEXT_TYPEMASK);
     new->c_flags = (type & ~PM_CONTEXT_TYPEMASK);
+
+    /* Now publish it, appending to contexts[] if it was not reused */
+    PM_LOCK(contexts_lock);
+    if (i == contexts_len) {
+	if (contexts == NULL)
+	    list = (__pmContext **)malloc(sizeof(__pmContext *));
+	else
+	    list = (__pmContext **)realloc((void *)contexts, (1+contexts_len) * sizeof(__pmContext *));
+	if (list == NULL) {
+	    /* fail : nothing changed, contexts[] is still valid */
+	    sts = -oserror();
+	    PM_UNLOCK(contexts_lock);
+	    destroylock(&new->c_lock, "c_lock");
+	    free(new);
+	    new = NULL;
+	    goto FAILED;
+	}
+	contexts = list;	/* realloc may have moved (and freed) the old one */
+	contexts[contexts_len] = new;
+	contexts_len++;
+    }
+    PM_TPD(curcontext) = i;
+    new->c_type = (type & PM_CONTEXT_TYPEMASK);
+    PM_UNLOCK(contexts_lock);
+
     if ((new->c_instprof = (__pmProfile *)calloc(1, sizeof(__pmProfile))) == NULL) {
 	/*
 	 * fail : nothing changed -- actually list is changed, but restoring
@@ -1086,17 +1137,20 @@ FAILED:
 	if (new->c_instprof != NULL)
 	    free(new->c_instprof);
 	/* only free this pointer if it was not reclaimed from old contexts */
+	PM_LOCK(contexts_lock);
 	for (i = 0; i < old_contexts_len; i++) {
 	    if (contexts[i] != new)
 		continue;
 	    new->c_type = PM_CONTEXT_FREE;
 	    break;
 	}
+	contexts_len = old_contexts_len;
+	PM_UNLOCK(contexts_lock);
+	destroylock(&new->c_lock, "c_lock");
 	if (i == old_contexts_len)
 	    free(new);
     }
     PM_TPD(curcontext) = old_curcontext;
-    contexts_len = old_contexts_len;
 #ifdef PCP_DEBUG
     if (pmDebug & DBG_TRACE_CONTEXT)
 	fprintf(stderr, "pmNewContext(%d, %s) -> %d, curcontext=%d\n",
@@ -1285,14 +1339,16 @@ pmDupContext(void)
 	}
 	*newcon->c_archctl = *oldcon->c_archctl;	/* struct assignment */
 	/*
-	 * Need to make hash list and read cache independent in case oldcon
-	 * is subsequently closed via pmDestroyContext() and don't want
-	 * __pmFreeInterpData() to trash our hash list and read cache.
-	 * Start with an empty hash list and read cache for the dup'd context.
+	 * Need to make hash list, read cache and result arena independent
+	 * in case oldcon is subsequently closed via pmDestroyContext() and
+	 * don't want __pmFreeInterpData() to trash our hash list and read
+	 * cache.  Start with an empty hash list, read cache and result
+	 * arena for the dup'd context.
 	 */
 	newcon->c_archctl->ac_pmid_hc.nodes = 0;
 	newcon->c_archctl->ac_pmid_hc.hsize = 0;
 	newcon->c_archctl->ac_cache = NULL;
+	newcon->c_archctl->ac_arena = NULL;
 
 	/*
 	 * We need to copy the log lists and bump up the reference counts of
@@ -1340,8 +1396,11 @@ pmDupContext(void)
 
 done:
     /* return an error code, or the handle for the new context */
-    if (sts < 0 && new >= 0)
+    if (sts < 0 && new >= 0) {
+	PM_LOCK(contexts_lock);
 	contexts[new]->c_type = PM_CONTEXT_FREE;
+	PM_UNLOCK(contexts_lock);
+    }
 #ifdef PCP_DEBUG
     if (pmDebug & DBG_TRACE_CONTEXT) {
 	fprintf(stderr, "pmDupContext() -> %d\n", sts);
@@ -1358,16 +1417,17 @@ int
 pmUseContext(int handle)
 {
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(contexts_lock);
     if (handle < 0 || handle >= contexts_len ||
 	contexts[handle]->c_type == PM_CONTEXT_FREE) {
+	    PM_UNLOCK(contexts_lock);
 #ifdef PCP_DEBUG
 	    if (pmDebug & DBG_TRACE_CONTEXT)
 		fprintf(stderr, "pmUseContext(%d) -> %d\n", handle, PM_ERR_NOCONTEXT);
 #endif
-	    PM_UNLOCK(__pmLock_libpcp);
 	    return PM_ERR_NOCONTEXT;
     }
+    PM_UNLOCK(contexts_lock);
 
 #ifdef PCP_DEBUG
     if (pmDebug & DBG_TRACE_CONTEXT)
@@ -1375,7 +1435,6 @@ pmUseContext(int handle)
 #endif
     PM_TPD(curcontext) = handle;
 
-    PM_UNLOCK(__pmLock_libpcp);
     return 0;
 }
 
@@ -1418,7 +1477,9 @@ pmDestroyContext(int handle)
     }
     __pmFreeAttrsSpec(&ctxp->c_attrs);
     __pmHashClear(&ctxp->c_attrs);
+    PM_LOCK(contexts_lock);
     ctxp->c_type = PM_CONTEXT_FREE;
+    PM_UNLOCK(contexts_lock);
 
     if (handle == PM_TPD(curcontext))
 	/* we have no choice */
@@ -148,7 +148,11 @@ pmFetch(int numpmid, pmID pmidlist[], pmResult **result)
 	}
 	else {
 	    /* assume PM_CONTEXT_ARCHIVE */
+	    __pmLogCtl	*lcp = ctxp->c_archctl->ac_log;
+
+	    PM_LOCK(lcp->l_lock);
 	    n = __pmLogFetch(ctxp, numpmid, pmidlist, result);
+	    PM_UNLOCK(lcp->l_lock);
 	    if (n >= 0 && (ctxp->c_mode & __PM_MODE_MASK) != PM_MODE_INTERP) {
 		ctxp->c_origin.tv_sec = (__int32_t)(*result)->timestamp.tv_sec;
 		ctxp->c_origin.tv_usec = (__int32_t)(*result)->timestamp.tv_usec;
@@ -207,7 +211,11 @@ pmFetchArchive(pmResult **result)
 		n = PM_ERR_MODE;
 	    else {
 		/* assume PM_CONTEXT_ARCHIVE and BACK or FORW */
+		__pmLogCtl	*lcp = ctxp->c_archctl->ac_log;
+
+		PM_LOCK(lcp->l_lock);
 		n = __pmLogFetch(ctxp, 0, NULL, result);
+		PM_UNLOCK(lcp->l_lock);
 		if (n >= 0) {
 		    ctxp->c_origin.tv_sec = (__int32_t)(*result)->timestamp.tv_sec;
 		    ctxp->c_origin.tv_usec = (__int32_t)(*result)->timestamp.tv_usec;
@@ -220,6 +228,181 @@ pmFetchArchive(pmResult **result)
     return n;
 }
 
+/*
+ * Interpolated values for numpmid (metric, instance) pairs at count
+ * times start, start+step, ... from an archive context, returned as one
+ * dense column per pair: values[i*count + k] is for pmidlist[i] and
+ * instlist[i] at the k-th time, or NaN if there is no value.
+ *
+ * This is the same as pmSetMode(PM_MODE_INTERP, ...) followed by count
+ * calls to pmFetch(), but the metric list is deduplicated, descriptors
+ * looked up and derived metrics rewritten once, the context is only
+ * looked up and locked once, and the interpolation state is carried
+ * from one point to the next as the archive is read forwards.
+ */
+int
+pmFetchInterpRange(int numpmid, pmID *pmidlist, int *instlist,
+		   const struct timeval *start, const struct timeval *step,
+		   int count, double *values)
+{
+    __pmContext		*ctxp = NULL;
+    __pmLogCtl		*lcp;
+    pmDesc		*desclist = NULL;
+    pmID		*uniq = NULL;	/* distinct pmids, to be fetched */
+    int			*col = NULL;	/* pmidlist[i] is uniq[col[i]] */
+    int			*hint = NULL;	/* ... at vlist[hint[i]] last time */
+    pmID		*newlist = NULL;
+    pmID		*fetchlist;
+    int			fetchcnt;
+    pmResult		*rp;
+    pmAtomValue		atom;
+    pmValueSet		*vsp;
+    double		nan = (double)0.0 / (double)0.0;	/* nan(""); */
+    double		step_ms;
+    int			nuniq = 0;
+    int			have_dm;
+    int			nvalues = 0;
+    int			i, j, k;
+    int			n;
+
+    if (numpmid < 1 || count < 1)
+	return PM_ERR_TOOSMALL;
+    if (step->tv_sec < 0 || step->tv_usec < 0 ||
+	(step->tv_sec == 0 && step->tv_usec == 0))
+	return -EINVAL;
+
+    if ((desclist = (pmDesc *)malloc(numpmid * sizeof(pmDesc))) == NULL ||
+	(uniq = (pmID *)malloc(numpmid * sizeof(pmID))) == NULL ||
+	(col = (int *)malloc(numpmid * sizeof(int))) == NULL ||
+	(hint = (int *)calloc(numpmid, sizeof(int))) == NULL) {
+	n = -oserror();
+	goto done;
+    }
+    for (i = 0; i < numpmid; i++) {
+	if ((n = pmLookupDesc(pmidlist[i], &desclist[i])) < 0)
+	    goto done;
+	switch (desclist[i].type) {
+	    case PM_TYPE_32:
+	    case PM_TYPE_U32:
+	    case PM_TYPE_64:
+	    case PM_TYPE_U64:
+	    case PM_TYPE_FLOAT:
+	    case PM_TYPE_DOUBLE:
+		break;
+	    default:
+		n = PM_ERR_TYPE;
+		goto done;
+	}
+	for (j = 0; j < nuniq; j++) {
+	    if (uniq[j] == pmidlist[i])
+		break;
+	}
+	if (j == nuniq)
+	    uniq[nuniq++] = pmidlist[i];
+	col[i] = j;
+    }
+    for (i = 0; i < numpmid * count; i++)
+	values[i] = nan;
+
+    if ((n = pmWhichContext()) < 0)
+	goto done;
+    if ((ctxp = __pmHandleToPtr(n)) == NULL) {
+	n = PM_ERR_NOCONTEXT;
+	goto done;
+    }
+    if (ctxp->c_type != PM_CONTEXT_ARCHIVE) {
+	n = PM_ERR_NOTARCHIVE;
+	goto done;
+    }
+    lcp = ctxp->c_archctl->ac_log;
+
+    /* for derived metrics, may need to rewrite the pmidlist */
+    have_dm = fetchcnt = __pmPrepareFetch(ctxp, nuniq, uniq, &newlist);
+    if (fetchcnt > nuniq)
+	fetchlist = newlist;
+    else {
+	fetchlist = uniq;
+	fetchcnt = nuniq;
+    }
+
+    /*
+     * as for pmSetMode(PM_MODE_INTERP, start, step) ... the delta only
+     * sets the direction and scan hints, each origin is computed below
+     */
+    step_ms = step->tv_sec * 1000.0 + step->tv_usec / 1000.0;
+    if (step_ms <= INT_MAX) {
+	ctxp->c_mode = PM_MODE_INTERP;
+	ctxp->c_delta = step_ms < 1.0 ? 1 : (int)step_ms;
+    }
+    else {
+	ctxp->c_mode = PM_MODE_INTERP | PM_XTB_SET(PM_TIME_SEC);
+	ctxp->c_delta = step->tv_sec < INT_MAX ? (int)step->tv_sec : INT_MAX;
+    }
+    ctxp->c_origin.tv_sec = (__int32_t)start->tv_sec;
+    ctxp->c_origin.tv_usec = (__int32_t)start->tv_usec;
+    PM_LOCK(lcp->l_lock);
+    __pmLogSetTime(ctxp);
+    PM_UNLOCK(lcp->l_lock);
+    __pmLogResetInterp(ctxp);
+
+    for (k = 0; k < count; k++) {
+	__int64_t	usec;
+
+	usec = (__int64_t)start->tv_usec + k * (__int64_t)step->tv_usec;
+	ctxp->c_origin.tv_sec = (__int32_t)(start->tv_sec + k * (__int64_t)step->tv_sec + usec / 1000000);
+	ctxp->c_origin.tv_usec = (__int32_t)(usec % 1000000);
+
+	PM_LOCK(lcp->l_lock);
+	n = __pmLogFetch(ctxp, fetchcnt, fetchlist, &rp);
+	PM_UNLOCK(lcp->l_lock);
+	if (n == PM_ERR_EOL)
+	    /* beyond the end of the archive, no more values */
+	    break;
+	if (n < 0)
+	    goto done;
+	if (have_dm)
+	    __pmFinishResult(ctxp, n, &rp);
+
+	for (i = 0; i < numpmid; i++) {
+	    vsp = rp->vset[col[i]];
+	    if (vsp->numval <= 0)
+		continue;
+	    j = hint[i];
+	    if (j >= vsp->numval || vsp->vlist[j].inst != instlist[i]) {
+		for (j = 0; j < vsp->numval; j++) {
+		    if (vsp->vlist[j].inst == instlist[i])
+			break;
+		}
+		if (j == vsp->numval)
+		    continue;
+		hint[i] = j;
+	    }
+	    if (pmExtractValue(vsp->valfmt, &vsp->vlist[j], desclist[i].type,
+			       &atom, PM_TYPE_DOUBLE) < 0)
+		continue;
+	    values[i * count + k] = atom.d;
+	    nvalues++;
+	}
+	pmFreeResult(rp);
+    }
+    n = nvalues;
+
+done:
+    if (ctxp != NULL)
+	PM_UNLOCK(ctxp->c_lock);
+    if (newlist != NULL)
+	free(newlist);
+    if (desclist != NULL)
+	free(desclist);
+    if (uniq != NULL)
+	free(uniq);
+    if (col != NULL)
+	free(col);
+    if (hint != NULL)
+	free(hint);
+    return n;
+}
+
 int
 pmSetMode(int mode, const struct timeval *when, int delta)
 {
@@ -248,6 +431,8 @@ pmSetMode(int mode, const struct timeval *when, int delta)
 	    /* assume PM_CONTEXT_ARCHIVE */
 	    if (l_mode == PM_MODE_INTERP ||
 		l_mode == PM_MODE_FORW || l_mode == PM_MODE_BACK) {
+		__pmLogCtl	*lcp = ctxp->c_archctl->ac_log;
+
 		if (when != NULL) {
 		    /*
 		     * special case of NULL for timestamp
@@ -258,7 +443,9 @@ pmSetMode(int mode, const struct timeval *when, int delta)
 		}
 		ctxp->c_mode = mode;
 		ctxp->c_delta = delta;
+		PM_LOCK(lcp->l_lock);
 		__pmLogSetTime(ctxp);
+		PM_UNLOCK(lcp->l_lock);
 		__pmLogResetInterp(ctxp);
 		n = 0;
 	    }
@@ -135,7 +135,9 @@ __pmFetchLocal(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **resul
 	/* Copy results back
 	 *
 	 * Note: We DO NOT have to free tmp_ans since DSO PMDA would
-	 *		ALWAYS return a pointer to the static area.
+	 *		either return a pointer to the static area, or
+	 *		(pmdaFetch) a PDU buffer holding the value sets too,
+	 *		which pmFreeResult(ans) releases via the value sets.
 	 */
 	for (n = 0, k = j; k < numpmid && n < cnt; k++) {
 	    if (pmidlist[k] == splitlist[n]) {
@@ -18,23 +18,62 @@
 
 /* Free result buffer routines */
 
+/*
+ * PDU buffers holding the vset[]s of one result.  Usually there is
+ * just one (a decoded PDU or an arena-backed result), but a result for
+ * a PM_CONTEXT_LOCAL context gathers vset[]s from several DSO PMDAs.
+ */
+typedef struct {
+    char	*base;
+    int		size;
+} bufrange_t;
+
+#define NRANGE	8
+
 static void
 __pmFreeResultValueSets(pmValueSet **ppvstart, pmValueSet **ppvsend)
 {
     pmValueSet *pvs;
     pmValueSet **ppvs;
     char	strbuf[20];
+    bufrange_t	srange[NRANGE];
+    bufrange_t	*range = srange;
+    int		maxrange = NRANGE;
+    int		nrange = 0;
+    int		i;
     int		j;
 
-    /* if _any_ vset[] -> an address within a pdubuf, we are done */
-    for (ppvs = ppvstart; ppvs < ppvsend; ppvs++) {
-	if (__pmUnpinPDUBuf((void *)*ppvs))
-	    return;
-    }
-
-    /* not created from a pdubuf, really free the memory */
     for (ppvs = ppvstart; ppvs < ppvsend; ppvs++) {
 	pvs = *ppvs;
+	for (i = 0; i < nrange; i++) {
+	    if ((char *)pvs >= range[i].base &&
+		(char *)pvs < range[i].base + range[i].size)
+		break;
+	}
+	if (i < nrange)
+	    continue;
+	if (nrange == maxrange) {
+	    bufrange_t	*tmp;
+
+	    if ((tmp = (bufrange_t *)malloc(2 * maxrange * sizeof(bufrange_t))) == NULL) {
+		__pmNoMem("__pmFreeResultValueSets", 2 * maxrange * sizeof(bufrange_t), PM_FATAL_ERR);
+	    }
+	    memcpy(tmp, range, nrange * sizeof(bufrange_t));
+	    if (range != srange)
+		free(range);
+	    range = tmp;
+	    maxrange *= 2;
+	}
+	/*
+	 * a vset[] within a pdubuf is released by unpinning the pdubuf,
+	 * once only and not until all the vset[]s have been looked at
+	 */
+	if ((range[nrange].size = __pmPDUBufRange((void *)pvs, &range[nrange].base)) > 0) {
+	    nrange++;
+	    continue;
+	}
+
+	/* not created from a pdubuf, really free the memory */
 	if (pvs->numval > 0 && pvs->valfmt == PM_VAL_DPTR) {
 	    /* pmValueBlocks may be malloc'd as well */
 	    for (j = 0; j < pvs->numval; j++) {
@@ -52,6 +91,11 @@ __pmFreeResultValueSets(pmValueSet **ppvstart, pmValueSet **ppvsend)
 		pvs, pmIDStr_r(pvs->pmid, strbuf, sizeof(strbuf)));
 	free(pvs);
     }
+
+    for (i = 0; i < nrange; i++)
+	__pmUnpinPDUBuf((void *)range[i].base);
+    if (range != srange)
+	free(range);
 }
 
 void
@@ -60,6 +104,9 @@ __pmFreeResultValues(pmResult *result)
     if (pmDebug & DBG_TRACE_PDUBUF)
 	fprintf(stderr, "__pmFreeResultValues(" PRINTF_P_PFX "%p) numpmid=%d\n",
 	    result, result->numpmid);
+    /* arena-backed, the pmResult and all its values are in one pdubuf */
+    if (__pmUnpinPDUBuf((void *)result))
+	return;
     if (result->numpmid)
 	__pmFreeResultValueSets(result->vset, &result->vset[result->numpmid]);
 }
@@ -69,7 +116,10 @@ pmFreeResult(pmResult *result)
 {
     if (pmDebug & DBG_TRACE_PDUBUF)
 	fprintf(stderr, "pmFreeResult(" PRINTF_P_PFX "%p)\n", result);
-    __pmFreeResultValues(result);
+    if (__pmUnpinPDUBuf((void *)result))
+	return;
+    if (result->numpmid)
+	__pmFreeResultValueSets(result->vset, &result->vset[result->numpmid]);
     free(result);
 }
 
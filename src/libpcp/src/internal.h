@@ -30,6 +30,12 @@ extern int __pmPtrToHandle(__pmContext *) _PCP_HIDDEN;
 
 extern int __pmGetDate(struct timespec *, char const *, struct timespec const *)  _PCP_HIDDEN;
 
+struct stat;
+extern FILE *__pmLogXzOpen(const char *) _PCP_HIDDEN;
+extern int __pmLogFileno(FILE *) _PCP_HIDDEN;
+extern int __pmLogFstat(FILE *, struct stat *) _PCP_HIDDEN;
+extern __pmResultArena *__pmLogArena(__pmArchCtl *) _PCP_HIDDEN;
+
 #ifdef HAVE_NETWORK_BYTEORDER
 /*
  * no-ops if already in network byte order but
@@ -107,6 +113,7 @@ typedef struct {
     char	*derive_errmsg;	/* derived metric parser error message */
     __pmnsTree  *curr_pmns;     /* current pmns */
     int         useExtPMNS;     /* ... was the result of a __pmUsePMNS */
+    int		__pmLastUsedFd;	/* fd for last PDU sent or received */
 } __pmTPD;
 
 static inline __pmTPD *
@@ -36,6 +36,7 @@
 #include <assert.h>
 #include "pmapi.h"
 #include "impl.h"
+#include "internal.h"
 
 #define UPD_MARK_NONE	0
 #define UPD_MARK_FORW	1
@@ -101,18 +102,41 @@ typedef struct pmidcntl {		/* metric control */
     struct instcntl	*first;		/* first metric-instace control */
 } pmidcntl_t;
 
-typedef struct {
-    pmResult	*rp;		/* cached pmResult from __pmLogRead */
-    int		sts;		/* from __pmLogRead */
-    char	*l_name;	/* log name */
-    int		vol;		/* log volume */
-    long	head_posn;	/* posn in file before forwards __pmLogRead */
-    long	tail_posn;	/* posn in file after forwards __pmLogRead */
-    int		mode;		/* PM_MODE_FORW or PM_MODE_BACK */
-    int		used;		/* used count for LFU replacement */
+/*
+ * Read cache ... pmResults from __pmLogRead are cached per context and
+ * keyed by (archive, volume, offset), using both the offset before a
+ * forwards read (head) and the offset after it (tail), so that a record
+ * is found again when reading in either direction.  Each entry is hashed
+ * on both keys, and all entries are on a list in most recently used
+ * order, the least recently used entry being reused once the cache holds
+ * ac_cache_size results (or DEFAULT_CACHE, or $PCP_INTERP_CACHE).
+ */
+typedef struct cache {
+    struct cache	*next;		/* LRU list, most recently used first */
+    struct cache	*prev;
+    struct cache	*head_next;	/* hash chain on head_posn */
+    struct cache	*tail_next;	/* hash chain on tail_posn */
+    pmResult		*rp;		/* cached pmResult from __pmLogRead */
+    int			sts;		/* from __pmLogRead */
+    int			log;		/* archive (ac_cur_log), -1 if unused */
+    int			vol;		/* log volume */
+    long		head_posn;	/* posn in file before forwards __pmLogRead */
+    long		tail_posn;	/* posn in file after forwards __pmLogRead */
 } cache_t;
 
-#define NUMCACHE 4
+typedef struct {
+    cache_t		lru;		/* list head, lru.prev is least recently used */
+    cache_t		**head_hash;
+    cache_t		**tail_hash;
+    unsigned int	hsize;		/* hash table size, a power of 2 */
+    int			count;		/* entries allocated */
+    int			size;		/* maximum entries */
+    __uint64_t		hit;
+    __uint64_t		miss;
+    __uint64_t		evict;
+} cachectl_t;
+
+#define DEFAULT_CACHE 64
 
 /*
  * diagnostic counters ... indexed by PM_MODE_FORW (2) and
@@ -121,6 +145,155 @@ typedef struct {
 static long	nr_cache[PM_MODE_BACK+1];
 static long	nr[PM_MODE_BACK+1];
 
+static unsigned int
+cache_hash(cachectl_t *ccp, int log, int vol, long posn)
+{
+    unsigned int	h;
+
+    h = (unsigned int)posn ^ ((unsigned int)(posn >> 16) << 5);
+    h = (h ^ (vol << 20) ^ (log << 26)) * 2654435761U;
+    return (h >> 8) & (ccp->hsize - 1);
+}
+
+static void
+cache_unhash(cachectl_t *ccp, cache_t *cp)
+{
+    cache_t	**cpp;
+
+    if (cp->log < 0)
+	return;
+    for (cpp = &ccp->head_hash[cache_hash(ccp, cp->log, cp->vol, cp->head_posn)];
+	 *cpp != NULL; cpp = &(*cpp)->head_next) {
+	if (*cpp == cp) {
+	    *cpp = cp->head_next;
+	    break;
+	}
+    }
+    for (cpp = &ccp->tail_hash[cache_hash(ccp, cp->log, cp->vol, cp->tail_posn)];
+	 *cpp != NULL; cpp = &(*cpp)->tail_next) {
+	if (*cpp == cp) {
+	    *cpp = cp->tail_next;
+	    break;
+	}
+    }
+    cp->log = -1;
+}
+
+static void
+cache_rehash(cachectl_t *ccp, cache_t *cp)
+{
+    unsigned int	h;
+
+    h = cache_hash(ccp, cp->log, cp->vol, cp->head_posn);
+    cp->head_next = ccp->head_hash[h];
+    ccp->head_hash[h] = cp;
+    h = cache_hash(ccp, cp->log, cp->vol, cp->tail_posn);
+    cp->tail_next = ccp->tail_hash[h];
+    ccp->tail_hash[h] = cp;
+}
+
+static void
+cache_unlink(cache_t *cp)
+{
+    cp->prev->next = cp->next;
+    cp->next->prev = cp->prev;
+}
+
+/* link at the most recently used end, else least recently used */
+static void
+cache_link(cachectl_t *ccp, cache_t *cp, int recent)
+{
+    cache_t	*after = recent ? &ccp->lru : ccp->lru.prev;
+
+    cp->prev = after;
+    cp->next = after->next;
+    after->next->prev = cp;
+    after->next = cp;
+}
+
+static void
+cache_release(cachectl_t *ccp, cache_t *cp)
+{
+    cache_unhash(ccp, cp);
+    cache_unlink(cp);
+    if (cp->rp != NULL)
+	pmFreeResult(cp->rp);
+    free(cp);
+    ccp->count--;
+}
+
+/*
+ * Set the maximum number of cached results, discarding the least
+ * recently used beyond that and resizing the hash tables to suit.
+ */
+static int
+cache_resize(cachectl_t *ccp, int size)
+{
+    cache_t		**head_hash, **tail_hash;
+    cache_t		*cp;
+    unsigned int	hsize;
+
+    while (ccp->count > size) {
+	cache_release(ccp, ccp->lru.prev);
+	ccp->evict++;
+    }
+
+    for (hsize = 16; hsize < 2 * (unsigned int)size; hsize <<= 1)
+	;
+    if (hsize != ccp->hsize) {
+	head_hash = (cache_t **)calloc(hsize, sizeof(cache_t *));
+	tail_hash = (cache_t **)calloc(hsize, sizeof(cache_t *));
+	if (head_hash == NULL || tail_hash == NULL) {
+	    free(head_hash);
+	    free(tail_hash);
+	    return -ENOMEM;
+	}
+	free(ccp->head_hash);
+	free(ccp->tail_hash);
+	ccp->head_hash = head_hash;
+	ccp->tail_hash = tail_hash;
+	ccp->hsize = hsize;
+	for (cp = ccp->lru.next; cp != &ccp->lru; cp = cp->next) {
+	    if (cp->log >= 0)
+		cache_rehash(ccp, cp);
+	}
+    }
+    ccp->size = size;
+    return 0;
+}
+
+/* size set for this context, else $PCP_INTERP_CACHE, else the default */
+static int
+cache_size(__pmArchCtl *acp)
+{
+    char	*env;
+    int		size = acp->ac_cache_size;
+
+    if (size <= 0 && ((env = getenv("PCP_INTERP_CACHE")) == NULL ||
+		      (size = atoi(env)) <= 0))
+	size = DEFAULT_CACHE;
+    return size;
+}
+
+static cachectl_t *
+cache_init(__pmArchCtl *acp)
+{
+    cachectl_t	*ccp;
+
+    if (acp->ac_cache != NULL)
+	return (cachectl_t *)acp->ac_cache;
+
+    if ((ccp = (cachectl_t *)calloc(1, sizeof(cachectl_t))) == NULL)
+	return NULL;
+    ccp->lru.next = ccp->lru.prev = &ccp->lru;
+    if (cache_resize(ccp, cache_size(acp)) < 0) {
+	free(ccp);
+	return NULL;
+    }
+    acp->ac_cache = (void *)ccp;
+    return ccp;
+}
+
 /*
  * called with the context lock held
  */
@@ -128,13 +301,11 @@ static int
 cache_read(__pmArchCtl *acp, int mode, pmResult **rp)
 {
     long	posn;
+    cachectl_t	*ccp;
     cache_t	*cp;
-    cache_t	*lfup;
-    cache_t	*cache;
-    char	*save_curlog_name;
     int		sts;
+    int		save_curlog;
     int		save_curvol;
-    int		archive_changed;
 
     /*
      * If the previous __pmLogRead generated a virtual MARK record and we have
@@ -154,15 +325,8 @@ cache_read(__pmArchCtl *acp, int mode, pmResult **rp)
     else
 	posn = 0;
 
-    if (acp->ac_cache == NULL) {
-	/* cache initialization */
-	acp->ac_cache = cache = (cache_t *)calloc(NUMCACHE, sizeof(cache_t));
-	if (!cache)
-	    return -ENOMEM;
-	acp->ac_cache_idx = 0;
-    }
-    else
-	cache = acp->ac_cache;
+    if ((ccp = cache_init(acp)) == NULL)
+	return -ENOMEM;
 
 #ifdef PCP_DEBUG
     if ((pmDebug & DBG_TRACE_LOG) && (pmDebug & DBG_TRACE_DESPERATE)) {
@@ -175,16 +339,28 @@ cache_read(__pmArchCtl *acp, int mode, pmResult **rp)
     }
 #endif
 
-    acp->ac_cache_idx = (acp->ac_cache_idx + 1) % NUMCACHE;
-    lfup = &cache[acp->ac_cache_idx];
-    for (cp = cache; cp < &cache[NUMCACHE]; cp++) {
-	if (cp->l_name != NULL && strcmp(cp->l_name, acp->ac_log->l_name) == 0 &&
-	    cp->vol == acp->ac_vol &&
-	    ((mode == PM_MODE_FORW && cp->head_posn == posn) ||
-	     (mode == PM_MODE_BACK && cp->tail_posn == posn)) &&
-	    cp->rp != NULL) {
+    if (posn != 0) {
+	if (mode == PM_MODE_FORW) {
+	    cp = ccp->head_hash[cache_hash(ccp, acp->ac_cur_log, acp->ac_vol, posn)];
+	    for ( ; cp != NULL; cp = cp->head_next) {
+		if (cp->head_posn == posn && cp->vol == acp->ac_vol &&
+		    cp->log == acp->ac_cur_log)
+		    break;
+	    }
+	}
+	else {
+	    cp = ccp->tail_hash[cache_hash(ccp, acp->ac_cur_log, acp->ac_vol, posn)];
+	    for ( ; cp != NULL; cp = cp->tail_next) {
+		if (cp->tail_posn == posn && cp->vol == acp->ac_vol &&
+		    cp->log == acp->ac_cur_log)
+		    break;
+	    }
+	}
+	if (cp != NULL) {
 	    *rp = cp->rp;
-	    cp->used++;
+	    cache_unlink(cp);
+	    cache_link(ccp, cp, 1);
+	    ccp->hit++;
 	    if (mode == PM_MODE_FORW)
 		fseek(acp->ac_log->l_mfp, cp->tail_posn, SEEK_SET);
 	    else
@@ -196,10 +372,10 @@ cache_read(__pmArchCtl *acp, int mode, pmResult **rp)
 		tmp.tv_sec = (__int32_t)cp->rp->timestamp.tv_sec;
 		tmp.tv_usec = (__int32_t)cp->rp->timestamp.tv_usec;
 		t_this = __pmTimevalSub(&tmp, __pmLogStartTime(acp));
-		fprintf(stderr, "hit cache[%d] t=%.6f\n",
-		    (int)(cp - cache), t_this);
-		nr_cache[mode]++;
+		fprintf(stderr, "hit cache " PRINTF_P_PFX "%p t=%.6f\n",
+		    cp, t_this);
 	    }
+	    nr_cache[mode]++;
 #endif
 	    acp->ac_mark_done = 0;
 	    sts = cp->sts;
@@ -212,88 +388,138 @@ cache_read(__pmArchCtl *acp, int mode, pmResult **rp)
 	fprintf(stderr, "miss\n");
     nr[mode]++;
 #endif
-
-    if (lfup->rp != NULL)
-	pmFreeResult(lfup->rp);
+    ccp->miss++;
+
+    /* a new entry until the cache is full, then the least recently used */
+    if (ccp->count < ccp->size &&
+	(cp = (cache_t *)calloc(1, sizeof(cache_t))) != NULL) {
+	cp->log = -1;
+	cache_link(ccp, cp, 0);
+	ccp->count++;
+    }
+    else {
+	cp = ccp->lru.prev;
+	if (cp == &ccp->lru)
+	    return -ENOMEM;
+	if (cp->log >= 0)
+	    ccp->evict++;
+	cache_unhash(ccp, cp);
+	if (cp->rp != NULL) {
+	    pmFreeResult(cp->rp);
+	    cp->rp = NULL;
+	}
+    }
 
     /*
      * We need to know when we cross archive or volume boundaries.
-     * The only way to know if the archive has changed is to check whether the
-     * archive name has changed.
      */
-    if ((save_curlog_name = strdup(acp->ac_log->l_name)) == NULL) {
-	__pmNoMem("__pmLogFetchInterp.save_curlog_name",
-		  strlen(acp->ac_log->l_name) + 1, PM_FATAL_ERR);
-    }
+    save_curlog = acp->ac_cur_log;
     save_curvol = acp->ac_log->l_curvol;
 
-    lfup->sts = __pmLogRead(acp->ac_log, mode, NULL, &lfup->rp, PMLOGREAD_NEXT);
-    if (lfup->sts < 0)
-	lfup->rp = NULL;
-    *rp = lfup->rp;
-
-    archive_changed = strcmp(save_curlog_name, acp->ac_log->l_name) != 0;
-    free(save_curlog_name);
+    cp->sts = __pmLogRead(acp->ac_log, mode, NULL, &cp->rp, PMLOGREAD_NEXT);
+    if (cp->sts < 0)
+	cp->rp = NULL;
+    *rp = cp->rp;
 
     /*
      * vol/arch switch since last time, or vol/arch switch or virtual mark
      * record generated in __pmLogRead() ...
      * new vol/arch, stdio stream and we don't know where we started from
-     * ... don't cache
+     * ... don't cache, and leave the entry to be reused first
      */
-    if (posn == 0 || save_curvol != acp->ac_log->l_curvol || archive_changed ||
-	acp->ac_mark_done) {
-	if (lfup->l_name) {
-	    free(lfup->l_name);
-	    lfup->l_name = NULL;
-	}
+    if (posn == 0 || save_curvol != acp->ac_log->l_curvol ||
+	save_curlog != acp->ac_cur_log || acp->ac_mark_done || cp->rp == NULL) {
 #ifdef PCP_DEBUG
 	if ((pmDebug & DBG_TRACE_LOG) && (pmDebug & DBG_TRACE_DESPERATE))
-	    fprintf(stderr, "cache_read: reload vol switch, mark cache[%d] unused\n",
-		(int)(lfup - cache));
+	    fprintf(stderr, "cache_read: reload vol switch, mark cache "
+		PRINTF_P_PFX "%p unused\n", cp);
 #endif
     }
     else {
-	lfup->mode = mode;
-	lfup->vol = acp->ac_vol;
-	lfup->used = 1;
-	/* Try to avoid excessive copying/freeing of the archive name. */
-	if (lfup->l_name != NULL && strcmp(lfup->l_name, acp->ac_log->l_name) != 0) {
-	    free(lfup->l_name);
-	    lfup->l_name = NULL;
-	}
-	if (lfup->l_name == NULL) {
-	    if ((lfup->l_name = strdup(acp->ac_log->l_name)) == NULL) {
-		__pmNoMem("__pmLogFetchInterp.l_name",
-			  strlen(acp->ac_log->l_name) + 1, PM_FATAL_ERR);
-	    }
-	}
+	cp->log = acp->ac_cur_log;
+	cp->vol = acp->ac_vol;
 	if (mode == PM_MODE_FORW) {
-	    lfup->head_posn = posn;
-	    lfup->tail_posn = ftell(acp->ac_log->l_mfp);
-	    assert(lfup->tail_posn >= 0);
+	    cp->head_posn = posn;
+	    cp->tail_posn = ftell(acp->ac_log->l_mfp);
+	    assert(cp->tail_posn >= 0);
 	}
 	else {
-	    lfup->tail_posn = posn;
-	    lfup->head_posn = ftell(acp->ac_log->l_mfp);
-	    assert(lfup->head_posn >= 0);
+	    cp->tail_posn = posn;
+	    cp->head_posn = ftell(acp->ac_log->l_mfp);
+	    assert(cp->head_posn >= 0);
 	}
+	cache_rehash(ccp, cp);
+	cache_unlink(cp);
+	cache_link(ccp, cp, 1);
 #ifdef PCP_DEBUG
 	if ((pmDebug & DBG_TRACE_LOG) && (pmDebug & DBG_TRACE_DESPERATE)) {
-	    fprintf(stderr, "cache_read: reload cache[%d] vol=%d (curvol=%d) head=%ld tail=%ld ",
-		(int)(lfup - cache), lfup->vol, acp->ac_log->l_curvol,
-		(long)lfup->head_posn, (long)lfup->tail_posn);
-	    if (lfup->sts == 0)
-		fprintf(stderr, "sts=%d\n", lfup->sts);
+	    fprintf(stderr, "cache_read: reload cache " PRINTF_P_PFX "%p vol=%d (curvol=%d) head=%ld tail=%ld ",
+		cp, cp->vol, acp->ac_log->l_curvol,
+		(long)cp->head_posn, (long)cp->tail_posn);
+	    if (cp->sts == 0)
+		fprintf(stderr, "sts=%d\n", cp->sts);
 	    else {
 		char	errmsg[PM_MAXERRMSGLEN];
-		fprintf(stderr, "sts=%s\n", pmErrStr_r(lfup->sts, errmsg, sizeof(errmsg)));
+		fprintf(stderr, "sts=%s\n", pmErrStr_r(cp->sts, errmsg, sizeof(errmsg)));
 	    }
 	}
 #endif
     }
 
-    return lfup->sts;
+    return cp->sts;
+}
+
+int
+pmGetInterpCacheStats(pmInterpCacheStats *stats)
+{
+    __pmContext	*ctxp;
+    cachectl_t	*ccp;
+    int		sts;
+
+    if ((sts = pmWhichContext()) < 0)
+	return sts;
+    if ((ctxp = __pmHandleToPtr(sts)) == NULL)
+	return PM_ERR_NOCONTEXT;
+    if (ctxp->c_type != PM_CONTEXT_ARCHIVE) {
+	PM_UNLOCK(ctxp->c_lock);
+	return PM_ERR_NOTARCHIVE;
+    }
+    memset(stats, 0, sizeof(*stats));
+    if ((ccp = (cachectl_t *)ctxp->c_archctl->ac_cache) != NULL) {
+	stats->hit = ccp->hit;
+	stats->miss = ccp->miss;
+	stats->evict = ccp->evict;
+	stats->count = ccp->count;
+	stats->size = ccp->size;
+    }
+    else
+	stats->size = cache_size(ctxp->c_archctl);
+    PM_UNLOCK(ctxp->c_lock);
+    return 0;
+}
+
+int
+pmSetInterpCacheSize(int size)
+{
+    __pmContext	*ctxp;
+    int		sts;
+
+    if (size < 1)
+	return -EINVAL;
+    if ((sts = pmWhichContext()) < 0)
+	return sts;
+    if ((ctxp = __pmHandleToPtr(sts)) == NULL)
+	return PM_ERR_NOCONTEXT;
+    if (ctxp->c_type != PM_CONTEXT_ARCHIVE)
+	sts = PM_ERR_NOTARCHIVE;
+    else if (ctxp->c_archctl->ac_cache != NULL)
+	sts = cache_resize((cachectl_t *)ctxp->c_archctl->ac_cache, size);
+    else
+	sts = 0;
+    if (sts == 0)
+	ctxp->c_archctl->ac_cache_size = size;
+    PM_UNLOCK(ctxp->c_lock);
+    return sts;
 }
 
 void
@@ -693,6 +919,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
     double	t_this;
     pmResult	*rp;
     pmResult	*logrp;
+    __pmResultArena	*ap;
+    pmValueSet	*vsp;
     __pmHashCtl	*hcp = &ctxp->c_archctl->ac_pmid_hc;
     __pmHashNode	*hp;
     pmidcntl_t	*pcp = NULL;	/* initialize to pander to gcc */
@@ -706,16 +934,22 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
     __pmTimeval	tmp;
     struct timeval delta_tv;
 
-    PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
     if (dowrap == -1) {
-	/* PCP_COUNTER_WRAP in environment enables "counter wrap" logic */
-	if (getenv("PCP_COUNTER_WRAP") == NULL)
-	    dowrap = 0;
-	else
-	    dowrap = 1;
+	/*
+	 * one-trip, and every thread would compute the same value, so
+	 * the libpcp lock is not needed once dowrap has been set
+	 */
+	PM_INIT_LOCKS();
+	PM_LOCK(__pmLock_libpcp);
+	if (dowrap == -1) {
+	    /* PCP_COUNTER_WRAP in environment enables "counter wrap" logic */
+	    if (getenv("PCP_COUNTER_WRAP") == NULL)
+		dowrap = 0;
+	    else
+		dowrap = 1;
+	}
+	PM_UNLOCK(__pmLock_libpcp);
     }
-    PM_UNLOCK(__pmLock_libpcp);
 
     t_req = __pmTimevalSub(&ctxp->c_origin, __pmLogStartTime(ctxp->c_archctl));
 
@@ -767,12 +1001,10 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 	}
     }
 
-    if ((rp = (pmResult *)malloc(sizeof(pmResult) + (numpmid - 1) * sizeof(pmValueSet *))) == NULL)
+    /* the pmResult is built in the context's result arena */
+    if ((ap = __pmLogArena(ctxp->c_archctl)) == NULL)
 	return -oserror();
-
-    rp->timestamp.tv_sec = ctxp->c_origin.tv_sec;
-    rp->timestamp.tv_usec = ctxp->c_origin.tv_usec;
-    rp->numpmid = numpmid;
+    __pmArenaReset(ap);
 
     /* zeroth pass ... clear search and inresult flags */
     for (j = 0; j < hcp->hsize; j++) {
@@ -806,8 +1038,6 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 	    pcp->last_numval = -1;
 	    sts = __pmHashAdd((int)pmidlist[j], (void *)pcp, hcp);
 	    if (sts < 0) {
-		rp->numpmid = j;
-		pmFreeResult(rp);
 		free(pcp);
 		return sts;
 	    }
@@ -910,10 +1140,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		assert(ctxp->c_archctl->ac_offset >= 0);
 		ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_log->l_curvol;
 		sts = update_bounds(ctxp, t_req, logrp, UPD_MARK_NONE, NULL, NULL);
-		if (sts < 0) {
-		    free(rp);
+		if (sts < 0)
 		    return sts;
-		}
 	    }
 	}
 	else {
@@ -928,10 +1156,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		assert(ctxp->c_archctl->ac_offset >= 0);
 		ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_log->l_curvol;
 		sts = update_bounds(ctxp, t_req, logrp, UPD_MARK_NONE, NULL, NULL);
-		if (sts < 0) {
-		    free(rp);
+		if (sts < 0)
 		    return sts;
-		}
 	    }
 	}
 	ctxp->c_archctl->ac_serial = 1;
@@ -987,10 +1213,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 			if (ctxp->c_delta > 0)  {
 			    /* forwards before scanning back */
 			    sts = do_roll(ctxp, t_req, &seen_mark);
-			    if (sts < 0) {
-				free(rp);
+			    if (sts < 0)
 				return sts;
-			    }
 			}
 		    }
 		}
@@ -1053,10 +1277,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_log->l_curvol;
 	    }
 	    sts = update_bounds(ctxp, t_req, logrp, UPD_MARK_BACK, &done, &seen_mark);
-	    if (sts < 0) {
-		free(rp);
+	    if (sts < 0)
 		return sts;
-	    }
 
 	    /*
 	     * forget about those that can never be found from here
@@ -1109,10 +1331,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 			if (ctxp->c_delta < 0)  {
 			    /* backwards before scanning forwards */
 			    sts = do_roll(ctxp, t_req, &seen_mark);
-			    if (sts < 0) {
-				free(rp);
+			    if (sts < 0)
 				return sts;
-			    }
 			}
 		    }
 		}
@@ -1175,10 +1395,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		ctxp->c_archctl->ac_vol = ctxp->c_archctl->ac_log->l_curvol;
 	    }
 	    sts = update_bounds(ctxp, t_req, logrp, UPD_MARK_FORW, &done, &seen_mark);
-	    if (sts < 0) {
-		free(rp);
+	    if (sts < 0)
 		return sts;
-	    }
 
 	    /*
 	     * forget about those that can never be found from here
@@ -1271,33 +1489,19 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 
     for (j = 0; j < numpmid; j++) {
 	if (pmidlist[j] == PM_ID_NULL) {
-	    rp->vset[j] = (pmValueSet *)malloc(sizeof(pmValueSet) -
-					    sizeof(pmValue));
-	}
-	else {
-	    hp = __pmHashSearch((int)pmidlist[j], hcp);
-	    assert(hp != NULL);
-	    pcp = (pmidcntl_t *)hp->data;
-
-	    if (pcp->numval >= 1)
-		rp->vset[j] = (pmValueSet *)malloc(sizeof(pmValueSet) +
-						(pcp->numval - 1)*sizeof(pmValue));
-	    else
-		rp->vset[j] = (pmValueSet *)malloc(sizeof(pmValueSet) -
-						sizeof(pmValue));
+	    if (__pmArenaValueSet(ap, PM_ID_NULL, 0) == NULL) {
+		__pmNoMem("__pmLogFetchInterp.vset", sizeof(pmValueSet), PM_FATAL_ERR);
+	    }
+	    continue;
 	}
+	hp = __pmHashSearch((int)pmidlist[j], hcp);
+	assert(hp != NULL);
+	pcp = (pmidcntl_t *)hp->data;
 
-	if (rp->vset[j] == NULL) {
+	if ((vsp = __pmArenaValueSet(ap, pmidlist[j], pcp->numval)) == NULL) {
 	    __pmNoMem("__pmLogFetchInterp.vset", sizeof(pmValueSet), PM_FATAL_ERR);
 	}
-
-	rp->vset[j]->pmid = pmidlist[j];
-	if (pmidlist[j] == PM_ID_NULL) {
-	    rp->vset[j]->numval = 0;
-	    continue;
-	}
-	rp->vset[j]->numval = pcp->numval;
-	rp->vset[j]->valfmt = pcp->valfmt;
+	vsp->valfmt = pcp->valfmt;
 
 	i = 0;
 	if (pcp->numval > 0) {
@@ -1316,20 +1520,20 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 			icp->t_first, icp->t_last);
 		}
 #endif
-		rp->vset[j]->vlist[i].inst = icp->inst;
+		vsp->vlist[i].inst = icp->inst;
 		if (pcp->desc.type == PM_TYPE_32 || pcp->desc.type == PM_TYPE_U32) {
 		    if (icp->t_prior == t_req)
-			rp->vset[j]->vlist[i++].value.lval = icp->v_prior.lval;
+			vsp->vlist[i++].value.lval = icp->v_prior.lval;
 		    else if (icp->t_next == t_req)
-			rp->vset[j]->vlist[i++].value.lval = icp->v_next.lval;
+			vsp->vlist[i++].value.lval = icp->v_next.lval;
 		    else {
 			if (pcp->desc.sem == PM_SEM_DISCRETE) {
 			    if (icp->t_prior >= 0)
-				rp->vset[j]->vlist[i++].value.lval = icp->v_prior.lval;
+				vsp->vlist[i++].value.lval = icp->v_prior.lval;
 			}
 			else if (pcp->desc.sem == PM_SEM_INSTANT) {
 			    if (icp->t_prior >= 0 && icp->t_next >= 0)
-				rp->vset[j]->vlist[i++].value.lval = icp->v_prior.lval;
+				vsp->vlist[i++].value.lval = icp->v_prior.lval;
 			}
 			else {
 			    /* assume COUNTER */
@@ -1337,18 +1541,18 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 				if (pcp->desc.type == PM_TYPE_32) {
 				    if (icp->v_next.lval >= icp->v_prior.lval ||
 					dowrap == 0) {
-					rp->vset[j]->vlist[i++].value.lval = 0.5 +
+					vsp->vlist[i++].value.lval = 0.5 +
 					    icp->v_prior.lval + (t_req - icp->t_prior) *
 					    (icp->v_next.lval - icp->v_prior.lval) /
 					    (icp->t_next - icp->t_prior);
 				    }
 				    else {
 					/* not monotonic increasing and want wrap */
-					rp->vset[j]->vlist[i++].value.lval = 0.5 +
+					vsp->vlist[i++].value.lval = 0.5 +
 					    (t_req - icp->t_prior) *
 					    (__int32_t)(UINT_MAX - icp->v_prior.lval + 1 + icp->v_next.lval) /
 					    (icp->t_next - icp->t_prior);
-					rp->vset[j]->vlist[i].value.lval += icp->v_prior.lval;
+					vsp->vlist[i].value.lval += icp->v_prior.lval;
 				    }
 				}
 				else {
@@ -1378,7 +1582,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 						    (icp->t_next - icp->t_prior);
 					}
 				    }
-				    rp->vset[j]->vlist[i++].value.lval = av.ul;
+				    vsp->vlist[i++].value.lval = av.ul;
 				}
 			    }
 			}
@@ -1387,17 +1591,17 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		else if (pcp->desc.type == PM_TYPE_FLOAT && icp->metric->valfmt == PM_VAL_INSITU) {
 		    /* OLD style FLOAT insitu */
 		    if (icp->t_prior == t_req)
-			rp->vset[j]->vlist[i++].value.lval = icp->v_prior.lval;
+			vsp->vlist[i++].value.lval = icp->v_prior.lval;
 		    else if (icp->t_next == t_req)
-			rp->vset[j]->vlist[i++].value.lval = icp->v_next.lval;
+			vsp->vlist[i++].value.lval = icp->v_next.lval;
 		    else {
 			if (pcp->desc.sem == PM_SEM_DISCRETE) {
 			    if (icp->t_prior >= 0)
-				rp->vset[j]->vlist[i++].value.lval = icp->v_prior.lval;
+				vsp->vlist[i++].value.lval = icp->v_prior.lval;
 			}
 			else if (pcp->desc.sem == PM_SEM_INSTANT) {
 			    if (icp->t_prior >= 0 && icp->t_next >= 0)
-				rp->vset[j]->vlist[i++].value.lval = icp->v_prior.lval;
+				vsp->vlist[i++].value.lval = icp->v_prior.lval;
 			}
 			else {
 			    /* assume COUNTER */
@@ -1409,7 +1613,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 					(avp_next->f - avp_prior->f) /
 					(icp->t_next - icp->t_prior);
 				/* yes this IS correct ... */
-				rp->vset[j]->vlist[i++].value.lval = av.l;
+				vsp->vlist[i++].value.lval = av.l;
 			    }
 			}
 		    }
@@ -1421,14 +1625,13 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		    int			ok = 1;
 
 		    need = PM_VAL_HDR_SIZE + sizeof(float);
-		    if ((vp = (pmValueBlock *)malloc(need)) == NULL) {
+		    if ((vp = __pmArenaValueBlock(ap, need, &vsp->vlist[i++])) == NULL) {
 			sts = -oserror();
 			goto bad_alloc;
 		    }
 		    vp->vlen = need;
 		    vp->vtype = PM_TYPE_FLOAT;
-		    rp->vset[j]->valfmt = PM_VAL_DPTR;
-		    rp->vset[j]->vlist[i++].value.pval = vp;
+		    vsp->valfmt = PM_VAL_DPTR;
 		    if (icp->t_prior == t_req)
 			memcpy((void *)vp->vbuf, (void *)icp->v_prior.pval->vbuf, sizeof(float));
 		    else if (icp->t_next == t_req)
@@ -1470,8 +1673,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 			}
 		    }
 		    if (!ok) {
+			/* arena space is not reclaimed, just unused */
 			i--;
-			free(vp);
 		    }
 		}
 		else if (pcp->desc.type == PM_TYPE_64 || pcp->desc.type == PM_TYPE_U64) {
@@ -1480,7 +1683,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		    int			ok = 1;
 
 		    need = PM_VAL_HDR_SIZE + sizeof(__int64_t);
-		    if ((vp = (pmValueBlock *)malloc(need)) == NULL) {
+		    if ((vp = __pmArenaValueBlock(ap, need, &vsp->vlist[i++])) == NULL) {
 			sts = -oserror();
 			goto bad_alloc;
 		    }
@@ -1489,8 +1692,7 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 			vp->vtype = PM_TYPE_64;
 		    else
 			vp->vtype = PM_TYPE_U64;
-		    rp->vset[j]->valfmt = PM_VAL_DPTR;
-		    rp->vset[j]->vlist[i++].value.pval = vp;
+		    vsp->valfmt = PM_VAL_DPTR;
 		    if (icp->t_prior == t_req)
 			memcpy((void *)vp->vbuf, (void *)icp->v_prior.pval->vbuf, sizeof(__int64_t));
 		    else if (icp->t_next == t_req)
@@ -1613,8 +1815,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 			}
 		    }
 		    if (!ok) {
+			/* arena space is not reclaimed, just unused */
 			i--;
-			free(vp);
 		    }
 		}
 		else if (pcp->desc.type == PM_TYPE_DOUBLE) {
@@ -1623,14 +1825,13 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 		    int			ok = 1;
 
 		    need = PM_VAL_HDR_SIZE + sizeof(double);
-		    if ((vp = (pmValueBlock *)malloc(need)) == NULL) {
+		    if ((vp = __pmArenaValueBlock(ap, need, &vsp->vlist[i++])) == NULL) {
 			sts = -oserror();
 			goto bad_alloc;
 		    }
 		    vp->vlen = need;
 		    vp->vtype = PM_TYPE_DOUBLE;
-		    rp->vset[j]->valfmt = PM_VAL_DPTR;
-		    rp->vset[j]->vlist[i++].value.pval = vp;
+		    vsp->valfmt = PM_VAL_DPTR;
 		    if (icp->t_prior == t_req)
 			memcpy((void *)vp->vbuf, (void *)icp->v_prior.pval->vbuf, sizeof(double));
 		    else if (icp->t_next == t_req)
@@ -1670,8 +1871,8 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 			}
 		    }
 		    if (!ok) {
+			/* arena space is not reclaimed, just unused */
 			i--;
-			free(vp);
 		    }
 		}
 		else if ((pcp->desc.type == PM_TYPE_AGGREGATE ||
@@ -1684,13 +1885,12 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 
 		    need = icp->v_prior.pval->vlen;
 
-		    vp = (pmValueBlock *)malloc(need);
+		    vp = __pmArenaValueBlock(ap, need, &vsp->vlist[i++]);
 		    if (vp == NULL) {
 			sts = -oserror();
 			goto bad_alloc;
 		    }
-		    rp->vset[j]->valfmt = PM_VAL_DPTR;
-		    rp->vset[j]->vlist[i++].value.pval = vp;
+		    vsp->valfmt = PM_VAL_DPTR;
 		    memcpy((void *)vp, icp->v_prior.pval, need);
 		}
 		else {
@@ -1702,8 +1902,11 @@ __pmLogFetchInterp(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **r
 	pcp->last_numval = pcp->numval;
     }
 
+    if ((sts = __pmArenaResult(ap, &rp)) < 0)
+	return sts;
+    rp->timestamp.tv_sec = ctxp->c_origin.tv_sec;
+    rp->timestamp.tv_usec = ctxp->c_origin.tv_usec;
     *result = rp;
-    sts = 0;
 
 all_done:
     pmXTBdeltaToTimeval(ctxp->c_delta, ctxp->c_mode, &delta_tv);
@@ -1735,16 +1938,7 @@ all_done:
     return sts;
 
 bad_alloc:
-    /*
-     * leaks a little (vlist[] stuff) ... but does not really matter at
-     * this point, chance of anything good happening from here on are
-     * pretty remote
-     */
-    rp->vset[j]->numval = i;
-    while (++j < numpmid)
-	rp->vset[j]->numval = 0;
-    pmFreeResult(rp);
-
+    /* nothing to free, the staged result is discarded on the next call */
     return sts;
 
 }
@@ -1870,28 +2064,23 @@ __pmFreeInterpData(__pmContext *ctxp)
 
     if (ctxp->c_archctl->ac_cache != NULL) {
 	/* read cache allocated, work to be done */
-	cache_t		*cache = (cache_t *)ctxp->c_archctl->ac_cache;
+	cachectl_t	*ccp = (cachectl_t *)ctxp->c_archctl->ac_cache;
 	cache_t		*cp;
 
-	for (cp = cache; cp < &cache[NUMCACHE]; cp++) {
+	while ((cp = ccp->lru.next) != &ccp->lru) {
 #ifdef PCP_DEBUG
 	    if ((pmDebug & DBG_TRACE_LOG) && (pmDebug & DBG_TRACE_INTERP)) {
 		fprintf(stderr, "read cache entry "
-			PRINTF_P_PFX "%p: l_name=%s rp="
+			PRINTF_P_PFX "%p: log=%d vol=%d rp="
 			PRINTF_P_PFX "%p\n",
-			cp, cp->l_name ? cp->l_name : "(none)",
-			cp->rp);
+			cp, cp->log, cp->vol, cp->rp);
 	    }
 #endif
-	    if (cp->l_name != NULL) {
-		free(cp->l_name);
-		cp->l_name = NULL;
-	    }
-	    if (cp->rp != NULL) {
-		pmFreeResult(cp->rp);
-		cp->rp = NULL;
-	    }
-	    cp->used = 0;
+	    cache_release(ccp, cp);
 	}
+	free(ccp->head_hash);
+	free(ccp->tail_hash);
+	free(ccp);
+	ctxp->c_archctl->ac_cache = NULL;
     }
 }
@@ -11,10 +11,21 @@
  * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
  * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
  * License for more details.
+ *
+ * Thread-safe notes
+ *
+ * __pmIPCTable[] and its size are protected by ipc_lock rather than the
+ * libpcp lock, as the PDU version is looked up for every PDU decoded.
+ * ipc_lock is a leaf lock.
+ *
+ * __pmLastUsedFd needs to be thread-private, as it is set just before
+ * a PDU is sent or received and read back while that PDU is decoded,
+ * in the same thread.
  */
 
 #include "pmapi.h"
 #include "impl.h"
+#include "internal.h"
 #ifdef HAVE_VALUES_H
 #include <values.h>
 #endif
@@ -41,7 +52,16 @@ typedef struct {
     char	data[0];	/* opaque data (optional) */
 } __pmIPC;
 
-static int	__pmLastUsedFd = -INT_MAX;
+#ifdef PM_MULTI_THREAD
+#ifdef HAVE___THREAD
+/* using a gcc construct here to make __pmLastUsedFd thread-private */
+static __thread int	__pmLastUsedFd = -INT_MAX;
+#endif
+static pthread_mutex_t	ipc_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static int		__pmLastUsedFd = -INT_MAX;
+static void		*ipc_lock;
+#endif
 static __pmIPC	*__pmIPCTable;
 static int	ipctablecount;
 static int	ipcentrysize;
@@ -54,7 +74,7 @@ __pmIPCTablePtr(int fd)
 }
 
 /*
- * always called with __pmLock_libpcp held
+ * always called with ipc_lock held
  */
 static int
 __pmResizeIPC(int fd)
@@ -80,6 +100,23 @@ __pmResizeIPC(int fd)
     return 0;
 }
 
+/*
+ * always called with ipc_lock held
+ */
+static void
+printipc(void)
+{
+    int	i;
+
+    fprintf(stderr, "IPC table fd(PDU version):");
+    for (i = 0; i < ipctablecount; i++) {
+	if (__pmIPCTablePtr(i)->version != UNKNOWN_VERSION)
+	    fprintf(stderr, " %d(%d,%d)", i, __pmIPCTablePtr(i)->version,
+					     __pmIPCTablePtr(i)->socket);
+    }
+    fputc('\n', stderr);
+}
+
 int
 __pmSetVersionIPC(int fd, int version)
 {
@@ -89,19 +126,19 @@ __pmSetVersionIPC(int fd, int version)
 	fprintf(stderr, "__pmSetVersionIPC: fd=%d version=%d\n", fd, version);
 
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(ipc_lock);
     if ((sts = __pmResizeIPC(fd)) < 0) {
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(ipc_lock);
 	return sts;
     }
 
     __pmIPCTablePtr(fd)->version = version;
-    __pmLastUsedFd = fd;
+    PM_TPD(__pmLastUsedFd) = fd;
 
     if (pmDebug & DBG_TRACE_CONTEXT)
-	__pmPrintIPC();
+	printipc();
 
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(ipc_lock);
     return sts;
 }
 
@@ -114,19 +151,19 @@ __pmSetSocketIPC(int fd)
 	fprintf(stderr, "__pmSetSocketIPC: fd=%d\n", fd);
 
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(ipc_lock);
     if ((sts = __pmResizeIPC(fd)) < 0) {
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(ipc_lock);
 	return sts;
     }
 
     __pmIPCTablePtr(fd)->socket = 1;
-    __pmLastUsedFd = fd;
+    PM_TPD(__pmLastUsedFd) = fd;
 
     if (pmDebug & DBG_TRACE_CONTEXT)
-	__pmPrintIPC();
+	printipc();
 
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(ipc_lock);
     return sts;
 }
 
@@ -138,18 +175,18 @@ __pmVersionIPC(int fd)
     if (fd == PDU_OVERRIDE2)
 	return PDU_VERSION2;
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(ipc_lock);
     if (__pmIPCTable == NULL || fd < 0 || fd >= ipctablecount) {
 	if (pmDebug & DBG_TRACE_CONTEXT)
 	    fprintf(stderr,
 		"IPC protocol botch: table->" PRINTF_P_PFX "%p fd=%d sz=%d\n",
 		__pmIPCTable, fd, ipctablecount);
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(ipc_lock);
 	return UNKNOWN_VERSION;
     }
     sts = __pmIPCTablePtr(fd)->version;
 
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(ipc_lock);
     return sts;
 }
 
@@ -159,9 +196,7 @@ __pmLastVersionIPC()
     int		sts;
 
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
-    sts = __pmVersionIPC(__pmLastUsedFd);
-    PM_UNLOCK(__pmLock_libpcp);
+    sts = __pmVersionIPC(PM_TPD(__pmLastUsedFd));
     return sts;
 }
 
@@ -171,14 +206,14 @@ __pmSocketIPC(int fd)
     int		sts;
 
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(ipc_lock);
     if (__pmIPCTable == NULL || fd < 0 || fd >= ipctablecount) {
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(ipc_lock);
 	return 0;
     }
     sts = __pmIPCTablePtr(fd)->socket;
 
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(ipc_lock);
     return sts;
 }
 
@@ -189,9 +224,9 @@ __pmSetDataIPC(int fd, void *data)
     int		sts;
 
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(ipc_lock);
     if ((sts = __pmResizeIPC(fd)) < 0) {
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(ipc_lock);
 	return sts;
     }
 
@@ -201,12 +236,12 @@ __pmSetDataIPC(int fd, void *data)
 
     dest = ((char *)__pmIPCTablePtr(fd)) + sizeof(__pmIPC);
     memcpy(dest, data, ipcentrysize - sizeof(__pmIPC));
-    __pmLastUsedFd = fd;
+    PM_TPD(__pmLastUsedFd) = fd;
 
     if (pmDebug & DBG_TRACE_CONTEXT)
-	__pmPrintIPC();
+	printipc();
 
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(ipc_lock);
     return sts;
 }
 
@@ -216,10 +251,10 @@ __pmDataIPC(int fd, void *data)
     char	*source;
 
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(ipc_lock);
     if (fd < 0 || fd >= ipctablecount || __pmIPCTable == NULL ||
 	ipcentrysize == sizeof(__pmIPC)) {
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(ipc_lock);
 	return -ESRCH;
     }
     source = ((char *)__pmIPCTablePtr(fd)) + sizeof(__pmIPC);
@@ -228,7 +263,7 @@ __pmDataIPC(int fd, void *data)
 		fd, source, (int)(ipcentrysize - sizeof(__pmIPC)));
     memcpy(data, source, ipcentrysize - sizeof(__pmIPC));
 
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(ipc_lock);
     return 0;
 }
 
@@ -242,34 +277,24 @@ void
 __pmOverrideLastFd(int fd)
 {
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
-    __pmLastUsedFd = fd;
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_TPD(__pmLastUsedFd) = fd;
 }
 
 void
 __pmResetIPC(int fd)
 {
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(ipc_lock);
     if (__pmIPCTable && fd >= 0 && fd < ipctablecount)
 	memset(__pmIPCTablePtr(fd), 0, ipcentrysize);
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(ipc_lock);
 }
 
 void
 __pmPrintIPC(void)
 {
-    int	i;
-
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
-    fprintf(stderr, "IPC table fd(PDU version):");
-    for (i = 0; i < ipctablecount; i++) {
-	if (__pmIPCTablePtr(i)->version != UNKNOWN_VERSION)
-	    fprintf(stderr, " %d(%d,%d)", i, __pmIPCTablePtr(i)->version,
-					     __pmIPCTablePtr(i)->socket);
-    }
-    fputc('\n', stderr);
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_LOCK(ipc_lock);
+    printipc();
+    PM_UNLOCK(ipc_lock);
 }
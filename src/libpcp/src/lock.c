@@ -32,6 +32,30 @@ typedef struct {
 static int		multi_init[PM_SCOPE_MAX+1];
 static pthread_t	multi_seen[PM_SCOPE_MAX+1];
 
+/*
+ * Lock contention measurement, enabled by $PCP_LOCKSTATS.
+ *
+ * Statistics are kept per PM_LOCK() call site, and reported on stderr
+ * when the process exits, busiest waits first.  The sites are the
+ * __FILE__ and __LINE__ of the caller, so the table is keyed on the
+ * address of the (string constant) file name and the line number.
+ */
+typedef struct {
+    const char		*file;		/* NULL for an unused slot */
+    int			line;
+    void		*lock;		/* first lock seen at this site */
+    unsigned long	acquired;
+    unsigned long	contended;	/* ... of which had to wait */
+    double		waited;		/* total time waiting (seconds) */
+} lockstat_t;
+
+#define LOCKSTAT_SITES	1024
+
+static int		lockstats;	/* one-trip initialization then read-only */
+static lockstat_t	lockstat[LOCKSTAT_SITES];
+static unsigned long	lockstat_lost;	/* updates dropped, table full */
+static pthread_mutex_t	lockstat_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* the big libpcp lock */
 #ifdef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
 pthread_mutex_t	__pmLock_libpcp = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
@@ -70,6 +94,114 @@ SetupDebug(void)
     }
 }
 
+static int
+lockstat_cmp(const void *a, const void *b)
+{
+    const lockstat_t	*aa = (const lockstat_t *)a;
+    const lockstat_t	*bb = (const lockstat_t *)b;
+
+    if (aa->waited != bb->waited)
+	return aa->waited < bb->waited ? 1 : -1;
+    if (aa->contended != bb->contended)
+	return aa->contended < bb->contended ? 1 : -1;
+    if (aa->acquired != bb->acquired)
+	return aa->acquired < bb->acquired ? 1 : -1;
+    return 0;
+}
+
+static void
+lockstat_report(void)
+{
+    lockstat_t		*report;
+    int			nsite = 0;
+    int			i;
+
+    pthread_mutex_lock(&lockstat_lock);
+    report = (lockstat_t *)malloc(sizeof(lockstat));
+    if (report != NULL) {
+	for (i = 0; i < LOCKSTAT_SITES; i++) {
+	    if (lockstat[i].file != NULL)
+		report[nsite++] = lockstat[i];
+	}
+    }
+    pthread_mutex_unlock(&lockstat_lock);
+    if (report == NULL)
+	return;
+
+    qsort(report, nsite, sizeof(report[0]), lockstat_cmp);
+    fprintf(stderr, "PCP_LOCKSTATS: pid %" FMT_PID ", %d lock call sites\n",
+	    getpid(), nsite);
+    fprintf(stderr, "%12s %10s %12s  %s\n",
+	    "acquired", "contended", "waited(s)", "call site [lock]");
+    for (i = 0; i < nsite; i++) {
+	fprintf(stderr, "%12lu %10lu %12.6f  %s:%d [",
+		report[i].acquired, report[i].contended, report[i].waited,
+		report[i].file, report[i].line);
+	if (report[i].lock == (void *)&__pmLock_libpcp)
+	    fprintf(stderr, "libpcp]\n");
+	else
+	    fprintf(stderr, PRINTF_P_PFX "%p]\n", report[i].lock);
+    }
+    if (lockstat_lost)
+	fprintf(stderr, "PCP_LOCKSTATS: %lu lock operations not counted (too many call sites)\n",
+		lockstat_lost);
+    free(report);
+}
+
+static void
+lockstat_note(void *lock, const char *file, int line, int contended, double waited)
+{
+    unsigned int	h;
+    int			i;
+
+    h = (unsigned int)(((__psint_t)file >> 3) ^ ((unsigned int)line * 2654435761U));
+    pthread_mutex_lock(&lockstat_lock);
+    for (i = 0; i < LOCKSTAT_SITES; i++) {
+	lockstat_t	*lsp = &lockstat[(h + i) % LOCKSTAT_SITES];
+
+	if (lsp->file == NULL) {
+	    lsp->file = file;
+	    lsp->line = line;
+	    lsp->lock = lock;
+	}
+	else if (lsp->file != file || lsp->line != line)
+	    continue;
+	lsp->acquired++;
+	if (contended) {
+	    lsp->contended++;
+	    lsp->waited += waited;
+	}
+	break;
+    }
+    if (i == LOCKSTAT_SITES)
+	lockstat_lost++;
+    pthread_mutex_unlock(&lockstat_lock);
+}
+
+/*
+ * Acquire a lock, noting whether we had to wait for it and for how long.
+ */
+static int
+lockstat_acquire(void *lock, const char *file, int line)
+{
+    struct timespec	start, end;
+    double		waited = 0.0;
+    int			contended = 0;
+    int			sts;
+
+    if ((sts = pthread_mutex_trylock(lock)) == EBUSY) {
+	contended = 1;
+	__pmGetTimespec(&start);
+	sts = pthread_mutex_lock(lock);
+	__pmGetTimespec(&end);
+	waited = (end.tv_sec - start.tv_sec) +
+		 (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+    }
+    if (sts == 0)
+	lockstat_note(lock, file, line, contended, waited);
+    return sts;
+}
+
 void
 __pmInitLocks(void)
 {
@@ -84,6 +216,10 @@ __pmInitLocks(void)
     }
     if (!done) {
 	SetupDebug();
+	if (getenv("PCP_LOCKSTATS") != NULL) {
+	    lockstats = 1;
+	    atexit(lockstat_report);
+	}
 #ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
 	/*
 	 * Unable to initialize at compile time, need to do it here in
@@ -137,6 +273,7 @@ __pmInitLocks(void)
 	}
 	memset((void *)tpd, 0, sizeof(*tpd));
 	tpd->curcontext = PM_CONTEXT_UNDEF;
+	tpd->__pmLastUsedFd = -INT_MAX;
     }
 #endif
 }
@@ -275,7 +412,11 @@ __pmLock(void *lock, const char *file, int line)
     if (pmDebug & DBG_TRACE_LOCK)
 	__pmDebugLock(PM_LOCK_OP, lock, file, line);
 
-    if ((sts = pthread_mutex_lock(lock)) != 0) {
+    if (lockstats)
+	sts = lockstat_acquire(lock, file, line);
+    else
+	sts = pthread_mutex_lock(lock);
+    if (sts != 0) {
 	sts = -sts;
 	if (pmDebug & DBG_TRACE_DESPERATE)
 	    fprintf(stderr, "%s:%d: lock failed: %s\n", file, line, pmErrStr(sts));
@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2016 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * In-process, seekable reading of xz-compressed archive volumes.
+ *
+ * An xz file ends with an index of its blocks, giving the compressed
+ * and uncompressed offsets of each.  We load that index at open time,
+ * and return a stdio stream (via fopencookie) whose reads decompress on
+ * demand: a seek costs at most decompressing from the start of the
+ * containing block up to the target.  Files compressed with a bounded
+ * block size (xz --block-size, or multi-threaded xz) therefore get cheap
+ * random access.  A window of recently decoded data is retained so
+ * that the short backward steps made by __pmLogRead and interp.c do not
+ * restart the block.
+ *
+ * Files with a block larger than XZ_MAXBLOCK (typically xz's default of
+ * one block for the whole file) are refused, and the caller falls back
+ * to decompressing the whole volume with xz(1) into a temporary file;
+ * walking such a block backwards would mean decoding it over and over.
+ *
+ * Thread-safe notes:
+ *
+ * Each stream is only used under the l_lock of the __pmLogCtl it belongs
+ * to.  The list of open streams (so that we can map a FILE back to its
+ * underlying file descriptor) is protected by xz_lock, a leaf lock.
+ */
+
+#include <sys/stat.h>
+#include "pmapi.h"
+#include "impl.h"
+#include "internal.h"
+
+#if defined(HAVE_LZMA_DECOMPRESSION) && defined(HAVE_FOPENCOOKIE)
+#include <lzma.h>
+
+#define XZ_INBUF	(64 * 1024)
+#define XZ_OUTBUF	(256 * 1024)
+#define XZ_KEEP		(64 * 1024)	/* decoded history kept when the window slides */
+#define XZ_STEP		(16 * 1024)	/* decode no further ahead than this */
+#define XZ_MAXBLOCK	(2 * 1024 * 1024)	/* larger blocks: use xz(1) instead */
+
+typedef struct xzfile {
+    struct xzfile	*next;
+    FILE		*fp;		/* stream handed out to the caller */
+    int			fd;		/* the compressed file */
+    lzma_index		*index;		/* blocks of all streams in the file */
+    uint64_t		size;		/* total uncompressed size */
+    uint64_t		posn;		/* stream position (uncompressed) */
+    lzma_index_iter	iter;		/* block being decoded */
+    lzma_block		block;		/* ... referred to by strm while decoding */
+    lzma_filter		filters[LZMA_FILTERS_MAX + 1];
+    lzma_stream		strm;
+    int			active;		/* strm is part way through iter's block */
+    uint64_t		inposn;		/* next compressed offset to read */
+    uint64_t		inend;		/* end of the block in the compressed file */
+    uint8_t		*outbuf;	/* decoded bytes [outposn, outposn+outlen) */
+    uint64_t		outposn;
+    size_t		outlen;
+    uint8_t		inbuf[XZ_INBUF];
+} xzfile_t;
+
+static xzfile_t		*xzfiles;	/* open streams */
+#ifdef PM_MULTI_THREAD
+static pthread_mutex_t	xz_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static void		*xz_lock;
+#endif
+
+static int
+xz_pread(int fd, void *buf, size_t len, uint64_t offset)
+{
+    ssize_t	n;
+    size_t	done = 0;
+
+    while (done < len) {
+	n = pread(fd, (char *)buf + done, len - done, (off_t)(offset + done));
+	if (n < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    return -oserror();
+	}
+	if (n == 0)
+	    return PM_ERR_LOGREC;
+	done += n;
+    }
+    return 0;
+}
+
+/*
+ * Walk backwards from the end of the file, decoding the index of each
+ * (possibly concatenated) stream and combining them, in the manner of
+ * xz --list.
+ */
+static int
+xz_load_index(xzfile_t *xz, uint64_t filesize)
+{
+    uint8_t		buf[LZMA_STREAM_HEADER_SIZE];
+    lzma_stream_flags	header_flags;
+    lzma_stream_flags	footer_flags;
+    lzma_index		*this_index;
+    lzma_stream		strm = LZMA_STREAM_INIT;
+    lzma_ret		ret;
+    uint64_t		pos = filesize;
+    uint64_t		padding;
+    uint64_t		index_size;
+    size_t		n;
+    int			sts;
+
+    while (pos > 0) {
+	/* stream padding is a multiple of four zero bytes */
+	padding = 0;
+	for ( ; ; ) {
+	    if (pos < 2 * LZMA_STREAM_HEADER_SIZE)
+		return PM_ERR_LOGREC;
+	    if ((sts = xz_pread(xz->fd, buf, LZMA_STREAM_HEADER_SIZE,
+				pos - LZMA_STREAM_HEADER_SIZE)) < 0)
+		return sts;
+	    if (buf[8] != 0 || buf[9] != 0 || buf[10] != 0 || buf[11] != 0)
+		break;
+	    pos -= 4;
+	    padding += 4;
+	}
+	pos -= LZMA_STREAM_HEADER_SIZE;
+	if (lzma_stream_footer_decode(&footer_flags, buf) != LZMA_OK)
+	    return PM_ERR_LOGREC;
+	index_size = footer_flags.backward_size;
+	if (pos < index_size + LZMA_STREAM_HEADER_SIZE)
+	    return PM_ERR_LOGREC;
+	pos -= index_size;
+
+	if (lzma_index_decoder(&strm, &this_index, UINT64_MAX) != LZMA_OK)
+	    return -ENOMEM;
+	do {
+	    n = index_size < XZ_INBUF ? (size_t)index_size : XZ_INBUF;
+	    if ((sts = xz_pread(xz->fd, xz->inbuf, n, pos + footer_flags.backward_size - index_size)) < 0) {
+		lzma_end(&strm);
+		return sts;
+	    }
+	    index_size -= n;
+	    strm.next_in = xz->inbuf;
+	    strm.avail_in = n;
+	    ret = lzma_code(&strm, LZMA_RUN);
+	} while (ret == LZMA_OK && index_size > 0);
+	lzma_end(&strm);
+	if (ret != LZMA_STREAM_END)
+	    return PM_ERR_LOGREC;
+
+	if (pos < lzma_index_total_size(this_index) + LZMA_STREAM_HEADER_SIZE) {
+	    lzma_index_end(this_index, NULL);
+	    return PM_ERR_LOGREC;
+	}
+	pos -= lzma_index_total_size(this_index) + LZMA_STREAM_HEADER_SIZE;
+	if ((sts = xz_pread(xz->fd, buf, LZMA_STREAM_HEADER_SIZE, pos)) < 0) {
+	    lzma_index_end(this_index, NULL);
+	    return sts;
+	}
+	if (lzma_stream_header_decode(&header_flags, buf) != LZMA_OK ||
+	    lzma_stream_flags_compare(&header_flags, &footer_flags) != LZMA_OK ||
+	    lzma_index_stream_flags(this_index, &footer_flags) != LZMA_OK ||
+	    lzma_index_stream_padding(this_index, padding) != LZMA_OK) {
+	    lzma_index_end(this_index, NULL);
+	    return PM_ERR_LOGREC;
+	}
+	if (xz->index != NULL &&
+	    lzma_index_cat(this_index, xz->index, NULL) != LZMA_OK) {
+	    lzma_index_end(this_index, NULL);
+	    return PM_ERR_LOGREC;
+	}
+	xz->index = this_index;
+    }
+    if (xz->index == NULL)
+	return PM_ERR_LOGREC;
+    xz->size = lzma_index_uncompressed_size(xz->index);
+    return 0;
+}
+
+/*
+ * Set up the decoder at the start of the block in xz->iter.
+ */
+static int
+xz_start_block(xzfile_t *xz)
+{
+    lzma_filter	*filters = xz->filters;
+    lzma_block	*block = &xz->block;
+    lzma_ret	ret;
+    int		i;
+    int		sts;
+
+    xz->active = 0;
+    memset(block, 0, sizeof(*block));
+    if ((sts = xz_pread(xz->fd, xz->inbuf, 1, xz->iter.block.compressed_file_offset)) < 0)
+	return sts;
+    if (xz->inbuf[0] == 0x00)
+	return PM_ERR_LOGREC;	/* an index, not a block header */
+    block->version = 0;
+    block->check = xz->iter.stream.flags->check;
+    block->filters = filters;
+    block->header_size = lzma_block_header_size_decode(xz->inbuf[0]);
+    if ((sts = xz_pread(xz->fd, xz->inbuf, block->header_size, xz->iter.block.compressed_file_offset)) < 0)
+	return sts;
+    if (lzma_block_header_decode(block, NULL, xz->inbuf) != LZMA_OK)
+	return PM_ERR_LOGREC;
+    if (lzma_block_compressed_size(block, xz->iter.block.unpadded_size) != LZMA_OK) {
+	ret = LZMA_DATA_ERROR;
+    }
+    else {
+	/* reusing strm keeps the decoder's (dictionary sized) buffers */
+	ret = lzma_block_decoder(&xz->strm, block);
+    }
+    /* the decoder has its own copy of the filter options */
+    for (i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++)
+	free(filters[i].options);
+    if (ret != LZMA_OK)
+	return ret == LZMA_MEM_ERROR ? -ENOMEM : PM_ERR_LOGREC;
+
+    xz->active = 1;
+    /* drop any input left over from a block we abandoned part way */
+    xz->strm.next_in = NULL;
+    xz->strm.avail_in = 0;
+    xz->inposn = xz->iter.block.compressed_file_offset + block->header_size;
+    xz->inend = xz->iter.block.compressed_file_offset + xz->iter.block.total_size;
+    if (xz->outposn + xz->outlen != xz->iter.block.uncompressed_file_offset) {
+	/* not simply the block following the window */
+	xz->outposn = xz->iter.block.uncompressed_file_offset;
+	xz->outlen = 0;
+    }
+    return 0;
+}
+
+/*
+ * Decode more of the file into the window, moving on to the following
+ * block at the end of the current one.  Returns the number of bytes
+ * added, 0 at end of file or an error.
+ */
+static int
+xz_fill(xzfile_t *xz)
+{
+    lzma_ret	ret;
+    size_t	n;
+    int		sts;
+
+    if (!xz->active) {
+	if (lzma_index_iter_next(&xz->iter, LZMA_INDEX_ITER_NONEMPTY_BLOCK))
+	    return 0;
+	if ((sts = xz_start_block(xz)) < 0)
+	    return sts;
+    }
+
+    if (xz->outlen == XZ_OUTBUF) {
+	memmove(xz->outbuf, xz->outbuf + XZ_OUTBUF - XZ_KEEP, XZ_KEEP);
+	xz->outposn += XZ_OUTBUF - XZ_KEEP;
+	xz->outlen = XZ_KEEP;
+    }
+    xz->strm.next_out = xz->outbuf + xz->outlen;
+    xz->strm.avail_out = XZ_OUTBUF - xz->outlen;
+    if (xz->strm.avail_out > XZ_STEP)
+	xz->strm.avail_out = XZ_STEP;
+
+    do {
+	if (xz->strm.avail_in == 0 && xz->inposn < xz->inend) {
+	    n = xz->inend - xz->inposn < XZ_INBUF ? (size_t)(xz->inend - xz->inposn) : XZ_INBUF;
+	    if ((sts = xz_pread(xz->fd, xz->inbuf, n, xz->inposn)) < 0)
+		return sts;
+	    xz->inposn += n;
+	    xz->strm.next_in = xz->inbuf;
+	    xz->strm.avail_in = n;
+	}
+	ret = lzma_code(&xz->strm, LZMA_RUN);
+    } while (ret == LZMA_OK && xz->strm.avail_out > 0);
+
+    n = xz->strm.next_out - (xz->outbuf + xz->outlen);
+    xz->outlen += n;
+    if (ret == LZMA_STREAM_END) {
+	/* end of this block; the next starts where it stopped */
+	xz->active = 0;
+	if (n == 0)
+	    return xz_fill(xz);
+    }
+    else if (ret != LZMA_OK)
+	return ret == LZMA_MEM_ERROR ? -ENOMEM : PM_ERR_LOGREC;
+    return (int)n;
+}
+
+static ssize_t
+xz_read(void *cookie, char *buf, size_t size)
+{
+    xzfile_t	*xz = (xzfile_t *)cookie;
+    size_t	done = 0;
+    size_t	n;
+    int		sts;
+
+    while (done < size && xz->posn < xz->size) {
+	if (xz->posn >= xz->outposn && xz->posn < xz->outposn + xz->outlen) {
+	    n = xz->outposn + xz->outlen - xz->posn;
+	    if (n > size - done)
+		n = size - done;
+	    memcpy(buf + done, xz->outbuf + (xz->posn - xz->outposn), n);
+	    xz->posn += n;
+	    done += n;
+	    continue;
+	}
+	if (xz->posn < xz->outposn ||
+	    xz->posn >= xz->iter.block.uncompressed_file_offset +
+			xz->iter.block.uncompressed_size) {
+	    /*
+	     * Behind the window, or beyond the current block: restart at
+	     * the start of the block containing posn (if that is simply
+	     * the next block, the window is kept).  Otherwise posn is
+	     * ahead in this block and we decode forwards.
+	     */
+	    if (lzma_index_iter_locate(&xz->iter, xz->posn)) {
+		setoserror(EINVAL);
+		return -1;
+	    }
+	    if ((sts = xz_start_block(xz)) < 0) {
+		setoserror(sts == PM_ERR_LOGREC ? EIO : -sts);
+		return -1;
+	    }
+	}
+	if ((sts = xz_fill(xz)) < 0) {
+	    setoserror(sts == PM_ERR_LOGREC ? EIO : -sts);
+	    return -1;
+	}
+	if (sts == 0)
+	    break;
+    }
+    return done;
+}
+
+static int
+xz_seek(void *cookie, off64_t *offset, int whence)
+{
+    xzfile_t	*xz = (xzfile_t *)cookie;
+    int64_t	posn;
+
+    if (whence == SEEK_SET)
+	posn = *offset;
+    else if (whence == SEEK_CUR)
+	posn = xz->posn + *offset;
+    else if (whence == SEEK_END)
+	posn = xz->size + *offset;
+    else
+	posn = -1;
+    if (posn < 0) {
+	setoserror(EINVAL);
+	return -1;
+    }
+    /* decoding happens lazily, on the next read */
+    xz->posn = posn;
+    *offset = posn;
+    return 0;
+}
+
+static void
+xz_free(xzfile_t *xz)
+{
+    lzma_end(&xz->strm);
+    if (xz->index != NULL)
+	lzma_index_end(xz->index, NULL);
+    if (xz->fd >= 0)
+	close(xz->fd);
+    if (xz->outbuf != NULL)
+	free(xz->outbuf);
+    free(xz);
+}
+
+static int
+xz_close(void *cookie)
+{
+    xzfile_t	*xz = (xzfile_t *)cookie;
+    xzfile_t	**xzp;
+
+    PM_LOCK(xz_lock);
+    for (xzp = &xzfiles; *xzp != NULL; xzp = &(*xzp)->next) {
+	if (*xzp == xz) {
+	    *xzp = xz->next;
+	    break;
+	}
+    }
+    PM_UNLOCK(xz_lock);
+    xz_free(xz);
+    return 0;
+}
+
+/*
+ * Open an xz-compressed file for reading as a seekable stdio stream of
+ * its uncompressed contents.  Returns NULL, with oserror() set, if the
+ * file cannot be opened or is not a well-formed xz file; the caller may
+ * then fall back to running xz(1).
+ */
+FILE *
+__pmLogXzOpen(const char *fname)
+{
+    cookie_io_functions_t	io = { xz_read, NULL, xz_seek, xz_close };
+    struct stat			sbuf;
+    xzfile_t			*xz;
+    int				sts;
+
+    if ((xz = (xzfile_t *)calloc(1, sizeof(*xz))) == NULL)
+	return NULL;
+    xz->strm = (lzma_stream)LZMA_STREAM_INIT;
+    if ((xz->fd = open(fname, O_RDONLY)) < 0) {
+	sts = -oserror();
+	goto fail;
+    }
+    if (fstat(xz->fd, &sbuf) < 0) {
+	sts = -oserror();
+	goto fail;
+    }
+    if ((sts = xz_load_index(xz, (uint64_t)sbuf.st_size)) < 0)
+	goto fail;
+    lzma_index_iter_init(&xz->iter, xz->index);
+    while (!lzma_index_iter_next(&xz->iter, LZMA_INDEX_ITER_BLOCK)) {
+	if (xz->iter.block.uncompressed_size > XZ_MAXBLOCK) {
+	    sts = -EOPNOTSUPP;
+	    goto fail;
+	}
+    }
+    if ((xz->outbuf = (uint8_t *)malloc(XZ_OUTBUF)) == NULL) {
+	sts = -oserror();
+	goto fail;
+    }
+    lzma_index_iter_init(&xz->iter, xz->index);
+    if ((xz->fp = fopencookie(xz, "r", io)) == NULL) {
+	sts = -oserror();
+	goto fail;
+    }
+
+    PM_INIT_LOCKS();
+    PM_LOCK(xz_lock);
+    xz->next = xzfiles;
+    xzfiles = xz;
+    PM_UNLOCK(xz_lock);
+
+#ifdef PCP_DEBUG
+    if (pmDebug & DBG_TRACE_LOG)
+	fprintf(stderr, "__pmLogXzOpen: %s: %llu bytes in %llu block(s), fd=%d\n",
+		fname, (unsigned long long)xz->size,
+		(unsigned long long)lzma_index_block_count(xz->index), xz->fd);
+#endif
+    return xz->fp;
+
+fail:
+#ifdef PCP_DEBUG
+    if (pmDebug & DBG_TRACE_LOG) {
+	char	errmsg[PM_MAXERRMSGLEN];
+	fprintf(stderr, "__pmLogXzOpen: %s: %s\n", fname, pmErrStr_r(sts, errmsg, sizeof(errmsg)));
+    }
+#endif
+    xz_free(xz);
+    setoserror(sts == PM_ERR_LOGREC ? EINVAL : -sts);
+    return NULL;
+}
+
+static xzfile_t *
+xz_lookup(FILE *f)
+{
+    xzfile_t	*xz;
+
+    PM_INIT_LOCKS();
+    PM_LOCK(xz_lock);
+    for (xz = xzfiles; xz != NULL; xz = xz->next) {
+	if (xz->fp == f)
+	    break;
+    }
+    PM_UNLOCK(xz_lock);
+    return xz;
+}
+
+/*
+ * fileno(3) and fstat(2) equivalents for archive streams, which may
+ * have come from __pmLogXzOpen ... the compressed file's descriptor
+ * stands in for the stream in the IPC table, and the size reported is
+ * the uncompressed size.
+ */
+int
+__pmLogFileno(FILE *f)
+{
+    xzfile_t	*xz;
+    int		fd;
+
+    if ((fd = fileno(f)) >= 0)
+	return fd;
+    if ((xz = xz_lookup(f)) != NULL)
+	return xz->fd;
+    return -1;
+}
+
+int
+__pmLogFstat(FILE *f, struct stat *sbuf)
+{
+    xzfile_t	*xz;
+    int		fd;
+    int		sts;
+
+    if ((fd = fileno(f)) >= 0)
+	return fstat(fd, sbuf);
+    if ((xz = xz_lookup(f)) == NULL) {
+	setoserror(EBADF);
+	return -1;
+    }
+    if ((sts = fstat(xz->fd, sbuf)) < 0)
+	return sts;
+    sbuf->st_size = (off_t)xz->size;
+    return 0;
+}
+
+#else /* !HAVE_LZMA_DECOMPRESSION || !HAVE_FOPENCOOKIE */
+
+FILE *
+__pmLogXzOpen(const char *fname)
+{
+    (void)fname;
+    setoserror(EOPNOTSUPP);
+    return NULL;
+}
+
+int
+__pmLogFileno(FILE *f)
+{
+    return fileno(f);
+}
+
+int
+__pmLogFstat(FILE *f, struct stat *sbuf)
+{
+    return fstat(fileno(f), sbuf);
+}
+
+#endif
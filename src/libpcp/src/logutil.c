@@ -54,26 +54,6 @@ static const struct {
 };
 static const int ncompress = sizeof(compress_ctl) / sizeof(compress_ctl[0]);
 
-/*
- * first two fields are made to look like a pmValueSet when no values are
- * present ... used to populate the pmValueSet in a pmResult when values
- * for particular metrics are not available from this log record.
- */
-typedef struct {
-    pmID	pc_pmid;
-    int		pc_numval;	/* MUST be 0 */
-    				/* value control for interpolation */
-} pmid_ctl;
-
-/*
- * Hash control for requested metrics, used to construct 'No values'
- * result when the corresponding metric is requested but there is
- * no values available in the pmResult
- *
- * Note, this hash table is global across all contexts.
- */
-static __pmHashCtl	pc_hc;
-
 #ifdef PCP_DEBUG
 static void
 dumpbuf(int nch, __pmPDU *pb)
@@ -232,7 +212,7 @@ __pmLogChkLabel(__pmLogCtl *lcp, FILE *f, __pmLogLabel *lp, int vol)
 	return PM_ERR_LABEL;
     }
 
-    if (__pmSetVersionIPC(fileno(f), version) < 0)
+    if (__pmSetVersionIPC(__pmLogFileno(f), version) < 0)
 	return -oserror();
 #ifdef PCP_DEBUG
     if (pmDebug & DBG_TRACE_LOG)
@@ -341,6 +321,15 @@ fopen_compress(const char *fname)
     if ((i = index_compress(fname)) < 0)
 	return NULL;
 
+    if (strcmp(compress_ctl[i].suff, ".xz") == 0) {
+	/* decompress in-process and on demand, if we can */
+	char	xzname[MAXPATHLEN];
+
+	snprintf(xzname, sizeof(xzname), "%s%s", fname, compress_ctl[i].suff);
+	if ((fp = __pmLogXzOpen(xzname)) != NULL)
+	    return fp;
+    }
+
     if (compress_ctl[i].appl == USE_XZ)
 	cmd = "xz -dc";
     else if (compress_ctl[i].appl == USE_BZIP2)
@@ -403,6 +392,35 @@ fopen_compress(const char *fname)
     return fp;
 }
 
+/*
+ * Map the whole of the open file f read-only, returning NULL (and
+ * leaving the caller to use stdio) if it is empty or cannot be mapped
+ */
+static char *
+logmapfile(FILE *f, size_t *lenp)
+{
+    struct stat	sbuf;
+    char	*addr;
+
+    if (fstat(fileno(f), &sbuf) < 0 || !S_ISREG(sbuf.st_mode) ||
+	sbuf.st_size <= 0 || (off_t)(size_t)sbuf.st_size != sbuf.st_size)
+	return NULL;
+    if ((addr = (char *)__pmMemoryMap(fileno(f), (size_t)sbuf.st_size, 0)) == NULL)
+	return NULL;
+    *lenp = (size_t)sbuf.st_size;
+    return addr;
+}
+
+static void
+logunmapvol(__pmLogCtl *lcp)
+{
+    if (lcp->l_mfmap != NULL) {
+	__pmMemoryUnmap(lcp->l_mfmap, lcp->l_mfmaplen);
+	lcp->l_mfmap = NULL;
+	lcp->l_mfmaplen = 0;
+    }
+}
+
 static FILE *
 _logpeek(__pmLogCtl *lcp, int vol)
 {
@@ -435,8 +453,9 @@ __pmLogChangeVol(__pmLogCtl *lcp, int vol)
     if (lcp->l_curvol == vol)
 	return 0;
 
+    logunmapvol(lcp);
     if (lcp->l_mfp != NULL) {
-	__pmResetIPC(fileno(lcp->l_mfp));
+	__pmResetIPC(__pmLogFileno(lcp->l_mfp));
 	fclose(lcp->l_mfp);
     }
     snprintf(name, sizeof(name), "%s.%d", lcp->l_name, vol);
@@ -450,13 +469,65 @@ __pmLogChangeVol(__pmLogCtl *lcp, int vol)
 	return sts;
 
     lcp->l_curvol = vol;
+    lcp->l_mfmap = logmapfile(lcp->l_mfp, &lcp->l_mfmaplen);
 #ifdef PCP_DEBUG
-    if (pmDebug & DBG_TRACE_LOG)
-	fprintf(stderr, "__pmLogChangeVol: change to volume %d\n", vol);
+    if (pmDebug & DBG_TRACE_LOG) {
+	fprintf(stderr, "__pmLogChangeVol: change to volume %d", vol);
+	if (lcp->l_mfmap != NULL)
+	    fprintf(stderr, " (mapped %lu bytes)", (unsigned long)lcp->l_mfmaplen);
+	fputc('\n', stderr);
+    }
 #endif
     return sts;
 }
 
+/*
+ * Load the whole temporal index from a mapping of the file in one pass.
+ * Returns 1 on success, 0 if the index could not be mapped (caller
+ * falls back to stdio) else an error code.
+ */
+static int
+logloadindexmap(__pmLogCtl *lcp)
+{
+    size_t	len;
+    size_t	hdr = sizeof(__pmLogLabel) + 2*sizeof(int);
+    char	*addr;
+    __pmLogTI	*tip;
+    int		numti;
+    int		i;
+
+    if ((addr = logmapfile(lcp->l_tifp, &len)) == NULL)
+	return 0;
+    /* as for stdio, a partial entry at the end (still being written) is ignored */
+    numti = len > hdr ? (int)((len - hdr) / sizeof(__pmLogTI)) : 0;
+    if (numti > 0) {
+	if ((lcp->l_ti = (__pmLogTI *)malloc(numti * sizeof(__pmLogTI))) == NULL) {
+	    i = -oserror();
+	    __pmMemoryUnmap(addr, len);
+	    return i;
+	}
+	memcpy(lcp->l_ti, addr + hdr, numti * sizeof(__pmLogTI));
+	for (i = 0; i < numti; i++) {
+	    /* swab the temporal index record */
+	    tip = &lcp->l_ti[i];
+	    tip->ti_stamp.tv_sec = ntohl(tip->ti_stamp.tv_sec);
+	    tip->ti_stamp.tv_usec = ntohl(tip->ti_stamp.tv_usec);
+	    tip->ti_vol = ntohl(tip->ti_vol);
+	    tip->ti_meta = ntohl(tip->ti_meta);
+	    tip->ti_log = ntohl(tip->ti_log);
+	}
+    }
+    lcp->l_numti = numti;
+    __pmMemoryUnmap(addr, len);
+    /* leave the stream where the stdio loop would have */
+    fseek(lcp->l_tifp, (long)(hdr + numti * sizeof(__pmLogTI)), SEEK_SET);
+#ifdef PCP_DEBUG
+    if (pmDebug & DBG_TRACE_LOG)
+	fprintf(stderr, "__pmLogLoadIndex: mapped %d entries\n", numti);
+#endif
+    return 1;
+}
+
 int
 __pmLogLoadIndex(__pmLogCtl *lcp)
 {
@@ -468,6 +539,9 @@ __pmLogLoadIndex(__pmLogCtl *lcp)
     lcp->l_numti = 0;
     lcp->l_ti = NULL;
 
+    if (lcp->l_tifp != NULL && (sts = logloadindexmap(lcp)) != 0)
+	return sts < 0 ? sts : 0;
+
     if (lcp->l_tifp != NULL) {
 	fseek(f, (long)(sizeof(__pmLogLabel) + 2*sizeof(int)), SEEK_SET);
 	for ( ; ; ) {
@@ -634,6 +708,8 @@ __pmLogCreate(const char *host, const char *base, int log_version,
     lcp->l_hashpmid.nodes = lcp->l_hashpmid.hsize = 0;
     lcp->l_hashindom.nodes = lcp->l_hashindom.hsize = 0;
     lcp->l_tifp = lcp->l_mdfp = lcp->l_mfp = NULL;
+    lcp->l_mfmap = NULL;
+    lcp->l_mfmaplen = 0;
 
     if ((lcp->l_tifp = __pmLogNewFile(base, PM_LOG_VOL_TI)) != NULL) {
 	if ((lcp->l_mdfp = __pmLogNewFile(base, PM_LOG_VOL_META)) != NULL) {
@@ -773,8 +849,9 @@ __pmLogClose(__pmLogCtl *lcp)
 	fclose(lcp->l_mdfp);
 	lcp->l_mdfp = NULL;
     }
+    logunmapvol(lcp);
     if (lcp->l_mfp != NULL) {
-	__pmResetIPC(fileno(lcp->l_mfp));
+	__pmResetIPC(__pmLogFileno(lcp->l_mfp));
 	fclose(lcp->l_mfp);
 	lcp->l_mfp = NULL;
     }
@@ -918,6 +995,8 @@ __pmLogLoadLabel(__pmLogCtl *lcp, const char *name)
 
     lcp->l_minvol = -1;
     lcp->l_tifp = lcp->l_mdfp = lcp->l_mfp = NULL;
+    lcp->l_mfmap = NULL;
+    lcp->l_mfmaplen = 0;
     lcp->l_ti = NULL;
     lcp->l_hashpmid.nodes = lcp->l_hashpmid.hsize = 0;
     lcp->l_hashindom.nodes = lcp->l_hashindom.hsize = 0;
@@ -1532,6 +1611,73 @@ clearMarkDone(void)
     }
 }
 
+/*
+ * Fast path for __pmLogRead: pick up the record next to offset (in the
+ * direction of mode) straight from the mapping of the current volume,
+ * then leave l_mfp positioned as the stdio path would.  Only a complete,
+ * well-formed record is handled here; anything else (end of the mapped
+ * region, volume or archive boundaries, a record still being appended,
+ * corruption) returns 0 and is left to the stdio path, which owns all
+ * the error and end-of-log semantics.
+ *
+ * The record body is copied once into a PDU buffer, since
+ * __pmDecodeResult swabs in place and the resulting pmValueBlocks point
+ * into (and pin) the buffer.
+ */
+static int
+logmapread(__pmLogCtl *lcp, int mode, long offset, __pmPDU **pbp, int *headp)
+{
+    const char	*base = lcp->l_mfmap;
+    size_t	len = lcp->l_mfmaplen;
+    size_t	start;
+    size_t	hdr = sizeof(__pmLogLabel) + 2 * sizeof(int);
+    int		head;
+    int		trail;
+    int		rlen;
+    __pmPDU	*pb;
+    __pmPDUHdr	*header;
+
+    if (offset < (long)hdr || (size_t)offset > len)
+	return 0;
+
+    if (mode == PM_MODE_BACK) {
+	if ((size_t)offset < hdr + sizeof(trail))
+	    return 0;
+	memcpy(&trail, base + offset - sizeof(trail), sizeof(trail));
+	head = ntohl(trail);
+	if (head < 2 * (int)sizeof(head) || (size_t)head > offset - hdr)
+	    return 0;
+	start = offset - head;
+    }
+    else {
+	if (len - offset < sizeof(head))
+	    return 0;
+	memcpy(&head, base + offset, sizeof(head));
+	head = ntohl(head);
+	if (head < 2 * (int)sizeof(head) || (size_t)head > len - offset)
+	    return 0;
+	start = offset;
+    }
+
+    memcpy(&trail, base + start + head - sizeof(trail), sizeof(trail));
+    if (ntohl(trail) != head)
+	return 0;
+
+    rlen = head - 2 * (int)sizeof(head);
+    if ((pb = __pmFindPDUBuf(rlen + (int)sizeof(__pmPDUHdr) + (int)sizeof(int))) == NULL)
+	return 0;
+    memcpy(&pb[3], base + start + sizeof(head), rlen);
+    header = (__pmPDUHdr *)pb;
+    header->len = sizeof(*header) + rlen;
+    header->type = PDU_RESULT;
+    header->from = FROM_ANON;
+
+    fseek(lcp->l_mfp, (long)(mode == PM_MODE_BACK ? start : start + head), SEEK_SET);
+    *pbp = pb;
+    *headp = head;
+    return 1;
+}
+
 /*
  * read next forward or backward from the log
  *
@@ -1573,6 +1719,18 @@ __pmLogRead(__pmLogCtl *lcp, int mode, FILE *peekf, pmResult **result, int optio
     }
 #endif
 
+    if (peekf == NULL && lcp->l_mfmap != NULL &&
+	logmapread(lcp, mode, offset, &pb, &head)) {
+	rlen = head - 2 * (int)sizeof(head);
+	/* not at a multi-archive boundary, see below */
+	clearMarkDone();
+	if (option == PMLOGREAD_TO_EOF && paranoidCheck(head, pb) == -1) {
+	    __pmUnpinPDUBuf(pb);
+	    return PM_ERR_LOGREC;
+	}
+	goto decode;
+    }
+
     if (mode == PM_MODE_BACK) {
        for ( ; ; ) {
 	   if (offset <= sizeof(__pmLogLabel) + 2 * sizeof(int)) {
@@ -1857,7 +2015,8 @@ again:
     if (mode == PM_MODE_BACK)
 	fseek(f, -(long)sizeof(trail), SEEK_CUR);
 
-    __pmOverrideLastFd(fileno(f));
+decode:
+    __pmOverrideLastFd(__pmLogFileno(f));
     sts = __pmDecodeResult(pb, result); /* also swabs the result */
 
 #ifdef PCP_DEBUG
@@ -1923,6 +2082,18 @@ check_all_derived(int numpmid, pmID pmidlist[])
     return 1;
 }
 
+/*
+ * Staging for arena-backed results built in this context, allocated on
+ * first use and protected by c_lock, as for the rest of c_archctl.
+ */
+__pmResultArena *
+__pmLogArena(__pmArchCtl *acp)
+{
+    if (acp->ac_arena == NULL)
+	acp->ac_arena = calloc(1, sizeof(__pmResultArena));
+    return (__pmResultArena *)acp->ac_arena;
+}
+
 int
 __pmLogFetch(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **result)
 {
@@ -1936,8 +2107,6 @@ __pmLogFetch(__pmContext *ctxp, int numpmid, pmID pmidlist[], pmResult **result)
     pmResult	*newres;
     pmDesc	desc;
     int		kval;
-    __pmHashNode	*hp;
-    pmid_ctl	*pcp;
     int		nskip;
     __pmTimeval	tmp;
     int		ctxp_mode = ctxp->c_mode & __PM_MODE_MASK;
@@ -2063,77 +2232,66 @@ more:
 	if (numpmid > 0) {
 	    /*
 	     * not necesssarily after them all, so cherry-pick the metrics
-	     * we wanted ..
-	     * there are two tricks here ...
-	     * (1) pmValueSets for metrics requested, but not in the pmResult
-	     *     from the log are assigned using the first two fields in the
-	     *     pmid_ctl struct -- since these are allocated once as
-	     *	   needed, and never free'd, we have to make sure pmFreeResult
-	     *     finds a pmValueSet in a pinned pdu buffer ... this means
-	     *     we must find at least one real value from the log to go
-	     *     with any "unavailable" results
-	     * (2) real pmValueSets can be ignored, they are in a pdubuf
-	     *     and will be reclaimed when the buffer is unpinned in
-	     *     pmFreeResult
+	     * we wanted into an arena-backed result, with a "no values
+	     * available" pmValueSet for those metrics that were requested
+	     * but are not in the pmResult from the log
 	     */
+	    __pmResultArena	*ap = __pmLogArena(ctxp->c_archctl);
+	    pmValueSet		*vsp;
+	    pmValueSet		*lvsp;
+	    pmValueBlock	*vbp;
+	    int			k;
 
-	    i = (int)sizeof(pmResult) + numpmid * (int)sizeof(pmValueSet *);
-	    if ((newres = (pmResult *)malloc(i)) == NULL) {
-		__pmNoMem("__pmLogFetch.newres", i, PM_FATAL_ERR);
+	    if (ap == NULL) {
+		pmFreeResult(*result);
+		return -oserror();
 	    }
-	    newres->numpmid = numpmid;
-	    newres->timestamp = (*result)->timestamp;
+	    __pmArenaReset(ap);
 	    u = 0;
-	    PM_INIT_LOCKS();
-	    PM_LOCK(__pmLock_libpcp);
 	    for (j = 0; j < numpmid; j++) {
-		hp = __pmHashSearch((int)pmidlist[j], &pc_hc);
-		if (hp == NULL) {
-		    /* first time we've been asked for this one */
-		    if ((pcp = (pmid_ctl *)malloc(sizeof(pmid_ctl))) == NULL) {
-			__pmNoMem("__pmLogFetch.pmid_ctl", sizeof(pmid_ctl), PM_FATAL_ERR);
-		    }
-		    pcp->pc_pmid = pmidlist[j];
-		    pcp->pc_numval = 0;
-		    sts = __pmHashAdd((int)pmidlist[j], (void *)pcp, &pc_hc);
-		    if (sts < 0) {
-			PM_UNLOCK(__pmLock_libpcp);
-			return sts;
-		    }
-		}
-		else
-		    pcp = (pmid_ctl *)hp->data;
+		lvsp = NULL;
 		for (i = 0; i < (*result)->numpmid; i++) {
 		    if (pmidlist[j] == (*result)->vset[i]->pmid) {
 			/* match */
-			newres->vset[j] = (*result)->vset[i];
+			lvsp = (*result)->vset[i];
 			u++;
 			break;
 		    }
 		}
-		if (i == (*result)->numpmid) {
-		    /*
-		     * requested metric not returned from the log, construct
-		     * a "no values available" pmValueSet from the pmid_ctl
-		     */
-		    newres->vset[j] = (pmValueSet *)pcp;
+		if ((vsp = __pmArenaValueSet(ap, pmidlist[j], lvsp == NULL ? 0 : lvsp->numval)) == NULL) {
+		    pmFreeResult(*result);
+		    return -oserror();
+		}
+		if (lvsp == NULL || lvsp->numval <= 0)
+		    continue;
+		vsp->valfmt = lvsp->valfmt;
+		for (k = 0; k < lvsp->numval; k++) {
+		    vsp->vlist[k].inst = lvsp->vlist[k].inst;
+		    if (lvsp->valfmt == PM_VAL_INSITU) {
+			vsp->vlist[k].value.lval = lvsp->vlist[k].value.lval;
+			continue;
+		    }
+		    if ((vbp = __pmArenaValueBlock(ap, lvsp->vlist[k].value.pval->vlen, &vsp->vlist[k])) == NULL) {
+			pmFreeResult(*result);
+			return -oserror();
+		    }
+		    memcpy((void *)vbp, (void *)lvsp->vlist[k].value.pval, lvsp->vlist[k].value.pval->vlen);
 		}
 	    }
-	    PM_UNLOCK(__pmLock_libpcp);
 	    if (u == 0 && !all_derived) {
 		/*
 		 * not one of our pmids was in the log record, try
 		 * another log record ...
 		 */
 		pmFreeResult(*result);
-		free(newres);
 		goto more;
 	    }
-	    /*
-	     * *result malloc'd in __pmLogRead, but vset[]'s are either in
-	     * pdubuf or the pmid_ctl struct
-	     */
-	    free(*result);
+	    if ((sts = __pmArenaResult(ap, &newres)) < 0) {
+		pmFreeResult(*result);
+		return sts;
+	    }
+	    newres->timestamp = (*result)->timestamp;
+	    pmFreeResult(*result);
 	    *result = newres;
 	}
 	else
@@ -2320,9 +2478,9 @@ __pmLogSetTime(__pmContext *ctxp)
 		    sbuf.st_size = 0;
 		    vol = lcp->l_maxvol;
 		    if (vol >= 0 && vol < lcp->l_numseen && lcp->l_seen[vol])
-			fstat(fileno(lcp->l_mfp), &sbuf);
+			__pmLogFstat(lcp->l_mfp, &sbuf);
 		    else if ((f = _logpeek(lcp, lcp->l_maxvol)) != NULL) {
-			fstat(fileno(f), &sbuf);
+			__pmLogFstat(f, &sbuf);
 			fclose(f);
 		    }
 		}
@@ -2506,6 +2664,7 @@ pmGetArchiveLabel(pmLogLabel *lp)
     __pmContext	*ctxp;
     __pmArchCtl	*acp;
     __pmLogCtl	*lcp;
+    __pmLogCtl	*lockedlcp;	/* whose l_lock we hold */
 
     ctxp = __pmHandleToPtr(pmWhichContext());
     if (ctxp == NULL) 
@@ -2516,6 +2675,8 @@ pmGetArchiveLabel(pmLogLabel *lp)
     }
     acp = ctxp->c_archctl;
     lcp = acp->ac_log;
+    lockedlcp = lcp;
+    PM_LOCK(lockedlcp->l_lock);
 
     /* If necessary, switch to the first archive in the context. */
     if (acp->ac_cur_log != 0) {
@@ -2525,6 +2686,7 @@ pmGetArchiveLabel(pmLogLabel *lp)
 	save_offset = ctxp->c_archctl->ac_offset;
 
 	if ((sts = __pmLogChangeArchive(ctxp, 0)) < 0) {
+	    PM_UNLOCK(lockedlcp->l_lock);
 	    PM_UNLOCK(ctxp->c_lock);
 	    return sts;
 	}
@@ -2534,6 +2696,7 @@ pmGetArchiveLabel(pmLogLabel *lp)
 
     /* Get the label. */
     if ((sts = __pmGetArchiveLabel(lcp, lp)) < 0) {
+	PM_UNLOCK(lockedlcp->l_lock);
 	PM_UNLOCK(ctxp->c_lock);
 	return sts;
     }
@@ -2541,17 +2704,19 @@ pmGetArchiveLabel(pmLogLabel *lp)
     if (restore) {
 	/* Restore to the initial state. */
 	if ((sts = __pmLogChangeArchive(ctxp, save_arch)) < 0) {
+	    PM_UNLOCK(lockedlcp->l_lock);
 	    PM_UNLOCK(ctxp->c_lock);
 	    return sts;
 	}
 	lcp = ctxp->c_archctl->ac_log;
 	if ((sts = __pmLogChangeVol(lcp, save_vol)) < 0) {
+	    PM_UNLOCK(lockedlcp->l_lock);
 	    PM_UNLOCK(ctxp->c_lock);
 	    return sts;
 	}
 	fseek(lcp->l_mfp, save_offset, SEEK_SET);
     }
-
+    PM_UNLOCK(lockedlcp->l_lock);
     PM_UNLOCK(ctxp->c_lock);
     return 0;
 }
@@ -2599,7 +2764,7 @@ __pmGetArchiveEnd(__pmLogCtl *lcp, struct timeval *tp)
 	    continue;
 	}
 
-	if (fstat(fileno(f), &sbuf) < 0) {
+	if (__pmLogFstat(f, &sbuf) < 0) {
 	    /* if we can't stat() this one, then try previous volume(s) */
 	    fclose(f);
 	    f = NULL;
@@ -2756,6 +2921,7 @@ pmGetArchiveEnd(struct timeval *tp)
     __pmContext	*ctxp;
     __pmArchCtl	*acp;
     __pmLogCtl	*lcp;
+    __pmLogCtl	*lockedlcp;	/* whose l_lock we hold */
 
     /*
      * set l_physend and l_endtime
@@ -2770,6 +2936,8 @@ pmGetArchiveEnd(struct timeval *tp)
     }
     acp = ctxp->c_archctl;
     lcp = acp->ac_log;
+    lockedlcp = lcp;
+    PM_LOCK(lockedlcp->l_lock);
 
     /* If necessary, switch to the last archive in the context. */
     if (acp->ac_cur_log != acp->ac_num_logs - 1) {
@@ -2779,6 +2947,7 @@ pmGetArchiveEnd(struct timeval *tp)
 	save_offset = ctxp->c_archctl->ac_offset;
 
 	if ((sts = __pmLogChangeArchive(ctxp, acp->ac_num_logs - 1)) < 0) {
+	    PM_UNLOCK(lockedlcp->l_lock);
 	    PM_UNLOCK(ctxp->c_lock);
 	    return sts;
 	}
@@ -2787,6 +2956,7 @@ pmGetArchiveEnd(struct timeval *tp)
     }
 
     if ((sts = __pmGetArchiveEnd(lcp, tp)) < 0) {
+	PM_UNLOCK(lockedlcp->l_lock);
 	PM_UNLOCK(ctxp->c_lock);
 	return sts;
     }
@@ -2794,17 +2964,19 @@ pmGetArchiveEnd(struct timeval *tp)
     if (restore) {
 	/* Restore to the initial state. */
 	if ((sts = __pmLogChangeArchive(ctxp, save_arch)) < 0) {
+	    PM_UNLOCK(lockedlcp->l_lock);
 	    PM_UNLOCK(ctxp->c_lock);
 	    return sts;
 	}
 	lcp = ctxp->c_archctl->ac_log;
 	if ((sts = __pmLogChangeVol(lcp, save_vol)) < 0) {
+	    PM_UNLOCK(lockedlcp->l_lock);
 	    PM_UNLOCK(ctxp->c_lock);
 	    return sts;
 	}
 	fseek(lcp->l_mfp, save_offset, SEEK_SET);
     }
-
+    PM_UNLOCK(lockedlcp->l_lock);
     PM_UNLOCK(ctxp->c_lock);
     return sts;
 }
@@ -2829,8 +3001,17 @@ __pmLogChangeArchive(__pmContext *ctxp, int arch)
      * if necessary.
      */
     sts = __pmFindOrOpenArchive(ctxp, mlcp->ml_name, 1/*multi_arch*/);
-    if (sts < 0)
+    if (sts < 0) {
+	/*
+	 * The current archive has been closed by now, so re-open it and
+	 * go back to the last position, so the context remains usable.
+	 */
+	mlcp = acp->ac_log_list[acp->ac_cur_log];
+	if (__pmFindOrOpenArchive(ctxp, mlcp->ml_name, 1/*multi_arch*/) == 0 &&
+	    __pmLogChangeVol(acp->ac_log, acp->ac_vol) == 0)
+	    fseek(acp->ac_log->l_mfp, acp->ac_offset, SEEK_SET);
 	return sts;
+    }
 
     acp->ac_cur_log = arch;
     acp->ac_mark_done = 0;
@@ -2891,6 +3072,7 @@ __pmLogChangeToNextArchive(__pmLogCtl **lcp)
     __pmTimeval prev_endtime;
     __pmTimeval	save_origin;
     int		save_mode;
+    int		sts;
 
     /* Get the current context. It must be an archive context. */
     ctxp = __pmHandleToPtr(pmWhichContext());
@@ -2932,10 +3114,14 @@ __pmLogChangeToNextArchive(__pmLogCtl **lcp)
     save_origin = ctxp->c_origin;
     save_mode = ctxp->c_mode;
     /* Switch to the next archive. */
-    __pmLogChangeArchive(ctxp, acp->ac_cur_log + 1);
+    sts = __pmLogChangeArchive(ctxp, acp->ac_cur_log + 1);
     *lcp = acp->ac_log;
     ctxp->c_origin = save_origin;
     ctxp->c_mode = save_mode;
+    if (sts < 0) {
+	PM_UNLOCK(ctxp->c_lock);
+	return sts;
+    }
 
     /*
      * We want to reposition to the start of the archive.
@@ -3009,10 +3195,14 @@ __pmLogChangeToPreviousArchive(__pmLogCtl **lcp)
     save_origin = ctxp->c_origin;
     save_mode = ctxp->c_mode;
     /* Switch to the next archive. */
-    __pmLogChangeArchive(ctxp, acp->ac_cur_log - 1);
+    sts = __pmLogChangeArchive(ctxp, acp->ac_cur_log - 1);
     *lcp = acp->ac_log;
     ctxp->c_origin = save_origin;
     ctxp->c_mode = save_mode;
+    if (sts < 0) {
+	PM_UNLOCK(ctxp->c_lock);
+	return sts;
+    }
 
     /*
      * We need the current end time of the new archive in order to compare
@@ -3058,9 +3248,12 @@ __pmArchCtlFree(__pmArchCtl *acp)
      */
     __pmLogCtl *lcp = acp->ac_log;
     if (lcp != NULL) {
-	if (--lcp->l_refcnt == 0) {
+	if (lcp->l_refcnt == 0 || --lcp->l_refcnt == 0) {
 	    __pmLogClose(lcp);
 	    logFreePMNS(lcp);
+#ifdef PM_MULTI_THREAD
+	    pthread_mutex_destroy(&lcp->l_lock);
+#endif
 	    free(lcp);
 	}
     }
@@ -3081,6 +3274,12 @@ __pmArchCtlFree(__pmArchCtl *acp)
     if (acp->ac_cache != NULL)
 	free(acp->ac_cache);
 
+    /* And the result arena. */
+    if (acp->ac_arena != NULL) {
+	__pmArenaFree((__pmResultArena *)acp->ac_arena);
+	free(acp->ac_arena);
+    }
+
     /* Now we can free it. */
     free(acp);
 }
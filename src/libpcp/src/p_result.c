@@ -22,9 +22,10 @@
  * ensuring _someone_ will unpin the buffer when it is safe to do so.
  *
  * Similarly, __pmDecodeResult() accepts a pinned buffer and returns
- * a pmResult that (on 64-bit pointer platforms) may contain pointers
- * into a second underlying pinned buffer.  The input buffer remains
- * pinned, the second buffer will be pinned if it is used.  The caller
+ * a pmResult that (on 64-bit pointer platforms) is itself in a second
+ * underlying pinned buffer, along with all of its pmValueSets and
+ * pmValueBlocks (an arena-backed result).  The input buffer remains
+ * pinned, and the second buffer is pinned too.  The caller
  * will typically call pmFreeResult(), but also needs to call
  * __pmUnpinPDUBuf() for the input PDU buffer.  When the result contains
  * pointers back into the input PDU buffer, this will be pinned _twice_
@@ -189,6 +190,7 @@ __pmDecodeResult(__pmPDU *pdubuf, pmResult **result)
     int		valfmt;
     int		numval;
     int		need;
+    int		rsize;		/* size of pmResult */
 /*
  * Note: all sizes are in units of bytes ... beware that pp->data is in
  *	 units of __pmPDU
@@ -231,15 +233,9 @@ __pmDecodeResult(__pmPDU *pdubuf, pmResult **result)
 #endif
 	return PM_ERR_IPC;
     }
-    if ((pr = (pmResult *)malloc(sizeof(pmResult) +
-			     (numpmid - 1) * sizeof(pmValueSet *))) == NULL) {
-	return -oserror();
-    }
-    pr->numpmid = numpmid;
-    pr->timestamp.tv_sec = ntohl(pp->timestamp.tv_sec);
-    pr->timestamp.tv_usec = ntohl(pp->timestamp.tv_usec);
 
 #if defined(HAVE_64BIT_PTR)
+    pr = NULL;
     vsplit = pduend;	/* smallest observed value block pointer */
     nvsize = vsize = vbsize = 0;
     for (i = 0; i < numpmid; i++) {
@@ -385,11 +381,20 @@ __pmDecodeResult(__pmPDU *pdubuf, pmResult **result)
 	goto corrupt;
     }
 
-    /* the original pdubuf is already pinned so we won't allocate that again */
-    if ((newbuf = (char *)__pmFindPDUBuf(need)) == NULL) {
-	free(pr);
+    /*
+     * the original pdubuf is already pinned so we won't allocate that
+     * again ... the pmResult goes at the start of the new buffer, so
+     * pmFreeResult() releases the lot with one __pmUnpinPDUBuf()
+     */
+    rsize = (int)sizeof(pmResult);
+    if (numpmid > 1)
+	rsize += (numpmid - 1) * (int)sizeof(pmValueSet *);
+    if ((pr = (pmResult *)__pmFindPDUBuf(rsize + need)) == NULL)
 	return -oserror();
-    }
+    pr->numpmid = numpmid;
+    pr->timestamp.tv_sec = ntohl(pp->timestamp.tv_sec);
+    pr->timestamp.tv_usec = ntohl(pp->timestamp.tv_usec);
+    newbuf = (char *)pr + rsize;
 
     /*
      * At this point, we have verified the contents of the incoming PDU and
@@ -403,11 +408,12 @@ __pmDecodeResult(__pmPDU *pdubuf, pmResult **result)
      *                                    bytes              bytes
      *
      * and in the new PDU buffer we are going to build ...
-     * :---------------------:---------------------:
-     * : ... pmValueSets ... : .. pmValueBlocks .. :
-     * :---------------------:---------------------:
-     *  <---   nvsize    ---> <----   vbsize  ---->
-     *         bytes                  bytes
+     * :----------:---------------------:---------------------:
+     * : pmResult : ... pmValueSets ... : .. pmValueBlocks .. :
+     * :----------:---------------------:---------------------:
+     *  <-rsize-->  <---   nvsize    ---> <----   vbsize  ---->
+     *   bytes      ^      bytes                  bytes
+     *              newbuf
      */
 
     if (vbsize) {
@@ -490,11 +496,14 @@ __pmDecodeResult(__pmPDU *pdubuf, pmResult **result)
 	}
 #endif
     }
-    if (numpmid == 0)
-	__pmUnpinPDUBuf(newbuf);
 
 #elif defined(HAVE_32BIT_PTR)
 
+    if ((pr = (pmResult *)malloc(sizeof(pmResult) +
+			     (numpmid - 1) * sizeof(pmValueSet *))) == NULL) {
+	return -oserror();
+    }
+    pr->numpmid = numpmid;
     pr->timestamp.tv_sec = ntohl(pp->timestamp.tv_sec);
     pr->timestamp.tv_usec = ntohl(pp->timestamp.tv_usec);
     vlp = (vlist_t *)pp->data;
@@ -638,8 +647,8 @@ __pmDecodeResult(__pmPDU *pdubuf, pmResult **result)
 
     /*
      * Note we return with the input buffer (pdubuf) still pinned and
-     * for the 64-bit pointer case the new buffer (newbuf) also pinned -
-     * if numpmid != 0 see the thread-safe comments above
+     * for the 64-bit pointer case the new buffer (holding pr) also
+     * pinned - see the thread-safe comments above
      */
     *result = pr;
     return 0;
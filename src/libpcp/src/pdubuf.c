@@ -12,11 +12,29 @@
  * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
  * License for more details.
  *
+ * PDU buffers of up to MAXSLABBUF bytes are carved from slabs of
+ * SLAB_SIZE bytes, each aligned on a SLAB_SIZE boundary and holding
+ * objects of just one size class (a power of two).  Each object starts
+ * with a bufobj_t holding its pin count, so any address within a buffer
+ * leads to its slab (by masking) and then to its object (by division)
+ * without searching.  Free objects are cached per-thread (up to MAG_SIZE
+ * of each class) so the usual find, send or decode, unpin cycle reuses
+ * the same few buffers.  Larger buffers are malloc'd one at a time and
+ * found via a tsearch(3) tree, as all buffers used to be.
+ *
  * Thread-safe notes
  *
  * To avoid buffer trampling, on success __pmFindPDUBuf() now returns
  * a pinned PDU buffer.  It is the caller's responsibility to unpin the
  * PDU buffer when safe to do so.
+ *
+ * Slabs, pin counts, buf_tree (and the __pmCountPDUBuf callback state)
+ * are protected by pdubuf_lock, not __pmLock_libpcp, as every PDU sent
+ * or received comes through here.  pdubuf_lock is a leaf lock: nothing
+ * else is locked, and no diagnostics are issued via __pmNotifyErr(),
+ * while it is held.  The per-thread caches are only used by their own
+ * thread, except that the counts in them are read (unlocked, these are
+ * diagnostics) by __pmCountPDUBuf and __pmGetPDUBufStats.
  */
 
 #include "pmapi.h"
@@ -34,8 +52,80 @@ typedef struct bufctl
     /* The actual buffer happens to follow this struct. */
 } bufctl_t;
 
-/* Protected by global __pmLock_libpcp. */
+/* Protected by pdubuf_lock. */
 static void *buf_tree;
+#ifdef PM_MULTI_THREAD
+static pthread_mutex_t	pdubuf_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static void		*pdubuf_lock;
+#endif
+
+#if defined(HAVE_POSIX_MEMALIGN) || defined(HAVE_MEMALIGN)
+#define PDUBUF_SLABS
+#endif
+
+#define SLAB_SHIFT	17
+#define SLAB_SIZE	(1 << SLAB_SHIFT)	/* 128 Kbytes, and aligned so */
+#define MIN_SHIFT	7			/* smallest class, 128 bytes */
+#define NCLASS		8			/* ... doubling up to 16 Kbytes */
+#define MAXSLABBUF	(1 << (MIN_SHIFT + NCLASS - 1))
+#define MAG_SIZE	8			/* per-thread cache, per class */
+
+/*
+ * Object header, padded so that the buffer that follows is aligned at
+ * least as well as malloc would align it.
+ */
+typedef union bufobj {
+    struct {
+	int		pincnt;		/* 0 if free or cached */
+	int		size;		/* bytes asked for, <= class size */
+	union bufobj	*next;		/* when on a slab's free list */
+    } o;
+    double		align_d;
+    long long		align_ll;
+    void		*align_p[2];
+} bufobj_t;
+
+typedef struct slab {
+    struct slab		*next;		/* slabs of this class with */
+    struct slab		*prev;		/* ... free objects */
+    bufobj_t		*free;		/* free objects in this slab */
+    int			nfree;
+    int			cls;		/* size class, 0 .. NCLASS-1 */
+    char		*base;		/* first object */
+} slab_t;
+
+typedef struct {
+    slab_t		*partial;	/* slabs with at least one free object */
+    int			nslab;
+    int			nfree;		/* free objects in all slabs */
+} sizeclass_t;
+
+/* Per-thread cache of free objects, also kept on a list for the stats. */
+typedef struct magazine {
+    struct magazine	*next;
+    struct magazine	*prev;
+    int			count[NCLASS];
+    bufobj_t		*obj[NCLASS][MAG_SIZE];
+    __uint64_t		hit;		/* finds satisfied from this cache */
+} magazine_t;
+
+#ifdef PDUBUF_SLABS
+/* Protected by pdubuf_lock. */
+static sizeclass_t	sizeclass[NCLASS];
+static __pmHashCtl	slab_hc;	/* slab address >> SLAB_SHIFT -> slab */
+static magazine_t	*maglist;
+static __uint64_t	retired_hit;	/* from magazines of exited threads */
+static __uint64_t	slab_miss;	/* finds that had to go to a slab */
+#ifdef PM_MULTI_THREAD
+static pthread_once_t	magkey_once = PTHREAD_ONCE_INIT;
+static pthread_key_t	magkey;
+static int		magkey_sts;	/* set once, by mag_key_create() */
+#else
+static magazine_t	*magazine;
+#endif
+#endif
+static __uint64_t	large_alloc;	/* protected by pdubuf_lock */
 
 #ifdef PCP_DEBUG
 static void
@@ -49,20 +139,64 @@ pdubufdump1(const void *nodep, const VISIT which, const int depth)
 		pcp->bc_pincnt);
 }
 
+#ifdef PDUBUF_SLABS
+static int	class_stride(int);
+static int	class_nobj(int);
+
+/* pinned objects in one slab, same format as pdubufdump1 */
+static void
+pdubufdumpslab(const slab_t *sp, int *hdr)
+{
+    bufobj_t	*op;
+    char	*buf;
+    int		i;
+
+    for (i = 0; i < class_nobj(sp->cls); i++) {
+	op = (bufobj_t *)(sp->base + i * class_stride(sp->cls));
+	if (op->o.pincnt == 0)
+	    continue;
+	if (*hdr == 0) {
+	    fprintf(stderr, "   pinned pdubuf[size](pincnt):");
+	    *hdr = 1;
+	}
+	buf = (char *)&op[1];
+	fprintf(stderr, " " PRINTF_P_PFX "%p...%p[%d](%d)",
+		buf, &buf[op->o.size - 1], op->o.size, op->o.pincnt);
+    }
+}
+#endif
+
+/* always called with pdubuf_lock held */
 static void
 pdubufdump(void)
 {
-    /*
-     * There is no longer a pdubuf free list, ergo no
-     * fprintf(stderr, "   free pdubuf[size]:\n");
-     */
-    PM_LOCK(__pmLock_libpcp);
+    int			hdr = 0;
+#ifdef PDUBUF_SLABS
+    __pmHashNode	*hp;
+    int			c;
+    int			i;
+
+    if (pmDebug & DBG_TRACE_DESPERATE) {
+	for (c = 0; c < NCLASS; c++) {
+	    if (sizeclass[c].nslab == 0)
+		continue;
+	    fprintf(stderr, "   pdubuf[%d] slabs: %d free: %d\n",
+		    1 << (MIN_SHIFT + c), sizeclass[c].nslab, sizeclass[c].nfree);
+	}
+    }
+    for (i = 0; i < slab_hc.hsize; i++) {
+	for (hp = slab_hc.hash[i]; hp != NULL; hp = hp->next)
+	    pdubufdumpslab((slab_t *)hp->data, &hdr);
+    }
+#endif
     if (buf_tree != NULL) {
-	fprintf(stderr, "   pinned pdubuf[size](pincnt):");
+	if (hdr == 0)
+	    fprintf(stderr, "   pinned pdubuf[size](pincnt):");
 	twalk(buf_tree, &pdubufdump1);
-	fprintf(stderr, "\n");
+	hdr = 1;
     }
-    PM_UNLOCK(__pmLock_libpcp);
+    if (hdr)
+	fprintf(stderr, "\n");
 }
 #endif
 
@@ -83,6 +217,242 @@ bufctl_t_compare(const void *a, const void *b)
     return 0;		/* overlap */
 }
 
+#ifdef PDUBUF_SLABS
+static inline int
+class_size(int c)
+{
+    return 1 << (MIN_SHIFT + c);
+}
+
+static inline int
+class_stride(int c)
+{
+    return sizeof(bufobj_t) + class_size(c);
+}
+
+#define SLAB_HDR	((sizeof(slab_t) + sizeof(bufobj_t) - 1) / sizeof(bufobj_t) * sizeof(bufobj_t))
+
+static inline int
+class_nobj(int c)
+{
+    return (SLAB_SIZE - SLAB_HDR) / class_stride(c);
+}
+
+static inline int
+size_class(int need)
+{
+    int		c = 0;
+
+    while (class_size(c) < need)
+	c++;
+    return c;
+}
+
+/*
+ * Map any address to the slab object containing it, or NULL if the
+ * address is not in a slab object.  Always called with pdubuf_lock held.
+ */
+static bufobj_t *
+slab_lookup(void *handle, slab_t **spp)
+{
+    uintptr_t		addr = (uintptr_t)handle;
+    uintptr_t		start = addr & ~((uintptr_t)SLAB_SIZE - 1);
+    __pmHashNode	*hp;
+    slab_t		*sp;
+    bufobj_t		*op;
+    uintptr_t		i;
+
+    for (hp = __pmHashSearch((unsigned int)(start >> SLAB_SHIFT), &slab_hc);
+	 hp != NULL; hp = hp->next) {
+	if ((uintptr_t)hp->data == start)
+	    break;
+    }
+    if (hp == NULL)
+	return NULL;
+    sp = (slab_t *)start;
+    if (addr < (uintptr_t)sp->base)
+	return NULL;
+    i = (addr - (uintptr_t)sp->base) / class_stride(sp->cls);
+    if (i >= (uintptr_t)class_nobj(sp->cls))
+	return NULL;
+    op = (bufobj_t *)(sp->base + i * class_stride(sp->cls));
+    if (addr < (uintptr_t)&op[1] ||
+	addr >= (uintptr_t)&op[1] + op->o.size)
+	return NULL;		/* in the header, or beyond the buffer */
+    *spp = sp;
+    return op;
+}
+
+/*
+ * Get a free object from a slab of class c, allocating a new slab if
+ * need be.  Always called with pdubuf_lock held.
+ */
+static bufobj_t *
+slab_get(int c)
+{
+    sizeclass_t		*scp = &sizeclass[c];
+    slab_t		*sp;
+    bufobj_t		*op;
+    int			i;
+
+    if ((sp = scp->partial) == NULL) {
+	void		*p;
+#ifdef HAVE_POSIX_MEMALIGN
+	if (posix_memalign(&p, SLAB_SIZE, SLAB_SIZE) != 0)
+	    return NULL;
+#else
+	if ((p = memalign(SLAB_SIZE, SLAB_SIZE)) == NULL)
+	    return NULL;
+#endif
+	sp = (slab_t *)p;
+	if (__pmHashAdd((unsigned int)((uintptr_t)sp >> SLAB_SHIFT), sp, &slab_hc) < 0) {
+	    free(sp);
+	    return NULL;
+	}
+	sp->cls = c;
+	sp->base = (char *)sp + SLAB_HDR;
+	sp->free = NULL;
+	sp->nfree = class_nobj(c);
+	for (i = sp->nfree - 1; i >= 0; i--) {
+	    op = (bufobj_t *)(sp->base + i * class_stride(c));
+	    op->o.pincnt = 0;
+	    op->o.next = sp->free;
+	    sp->free = op;
+	}
+	sp->prev = NULL;
+	sp->next = NULL;
+	scp->partial = sp;
+	scp->nslab++;
+	scp->nfree += sp->nfree;
+    }
+
+    op = sp->free;
+    sp->free = op->o.next;
+    sp->nfree--;
+    scp->nfree--;
+    if (sp->nfree == 0) {
+	/* full, off the partial list */
+	scp->partial = sp->next;
+	if (sp->next != NULL)
+	    sp->next->prev = NULL;
+    }
+    slab_miss++;
+    return op;
+}
+
+/*
+ * Return an object to its slab, releasing the slab if it is now unused
+ * and there is at least another slab's worth of free objects in this
+ * class.  Always called with pdubuf_lock held.
+ */
+static void
+slab_put(bufobj_t *op)
+{
+    slab_t		*sp;
+    sizeclass_t		*scp;
+    int			nobj;
+
+    sp = (slab_t *)((uintptr_t)op & ~((uintptr_t)SLAB_SIZE - 1));
+    scp = &sizeclass[sp->cls];
+    nobj = class_nobj(sp->cls);
+    op->o.pincnt = 0;
+    op->o.next = sp->free;
+    sp->free = op;
+    if (sp->nfree++ == 0) {
+	/* was full, back on the partial list */
+	sp->prev = NULL;
+	sp->next = scp->partial;
+	if (sp->next != NULL)
+	    sp->next->prev = sp;
+	scp->partial = sp;
+    }
+    scp->nfree++;
+    if (sp->nfree == nobj && scp->nfree >= 2 * nobj) {
+	if (sp->prev != NULL)
+	    sp->prev->next = sp->next;
+	else
+	    scp->partial = sp->next;
+	if (sp->next != NULL)
+	    sp->next->prev = sp->prev;
+	scp->nslab--;
+	scp->nfree -= nobj;
+	__pmHashDel((unsigned int)((uintptr_t)sp >> SLAB_SHIFT), sp, &slab_hc);
+	free(sp);
+    }
+}
+
+#ifdef PM_MULTI_THREAD
+/*
+ * Thread exit, return this thread's cached objects to their slabs.
+ */
+static void
+mag_destroy(void *arg)
+{
+    magazine_t		*mp = (magazine_t *)arg;
+    int			c;
+
+    PM_LOCK(pdubuf_lock);
+    for (c = 0; c < NCLASS; c++) {
+	while (mp->count[c] > 0)
+	    slab_put(mp->obj[c][--mp->count[c]]);
+    }
+    retired_hit += mp->hit;
+    if (mp->prev != NULL)
+	mp->prev->next = mp->next;
+    else
+	maglist = mp->next;
+    if (mp->next != NULL)
+	mp->next->prev = mp->prev;
+    PM_UNLOCK(pdubuf_lock);
+    free(mp);
+}
+
+static void
+mag_key_create(void)
+{
+    magkey_sts = pthread_key_create(&magkey, mag_destroy);
+}
+#endif
+
+/*
+ * This thread's cache of free objects, or NULL if it cannot be created.
+ * Never called with pdubuf_lock held.
+ */
+static magazine_t *
+mag_get(void)
+{
+    magazine_t		*mp;
+
+#ifdef PM_MULTI_THREAD
+    pthread_once(&magkey_once, mag_key_create);
+    if (magkey_sts != 0)
+	return NULL;
+    if ((mp = (magazine_t *)pthread_getspecific(magkey)) != NULL)
+	return mp;
+#else
+    if ((mp = magazine) != NULL)
+	return mp;
+#endif
+    if ((mp = (magazine_t *)calloc(1, sizeof(*mp))) == NULL)
+	return NULL;
+#ifdef PM_MULTI_THREAD
+    if (pthread_setspecific(magkey, mp) != 0) {
+	free(mp);
+	return NULL;
+    }
+#else
+    magazine = mp;
+#endif
+    PM_LOCK(pdubuf_lock);
+    mp->next = maglist;
+    if (maglist != NULL)
+	maglist->prev = mp;
+    maglist = mp;
+    PM_UNLOCK(pdubuf_lock);
+    return mp;
+}
+#endif /* PDUBUF_SLABS */
+
 __pmPDU *
 __pmFindPDUBuf(int need)
 {
@@ -95,11 +465,49 @@ __pmFindPDUBuf(int need)
 	/* special diagnostic case ... dump buffer state */
 #ifdef PCP_DEBUG
 	fprintf(stderr, "__pmFindPDUBuf(DEBUG)\n");
+	PM_LOCK(pdubuf_lock);
 	pdubufdump();
+	PM_UNLOCK(pdubuf_lock);
 #endif
 	return NULL;
     }
 
+#ifdef PDUBUF_SLABS
+    if (likely(need <= MAXSLABBUF)) {
+	magazine_t	*mp = mag_get();
+	bufobj_t	*op;
+	int		c = size_class(need);
+
+	if (likely(mp != NULL && mp->count[c] > 0)) {
+	    op = mp->obj[c][--mp->count[c]];
+	    mp->hit++;
+	    op->o.size = need;
+	    op->o.pincnt = 1;
+	}
+	else {
+	    PM_LOCK(pdubuf_lock);
+	    op = slab_get(c);
+	    if (likely(op != NULL)) {
+		op->o.size = need;
+		op->o.pincnt = 1;
+	    }
+	    PM_UNLOCK(pdubuf_lock);
+	    if (unlikely(op == NULL))
+		return NULL;
+	}
+#ifdef PCP_DEBUG
+	if (unlikely(pmDebug & DBG_TRACE_PDUBUF)) {
+	    fprintf(stderr, "__pmFindPDUBuf(%d) -> " PRINTF_P_PFX "%p [%d]\n",
+		    need, &op[1], class_size(c));
+	    PM_LOCK(pdubuf_lock);
+	    pdubufdump();
+	    PM_UNLOCK(pdubuf_lock);
+	}
+#endif
+	return (__pmPDU *)&op[1];
+    }
+#endif
+
     if ((pcp = (bufctl_t *)malloc(sizeof(*pcp) + need)) == NULL) {
 	return NULL;
     }
@@ -108,15 +516,15 @@ __pmFindPDUBuf(int need)
     pcp->bc_size = need;
     pcp->bc_buf = ((char *)pcp) + sizeof(*pcp);
 
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(pdubuf_lock);
     /* Insert the node in the tree. */
     bcp = tsearch((void *)pcp, &buf_tree, &bufctl_t_compare);
     if (unlikely(bcp == NULL)) {	/* ENOMEM */
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(pdubuf_lock);
 	free(pcp);
 	return NULL;
     }
-    PM_UNLOCK(__pmLock_libpcp);
+    large_alloc++;
 
 #ifdef PCP_DEBUG
     if (unlikely(pmDebug & DBG_TRACE_PDUBUF)) {
@@ -125,6 +533,7 @@ __pmFindPDUBuf(int need)
 	pdubufdump();
     }
 #endif
+    PM_UNLOCK(pdubuf_lock);
 
     return (__pmPDU *)pcp->bc_buf;
 }
@@ -137,7 +546,26 @@ __pmPinPDUBuf(void *handle)
 
     assert(((__psint_t)handle % sizeof(int)) == 0);
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(pdubuf_lock);
+
+#ifdef PDUBUF_SLABS
+    {
+	slab_t		*sp;
+	bufobj_t	*op = slab_lookup(handle, &sp);
+
+	if (op != NULL && op->o.pincnt > 0) {
+	    op->o.pincnt++;
+#ifdef PCP_DEBUG
+	    if (unlikely(pmDebug & DBG_TRACE_PDUBUF))
+		fprintf(stderr, "__pmPinPDUBuf(" PRINTF_P_PFX "%p) -> pdubuf="
+			PRINTF_P_PFX "%p, pincnt=%d\n", handle,
+			&op[1], op->o.pincnt);
+#endif
+	    PM_UNLOCK(pdubuf_lock);
+	    return;
+	}
+    }
+#endif
 
     /*
      * Initialize a dummy bufctl_t to use only as search key;
@@ -158,13 +586,13 @@ __pmPinPDUBuf(void *handle)
 	       ((char *)handle < &pcp->bc_buf[pcp->bc_size]));
 	pcp->bc_pincnt++;
     } else {
-	__pmNotifyErr(LOG_WARNING, "__pmPinPDUBuf: 0x%lx not in pool!",
-			(unsigned long)handle);
 #ifdef PCP_DEBUG
 	if (pmDebug & DBG_TRACE_PDUBUF)
 	    pdubufdump();
 #endif
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(pdubuf_lock);
+	__pmNotifyErr(LOG_WARNING, "__pmPinPDUBuf: 0x%lx not in pool!",
+			(unsigned long)handle);
 	return;
     }
 
@@ -175,7 +603,7 @@ __pmPinPDUBuf(void *handle)
 		pcp->bc_buf, pcp->bc_pincnt);
 #endif
 
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(pdubuf_lock);
 }
 
 int
@@ -186,7 +614,41 @@ __pmUnpinPDUBuf(void *handle)
 
     assert(((__psint_t)handle % sizeof(int)) == 0);
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(pdubuf_lock);
+
+#ifdef PDUBUF_SLABS
+    {
+	slab_t		*sp;
+	bufobj_t	*op = slab_lookup(handle, &sp);
+
+	if (op != NULL && op->o.pincnt > 0) {
+	    magazine_t	*mp;
+	    int		c = sp->cls;
+
+#ifdef PCP_DEBUG
+	    if (unlikely(pmDebug & DBG_TRACE_PDUBUF))
+		fprintf(stderr, "__pmUnpinPDUBuf(" PRINTF_P_PFX "%p) -> pdubuf="
+			PRINTF_P_PFX "%p, pincnt=%d\n", handle,
+			&op[1], op->o.pincnt - 1);
+#endif
+	    if (likely(--op->o.pincnt > 0)) {
+		PM_UNLOCK(pdubuf_lock);
+		return 1;
+	    }
+	    PM_UNLOCK(pdubuf_lock);
+	    /* free, into this thread's cache if there is room */
+	    mp = mag_get();
+	    if (likely(mp != NULL && mp->count[c] < MAG_SIZE)) {
+		mp->obj[c][mp->count[c]++] = op;
+		return 1;
+	    }
+	    PM_LOCK(pdubuf_lock);
+	    slab_put(op);
+	    PM_UNLOCK(pdubuf_lock);
+	    return 1;
+	}
+    }
+#endif
 
     /*
      * Initialize a dummy bufctl_t to use only as search key;
@@ -211,7 +673,7 @@ __pmUnpinPDUBuf(void *handle)
 	    pdubufdump();
 	}
 #endif
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(pdubuf_lock);
 	return 0;
     }
 
@@ -227,19 +689,62 @@ __pmUnpinPDUBuf(void *handle)
 
     if (likely(--pcp->bc_pincnt == 0)) {
 	tdelete(pcp, &buf_tree, &bufctl_t_compare);
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(pdubuf_lock);
 	free(pcp);
     }
     else {
-	PM_UNLOCK(__pmLock_libpcp);
+	PM_UNLOCK(pdubuf_lock);
     }
 
     return 1;
 }
 
+/*
+ * If handle is an address within a pinned PDU buffer, set *base to
+ * the start of that buffer and return its size, else return 0.  The
+ * pin count is not changed.
+ */
+int
+__pmPDUBufRange(void *handle, char **base)
+{
+    bufctl_t	*pcp, pcp_search;
+    void	*bcp;
+    int		size = 0;
+
+    PM_INIT_LOCKS();
+    PM_LOCK(pdubuf_lock);
+
+#ifdef PDUBUF_SLABS
+    {
+	slab_t		*sp;
+	bufobj_t	*op = slab_lookup(handle, &sp);
+
+	if (op != NULL) {
+	    if (op->o.pincnt > 0) {
+		*base = (char *)&op[1];
+		size = op->o.size;
+	    }
+	    PM_UNLOCK(pdubuf_lock);
+	    return size;
+	}
+    }
+#endif
+
+    pcp_search.bc_buf = handle;
+    pcp_search.bc_size = 1;
+    if ((bcp = tfind(&pcp_search, &buf_tree, &bufctl_t_compare)) != NULL) {
+	pcp = *(bufctl_t **)bcp;
+	*base = pcp->bc_buf;
+	size = pcp->bc_size;
+    }
+
+    PM_UNLOCK(pdubuf_lock);
+    return size;
+}
+
 /*
  * Used to pass context from __pmCountPDUBuf to the pdubufcount callback.
- * They are protected by the __pmLock_libpcp.
+ * They are protected by pdubuf_lock.
  */
 static int	pdu_bufcnt_need;
 static unsigned	pdu_bufcnt;
@@ -254,18 +759,63 @@ pdubufcount(const void *nodep, const VISIT which, const int depth)
 	    pdu_bufcnt++;
 }
 
+/*
+ * Count the buffers that could hold need bytes, in use (alloc) and
+ * free for reuse (free).
+ */
 void
 __pmCountPDUBuf(int need, int *alloc, int *free)
 {
     PM_INIT_LOCKS();
-    PM_LOCK(__pmLock_libpcp);
+    PM_LOCK(pdubuf_lock);
 
     pdu_bufcnt_need = need;
     pdu_bufcnt = 0;
     twalk(buf_tree, &pdubufcount);
     *alloc = pdu_bufcnt;
 
-    *free = 0;			/* We don't retain freed nodes. */
+    *free = 0;			/* We don't retain freed large buffers. */
+
+#ifdef PDUBUF_SLABS
+    {
+	magazine_t	*mp;
+	int		c;
+	int		cached;
+
+	for (c = 0; c < NCLASS; c++) {
+	    if (class_size(c) < need)
+		continue;
+	    cached = 0;
+	    for (mp = maglist; mp != NULL; mp = mp->next)
+		cached += mp->count[c];
+	    *alloc += sizeclass[c].nslab * class_nobj(c) - sizeclass[c].nfree - cached;
+	    *free += sizeclass[c].nfree + cached;
+	}
+    }
+#endif
 
-    PM_UNLOCK(__pmLock_libpcp);
+    PM_UNLOCK(pdubuf_lock);
+}
+
+void
+__pmGetPDUBufStats(__pmPDUBufStats *stats)
+{
+    PM_INIT_LOCKS();
+    memset(stats, 0, sizeof(*stats));
+    PM_LOCK(pdubuf_lock);
+#ifdef PDUBUF_SLABS
+    {
+	magazine_t	*mp;
+	int		c;
+
+	stats->hit = retired_hit;
+	for (mp = maglist; mp != NULL; mp = mp->next)
+	    stats->hit += mp->hit;
+	stats->miss = slab_miss;
+	for (c = 0; c < NCLASS; c++)
+	    stats->slabs += sizeclass[c].nslab;
+    }
+#endif
+    stats->large = large_alloc;
+    PM_UNLOCK(pdubuf_lock);
 }
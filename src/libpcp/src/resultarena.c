@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation; either version 2.1 of the License, or
+ * (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * Arena-backed pmResult construction.
+ *
+ * Building a pmResult the traditional way costs one malloc for the
+ * pmResult, one for each pmValueSet and one for each pmValueBlock, and
+ * the same number of free()s in pmFreeResult().  Here the pmValueSets
+ * and pmValueBlocks are staged in two buffers that the caller keeps
+ * from one result to the next, then copied (with the pmResult) into a
+ * single pinned PDU buffer laid out as
+ *
+ * :----------:---------------------:---------------------:
+ * : pmResult : ... pmValueSets ... : .. pmValueBlocks .. :
+ * :----------:---------------------:---------------------:
+ *
+ * so, once the staging buffers have grown to size, each result costs
+ * one allocation (usually from a per-thread cache in pdubuf.c) and one
+ * __pmUnpinPDUBuf() to release.
+ *
+ * Staged pmValueSets are addressed by their offset in ra_vs[] and the
+ * pval of a staged PM_VAL_DPTR value is its offset in ra_vb[], as both
+ * buffers may be moved by realloc() as they grow; these are turned
+ * into pointers by __pmArenaResult().
+ *
+ * Thread-safe notes
+ *
+ * No statics here, the caller provides the __pmResultArena and any
+ * locking needed to protect it.
+ */
+
+#include "pmapi.h"
+#include "impl.h"
+
+/* keep pmValueSets and pmValueBlocks aligned for 64-bit values */
+#define ARENA_ALIGN(x)	(((x) + (int)sizeof(__int64_t) - 1) & ~((int)sizeof(__int64_t) - 1))
+
+static int
+vset_size(int numval)
+{
+    /* numval < 0 is an error code, and no vlist[] is needed */
+    if (numval >= 1)
+	return (int)sizeof(pmValueSet) + (numval - 1) * (int)sizeof(pmValue);
+    return (int)sizeof(pmValueSet) - (int)sizeof(pmValue);
+}
+
+static int
+arena_grow(char **bufp, int *maxp, int need)
+{
+    int		max;
+    char	*buf;
+
+    if (need <= *maxp)
+	return 0;
+    max = *maxp > 0 ? *maxp : 1024;
+    while (max < need)
+	max *= 2;
+    if ((buf = (char *)realloc(*bufp, max)) == NULL)
+	return -oserror();
+    *bufp = buf;
+    *maxp = max;
+    return 0;
+}
+
+/*
+ * Start a new result, keeping the staging buffers.
+ */
+void
+__pmArenaReset(__pmResultArena *ap)
+{
+    ap->ra_numpmid = 0;
+    ap->ra_vslen = 0;
+    ap->ra_vblen = 0;
+}
+
+/*
+ * Add the next pmValueSet, with room for numval values (none if
+ * numval <= 0).  Returns NULL if there is no more memory.
+ */
+pmValueSet *
+__pmArenaValueSet(__pmResultArena *ap, pmID pmid, int numval)
+{
+    pmValueSet	*vsp;
+    int		size = ARENA_ALIGN(vset_size(numval));
+
+    if (ap->ra_numpmid >= ap->ra_maxpmid) {
+	int	max = ap->ra_maxpmid > 0 ? 2 * ap->ra_maxpmid : 16;
+	int	*off;
+
+	if ((off = (int *)realloc(ap->ra_vsoff, max * sizeof(int))) == NULL)
+	    return NULL;
+	ap->ra_vsoff = off;
+	ap->ra_maxpmid = max;
+    }
+    if (arena_grow(&ap->ra_vs, &ap->ra_vsmax, ap->ra_vslen + size) < 0)
+	return NULL;
+
+    vsp = (pmValueSet *)&ap->ra_vs[ap->ra_vslen];
+    ap->ra_vsoff[ap->ra_numpmid++] = ap->ra_vslen;
+    ap->ra_vslen += size;
+    vsp->pmid = pmid;
+    vsp->numval = numval;
+    vsp->valfmt = PM_VAL_INSITU;
+    return vsp;
+}
+
+/*
+ * Make room for numval values in the last pmValueSet added, keeping
+ * its contents.  Returns NULL if there is no more memory.
+ */
+pmValueSet *
+__pmArenaGrowValueSet(__pmResultArena *ap, int numval)
+{
+    int		off;
+
+    if (ap->ra_numpmid < 1)
+	return NULL;
+    off = ap->ra_vsoff[ap->ra_numpmid - 1];
+    if (arena_grow(&ap->ra_vs, &ap->ra_vsmax, off + ARENA_ALIGN(vset_size(numval))) < 0)
+	return NULL;
+    ap->ra_vslen = off + ARENA_ALIGN(vset_size(numval));
+    return (pmValueSet *)&ap->ra_vs[off];
+}
+
+/*
+ * Add space for a pmValueBlock of need bytes (vlen and vtype are set
+ * by the caller) as the value of vp, which must be in the last
+ * pmValueSet added.  Returns NULL if there is no more memory.
+ */
+pmValueBlock *
+__pmArenaValueBlock(__pmResultArena *ap, int need, pmValue *vp)
+{
+    pmValueBlock	*vbp;
+    int			size;
+
+    size = need < (int)sizeof(pmValueBlock) ? (int)sizeof(pmValueBlock) : need;
+    size = ARENA_ALIGN(size);
+    if (arena_grow(&ap->ra_vb, &ap->ra_vbmax, ap->ra_vblen + size) < 0)
+	return NULL;
+
+    vbp = (pmValueBlock *)&ap->ra_vb[ap->ra_vblen];
+    vp->value.pval = (pmValueBlock *)(__psint_t)ap->ra_vblen;
+    ap->ra_vblen += size;
+    return vbp;
+}
+
+/*
+ * Like __pmStuffValue(), but any pmValueBlock comes from the arena.
+ */
+int
+__pmArenaStuffValue(__pmResultArena *ap, const pmAtomValue *avp, pmValue *vp, int type)
+{
+    const void		*src;
+    int			body;
+    pmValueBlock	*vbp;
+
+    switch (type) {
+	case PM_TYPE_FLOAT:
+	    body = sizeof(float);
+	    src  = (const void *)&avp->f;
+	    break;
+
+	case PM_TYPE_64:
+	case PM_TYPE_U64:
+	case PM_TYPE_DOUBLE:
+	    body = sizeof(__int64_t);
+	    src  = (const void *)&avp->ull;
+	    break;
+
+	case PM_TYPE_AGGREGATE:
+	    body = avp->vbp->vlen - PM_VAL_HDR_SIZE;
+	    src  = (const void *)avp->vbp->vbuf;
+	    break;
+
+	case PM_TYPE_STRING:
+	    body = strlen(avp->cp) + 1;
+	    src  = (const void *)avp->cp;
+	    break;
+
+	default:
+	    /* insitu, static (PM_VAL_SPTR) or bad type, nothing to copy */
+	    return __pmStuffValue(avp, vp, type);
+    }
+    if ((vbp = __pmArenaValueBlock(ap, PM_VAL_HDR_SIZE + body, vp)) == NULL)
+	return -oserror();
+    vbp->vlen = PM_VAL_HDR_SIZE + body;
+    vbp->vtype = type;
+    memcpy((void *)vbp->vbuf, src, body);
+    return PM_VAL_DPTR;
+}
+
+/*
+ * Copy the staged pmValueSets and pmValueBlocks into a new pinned PDU
+ * buffer behind a pmResult (timestamp zeroed) and return that.
+ */
+int
+__pmArenaResult(__pmResultArena *ap, pmResult **result)
+{
+    int		hdr;
+    int		i, j;
+    char	*buf;
+    char	*vb;
+    pmResult	*rp;
+    pmValueSet	*vsp;
+
+    hdr = (int)sizeof(pmResult);
+    if (ap->ra_numpmid > 1)
+	hdr += (ap->ra_numpmid - 1) * (int)sizeof(pmValueSet *);
+    hdr = ARENA_ALIGN(hdr);
+    if ((buf = (char *)__pmFindPDUBuf(hdr + ap->ra_vslen + ap->ra_vblen)) == NULL)
+	return -oserror();
+
+    if (ap->ra_vslen)
+	memcpy(&buf[hdr], ap->ra_vs, ap->ra_vslen);
+    vb = &buf[hdr + ap->ra_vslen];
+    if (ap->ra_vblen)
+	memcpy(vb, ap->ra_vb, ap->ra_vblen);
+
+    rp = (pmResult *)buf;
+    rp->timestamp.tv_sec = 0;
+    rp->timestamp.tv_usec = 0;
+    rp->numpmid = ap->ra_numpmid;
+    for (i = 0; i < ap->ra_numpmid; i++) {
+	rp->vset[i] = vsp = (pmValueSet *)&buf[hdr + ap->ra_vsoff[i]];
+	if (vsp->numval <= 0 || vsp->valfmt != PM_VAL_DPTR)
+	    continue;
+	for (j = 0; j < vsp->numval; j++)
+	    vsp->vlist[j].value.pval = (pmValueBlock *)&vb[(__psint_t)vsp->vlist[j].value.pval];
+    }
+
+    if (pmDebug & DBG_TRACE_PDUBUF)
+	fprintf(stderr, "__pmArenaResult(" PRINTF_P_PFX "%p) numpmid=%d size=%d\n",
+	    rp, rp->numpmid, hdr + ap->ra_vslen + ap->ra_vblen);
+    *result = rp;
+    return 0;
+}
+
+/*
+ * Release the staging buffers.
+ */
+void
+__pmArenaFree(__pmResultArena *ap)
+{
+    free(ap->ra_vsoff);
+    free(ap->ra_vs);
+    free(ap->ra_vb);
+    memset(ap, 0, sizeof(*ap));
+}
@@ -16,6 +16,7 @@
  */
 #include "pmapi.h"
 #include <sys/stat.h>
+#include <sched.h>
 #include "mmv_stats.h"
 #include "mmv_dev.h"
 #include "impl.h"
@@ -62,6 +63,17 @@ mmv_singular(__int32_t indom)
     return (indom == 0 || indom == PM_INDOM_NULL);
 }
 
+/* counters of numeric type can be split into per-thread shards */
+static int
+mmv_shardable(mmv_metric_type_t type, mmv_metric_sem_t sem)
+{
+    if (sem != MMV_SEM_COUNTER && sem != 0)
+	return 0;
+    return (type == MMV_TYPE_I32 || type == MMV_TYPE_U32 ||
+	    type == MMV_TYPE_I64 || type == MMV_TYPE_U64 ||
+	    type == MMV_TYPE_FLOAT || type == MMV_TYPE_DOUBLE);
+}
+
 static mmv_disk_indom_t *
 mmv_lookup_disk_indom(__int32_t indom, mmv_disk_indom_t *in, int nindoms)
 {
@@ -96,6 +108,190 @@ mmv_generation(void)
     return (((__uint64_t)gen1 << 32) | (__uint64_t)gen2);
 }
 
+/*
+ * Name-keyed index of the values in a mapping, so mmv_lookup_value_desc()
+ * does not compare names against every value in the file.  An index is
+ * built when the mapping is created and rebuilt if the generation number
+ * in the header no longer matches, it is immutable once built.
+ */
+typedef struct mmv_index {
+    struct mmv_index *	next;
+    void *		addr;		/* mapping start */
+    __uint64_t		gen;		/* generation indexed */
+    __pmHashCtl		metrics;	/* name -> mmv_disk_metric_t */
+    __pmHashCtl		values;		/* metric,instance -> mmv_disk_value_t */
+} mmv_index_t;
+
+static mmv_index_t *indexes;
+
+#ifdef PM_MULTI_THREAD
+static pthread_mutex_t	index_lock = PTHREAD_MUTEX_INITIALIZER;
+#define INDEX_LOCK	pthread_mutex_lock(&index_lock)
+#define INDEX_UNLOCK	pthread_mutex_unlock(&index_lock)
+#else
+#define INDEX_LOCK
+#define INDEX_UNLOCK
+#endif
+
+static unsigned int
+mmv_hash_string(unsigned int h, const char *p)
+{
+    /* FNV-1a */
+    while (*p)
+	h = (h ^ (unsigned char)*p++) * 16777619U;
+    return h;
+}
+
+static unsigned int
+mmv_hash_value(__uint64_t metric, const char *inst)
+{
+    unsigned int h = 2166136261U ^ (unsigned int)(metric ^ (metric >> 32));
+
+    return inst ? mmv_hash_string(h, inst) : h;
+}
+
+static __pmHashWalkState
+mmv_index_free_node(const __pmHashNode *hp, void *cdata)
+{
+    (void)hp;
+    (void)cdata;
+    return PM_HASH_WALK_DELETE_NEXT;
+}
+
+static void
+mmv_index_clear(mmv_index_t *ip)
+{
+    __pmHashWalkCB(mmv_index_free_node, NULL, &ip->metrics);
+    __pmHashClear(&ip->metrics);
+    __pmHashInit(&ip->metrics);
+    __pmHashWalkCB(mmv_index_free_node, NULL, &ip->values);
+    __pmHashClear(&ip->values);
+    __pmHashInit(&ip->values);
+}
+
+static mmv_disk_metric_t *
+mmv_index_metric(mmv_index_t *ip, const char *name)
+{
+    unsigned int key = mmv_hash_string(2166136261U, name);
+    __pmHashNode *hp;
+
+    for (hp = __pmHashSearch(key, &ip->metrics); hp != NULL; hp = hp->next) {
+	mmv_disk_metric_t *m = (mmv_disk_metric_t *)hp->data;
+	if (hp->key == key && strcmp(m->name, name) == 0)
+	    return m;
+    }
+    return NULL;
+}
+
+static mmv_disk_value_t *
+mmv_index_value(mmv_index_t *ip, __uint64_t metric, const char *inst)
+{
+    unsigned int key = mmv_hash_value(metric, inst);
+    __pmHashNode *hp;
+
+    for (hp = __pmHashSearch(key, &ip->values); hp != NULL; hp = hp->next) {
+	mmv_disk_value_t *v = (mmv_disk_value_t *)hp->data;
+	if (hp->key != key || v->metric != metric)
+	    continue;
+	if (inst == NULL)
+	    return v;
+	if (strcmp(((mmv_disk_instance_t *)
+		((char *)ip->addr + v->instance))->external, inst) == 0)
+	    return v;
+    }
+    return NULL;
+}
+
+/* (re)build the index from the values section, first name match wins */
+static int
+mmv_index_build(mmv_index_t *ip)
+{
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)ip->addr;
+    mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
+			((char *)ip->addr + sizeof(mmv_disk_header_t));
+    mmv_disk_value_t *v;
+    mmv_disk_metric_t *m;
+    const char *inst;
+    int i, j, sts;
+
+    mmv_index_clear(ip);
+    ip->gen = hdr->g1;
+
+    for (i = 0; i < hdr->tocs; i++) {
+	if (toc[i].type != MMV_TOC_VALUES)
+	    continue;
+	v = (mmv_disk_value_t *)((char *)ip->addr + toc[i].offset);
+	for (j = 0; j < toc[i].count; j++) {
+	    m = (mmv_disk_metric_t *)((char *)ip->addr + v[j].metric);
+	    if (mmv_index_metric(ip, m->name) == NULL) {
+		sts = __pmHashAdd(mmv_hash_string(2166136261U, m->name),
+				m, &ip->metrics);
+		if (sts < 0)
+		    return sts;
+	    }
+	    if (mmv_singular(m->indom))
+		inst = NULL;
+	    else
+		inst = ((mmv_disk_instance_t *)
+			((char *)ip->addr + v[j].instance))->external;
+	    if (mmv_index_value(ip, v[j].metric, inst) == NULL) {
+		sts = __pmHashAdd(mmv_hash_value(v[j].metric, inst),
+				&v[j], &ip->values);
+		if (sts < 0)
+		    return sts;
+	    }
+	}
+    }
+    return 0;
+}
+
+/* find the index for a mapping, building it if needed */
+static mmv_index_t *
+mmv_index_lookup(void *addr)
+{
+    mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
+    mmv_index_t *ip;
+
+    INDEX_LOCK;
+    for (ip = indexes; ip != NULL; ip = ip->next)
+	if (ip->addr == addr)
+	    break;
+    if (ip == NULL) {
+	if ((ip = (mmv_index_t *)calloc(1, sizeof(mmv_index_t))) == NULL)
+	    goto done;
+	ip->addr = addr;
+	ip->next = indexes;
+	indexes = ip;
+    }
+    if (ip->gen != hdr->g1) {
+	if (mmv_index_build(ip) < 0) {
+	    mmv_index_clear(ip);
+	    ip->gen = 0;
+	    ip = NULL;
+	}
+    }
+done:
+    INDEX_UNLOCK;
+    return ip;
+}
+
+static void
+mmv_index_drop(void *addr)
+{
+    mmv_index_t *ip, **ipp;
+
+    INDEX_LOCK;
+    for (ipp = &indexes; (ip = *ipp) != NULL; ipp = &ip->next) {
+	if (ip->addr == addr) {
+	    *ipp = ip->next;
+	    mmv_index_clear(ip);
+	    free(ip);
+	    break;
+	}
+    }
+    INDEX_UNLOCK;
+}
+
 void * 
 mmv_stats_init(const char *fname,
 		int cluster, mmv_stats_flags_t fl,
@@ -114,12 +310,18 @@ mmv_stats_init(const char *fname,
     __uint64_t metrics_offset;		/* anchor start of metrics section */
     __uint64_t values_offset;		/* anchor start of values section */
     __uint64_t strings_offset;		/* anchor start of any/all strings */
+    __uint64_t shards_offset;		/* anchor start of counter shards */
+    __uint64_t histograms_offset;	/* anchor start of histograms */
+    mmv_disk_histogram_t *hlist;
+    mmv_disk_shard_t *shlist;
     void *addr;
     size_t size;
     int i, j, k, tocidx, stridx;
     int ninstances = 0;
     int nstrings = 0;
     int nvalues = 0;
+    int nsharded = 0;
+    int nhists = 0;
 
     for (i = 0; i < nindoms; i++) {
 	if (mmv_singular(in[i].serial)) {
@@ -135,7 +337,7 @@ mmv_stats_init(const char *fname,
 
     for (i = 0; i < nmetrics; i++) {
 	if ((st[i].type < MMV_TYPE_NOSUPPORT) || 
-	    (st[i].type > MMV_TYPE_ELAPSED) || strlen(st[i].name) == 0) {
+	    (st[i].type > MMV_TYPE_HISTOGRAM) || strlen(st[i].name) == 0) {
 	    setoserror(EINVAL);
 	    return NULL;
 	}
@@ -154,10 +356,18 @@ mmv_stats_init(const char *fname,
 	    }
 	    if (st[i].type == MMV_TYPE_STRING)
 		nstrings += mi->count;
+	    if ((fl & MMV_FLAG_SHARDED) && mmv_shardable(st[i].type, st[i].semantics))
+		nsharded += mi->count;
+	    if (st[i].type == MMV_TYPE_HISTOGRAM)
+		nhists += mi->count;
 	    nvalues += mi->count;
 	} else {
 	    if (st[i].type == MMV_TYPE_STRING)
 		nstrings++;
+	    if ((fl & MMV_FLAG_SHARDED) && mmv_shardable(st[i].type, st[i].semantics))
+		nsharded++;
+	    if (st[i].type == MMV_TYPE_HISTOGRAM)
+		nhists++;
 	    nvalues++;
 	}
     }
@@ -169,6 +379,10 @@ mmv_stats_init(const char *fname,
 	size += sizeof(mmv_disk_toc_t) * 2;
     if (nstrings)
 	size += sizeof(mmv_disk_toc_t) * 1;
+    if (nsharded)
+	size += sizeof(mmv_disk_toc_t) * 1;
+    if (nhists)
+	size += sizeof(mmv_disk_toc_t) * 1;
     indoms_offset = sizeof(mmv_disk_header_t) + size;
 
     /* Following the indom definitions are the actual instances */
@@ -188,8 +402,18 @@ mmv_stats_init(const char *fname,
     size = nvalues * sizeof(mmv_disk_value_t);
     strings_offset = values_offset + size;
 
-    /* End of file follows all of the actual strings */
+    /* Following the strings are the shards, each in its own cache line */
     size = strings_offset + nstrings * sizeof(mmv_disk_string_t);
+    shards_offset = (size + MMV_CACHELINE - 1) & ~(MMV_CACHELINE - 1);
+
+    /* Following the shards are the histograms, also cache line aligned */
+    if (nsharded)
+	size = shards_offset + nsharded * MMV_SHARDS * sizeof(mmv_disk_shard_t);
+    histograms_offset = (size + MMV_CACHELINE - 1) & ~(MMV_CACHELINE - 1);
+
+    /* End of file follows all of the histograms */
+    if (nhists)
+	size = histograms_offset + nhists * sizeof(mmv_disk_histogram_t);
 
     if ((addr = mmv_mapping_init(fname, size)) == NULL)
 	return NULL;
@@ -207,7 +431,7 @@ mmv_stats_init(const char *fname,
 
     hdr = (mmv_disk_header_t *) addr;
     strncpy(hdr->magic, "MMV", 4);
-    hdr->version = MMV_VERSION;
+    hdr->version = nhists ? 3 : nsharded ? 2 : 1;
     hdr->g1 = mmv_generation();
     hdr->g2 = 0;
     hdr->tocs = 2;
@@ -215,6 +439,10 @@ mmv_stats_init(const char *fname,
 	hdr->tocs += 2;
     if (nstrings)
 	hdr->tocs += 1;
+    if (nsharded)
+	hdr->tocs += 1;
+    if (nhists)
+	hdr->tocs += 1;
     hdr->flags = fl;
     hdr->cluster = cluster;
     hdr->process = (__int32_t)getpid();
@@ -246,6 +474,18 @@ mmv_stats_init(const char *fname,
 	toc[tocidx].offset = strings_offset;
 	tocidx++;
     }
+    if (nsharded) {
+	toc[tocidx].type = MMV_TOC_SHARDS;
+	toc[tocidx].count = nsharded * MMV_SHARDS;
+	toc[tocidx].offset = shards_offset;
+	tocidx++;
+    }
+    if (nhists) {
+	toc[tocidx].type = MMV_TOC_HISTOGRAMS;
+	toc[tocidx].count = nhists;
+	toc[tocidx].offset = histograms_offset;
+	tocidx++;
+    }
 
     /* Indom section */
     domlist = (mmv_disk_indom_t *)((char *)addr + indoms_offset);
@@ -284,7 +524,7 @@ mmv_stats_init(const char *fname,
 	mlist[i].semantics = st[i].semantics;
 	mlist[i].shorttext = 0;		/* filled in later */
 	mlist[i].helptext = 0;		/* filled in later */
-	mlist[i].padding = 0;
+	mlist[i].sequence = 0;
     }
 
     /* Values section */
@@ -311,6 +551,28 @@ mmv_stats_init(const char *fname,
 	}
     }
 
+    /* Shards section, already zeroed by ftruncate */
+    shlist = (mmv_disk_shard_t *)((char *)addr + shards_offset);
+    for (i = 0; nsharded && i < nvalues; i++) {
+	mmv_disk_metric_t * metric = (mmv_disk_metric_t *)
+			((char *)addr + vlist[i].metric);
+	if (mmv_shardable(metric->type, metric->semantics)) {
+	    vlist[i].extra = (char *)shlist - (char *)addr;
+	    shlist += MMV_SHARDS;
+	}
+    }
+
+    /* Histograms section, also zeroed by ftruncate */
+    hlist = (mmv_disk_histogram_t *)((char *)addr + histograms_offset);
+    for (i = 0; nhists && i < nvalues; i++) {
+	mmv_disk_metric_t * metric = (mmv_disk_metric_t *)
+			((char *)addr + vlist[i].metric);
+	if (metric->type == MMV_TYPE_HISTOGRAM) {
+	    vlist[i].extra = (char *)hlist - (char *)addr;
+	    hlist++;
+	}
+    }
+
     /* Strings section */
     slist = (mmv_disk_string_t *)((char *)addr + strings_offset);
     stridx = 0;
@@ -363,6 +625,10 @@ mmv_stats_init(const char *fname,
     /* Complete - unlock the header, PMDA can read now */
     hdr->g2 = hdr->g1;
 
+    /* index the new values for mmv_lookup_value_desc() */
+    mmv_index_drop(addr);
+    mmv_index_lookup(addr);
+
     return addr;
 }
 
@@ -373,6 +639,7 @@ mmv_stats_stop(const char *fname, void *addr)
     char path[MAXPATHLEN];
     struct stat sbuf;
 
+    mmv_index_drop(addr);
     mmv_stats_path(fname, path, sizeof(path));
     if (stat(path, &sbuf) < 0)
 	sbuf.st_size = (size_t)-1;
@@ -385,47 +652,160 @@ pmAtomValue *
 mmv_lookup_value_desc(void *addr, const char *metric, const char *inst)
 {
     if (addr != NULL && metric != NULL) {
-	int i;
-	mmv_disk_header_t *hdr = (mmv_disk_header_t *)addr;
-	mmv_disk_toc_t *toc = (mmv_disk_toc_t *)
-			((char *)addr + sizeof(mmv_disk_header_t));
-
-	for (i = 0; i < hdr->tocs; i++) {
-	    if (toc[i].type == MMV_TOC_VALUES) {
-		int j;
-		mmv_disk_value_t *v = (mmv_disk_value_t *)
-				((char *)addr + toc[i].offset);
-
-		for (j = 0; j < toc[i].count; j++) {
-		    mmv_disk_metric_t *m = (mmv_disk_metric_t *)
-					((char *)addr + v[j].metric);
-		    if (strcmp(m->name, metric) == 0) {
-			if (mmv_singular(m->indom)) {  /* Singular metric */
-			    return &v[j].value;
- 			} else {
-			    if (inst == NULL) {
-				/* Metric has multiple instances, but
-				 * we don't know which one to return,
-				 * so return an error
-				 */
-				return NULL;
-			    } else {
-				mmv_disk_instance_t * in = 
-				    (mmv_disk_instance_t *)
-					((char *)addr + v[j].instance);
-				if (strcmp(in->external, inst) == 0)
-				    return &v[j].value;
-			    }
-			}
-		    }
-		}
-	    }
-	}
+	mmv_index_t *ip;
+	mmv_disk_metric_t *m;
+	mmv_disk_value_t *v;
+
+	if ((ip = mmv_index_lookup(addr)) == NULL)
+	    return NULL;
+	if ((m = mmv_index_metric(ip, metric)) == NULL)
+	    return NULL;
+	if (mmv_singular(m->indom))	/* Singular metric */
+	    inst = NULL;
+	else if (inst == NULL)
+	    /* Metric has multiple instances, but we don't know
+	     * which one to return, so return an error
+	     */
+	    return NULL;
+	v = mmv_index_value(ip, (char *)m - (char *)addr, inst);
+	if (v != NULL)
+	    return &v->value;
     }
 
     return NULL;
 }
 
+/*
+ * Values are updated in place in the shared mapping, possibly by many
+ * threads at once: integers with relaxed atomic adds and stores, floating
+ * point with compare-and-swap loops.  Strings and elapsed times span more
+ * than one word, so they are written under a seqlock in the metric desc,
+ * and the PMDA retries a read that overlapped a write.
+ */
+static void
+mmv_atomic_add(mmv_metric_type_t type, pmAtomValue *a, double inc)
+{
+    switch (type) {
+    case MMV_TYPE_I32:
+	__atomic_fetch_add(&a->l, (__int32_t)inc, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_U32:
+	__atomic_fetch_add(&a->ul, (__uint32_t)inc, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_I64:
+	__atomic_fetch_add(&a->ll, (__int64_t)inc, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_U64:
+	__atomic_fetch_add(&a->ull, (__uint64_t)inc, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_FLOAT: {
+	float old, new;
+
+	__atomic_load(&a->f, &old, __ATOMIC_RELAXED);
+	do {
+	    new = old + (float)inc;
+	} while (!__atomic_compare_exchange(&a->f, &old, &new, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	break;
+    }
+    case MMV_TYPE_DOUBLE: {
+	double old, new;
+
+	__atomic_load(&a->d, &old, __ATOMIC_RELAXED);
+	do {
+	    new = old + inc;
+	} while (!__atomic_compare_exchange(&a->d, &old, &new, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	break;
+    }
+    default:
+	break;
+    }
+}
+
+static void
+mmv_atomic_set(mmv_metric_type_t type, pmAtomValue *a, double val)
+{
+    switch (type) {
+    case MMV_TYPE_I32:
+	__atomic_store_n(&a->l, (__int32_t)val, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_U32:
+	__atomic_store_n(&a->ul, (__uint32_t)val, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_I64:
+	__atomic_store_n(&a->ll, (__int64_t)val, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_U64:
+	__atomic_store_n(&a->ull, (__uint64_t)val, __ATOMIC_RELAXED);
+	break;
+    case MMV_TYPE_FLOAT: {
+	float f = (float)val;
+	__atomic_store(&a->f, &f, __ATOMIC_RELAXED);
+	break;
+    }
+    case MMV_TYPE_DOUBLE:
+	__atomic_store(&a->d, &val, __ATOMIC_RELAXED);
+	break;
+    default:
+	break;
+    }
+}
+
+/*
+ * An odd sequence number marks a write in progress, and locks out
+ * writers.  The lock is only held across a short copy, so spin for it,
+ * yielding now and then - however long its holder is descheduled for.
+ * The lock is never taken over: a second writer would tear the value
+ * and leave the sequence odd for good.  Readers give up on a holder
+ * that never finishes (see the mmv PMDA), and a writer can only wait
+ * forever if it interrupted its own write from a signal handler (not
+ * allowed, see mmv_inc_value(3)) or its holder was killed mid-write.
+ */
+static void
+mmv_write_begin(mmv_disk_metric_t *m)
+{
+    __uint32_t seq;
+    int spins;
+
+    for (spins = 1; ; spins++) {
+	seq = __atomic_load_n(&m->sequence, __ATOMIC_ACQUIRE);
+	if (!(seq & 1) &&
+	    __atomic_compare_exchange_n(&m->sequence, &seq, seq + 1, 1,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	    break;
+	if (spins % 100 == 0)
+	    sched_yield();
+    }
+}
+
+static void
+mmv_write_end(mmv_disk_metric_t *m)
+{
+    __atomic_fetch_add(&m->sequence, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Each thread updates its own shard of a sharded counter, chosen round
+ * robin when the thread first updates one.
+ */
+#if defined(PM_MULTI_THREAD) && defined(HAVE___THREAD)
+static __thread int	shard = -1;
+#else
+static int		shard = -1;
+#endif
+static unsigned int	nextshard;
+
+static pmAtomValue *
+mmv_shard_value(void *addr, mmv_disk_value_t *v)
+{
+    mmv_disk_shard_t *shards = (mmv_disk_shard_t *)((char *)addr + v->extra);
+
+    if (shard < 0)
+	shard = __atomic_fetch_add(&nextshard, 1, __ATOMIC_RELAXED) % MMV_SHARDS;
+    return &shards[shard].value;
+}
+
 void
 mmv_inc_value(void *addr, pmAtomValue *av, double inc)
 {
@@ -435,30 +815,24 @@ mmv_inc_value(void *addr, pmAtomValue *av, double inc)
 					((char *)addr + v->metric);
 	switch (m->type) {
 	case MMV_TYPE_I32:
-	    v->value.l += (__int32_t)inc;
-	    break;
 	case MMV_TYPE_U32:
-	    v->value.ul += (__uint32_t)inc;
-	    break;
 	case MMV_TYPE_I64:
-	    v->value.ll += (__int64_t)inc;
-	    break;
 	case MMV_TYPE_U64:
-	    v->value.ull += (__uint64_t)inc;
-	    break;
 	case MMV_TYPE_FLOAT:
-	    v->value.f += (float)inc;
-	    break;
 	case MMV_TYPE_DOUBLE:
-	    v->value.d += inc;
+	    if (v->extra)	/* sharded counter */
+		av = mmv_shard_value(addr, v);
+	    mmv_atomic_add(m->type, av, inc);
 	    break;
 	case MMV_TYPE_ELAPSED:
+	    mmv_write_begin(m);
 	    if (inc < 0)
 		v->extra = (__int64_t)inc;
 	    else {
 		v->value.ll += v->extra + (__int64_t)inc;
 		v->extra = 0;
 	    }
+	    mmv_write_end(m);
 	    break;
 	default:
 	    break;
@@ -473,28 +847,29 @@ mmv_set_value(void *addr, pmAtomValue *av, double val)
 	mmv_disk_value_t * v = (mmv_disk_value_t *) av;
 	mmv_disk_metric_t * m = (mmv_disk_metric_t *)
 					((char *)addr + v->metric);
+	mmv_disk_shard_t * shards;
+	int i;
+
 	switch (m->type) {
 	case MMV_TYPE_I32:
-	    v->value.l = (__int32_t)val;
-	    break;
 	case MMV_TYPE_U32:
-	    v->value.ul = (__uint32_t)val;
-	    break;
 	case MMV_TYPE_I64:
-	    v->value.ll = (__int64_t)val;
-	    break;
 	case MMV_TYPE_U64:
-	    v->value.ull = (__uint64_t)val;
-	    break;
 	case MMV_TYPE_FLOAT:
-	    v->value.f = (float)val;
-	    break;
 	case MMV_TYPE_DOUBLE:
-	    v->value.d = val;
+	    if (v->extra) {	/* sharded counter, not atomic over shards */
+		shards = (mmv_disk_shard_t *)((char *)addr + v->extra);
+		for (i = 1; i < MMV_SHARDS; i++)
+		    mmv_atomic_set(m->type, &shards[i].value, 0);
+		av = &shards[0].value;
+	    }
+	    mmv_atomic_set(m->type, av, val);
 	    break;
 	case MMV_TYPE_ELAPSED:
+	    mmv_write_begin(m);
 	    v->value.ll = (__int64_t)val;
 	    v->extra = 0;
+	    mmv_write_end(m);
 	    break;
 	default:
 	    break;
@@ -516,13 +891,56 @@ mmv_set_string(void *addr, pmAtomValue *av, const char *string, int size)
 	    mmv_disk_string_t * s;
 
 	    s = (mmv_disk_string_t *)((char *)addr + soffset);
+	    mmv_write_begin(m);
 	    strncpy(s->payload, string, size);
 	    s->payload[size] = '\0';
 	    v->value.l = size;
+	    mmv_write_end(m);
 	}
     }
 }
 
+/*
+ * Histogram values are recorded with three relaxed atomic adds, so the
+ * PMDA may see count, sum and buckets that disagree by the values being
+ * recorded at the time of a fetch, but never loses a recorded value.
+ */
+static unsigned int
+mmv_hist_bucket(__uint64_t value)
+{
+    unsigned int shift;
+
+    if (value < MMV_HIST_SUB)
+	return (unsigned int)value;
+    shift = 63 - __builtin_clzll(value) - MMV_HIST_SUBBITS;
+    return (shift + 1) * MMV_HIST_SUB + (value >> shift) - MMV_HIST_SUB;
+}
+
+void
+mmv_record_value(void *addr, pmAtomValue *av, double val)
+{
+    if (av != NULL && addr != NULL) {
+	mmv_disk_value_t * v = (mmv_disk_value_t *) av;
+	mmv_disk_metric_t * m = (mmv_disk_metric_t *)
+					((char *)addr + v->metric);
+	mmv_disk_histogram_t * h;
+	__uint64_t value;
+
+	if (m->type != MMV_TYPE_HISTOGRAM || v->extra == 0)
+	    return;
+	h = (mmv_disk_histogram_t *)((char *)addr + v->extra);
+	if (val <= 0)
+	    value = 0;
+	else if (val >= 18446744073709551615.0)
+	    value = ~(__uint64_t)0;
+	else
+	    value = (__uint64_t)val;
+	__atomic_fetch_add(&h->buckets[mmv_hist_bucket(value)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, value, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+    }
+}
+
 /*
  * Simple wrapper routines
  */
@@ -557,6 +975,18 @@ mmv_stats_set(void *addr,
     }
 }
 
+void
+mmv_stats_record(void *addr,
+	const char *metric, const char *instance, double value)
+{
+    if (addr) {
+	pmAtomValue * mmv_metric;
+	mmv_metric = mmv_lookup_value_desc(addr, metric, instance);
+	if (mmv_metric)
+	    mmv_record_value(addr, mmv_metric, value);
+    }
+}
+
 void
 mmv_stats_add_fallback(void *addr, const char *metric,
 	const char *instance, const char *instance2, double count)
@@ -23,6 +23,7 @@
 PMCD_DATA int	pmcd_hi_openfds = -1;   /* Highest open pmcd file descriptor */
 PMCD_DATA int	_pmcd_done;		/* flag from pmcd pmda */
 PMCD_DATA int	_pmcd_timeout = 5;	/* Timeout for hung agents */
+PMCD_DATA int	_pmcd_coalesce = 50;	/* Window for shared agent fetches */
 
 PMCD_DATA int	nAgents;		/* Number of active agents */
 PMCD_DATA AgentInfo *agent;		/* Array of agent info structs */
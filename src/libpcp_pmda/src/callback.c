@@ -435,8 +435,284 @@ pmdaInstance(pmInDom indom, int inst, char *name, __pmInResult **result, pmdaExt
 }
 
 /*
- * resize the pmResult and call the e_callback for each metric instance
- * required in the profile.
+ * Handle the return code and value from a fetch callback for one
+ * metric-instance pair, and if there is a value copy it into *vp
+ * (setting *valfmt) then release the callback's buffer for
+ * PMDA_FETCH_DYNAMIC.
+ * Returns 1 if a value was copied, 0 for no value, else an error code.
+ */
+static int
+__pmdaFetchValue(e_ext_t *extp, pmDesc *dp, int inst, int sts,
+		 pmAtomValue *atom, pmValue *vp, int *valfmt)
+{
+    int		type = dp->type;
+    int		lsts;
+
+    if (sts < 0) {
+	char	strbuf[20];
+
+	pmIDStr_r(dp->pmid, strbuf, sizeof(strbuf));
+	if (sts == PM_ERR_PMID) {
+	    __pmNotifyErr(LOG_ERR, 
+		"pmdaFetch: PMID %s not handled by fetch callback\n",
+			strbuf);
+	}
+	else if (sts == PM_ERR_INST) {
+#ifdef PCP_DEBUG
+	    if (pmDebug & DBG_TRACE_LIBPMDA) {
+		__pmNotifyErr(LOG_ERR,
+		    "pmdaFetch: Instance %d of PMID %s not handled by fetch callback\n",
+			    inst, strbuf);
+	    }
+#endif
+	}
+	else if (sts == PM_ERR_APPVERSION ||
+		 sts == PM_ERR_PERMISSION ||
+		 sts == PM_ERR_AGAIN ||
+		 sts == PM_ERR_NYI) {
+#ifdef PCP_DEBUG
+	    if (pmDebug & DBG_TRACE_LIBPMDA) {
+		__pmNotifyErr(LOG_ERR,
+		     "pmdaFetch: Unavailable metric PMID %s[%d]\n",
+			    strbuf, inst);
+	    }
+#endif
+	}
+	else {
+	    __pmNotifyErr(LOG_ERR,
+		"pmdaFetch: Fetch callback error from metric PMID %s[%d]: %s\n",
+			strbuf, inst, pmErrStr(sts));
+	}
+	return sts;
+    }
+
+    /*
+     * PMDA_INTERFACE_2
+     *	>= 0 => OK
+     * PMDA_INTERFACE_3 or PMDA_INTERFACE_4
+     *	== 0 => no values
+     *	> 0  => OK
+     * PMDA_INTERFACE_5 or later
+     *	== 0 (PMDA_FETCH_NOVALUES) => no values
+     *	== 1 (PMDA_FETCH_STATIC) or > 2 => OK
+     *	== 2 (PMDA_FETCH_DYNAMIC) => OK and free(atom.vp)
+     *	     after __pmArenaStuffValue() called
+     */
+    if (extp->dispatch->comm.pmda_interface != PMDA_INTERFACE_2 && sts == 0)
+	return 0;
+
+    if ((lsts = __pmArenaStuffValue(&extp->arena, atom, vp, type)) == PM_ERR_TYPE) {
+	char	strbuf[20];
+	char	st2buf[20];
+	__pmNotifyErr(LOG_ERR, 
+		     "pmdaFetch: Descriptor type (%s) for metric %s is bad",
+		     pmTypeStr_r(type, strbuf, sizeof(strbuf)),
+		     pmIDStr_r(dp->pmid, st2buf, sizeof(st2buf)));
+    }
+    else if (lsts >= 0)
+	*valfmt = lsts;
+    if (extp->dispatch->comm.pmda_interface >= PMDA_INTERFACE_5 && sts == PMDA_FETCH_DYNAMIC) {
+	if (type == PM_TYPE_STRING)
+	    free(atom->cp);
+	else if (type == PM_TYPE_AGGREGATE)
+	    free(atom->vbp);
+	else {
+	    char	strbuf[20];
+	    char	st2buf[20];
+	    __pmNotifyErr(LOG_WARNING,
+			  "pmdaFetch: Attempt to free value for metric %s of wrong type %s\n",
+			  pmIDStr_r(dp->pmid, strbuf, sizeof(strbuf)),
+			  pmTypeStr_r(type, st2buf, sizeof(st2buf)));
+	}
+    }
+    return lsts < 0 ? lsts : 1;
+}
+
+static int
+__pmdaInstCmp(const void *a, const void *b)
+{
+    int		ia = *(const int *)a;
+    int		ib = *(const int *)b;
+
+    return ia < ib ? -1 : (ia > ib);
+}
+
+/*
+ * Build extp->colinst[] as the instances of indom selected by the
+ * profile, in the same order as __pmdaStartInst and __pmdaNextInst
+ * would return them.  The profile entry for the indom is found once,
+ * not once per instance, and any explicit instance list in the profile
+ * is searched with bsearch(3) rather than linearly.
+ */
+static int
+__pmdaProfileInst(pmInDom indom, pmdaExt *pmda, e_ext_t *extp)
+{
+    __pmInDomProfile	*prof = NULL;
+    pmdaIndom		*idp = NULL;
+    int			dflt;		/* =1 include unlisted instances */
+    int			cache;
+    int			inst;
+    int			need;
+    int			i, n = 0;
+
+    if (pmda->e_prof == NULL)
+	dflt = 1;
+    else if ((prof = __pmFindProfile(indom, pmda->e_prof)) == NULL)
+	dflt = (pmda->e_prof->state == PM_PROFILE_INCLUDE);
+    else {
+	dflt = (prof->state == PM_PROFILE_INCLUDE);
+	if (prof->instances_len == 0)
+	    prof = NULL;
+    }
+    extp->colindom = indom;
+    extp->colnuminst = 0;
+    if (prof == NULL && dflt == 0)
+	return 0;
+
+    if (prof != NULL) {
+	if (prof->instances_len > extp->colmaxprof) {
+	    need = prof->instances_len * sizeof(int);
+	    if ((extp->colprof = (int *)realloc(extp->colprof, need)) == NULL) {
+		extp->colmaxprof = 0;
+		return -oserror();
+	    }
+	    extp->colmaxprof = prof->instances_len;
+	}
+	memcpy(extp->colprof, prof->instances, prof->instances_len * sizeof(int));
+	qsort(extp->colprof, prof->instances_len, sizeof(int), __pmdaInstCmp);
+    }
+
+    if ((cache = pmdaCacheOp(indom, PMDA_CACHE_CHECK)) != 0) {
+	need = pmdaCacheOp(indom, PMDA_CACHE_SIZE_ACTIVE);
+	pmdaCacheOp(indom, PMDA_CACHE_WALK_REWIND);
+    }
+    else {
+	for (i = 0; i < pmda->e_nindoms; i++) {
+	    if (pmda->e_indoms[i].it_indom == indom) {
+		idp = &pmda->e_indoms[i];
+		break;
+	    }
+	}
+	need = idp == NULL ? 0 : idp->it_numinst;
+    }
+
+    for (i = 0; ; i++) {
+	if (cache) {
+	    if ((inst = pmdaCacheOp(indom, PMDA_CACHE_WALK_NEXT)) == -1)
+		break;
+	}
+	else {
+	    if (i >= need)
+		break;
+	    inst = idp->it_set[i].i_inst;
+	}
+	if (prof != NULL &&
+	    bsearch(&inst, extp->colprof, prof->instances_len, sizeof(int), __pmdaInstCmp) != NULL) {
+	    /* present in the list => inverse of default for this indom */
+	    if (dflt)
+		continue;
+	}
+	else if (!dflt)
+	    continue;
+	if (n >= extp->colmaxinst) {
+	    int		max = need > n ? need : 2 * n + 4;
+
+	    if ((extp->colinst = (int *)realloc(extp->colinst, max * sizeof(int))) == NULL) {
+		extp->colmaxinst = 0;
+		return -oserror();
+	    }
+	    extp->colmaxinst = max;
+	}
+	extp->colinst[n++] = inst;
+    }
+    extp->colnuminst = n;
+
+#ifdef PCP_DEBUG
+    if (pmDebug & DBG_TRACE_INDOM) {
+	char	strbuf[20];
+	fprintf(stderr, "__pmdaProfileInst(indom=%s) -> %d of %d\n",
+	    pmInDomStr_r(indom, strbuf, sizeof(strbuf)), n, i);
+    }
+#endif
+    return n;
+}
+
+/*
+ * Add the pmValueSet for one metric to the arena with a single call to
+ * the e_fetchColumnCallBack.
+ */
+static int
+__pmdaFetchColumn(pmdaExt *pmda, e_ext_t *extp, pmdaMetric *metap,
+		  pmDesc *dp)
+{
+    pmValueSet	*vset;
+    int		single = PM_IN_NULL;
+    int		*instlist;
+    int		numinst;
+    int		numval;
+    int		valfmt = PM_VAL_INSITU;
+    int		sts = 0;
+    int		j, k;
+
+    if (dp->indom == PM_INDOM_NULL) {
+	instlist = &single;
+	numinst = 1;
+    }
+    else {
+	if (extp->colindom != dp->indom &&
+	    (sts = __pmdaProfileInst(dp->indom, pmda, extp)) < 0) {
+	    extp->colindom = PM_INDOM_NULL;
+	    return sts;
+	}
+	instlist = extp->colinst;
+	numinst = extp->colnuminst;
+    }
+
+    if ((vset = __pmArenaValueSet(&extp->arena, dp->pmid, numinst)) == NULL)
+	return -oserror();
+    vset->numval = 0;
+    if (numinst == 0)
+	return 0;
+
+    if (numinst > extp->colmaxval) {
+	if ((extp->colatom = (pmAtomValue *)realloc(extp->colatom, numinst * sizeof(pmAtomValue))) == NULL ||
+	    (extp->colsts = (int *)realloc(extp->colsts, numinst * sizeof(int))) == NULL) {
+	    extp->colmaxval = 0;
+	    return -oserror();
+	}
+	extp->colmaxval = numinst;
+    }
+    for (k = 0; k < numinst; k++)
+	extp->colsts[k] = PMDA_FETCH_NOVALUES;
+
+    sts = (*(pmda->e_fetchColumnCallBack))(metap, numinst, instlist,
+					   extp->colatom, extp->colsts);
+    if (sts < 0) {
+	vset->numval = __pmdaFetchValue(extp, dp, PM_IN_NULL, sts, NULL, NULL, NULL);
+	return 0;
+    }
+
+    numval = 0;
+    for (j = k = 0; k < numinst; k++) {
+	vset->vlist[j].inst = instlist[k];
+	sts = __pmdaFetchValue(extp, dp, instlist[k], extp->colsts[k],
+			       &extp->colatom[k], &vset->vlist[j], &valfmt);
+	if (sts > 0) {
+	    vset->valfmt = valfmt;
+	    j++;
+	}
+	else
+	    numval = sts;
+    }
+    vset->numval = j > 0 ? j : numval;
+    return 0;
+}
+
+/*
+ * stage a pmValueSet in the arena and call the e_callback for each
+ * metric instance required in the profile, or the e_fetchColumnCallBack
+ * once for each metric if there is one, then return the result as one
+ * PDU buffer (released by pmFreeResult or __pmFreeResultValues).
  */
 
 int
@@ -445,15 +721,14 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
     int			i;		/* over pmidlist[] */
     int			j;		/* over metatab and vset->vlist[] */
     int			sts;
-    int			need;
     int			inst;
     int			numval;
+    int			valfmt;
     pmValueSet		*vset;
     pmDesc		*dp;
     pmdaMetric          metaBuf;
     pmdaMetric		*metap;
     pmAtomValue		atom;
-    int			type;
     e_ext_t		*extp = (e_ext_t *)pmda->e_ext;
 
     if (extp->dispatch->version.any.ext != pmda)
@@ -463,19 +738,10 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
     if (extp->dispatch->comm.pmda_interface >= PMDA_INTERFACE_5)
 	__pmdaSetContext(pmda->e_context);
 
-    if (numpmid > extp->maxnpmids) {
-	if (extp->res != NULL)
-	    free(extp->res);
-	/* (numpmid - 1) because there's room for one valueSet in a pmResult */
-	need = (int)sizeof(pmResult) + (numpmid - 1) * (int)sizeof(pmValueSet *);
-	if ((extp->res = (pmResult *) malloc(need)) == NULL)
-	    return -oserror();
-	extp->maxnpmids = numpmid;
-    }
+    __pmArenaReset(&extp->arena);
 
-    extp->res->timestamp.tv_sec = 0;
-    extp->res->timestamp.tv_usec = 0;
-    extp->res->numpmid = numpmid;
+    /* instance lists from the profile are only reused within this fetch */
+    extp->colindom = PM_INDOM_NULL;
 
     /* Look up the pmDesc for the incoming pmids in our pmdaMetrics tables,
        if present.  Fall back to .desc callback if not found (for highly
@@ -505,6 +771,12 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
             }
         }
 
+	if (dp != NULL && pmda->e_fetchColumnCallBack != NULL) {
+	    if ((sts = __pmdaFetchColumn(pmda, extp, metap, dp)) < 0)
+		return sts;
+	    continue;
+	}
+
 	if (dp != NULL) {
 	    if (dp->indom != PM_INDOM_NULL) {
 		/* count instances in the profile */
@@ -532,20 +804,8 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 	}
 
 
-	/* Must use individual malloc()s because of pmFreeResult() */
-	if (numval >= 1)
-	    extp->res->vset[i] = vset = (pmValueSet *)malloc(sizeof(pmValueSet) +
-					    (numval - 1)*sizeof(pmValue));
-	else
-	    extp->res->vset[i] = vset = (pmValueSet *)malloc(sizeof(pmValueSet) -
-					    sizeof(pmValue));
-	if (vset == NULL) {
-	    sts = -oserror();
-	    goto error;
-	}
-	vset->pmid = pmidlist[i];
-	vset->numval = numval;
-	vset->valfmt = PM_VAL_INSITU;
+	if ((vset = __pmArenaValueSet(&extp->arena, pmidlist[i], numval)) == NULL)
+	    return -oserror();
 	if (vset->numval <= 0)
 	    continue;
 
@@ -555,103 +815,21 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 	    __pmdaStartInst(dp->indom, pmda);
 	    __pmdaNextInst(&inst, pmda);
 	}
-	type = dp->type;
 	j = 0;
 	do {
 	    if (j == numval) {
 		/* more instances than expected! */
 		numval++;
-		extp->res->vset[i] = vset = (pmValueSet *)realloc(vset,
-			    sizeof(pmValueSet) + (numval - 1)*sizeof(pmValue));
-		if (vset == NULL) {
-		    sts = -oserror();
-		    goto error;
-		}
+		if ((vset = __pmArenaGrowValueSet(&extp->arena, numval)) == NULL)
+		    return -oserror();
 	    }
 	    vset->vlist[j].inst = inst;
 
-	    if ((sts = (*(pmda->e_fetchCallBack))(metap, inst, &atom)) < 0) {
-		char	strbuf[20];
-
-		pmIDStr_r(dp->pmid, strbuf, sizeof(strbuf));
-		if (sts == PM_ERR_PMID) {
-		    __pmNotifyErr(LOG_ERR, 
-		        "pmdaFetch: PMID %s not handled by fetch callback\n",
-				strbuf);
-		}
-		else if (sts == PM_ERR_INST) {
-#ifdef PCP_DEBUG
-		    if (pmDebug & DBG_TRACE_LIBPMDA) {
-			__pmNotifyErr(LOG_ERR,
-			    "pmdaFetch: Instance %d of PMID %s not handled by fetch callback\n",
-				    inst, strbuf);
-		    }
-#endif
-		}
-		else if (sts == PM_ERR_APPVERSION ||
-			 sts == PM_ERR_PERMISSION ||
-			 sts == PM_ERR_AGAIN ||
-			 sts == PM_ERR_NYI) {
-#ifdef PCP_DEBUG
-		    if (pmDebug & DBG_TRACE_LIBPMDA) {
-			__pmNotifyErr(LOG_ERR,
-			     "pmdaFetch: Unavailable metric PMID %s[%d]\n",
-				    strbuf, inst);
-		    }
-#endif
-		}
-		else {
-		    __pmNotifyErr(LOG_ERR,
-			"pmdaFetch: Fetch callback error from metric PMID %s[%d]: %s\n",
-				strbuf, inst, pmErrStr(sts));
-		}
-	    }
-	    else {
-		/*
-		 * PMDA_INTERFACE_2
-		 *	>= 0 => OK
-		 * PMDA_INTERFACE_3 or PMDA_INTERFACE_4
-		 *	== 0 => no values
-		 *	> 0  => OK
-		 * PMDA_INTERFACE_5 or later
-		 *	== 0 (PMDA_FETCH_NOVALUES) => no values
-		 *	== 1 (PMDA_FETCH_STATIC) or > 2 => OK
-		 *	== 2 (PMDA_FETCH_DYNAMIC) => OK and free(atom.vp)
-		 *	     after __pmStuffValue() called
-		 */
-		if (extp->dispatch->comm.pmda_interface == PMDA_INTERFACE_2 ||
-		    (extp->dispatch->comm.pmda_interface >= PMDA_INTERFACE_3 && sts > 0)) {
-		    int		lsts;
-
-		    if ((lsts = __pmStuffValue(&atom, &vset->vlist[j], type)) == PM_ERR_TYPE) {
-			char	strbuf[20];
-			char	st2buf[20];
-			__pmNotifyErr(LOG_ERR, 
-				     "pmdaFetch: Descriptor type (%s) for metric %s is bad",
-				     pmTypeStr_r(type, strbuf, sizeof(strbuf)),
-				     pmIDStr_r(dp->pmid, st2buf, sizeof(st2buf)));
-		    }
-		    else if (lsts >= 0) {
-			vset->valfmt = lsts;
-			j++;
-		    }
-		    if (extp->dispatch->comm.pmda_interface >= PMDA_INTERFACE_5 && sts == PMDA_FETCH_DYNAMIC) {
-			if (type == PM_TYPE_STRING)
-			    free(atom.cp);
-			else if (type == PM_TYPE_AGGREGATE)
-			    free(atom.vbp);
-			else {
-			    char	strbuf[20];
-			    char	st2buf[20];
-			    __pmNotifyErr(LOG_WARNING,
-					  "pmdaFetch: Attempt to free value for metric %s of wrong type %s\n",
-					  pmIDStr_r(dp->pmid, strbuf, sizeof(strbuf)),
-					  pmTypeStr_r(type, st2buf, sizeof(st2buf)));
-			}
-		    }
-		    if (lsts < 0)
-			sts = lsts;
-		}
+	    sts = (*(pmda->e_fetchCallBack))(metap, inst, &atom);
+	    sts = __pmdaFetchValue(extp, dp, inst, sts, &atom, &vset->vlist[j], &valfmt);
+	    if (sts > 0) {
+		vset->valfmt = valfmt;
+		j++;
 	    }
 	} while (dp->indom != PM_INDOM_NULL && __pmdaNextInst(&inst, pmda));
 
@@ -661,16 +839,7 @@ pmdaFetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 	    vset->numval = j;
 
     }
-    *resp = extp->res;
-    return 0;
-
-error:
-
-    if (i) {
-	extp->res->numpmid = i;
-	__pmFreeResultValues(extp->res);
-    }
-    return sts;
+    return __pmArenaResult(&extp->arena, resp);
 }
 
 /*
@@ -19,7 +19,8 @@
 #define HAVE_V_FOUR(interface)	((interface) >= PMDA_INTERFACE_4)
 #define HAVE_V_FIVE(interface)	((interface) >= PMDA_INTERFACE_5)
 #define HAVE_V_SIX(interface)	((interface) >= PMDA_INTERFACE_6)
-#define HAVE_ANY(interface)	((interface) <= PMDA_INTERFACE_6 && HAVE_V_TWO(interface))
+#define HAVE_V_SEVEN(interface)	((interface) >= PMDA_INTERFACE_7)
+#define HAVE_ANY(interface)	((interface) <= PMDA_INTERFACE_7 && HAVE_V_TWO(interface))
 
 /*
  * Auxilliary structure used to save data from pmdaDSO or pmdaDaemon and
@@ -28,9 +29,18 @@
  */
 typedef struct {
     pmdaInterface	*dispatch;	/* back pointer to our pmdaInterface */
-    pmResult		*res;		/* high-water allocation for */
-    int			maxnpmids;	/* pmResult for each PMDA */
+    __pmResultArena	arena;		/* pmResult staging for each PMDA */
     __pmHashCtl		hashpmids;	/* hashed metrictab lookups */
+    /* pmdaFetch with a column callback, high-water allocations */
+    pmInDom		colindom;	/* profile selected instances of */
+    int			colnuminst;	/* this indom in this fetch are */
+    int			*colinst;	/* colinst[0] ... */
+    int			colmaxinst;
+    int			*colprof;	/* sorted copy of profile instances */
+    int			colmaxprof;
+    pmAtomValue		*colatom;	/* values and return codes from */
+    int			*colsts;	/* the column callback */
+    int			colmaxval;
 } e_ext_t;
 
 #endif /* LIBDEFS_H */
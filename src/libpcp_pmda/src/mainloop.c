@@ -467,6 +467,18 @@ pmdaSetFetchCallBack(pmdaInterface *dispatch, pmdaFetchCallBack callback)
     }
 }
 
+void
+pmdaSetFetchColumnCallBack(pmdaInterface *dispatch, pmdaFetchColumnCallBack callback)
+{
+    if (HAVE_V_SEVEN(dispatch->comm.pmda_interface) || callback == NULL)
+	dispatch->version.seven.ext->e_fetchColumnCallBack = callback;
+    else {
+	__pmNotifyErr(LOG_CRIT, "Unable to set fetch column callback for PMDA interface version %d.",
+		     dispatch->comm.pmda_interface);
+	dispatch->status = PM_ERR_GENERIC;
+    }
+}
+
 void
 pmdaSetCheckCallBack(pmdaInterface *dispatch, pmdaCheckCallBack callback)
 {
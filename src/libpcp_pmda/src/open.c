@@ -593,7 +593,8 @@ pmdaInit(pmdaInterface *dispatch, pmdaIndom *indoms, int nindoms,
     pmda = dispatch->version.any.ext;
 
     if (dispatch->version.any.fetch == pmdaFetch &&
-	pmda->e_fetchCallBack == (pmdaFetchCallBack)0) {
+	pmda->e_fetchCallBack == (pmdaFetchCallBack)0 &&
+	pmda->e_fetchColumnCallBack == (pmdaFetchColumnCallBack)0) {
 	__pmNotifyErr(LOG_CRIT, "pmdaInit: PMDA %s: using pmdaFetch() but fetch call back not set", pmda->e_name);
 	dispatch->status = PM_ERR_GENERIC;
 	return;
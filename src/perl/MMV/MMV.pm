@@ -12,17 +12,17 @@ require DynaLoader;
     mmv_stats_init mmv_stats_stop mmv_units
 	mmv_lookup_value_desc
 	mmv_inc_value mmv_set_value mmv_set_string
-	mmv_stats_add mmv_stats_inc mmv_stats_set
+	mmv_stats_add mmv_stats_inc mmv_stats_set mmv_stats_record
 	mmv_stats_add_fallback mmv_stats_inc_fallback
 	mmv_stats_interval_start mmv_stats_interval_end
 	mmv_stats_set_string
-    MMV_FLAG_NOPREFIX MMV_FLAG_PROCESS
+    MMV_FLAG_NOPREFIX MMV_FLAG_PROCESS MMV_FLAG_SHARDED
     MMV_INDOM_NULL
     MMV_TYPE_NOSUPPORT
     MMV_TYPE_I32 MMV_TYPE_U32
     MMV_TYPE_I64 MMV_TYPE_U64
     MMV_TYPE_FLOAT MMV_TYPE_DOUBLE
-    MMV_TYPE_STRING MMV_TYPE_ELAPSED
+    MMV_TYPE_STRING MMV_TYPE_ELAPSED MMV_TYPE_HISTOGRAM
     MMV_COUNT_ONE
     MMV_SEM_COUNTER MMV_SEM_INSTANT MMV_SEM_DISCRETE
     MMV_SPACE_BYTE MMV_SPACE_KBYTE MMV_SPACE_MBYTE
@@ -38,6 +38,7 @@ sub MMV_INDOM_NULL	{ 0xffffffff; }
 # flags for pmdammv
 sub MMV_FLAG_NOPREFIX	{ 0x1; } # metric names not prefixed by file name
 sub MMV_FLAG_PROCESS	{ 0x2; } # instrumented process must be running
+sub MMV_FLAG_SHARDED	{ 0x4; } # per-thread shards for counter values
 
 # data type of metric values
 sub MMV_TYPE_NOSUPPORT	{ 0xffffffff; }	# not implemented in this version
@@ -48,7 +49,8 @@ sub MMV_TYPE_U64	{ 3; }	# 64-bit signed integer
 sub MMV_TYPE_FLOAT	{ 4; }	# 32-bit floating point
 sub MMV_TYPE_DOUBLE	{ 5; }	# 64-bit floating point
 sub MMV_TYPE_STRING	{ 6; }	# null-terminated string
-sub MMV_TYPE_ELAPSED	{ 10; }	# 64-bit elapsed time
+sub MMV_TYPE_ELAPSED	{ 9; }	# 64-bit elapsed time
+sub MMV_TYPE_HISTOGRAM	{ 10; }	# distribution of 64-bit values
 
 # units - space scale
 sub MMV_SPACE_BYTE	{ 0; }  # bytes
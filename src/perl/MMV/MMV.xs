@@ -330,6 +330,15 @@ mmv_stats_set(handle,metric,instance, value)
     CODE:
 	mmv_stats_set(handle, metric, instance, value);
 
+void
+mmv_stats_record(handle,metric,instance,value)
+	void *			handle
+	char *			metric
+	char *			instance
+	double			value
+    CODE:
+	mmv_stats_record(handle, metric, instance, value);
+
 void
 mmv_stats_add_fallback(handle,metric,instance,instance2,count)
 	void *			handle
@@ -184,6 +184,9 @@ CleanupAgent(AgentInfo* aPtr, int why, int status)
 	pmcd_dump_trace(stderr);
 
     MarkStateChanges(PMCD_DROP_AGENT);
+
+    /* complete any client fetches still waiting on this agent */
+    AbortAgentFetch(aPtr);
 }
 
 static int
@@ -114,6 +114,7 @@ AcceptNewClient(int reqfd)
     client[i].status.connected = 1;
     client[i].status.attributes = 0;
     client[i].status.changes = 0;
+    client[i].status.fetching = 0;
     memset(&client[i].attrs, 0, sizeof(__pmHashCtl));
 
     /*
@@ -216,6 +217,7 @@ DeleteClient(ClientInfo *cp)
     cp->status.connected = 0;
     cp->status.attributes = 0;
     cp->status.changes = 0;
+    cp->status.fetching = 0;
     cp->fd = -1;
 
     NotifyEndContext(cp-client);
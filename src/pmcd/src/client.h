@@ -22,6 +22,7 @@ typedef struct {
 	unsigned int	connected : 1;	/* Client connected */
 	unsigned int	changes : 3;	/* PMCD_* bits for changes since last fetch */
 	unsigned int	attributes: 1;	/* Connection attributes have changed */
+	unsigned int	fetching : 1;	/* Waiting on agents for a fetch */
     } status;
     /* There is an array of profiles, as there is a profile associated
      * with each client context.  The array is not guaranteed to be dense.
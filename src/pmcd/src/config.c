@@ -2354,6 +2354,8 @@ DupAgent(AgentInfo *dest, AgentInfo *src)
     dest->outFd = src->outFd;
     dest->profClient = src->profClient;
     dest->profIndex = src->profIndex;
+    dest->fetchSent = src->fetchSent;
+    dest->fetchShared = src->fetchShared;
     /* IMPORTANT: copy the status, connections stay connected */
     memcpy(&dest->status, &src->status, sizeof(dest->status));
     if (src->ipcType == AGENT_DSO) {
@@ -17,16 +17,31 @@
 #include "impl.h"
 #include "pmcd.h"
 
-/* Freq. histogram: pmids for each agent in current fetch request */
-
-static int	*aFreq;
-
-/* Routine to break a list of pmIDs up into sublists of metrics within the
- * same metric domain.  The resulting lists are returned via a pointer to an
- * array of per-domain lists as defined by the struct below.  Any metrics for
- * which no agent exists are collected into a list at the end of the list of
- * valid lists.  This list has domain = -1 and is used to indicate the end of
- * the list of pmID lists.
+/*
+ * Asynchronous fetch handling.
+ *
+ * DoFetch() breaks a client's PDU_FETCH into per-domain pmID lists.  DSO
+ * agents are called directly, but rather than waiting for every daemon
+ * agent to respond (which would stall all other clients behind the
+ * slowest PMDA) the per-domain requests for daemon agents are queued on
+ * the agent and DoFetch() returns to ClientLoop().  Each agent has at
+ * most one fetch outstanding (fetchReq), so the profile/fetch/result PDU
+ * exchange with the PMDA is unchanged.  ClientLoop() selects on the
+ * output fd of agents with a fetch outstanding and HandleFetchAgents()
+ * collects the results; once every agent involved in a client fetch has
+ * answered, the pmResult is assembled and sent to the client.  No more
+ * PDUs are read from a client while its fetch is outstanding.
+ *
+ * Clients sampling the same metrics at the same time (pmlogger and pmie
+ * instances with common configurations are typical) often make identical
+ * requests of an agent.  A request with the same pmIDs and an equivalent
+ * instance profile as one already queued on the agent, or one sent less
+ * than _pmcd_coalesce msecs ago, is not sent again but attached to the
+ * earlier request as a waiter, and is given a copy of its result.
+ *
+ * Any other request/response exchange with a daemon agent (desc, text,
+ * instance, PMNS and store PDUs) must call DrainAgentFetch() first so the
+ * outstanding fetch result is not mistaken for the response.
  */
 
 typedef struct {
@@ -35,16 +50,53 @@ typedef struct {
     pmID *list;
 } DomPmidList;
 
+/*
+ * Per-agent part of a client fetch, queued on the agent until a result
+ * is available.
+ */
+typedef struct fetchreq {
+    struct fetchreq	*next;		/* next request queued on agent */
+    struct fetchctl	*fetch;		/* client fetch this is part of */
+    DomPmidList		*dp;		/* pmIDs for this agent */
+    pmResult		*result;	/* agent's result, once known */
+    struct fetchreq	*waiters;	/* identical requests sharing result */
+} FetchReq;
+
+/*
+ * A client fetch waiting on one or more agents.
+ */
+typedef struct fetchctl {
+    int			clientId;	/* index into client[] */
+    unsigned int	seq;		/* client seq, detects slot reuse */
+    int			ctxnum;		/* client context number */
+    int			nPmids;		/* number of pmIDs requested */
+    int			*slot;		/* dList index for each pmID */
+    int			nDoms;		/* entries in dList[], incl bad list */
+    DomPmidList		*dList;		/* per-domain pmID lists */
+    FetchReq		*req;		/* one per dList[] entry */
+    int			nWait;		/* requests yet to complete */
+} FetchCtl;
+
+/* Routine to break a list of pmIDs up into sublists of metrics within the
+ * same metric domain.  The resulting lists are returned via a pointer to an
+ * array of per-domain lists as defined by the DomPmidList struct above.  Any metrics for
+ * which no agent exists are collected into a list at the end of the list of
+ * valid lists.  This list has domain = -1 and is used to indicate the end of
+ * the list of pmID lists.  The list index for each of the original pmIDs is
+ * returned via slot[].  The result is a single malloc'd block, owned by the
+ * caller.
+ */
+
 static DomPmidList *
-SplitPmidList(int nPmids, pmID *pmidList)
+SplitPmidList(int nPmids, pmID *pmidList, int *slot)
 {
     int			i, j;
     static int		*resIndex = NULL;	/* resIndex[k] = index of agent[k]'s list in result */
+    static int		*aFreq = NULL;	/* pmids for each agent in request */
     static int		nDoms = 0;	/* No. of entries in two tables above */
     int			nGood;
-    static int		currentSize = 0;
     int			resultSize;
-    static DomPmidList	*result;
+    DomPmidList		*result;
     pmID		*resultPmids;
 
     /* Allocate the frequency histogram and array for mapping from agent to
@@ -114,14 +166,9 @@ SplitPmidList(int nPmids, pmID *pmidList)
 doit:
     resultSize = (nGood + 1) * (int)sizeof(DomPmidList);
     resultSize += nPmids * sizeof(pmID);
-    if (resultSize > currentSize) {
-	if (currentSize > 0)
-	    free(result);
-	result = (DomPmidList *)malloc(resultSize);
-	if (result == NULL) {
-	    __pmNoMem("SplitPmidList.result", resultSize, PM_FATAL_ERR);
-	}
-	currentSize = resultSize;
+    result = (DomPmidList *)malloc(resultSize);
+    if (result == NULL) {
+	__pmNoMem("SplitPmidList.result", resultSize, PM_FATAL_ERR);
     }
 
     resultPmids = (pmID *)&result[nGood + 1];
@@ -155,10 +202,17 @@ doit:
     for (i = 0; i < nPmids; i++) {
  	j = resIndex[mapdom[((__pmID_int *)&pmidList[i])->domain]];
  	result[j].list[result[j].listSize++] = pmidList[i];
+	slot[i] = j;
     }
     return result;
 }
 
+/*
+ * Staging area for the pmResults built here, each of which is then
+ * a single PDU buffer released by pmFreeResult().
+ */
+static __pmResultArena	arena;
+
 /* Build a pmResult indicating that no values are available for the pmID list
  * supplied.
  */
@@ -166,31 +220,51 @@ doit:
 static pmResult *
 MakeBadResult(int npmids, pmID *list, int sts)
 {
-    int	       need;
     int	       i;
-    pmValueSet *vSet;
     pmResult   *result;
 
-    need = (int)sizeof(pmResult) +
-	(npmids - 1) * (int)sizeof(pmValueSet *);
-	/* npmids - 1 because there is already 1 pmValueSet* in a pmResult */
-    result = (pmResult *)malloc(need);
-    if (result == NULL) {
-	__pmNoMem("MakeBadResult.result", need, PM_FATAL_ERR);
-    }
-    result->numpmid = npmids;
+    __pmArenaReset(&arena);
     for (i = 0; i < npmids; i++) {
-	vSet = (pmValueSet *)malloc(sizeof(pmValueSet));
-	if (vSet == NULL) {
+	if (__pmArenaValueSet(&arena, list[i], sts) == NULL) {
 	    __pmNoMem("MakeBadResult.vSet", sizeof(pmValueSet), PM_FATAL_ERR);
 	}
-	result->vset[i] = vSet;
-	vSet->pmid = list[i];
-	vSet->numval = sts;
+    }
+    if (__pmArenaResult(&arena, &result) < 0) {
+	__pmNoMem("MakeBadResult.result", sizeof(pmResult), PM_FATAL_ERR);
     }
     return result;
 }
 
+/*
+ * Living DSO agents may manage their own pmResult skeleton and reuse it
+ * on the next call, but the result may need to outlive another client's
+ * fetch from the same agent while daemon agents are still responding.
+ * Take a private copy of the skeleton; the value sets within it are
+ * ours to free in any case.  A result from pmdaFetch() is a PDU buffer
+ * of its own, and already private.
+ */
+static pmResult *
+DupDsoResult(pmResult *rp)
+{
+    int		need;
+    char	*base;
+    pmResult	*result;
+
+    if (__pmPDUBufRange((void *)rp, &base) > 0)
+	return rp;
+
+    need = (int)sizeof(pmResult) +
+	(rp->numpmid - 1) * (int)sizeof(pmValueSet *);
+    if (rp->numpmid < 1)
+	need = (int)sizeof(pmResult);
+    result = (pmResult *)malloc(need);
+    if (result == NULL) {
+	__pmNoMem("DupDsoResult.result", need, PM_FATAL_ERR);
+    }
+    memcpy(result, rp, need);
+    return result;
+}
+
 static pmResult *
 SendFetch(DomPmidList *dpList, AgentInfo *aPtr, ClientInfo *cPtr, int ctxnum)
 {
@@ -280,6 +354,8 @@ SendFetch(DomPmidList *dpList, AgentInfo *aPtr, ClientInfo *cPtr, int ctxnum)
 			sts = PM_ERR_PMID;
 			bad = 2;
 		    }
+		    else
+			result = DupDsoResult(result);
 		}
 	    }
 	}
@@ -318,6 +394,9 @@ SendFetch(DomPmidList *dpList, AgentInfo *aPtr, ClientInfo *cPtr, int ctxnum)
 	    }
 #endif
 	if (aPtr->ipcType == AGENT_DSO) {
+	    if (bad == 2)
+		/* the DSO's value sets are ours to free */
+		__pmFreeResultValues(result);
 	    aPtr->status.madeDsoResult = 1;
 	    sts = 0;
 	}
@@ -330,40 +409,393 @@ SendFetch(DomPmidList *dpList, AgentInfo *aPtr, ClientInfo *cPtr, int ctxnum)
     return result;
 }
 
-int
-DoFetch(ClientInfo *cip, __pmPDU* pb)
+
+/*
+ * Return the client that made a fetch request, or NULL if the client
+ * has gone away (and perhaps its client[] slot has been reused) while
+ * the agents were working on it.
+ */
+static ClientInfo *
+FetchClient(FetchCtl *fcp)
+{
+    ClientInfo	*cip;
+
+    if (fcp->clientId >= nClients)
+	return NULL;
+    cip = &client[fcp->clientId];
+    if (!cip->status.connected || cip->seq != fcp->seq)
+	return NULL;
+    return cip;
+}
+
+/*
+ * Instance profiles are equivalent if they are the same element by
+ * element.  The order of the per-indom entries is not canonical, so this
+ * may miss some equivalent profiles, which is harmless.
+ */
+static int
+SameProfile(__pmProfile *a, __pmProfile *b)
+{
+    int			i;
+    __pmInDomProfile	*ap, *bp;
+
+    if (a == b)
+	return 1;
+    if (a->state != b->state || a->profile_len != b->profile_len)
+	return 0;
+    for (i = 0; i < a->profile_len; i++) {
+	ap = &a->profile[i];
+	bp = &b->profile[i];
+	if (ap->indom != bp->indom || ap->state != bp->state ||
+	    ap->instances_len != bp->instances_len)
+	    return 0;
+	if (ap->instances_len > 0 &&
+	    memcmp(ap->instances, bp->instances, ap->instances_len * sizeof(int)) != 0)
+	    return 0;
+    }
+    return 1;
+}
+
+/*
+ * Would sending request b to the agent give the same result as sending
+ * request a?
+ */
+static int
+SameFetch(FetchReq *a, FetchReq *b)
+{
+    ClientInfo	*acp, *bcp;
+
+    if (a->dp->listSize != b->dp->listSize ||
+	memcmp(a->dp->list, b->dp->list, a->dp->listSize * sizeof(pmID)) != 0)
+	return 0;
+    if ((acp = FetchClient(a->fetch)) == NULL ||
+	(bcp = FetchClient(b->fetch)) == NULL)
+	return 0;
+    return SameProfile(acp->profile[a->fetch->ctxnum],
+		       bcp->profile[b->fetch->ctxnum]);
+}
+
+/*
+ * Find a request for the agent that rp can share the result of.  Agents
+ * that use the client credentials or container are excluded as their
+ * results may differ between clients.
+ */
+static FetchReq *
+FindFetchReq(AgentInfo *ap, FetchReq *rp)
+{
+    FetchReq		*sp;
+    struct timeval	now;
+
+    if (_pmcd_coalesce <= 0 ||
+	(ap->status.flags & (PDU_FLAG_AUTH|PDU_FLAG_CONTAINER)))
+	return NULL;
+    if ((sp = ap->fetchReq) != NULL) {
+	/* values must not be sampled long before the request arrived */
+	__pmtimevalNow(&now);
+	if (__pmtimevalSub(&now, &ap->fetchStart) * 1000 <= _pmcd_coalesce &&
+	    SameFetch(sp, rp))
+	    return sp;
+    }
+    for (sp = ap->fetchHead; sp != NULL; sp = sp->next) {
+	if (SameFetch(sp, rp))
+	    return sp;
+    }
+    return NULL;
+}
+
+/*
+ * Deep copy of an agent's pmResult, for a request that shared it.
+ */
+static pmResult *
+DupResult(pmResult *rp)
+{
+    int		i, j;
+    int		need;
+    pmResult	*result;
+    pmValueSet	*vsp;
+    pmValueSet	*src;
+    pmValueBlock *vbp;
+
+    __pmArenaReset(&arena);
+    for (i = 0; i < rp->numpmid; i++) {
+	src = rp->vset[i];
+	if ((vsp = __pmArenaValueSet(&arena, src->pmid, src->numval)) == NULL) {
+	    __pmNoMem("DupResult.vset", sizeof(pmValueSet), PM_FATAL_ERR);
+	}
+	if (src->numval <= 0)
+	    continue;
+	if (src->valfmt == PM_VAL_INSITU) {
+	    memcpy(vsp->vlist, src->vlist, src->numval * sizeof(pmValue));
+	    continue;
+	}
+	/* the copy owns its value blocks, whatever the original did */
+	vsp->valfmt = PM_VAL_DPTR;
+	for (j = 0; j < src->numval; j++) {
+	    need = src->vlist[j].value.pval->vlen;
+	    vsp->vlist[j].inst = src->vlist[j].inst;
+	    if ((vbp = __pmArenaValueBlock(&arena, need, &vsp->vlist[j])) == NULL) {
+		__pmNoMem("DupResult.pval", need, PM_FATAL_ERR);
+	    }
+	    memcpy(vbp, src->vlist[j].value.pval, need);
+	}
+    }
+    if (__pmArenaResult(&arena, &result) < 0) {
+	__pmNoMem("DupResult.result", sizeof(pmResult), PM_FATAL_ERR);
+    }
+    result->timestamp = rp->timestamp;
+    return result;
+}
+
+/*
+ * All agents have responded, so assemble the pmResult for the client
+ * from the per-domain results and send it.
+ */
+static void
+FinishFetch(FetchCtl *fcp)
 {
     int			i, j;
     int 		sts;
-    int			ctxnum;
-    __pmTimeval		when;
-    int			nPmids;
-    pmID		*pmidList;
+    ClientInfo		*cip;
     static pmResult	*endResult = NULL;
     static int		maxnpmids = 0;	/* sizes endResult */
-    DomPmidList		*dList;		/* NOTE: NOT indexed by agent index */
-    static int		nDoms = 0;
-    static pmResult	**results = NULL;
     static int		*resIndex = NULL;
-    __pmFdSet		waitFds;
-    __pmFdSet		readyFds;
-    int			nWait;
-    int			maxFd;
-    struct timeval	timeout;
+    static int		maxndoms = 0;	/* sizes resIndex */
 
-    if (nAgents > nDoms) {
-	if (results != NULL)
-	    free(results);
-	if (resIndex != NULL)
-	    free(resIndex);
-	results = (pmResult **)malloc((nAgents + 1) * sizeof (pmResult *));
-	resIndex = (int *)malloc((nAgents + 1) * sizeof(int));
-	if (results == NULL || resIndex == NULL) {
-	    __pmNoMem("DoFetch.results", (nAgents + 1) * sizeof (pmResult *) + (nAgents + 1) * sizeof(int), PM_FATAL_ERR);
+    if ((cip = FetchClient(fcp)) != NULL) {
+	cip->status.fetching = 0;
+
+	if (fcp->nPmids > maxnpmids) {
+	    int		need;
+	    if (endResult != NULL)
+		free(endResult);
+	    need = (int)sizeof(pmResult) + (fcp->nPmids - 1) * (int)sizeof(pmValueSet *);
+	    if ((endResult = (pmResult *)malloc(need)) == NULL) {
+		__pmNoMem("FinishFetch.endResult", need, PM_FATAL_ERR);
+	    }
+	    maxnpmids = fcp->nPmids;
 	}
-	nDoms = nAgents;
+	if (fcp->nDoms > maxndoms) {
+	    if (resIndex != NULL)
+		free(resIndex);
+	    if ((resIndex = (int *)malloc(fcp->nDoms * sizeof(int))) == NULL) {
+		__pmNoMem("FinishFetch.resIndex", fcp->nDoms * sizeof(int), PM_FATAL_ERR);
+	    }
+	    maxndoms = fcp->nDoms;
+	}
+
+	endResult->numpmid = fcp->nPmids;
+	__pmtimevalNow(&endResult->timestamp);
+	/* The order of the pmIDs in the per-domain results is the same as in
+	 * the original request, but on a per-domain basis.  resIndex is an
+	 * array of indeces (one per domain list) of the next metric to be
+	 * retrieved from each per-domain result's vset.
+	 */
+	memset(resIndex, 0, fcp->nDoms * sizeof(resIndex[0]));
+
+	for (i = 0; i < fcp->nPmids; i++) {
+	    j = fcp->slot[i];
+	    endResult->vset[i] = fcp->req[j].result->vset[resIndex[j]++];
+	}
+	pmcd_trace(TR_XMIT_PDU, cip->fd, PDU_RESULT, endResult->numpmid);
+
+	sts = 0;
+	if (cip->status.changes) {
+	    /* notify client of PMCD state change */
+	    sts = __pmSendError(cip->fd, FROM_ANON, (int)cip->status.changes);
+	    if (sts > 0)
+		sts = 0;
+	    cip->status.changes = 0;
+	}
+	if (sts == 0)
+	    sts = __pmSendResult(cip->fd, FROM_ANON, endResult);
+
+	if (sts < 0) {
+	    pmcd_trace(TR_XMIT_ERR, cip->fd, PDU_RESULT, sts);
+	    CleanupClient(cip, sts);
+	}
+    }
+
+    /*
+     * pmFreeResult() all the accumulated results ... these are all
+     * dynamically allocated, in __pmDecodeResult, pmdaFetch,
+     * DupDsoResult, DupResult or MakeBadResult
+     */
+    for (i = 0; i < fcp->nDoms; i++) {
+	if (fcp->req[i].result != NULL)
+	    pmFreeResult(fcp->req[i].result);
+    }
+    free(fcp->req);
+    free(fcp->dList);
+    free(fcp);
+}
+
+/*
+ * Note the result for one agent's part of a client fetch (and for any
+ * requests sharing it), and finish the fetch if this was the last one
+ * outstanding.
+ */
+static void
+FetchReqDone(FetchReq *rp, pmResult *result)
+{
+    FetchCtl	*fcp = rp->fetch;
+    FetchReq	*wp;
+
+    while ((wp = rp->waiters) != NULL) {
+	rp->waiters = wp->next;
+	wp->next = NULL;
+	FetchReqDone(wp, result != NULL ? DupResult(result) : NULL);
     }
-    memset(results, 0, (nAgents + 1) * sizeof(results[0]));
+    rp->result = result;
+    if (--fcp->nWait == 0)
+	FinishFetch(fcp);
+}
+
+/*
+ * The client to send a request on behalf of, which may be one sharing
+ * the request if the client that made it has gone away.
+ */
+static ClientInfo *
+FetchReqClient(FetchReq *rp, int *ctxnum)
+{
+    ClientInfo	*cip;
+    FetchReq	*wp;
+
+    if ((cip = FetchClient(rp->fetch)) != NULL) {
+	*ctxnum = rp->fetch->ctxnum;
+	return cip;
+    }
+    for (wp = rp->waiters; wp != NULL; wp = wp->next) {
+	if ((cip = FetchClient(wp->fetch)) != NULL) {
+	    *ctxnum = wp->fetch->ctxnum;
+	    return cip;
+	}
+    }
+    return NULL;
+}
+
+/*
+ * Send queued fetch requests to an agent, until one is on the wire
+ * awaiting a result or the queue is empty.  Requests that cannot be sent
+ * complete immediately with a "bad" result.
+ */
+static void
+StartAgentFetch(AgentInfo *ap)
+{
+    FetchReq	*rp;
+    ClientInfo	*cip;
+    int		ctxnum;
+    pmResult	*result;
+
+    while (ap->fetchReq == NULL && (rp = ap->fetchHead) != NULL) {
+	if ((ap->fetchHead = rp->next) == NULL)
+	    ap->fetchTail = NULL;
+	rp->next = NULL;
+
+	if ((cip = FetchReqClient(rp, &ctxnum)) == NULL)
+	    /* clients have gone, result would be discarded anyway */
+	    result = NULL;
+	else if (!ap->status.connected)
+	    result = MakeBadResult(rp->dp->listSize, rp->dp->list, PM_ERR_NOAGENT);
+	else if ((result = SendFetch(rp->dp, ap, cip, ctxnum)) == NULL) {
+	    /* on the wire, wait for agent's response */
+	    ap->fetchReq = rp;
+	    ap->fetchSent++;
+	    __pmtimevalNow(&ap->fetchStart);
+	    break;
+	}
+	FetchReqDone(rp, result);
+    }
+}
+
+/*
+ * Read the response to the fetch request an agent is working on.
+ */
+static void
+RecvFetch(AgentInfo *ap)
+{
+    FetchReq	*rp = ap->fetchReq;
+    DomPmidList	*dp = rp->dp;
+    pmResult	*result = NULL;
+    __pmPDU	*pb;
+    int		pinpdu;
+    int		sts;
+
+    ap->fetchReq = NULL;
+    pinpdu = sts = __pmGetPDU(ap->outFd, ANY_SIZE, _pmcd_timeout, &pb);
+    if (sts > 0)
+	pmcd_trace(TR_RECV_PDU, ap->outFd, sts, (int)((__psint_t)pb & 0xffffffff));
+    if (sts == PDU_RESULT) {
+	if ((sts = __pmDecodeResult(pb, &result)) >= 0)
+	    if (result->numpmid != dp->listSize) {
+#ifdef PCP_DEBUG
+		if (pmDebug & DBG_TRACE_APPL0)
+		    __pmNotifyErr(LOG_ERR, "DoFetch: \"%s\" agent given %d pmIDs, returned %d\n",
+				 ap->pmDomainLabel, dp->listSize, result->numpmid);
+#endif
+		pmFreeResult(result);
+		result = NULL;
+		sts = PM_ERR_IPC;
+	    }
+    }
+    else {
+	if (sts == PDU_ERROR) {
+	    int s;
+	    if ((s = __pmDecodeError(pb, &sts)) < 0)
+		sts = s;
+	    else if (sts >= 0)
+		sts = PM_ERR_GENERIC;
+	    pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_RESULT, sts);
+	}
+	else if (sts >= 0) {
+	    pmcd_trace(TR_WRONG_PDU, ap->outFd, PDU_RESULT, sts);
+	    sts = PM_ERR_IPC;
+	}
+    }
+    if (pinpdu > 0)
+	__pmUnpinPDUBuf(pb);
+
+    if (sts < 0) {
+	result = MakeBadResult(dp->listSize, dp->list, sts);
+
+	if (sts == PM_ERR_PMDANOTREADY) {
+	    /* the agent is indicating it can't handle PDUs for now */
+	    int k;
+	    extern int CheckError(AgentInfo *ap, int sts);
+
+	    for (k = 0; k < dp->listSize; k++)
+		result->vset[k]->numval = PM_ERR_AGAIN;
+	    sts = CheckError(ap, sts);
+	}
+
+#ifdef PCP_DEBUG
+	if (pmDebug & DBG_TRACE_APPL0) {
+	    fprintf(stderr, "RESULT error from \"%s\" agent : %s\n",
+		    ap->pmDomainLabel, pmErrStr(sts));
+	}
+#endif
+    }
+
+    FetchReqDone(rp, result);
+
+    if (sts == PM_ERR_IPC || sts == PM_ERR_TIMEOUT)
+	CleanupAgent(ap, AT_COMM, ap->outFd);
+}
+
+int
+DoFetch(ClientInfo *cip, __pmPDU* pb)
+{
+    int			i;
+    int 		sts;
+    int			ctxnum;
+    __pmTimeval		when;
+    int			nPmids;
+    pmID		*pmidList;
+    int			need;
+    DomPmidList		*dList;
+    FetchCtl		*fcp;
+    FetchReq		*rp;
+    FetchReq		*sp;
+    AgentInfo		*ap;
 
     sts = __pmDecodeFetch(pb, &ctxnum, &when, &nPmids, &pmidList);
     if (sts < 0)
@@ -380,203 +812,261 @@ DoFetch(ClientInfo *cip, __pmPDU* pb)
 	return PM_ERR_NOPROFILE;
     }
 
-    if (nPmids > maxnpmids) {
-	int		need;
-	if (endResult != NULL)
-	    free(endResult);
-	need = (int)sizeof(pmResult) + (nPmids - 1) * (int)sizeof(pmValueSet *);
-	if ((endResult = (pmResult *)malloc(need)) == NULL) {
-	    __pmNoMem("DoFetch.endResult", need, PM_FATAL_ERR);
-	}
-	maxnpmids = nPmids;
+    need = (int)sizeof(FetchCtl) + nPmids * (int)sizeof(int);
+    if ((fcp = (FetchCtl *)malloc(need)) == NULL) {
+	__pmNoMem("DoFetch.fcp", need, PM_FATAL_ERR);
     }
+    fcp->clientId = cip - client;
+    fcp->seq = cip->seq;
+    fcp->ctxnum = ctxnum;
+    fcp->nPmids = nPmids;
+    fcp->slot = (int *)&fcp[1];
+    fcp->dList = dList = SplitPmidList(nPmids, pmidList, fcp->slot);
+    __pmUnpinPDUBuf(pmidList);
 
-    dList = SplitPmidList(nPmids, pmidList);
+    for (i = 0; dList[i].domain != -1; i++)
+	;
+    fcp->nDoms = i + 1;		/* including the "bad" list */
+    if ((fcp->req = (FetchReq *)calloc(fcp->nDoms, sizeof(FetchReq))) == NULL) {
+	__pmNoMem("DoFetch.req", fcp->nDoms * sizeof(FetchReq), PM_FATAL_ERR);
+    }
 
     /* For each domain in the split pmidList, dispatch the per-domain subset
      * of pmIDs to the appropriate agent.  For DSO agents, the pmResult will
-     * come back immediately.  If a request cannot be sent to an agent, a
-     * suitable pmResult (containing metric not available values) will be
-     * returned.
+     * come back immediately.  Requests for other agents are queued on the
+     * agent and sent as soon as the agent has finished with any fetch
+     * requests from other clients, unless an identical request from
+     * another client can answer them too.  nWait holds an extra reference on fcp
+     * until all the requests have been dispatched.
      */
-    __pmFD_ZERO(&waitFds);
-    nWait = 0;
-    maxFd = -1;
-    for (i = 0; dList[i].domain != -1; i++) {
-	j = mapdom[dList[i].domain];
-	results[j] = SendFetch(&dList[i], &agent[j], cip, ctxnum);
-	if (results[j] == NULL) { /* Wait for agent's response */
-	    int fd = agent[j].outFd;
-	    agent[j].status.busy = 1;
-	    __pmFD_SET(fd, &waitFds);
-	    if (fd > maxFd)
-		maxFd = fd;
-	    nWait++;
-	}
-    }
-    /* Construct pmResult for bad-pmID list */
-    if (dList[i].listSize != 0)
-	results[nAgents] = MakeBadResult(dList[i].listSize, dList[i].list, PM_ERR_NOAGENT);
-
-    /* Wait for results to roll in from agents */
-    while (nWait > 0) {
-        __pmFD_COPY(&readyFds, &waitFds);
-	if (nWait > 1) {
-	    timeout.tv_sec = _pmcd_timeout;
-	    timeout.tv_usec = 0;
-
-	    sts = __pmSelectRead(maxFd+1, &readyFds, &timeout);
-
-	    if (sts == 0) {
-		__pmNotifyErr(LOG_INFO, "DoFetch: select timeout");
-
-		/* Timeout, terminate agents with undelivered results */
-		for (i = 0; i < nAgents; i++) {
-		    if (agent[i].status.busy) {
-			/* Find entry in dList for this agent */
-			for (j = 0; dList[j].domain != -1; j++)
-			    if (dList[j].domain == agent[i].pmDomainId)
-				break;
-			results[i] = MakeBadResult(dList[j].listSize,
-						   dList[j].list,
-						   PM_ERR_NOAGENT);
-			pmcd_trace(TR_RECV_TIMEOUT, agent[i].outFd, PDU_RESULT, 0);
-			CleanupAgent(&agent[i], AT_COMM, agent[i].inFd);
-		    }
-		}
-		break;
-	    }
-	    else if (sts < 0) {
-		/* this is not expected to happen! */
-		__pmNotifyErr(LOG_ERR, "DoFetch: fatal select failure: %s\n",
-			netstrerror());
-		Shutdown();
-		exit(1);
-	    }
+    fcp->nWait = 1;
+    for (i = 0; i < fcp->nDoms; i++) {
+	rp = &fcp->req[i];
+	rp->fetch = fcp;
+	rp->dp = &dList[i];
+	if (dList[i].domain == -1) {
+	    /* Construct pmResult for bad-pmID list */
+	    if (dList[i].listSize != 0)
+		rp->result = MakeBadResult(dList[i].listSize, dList[i].list, PM_ERR_NOAGENT);
+	    continue;
+	}
+	ap = &agent[mapdom[dList[i].domain]];
+	if (ap->ipcType == AGENT_DSO) {
+	    rp->result = SendFetch(&dList[i], ap, cip, ctxnum);
+	    continue;
+	}
+	if ((sp = FindFetchReq(ap, rp)) != NULL) {
+	    rp->next = sp->waiters;
+	    sp->waiters = rp;
+	    ap->fetchShared++;
+	}
+	else {
+	    if (ap->fetchTail != NULL)
+		ap->fetchTail->next = rp;
+	    else
+		ap->fetchHead = rp;
+	    ap->fetchTail = rp;
 	}
+	fcp->nWait++;
+    }
 
-	/* Read results from agents that have them ready */
-	for (i = 0; i < nAgents; i++) {
-	    AgentInfo	*ap = &agent[i];
-	    int		pinpdu;
-	    if (!ap->status.busy || !__pmFD_ISSET(ap->outFd, &readyFds))
-		continue;
-	    ap->status.busy = 0;
-	    __pmFD_CLR(ap->outFd, &waitFds);
-	    nWait--;
-	    pinpdu = sts = __pmGetPDU(ap->outFd, ANY_SIZE, _pmcd_timeout, &pb);
-	    if (sts > 0)
-		pmcd_trace(TR_RECV_PDU, ap->outFd, sts, (int)((__psint_t)pb & 0xffffffff));
-	    if (sts == PDU_RESULT) {
-		if ((sts = __pmDecodeResult(pb, &results[i])) >= 0)
-		    if (results[i]->numpmid != aFreq[i]) {
-			pmFreeResult(results[i]);
-			sts = PM_ERR_IPC;
-#ifdef PCP_DEBUG
-			if (pmDebug & DBG_TRACE_APPL0)
-			    __pmNotifyErr(LOG_ERR, "DoFetch: \"%s\" agent given %d pmIDs, returned %d\n",
-					 ap->pmDomainLabel, aFreq[i], results[i]->numpmid);
-#endif
-		    }
-	    }
-	    else {
-		if (sts == PDU_ERROR) {
-		    int s;
-		    if ((s = __pmDecodeError(pb, &sts)) < 0)
-			sts = s;
-		    else if (sts >= 0)
-			sts = PM_ERR_GENERIC;
-		    pmcd_trace(TR_RECV_ERR, ap->outFd, PDU_RESULT, sts);
-		}
-		else if (sts >= 0) {
-		    pmcd_trace(TR_WRONG_PDU, ap->outFd, PDU_RESULT, sts);
-		    sts = PM_ERR_IPC;
-		}
-	    }
-	    if (pinpdu > 0)
-		__pmUnpinPDUBuf(pb);
-
-	    if (sts < 0) {
-		/* Find entry in dList for this agent */
-		for (j = 0; dList[j].domain != -1; j++)
-		    if (dList[j].domain == agent[i].pmDomainId)
-			break;
-		results[i] = MakeBadResult(dList[j].listSize,
-					   dList[j].list, sts);
-
-		if (sts == PM_ERR_PMDANOTREADY) {
-		    /* the agent is indicating it can't handle PDUs for now */
-		    int k;
-		    extern int CheckError(AgentInfo *ap, int sts);
-
-		    for (k = 0; k < dList[j].listSize; k++)
-			results[i]->vset[k]->numval = PM_ERR_AGAIN;
-		    sts = CheckError(&agent[i], sts);
-		}
+    if (fcp->nWait > 1) {
+	cip->status.fetching = 1;
+	for (i = 0; dList[i].domain != -1; i++) {
+	    ap = &agent[mapdom[dList[i].domain]];
+	    if (ap->ipcType != AGENT_DSO)
+		StartAgentFetch(ap);
+	}
+    }
+    if (--fcp->nWait == 0)
+	FinishFetch(fcp);
 
-#ifdef PCP_DEBUG
-		if (pmDebug & DBG_TRACE_APPL0) {
-		    fprintf(stderr, "RESULT error from \"%s\" agent : %s\n",
-			    ap->pmDomainLabel, pmErrStr(sts));
-		}
-#endif
-		if (sts == PM_ERR_IPC || sts == PM_ERR_TIMEOUT)
-		    CleanupAgent(ap, AT_COMM, ap->outFd);
-	    }
+    return 0;
+}
+
+/*
+ * Add the output file descriptors of agents with a fetch outstanding to
+ * the select set, returning the new select nfds value.
+ */
+int
+FetchAgentFds(__pmFdSet *fds, int nfds)
+{
+    int		i;
+    AgentInfo	*ap;
+
+    for (i = 0; i < nAgents; i++) {
+	ap = &agent[i];
+	if (ap->fetchReq == NULL)
+	    continue;
+	__pmFD_SET(ap->outFd, fds);
+	if (ap->outFd >= nfds)
+	    nfds = ap->outFd + 1;
+    }
+    return nfds;
+}
+
+/*
+ * Time until the earliest outstanding agent fetch times out, or NULL
+ * if there are no fetches outstanding that can time out.
+ */
+struct timeval *
+FetchTimeout(struct timeval *tv)
+{
+    int			i;
+    int			found = 0;
+    struct timeval	now;
+    AgentInfo		*ap;
+
+    if (_pmcd_timeout <= 0)
+	/* timeouts turned off */
+	return NULL;
+    for (i = 0; i < nAgents; i++) {
+	ap = &agent[i];
+	if (ap->fetchReq == NULL)
+	    continue;
+	if (!found || __pmtimevalSub(&ap->fetchStart, tv) < 0)
+	    *tv = ap->fetchStart;
+	found = 1;
+    }
+    if (!found)
+	return NULL;
+    tv->tv_sec += _pmcd_timeout;
+
+    __pmtimevalNow(&now);
+    if (__pmtimevalSub(tv, &now) <= 0) {
+	tv->tv_sec = 0;
+	tv->tv_usec = 0;
+    }
+    else {
+	tv->tv_sec -= now.tv_sec;
+	tv->tv_usec -= now.tv_usec;
+	if (tv->tv_usec < 0) {
+	    tv->tv_usec += 1000000;
+	    tv->tv_sec--;
 	}
     }
+    return tv;
+}
 
-    endResult->numpmid = nPmids;
-    __pmtimevalNow(&endResult->timestamp);
-    /* The order of the pmIDs in the per-domain results is the same as in the
-     * original request, but on a per-domain basis.  resIndex is an array of
-     * indeces (one per agent) of the next metric to be retrieved from each
-     * per-domain result's vset.
-     */
-    memset(resIndex, 0, (nAgents + 1) * sizeof(resIndex[0]));
+/*
+ * Collect results from agents that have them ready, then send them the
+ * next queued request.
+ */
+void
+HandleFetchAgents(__pmFdSet *readyFds)
+{
+    int		i;
+    AgentInfo	*ap;
 
-    for (i = 0; i < nPmids; i++) {
-	j = mapdom[((__pmID_int *)&pmidList[i])->domain];
-	endResult->vset[i] = results[j]->vset[resIndex[j]++];
+    for (i = 0; i < nAgents; i++) {
+	ap = &agent[i];
+	if (ap->fetchReq == NULL || !__pmFD_ISSET(ap->outFd, readyFds))
+	    continue;
+	RecvFetch(ap);
+	StartAgentFetch(ap);
     }
-    pmcd_trace(TR_XMIT_PDU, cip->fd, PDU_RESULT, endResult->numpmid);
+}
 
-    sts = 0;
-    if (cip->status.changes) {
-	/* notify client of PMCD state change */
-	sts = __pmSendError(cip->fd, FROM_ANON, (int)cip->status.changes);
-	if (sts > 0)
-	    sts = 0;
-	cip->status.changes = 0;
+/*
+ * Terminate agents that have not delivered a fetch result in time.
+ */
+void
+CheckFetchTimeouts(void)
+{
+    int			i;
+    struct timeval	now;
+    AgentInfo		*ap;
+    FetchReq		*rp;
+
+    if (_pmcd_timeout <= 0)
+	/* timeouts turned off */
+	return;
+    __pmtimevalNow(&now);
+    for (i = 0; i < nAgents; i++) {
+	ap = &agent[i];
+	if ((rp = ap->fetchReq) == NULL ||
+	    __pmtimevalSub(&now, &ap->fetchStart) < _pmcd_timeout)
+	    continue;
+	__pmNotifyErr(LOG_INFO, "DoFetch: timeout waiting for \"%s\" agent",
+			ap->pmDomainLabel);
+	ap->fetchReq = NULL;
+	FetchReqDone(rp, MakeBadResult(rp->dp->listSize, rp->dp->list,
+					PM_ERR_NOAGENT));
+	pmcd_trace(TR_RECV_TIMEOUT, ap->outFd, PDU_RESULT, 0);
+	CleanupAgent(ap, AT_COMM, ap->inFd);
     }
-    if (sts == 0)
-	sts = __pmSendResult(cip->fd, FROM_ANON, endResult);
+}
 
-    if (sts < 0) {
-	pmcd_trace(TR_XMIT_ERR, cip->fd, PDU_RESULT, sts);
-	CleanupClient(cip, sts);
+/*
+ * Send queued fetch requests to any agents that are now idle, e.g. after
+ * a DrainAgentFetch().
+ */
+void
+StartFetchAgents(void)
+{
+    int		i;
+
+    for (i = 0; i < nAgents; i++) {
+	if (agent[i].fetchHead != NULL)
+	    StartAgentFetch(&agent[i]);
     }
+}
 
-    /*
-     * pmFreeResult() all the accumulated results.
-     */
-    for (i = 0; dList[i].domain != -1; i++) {
-	j = mapdom[dList[i].domain];
-	if (agent[j].ipcType == AGENT_DSO && agent[j].status.connected &&
-	    !agent[j].status.madeDsoResult)
-	    /* Living DSO's manage their own pmResult skeleton unless
-	     * MakeBadResult was called to create the result.  The value sets
-	     * within the skeleton need to be freed though!
-	     */
-	    __pmFreeResultValues(results[j]);
-	else
-	    /* For others it is dynamically allocated in __pmDecodeResult or
-	     * MakeBadResult
-	     */
-	    pmFreeResult(results[j]);
+/*
+ * Wait for the result of any fetch the agent is working on, so that
+ * some other request/response exchange with the agent can be done.
+ * Further queued fetch requests are not started.  Returns PM_ERR_NOAGENT
+ * if the agent is no longer connected.
+ */
+int
+DrainAgentFetch(AgentInfo *ap)
+{
+    if (ap->fetchReq != NULL)
+	RecvFetch(ap);
+    return ap->status.connected ? 0 : PM_ERR_NOAGENT;
+}
+
+/*
+ * Agent is being cleaned up, complete its outstanding and queued fetch
+ * requests with "no agent" results.
+ */
+void
+AbortAgentFetch(AgentInfo *ap)
+{
+    FetchReq	*rp;
+
+    if ((rp = ap->fetchReq) != NULL) {
+	ap->fetchReq = NULL;
+	FetchReqDone(rp, MakeBadResult(rp->dp->listSize, rp->dp->list,
+					PM_ERR_NOAGENT));
     }
-    if (results[nAgents] != NULL)
-	pmFreeResult(results[nAgents]);
-    __pmUnpinPDUBuf(pmidList);
-    return 0;
+    while ((rp = ap->fetchHead) != NULL) {
+	if ((ap->fetchHead = rp->next) == NULL)
+	    ap->fetchTail = NULL;
+	rp->next = NULL;
+	FetchReqDone(rp, MakeBadResult(rp->dp->listSize, rp->dp->list,
+					PM_ERR_NOAGENT));
+    }
+}
+
+/*
+ * Complete all fetches synchronously, e.g. before the agent table is
+ * rebuilt on SIGHUP.
+ */
+void
+FlushFetches(void)
+{
+    int		i;
+    int		pending;
+
+    do {
+	pending = 0;
+	for (i = 0; i < nAgents; i++) {
+	    StartAgentFetch(&agent[i]);
+	    if (agent[i].fetchReq != NULL) {
+		RecvFetch(&agent[i]);
+		pending = 1;
+	    }
+	}
+    } while (pending);
 }
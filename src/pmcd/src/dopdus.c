@@ -81,6 +81,8 @@ DoText(ClientInfo *cp, __pmPDU* pb)
 					  ap->ipc.dso.dispatch.version.any.ext);
     }
     else {
+	if (DrainAgentFetch(ap) < 0)
+	    return PM_ERR_NOAGENT;
 	if (ap->status.notReady)
 	    return PM_ERR_AGAIN;
 	pmcd_trace(TR_XMIT_PDU, ap->inFd, PDU_TEXT_REQ, ident);
@@ -206,6 +208,8 @@ DoDesc(ClientInfo *cp, __pmPDU *pb)
 					ap->ipc.dso.dispatch.version.any.ext);
     }
     else {
+	if (DrainAgentFetch(ap) < 0)
+	    return PM_ERR_NOAGENT;
 	if (ap->status.notReady)
 	    return PM_ERR_AGAIN;
 	pmcd_trace(TR_XMIT_PDU, ap->inFd, PDU_DESC_REQ, (int)pmid);
@@ -299,6 +303,10 @@ DoInstance(ClientInfo *cp, __pmPDU* pb)
 					ap->ipc.dso.dispatch.version.any.ext);
     }
     else {
+	if (DrainAgentFetch(ap) < 0) {
+	    if (name != NULL) free(name);
+	    return PM_ERR_NOAGENT;
+	}
 	if (ap->status.notReady) {
 	    if (name != NULL) free(name);
 	    return PM_ERR_AGAIN;
@@ -399,6 +407,10 @@ DoPMNSIDs(ClientInfo *cp, __pmPDU *pb)
 	}
 	else {
 	    /* daemon PMDA ... ship request on */
+	    if (DrainAgentFetch(ap) < 0) {
+		sts = PM_ERR_NOAGENT;
+		goto fail;
+	    }
 	    if (ap->status.notReady)
 		return PM_ERR_AGAIN;
 	    pmcd_trace(TR_XMIT_PDU, ap->inFd, PDU_PMNS_IDS, 1);
@@ -514,7 +526,9 @@ DoPMNSNames(ClientInfo *cp, __pmPDU *pb)
 	    else {
 		/* daemon PMDA ... ship request on */
 		int		fdfail = -1;
-		if (ap->status.notReady)
+		if (DrainAgentFetch(ap) < 0)
+		    lsts = PM_ERR_NOAGENT;
+		else if (ap->status.notReady)
 		    lsts = PM_ERR_AGAIN;
 		else {
 		    pmcd_trace(TR_XMIT_PDU, ap->inFd, PDU_PMNS_NAMES, 1);
@@ -643,7 +657,9 @@ DoPMNSChild(ClientInfo *cp, __pmPDU *pb)
 	else {
 	    /* daemon PMDA ... ship request on */
 	    int		fdfail = -1;
-	    if (ap->status.notReady)
+	    if (DrainAgentFetch(ap) < 0)
+		sts = PM_ERR_NOAGENT;
+	    else if (ap->status.notReady)
 		sts = PM_ERR_AGAIN;
 	    else {
 		pmcd_trace(TR_XMIT_PDU, ap->inFd, PDU_PMNS_CHILD, 1);
@@ -826,7 +842,7 @@ traverse_dynamic(ClientInfo *cp, char *start, int *num_names, char ***names)
 	    else {
 		/* daemon PMDA ... ship request on */
 		int		fdfail = -1;
-		if (ap->status.notReady)
+		if (DrainAgentFetch(ap) < 0 || ap->status.notReady)
 		    continue;
 		pmcd_trace(TR_XMIT_PDU, ap->inFd, PDU_PMNS_TRAVERSE, 1);
 		sts = __pmSendTraversePMNSReq(ap->inFd, cp - client, namelist[0]);
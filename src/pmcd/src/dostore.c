@@ -164,7 +164,9 @@ DoStore(ClientInfo *cp, __pmPDU* pb)
 				       ap->ipc.dso.dispatch.version.any.ext);
 	}
 	else {
-	    if (ap->status.notReady == 0) {
+	    if (DrainAgentFetch(ap) < 0)
+		s = PM_ERR_NOAGENT;
+	    else if (ap->status.notReady == 0) {
 		/* agent is ready for PDUs */
 		pmcd_trace(TR_XMIT_PDU, ap->inFd, PDU_RESULT, dResult[i]->numpmid);
 		s = __pmSendResult(ap->inFd, cp - client, dResult[i]);
@@ -528,6 +528,7 @@ SignalRestart(void)
     fprintf(stderr, "\nCurrent PMCD clients ...\n");
     ShowClients(stderr);
     ResetBadHosts();
+    FlushFetches();
     ParseRestartAgents(configFileName);
 }
 
@@ -694,7 +695,7 @@ CheckNewClient(__pmFdSet * fdset, int rfd, int family)
     }
 }
 
-/* Loop, synchronously processing requests from clients. */
+/* Loop, processing requests from clients and results from agents. */
 
 static void
 ClientLoop(void)
@@ -704,6 +705,7 @@ ClientLoop(void)
     int		checkAgents;
     int		reload_ns = 0;
     __pmFdSet	readableFds;
+    struct timeval	timeout;
 
     for (;;) {
 
@@ -713,6 +715,14 @@ ClientLoop(void)
 	readableFds = clientFds;
 	maxFd = maxClientFd + 1;
 
+	/* Clients waiting on agents for a fetch result don't get to send
+	 * any more PDUs until the result has been sent.
+	 */
+	for (i = 0; i < nClients; i++) {
+	    if (client[i].status.connected && client[i].status.fetching)
+		__pmFD_CLR(client[i].fd, &readableFds);
+	}
+
 	/* If an agent was not ready, it may send an ERROR PDU to indicate it
 	 * is now ready.  Add such agents to the list of file descriptors.
 	 */
@@ -733,7 +743,10 @@ ClientLoop(void)
 	    }
 	}
 
-	sts = __pmSelectRead(maxFd, &readableFds, NULL);
+	/* Agents working on fetch requests will send a result PDU. */
+	maxFd = FetchAgentFds(&readableFds, maxFd);
+
+	sts = __pmSelectRead(maxFd, &readableFds, FetchTimeout(&timeout));
 	if (sts > 0) {
 	    if (pmDebug & DBG_TRACE_APPL0)
 		for (i = 0; i <= maxClientFd; i++)
@@ -743,12 +756,15 @@ ClientLoop(void)
 	    __pmServerAddNewClients(&readableFds, CheckNewClient);
 	    if (checkAgents)
 		reload_ns = HandleReadyAgents(&readableFds);
+	    HandleFetchAgents(&readableFds);
 	    HandleClientInput(&readableFds);
 	}
 	else if (sts == -1 && neterror() != EINTR) {
 	    __pmNotifyErr(LOG_ERR, "ClientLoop select: %s\n", netstrerror());
 	    break;
 	}
+	CheckFetchTimeouts();
+	StartFetchAgents();
 	if (restart) {
 	    restart = 0;
 	    reload_ns = 1;
@@ -73,6 +73,8 @@ typedef struct {
 
 /* The agent table and its size. */
 
+struct fetchreq;			/* asynchronous fetch, see dofetch.c */
+
 typedef struct {
     int        pmDomainId;		/* PMD identifier */
     int        ipcType;			/* DSO, socket or pipe */
@@ -96,6 +98,12 @@ typedef struct {
 	    flags : 16;			/* Agent-supplied connection flags */
     } status;
     int		reason;			/* if ! connected */
+    struct fetchreq *fetchReq;		/* fetch request awaiting a result */
+    struct fetchreq *fetchHead;		/* fetch requests yet to be sent */
+    struct fetchreq *fetchTail;
+    struct timeval fetchStart;		/* when fetchReq was sent */
+    unsigned int fetchSent;		/* fetch PDUs sent to agent */
+    unsigned int fetchShared;		/* fetches answered by another's PDU */
     union {				/* per-ipcType info */
 	DsoInfo    dso;
 	SocketInfo socket;
@@ -154,6 +162,9 @@ extern int	pmdarootfd;
 /* timeout to PMDAs (secs) */
 PMCD_DATA extern int	_pmcd_timeout;
 
+/* window for sharing a fetch already sent to an agent (msecs) */
+PMCD_DATA extern int	_pmcd_coalesce;
+
 /* timeout for credentials */
 extern int	_creds_timeout;
 
@@ -211,6 +222,18 @@ extern int DoPMNSNames(ClientInfo *, __pmPDU *);
 extern int DoPMNSChild(ClientInfo *, __pmPDU *);
 extern int DoPMNSTraverse(ClientInfo *, __pmPDU *);
 
+/*
+ * Asynchronous fetch support routines
+ */
+extern int FetchAgentFds(__pmFdSet *, int);
+extern struct timeval *FetchTimeout(struct timeval *);
+extern void HandleFetchAgents(__pmFdSet *);
+extern void CheckFetchTimeouts(void);
+extern void StartFetchAgents(void);
+extern int DrainAgentFetch(AgentInfo *);
+extern void AbortAgentFetch(AgentInfo *);
+extern void FlushFetches(void);
+
 /*
  * General purpose routines
  */
@@ -81,6 +81,7 @@ enum {
 	CLUSTER_NET_SNMP6,	/* 58 /proc/net/snmp6 */
 	CLUSTER_MD,		/* 59 disk.md.* (not status) */
 	CLUSTER_MDADM,		/* 60 disk.md.status */
+	CLUSTER_REFRESH,	/* 61 pmda.refresh, linux PMDA refresh statistics */
 
 	NUM_CLUSTERS		/* one more than highest numbered cluster */
 };
@@ -44,6 +44,7 @@ enum {
 	ICMPMSG_INDOM,          /* 23 - icmp message types */
 	DM_INDOM,		/* 24 - device mapper devices */
 	MD_INDOM,		/* 25 - multi-device devices */
+	REFRESH_INDOM,		/* 26 - refreshed clusters */
 
 	NUM_INDOMS		/* one more than highest numbered cluster */
 };
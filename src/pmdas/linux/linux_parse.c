@@ -0,0 +1,313 @@
+/*
+ * Linux /proc file parsing
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include <ctype.h>
+#include "pmapi.h"
+#include "impl.h"
+#include "pmda.h"
+#include "indom.h"
+#include "linux_parse.h"
+
+/* initial buffer size, large enough for most files in one read */
+#define LINUX_FILE_BUFSIZE	4096
+
+int
+linux_file_read(linux_file_t *lf, int flags)
+{
+    char	path[MAXPATHLEN];
+    char	*buf;
+    size_t	size;
+    ssize_t	bytes;
+    int		fd = (flags & LINUX_FILE_NOCACHE) ? -1 : lf->fd;
+    int		sts = 0;
+
+    lf->length = 0;
+    lf->cursor = NULL;
+
+    if (fd < 0) {
+	snprintf(path, sizeof(path), "%s%s", linux_statspath, lf->path);
+	if ((fd = open(path, O_RDONLY)) < 0)
+	    return -oserror();
+	if (!(flags & LINUX_FILE_NOCACHE))
+	    lf->fd = fd;
+    }
+
+    for (;;) {
+	/* always leave space for the terminating NUL */
+	if (lf->length + 1 >= lf->size) {
+	    size = lf->size ? lf->size * 2 : LINUX_FILE_BUFSIZE;
+	    if ((buf = (char *)realloc(lf->buf, size)) == NULL) {
+		sts = -ENOMEM;
+		break;
+	    }
+	    lf->buf = buf;
+	    lf->size = size;
+	}
+	bytes = pread(fd, lf->buf + lf->length,
+			lf->size - lf->length - 1, lf->length);
+	if (bytes < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    sts = -oserror();
+	    break;
+	}
+	if (bytes == 0)
+	    break;
+	lf->length += bytes;
+    }
+
+    if (fd != lf->fd)
+	close(fd);
+    else if (sts < 0 && sts != -ENOMEM) {
+	/* reopen on the next refresh */
+	close(fd);
+	lf->fd = -1;
+    }
+
+    if (lf->buf) {
+	lf->buf[lf->length] = '\0';
+	lf->cursor = lf->buf;
+    }
+    return sts < 0 ? sts : (int)lf->length;
+}
+
+char *
+linux_file_line(linux_file_t *lf)
+{
+    char	*line = lf->cursor;
+    char	*end;
+
+    if (line == NULL || *line == '\0')
+	return NULL;
+    if ((end = strchr(line, '\n')) != NULL) {
+	*end = '\0';
+	lf->cursor = end + 1;
+    }
+    else
+	lf->cursor = line + strlen(line);
+    return line;
+}
+
+char *
+linux_parse_word(char **cursor)
+{
+    char	*p = *cursor;
+    char	*word;
+
+    while (isspace((int)*p))
+	p++;
+    if (*p == '\0') {
+	*cursor = p;
+	return NULL;
+    }
+    for (word = p; *p && !isspace((int)*p); p++)
+	;
+    if (*p != '\0')
+	*p++ = '\0';
+    *cursor = p;
+    return word;
+}
+
+int
+linux_parse_u64(char **cursor, __uint64_t *value)
+{
+    char	*p = *cursor;
+    __uint64_t	v = 0;
+    int		negative = 0;
+    int		overflow = 0;
+    int		digit;
+
+    while (isspace((int)*p))
+	p++;
+    if (*p == '-' || *p == '+')
+	negative = (*p++ == '-');
+    if (!isdigit((int)*p))
+	return 0;
+    for (; isdigit((int)*p); p++) {
+	digit = *p - '0';
+	if (v > (ULLONG_MAX - digit) / 10)
+	    overflow = 1;
+	v = v * 10 + digit;
+    }
+    if (overflow)
+	v = ULLONG_MAX;
+    else if (negative)
+	v = -v;
+    *value = v;
+    *cursor = p;
+    return 1;
+}
+
+/*
+ * Perfect hashing via "hash, displace and compress": keys are first
+ * hashed into buckets (about four keys each), then, largest bucket
+ * first, a seed is searched for which places every key in the bucket
+ * into a distinct unused slot of a table at least twice the number of
+ * keys.  A lookup is then two hashes of the key and one comparison.
+ */
+
+enum {
+	KEYTAB_UNBUILT,
+	KEYTAB_BUILT,
+	KEYTAB_LINEAR		/* could not be built, search the table */
+};
+
+#define KEYTAB_MAXSEED	(1<<16)
+
+static inline unsigned int
+keytab_hash(const char *key, size_t length, unsigned int seed)
+{
+    unsigned int	h = 2166136261U ^ (seed * 0x9e3779b9U);
+    size_t		i;
+
+    for (i = 0; i < length; i++) {
+	h ^= (unsigned char)key[i];
+	h *= 16777619U;
+    }
+    return h ^ (h >> 15);
+}
+
+static inline const char *
+keytab_key(linux_keytab_t *kt, int index)
+{
+    return *(const char **)(kt->table + index * kt->stride);
+}
+
+static int
+keytab_build(linux_keytab_t *kt)
+{
+    unsigned int	*bucket = NULL;		/* bucket of each key */
+    unsigned int	*order = NULL;		/* buckets, largest first */
+    unsigned int	*count = NULL;		/* keys in each bucket */
+    unsigned int	slot[64];
+    unsigned int	nkeys, nslots, seed, b, i, j, k, n;
+    const char		*key;
+    int			sts = -ENOMEM;
+
+    for (nkeys = 0; keytab_key(kt, nkeys) != NULL; nkeys++)
+	;
+    for (nslots = 8; nslots < 2 * nkeys; nslots <<= 1)
+	;
+    kt->nbuckets = (nkeys + 3) / 4 + 1;
+    kt->mask = nslots - 1;
+    kt->seeds = (unsigned int *)calloc(kt->nbuckets, sizeof(unsigned int));
+    kt->slots = (int *)malloc(nslots * sizeof(int));
+    bucket = (unsigned int *)malloc((nkeys + 1) * sizeof(unsigned int));
+    order = (unsigned int *)malloc(kt->nbuckets * sizeof(unsigned int));
+    count = (unsigned int *)calloc(kt->nbuckets, sizeof(unsigned int));
+    if (!kt->seeds || !kt->slots || !bucket || !order || !count)
+	goto done;
+    for (i = 0; i < nslots; i++)
+	kt->slots[i] = -1;
+
+    for (i = 0; i < nkeys; i++) {
+	key = keytab_key(kt, i);
+	/* duplicate keys resolve to the first entry, as a linear search */
+	for (j = 0; j < i; j++)
+	    if (strcmp(key, keytab_key(kt, j)) == 0)
+		break;
+	if (j < i) {
+	    bucket[i] = kt->nbuckets;	/* not hashed */
+	    continue;
+	}
+	bucket[i] = keytab_hash(key, strlen(key), 0) % kt->nbuckets;
+	count[bucket[i]]++;
+    }
+
+    /* insertion sort, there are few buckets and fewer large ones */
+    for (i = 0; i < kt->nbuckets; i++) {
+	for (j = i; j > 0 && count[order[j-1]] < count[i]; j--)
+	    order[j] = order[j-1];
+	order[j] = i;
+    }
+
+    sts = -E2BIG;
+    for (b = 0; b < kt->nbuckets && count[order[b]] > 0; b++) {
+	if (count[order[b]] > sizeof(slot) / sizeof(slot[0]))
+	    goto done;
+	for (seed = 1; seed < KEYTAB_MAXSEED; seed++) {
+	    for (i = n = 0; i < nkeys; i++) {
+		if (bucket[i] != order[b])
+		    continue;
+		key = keytab_key(kt, i);
+		slot[n] = keytab_hash(key, strlen(key), seed) & kt->mask;
+		if (kt->slots[slot[n]] != -1)
+		    break;
+		for (k = 0; k < n; k++)
+		    if (slot[k] == slot[n])
+			break;
+		if (k < n)
+		    break;
+		n++;
+	    }
+	    if (i == nkeys)
+		break;
+	}
+	if (seed == KEYTAB_MAXSEED)
+	    goto done;
+	kt->seeds[order[b]] = seed;
+	for (i = n = 0; i < nkeys; i++)
+	    if (bucket[i] == order[b])
+		kt->slots[slot[n++]] = i;
+    }
+    sts = 0;
+
+done:
+    free(bucket);
+    free(order);
+    free(count);
+    if (sts < 0) {
+	free(kt->seeds);
+	free(kt->slots);
+	kt->seeds = NULL;
+	kt->slots = NULL;
+    }
+    return sts;
+}
+
+int
+linux_keytab_lookup(linux_keytab_t *kt, const char *key, size_t length)
+{
+    const char	*name;
+    int		index;
+
+    if (kt->state == KEYTAB_UNBUILT) {
+	if (keytab_build(kt) < 0) {
+	    __pmNotifyErr(LOG_WARNING,
+		"linux_keytab_lookup: no perfect hash for \"%s\" table, "
+		"using linear search\n", keytab_key(kt, 0));
+	    kt->state = KEYTAB_LINEAR;
+	}
+	else
+	    kt->state = KEYTAB_BUILT;
+    }
+
+    if (kt->state == KEYTAB_LINEAR) {
+	for (index = 0; (name = keytab_key(kt, index)) != NULL; index++)
+	    if (strncmp(name, key, length) == 0 && name[length] == '\0')
+		return index;
+	return -1;
+    }
+
+    index = keytab_hash(key, length, 0) % kt->nbuckets;
+    index = kt->slots[keytab_hash(key, length, kt->seeds[index]) & kt->mask];
+    if (index < 0)
+	return -1;
+    name = keytab_key(kt, index);
+    if (strncmp(name, key, length) != 0 || name[length] != '\0')
+	return -1;
+    return index;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#ifndef _LINUX_PARSE_H
+#define _LINUX_PARSE_H
+/*
+ * Shared parsing for the text files below /proc (relative to
+ * linux_statspath), e.g. :
+ *
+ *	static linux_file_t meminfo = LINUX_FILE("/proc/meminfo");
+ *
+ *	if ((sts = linux_file_read(&meminfo, 0)) < 0)
+ *	    return sts;
+ *	while ((line = linux_file_line(&meminfo)) != NULL) {
+ *	    ...
+ *	}
+ *
+ * The file descriptor is kept open and the whole file is read into a
+ * buffer that is reused (and only ever grown) across refreshes, using
+ * pread(2) from offset zero.  Lines are terminated in place within the
+ * buffer, and can be split further with linux_parse_word() and
+ * linux_parse_u64(), which modify nothing beyond that same buffer.
+ */
+
+typedef struct linux_file {
+	const char	*path;		/* below linux_statspath */
+	int		fd;		/* kept open between refreshes */
+	char		*buf;		/* contents from the last read */
+	size_t		size;		/* allocated size of buf */
+	size_t		length;		/* bytes in buf from the last read */
+	char		*cursor;	/* start of the next line */
+} linux_file_t;
+
+#define LINUX_FILE(path)	{ (path), -1 }
+
+/* open and read (then close) afresh, e.g. in another namespace */
+#define LINUX_FILE_NOCACHE	(1<<0)
+
+extern int linux_file_read(linux_file_t *, int);
+extern char *linux_file_line(linux_file_t *);
+
+/* next word in a line, NUL-terminated in place; NULL at end of line */
+extern char *linux_parse_word(char **);
+/* next number in a line, with strtoull(3) semantics; 0 if none found */
+extern int linux_parse_u64(char **, __uint64_t *);
+
+/*
+ * Keyed files (name/value lines, or header/value line pairs) use a
+ * perfect hash built once (on first lookup) over a static table, which
+ * is an array of structures, each starting with a key string and with
+ * a NULL key terminating the table, e.g. :
+ *
+ *	static linux_keytab_t vmstat_keys = LINUX_KEYTAB(vmstat_fields);
+ *
+ *	if ((i = linux_keytab_lookup(&vmstat_keys, name, length)) >= 0)
+ *	    *vmstat_fields[i].offset = value;
+ *
+ * The lookup returns the index of the (first) entry with that key,
+ * or -1 if there is none, and costs one hash and one comparison.
+ */
+
+typedef struct linux_keytab {
+	const char	*table;		/* array of structures ... */
+	size_t		stride;		/* ... each starting with a key */
+	int		state;		/* not built, built, or linear */
+	unsigned int	nbuckets;	/* first level hash buckets */
+	unsigned int	mask;		/* number of slots - 1 */
+	unsigned int	*seeds;		/* per-bucket second level seed */
+	int		*slots;		/* table index, or -1 if unused */
+} linux_keytab_t;
+
+#define LINUX_KEYTAB(table)	{ (const char *)(table), sizeof((table)[0]) }
+
+extern int linux_keytab_lookup(linux_keytab_t *, const char *, size_t);
+
+#endif /* _LINUX_PARSE_H */
@@ -281,6 +281,40 @@ static pmdaInstid nfs4_svr_indom_id[NR_RPC4_SVR_COUNTERS] = {
 	{ 59, "reclaim_comp" },
 };
 
+/* instance identifiers are the cluster numbers of refreshed clusters */
+static pmdaInstid refresh_indom_id[] = {
+	{ CLUSTER_STAT, "stat" },
+	{ CLUSTER_MEMINFO, "meminfo" },
+	{ CLUSTER_LOADAVG, "loadavg" },
+	{ CLUSTER_NET_DEV, "net_dev" },
+	{ CLUSTER_INTERRUPTS, "interrupts" },
+	{ CLUSTER_FILESYS, "filesys" },
+	{ CLUSTER_SWAPDEV, "swapdev" },
+	{ CLUSTER_NET_NFS, "net_rpc" },
+	{ CLUSTER_PARTITIONS, "partitions" },
+	{ CLUSTER_NET_SOCKSTAT, "net_sockstat" },
+	{ CLUSTER_KERNEL_UNAME, "uname" },
+	{ CLUSTER_NET_SNMP, "net_snmp" },
+	{ CLUSTER_SCSI, "scsi" },
+	{ CLUSTER_CPUINFO, "cpuinfo" },
+	{ CLUSTER_NET_TCP, "net_tcp" },
+	{ CLUSTER_SEM_LIMITS, "sem_limits" },
+	{ CLUSTER_MSG_LIMITS, "msg_limits" },
+	{ CLUSTER_SHM_LIMITS, "shm_limits" },
+	{ CLUSTER_UPTIME, "uptime" },
+	{ CLUSTER_VFS, "vfs" },
+	{ CLUSTER_VMSTAT, "vmstat" },
+	{ CLUSTER_NET_ADDR, "net_addr" },
+	{ CLUSTER_TMPFS, "tmpfs" },
+	{ CLUSTER_SYSFS_KERNEL, "sysfs_kernel" },
+	{ CLUSTER_NUMA_MEMINFO, "numa_meminfo" },
+	{ CLUSTER_NET_NETSTAT, "net_netstat" },
+	{ CLUSTER_SHM_INFO, "shm_info" },
+	{ CLUSTER_NET_SOFTNET, "net_softnet" },
+	{ CLUSTER_NET_SNMP6, "net_snmp6" },
+};
+#define NR_REFRESH_CLUSTERS (sizeof(refresh_indom_id)/sizeof(refresh_indom_id[0]))
+
 static pmdaIndom indomtab[] = {
     { CPU_INDOM, 0, NULL },
     { DISK_INDOM, 0, NULL }, /* cached */
@@ -308,6 +342,7 @@ static pmdaIndom indomtab[] = {
     { ICMPMSG_INDOM, NR_ICMPMSG_COUNTERS, _pm_proc_net_snmp_indom_id },
     { DM_INDOM, 0, NULL }, /* cached */
     { MD_INDOM, 0, NULL }, /* cached */
+    { REFRESH_INDOM, NR_REFRESH_CLUSTERS, refresh_indom_id },
 };
 
 
@@ -4490,6 +4525,26 @@ static pmdaMetric metrictab[] = {
     /* network.softnet.flow_limit_count */
     { NULL, { PMDA_PMID(CLUSTER_NET_SOFTNET,5), PM_TYPE_U64, PM_INDOM_NULL,
       PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) }, },
+
+/*
+ * pmda.refresh cluster
+ */
+
+    /* pmda.refresh.interval */
+    { NULL, { PMDA_PMID(CLUSTER_REFRESH,0), PM_TYPE_U32, REFRESH_INDOM,
+      PM_SEM_DISCRETE, PMDA_PMUNITS(0,1,0,0,PM_TIME_MSEC,0) }, },
+
+    /* pmda.refresh.count */
+    { NULL, { PMDA_PMID(CLUSTER_REFRESH,1), PM_TYPE_U64, REFRESH_INDOM,
+      PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) }, },
+
+    /* pmda.refresh.cached */
+    { NULL, { PMDA_PMID(CLUSTER_REFRESH,2), PM_TYPE_U64, REFRESH_INDOM,
+      PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) }, },
+
+    /* pmda.refresh.time */
+    { NULL, { PMDA_PMID(CLUSTER_REFRESH,3), PM_TYPE_U64, REFRESH_INDOM,
+      PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_USEC,0) }, },
 };
 
 typedef struct {
@@ -4532,56 +4587,253 @@ linux_ctx_container(int ctx)
     return NULL;
 }
 
+/*
+ * Refresh statistics and the minimum age (interval) of values from each
+ * cluster.  A cluster with a non-zero interval is only refreshed when
+ * its values from the last refresh are older than that interval, else
+ * the last values parsed are used again, so that back-to-back requests
+ * (e.g. from several clients) and the more expensive clusters (disks,
+ * network addresses, filesystems) can be kept off the fetch path.
+ * All times are in microseconds.
+ */
+typedef struct {
+    __uint64_t	interval;	/* minimum age before refreshing again */
+    __uint64_t	count;		/* refreshes of this cluster */
+    __uint64_t	cached;		/* requests satisfied without a refresh */
+    __uint64_t	time;		/* total time spent refreshing */
+} linux_refresh_t;
+
+static linux_refresh_t	refreshtab[NUM_CLUSTERS];
+static __uint64_t	refresh_stamp[NUM_REFRESHES];	/* last refresh time */
+
+static __uint64_t
+refresh_clock(void)
+{
+    struct timeval	now;
+
+    __pmtimevalNow(&now);
+    return (__uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+/* cluster which a (possibly fine-grained) refresh index belongs to */
+static int
+refresh_cluster(int index)
+{
+    switch (index) {
+    case REFRESH_NET_MTU:
+    case REFRESH_NET_SPEED:
+    case REFRESH_NET_DUPLEX:
+    case REFRESH_NET_LINKUP:
+    case REFRESH_NET_RUNNING:
+	return CLUSTER_NET_DEV;
+    case REFRESH_NETADDR_INET:
+    case REFRESH_NETADDR_IPV6:
+    case REFRESH_NETADDR_HW:
+	return CLUSTER_NET_ADDR;
+    case CLUSTER_INTERRUPT_LINES:
+    case CLUSTER_INTERRUPT_OTHER:
+	return CLUSTER_INTERRUPTS;
+    }
+    return index;
+}
+
+static int
+refresh_instance(unsigned int inst)
+{
+    int		i;
+
+    for (i = 0; i < NR_REFRESH_CLUSTERS; i++)
+	if (refresh_indom_id[i].i_inst == inst)
+	    return 1;
+    return 0;
+}
+
+static void
+refresh_interval(int cluster, __uint64_t interval)
+{
+    int		i;
+
+    if (cluster >= 0) {
+	refreshtab[cluster].interval = interval;
+	return;
+    }
+    for (i = 0; i < NR_REFRESH_CLUSTERS; i++)
+	refreshtab[refresh_indom_id[i].i_inst].interval = interval;
+}
+
+/*
+ * Drop refresh requests for values younger than the cluster interval.
+ * Containers are always refreshed, as are slabinfo values (which are
+ * only available to some clients), and all indices of a cluster are
+ * refreshed together where refreshing it resets them (interface ioctl
+ * values, and every network address family).
+ */
+static __uint64_t
+refresh_lookup(int *requested, int *need_refresh, linux_container_t *cp)
+{
+    __uint64_t	now = refresh_clock();
+    int		i, cluster;
+
+    if (cp)
+	return now;
+
+    for (i = 0; i < NUM_REFRESHES; i++) {
+	if (!need_refresh[i] || i == CLUSTER_SLAB)
+	    continue;
+	cluster = refresh_cluster(i);
+	if (refreshtab[cluster].interval == 0 || refresh_stamp[i] == 0)
+	    continue;
+	if (now - refresh_stamp[i] < refreshtab[cluster].interval)
+	    need_refresh[i] = 0;
+    }
+
+    if (need_refresh[REFRESH_NETADDR_INET] ||
+	need_refresh[REFRESH_NETADDR_IPV6] ||
+	need_refresh[REFRESH_NETADDR_HW])
+	need_refresh[CLUSTER_NET_ADDR] = 1;
+    for (i = NUM_CLUSTERS; i < NUM_REFRESHES; i++) {
+	if (requested[i] && need_refresh[refresh_cluster(i)])
+	    need_refresh[i] = 1;
+    }
+    return now;
+}
+
+/*
+ * Note the time values were refreshed at (or invalidate them, when
+ * refreshed within a container), and account for each cluster that
+ * was requested, whether refreshed or not.
+ */
+static void
+refresh_update(int *requested, int *need_refresh, __uint64_t now,
+		linux_container_t *cp)
+{
+    __uint64_t	stamp = cp ? 0 : now;
+    int		i, cluster, refreshed[NUM_CLUSTERS] = {0};
+
+    for (i = 0; i < NUM_REFRESHES; i++) {
+	cluster = refresh_cluster(i);
+	if (need_refresh[i]) {
+	    refresh_stamp[i] = stamp;
+	    refreshed[cluster] = 1;
+	}
+	else if (need_refresh[cluster]) {
+	    /* values reset by the cluster refresh, but not refreshed */
+	    refresh_stamp[i] = 0;
+	}
+    }
+
+    /* some clusters are always refreshed together */
+    if (refreshed[CLUSTER_INTERRUPTS])
+	refresh_stamp[CLUSTER_INTERRUPTS] =
+	refresh_stamp[CLUSTER_INTERRUPT_LINES] =
+	refresh_stamp[CLUSTER_INTERRUPT_OTHER] = stamp;
+    if (refreshed[CLUSTER_FILESYS] || refreshed[CLUSTER_TMPFS])
+	refresh_stamp[CLUSTER_FILESYS] = refresh_stamp[CLUSTER_TMPFS] = stamp;
+
+    for (i = 0; i < NUM_REFRESHES; i++) {
+	if (!requested[i])
+	    continue;
+	cluster = refresh_cluster(i);
+	if (refreshed[cluster] == 1) {
+	    refreshtab[cluster].count++;
+	    refreshed[cluster] = -1;	/* counted */
+	}
+	else if (refreshed[cluster] == 0) {
+	    refreshtab[cluster].cached++;
+	    refreshed[cluster] = -1;
+	}
+    }
+}
+
+/* account for time spent refreshing a cluster, returning the time now */
+static __uint64_t
+refresh_cost(int cluster, __uint64_t start)
+{
+    __uint64_t	now = refresh_clock();
+
+    refreshtab[cluster].time += now - start;
+    return now;
+}
+
 static int
 linux_refresh(pmdaExt *pmda, int *need_refresh, int context)
 {
     linux_container_t *cp = linux_ctx_container(context);
     linux_access_t *access = access_ctx(context);
+    int requested[NUM_REFRESHES];
     int need_refresh_mtab = 0;
     int need_net_ioctl = 0;
     int ns_fds = 0;
     int sts = 0;
+    __uint64_t now, start;
 
     if (cp && (sts = container_lookup(rootfd, cp)) < 0)
 	return sts;
 
-    if (need_refresh[CLUSTER_PARTITIONS])
+    memcpy(requested, need_refresh, sizeof(requested));
+    now = start = refresh_lookup(requested, need_refresh, cp);
+
+    if (need_refresh[CLUSTER_PARTITIONS]) {
     	refresh_proc_partitions(INDOM(DISK_INDOM),
 				INDOM(PARTITIONS_INDOM),
 				INDOM(DM_INDOM), INDOM(MD_INDOM));
+	start = refresh_cost(CLUSTER_PARTITIONS, start);
+    }
 
-    if (need_refresh[CLUSTER_STAT])
+    if (need_refresh[CLUSTER_STAT]) {
 	refresh_proc_stat(&proc_cpuinfo, &proc_stat);
+	start = refresh_cost(CLUSTER_STAT, start);
+    }
 
-    if (need_refresh[CLUSTER_CPUINFO])
+    if (need_refresh[CLUSTER_CPUINFO]) {
 	refresh_proc_cpuinfo(&proc_cpuinfo);
+	start = refresh_cost(CLUSTER_CPUINFO, start);
+    }
 
-    if (need_refresh[CLUSTER_MEMINFO])
+    if (need_refresh[CLUSTER_MEMINFO]) {
 	refresh_proc_meminfo(&proc_meminfo);
+	start = refresh_cost(CLUSTER_MEMINFO, start);
+    }
 
-    if (need_refresh[CLUSTER_NUMA_MEMINFO])
+    if (need_refresh[CLUSTER_NUMA_MEMINFO]) {
 	refresh_numa_meminfo(&numa_meminfo, &proc_cpuinfo, &proc_stat);
+	start = refresh_cost(CLUSTER_NUMA_MEMINFO, start);
+    }
 
-    if (need_refresh[CLUSTER_LOADAVG])
+    if (need_refresh[CLUSTER_LOADAVG]) {
 	refresh_proc_loadavg(&proc_loadavg);
+	start = refresh_cost(CLUSTER_LOADAVG, start);
+    }
 
-    if (need_refresh[CLUSTER_NET_NFS])
+    if (need_refresh[CLUSTER_NET_NFS]) {
 	refresh_proc_net_rpc(&proc_net_rpc);
+	start = refresh_cost(CLUSTER_NET_NFS, start);
+    }
 
-    if (need_refresh[CLUSTER_NET_SOCKSTAT])
+    if (need_refresh[CLUSTER_NET_SOCKSTAT]) {
 	refresh_proc_net_sockstat(&proc_net_sockstat);
+	start = refresh_cost(CLUSTER_NET_SOCKSTAT, start);
+    }
 
-    if (need_refresh[CLUSTER_NET_SNMP])
+    if (need_refresh[CLUSTER_NET_SNMP]) {
 	refresh_proc_net_snmp(&_pm_proc_net_snmp);
+	start = refresh_cost(CLUSTER_NET_SNMP, start);
+    }
 
-    if (need_refresh[CLUSTER_NET_SNMP6])
+    if (need_refresh[CLUSTER_NET_SNMP6]) {
 	refresh_proc_net_snmp6(_pm_proc_net_snmp6);
+	start = refresh_cost(CLUSTER_NET_SNMP6, start);
+    }
 
-    if (need_refresh[CLUSTER_NET_TCP])
+    if (need_refresh[CLUSTER_NET_TCP]) {
 	refresh_proc_net_tcp(&proc_net_tcp);
+	start = refresh_cost(CLUSTER_NET_TCP, start);
+    }
 
-    if (need_refresh[CLUSTER_NET_NETSTAT])
+    if (need_refresh[CLUSTER_NET_NETSTAT]) {
 	refresh_proc_net_netstat(&_pm_proc_net_netstat);
+	start = refresh_cost(CLUSTER_NET_NETSTAT, start);
+    }
 
     /*
      * Network interface metrics and namespaces are complicated by a
@@ -4614,50 +4866,81 @@ linux_refresh(pmdaExt *pmda, int *need_refresh, int context)
 	if (need_refresh[REFRESH_NETADDR_IPV6])
 	    need_net_ioctl = 1;
 
+	/*
+	 * Switching namespaces is not charged to any cluster, so start
+	 * is reset after each container_nsenter and nsleave.
+	 */
 	if (need_refresh[CLUSTER_NET_DEV]) {
 	    if ((sts = container_nsenter(cp, LINUX_NAMESPACE_NET, &ns_fds)) < 0)
 		goto done;
+	    start = refresh_clock();
 	    refresh_proc_net_dev(netdev, cp);
+	    start = refresh_cost(CLUSTER_NET_DEV, start);
 	    container_nsleave(cp, LINUX_NAMESPACE_NET);
 	}
 
 	if ((sts = container_nsenter(cp, LINUX_NAMESPACE_MNT, &ns_fds)) < 0)
 	    goto done;
+	start = refresh_clock();
 	refresh_net_addr_sysfs(netaddr, need_refresh);
+	if (need_refresh[CLUSTER_NET_ADDR])
+	    start = refresh_cost(CLUSTER_NET_ADDR, start);
+	else	/* nothing to do, not charged */
+	    start = refresh_clock();
 	need_net_ioctl |= refresh_net_sysfs(netdev, need_refresh);
-	if (need_refresh[CLUSTER_FILESYS] || need_refresh[CLUSTER_TMPFS])
+	start = refresh_cost(CLUSTER_NET_DEV, start);
+	if (need_refresh[CLUSTER_FILESYS] || need_refresh[CLUSTER_TMPFS]) {
 	    refresh_filesys(INDOM(FILESYS_INDOM), INDOM(TMPFS_INDOM), cp);
+	    start = refresh_cost(need_refresh[CLUSTER_FILESYS] ?
+				 CLUSTER_FILESYS : CLUSTER_TMPFS, start);
+	}
 	container_nsleave(cp, LINUX_NAMESPACE_MNT);
 
 	if (need_net_ioctl) {
 	    if ((sts = container_nsenter(cp, LINUX_NAMESPACE_NET, &ns_fds)) < 0)
 		goto done;
+	    start = refresh_clock();
 	    refresh_net_addr_ioctl(netaddr, cp, need_refresh);
+	    start = refresh_cost(CLUSTER_NET_ADDR, start);
 	    refresh_net_ioctl(netdev, cp, need_refresh);
+	    start = refresh_cost(CLUSTER_NET_DEV, start);
 	    container_nsleave(cp, LINUX_NAMESPACE_NET);
 	}
 
-	if (need_refresh[CLUSTER_NET_ADDR])
+	start = refresh_clock();
+
+	if (need_refresh[CLUSTER_NET_ADDR]) {
 	    store_net_addr_indom(netaddr, cp);
+	    start = refresh_cost(CLUSTER_NET_ADDR, start);
+	}
     }
 
     if (need_refresh[CLUSTER_KERNEL_UNAME]) {
 	if ((sts = container_nsenter(cp, LINUX_NAMESPACE_UTS, &ns_fds)) < 0)
 	    goto done;
+	start = refresh_clock();
 	uname(&kernel_uname);
+	start = refresh_cost(CLUSTER_KERNEL_UNAME, start);
 	container_nsleave(cp, LINUX_NAMESPACE_UTS);
+	start = refresh_clock();
     }
 
     if (need_refresh[CLUSTER_INTERRUPTS] ||
 	need_refresh[CLUSTER_INTERRUPT_LINES] ||
-	need_refresh[CLUSTER_INTERRUPT_OTHER])
+	need_refresh[CLUSTER_INTERRUPT_OTHER]) {
 	need_refresh_mtab |= refresh_interrupt_values();
+	start = refresh_cost(CLUSTER_INTERRUPTS, start);
+    }
 
-    if (need_refresh[CLUSTER_SWAPDEV])
+    if (need_refresh[CLUSTER_SWAPDEV]) {
 	refresh_swapdev(INDOM(SWAPDEV_INDOM));
+	start = refresh_cost(CLUSTER_SWAPDEV, start);
+    }
 
-    if (need_refresh[CLUSTER_SCSI])
+    if (need_refresh[CLUSTER_SCSI]) {
 	refresh_proc_scsi(INDOM(SCSI_INDOM));
+	start = refresh_cost(CLUSTER_SCSI, start);
+    }
 
     if (need_refresh[CLUSTER_SLAB]) {
 	if (access != NULL && (access->uid == 0 && access->uid_flag)) {
@@ -4665,36 +4948,57 @@ linux_refresh(pmdaExt *pmda, int *need_refresh, int context)
 	    refresh_proc_slabinfo(&proc_slabinfo);
 	} else
 	    proc_slabinfo.permission = 0;
+	start = refresh_cost(CLUSTER_SLAB, start);
     }
 
-    if (need_refresh[CLUSTER_SEM_LIMITS])
+    if (need_refresh[CLUSTER_SEM_LIMITS]) {
 	refresh_sem_limits(&sem_limits);
+	start = refresh_cost(CLUSTER_SEM_LIMITS, start);
+    }
 
-    if (need_refresh[CLUSTER_MSG_LIMITS])
+    if (need_refresh[CLUSTER_MSG_LIMITS]) {
         refresh_msg_limits(&msg_limits);
+	start = refresh_cost(CLUSTER_MSG_LIMITS, start);
+    }
 
-    if (need_refresh[CLUSTER_SHM_INFO])
+    if (need_refresh[CLUSTER_SHM_INFO]) {
         refresh_shm_info(&_shm_info);
+	start = refresh_cost(CLUSTER_SHM_INFO, start);
+    }
 
-    if (need_refresh[CLUSTER_SHM_LIMITS])
+    if (need_refresh[CLUSTER_SHM_LIMITS]) {
         refresh_shm_limits(&shm_limits);
+	start = refresh_cost(CLUSTER_SHM_LIMITS, start);
+    }
 
-    if (need_refresh[CLUSTER_UPTIME])
+    if (need_refresh[CLUSTER_UPTIME]) {
         refresh_proc_uptime(&proc_uptime);
+	start = refresh_cost(CLUSTER_UPTIME, start);
+    }
 
-    if (need_refresh[CLUSTER_VFS])
+    if (need_refresh[CLUSTER_VFS]) {
     	refresh_proc_sys_fs(&proc_sys_fs);
+	start = refresh_cost(CLUSTER_VFS, start);
+    }
 
-    if (need_refresh[CLUSTER_VMSTAT])
+    if (need_refresh[CLUSTER_VMSTAT]) {
     	refresh_proc_vmstat(&_pm_proc_vmstat);
+	start = refresh_cost(CLUSTER_VMSTAT, start);
+    }
 
-    if (need_refresh[CLUSTER_SYSFS_KERNEL])
+    if (need_refresh[CLUSTER_SYSFS_KERNEL]) {
     	refresh_sysfs_kernel(&sysfs_kernel);
+	start = refresh_cost(CLUSTER_SYSFS_KERNEL, start);
+    }
 
-    if (need_refresh[CLUSTER_NET_SOFTNET])
+    if (need_refresh[CLUSTER_NET_SOFTNET]) {
 	refresh_proc_net_softnet(&proc_net_softnet);
+	start = refresh_cost(CLUSTER_NET_SOFTNET, start);
+    }
 
 done:
+    if (sts >= 0)
+	refresh_update(requested, need_refresh, now, cp);
     if (need_refresh_mtab)
 	pmdaDynamicMetricTable(pmda);
     container_close(cp, ns_fds);
@@ -6413,6 +6717,27 @@ linux_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	}
 	break;
 
+    case CLUSTER_REFRESH:
+	if (!refresh_instance(inst))
+	    return PM_ERR_INST;
+	switch (idp->item) {
+	case 0: /* pmda.refresh.interval */
+	    atom->ul = refreshtab[inst].interval / 1000;
+	    break;
+	case 1: /* pmda.refresh.count */
+	    atom->ull = refreshtab[inst].count;
+	    break;
+	case 2: /* pmda.refresh.cached */
+	    atom->ull = refreshtab[inst].cached;
+	    break;
+	case 3: /* pmda.refresh.time */
+	    atom->ull = refreshtab[inst].time;
+	    break;
+	default:
+	    return PM_ERR_PMID;
+	}
+	break;
+
     default: /* unknown cluster */
 	return PM_ERR_PMID;
     }
@@ -6420,6 +6745,147 @@ linux_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
     return 1;
 }
 
+/*
+ * Column fill for the per-cpu and per-node time counters from /proc/stat.
+ * The source arrays, the sign of the optional second term and the result
+ * size are chosen once from the item, then applied to every instance.
+ * Returns 0 if the item is not one of these, so the caller falls back to
+ * the per-instance callback.
+ */
+static int
+stat_fetchColumn(pmdaMetric *mdesc, int numinst, const int *instlist,
+		 pmAtomValue *atoms, int *sts)
+{
+    __pmID_int		*idp = (__pmID_int *)&(mdesc->m_desc.pmid);
+    unsigned long long	*a, *b = NULL;
+    int			size = _pm_cputime_size;
+    int			sign = 1;
+    int			i;
+    double		val;
+
+    switch (idp->item) {
+    case 0:  a = proc_stat.p_user; break;	/* kernel.percpu.cpu.user */
+    case 1:  a = proc_stat.p_nice; break;	/* kernel.percpu.cpu.nice */
+    case 2:  a = proc_stat.p_sys; break;	/* kernel.percpu.cpu.sys */
+    case 3:  a = proc_stat.p_idle;		/* kernel.percpu.cpu.idle */
+	     size = _pm_idletime_size; break;
+    case 30: a = proc_stat.p_wait; break;	/* kernel.percpu.cpu.wait.total */
+    case 31: a = proc_stat.p_irq;		/* kernel.percpu.cpu.intr */
+	     b = proc_stat.p_sirq; break;
+    case 56: a = proc_stat.p_sirq; break;	/* kernel.percpu.cpu.irq.soft */
+    case 57: a = proc_stat.p_irq; break;	/* kernel.percpu.cpu.irq.hard */
+    case 58: a = proc_stat.p_steal; break;	/* kernel.percpu.cpu.steal */
+    case 61: a = proc_stat.p_guest; break;	/* kernel.percpu.cpu.guest */
+    case 76: a = proc_stat.p_user;		/* kernel.percpu.cpu.vuser */
+	     b = proc_stat.p_guest; sign = -1; break;
+    case 83: a = proc_stat.p_guest_nice; break;	/* kernel.percpu.cpu.guest_nice */
+    case 84: a = proc_stat.p_nice;		/* kernel.percpu.cpu.vnice */
+	     b = proc_stat.p_guest_nice; sign = -1; break;
+    case 62: a = proc_stat.n_user; break;	/* kernel.pernode.cpu.user */
+    case 63: a = proc_stat.n_nice; break;	/* kernel.pernode.cpu.nice */
+    case 64: a = proc_stat.n_sys; break;	/* kernel.pernode.cpu.sys */
+    case 65: a = proc_stat.n_idle;		/* kernel.pernode.cpu.idle */
+	     size = _pm_idletime_size; break;
+    case 69: a = proc_stat.n_wait; break;	/* kernel.pernode.cpu.wait.total */
+    case 66: a = proc_stat.n_irq;		/* kernel.pernode.cpu.intr */
+	     b = proc_stat.n_sirq; break;
+    case 70: a = proc_stat.n_sirq; break;	/* kernel.pernode.cpu.irq.soft */
+    case 71: a = proc_stat.n_irq; break;	/* kernel.pernode.cpu.irq.hard */
+    case 67: a = proc_stat.n_steal; break;	/* kernel.pernode.cpu.steal */
+    case 68: a = proc_stat.n_guest; break;	/* kernel.pernode.cpu.guest */
+    case 77: a = proc_stat.n_user;		/* kernel.pernode.cpu.vuser */
+	     b = proc_stat.n_guest; sign = -1; break;
+    case 85: a = proc_stat.n_guest_nice; break;	/* kernel.pernode.cpu.guest_nice */
+    case 86: a = proc_stat.n_nice;		/* kernel.pernode.cpu.vnice */
+	     b = proc_stat.n_guest_nice; sign = -1; break;
+    default:
+	return 0;
+    }
+
+    for (i = 0; i < numinst; i++) {
+	val = (double)a[instlist[i]];
+	if (b != NULL)
+	    val += sign * (double)b[instlist[i]];
+	_pm_assign_utype(size, &atoms[i], 1000 * val / hz);
+	sts[i] = 1;
+    }
+    return 1;
+}
+
+/*
+ * Column fill for the network.interface counters and totals, the
+ * per-interface state is looked up once per instance and the item
+ * decoded once per column.  Returns 0 for items not handled here.
+ */
+static int
+net_dev_fetchColumn(pmdaMetric *mdesc, int numinst, const int *instlist,
+		    pmAtomValue *atoms, int *sts)
+{
+    __pmID_int		*idp = (__pmID_int *)&(mdesc->m_desc.pmid);
+    net_interface_t	*netip;
+    int			first, second;
+    int			i;
+
+    if (idp->item <= 15) {		/* network.interface.{in,out} */
+	first = idp->item;
+	second = -1;
+    }
+    else if (idp->item <= 19) {		/* network.interface.total */
+	first = idp->item - 16;
+	second = idp->item - 8;
+    }
+    else if (idp->item == 20) {		/* network.interface.total.mcasts */
+	first = 7;			/* there is no out.mcasts */
+	second = -1;
+    }
+    else
+	return 0;
+
+    for (i = 0; i < numinst; i++) {
+	sts[i] = pmdaCacheLookup(INDOM(NET_DEV_INDOM), instlist[i],
+				 NULL, (void **)&netip);
+	if (sts[i] < 0)
+	    continue;
+	atoms[i].ull = netip->counters[first];
+	if (second >= 0)
+	    atoms[i].ull += netip->counters[second];
+	sts[i] = 1;
+    }
+    return 1;
+}
+
+/*
+ * column callback provided to pmdaFetch, called once per metric for
+ * all of the requested instances.  The per-cpu, per-node and network
+ * interface counters are filled a column at a time, everything else
+ * goes through linux_fetchCallBack for each instance.  String values
+ * here all live in buffers that are stable for the duration of the
+ * fetch, so can be passed back as they are.
+ */
+static int
+linux_fetchColumnCallBack(pmdaMetric *mdesc, int numinst, const int *instlist,
+			  pmAtomValue *atoms, int *sts)
+{
+    __pmID_int		*idp = (__pmID_int *)&(mdesc->m_desc.pmid);
+    int			i;
+
+    if (mdesc->m_user == NULL) {
+	if (idp->cluster == CLUSTER_STAT &&
+	    stat_fetchColumn(mdesc, numinst, instlist, atoms, sts))
+	    return 0;
+	if (idp->cluster == CLUSTER_NET_DEV &&
+	    net_dev_fetchColumn(mdesc, numinst, instlist, atoms, sts))
+	    return 0;
+    }
+
+    for (i = 0; i < numinst; i++) {
+	sts[i] = linux_fetchCallBack(mdesc, instlist[i], &atoms[i]);
+	if (sts[i] == PM_ERR_PMID)	/* same for every instance */
+	    return sts[i];
+    }
+    return 0;
+}
+
 
 static int
 linux_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
@@ -6503,6 +6969,32 @@ linux_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
     return pmdaFetch(numpmid, pmidlist, resp, pmda);
 }
 
+static int
+linux_store(pmResult *result, pmdaExt *pmda)
+{
+    linux_access_t	*access = access_ctx(pmda->e_context);
+    int			i, j, sts = 0;
+
+    for (i = 0; i < result->numpmid && sts >= 0; i++) {
+	pmValueSet *vsp = result->vset[i];
+	__pmID_int *idp = (__pmID_int *)&(vsp->pmid);
+	pmAtomValue av;
+
+	if (idp->cluster != CLUSTER_REFRESH || idp->item != 0)
+	    sts = PM_ERR_PERMISSION;	/* pmda.refresh.interval only */
+	else if (access == NULL || access->uid != 0 || !access->uid_flag)
+	    sts = PM_ERR_PERMISSION;
+	else for (j = 0; j < vsp->numval && sts >= 0; j++) {
+	    if (!refresh_instance(vsp->vlist[j].inst))
+		sts = PM_ERR_INST;
+	    else if ((sts = pmExtractValue(vsp->valfmt, &vsp->vlist[j],
+				PM_TYPE_U32, &av, PM_TYPE_U32)) >= 0)
+		refresh_interval(vsp->vlist[j].inst, av.ul * (__uint64_t)1000);
+	}
+    }
+    return sts;
+}
+
 static int
 linux_text(int ident, int type, char **buf, pmdaExt *pmda)
 {
@@ -6657,7 +7149,7 @@ linux_init(pmdaInterface *dp)
 	int sep = __pmPathSeparator();
 	snprintf(helppath, sizeof(helppath), "%s%c" "linux" "%c" "help",
 		pmGetConfig("PCP_PMDAS_DIR"), sep, sep);
-	pmdaDSO(dp, PMDA_INTERFACE_6, "linux DSO", helppath);
+	pmdaDSO(dp, PMDA_INTERFACE_7, "linux DSO", helppath);
     } else {
 	if (username)
 	    __pmSetProcessIdentity(username);
@@ -6669,13 +7161,14 @@ linux_init(pmdaInterface *dp)
 
     dp->version.six.instance = linux_instance;
     dp->version.six.fetch = linux_fetch;
+    dp->version.six.store = linux_store;
     dp->version.six.text = linux_text;
     dp->version.six.pmid = linux_pmid;
     dp->version.six.name = linux_name;
     dp->version.six.children = linux_children;
     dp->version.six.attribute = linux_attribute;
     dp->version.six.ext->e_endCallBack = linux_end_context;
-    pmdaSetFetchCallBack(dp, linux_fetchCallBack);
+    pmdaSetFetchColumnCallBack(dp, linux_fetchColumnCallBack);
 
     proc_stat.cpu_indom = proc_cpuinfo.cpuindom = &indomtab[CPU_INDOM];
     numa_meminfo.node_indom = proc_cpuinfo.node_indom = &indomtab[NODE_INDOM];
@@ -6778,18 +7271,58 @@ linux_init(pmdaInterface *dp)
     pmdaCacheOp(INDOM(STRINGS_INDOM), PMDA_CACHE_STRINGS);
 }
 
+/*
+ * Parse a -r [CLUSTER=]TIME option, which sets the refresh interval of
+ * one cluster (by its pmda.refresh instance name) or of all of them.
+ */
+static int
+refresh_option(char *option)
+{
+    struct timeval	interval;
+    char		*endnum, *value;
+    int			i, cluster = -1;
+
+    if ((value = strchr(option, '=')) != NULL) {
+	*value++ = '\0';
+	for (i = 0; i < NR_REFRESH_CLUSTERS; i++) {
+	    if (strcmp(refresh_indom_id[i].i_name, option) == 0) {
+		cluster = refresh_indom_id[i].i_inst;
+		break;
+	    }
+	}
+	if (cluster < 0) {
+	    fprintf(stderr, "%s: unknown refresh cluster \"%s\"\n",
+			pmProgname, option);
+	    return -EINVAL;
+	}
+    }
+    else
+	value = option;
+
+    if (pmParseInterval(value, &interval, &endnum) < 0) {
+	fprintf(stderr, "%s: -r requires a time interval: %s\n",
+			pmProgname, endnum);
+	free(endnum);
+	return -EINVAL;
+    }
+    refresh_interval(cluster, (__uint64_t)interval.tv_sec * 1000000 +
+			      interval.tv_usec);
+    return 0;
+}
+
 pmLongOptions	longopts[] = {
     PMDA_OPTIONS_HEADER("Options"),
     PMOPT_DEBUG,
     PMDAOPT_DOMAIN,
     PMDAOPT_LOGFILE,
+    { "refresh", 1, 'r', "[CLUSTER=]TIME", "minimum interval between cluster refreshes" },
     PMDAOPT_USERNAME,
     PMOPT_HELP,
     PMDA_OPTIONS_END
 };
 
 pmdaOptions	opts = {
-    .short_options = "D:d:l:U:?",
+    .short_options = "D:d:l:r:U:?",
     .long_options = longopts,
 };
 
@@ -6800,6 +7333,7 @@ int
 main(int argc, char **argv)
 {
     int			sep = __pmPathSeparator();
+    int			c;
     pmdaInterface	dispatch;
     char		helppath[MAXPATHLEN];
 
@@ -6808,9 +7342,16 @@ main(int argc, char **argv)
 
     snprintf(helppath, sizeof(helppath), "%s%c" "linux" "%c" "help",
 		pmGetConfig("PCP_PMDAS_DIR"), sep, sep);
-    pmdaDaemon(&dispatch, PMDA_INTERFACE_6, pmProgname, LINUX, "linux.log", helppath);
+    pmdaDaemon(&dispatch, PMDA_INTERFACE_7, pmProgname, LINUX, "linux.log", helppath);
 
-    pmdaGetOptions(argc, argv, &opts, &dispatch);
+    while ((c = pmdaGetOptions(argc, argv, &opts, &dispatch)) != EOF) {
+	switch (c) {
+	case 'r':
+	    if (refresh_option(opts.optarg) < 0)
+		opts.errors++;
+	    break;
+	}
+    }
     if (opts.errors) {
 	pmdaUsageMessage(&opts);
 	exit(1);
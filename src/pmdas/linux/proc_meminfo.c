@@ -20,6 +20,7 @@
 #include "pmda.h"
 #include "indom.h"
 #include <sys/stat.h>
+#include "linux_parse.h"
 #include "proc_meminfo.h"
 
 static proc_meminfo_t moff;
@@ -86,6 +87,9 @@ static struct {
     { NULL, NULL }
 };
 
+static linux_keytab_t meminfo_keys = LINUX_KEYTAB(meminfo_fields);
+static linux_file_t meminfo_file = LINUX_FILE("/proc/meminfo");
+
 #define MOFFSET(ii, pp) (int64_t *)((char *)pp + \
     (__psint_t)meminfo_fields[ii].offset - (__psint_t)&moff)
 
@@ -94,8 +98,11 @@ refresh_proc_meminfo(proc_meminfo_t *proc_meminfo)
 {
     char	buf[1024];
     char	*bufp;
+    char	*line;
     int64_t	*p;
+    __uint64_t	value;
     int		i;
+    int		sts;
     FILE	*fp;
 
     for (i = 0; meminfo_fields[i].field != NULL; i++) {
@@ -103,29 +110,21 @@ refresh_proc_meminfo(proc_meminfo_t *proc_meminfo)
 	*p = -1; /* marked as "no value available" */
     }
 
-    if ((fp = linux_statsfile("/proc/meminfo", buf, sizeof(buf))) == NULL)
-	return -oserror();
+    if ((sts = linux_file_read(&meminfo_file, 0)) < 0)
+	return sts;
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-	if ((bufp = strchr(buf, ':')) == NULL)
+    while ((line = linux_file_line(&meminfo_file)) != NULL) {
+	if ((bufp = strchr(line, ':')) == NULL)
+	    continue;
+	if ((i = linux_keytab_lookup(&meminfo_keys, line, bufp - line)) < 0)
 	    continue;
-	*bufp = '\0';
-	for (i=0; meminfo_fields[i].field != NULL; i++) {
-	    if (strcmp(buf, meminfo_fields[i].field) != 0)
-		continue;
+	bufp++;
+	if (linux_parse_u64(&bufp, &value)) {
 	    p = MOFFSET(i, proc_meminfo);
-	    for (bufp++; *bufp; bufp++) {
-	    	if (isdigit((int)*bufp)) {
-		    sscanf(bufp, "%llu", (unsigned long long *)p);
-		    *p *= 1024; /* kbytes -> bytes */
-		    break;
-		}
-	    }
+	    *p = value * 1024; /* kbytes -> bytes */
 	}
     }
 
-    fclose(fp);
-
     /*
      * MemAvailable is only in 3.x or later kernels but we can calculate it
      * using other values, similar to upstream kernel commit 34e431b0ae.
@@ -25,6 +25,7 @@
 #include <net/if.h>
 #include <ctype.h>
 #include "namespaces.h"
+#include "linux_parse.h"
 #include "proc_net_dev.h"
 
 static int
@@ -234,14 +235,17 @@ refresh_proc_net_dev(pmInDom indom, linux_container_t *container)
 {
     static uint32_t	gen;	/* refresh generation number */
     static uint32_t	cache_err;	/* throttle messages */
-    char		buf[1024];
-    FILE		*fp;
+    static linux_file_t	net_dev_file = LINUX_FILE("/proc/net/dev");
+    char		*line;
     char		*p, *v;
+    __uint64_t		value;
     int			j, sts;
     net_interface_t	*netip;
 
-    if ((fp = linux_statsfile("/proc/net/dev", buf, sizeof(buf))) == NULL)
-    	return -oserror();
+    /* inside a container namespace, /proc/net must be opened afresh */
+    sts = linux_file_read(&net_dev_file, container ? LINUX_FILE_NOCACHE : 0);
+    if (sts < 0)
+    	return sts;
 
     if (gen == 0) {
 	/*
@@ -261,11 +265,11 @@ Inter-|   Receive                                                |  Transmit
 
     pmdaCacheOp(indom, PMDA_CACHE_INACTIVE);
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-	if ((p = v = strchr(buf, ':')) == NULL)
+    while ((line = linux_file_line(&net_dev_file)) != NULL) {
+	if ((p = v = strchr(line, ':')) == NULL)
 	    continue;
-	*p = '\0';
-	for (p=buf; *p && isspace((int)*p); p++) {;}
+	*v++ = '\0';
+	for (p=line; *p && isspace((int)*p); p++) {;}
 
 	sts = pmdaCacheLookupName(indom, p, NULL, (void **)&netip);
 	if (sts == PM_ERR_INST || (sts >= 0 && netip == NULL)) {
@@ -293,16 +297,14 @@ Inter-|   Receive                                                |  Transmit
 	}
 
 	memset(&netip->ioc, 0, sizeof(netip->ioc));
-	for (p=v, j=0; j < PROC_DEV_COUNTERS_PER_LINE; j++) {
-	    for (; !isdigit((int)*p); p++) {;}
-	    sscanf(p, "%llu", (long long unsigned int *)&netip->counters[j]);
-	    for (; !isspace((int)*p); p++) {;}
+	for (j=0; j < PROC_DEV_COUNTERS_PER_LINE; j++) {
+	    if (!linux_parse_u64(&v, &value))
+		break;
+	    netip->counters[j] = value;
 	}
     }
 
     /* success */
-    fclose(fp);
-
     if (!container)
 	pmdaCacheOp(indom, PMDA_CACHE_SAVE);
     return 0;
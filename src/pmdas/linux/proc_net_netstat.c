@@ -16,6 +16,7 @@
 #include "impl.h"
 #include "pmda.h"
 #include "indom.h"
+#include "linux_parse.h"
 #include "proc_net_netstat.h"
 
 extern proc_net_netstat_t	_pm_proc_net_netstat;
@@ -272,49 +273,33 @@ netstat_fields_t netstat_tcp_fields[] = {
     { .field = NULL, .offset = NULL }
 };
 
+static linux_keytab_t netstat_ip_keys = LINUX_KEYTAB(netstat_ip_fields);
+static linux_keytab_t netstat_tcp_keys = LINUX_KEYTAB(netstat_tcp_fields);
+
 static void
-get_fields(netstat_fields_t *fields, char *header, char *buffer)
+get_fields(netstat_fields_t *fields, linux_keytab_t *keys, char *header, char *buffer)
 {
-    int i, j, count;
-    char *p, *indices[NETSTAT_MAX_COLUMNS];
-
-    /* first get pointers to each of the column headings */
-    strtok(header, " ");
-    for (i = 0; i < NETSTAT_MAX_COLUMNS; i++) {
-	if ((p = strtok(NULL, " \n")) == NULL)
-	    break;
-	indices[i] = p;
-    }
-    count = i;
+    char	*name, *p;
+    __uint64_t	value;
+    int		i;
 
     /*
-     * Extract values via back-referencing column headings.
-     * "i" is the last found index, which we use for a bit
-     * of optimisation for the (common) in-order maps case
-     * (where "in order" means in the order defined by the
-     * passed in "fields" table which typically matches the
-     * kernel - but may be out-of-order for older kernels).
+     * Extract values by pairing each column heading with the value
+     * in the same column, then looking the heading up in the table
+     * (columns may be in any order, and unknown ones are ignored).
      */
-    strtok(buffer, " ");
-    for (i = j = 0; j < count && fields[i].field; j++, i++) {
-        if ((p = strtok(NULL, " \n")) == NULL)
-            break;
-        if (strcmp(fields[i].field, indices[j]) == 0)
-            *fields[i].offset = strtoull(p, NULL, 10);
-        else {
-            for (i = 0; fields[i].field; i++) {
-                if (strcmp(fields[i].field, indices[j]) != 0)
-                    continue;
-                *fields[i].offset = strtoull(p, NULL, 10);
-                break;
-            }
-	    if (fields[i].field == NULL) /* not found, ignore */
-		i = 0;
-	}
+    linux_parse_word(&header);
+    linux_parse_word(&buffer);
+    while ((name = linux_parse_word(&header)) != NULL) {
+	if ((p = linux_parse_word(&buffer)) == NULL)
+	    break;
+	if ((i = linux_keytab_lookup(keys, name, strlen(name))) < 0)
+	    continue;
+	if (linux_parse_u64(&p, &value))
+	    *fields[i].offset = value;
     }
 }
 
-
 #define NETSTAT_IP_OFFSET(ii, pp) (int64_t *)((char *)pp + \
     (__psint_t)netstat_ip_fields[ii].offset - (__psint_t)&_pm_proc_net_netstat.ip)
 #define NETSTAT_TCP_OFFSET(ii, pp) (int64_t *)((char *)pp + \
@@ -335,24 +320,23 @@ init_refresh_proc_net_netstat(proc_net_netstat_t *netstat)
 int
 refresh_proc_net_netstat(proc_net_netstat_t *netstat)
 {
-    /* Need a sufficiently large value to hold a full line */
-    char	buf[MAXPATHLEN];
-    char	header[2048];
-    FILE	*fp;
+    static linux_file_t	netstat_file = LINUX_FILE("/proc/net/netstat");
+    char	*header;
+    char	*buf;
+    int		sts;
 
     init_refresh_proc_net_netstat(netstat);
-    if ((fp = linux_statsfile("/proc/net/netstat", buf, sizeof(buf))) == NULL)
-	return -oserror();
-    while (fgets(header, sizeof(header), fp) != NULL) {
-	if (fgets(buf, sizeof(buf), fp) != NULL) {
+    if ((sts = linux_file_read(&netstat_file, 0)) < 0)
+	return sts;
+    while ((header = linux_file_line(&netstat_file)) != NULL) {
+	if ((buf = linux_file_line(&netstat_file)) != NULL) {
 	    if (strncmp(buf, "IpExt:", 6) == 0)
-		get_fields(netstat_ip_fields, header, buf);
+		get_fields(netstat_ip_fields, &netstat_ip_keys, header, buf);
 	    else if (strncmp(buf, "TcpExt:", 7) == 0)
-		get_fields(netstat_tcp_fields, header, buf);
+		get_fields(netstat_tcp_fields, &netstat_tcp_keys, header, buf);
 	    else
 		__pmNotifyErr(LOG_ERR, "Unrecognised netstat row: %s\n", buf);
 	}
     }
-    fclose(fp);
     return 0;
 }
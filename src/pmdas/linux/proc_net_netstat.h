@@ -12,8 +12,6 @@
  * for more details.
  */
 
-#define NETSTAT_MAX_COLUMNS	256 /* arbitrary upper bound (228 observed as of 22/04/2014)*/
-
 enum {
     _PM_NETSTAT_IPEXT_INNOROUTES = 0,
     _PM_NETSTAT_IPEXT_INTRUNCATEDPKTS,
@@ -17,6 +17,7 @@
 #include "impl.h"
 #include "pmda.h"
 #include "indom.h"
+#include "linux_parse.h"
 #include "proc_net_snmp.h"
 
 extern proc_net_snmp_t	_pm_proc_net_snmp;
@@ -206,45 +207,33 @@ snmp_fields_t udplite_fields[] = {
     { .field = NULL, .offset = NULL }
 };
 
+static linux_keytab_t ip_keys = LINUX_KEYTAB(ip_fields);
+static linux_keytab_t icmp_keys = LINUX_KEYTAB(icmp_fields);
+static linux_keytab_t tcp_keys = LINUX_KEYTAB(tcp_fields);
+static linux_keytab_t udp_keys = LINUX_KEYTAB(udp_fields);
+static linux_keytab_t udplite_keys = LINUX_KEYTAB(udplite_fields);
+
 static void
-get_fields(snmp_fields_t *fields, char *header, char *buffer)
+get_fields(snmp_fields_t *fields, linux_keytab_t *keys, char *header, char *buffer)
 {
-    int i, j, count;
-    char *p, *indices[SNMP_MAX_COLUMNS];
-
-    /* first get pointers to each of the column headings */
-    strtok(header, " ");
-    for (i = 0; i < SNMP_MAX_COLUMNS; i++) {
-	if ((p = strtok(NULL, " \n")) == NULL)
-	    break;
-	indices[i] = p;
-    }
-    count = i;
+    char	*name, *p;
+    __uint64_t	value;
+    int		i;
 
     /*
-     * Extract values via back-referencing column headings.
-     * "i" is the last found index, which we use for a bit
-     * of optimisation for the (common) in-order maps case
-     * (where "in order" means in the order defined by the
-     * passed in "fields" table which typically matches the
-     * kernel - but may be out-of-order for older kernels).
+     * Extract values by pairing each column heading with the value
+     * in the same column, then looking the heading up in the table
+     * (columns may be in any order, and unknown ones are ignored).
      */
-    strtok(buffer, " ");
-    for (i = j = 0; j < count && fields[i].field; j++, i++) {
-        if ((p = strtok(NULL, " \n")) == NULL)
-            break;
-        if (strcmp(fields[i].field, indices[j]) == 0) {
-            *fields[i].offset = strtoull(p, NULL, 10);
-        } else {
-            for (i = 0; fields[i].field; i++) {
-                if (strcmp(fields[i].field, indices[j]) != 0)
-                    continue;
-                *fields[i].offset = strtoull(p, NULL, 10);
-                break;
-            }
-	    if (fields[i].field == NULL) /* not found, ignore */
-		i = 0;
-	}
+    linux_parse_word(&header);
+    linux_parse_word(&buffer);
+    while ((name = linux_parse_word(&header)) != NULL) {
+	if ((p = linux_parse_word(&buffer)) == NULL)
+	    break;
+	if ((i = linux_keytab_lookup(keys, name, strlen(name))) < 0)
+	    continue;
+	if (linux_parse_u64(&p, &value))
+	    *fields[i].offset = value;
     }
 }
 
@@ -336,32 +325,32 @@ init_refresh_proc_net_snmp(proc_net_snmp_t *snmp)
 int
 refresh_proc_net_snmp(proc_net_snmp_t *snmp)
 {
-    char	buf[MAXPATHLEN];
-    char	header[1024];
-    FILE	*fp;
+    static linux_file_t	snmp_file = LINUX_FILE("/proc/net/snmp");
+    char	*header;
+    char	*buf;
+    int		sts;
 
     init_refresh_proc_net_snmp(snmp);
-    if ((fp = linux_statsfile("/proc/net/snmp", buf, sizeof(buf))) == NULL)
-	return -oserror();
-    while (fgets(header, sizeof(header), fp) != NULL) {
-	if (fgets(buf, sizeof(buf), fp) != NULL) {
+    if ((sts = linux_file_read(&snmp_file, 0)) < 0)
+	return sts;
+    while ((header = linux_file_line(&snmp_file)) != NULL) {
+	if ((buf = linux_file_line(&snmp_file)) != NULL) {
 	    if (strncmp(buf, "Ip:", 3) == 0)
-		get_fields(ip_fields, header, buf);
+		get_fields(ip_fields, &ip_keys, header, buf);
 	    else if (strncmp(buf, "Icmp:", 5) == 0)
-		get_fields(icmp_fields, header, buf);
+		get_fields(icmp_fields, &icmp_keys, header, buf);
 	    else if (strncmp(buf, "IcmpMsg:", 8) == 0)
 		get_ordinal_fields(icmpmsg_fields, header, buf,
                                    NR_ICMPMSG_COUNTERS);
 	    else if (strncmp(buf, "Tcp:", 4) == 0)
-		get_fields(tcp_fields, header, buf);
+		get_fields(tcp_fields, &tcp_keys, header, buf);
 	    else if (strncmp(buf, "Udp:", 4) == 0)
-		get_fields(udp_fields, header, buf);
+		get_fields(udp_fields, &udp_keys, header, buf);
 	    else if (strncmp(buf, "UdpLite:", 8) == 0)
-		get_fields(udplite_fields, header, buf);
+		get_fields(udplite_fields, &udplite_keys, header, buf);
 	    else
-	    	fprintf(stderr, "Error: unrecognised snmp row: %s", buf);
+	    	fprintf(stderr, "Error: unrecognised snmp row: %s\n", buf);
 	}
     }
-    fclose(fp);
     return 0;
 }
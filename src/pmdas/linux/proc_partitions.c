@@ -28,6 +28,7 @@
 #include "convert.h"
 #include "clusters.h"
 #include "indom.h"
+#include "linux_parse.h"
 #include "proc_partitions.h"
 
 int _pm_have_kernel_2_6_partition_stats;
@@ -315,22 +316,69 @@ persistent_md_name(char *namebuf, int namelen)
     return found;
 }
 
+/* statistics following the device name, in either file */
+#define NR_DISK_FIELDS	11
+
+/* as many fields as were present, in order, as sscanf(3) would */
+static void
+disk_fields(partitions_entry_t *p, const __uint64_t *values, int count)
+{
+    switch (count) {
+    case 11:
+	p->aveq = values[10];
+	/*FALLTHROUGH*/
+    case 10:
+	p->io_ticks = values[9];
+	/*FALLTHROUGH*/
+    case 9:
+	p->ios_in_flight = values[8];
+	/*FALLTHROUGH*/
+    case 8:
+	p->wr_ticks = values[7];
+	/*FALLTHROUGH*/
+    case 7:
+	p->wr_sectors = values[6];
+	/*FALLTHROUGH*/
+    case 6:
+	p->wr_merges = values[5];
+	/*FALLTHROUGH*/
+    case 5:
+	p->wr_ios = values[4];
+	/*FALLTHROUGH*/
+    case 4:
+	p->rd_ticks = values[3];
+	/*FALLTHROUGH*/
+    case 3:
+	p->rd_sectors = values[2];
+	/*FALLTHROUGH*/
+    case 2:
+	p->rd_merges = values[1];
+	/*FALLTHROUGH*/
+    case 1:
+	p->rd_ios = values[0];
+    }
+}
+
 int
 refresh_proc_partitions(pmInDom disk_indom, pmInDom partitions_indom,
 			pmInDom dm_indom, pmInDom md_indom)
 {
-    FILE *fp;
-    int devmin;
-    int devmaj;
+    static linux_file_t diskstats_file = LINUX_FILE("/proc/diskstats");
+    static linux_file_t partitions_file = LINUX_FILE("/proc/partitions");
+    linux_file_t *lf;
+    __uint64_t devmin;
+    __uint64_t devmaj;
+    __uint64_t blocks = 0;
+    __uint64_t values[NR_DISK_FIELDS];
     int n;
+    int sts;
     int indom;
     int have_proc_diskstats;
     int inst;
-    unsigned long long blocks;
     partitions_entry_t *p;
     int indom_changes = 0;
     char *dmname, *mdname;
-    char buf[MAXPATHLEN];
+    char *line, *name;
     char namebuf[MAXPATHLEN];
     static int first = 1;
 
@@ -350,30 +398,37 @@ refresh_proc_partitions(pmInDom disk_indom, pmInDom partitions_indom,
     pmdaCacheOp(dm_indom, PMDA_CACHE_INACTIVE);
     pmdaCacheOp(md_indom, PMDA_CACHE_INACTIVE);
 
-    if ((fp = linux_statsfile("/proc/diskstats", buf, sizeof(buf))))
+    if (linux_file_read(&diskstats_file, 0) >= 0) {
 	/* 2.6 style disk stats */
+	lf = &diskstats_file;
 	have_proc_diskstats = 1;
-    else if ((fp = linux_statsfile("/proc/partitions", buf, sizeof(buf))))
+    }
+    else if ((sts = linux_file_read(&partitions_file, 0)) >= 0) {
+	lf = &partitions_file;
 	have_proc_diskstats = 0;
+    }
     else
-	return -oserror();
+	return sts;
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
+    while ((line = linux_file_line(lf)) != NULL) {
 	dmname = mdname = NULL;
-	if (buf[0] != ' ' || buf[0] == '\n') {
+	if (line[0] != ' ') {
 	    /* skip heading */
 	    continue;
 	}
 
-	if (have_proc_diskstats) {
-	    if ((n = sscanf(buf, "%d %d %s", &devmaj, &devmin, namebuf)) != 3)
-		continue;
-	}
-	else {
+	if (!linux_parse_u64(&line, &devmaj) ||
+	    !linux_parse_u64(&line, &devmin))
+	    continue;
+	if (!have_proc_diskstats) {
 	    /* /proc/partitions */
-	    if ((n = sscanf(buf, "%d %d %llu %s", &devmaj, &devmin, &blocks, namebuf)) != 4)
+	    if (!linux_parse_u64(&line, &blocks))
 		continue;
 	}
+	if ((name = linux_parse_word(&line)) == NULL)
+	    continue;
+	strncpy(namebuf, name, sizeof(namebuf));
+	namebuf[sizeof(namebuf)-1] = '\0';
 
 	if (_pm_isdm(namebuf)) {
 	    indom = dm_indom;
@@ -434,17 +489,18 @@ refresh_proc_partitions(pmInDom disk_indom, pmInDom partitions_indom,
 	    /* short /proc/diskstats or /proc/partitions name */
 	    inst = pmdaCacheStore(indom, PMDA_CACHE_ADD, namebuf, p);
 
+	p->major = devmaj;
+	p->minor = devmin;
+	for (n = 0; n < NR_DISK_FIELDS; n++)
+	    if (!linux_parse_u64(&line, &values[n]))
+		break;
+
 	if (have_proc_diskstats) {
 	    /* 2.6 style /proc/diskstats */
 	    p->nr_blocks = 0;
-	    namebuf[0] = '\0';
 	    /* Linux source: block/genhd.c::diskstats_show(1) */
-	    n = sscanf(buf, "%u %u %s %lu %lu %llu %u %lu %lu %llu %u %u %u %u",
-		&p->major, &p->minor, namebuf,
-		&p->rd_ios, &p->rd_merges, &p->rd_sectors, &p->rd_ticks,
-		&p->wr_ios, &p->wr_merges, &p->wr_sectors, &p->wr_ticks,
-		&p->ios_in_flight, &p->io_ticks, &p->aveq);
-	    if (n != 14) {
+	    disk_fields(p, values, n);
+	    if (n != NR_DISK_FIELDS) {
                 /*
 		 * From 2.6.25 onward, the full set of statistics is
 		 * available again for both partitions and disks.
@@ -453,21 +509,20 @@ refresh_proc_partitions(pmInDom disk_indom, pmInDom partitions_indom,
 		p->rd_merges = p->wr_merges = p->wr_ticks =
 			p->ios_in_flight = p->io_ticks = p->aveq = 0;
 		/* Linux source: block/genhd.c::diskstats_show(2) */
-		n = sscanf(buf, "%u %u %s %u %u %u %u\n",
-		    &p->major, &p->minor, namebuf,
-		    (unsigned int *)&p->rd_ios, (unsigned int *)&p->rd_sectors,
-		    (unsigned int *)&p->wr_ios, (unsigned int *)&p->wr_sectors);
+		if (n > 0)
+		    p->rd_ios = (unsigned int)values[0];
+		if (n > 1)
+		    p->rd_sectors = (unsigned int)values[1];
+		if (n > 2)
+		    p->wr_ios = (unsigned int)values[2];
+		if (n > 3)
+		    p->wr_sectors = (unsigned int)values[3];
 	    }
 	}
 	else {
 	    /* 2.4 style /proc/partitions */
-	    namebuf[0] = '\0';
-	    n = sscanf(buf, "%u %u %lu %s %lu %lu %llu %u %lu %lu %llu %u %u %u %u",
-		&p->major, &p->minor, &p->nr_blocks, namebuf,
-		&p->rd_ios, &p->rd_merges, &p->rd_sectors,
-		&p->rd_ticks, &p->wr_ios, &p->wr_merges,
-		&p->wr_sectors, &p->wr_ticks, &p->ios_in_flight,
-		&p->io_ticks, &p->aveq);
+	    p->nr_blocks = blocks;
+	    disk_fields(p, values, n);
 	}
 
     }
@@ -491,8 +546,6 @@ refresh_proc_partitions(pmInDom disk_indom, pmInDom partitions_indom,
     /*
      * success
      */
-    if (fp)
-	fclose(fp);
     return 0;
 }
 
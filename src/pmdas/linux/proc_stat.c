@@ -23,80 +23,83 @@
 #include <dirent.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include "linux_parse.h"
 #include "proc_cpuinfo.h"
 #include "proc_stat.h"
 
+enum {
+    STAT_PAGE,
+    STAT_SWAP,
+    STAT_INTR,
+    STAT_CTXT,
+    STAT_BTIME,
+    STAT_PROCESSES,
+    STAT_PROCS_RUNNING,
+    STAT_PROCS_BLOCKED,
+};
+
+static struct {
+    const char	*field;
+} stat_fields[] = {
+    [STAT_PAGE]		= { "page" },
+    [STAT_SWAP]		= { "swap" },
+    [STAT_INTR]		= { "intr" },
+    [STAT_CTXT]		= { "ctxt" },
+    [STAT_BTIME]	= { "btime" },
+    [STAT_PROCESSES]	= { "processes" },
+    [STAT_PROCS_RUNNING] = { "procs_running" },
+    [STAT_PROCS_BLOCKED] = { "procs_blocked" },
+    { NULL }
+};
+
+static linux_keytab_t stat_keys = LINUX_KEYTAB(stat_fields);
+static linux_file_t stat_file = LINUX_FILE("/proc/stat");
+
+#define NR_CPU_FIELDS	10
+
+/*
+ * cpu  95379 4 20053 6502503
+ * 2.6 kernels have 3 additional fields for wait, irq and soft_irq.
+ * More recent (2008) 2.6 kernels have an extra field for guest and
+ * also (since 2009) guest_nice.  Fields that are not present keep
+ * their previous values.
+ */
+static void
+stat_cpu_fields(char *p, unsigned long long **fields)
+{
+    __uint64_t	value;
+    int		i;
+
+    for (i = 0; i < NR_CPU_FIELDS && linux_parse_u64(&p, &value); i++)
+	*fields[i] = value;
+}
+
 int
 refresh_proc_stat(proc_cpuinfo_t *proc_cpuinfo, proc_stat_t *proc_stat)
 {
     pmdaIndom *idp = PMDAINDOM(CPU_INDOM);
-    char buf[MAXPATHLEN];
-    char fmt[64];
-    static int fd = -1; /* kept open until exit() */
+    unsigned long long *fields[NR_CPU_FIELDS];
     static int started;
-    static char *statbuf;
-    static int maxstatbuf;
-    static char **bufindex;
-    static int nbufindex;
-    static int maxbufindex;
-    int size;
+    __uint64_t value;
+    char *line;
+    char *p;
+    int cpunum;
+    int node;
     int n;
     int i;
-    int j;
 
-    if (fd >= 0) {
-	if (lseek(fd, 0, SEEK_SET) < 0)
-	    return -oserror();
-    } else {
-	snprintf(buf, sizeof(buf), "%s/proc/stat", linux_statspath);
-	if ((fd = open(buf, O_RDONLY)) < 0)
-	    return -oserror();
-    }
-
-    for (n=0;;) {
-	while (n >= maxstatbuf) {
-	    size = maxstatbuf + 512;
-	    if ((statbuf = (char *)realloc(statbuf, size)) == NULL)
-		return -ENOMEM;
-	    maxstatbuf = size;
-	}
-	size = (statbuf + maxstatbuf) - (statbuf + n);
-	if ((i = read(fd, statbuf + n, size)) > 0)
-	    n += i;
-	else
-	    break;
-    }
-    statbuf[n] = '\0';
-
-    if (bufindex == NULL) {
-	size = 4 * sizeof(char *);
-	if ((bufindex = (char **)malloc(size)) == NULL)
-	    return -ENOMEM;
-	maxbufindex = 4;
-    }
-
-    nbufindex = 0;
-    bufindex[nbufindex] = statbuf;
-    for (i=0; i < n; i++) {
-	if (statbuf[i] == '\n' || statbuf[i] == '\0') {
-	    statbuf[i] = '\0';
-	    if (nbufindex + 1 >= maxbufindex) {
-		size = (maxbufindex + 4) * sizeof(char *);
-		if ((bufindex = (char **)realloc(bufindex, size)) == NULL)
-		    return -ENOMEM;
-	    	maxbufindex += 4;
-	    }
-	    bufindex[++nbufindex] = statbuf + i + 1;
-	}
-    }
+    if ((n = linux_file_read(&stat_file, 0)) < 0)
+	return n;
 
     if (!started) {
 	started = 1;
 	memset(proc_stat, 0, sizeof(*proc_stat));
 
 	/* scan ncpus */
-	for (i=0; i < nbufindex; i++) {
-	    if (strncmp("cpu", bufindex[i], 3) == 0 && isdigit((int)bufindex[i][3]))
+	for (p = stat_file.buf; p != NULL; p = strchr(p, '\n')) {
+	    if (*p == '\n')
+		p++;
+	    if (strncmp("cpu", p, 3) == 0 && isdigit((int)p[3]))
 	    	proc_stat->ncpu++;
 	}
 	if (proc_stat->ncpu == 0)
@@ -154,175 +157,128 @@ refresh_proc_stat(proc_cpuinfo_t *proc_cpuinfo, proc_stat_t *proc_stat)
 	memset(proc_stat->n_guest, 0, n);
 	memset(proc_stat->n_guest_nice, 0, n);
     }
-    /*
-     * cpu  95379 4 20053 6502503
-     * 2.6 kernels have 3 additional fields
-     * for wait, irq and soft_irq.
-     */
-    strcpy(fmt, "cpu %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu");
-    n = sscanf((const char *)bufindex[0], fmt,
-	&proc_stat->user, &proc_stat->nice,
-	&proc_stat->sys, &proc_stat->idle,
-	&proc_stat->wait, &proc_stat->irq,
-	&proc_stat->sirq, &proc_stat->steal,
-	&proc_stat->guest, &proc_stat->guest_nice);
 
-    /*
-     * per-cpu stats
-     * e.g. cpu0 95379 4 20053 6502503
-     * 2.6 kernels have 3 additional fields for wait, irq and soft_irq.
-     * More recent (2008) 2.6 kernels have an extra field for guest and
-     * also (since 2009) guest_nice.
-     */
-    if (proc_stat->ncpu == 1) {
-	/*
-	 * Don't bother scanning - the per-cpu and per-node counters are the
-         * same as for "all" cpus, as already scanned above.
-	 * This also handles the non-SMP code where
-	 * there is no line starting with "cpu0".
-	 */
-	proc_stat->p_user[0] = proc_stat->n_user[0] = proc_stat->user;
-	proc_stat->p_nice[0] = proc_stat->n_nice[0] = proc_stat->nice;
-	proc_stat->p_sys[0] = proc_stat->n_sys[0] = proc_stat->sys;
-	proc_stat->p_idle[0] = proc_stat->n_idle[0] = proc_stat->idle;
-	proc_stat->p_wait[0] = proc_stat->n_wait[0] = proc_stat->wait;
-	proc_stat->p_irq[0] = proc_stat->n_irq[0] = proc_stat->irq;
-	proc_stat->p_sirq[0] = proc_stat->n_sirq[0] = proc_stat->sirq;
-	proc_stat->p_steal[0] = proc_stat->n_steal[0] = proc_stat->steal;
-    	proc_stat->p_guest[0] = proc_stat->n_guest[0] = proc_stat->guest;
-    	proc_stat->p_guest_nice[0] = proc_stat->n_guest_nice[0] = proc_stat->guest_nice;
-    }
-    else {
-	strcpy(fmt, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu");
-	for (i=0; i < proc_stat->ncpu; i++) {
-	    for (j=0; j < nbufindex; j++) {
-		if (strncmp("cpu", bufindex[j], 3) == 0 && isdigit((int)bufindex[j][3])) {
-		    int c;
-		    int cpunum = atoi(&bufindex[j][3]);
-		    int node;
-		    if (cpunum >= 0 && cpunum < proc_stat->ncpu) {
-			n = sscanf(bufindex[j], fmt, &c,
-			    &proc_stat->p_user[cpunum],
-			    &proc_stat->p_nice[cpunum],
-			    &proc_stat->p_sys[cpunum],
-			    &proc_stat->p_idle[cpunum],
-			    &proc_stat->p_wait[cpunum],
-			    &proc_stat->p_irq[cpunum],
-			    &proc_stat->p_sirq[cpunum],
-			    &proc_stat->p_steal[cpunum],
-			    &proc_stat->p_guest[cpunum],
-			    &proc_stat->p_guest_nice[cpunum]);
-			if ((node = proc_cpuinfo->cpuinfo[cpunum].node) != -1) {
-			    proc_stat->n_user[node] += proc_stat->p_user[cpunum];
-			    proc_stat->n_nice[node] += proc_stat->p_nice[cpunum];
-			    proc_stat->n_sys[node] += proc_stat->p_sys[cpunum];
-			    proc_stat->n_idle[node] += proc_stat->p_idle[cpunum];
-			    proc_stat->n_wait[node] += proc_stat->p_wait[cpunum];
-			    proc_stat->n_irq[node] += proc_stat->p_irq[cpunum];
-			    proc_stat->n_sirq[node] += proc_stat->p_sirq[cpunum];
-			    proc_stat->n_steal[node] += proc_stat->p_steal[cpunum];
-			    proc_stat->n_guest[node] += proc_stat->p_guest[cpunum];
-			    proc_stat->n_guest_nice[node] += proc_stat->p_guest_nice[cpunum];
-			}
-		    }
-		}
+    /* a single pass over the file, each line is parsed just once */
+    while ((line = linux_file_line(&stat_file)) != NULL) {
+	if (strncmp("cpu", line, 3) == 0) {
+	    if (isspace((int)line[3])) {
+		fields[0] = &proc_stat->user;
+		fields[1] = &proc_stat->nice;
+		fields[2] = &proc_stat->sys;
+		fields[3] = &proc_stat->idle;
+		fields[4] = &proc_stat->wait;
+		fields[5] = &proc_stat->irq;
+		fields[6] = &proc_stat->sirq;
+		fields[7] = &proc_stat->steal;
+		fields[8] = &proc_stat->guest;
+		fields[9] = &proc_stat->guest_nice;
+		stat_cpu_fields(line + 3, fields);
+		continue;
 	    }
-	    if (j == nbufindex)
-		break;
+	    /*
+	     * per-cpu stats, e.g. cpu0 95379 4 20053 6502503
+	     * For a single CPU, don't bother scanning - the per-cpu
+	     * and per-node counters are the same as for "all" cpus.
+	     * This also handles the non-SMP code where there is no
+	     * line starting with "cpu0".
+	     */
+	    if (!isdigit((int)line[3]) || proc_stat->ncpu == 1)
+		continue;
+	    p = line + 3;
+	    if (!linux_parse_u64(&p, &value) || value >= proc_stat->ncpu)
+		continue;
+	    cpunum = value;
+	    fields[0] = &proc_stat->p_user[cpunum];
+	    fields[1] = &proc_stat->p_nice[cpunum];
+	    fields[2] = &proc_stat->p_sys[cpunum];
+	    fields[3] = &proc_stat->p_idle[cpunum];
+	    fields[4] = &proc_stat->p_wait[cpunum];
+	    fields[5] = &proc_stat->p_irq[cpunum];
+	    fields[6] = &proc_stat->p_sirq[cpunum];
+	    fields[7] = &proc_stat->p_steal[cpunum];
+	    fields[8] = &proc_stat->p_guest[cpunum];
+	    fields[9] = &proc_stat->p_guest_nice[cpunum];
+	    stat_cpu_fields(p, fields);
+	    if ((node = proc_cpuinfo->cpuinfo[cpunum].node) != -1) {
+		proc_stat->n_user[node] += proc_stat->p_user[cpunum];
+		proc_stat->n_nice[node] += proc_stat->p_nice[cpunum];
+		proc_stat->n_sys[node] += proc_stat->p_sys[cpunum];
+		proc_stat->n_idle[node] += proc_stat->p_idle[cpunum];
+		proc_stat->n_wait[node] += proc_stat->p_wait[cpunum];
+		proc_stat->n_irq[node] += proc_stat->p_irq[cpunum];
+		proc_stat->n_sirq[node] += proc_stat->p_sirq[cpunum];
+		proc_stat->n_steal[node] += proc_stat->p_steal[cpunum];
+		proc_stat->n_guest[node] += proc_stat->p_guest[cpunum];
+		proc_stat->n_guest_nice[node] += proc_stat->p_guest_nice[cpunum];
+	    }
+	    continue;
 	}
-    }
 
-    /*
-     * page 59739 34786
-     * Note: this has moved to /proc/vmstat in 2.6 kernels
-     */
-    strcpy(fmt, "page %u %u");
-    for (j=0; j < nbufindex; j++) {
-    	if (strncmp(fmt, bufindex[j], 5) == 0) {
-	    sscanf((const char *)bufindex[j], fmt,
-		&proc_stat->page[0], &proc_stat->page[1]);
+	p = line;
+	while (*p && !isspace((int)*p))
+	    p++;
+	switch (linux_keytab_lookup(&stat_keys, line, p - line)) {
+	/*
+	 * page 59739 34786
+	 * swap 0 1
+	 * Note: these have moved to /proc/vmstat in 2.6 kernels
+	 */
+	case STAT_PAGE:
+	    if (linux_parse_u64(&p, &value)) {
+		proc_stat->page[0] = value;
+		if (linux_parse_u64(&p, &value))
+		    proc_stat->page[1] = value;
+	    }
 	    break;
-	}
-    }
-
-    /*
-     * swap 0 1
-     * Note: this has moved to /proc/vmstat in 2.6 kernels
-     */
-    strcpy(fmt, "swap %u %u");
-    for (j=0; j < nbufindex; j++) {
-    	if (strncmp(fmt, bufindex[j], 5) == 0) {
-	    sscanf((const char *)bufindex[j], fmt,
-		&proc_stat->swap[0], &proc_stat->swap[1]);
+	case STAT_SWAP:
+	    if (linux_parse_u64(&p, &value)) {
+		proc_stat->swap[0] = value;
+		if (linux_parse_u64(&p, &value))
+		    proc_stat->swap[1] = value;
+	    }
 	    break;
-	}
-    }
-
-    /*
-     * intr 32845463 24099228 2049 0 2 ....
-     * (just export the first number, which is total interrupts)
-     */
-    strcpy(fmt, "intr %llu");
-    for (j=0; j < nbufindex; j++) {
-    	if (strncmp(fmt, bufindex[j], 5) == 0) {
-	    sscanf((const char *)bufindex[j], fmt, &proc_stat->intr);
+	/*
+	 * intr 32845463 24099228 2049 0 2 ....
+	 * (just export the first number, which is total interrupts)
+	 */
+	case STAT_INTR:
+	    if (linux_parse_u64(&p, &value))
+		proc_stat->intr = value;
 	    break;
-	}
-    }
-
-    /*
-     * ctxt 1733480
-     */
-    strcpy(fmt, "ctxt %llu");
-    for (j=0; j < nbufindex; j++) {
-    	if (strncmp(fmt, bufindex[j], 5) == 0) {
-	    sscanf((const char *)bufindex[j], fmt, &proc_stat->ctxt);
+	case STAT_CTXT:
+	    if (linux_parse_u64(&p, &value))
+		proc_stat->ctxt = value;
 	    break;
-	}
-    }
-
-    /*
-     * btime 1733480
-     */
-    strcpy(fmt, "btime %lu");
-    for (j=0; j < nbufindex; j++) {
-    	if (strncmp(fmt, bufindex[j], 6) == 0) {
-	    sscanf((const char *)bufindex[j], fmt, &proc_stat->btime);
+	case STAT_BTIME:
+	    if (linux_parse_u64(&p, &value))
+		proc_stat->btime = value;
 	    break;
-	}
-    }
-
-    /*
-     * processes 2213
-     */
-    strcpy(fmt, "processes %lu");
-    for (j=0; j < nbufindex; j++) {
-    	if (strncmp(fmt, bufindex[j], 10) == 0) {
-	    sscanf((const char *)bufindex[j], fmt, &proc_stat->processes);
+	case STAT_PROCESSES:
+	    if (linux_parse_u64(&p, &value))
+		proc_stat->processes = value;
 	    break;
-	}
-    }
-
-    /*
-     * procs_running 1
-     */
-    strcpy(fmt, "procs_running %lu");
-    for (j=0; j < nbufindex; j++) {
-    	if (strncmp(fmt, bufindex[j], 10) == 0) {
-	    sscanf((const char *)bufindex[j], fmt, &proc_stat->procs_running);
+	case STAT_PROCS_RUNNING:
+	    if (linux_parse_u64(&p, &value))
+		proc_stat->procs_running = value;
+	    break;
+	case STAT_PROCS_BLOCKED:
+	    if (linux_parse_u64(&p, &value))
+		proc_stat->procs_blocked = value;
 	    break;
 	}
     }
 
-    /*
-     * procs_blocked 0
-     */
-    strcpy(fmt, "procs_blocked %lu");
-    for (j=0; j < nbufindex; j++) {
-    	if (strncmp(fmt, bufindex[j], 10) == 0) {
-	    sscanf((const char *)bufindex[j], fmt, &proc_stat->procs_blocked);
-	    break;
-	}
+    if (proc_stat->ncpu == 1) {
+	proc_stat->p_user[0] = proc_stat->n_user[0] = proc_stat->user;
+	proc_stat->p_nice[0] = proc_stat->n_nice[0] = proc_stat->nice;
+	proc_stat->p_sys[0] = proc_stat->n_sys[0] = proc_stat->sys;
+	proc_stat->p_idle[0] = proc_stat->n_idle[0] = proc_stat->idle;
+	proc_stat->p_wait[0] = proc_stat->n_wait[0] = proc_stat->wait;
+	proc_stat->p_irq[0] = proc_stat->n_irq[0] = proc_stat->irq;
+	proc_stat->p_sirq[0] = proc_stat->n_sirq[0] = proc_stat->sirq;
+	proc_stat->p_steal[0] = proc_stat->n_steal[0] = proc_stat->steal;
+    	proc_stat->p_guest[0] = proc_stat->n_guest[0] = proc_stat->guest;
+    	proc_stat->p_guest_nice[0] = proc_stat->n_guest_nice[0] = proc_stat->guest_nice;
     }
 
     /* success */
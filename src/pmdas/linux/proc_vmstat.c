@@ -20,6 +20,7 @@
 #include "pmapi.h"
 #include "pmda.h"
 #include "indom.h"
+#include "linux_parse.h"
 #include "proc_vmstat.h"
 
 static struct {
@@ -243,6 +244,9 @@ static struct {
     { .field = NULL, .offset = NULL }
 };
 
+static linux_keytab_t vmstat_keys = LINUX_KEYTAB(vmstat_fields);
+static linux_file_t vmstat_file = LINUX_FILE("/proc/vmstat");
+
 #define VMSTAT_OFFSET(ii, pp) (int64_t *)((char *)pp + \
     (__psint_t)vmstat_fields[ii].offset - (__psint_t)&_pm_proc_vmstat)
 
@@ -268,39 +272,33 @@ proc_vmstat_init(void)
 int
 refresh_proc_vmstat(proc_vmstat_t *proc_vmstat)
 {
-    char	buf[1024];
     char	*bufp;
+    char	*line;
     int64_t	*p;
+    __uint64_t	value;
     int		i;
-    FILE	*fp;
+    int		sts;
 
     for (i = 0; vmstat_fields[i].field != NULL; i++) {
 	p = VMSTAT_OFFSET(i, proc_vmstat);
 	*p = -1; /* marked as "no value available" */
     }
 
-    if ((fp = linux_statsfile("/proc/vmstat", buf, sizeof(buf))) == NULL)
-    	return -oserror();
+    if ((sts = linux_file_read(&vmstat_file, 0)) < 0)
+    	return sts;
 
     _pm_have_proc_vmstat = 1;
 
-    while (fgets(buf, sizeof(buf), fp) != NULL) {
-	if ((bufp = strchr(buf, ' ')) == NULL)
+    while ((line = linux_file_line(&vmstat_file)) != NULL) {
+	if ((bufp = strchr(line, ' ')) == NULL)
+	    continue;
+	if ((i = linux_keytab_lookup(&vmstat_keys, line, bufp - line)) < 0)
 	    continue;
-	*bufp = '\0';
-	for (i = 0; vmstat_fields[i].field != NULL; i++) {
-	    if (strcmp(buf, vmstat_fields[i].field) != 0)
-		continue;
+	if (linux_parse_u64(&bufp, &value)) {
 	    p = VMSTAT_OFFSET(i, proc_vmstat);
-	    for (bufp++; *bufp; bufp++) {
-	    	if (isdigit((int)*bufp)) {
-		    sscanf(bufp, "%llu", (unsigned long long *)p);
-		    break;
-		}
-	    }
+	    *p = value;
 	}
     }
-    fclose(fp);
 
     if (proc_vmstat->nr_slab == -1)	/* split apart in 2.6.18 */
 	proc_vmstat->nr_slab = proc_vmstat->nr_slab_reclaimable +
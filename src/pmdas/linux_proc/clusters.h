@@ -50,9 +50,10 @@
 #define CLUSTER_HOTPROC_PID_FD          59 /* /proc/<pid>/fd */
 #define CLUSTER_HOTPROC_GLOBAL		60 /* overall hotproc stats and controls*/
 #define CLUSTER_HOTPROC_PRED      	61 /* derived hotproc metrics */
+#define CLUSTER_PROC_EVENTS		62 /* proc connector and taskstats */
 
 
 #define MIN_CLUSTER  8		/* first cluster number we use here */
-#define NUM_CLUSTERS 62		/* one more than highest cluster number used */
+#define NUM_CLUSTERS 63		/* one more than highest cluster number used */
 
 #endif /* _CLUSTERS_H */
@@ -34,16 +34,17 @@ char *conf_buffer;	/* contains config text */
 char *pred_buffer;	/* contains parsed predicate */
 
 static bool_node *the_tree;
-static config_vars *the_vars;
-
-/* internal functions */
-static int eval_predicate(bool_node *);
-static int eval_comparison(bool_node *);
-static int eval_num_comp(N_tag, bool_node *, bool_node *);
-static int eval_str_comp(N_tag, bool_node *, bool_node *);
-static int eval_match_comp(N_tag, bool_node *, bool_node *);
-static char* get_strvalue(bool_node *);
-static double get_numvalue(bool_node *);
+static bool_node *held_tree;	/* snapshot being evaluated, see hold_tree() */
+static bool_node *retired_tree;	/* replaced while held, freed on release */
+
+/* internal functions, the variables are passed down so these are reentrant */
+static int eval_predicate(bool_node *, config_vars *);
+static int eval_comparison(bool_node *, config_vars *);
+static int eval_num_comp(N_tag, bool_node *, bool_node *, config_vars *);
+static int eval_str_comp(N_tag, bool_node *, bool_node *, config_vars *);
+static int eval_match_comp(N_tag, bool_node *, bool_node *, config_vars *);
+static char* get_strvalue(bool_node *, config_vars *);
+static double get_numvalue(bool_node *, config_vars *);
 static void eval_error(char *);
 
 extern int parse_predicate(bool_node **);
@@ -184,15 +185,43 @@ void
 new_tree(bool_node *tree)
 {
     /* free_tree will delete the tree we just constructed if NULL is passed in.  Not sure why */
-    if (the_tree != NULL )
-	free_tree(the_tree);
+    if (the_tree != NULL) {
+	if (the_tree == held_tree)
+	    retired_tree = the_tree;
+	else
+	    free_tree(the_tree);
+    }
 
     the_tree = tree;
 }
 
+/*
+ * Snapshot the current predicate so that it can be evaluated without
+ * the hotproc config lock held; a tree replaced by new_tree() meanwhile
+ * is not freed until release_tree().  Both are called with the config
+ * lock held, and there is at most one snapshot (the sampler's) at once.
+ */
+bool_node *
+hold_tree(void)
+{
+    held_tree = the_tree;
+    return held_tree;
+}
+
+void
+release_tree(void)
+{
+    if (retired_tree != NULL) {
+	free_tree(retired_tree);
+	retired_tree = NULL;
+    }
+    held_tree = NULL;
+}
+
 int
 read_config(FILE *conf)
 {
+    bool_node *tree = NULL;
     struct stat stat_buf;
     long size;
     int sts;
@@ -224,7 +253,9 @@ read_config(FILE *conf)
     }
     conf_buffer[size] = '\0'; /* terminate the buffer */
 
-    return parse_config(&the_tree);
+    if ((sts = parse_config(&tree)) >= 0)
+	new_tree(tree);
+    return sts;
 }
 
 void
@@ -234,10 +265,9 @@ dump_tree(FILE *f)
 }
 
 int
-eval_tree(config_vars *vars)
+eval_tree(bool_node *tree, config_vars *vars)
 {
-    the_vars = vars;
-    return eval_predicate(the_tree);
+    return eval_predicate(tree, vars);
 }
 
 static void 
@@ -248,7 +278,7 @@ eval_error(char *msg)
 }
 
 static int
-eval_predicate(bool_node *pred)
+eval_predicate(bool_node *pred, config_vars *vars)
 {
     bool_node *lhs, *rhs;
 
@@ -256,25 +286,25 @@ eval_predicate(bool_node *pred)
 	case N_and:	
 	    lhs = pred->data.children.left;
 	    rhs = pred->data.children.right;
-	    return eval_predicate(lhs) && eval_predicate(rhs);	
+	    return eval_predicate(lhs, vars) && eval_predicate(rhs, vars);	
 	case N_or:	
 	    lhs = pred->data.children.left;
 	    rhs = pred->data.children.right;
-	    return eval_predicate(lhs) || eval_predicate(rhs);	
+	    return eval_predicate(lhs, vars) || eval_predicate(rhs, vars);	
 	case N_not:	
 	    lhs = pred->data.children.left;
-	    return !eval_predicate(lhs);	
+	    return !eval_predicate(lhs, vars);	
 	case N_true:
 	    return 1;
 	case N_false:
 	    return 0;
 	default:
-	    return eval_comparison(pred);
+	    return eval_comparison(pred, vars);
     }
 }
 
 static int
-eval_comparison(bool_node *comp)
+eval_comparison(bool_node *comp, config_vars *vars)
 {
     bool_node *lhs = comp->data.children.left;
     bool_node *rhs = comp->data.children.right;
@@ -282,11 +312,11 @@ eval_comparison(bool_node *comp)
     switch (comp->tag) {
 	case N_lt: case N_gt: case N_ge: case N_le:
         case N_eq: case N_neq:
-	    return eval_num_comp(comp->tag, lhs, rhs); 
+	    return eval_num_comp(comp->tag, lhs, rhs, vars); 
 	case N_seq: case N_sneq:
-	    return eval_str_comp(comp->tag, lhs, rhs);
+	    return eval_str_comp(comp->tag, lhs, rhs, vars);
 	case N_match: case N_nmatch:
-	    return eval_match_comp(comp->tag, lhs, rhs);
+	    return eval_match_comp(comp->tag, lhs, rhs, vars);
 	default:
 	    eval_error("comparison");
 	    break;
@@ -295,10 +325,10 @@ eval_comparison(bool_node *comp)
 }
 
 static int
-eval_num_comp(N_tag tag, bool_node *lhs, bool_node *rhs)
+eval_num_comp(N_tag tag, bool_node *lhs, bool_node *rhs, config_vars *vars)
 {
-    double x = get_numvalue(lhs);
-    double y = get_numvalue(rhs);
+    double x = get_numvalue(lhs, vars);
+    double y = get_numvalue(rhs, vars);
 
     switch (tag) {
 	case N_lt: return (x < y);
@@ -315,20 +345,20 @@ eval_num_comp(N_tag tag, bool_node *lhs, bool_node *rhs)
 }
 
 static double
-get_numvalue(bool_node *n)
+get_numvalue(bool_node *n, config_vars *vars)
 {
     switch(n->tag) {
 	case N_number: return n->data.num_val;
-	case N_cpuburn: return the_vars->cpuburn;
-	/*case N_syscalls: return the_vars->preds.syscalls;*/
-        case N_ctxswitch: return the_vars->preds.ctxswitch;
-        case N_virtualsize: return the_vars->preds.virtualsize;
-        case N_residentsize: return the_vars->preds.residentsize;
-        case N_iodemand: return the_vars->preds.iodemand;
-        case N_iowait: return the_vars->preds.iowait;
-        case N_schedwait: return the_vars->preds.schedwait;
-	case N_gid: return the_vars->gid;
-	case N_uid: return the_vars->uid;
+	case N_cpuburn: return vars->cpuburn;
+	/*case N_syscalls: return vars->preds.syscalls;*/
+        case N_ctxswitch: return vars->preds.ctxswitch;
+        case N_virtualsize: return vars->preds.virtualsize;
+        case N_residentsize: return vars->preds.residentsize;
+        case N_iodemand: return vars->preds.iodemand;
+        case N_iowait: return vars->preds.iowait;
+        case N_schedwait: return vars->preds.schedwait;
+	case N_gid: return vars->gid;
+	case N_uid: return vars->uid;
 	default:
 	    eval_error("number value");
 	    break;
@@ -337,10 +367,10 @@ get_numvalue(bool_node *n)
 }
 
 static int
-eval_str_comp(N_tag tag, bool_node *lhs, bool_node *rhs)
+eval_str_comp(N_tag tag, bool_node *lhs, bool_node *rhs, config_vars *vars)
 {
-    char *x = get_strvalue(lhs);
-    char *y = get_strvalue(rhs);
+    char *x = get_strvalue(lhs, vars);
+    char *y = get_strvalue(rhs, vars);
 
     switch (tag) {
 	case N_seq: return (strcmp(x,y)==0?1:0);
@@ -353,27 +383,23 @@ eval_str_comp(N_tag tag, bool_node *lhs, bool_node *rhs)
 }
 
 static int
-eval_match_comp(N_tag tag, bool_node *lhs, bool_node *rhs)
+eval_match_comp(N_tag tag, bool_node *lhs, bool_node *rhs, config_vars *vars)
 {
     int sts;
-    char *res;
-    char *str= get_strvalue(lhs);
-    char *pat = get_strvalue(rhs);
+    char *str= get_strvalue(lhs, vars);
+    char *pat = get_strvalue(rhs, vars);
 
     if (rhs->tag != N_pat) {
 	eval_error("match");
     }
 
-    res = re_comp(pat);
-    if (res != NULL) {
+    if (rhs->regex == NULL) {
 	/* should have been checked at lex stage */
 	/* => internal error */
-	eval_error(res);
-    }
-    sts = re_exec(str);
-    if (sts < 0) {
-	eval_error("re_exec");
+	eval_error(pat);
     }
+    /* as for re_exec(), but with the pattern compiled by create_pat_node() */
+    sts = re_search(rhs->regex, str, strlen(str), 0, strlen(str), NULL) >= 0;
 
     switch (tag) {
 	case N_match: return sts;
@@ -386,24 +412,24 @@ eval_match_comp(N_tag tag, bool_node *lhs, bool_node *rhs)
 }
 
 static char *
-get_strvalue(bool_node *n)
+get_strvalue(bool_node *n, config_vars *vars)
 {
     switch (n->tag) {
 	case N_str: 
 	case N_pat:
 		return n->data.str_val;
 	case N_gname: 
-		/*if (the_vars->gname != NULL)*/
-		    return the_vars->gname;
+		/*if (vars->gname != NULL)*/
+		    return vars->gname;
 		/*else
-		    return get_gname_info(the_vars->gid);*/
+		    return get_gname_info(vars->gid);*/
 	case N_uname: 
-		/*if (the_vars->uname != NULL)*/
-		    return the_vars->uname;
+		/*if (vars->uname != NULL)*/
+		    return vars->uname;
 		/*else
-		    return get_uname_info(the_vars->uid);*/
-	case N_fname: return the_vars->fname; 
-	case N_psargs: return the_vars->psargs; 
+		    return get_uname_info(vars->uid);*/
+	case N_fname: return vars->fname; 
+	case N_psargs: return vars->psargs; 
 	default:
 	    eval_error("string value");
 	    break;
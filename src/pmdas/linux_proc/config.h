@@ -44,7 +44,9 @@ extern FILE *open_config(char []);
 extern int read_config(FILE *);
 extern int parse_config(bool_node **tree);
 extern void new_tree(bool_node *tree);
-extern int eval_tree(config_vars *);
+extern bool_node *hold_tree(void);
+extern void release_tree(void);
+extern int eval_tree(bool_node *, config_vars *);
 extern void dump_tree(FILE *);
 extern void do_pred_testing(void);
 
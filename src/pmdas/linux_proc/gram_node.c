@@ -15,6 +15,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
+#include <regex.h>
 #include "./gram_node.h"
 #include "pmapi.h"
 
@@ -42,6 +44,10 @@ void free_tree(bool_node *root)
 	next = n->next;
 	if (n->tag == N_pat || n->tag == N_str)
 	    free(n->data.str_val);
+	if (n->regex != NULL) {
+	    regfree(n->regex);
+	    free(n->regex);
+	}
 	free(n);
         n = next; 
     }    
@@ -61,6 +67,7 @@ create_tag_node(N_tag tag)
 	exit(1);
     }
     new_node->tag = tag;
+    new_node->regex = NULL;
 
     /* add to front of node-list */
     new_node->next = node_list;
@@ -98,6 +105,17 @@ bool_node *create_pat_node(char *str)
 {
     bool_node *n = create_tag_node(N_pat);
     n->data.str_val = str;
+
+    /*
+     * Compile it once here (the lexer has already checked it) rather
+     * than with re_comp() at each match, so that the predicate can be
+     * evaluated by several threads at once.
+     */
+    if ((n->regex = calloc(1, sizeof(*n->regex))) != NULL &&
+	re_compile_pattern(str, strlen(str), n->regex) != NULL) {
+	free(n->regex);
+	n->regex = NULL;
+    }
     return n;
 }
 
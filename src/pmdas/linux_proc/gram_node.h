@@ -41,6 +41,7 @@ typedef struct bool_node
 {
     N_tag tag;
     struct bool_node *next;
+    struct re_pattern_buffer *regex;	/* N_pat, compiled */
     union {
 	bool_children children;
 	char *str_val;
@@ -41,6 +41,7 @@
 #include "getinfo.h"
 #include "proc_pid.h"
 #include "proc_runq.h"
+#include "proc_netlink.h"
 #include "proc_dynamic.h"
 #include "ksym.h"
 #include "cgroups.h"
@@ -53,6 +54,7 @@ static proc_pid_t		hotproc_pid;
 static struct utsname		kernel_uname;
 static proc_runq_t		proc_runq;
 static int			all_access;	/* =1 no access checks */
+static int			netlink;	/* =1 use proc connector events */
 static int			have_access;	/* =1 recvd uid/gid */
 static size_t			_pm_system_pagesize;
 static unsigned int		threads;	/* control.all.threads */
@@ -764,6 +766,60 @@ static pmdaMetric metrictab[] = {
     { PMDA_PMID(CLUSTER_PROC_RUNQ, 7), PM_TYPE_32, PM_INDOM_NULL, PM_SEM_INSTANT,
     PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
 
+/*
+ * proc.events cluster
+ */
+
+/* proc.events.fork */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_FORK), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* proc.events.exec */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_EXEC), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* proc.events.exit */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_EXIT), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* proc.events.overflow */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_OVERFLOW), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) } },
+
+/* proc.events.exited.utime */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_EXITED_UTIME), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_MSEC,0) } },
+
+/* proc.events.exited.stime */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_EXITED_STIME), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(0,1,0,0,PM_TIME_MSEC,0) } },
+
+/* proc.events.exited.rchar */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_EXITED_RCHAR), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* proc.events.exited.wchar */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_EXITED_WCHAR), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* proc.events.exited.read_bytes */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_EXITED_READ_BYTES), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
+/* proc.events.exited.write_bytes */
+  { NULL,
+    { PMDA_PMID(CLUSTER_PROC_EVENTS, PROC_EVENTS_EXITED_WRITE_BYTES), PM_TYPE_U64, PM_INDOM_NULL,
+    PM_SEM_COUNTER, PMDA_PMUNITS(1,0,0,PM_SPACE_BYTE,0,0) } },
+
 /*
  * control groups cluster
  */
@@ -1525,6 +1581,8 @@ proc_refresh(pmdaExt *pmda, int *need_refresh)
 		container ? cgroup : NULL, cgrouplen);
 
     }
+    if (need_refresh[CLUSTER_PROC_EVENTS])
+	proc_netlink_refresh();
     if (need_refresh[CLUSTER_HOTPROC_PID_STAT] ||
         need_refresh[CLUSTER_HOTPROC_PID_STATM] ||
         need_refresh[CLUSTER_HOTPROC_PID_STATUS] ||
@@ -1809,7 +1867,7 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		break;
 
 	    case PROC_PID_STAT_TTYNAME: /* proc.psinfo.tty */
-		f = _pm_getfield(entry->stat_buf, PROC_PID_STAT_TTY);
+		f = proc_pid_stat_field(entry, PROC_PID_STAT_TTY);
 		if (f == NULL)
 		    atom->cp = "?";
 		else {
@@ -1819,11 +1877,10 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		break;
 
 	    case PROC_PID_STAT_CMD: /* proc.psinfo.cmd */
-		f = _pm_getfield(entry->stat_buf, idp->item);
+		f = proc_pid_stat_field(entry, idp->item);
 		if (f == NULL)
 		    return 0;
-		atom->cp = f + 1;
-		atom->cp[strlen(atom->cp)-1] = '\0';
+		atom->cp = f;	/* parentheses already stripped */
 		break;
 
 	    case PROC_PID_STAT_PSARGS: /* proc.psinfo.psargs */
@@ -1831,7 +1888,7 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		break;
 
 	    case PROC_PID_STAT_STATE: /* string */ /* proc.psinfo.sname */
-		f = _pm_getfield(entry->stat_buf, idp->item);
+		f = proc_pid_stat_field(entry, idp->item);
 		if (f == NULL)
 		    return 0;
 	    	atom->cp = f;
@@ -1839,18 +1896,18 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 
 	    case PROC_PID_STAT_VSIZE: /* proc.psinfo.vsize */
 	    case PROC_PID_STAT_RSS_RLIM: /* bytes converted to kbytes */ /* proc.psinfo.rss_rlim */
-		f = _pm_getfield(entry->stat_buf, idp->item);
+		f = proc_pid_stat_field(entry, idp->item);
 		if (f == NULL)
 		    return 0;
-		atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+		atom->ul = (__uint32_t)proc_strtoull(f);
 		atom->ul /= 1024;
 		break;
 
 	    case PROC_PID_STAT_RSS: /* pages converted to kbytes */ /* proc.psinfo.rss */
-		f = _pm_getfield(entry->stat_buf, idp->item);
+		f = proc_pid_stat_field(entry, idp->item);
 		if (f == NULL)
 		    return 0;
-		atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+		atom->ul = (__uint32_t)proc_strtoull(f);
 		atom->ul *= _pm_system_pagesize / 1024;
 		break;
 
@@ -1859,25 +1916,25 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    case PROC_PID_STAT_CUTIME: /* proc.psinfo.cutime */
 	    case PROC_PID_STAT_CSTIME: /* proc.psinfo.cstime */
 		/* unsigned jiffies converted to unsigned msecs */
-		f = _pm_getfield(entry->stat_buf, idp->item);
+		f = proc_pid_stat_field(entry, idp->item);
 		if (f == NULL)
 		    return 0;
-		jiffies = (__int64_t)strtoul(f, &tail, 0);
+		jiffies = (__int64_t)proc_strtoull(f);
 		_pm_assign_ulong(atom, jiffies * 1000 / hz);
 		break;
 
 	    case PROC_PID_STAT_PRIORITY: /* proc.psinfo.priority */
 	    case PROC_PID_STAT_NICE: /* signed decimal int */ /* proc.psinfo.nice */
-		f = _pm_getfield(entry->stat_buf, idp->item);
+		f = proc_pid_stat_field(entry, idp->item);
 		if (f == NULL)
 		    return 0;
-		atom->l = (__int32_t)strtol(f, &tail, 0);
+		atom->l = (__int32_t)proc_strtoull(f);
 		break;
 
 	    case PROC_PID_STAT_WCHAN: /* proc.psinfo.wchan */
-		if ((f = _pm_getfield(entry->stat_buf, idp->item)) == NULL)
+		if ((f = proc_pid_stat_field(entry, idp->item)) == NULL)
 		    return 0;
-		_pm_assign_ulong(atom, (__pm_kernel_ulong_t)strtoull(f, &tail, 0));
+		_pm_assign_ulong(atom, (__pm_kernel_ulong_t)proc_strtoull(f));
 		break;
  
 	    case PROC_PID_STAT_ENVIRON: /* proc.psinfo.environ */
@@ -1893,10 +1950,10 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		     * Convert address to symbol name if requested
 		     * Added by Mike Mason <mmlnx@us.ibm.com>
 		     */
-		    f = _pm_getfield(entry->stat_buf, PROC_PID_STAT_WCHAN);
+		    f = proc_pid_stat_field(entry, PROC_PID_STAT_WCHAN);
 		    if (f == NULL)
 			return 0;
-		    _pm_assign_ulong(atom, (__pm_kernel_ulong_t)strtoull(f, &tail, 0));
+		    _pm_assign_ulong(atom, (__pm_kernel_ulong_t)proc_strtoull(f));
 #if defined(HAVE_64BIT_LONG)
 		    if ((wc = wchan(atom->ull)))
 			atom->cp = wc;
@@ -1914,9 +1971,9 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    /* The following 2 case groups need to be here since the #defines don't match the index into the buffer */
 	    case PROC_PID_STAT_RTPRIORITY: /* proc.psinfo.rt_priority */
 	    case PROC_PID_STAT_POLICY: /* proc.psinfo.policy */
-	    	if ((f = _pm_getfield(entry->stat_buf, idp->item - 3)) == NULL) /* Note the offset */
+	    	if ((f = proc_pid_stat_field(entry, idp->item - 3)) == NULL) /* Note the offset */
 		    	return 0;
-		    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+		    atom->ul = (__uint32_t)proc_strtoull(f);
 	    	break;
 
 	    case PROC_PID_STAT_DELAYACCT_BLKIO_TICKS: /* proc.psinfo.delayacct_blkio_time */
@@ -1925,20 +1982,20 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    	/*
 		 * unsigned jiffies converted to unsigned milliseconds
 		 */
-		if ((f = _pm_getfield(entry->stat_buf, idp->item - 3)) == NULL)  /* Note the offset */
+		if ((f = proc_pid_stat_field(entry, idp->item - 3)) == NULL)  /* Note the offset */
 		    return 0;
 
-		jiffies = (__uint64_t)strtoul(f, &tail, 0);
+		jiffies = proc_strtoull(f);
 		atom->ull = jiffies * 1000 / hz;
 	    	break;
 	    case PROC_PID_STAT_START_TIME: /* proc.psinfo.start_time */
 	    	/*
 		 * unsigned jiffies converted to unsigned milliseconds
 		 */
-		if ((f = _pm_getfield(entry->stat_buf, idp->item)) == NULL)
+		if ((f = proc_pid_stat_field(entry, idp->item)) == NULL)
 		    return 0;
 
-		jiffies = (__uint64_t)strtoul(f, &tail, 0);
+		jiffies = proc_strtoull(f);
 		atom->ull = jiffies * 1000 / hz;
 	    	break;
 
@@ -1947,9 +2004,9 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 		 * unsigned decimal int
 		 */
 		if (idp->item < NR_PROC_PID_STAT) {
-		    if ((f = _pm_getfield(entry->stat_buf, idp->item)) == NULL)
+		    if ((f = proc_pid_stat_field(entry, idp->item)) == NULL)
 		    	return 0;
-		    atom->ul = (__uint32_t)strtoul(f, &tail, 0);
+		    atom->ul = (__uint32_t)proc_strtoull(f);
 		}
 		else
 		    return PM_ERR_PMID;
@@ -2830,6 +2887,45 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	atom->cp = proc_strings_lookup(entry->label_id);
 	break;
 
+    case CLUSTER_PROC_EVENTS:
+	if (!proc_netlink_active())
+	    return 0;
+	switch (idp->item) {
+	case PROC_EVENTS_FORK:
+	    atom->ull = proc_events.fork;
+	    break;
+	case PROC_EVENTS_EXEC:
+	    atom->ull = proc_events.exec;
+	    break;
+	case PROC_EVENTS_EXIT:
+	    atom->ull = proc_events.exit;
+	    break;
+	case PROC_EVENTS_OVERFLOW:
+	    atom->ull = proc_events.overflow;
+	    break;
+	case PROC_EVENTS_EXITED_UTIME:	/* usec converted to msec */
+	    atom->ull = proc_events.utime / 1000;
+	    break;
+	case PROC_EVENTS_EXITED_STIME:	/* usec converted to msec */
+	    atom->ull = proc_events.stime / 1000;
+	    break;
+	case PROC_EVENTS_EXITED_RCHAR:
+	    atom->ull = proc_events.rchar;
+	    break;
+	case PROC_EVENTS_EXITED_WCHAR:
+	    atom->ull = proc_events.wchar;
+	    break;
+	case PROC_EVENTS_EXITED_READ_BYTES:
+	    atom->ull = proc_events.read_bytes;
+	    break;
+	case PROC_EVENTS_EXITED_WRITE_BYTES:
+	    atom->ull = proc_events.write_bytes;
+	    break;
+	default:
+	    return PM_ERR_PMID;
+	}
+	break;
+
     case CLUSTER_CONTROL:
 	switch (idp->item) {
 	/* case 1: not reached -- proc.control.all.threads is direct */
@@ -2852,6 +2948,200 @@ proc_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
     return PMDA_FETCH_STATIC;
 }
 
+/*
+ * How a numeric proc.psinfo value is derived from its /proc/<pid>/stat
+ * field, decided once per column by psinfo_fetchColumn().
+ */
+enum {
+    PSINFO_PID, PSINFO_U32, PSINFO_ULONG, PSINFO_INT32,
+    PSINFO_KBYTES, PSINFO_PAGES, PSINFO_MSEC_ULONG, PSINFO_MSEC_U64
+};
+
+/*
+ * Column fill for the numeric proc.psinfo and hotproc.psinfo metrics,
+ * the bulk of a typical proc fetch; returns 0 for the metrics left to
+ * proc_fetchCallBack (strings, proc.nprocs, unknown items).
+ */
+static int
+psinfo_fetchColumn(pmdaMetric *mdesc, proc_pid_t *pp, int numinst,
+		   const int *instlist, pmAtomValue *atoms, int *sts)
+{
+    __pmID_int		*idp = (__pmID_int *)&(mdesc->m_desc.pmid);
+    proc_pid_entry_t	*entry;
+    int			field = idp->item;
+    int			kind;
+    int			i;
+    char		*f;
+
+    switch (idp->item) {
+    case PROC_PID_STAT_PID:
+	kind = PSINFO_PID;
+	break;
+    case PROC_PID_STAT_TTYNAME:
+    case PROC_PID_STAT_CMD:
+    case PROC_PID_STAT_PSARGS:
+    case PROC_PID_STAT_STATE:
+    case PROC_PID_STAT_ENVIRON:
+    case PROC_PID_STAT_WCHAN_SYMBOL:
+	return 0;
+    case PROC_PID_STAT_VSIZE:
+    case PROC_PID_STAT_RSS_RLIM:
+	kind = PSINFO_KBYTES;
+	break;
+    case PROC_PID_STAT_RSS:
+	kind = PSINFO_PAGES;
+	break;
+    case PROC_PID_STAT_UTIME:
+    case PROC_PID_STAT_STIME:
+    case PROC_PID_STAT_CUTIME:
+    case PROC_PID_STAT_CSTIME:
+	kind = PSINFO_MSEC_ULONG;
+	break;
+    case PROC_PID_STAT_PRIORITY:
+    case PROC_PID_STAT_NICE:
+	kind = PSINFO_INT32;
+	break;
+    case PROC_PID_STAT_WCHAN:
+	kind = PSINFO_ULONG;
+	break;
+    case PROC_PID_STAT_RTPRIORITY:
+    case PROC_PID_STAT_POLICY:
+	kind = PSINFO_U32;
+	field = idp->item - 3;		/* as in proc_fetchCallBack */
+	break;
+    case PROC_PID_STAT_DELAYACCT_BLKIO_TICKS:
+    case PROC_PID_STAT_GUEST_TIME:
+    case PROC_PID_STAT_CGUEST_TIME:
+	kind = PSINFO_MSEC_U64;
+	field = idp->item - 3;
+	break;
+    case PROC_PID_STAT_START_TIME:
+	kind = PSINFO_MSEC_U64;
+	break;
+    default:
+	if (idp->item >= NR_PROC_PID_STAT)
+	    return 0;
+	kind = PSINFO_U32;
+	break;
+    }
+
+    for (i = 0; i < numinst; i++) {
+	if ((entry = fetch_proc_pid_stat(instlist[i], pp, &sts[i])) == NULL)
+	    continue;
+	sts[i] = PMDA_FETCH_STATIC;
+	if (kind == PSINFO_PID) {
+	    atoms[i].ul = entry->id;
+	    continue;
+	}
+	if ((f = proc_pid_stat_field(entry, field)) == NULL) {
+	    sts[i] = 0;
+	    continue;
+	}
+	switch (kind) {
+	case PSINFO_U32:
+	    atoms[i].ul = (__uint32_t)proc_strtoull(f);
+	    break;
+	case PSINFO_ULONG:
+	    _pm_assign_ulong(&atoms[i], (__pm_kernel_ulong_t)proc_strtoull(f));
+	    break;
+	case PSINFO_INT32:
+	    atoms[i].l = (__int32_t)proc_strtoull(f);
+	    break;
+	case PSINFO_KBYTES:
+	    atoms[i].ul = (__uint32_t)proc_strtoull(f) / 1024;
+	    break;
+	case PSINFO_PAGES:
+	    atoms[i].ul = (__uint32_t)proc_strtoull(f) * (_pm_system_pagesize / 1024);
+	    break;
+	case PSINFO_MSEC_ULONG:
+	    _pm_assign_ulong(&atoms[i], (__int64_t)proc_strtoull(f) * 1000 / hz);
+	    break;
+	case PSINFO_MSEC_U64:
+	    atoms[i].ull = (__int64_t)proc_strtoull(f) * 1000 / hz;
+	    break;
+	}
+    }
+    return 1;
+}
+
+/*
+ * String values from proc_fetchCallBack may be in buffers that are
+ * reused on the next call (ttyname, wchan, ...), so for a column they
+ * are packed into this buffer, which is reused in turn by the next
+ * column once pmdaFetch has taken the values.
+ */
+static char	*colstr;
+static size_t	colstr_size;
+
+static int
+colstr_append(size_t *used, const char *cp)
+{
+    size_t	len = strlen(cp) + 1;
+    char	*tmp;
+
+    if (*used + len > colstr_size) {
+	size_t	size = colstr_size ? colstr_size : 4096;
+
+	while (*used + len > size)
+	    size *= 2;
+	if ((tmp = (char *)realloc(colstr, size)) == NULL)
+	    return -oserror();
+	colstr = tmp;
+	colstr_size = size;
+    }
+    memcpy(colstr + *used, cp, len);
+    *used += len;
+    return 0;
+}
+
+/*
+ * column callback provided to pmdaFetch, called once per metric for
+ * all of the requested instances (processes).  Errors that do not
+ * depend on the instance (unknown metric, no credentials) are reported
+ * once for the whole column.
+ */
+static int
+proc_fetchColumnCallBack(pmdaMetric *mdesc, int numinst, const int *instlist,
+			 pmAtomValue *atoms, int *sts)
+{
+    __pmID_int		*idp = (__pmID_int *)&(mdesc->m_desc.pmid);
+    size_t		used = 0;
+    int			i, err;
+
+    if (mdesc->m_user == NULL &&
+	(idp->cluster == CLUSTER_PID_STAT ||
+	 idp->cluster == CLUSTER_HOTPROC_PID_STAT) && idp->item != 99) {
+	if (!have_access)
+	    return PM_ERR_PERMISSION;
+	if (psinfo_fetchColumn(mdesc,
+		idp->cluster == CLUSTER_PID_STAT ? &proc_pid : &hotproc_pid,
+		numinst, instlist, atoms, sts))
+	    return 0;
+    }
+
+    for (i = 0; i < numinst; i++) {
+	sts[i] = proc_fetchCallBack(mdesc, instlist[i], &atoms[i]);
+	if (sts[i] == PM_ERR_PMID || sts[i] == PM_ERR_PERMISSION)
+	    return sts[i];
+	if (sts[i] == PMDA_FETCH_STATIC && mdesc->m_desc.type == PM_TYPE_STRING) {
+	    /* offset for now, colstr may move as it grows */
+	    size_t	offset = used;
+
+	    if ((err = colstr_append(&used, atoms[i].cp)) < 0)
+		sts[i] = err;
+	    else
+		atoms[i].ull = offset;
+	}
+    }
+    if (mdesc->m_desc.type == PM_TYPE_STRING) {
+	for (i = 0; i < numinst; i++) {
+	    if (sts[i] == PMDA_FETCH_STATIC)
+		atoms[i].cp = colstr + atoms[i].ull;
+	}
+    }
+    return 0;
+}
+
 static int
 proc_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 {
@@ -2954,8 +3244,10 @@ proc_store(pmResult *result, pmdaExt *pmda)
                         disable_hotproc();
                     }
 		    else {
+			hotproc_lock();
 			conf_gen++;
 			new_tree(tree);
+			hotproc_unlock();
 			if (conf_gen == 1) {
 			    /* There was no config to start with.
 			     * This is the first one, so enable the timer.
@@ -2972,7 +3264,9 @@ proc_store(pmResult *result, pmdaExt *pmda)
             case ITEM_HOTPROC_G_RELOAD_CONFIG: /* hotproc.control.reload_config */
 		if ((sts = pmExtractValue(vsp->valfmt, &vsp->vlist[0],
 				PM_TYPE_U32, &av, PM_TYPE_U32)) >= 0) {
-                    hotproc_init();
+		    hotproc_lock();
+		    hotproc_init();
+		    hotproc_unlock();
 		    reset_hotproc_timer();
 		}
 		break;
@@ -3096,7 +3390,7 @@ proc_init(pmdaInterface *dp)
 	int sep = __pmPathSeparator();
 	snprintf(helppath, sizeof(helppath), "%s%c" "proc" "%c" "help",
 		pmGetConfig("PCP_PMDAS_DIR"), sep, sep);
-	pmdaDSO(dp, PMDA_INTERFACE_6, "proc DSO", helppath);
+	pmdaDSO(dp, PMDA_INTERFACE_7, "proc DSO", helppath);
     }
 
     if (dp->status != 0)
@@ -3112,7 +3406,7 @@ proc_init(pmdaInterface *dp)
     dp->version.six.children = proc_children;
     dp->version.six.attribute = proc_ctx_attrs;
     pmdaSetEndContextCallBack(dp, proc_ctx_end);
-    pmdaSetFetchCallBack(dp, proc_fetchCallBack);
+    pmdaSetFetchColumnCallBack(dp, proc_fetchColumnCallBack);
 
     /*
      * Initialize the instance domain table.
@@ -3138,7 +3432,7 @@ proc_init(pmdaInterface *dp)
     hotproc_pid.indom = &indomtab[HOTPROC_INDOM];
 
     hotproc_init();
-    init_hotproc_pid(&hotproc_pid);
+    init_hotproc_pid();
  
     /* 
      * Read System.map and /proc/ksyms. Used to translate wait channel
@@ -3150,6 +3444,10 @@ proc_init(pmdaInterface *dp)
     proc_ctx_init();
     proc_dynamic_init(metrictab, nmetrics);
 
+    /* optional proc connector process tracking, see proc_netlink.c */
+    if (netlink)
+	proc_netlink_init();
+
     rootfd = pmdaRootConnect(NULL);
     pmdaSetFlags(dp, PMDA_EXT_FLAG_HASHED);
     pmdaInit(dp, indomtab, nindoms, metrictab, nmetrics);
@@ -3177,6 +3475,7 @@ pmLongOptions	longopts[] = {
     PMDAOPT_DOMAIN,
     PMDAOPT_LOGFILE,
     { "with-threads", 0, 'L', 0, "include threads in the all-processes instance domain" },
+    { "netlink", 0, 'N', 0, "track processes with kernel proc connector events" },
     { "from-cgroup", 1, 'r', "NAME", "restrict monitoring to processes in the named cgroup" },
     PMDAOPT_USERNAME,
     PMOPT_HELP,
@@ -3184,7 +3483,7 @@ pmLongOptions	longopts[] = {
 };
 
 pmdaOptions	opts = {
-    .short_options = "AD:d:l:Lr:U:?",
+    .short_options = "AD:d:l:LNr:U:?",
     .long_options = longopts,
 };
 
@@ -3200,7 +3499,7 @@ main(int argc, char **argv)
     __pmSetProgname(argv[0]);
     snprintf(helppath, sizeof(helppath), "%s%c" "proc" "%c" "help",
 		pmGetConfig("PCP_PMDAS_DIR"), sep, sep);
-    pmdaDaemon(&dispatch, PMDA_INTERFACE_6, pmProgname, PROC, "proc.log", helppath);
+    pmdaDaemon(&dispatch, PMDA_INTERFACE_7, pmProgname, PROC, "proc.log", helppath);
 
     while ((c = pmdaGetOptions(argc, argv, &opts, &dispatch)) != EOF) {
 	switch (c) {
@@ -3210,6 +3509,9 @@ main(int argc, char **argv)
 	case 'L':
 	    threads = 1;
 	    break;
+	case 'N':
+	    netlink = 1;
+	    break;
 	case 'r':
 	    cgroups = opts.optarg;
 	    break;
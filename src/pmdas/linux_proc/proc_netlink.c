@@ -0,0 +1,511 @@
+/*
+ * Linux proc connector and taskstats netlink interfaces
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * When enabled (pmdaproc -N), the kernel proc connector reports each
+ * fork, exec and exit, and these are applied to a list of pids kept
+ * here so that the proc instance domain can be refreshed without
+ * reading /proc (and each /proc/<pid>/task when threads are wanted).
+ * A full /proc scan is still made at startup, whenever events have
+ * been lost (the socket buffer overflowed between fetches), when the
+ * threads setting changes, for the proc.runq metrics (which must read
+ * every /proc/<pid>/stat anyway), and every PROC_NETLINK_RESYNC
+ * seconds to catch the few changes that are not reported as events
+ * (e.g. the tid of a non-leader thread that calls exec, or a group
+ * leader that exits before the other threads in its group).
+ *
+ * The taskstats interface is used to collect the accounting of every
+ * exiting task, so that the CPU time and I/O of processes that start
+ * and finish between samples is not lost.  The I/O counts reported by
+ * taskstats are rounded down to a multiple of 1KB, so taskstats is not
+ * used in place of /proc/<pid>/io for live processes.
+ *
+ * Both need CAP_NET_ADMIN, and either may be missing from the kernel;
+ * without them everything is done from /proc as before.
+ */
+
+#include "pmapi.h"
+#include "impl.h"
+#include "pmda.h"
+#include <signal.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
+#include "proc_pid.h"
+#include "proc_netlink.h"
+
+#define PROC_NETLINK_RESYNC	300	/* seconds between full /proc scans */
+#define PROC_NETLINK_RCVBUF	(4*1024*1024)
+
+proc_events_t	proc_events;
+
+static int		cn_fd = -1;	/* proc connector events */
+static int		ts_fd = -1;	/* taskstats exit notifications */
+static __u16		ts_family;
+static __u32		ts_seq;
+static proc_pid_list_t	tracked;	/* pids (or tids) known to exist */
+static proc_pid_list_t	exited;		/* exited, but maybe not yet reaped */
+static int		tracked_valid;	/* =1 if no events lost since sync */
+static time_t		tracked_sync;	/* time of the last full scan */
+
+static void
+netlink_rcvbuf(int fd)
+{
+    int		size = PROC_NETLINK_RCVBUF;
+
+    /* beyond rmem_max needs CAP_NET_ADMIN, which we have anyway */
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+static int
+connector_open(void)
+{
+    struct sockaddr_nl	addr;
+    struct nlmsghdr	*nlh;
+    struct cn_msg	*cn;
+    enum proc_cn_mcast_op op = PROC_CN_MCAST_LISTEN;
+    __uint64_t		buf[(NLMSG_SPACE(sizeof(struct cn_msg) + sizeof(op)) + 7) / 8];
+    int			fd, sts;
+
+    if ((fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR)) < 0)
+	return -oserror();
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = CN_IDX_PROC;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	goto fail;
+    netlink_rcvbuf(fd);
+
+    memset(buf, 0, sizeof(buf));
+    nlh = (struct nlmsghdr *)buf;
+    nlh->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + sizeof(op));
+    nlh->nlmsg_type = NLMSG_DONE;
+    cn = (struct cn_msg *)NLMSG_DATA(nlh);
+    cn->id.idx = CN_IDX_PROC;
+    cn->id.val = CN_VAL_PROC;
+    cn->len = sizeof(op);
+    memcpy(cn->data, &op, sizeof(op));
+    if (send(fd, nlh, nlh->nlmsg_len, 0) < 0)
+	goto fail;
+    return fd;
+
+fail:
+    sts = -oserror();
+    close(fd);
+    return sts;
+}
+
+static int
+genl_send(int fd, __u16 type, __u8 cmd, __u16 attr, const void *data, int len)
+{
+    struct {
+	struct nlmsghdr		nlh;
+	struct genlmsghdr	genl;
+	char			buf[256];
+    } msg;
+    struct nlattr	*na;
+
+    if (NLA_HDRLEN + len > sizeof(msg.buf))
+	return -E2BIG;
+    memset(&msg, 0, sizeof(msg));
+    msg.nlh.nlmsg_len = NLMSG_LENGTH(GENL_HDRLEN);
+    msg.nlh.nlmsg_type = type;
+    msg.nlh.nlmsg_flags = NLM_F_REQUEST;
+    msg.nlh.nlmsg_seq = ++ts_seq;
+    msg.genl.cmd = cmd;
+    msg.genl.version = 1;
+    na = (struct nlattr *)((char *)&msg + msg.nlh.nlmsg_len);
+    na->nla_type = attr;
+    na->nla_len = NLA_HDRLEN + len;
+    memcpy((char *)na + NLA_HDRLEN, data, len);
+    msg.nlh.nlmsg_len += NLA_ALIGN(na->nla_len);
+
+    while (send(fd, &msg, msg.nlh.nlmsg_len, 0) < 0) {
+	if (oserror() != EINTR)
+	    return -oserror();
+    }
+    return 0;
+}
+
+/*
+ * Walk the attributes in buf[0..len-1], return the first of type
+ * or NULL.
+ */
+static struct nlattr *
+nla_find(char *buf, int len, int type)
+{
+    struct nlattr	*na = (struct nlattr *)buf;
+
+    while (len >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN && na->nla_len <= len) {
+	if (na->nla_type == type)
+	    return na;
+	len -= NLA_ALIGN(na->nla_len);
+	na = (struct nlattr *)((char *)na + NLA_ALIGN(na->nla_len));
+    }
+    return NULL;
+}
+
+static int
+taskstats_open(void)
+{
+    struct sockaddr_nl	addr;
+    struct nlmsghdr	*nlh;
+    struct nlattr	*na;
+    __uint64_t		buf[1024];
+    char		cpumask[32];
+    int			fd, len, sts;
+
+    if ((fd = socket(PF_NETLINK, SOCK_RAW, NETLINK_GENERIC)) < 0)
+	return -oserror();
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	goto fail;
+
+    /* the taskstats family id is dynamic, ask the controller */
+    if ((sts = genl_send(fd, GENL_ID_CTRL, CTRL_CMD_GETFAMILY,
+		CTRL_ATTR_FAMILY_NAME, TASKSTATS_GENL_NAME,
+		sizeof(TASKSTATS_GENL_NAME))) < 0) {
+	close(fd);
+	return sts;
+    }
+    if ((len = recv(fd, buf, sizeof(buf), 0)) < 0)
+	goto fail;
+    nlh = (struct nlmsghdr *)buf;
+    if (!NLMSG_OK(nlh, len) || nlh->nlmsg_type == NLMSG_ERROR) {
+	close(fd);
+	return -ENOENT;
+    }
+    na = nla_find((char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+		  nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), CTRL_ATTR_FAMILY_ID);
+    if (na == NULL) {
+	close(fd);
+	return -ENOENT;
+    }
+    ts_family = *(__u16 *)((char *)na + NLA_HDRLEN);
+
+    netlink_rcvbuf(fd);
+    snprintf(cpumask, sizeof(cpumask), "0-%ld", sysconf(_SC_NPROCESSORS_CONF) - 1);
+    if ((sts = genl_send(fd, ts_family, TASKSTATS_CMD_GET,
+		TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, cpumask, strlen(cpumask) + 1)) < 0) {
+	close(fd);
+	return sts;
+    }
+    return fd;
+
+fail:
+    sts = -oserror();
+    close(fd);
+    return sts;
+}
+
+int
+proc_netlink_init(void)
+{
+    int		sts;
+
+    if ((cn_fd = connector_open()) < 0) {
+	sts = cn_fd;
+	__pmNotifyErr(LOG_WARNING, "proc connector unavailable, using /proc: %s",
+			pmErrStr(sts));
+	return sts;
+    }
+    if ((ts_fd = taskstats_open()) < 0)
+	__pmNotifyErr(LOG_INFO, "taskstats unavailable, no exited task accounting: %s",
+			pmErrStr(ts_fd));
+    return 0;
+}
+
+int
+proc_netlink_active(void)
+{
+    return cn_fd >= 0;
+}
+
+/* index of pid in the sorted list, or where it would be inserted */
+static int
+tracked_search(int pid)
+{
+    int		lo = 0, hi = tracked.count;
+
+    while (lo < hi) {
+	int	mid = (lo + hi) / 2;
+
+	if (tracked.pids[mid] < pid)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+static void
+tracked_insert(int pid)
+{
+    int		i = tracked_search(pid);
+    int		*pids;
+
+    if (i < tracked.count && tracked.pids[i] == pid)
+	return;
+    if (tracked.count >= tracked.size) {
+	if ((pids = (int *)realloc(tracked.pids, (tracked.size + 64) * sizeof(int))) == NULL) {
+	    tracked_valid = 0;
+	    return;
+	}
+	tracked.pids = pids;
+	tracked.size += 64;
+    }
+    memmove(&tracked.pids[i+1], &tracked.pids[i], (tracked.count - i) * sizeof(int));
+    tracked.pids[i] = pid;
+    tracked.count++;
+}
+
+static void
+tracked_remove(int pid)
+{
+    int		i = tracked_search(pid);
+
+    if (i >= tracked.count || tracked.pids[i] != pid)
+	return;
+    tracked.count--;
+    memmove(&tracked.pids[i], &tracked.pids[i+1], (tracked.count - i) * sizeof(int));
+}
+
+/*
+ * A process that has exited stays in /proc (as a zombie) until its
+ * parent reaps it, and that is not reported as an event, so exited
+ * pids are kept here and removed from the tracked list once they have
+ * really gone.
+ */
+static void
+exited_append(int pid)
+{
+    int		*pids;
+
+    if (exited.count >= exited.size) {
+	if ((pids = (int *)realloc(exited.pids, (exited.size + 64) * sizeof(int))) == NULL) {
+	    tracked_valid = 0;
+	    return;
+	}
+	exited.pids = pids;
+	exited.size += 64;
+    }
+    exited.pids[exited.count++] = pid;
+}
+
+static void
+exited_forget(int pid)
+{
+    int		i;
+
+    for (i = 0; i < exited.count; i++) {
+	if (exited.pids[i] == pid) {
+	    exited.pids[i] = exited.pids[--exited.count];
+	    break;
+	}
+    }
+}
+
+static void
+exited_reap(void)
+{
+    int		i;
+
+    for (i = 0; i < exited.count; ) {
+	if (kill(exited.pids[i], 0) < 0 && oserror() == ESRCH) {
+	    tracked_remove(exited.pids[i]);
+	    exited.pids[i] = exited.pids[--exited.count];
+	}
+	else
+	    i++;
+    }
+}
+
+static void
+connector_event(struct proc_event *ev)
+{
+    int		pid, tgid;
+
+    switch (ev->what) {
+    case PROC_EVENT_FORK:
+	proc_events.fork++;
+	pid = ev->event_data.fork.child_pid;
+	tgid = ev->event_data.fork.child_tgid;
+	if (tracked.threads || pid == tgid) {
+	    exited_forget(pid);		/* pid reused */
+	    tracked_insert(pid);
+	}
+	break;
+    case PROC_EVENT_EXEC:
+	proc_events.exec++;
+	break;
+    case PROC_EVENT_EXIT:
+	proc_events.exit++;
+	pid = ev->event_data.exit.process_pid;
+	tgid = ev->event_data.exit.process_tgid;
+	if (tracked.threads || pid == tgid)
+	    exited_append(pid);
+	break;
+    default:
+	break;
+    }
+}
+
+static void
+connector_drain(void)
+{
+    __uint64_t		buf[1024];
+    struct nlmsghdr	*nlh;
+    struct cn_msg	*cn;
+    int			len;
+
+    for (;;) {
+	if ((len = recv(cn_fd, buf, sizeof(buf), MSG_DONTWAIT)) < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    if (oserror() == ENOBUFS) {
+		/* events were dropped, the pid list must be rebuilt */
+		proc_events.overflow++;
+		tracked_valid = 0;
+		continue;
+	    }
+	    break;	/* EAGAIN, nothing more for now */
+	}
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len)) {
+	    if (nlh->nlmsg_type == NLMSG_NOOP)
+		continue;
+	    if (nlh->nlmsg_type == NLMSG_ERROR || nlh->nlmsg_type == NLMSG_OVERRUN) {
+		tracked_valid = 0;
+		continue;
+	    }
+	    cn = (struct cn_msg *)NLMSG_DATA(nlh);
+	    if (cn->id.idx != CN_IDX_PROC || cn->id.val != CN_VAL_PROC)
+		continue;
+	    connector_event((struct proc_event *)cn->data);
+	}
+    }
+}
+
+static void
+taskstats_exited(struct nlmsghdr *nlh)
+{
+    struct taskstats	ts;
+    struct nlattr	*aggr, *stats;
+    int			len;
+
+    if (nlh->nlmsg_type != ts_family)
+	return;
+    /* per-task totals only, the per-group totals would double count */
+    aggr = nla_find((char *)NLMSG_DATA(nlh) + GENL_HDRLEN,
+		    nlh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN), TASKSTATS_TYPE_AGGR_PID);
+    if (aggr == NULL)
+	return;
+    stats = nla_find((char *)aggr + NLA_HDRLEN, aggr->nla_len - NLA_HDRLEN,
+		     TASKSTATS_TYPE_STATS);
+    if (stats == NULL)
+	return;
+
+    /* older kernels send a shorter struct, fields are only ever added */
+    len = stats->nla_len - NLA_HDRLEN;
+    memset(&ts, 0, sizeof(ts));
+    memcpy(&ts, (char *)stats + NLA_HDRLEN, len < sizeof(ts) ? len : sizeof(ts));
+    proc_events.utime += ts.ac_utime;
+    proc_events.stime += ts.ac_stime;
+    proc_events.rchar += ts.read_char;
+    proc_events.wchar += ts.write_char;
+    proc_events.read_bytes += ts.read_bytes;
+    proc_events.write_bytes += ts.write_bytes;
+}
+
+static void
+taskstats_drain(void)
+{
+    __uint64_t		buf[1024];
+    struct nlmsghdr	*nlh;
+    int			len;
+
+    for (;;) {
+	if ((len = recv(ts_fd, buf, sizeof(buf), MSG_DONTWAIT)) < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    if (oserror() == ENOBUFS) {
+		proc_events.overflow++;
+		continue;
+	    }
+	    break;
+	}
+	for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len); nlh = NLMSG_NEXT(nlh, len))
+	    taskstats_exited(nlh);
+    }
+}
+
+void
+proc_netlink_refresh(void)
+{
+    if (cn_fd >= 0)
+	connector_drain();
+    if (ts_fd >= 0)
+	taskstats_drain();
+}
+
+int
+proc_netlink_pidlist(int want_threads, proc_pid_list_t *pids)
+{
+    int		*p;
+
+    if (cn_fd < 0)
+	return -ENOTCONN;
+    proc_netlink_refresh();
+    exited_reap();
+    if (!tracked_valid || tracked.threads != want_threads ||
+	time(NULL) - tracked_sync >= PROC_NETLINK_RESYNC)
+	return -EAGAIN;
+
+    if (pids->size < tracked.count) {
+	if ((p = (int *)realloc(pids->pids, tracked.count * sizeof(int))) == NULL)
+	    return -ENOMEM;
+	pids->pids = p;
+	pids->size = tracked.count;
+    }
+    memcpy(pids->pids, tracked.pids, tracked.count * sizeof(int));
+    pids->count = tracked.count;
+    pids->threads = want_threads;
+    return 0;
+}
+
+void
+proc_netlink_sync(proc_pid_list_t *pids)
+{
+    int		*p;
+
+    if (cn_fd < 0)
+	return;
+    if (tracked.size < pids->count) {
+	if ((p = (int *)realloc(tracked.pids, pids->count * sizeof(int))) == NULL) {
+	    tracked_valid = 0;
+	    return;
+	}
+	tracked.pids = p;
+	tracked.size = pids->count;
+    }
+    memcpy(tracked.pids, pids->pids, pids->count * sizeof(int));
+    tracked.count = pids->count;
+    tracked.threads = pids->threads;
+    tracked_valid = 1;
+    tracked_sync = time(NULL);
+}
@@ -0,0 +1,61 @@
+/*
+ * Linux proc connector and taskstats netlink interfaces
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef _PROC_NETLINK_H
+#define _PROC_NETLINK_H
+
+/*
+ * proc.events cluster item numbers
+ */
+#define PROC_EVENTS_FORK		0
+#define PROC_EVENTS_EXEC		1
+#define PROC_EVENTS_EXIT		2
+#define PROC_EVENTS_OVERFLOW		3
+#define PROC_EVENTS_EXITED_UTIME	4
+#define PROC_EVENTS_EXITED_STIME	5
+#define PROC_EVENTS_EXITED_RCHAR	6
+#define PROC_EVENTS_EXITED_WCHAR	7
+#define PROC_EVENTS_EXITED_READ_BYTES	8
+#define PROC_EVENTS_EXITED_WRITE_BYTES	9
+
+typedef struct {
+    __uint64_t	fork;		/* fork (process and thread) events */
+    __uint64_t	exec;		/* exec events */
+    __uint64_t	exit;		/* exit (process and thread) events */
+    __uint64_t	overflow;	/* event or exit stats messages dropped */
+    /* accounting for exited tasks, from taskstats */
+    __uint64_t	utime;		/* usec */
+    __uint64_t	stime;		/* usec */
+    __uint64_t	rchar;
+    __uint64_t	wchar;
+    __uint64_t	read_bytes;
+    __uint64_t	write_bytes;
+} proc_events_t;
+
+extern proc_events_t proc_events;
+
+/* subscribe to proc connector events (and taskstats, if available) */
+extern int proc_netlink_init(void);
+extern int proc_netlink_active(void);
+
+/* consume pending events; the pid list is unchanged if < 0 returned */
+extern int proc_netlink_pidlist(int, proc_pid_list_t *);
+/* pid list from a full /proc scan, events are applied to it hereafter */
+extern void proc_netlink_sync(proc_pid_list_t *);
+
+/* consume pending events, for the proc.events metrics */
+extern void proc_netlink_refresh(void);
+
+#endif /* _PROC_NETLINK_H */
@@ -23,82 +23,34 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <pwd.h>
 #include <grp.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include "proc_pid.h"
 #include "proc_runq.h"
+#include "proc_netlink.h"
 #include "indom.h"
 #include "cgroups.h"
 #include "hotproc.h"
 
 static proc_pid_list_t procpids; /* previous pids list that the proc pmda uses */
 static void refresh_proc_pidlist(proc_pid_t *, proc_pid_list_t *);
+static int proc_open(const char *, proc_pid_entry_t *);
+static void proc_dirfd_close(proc_pid_entry_t *);
 
 
 /* Hotproc variables */
 
-/* PIDS that we are keeping track of as POSSIBLE "hot" candidates
- * need a seperate list since it is generated by the timer update.
-*/
+/* PIDS that are currently "hot", refreshed along with the hotproc indom */
 static proc_pid_list_t hotpids;
-/* Hold a pointer to this since we need it for the timer */
-static proc_pid_t *hotproc_poss_pid;
-
-#define INIT_HOTPROC_MAX 200
 
 extern int conf_gen;
 extern char *proc_statspath;
 extern long hz;
 
-/* Actual processes that are hot based on the current configuration 
- * Filled in hotproc_eval_procs 
- */
-static pid_t *hot_active_list;
-
-static int hot_numactive;
-static int hot_maxactive = INIT_HOTPROC_MAX;
-
-/* array size allocated */
-static int hot_maxprocs[2] = {INIT_HOTPROC_MAX, INIT_HOTPROC_MAX};
-
-/* number of procs used in list (<= hot_maxprocs) */
-static int hot_numprocs[2] = {0, 0};
-
-/* Current and Previous list of processes that we are considering for "hot" inclusion
- * Updated by the timer callback
- * keeps stats that we will use for determination
- */
-static process_t *hotproc_list[2] = {NULL, NULL};
-
-/* various cpu time totals  */
-static int num_cpus;
-static int hot_have_totals;
-static double hot_total_transient;
-static double hot_total_cpuidle;
-static double hot_total_active;
-static double hot_total_inactive;
-
-static unsigned long hot_refresh_count;
-
-/* index into proc_list etc.. */
-static int current;
-static int previous = 1;
-
 struct timeval   hotproc_update_interval;
-int     hotproc_timer_id = -1;
-
-int 
-get_hot_totals(double * ta, double * ti, double * tt, double * tci )
-{
-    if (hot_have_totals) {
-	*ta = hot_total_active;
-	*ti = hot_total_inactive;
-	*tt = hot_total_transient;
-	*tci = hot_total_cpuidle;
-	return 1;
-    }
-    return 0;
-}
 
 static int
 compare_pid(const void *pa, const void *pb)
@@ -129,14 +81,18 @@ pidlist_append(const char *pidname, proc_pid_list_t *pids)
 }
 
 static void
-tasklist_append(const char *pid, proc_pid_list_t *pids)
+tasklist_append(int procfd, const char *pid, proc_pid_list_t *pids)
 {
-    DIR *taskdirp;
+    DIR *taskdirp = NULL;
     struct dirent *tdp;
     char taskpath[1024];
+    int fd;
 
-    sprintf(taskpath, "%s/proc/%s/task", proc_statspath, pid);
-    if ((taskdirp = opendir(taskpath)) != NULL) {
+    sprintf(taskpath, "%s/task", pid);
+    if ((fd = openat(procfd, taskpath, O_RDONLY|O_DIRECTORY)) >= 0 &&
+	(taskdirp = fdopendir(fd)) == NULL)
+	close(fd);
+    if (taskdirp != NULL) {
 	while ((tdp = readdir(taskdirp)) != NULL) {
 	    if (!isdigit((int)tdp->d_name[0]) || strcmp(pid, tdp->d_name) == 0)
 		continue;
@@ -148,7 +104,7 @@ tasklist_append(const char *pid, proc_pid_list_t *pids)
     else {
 	if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
 	    char ebuf[1024];
-	    fprintf(stderr, "tasklist_append: opendir(\"%s\") failed: %s\n", taskpath, pmErrStr_r(-oserror(), ebuf, sizeof(ebuf)));
+	    fprintf(stderr, "tasklist_append: opendir(\"%s/proc/%s\") failed: %s\n", proc_statspath, taskpath, pmErrStr_r(-oserror(), ebuf, sizeof(ebuf)));
 	}
     }
 #endif
@@ -200,6 +156,14 @@ refresh_global_pidlist(int want_threads, proc_runq_t *runq_stats, proc_pid_list_
     struct dirent *dp;
     char path[MAXPATHLEN];
 
+    /*
+     * With proc connector events the list is kept up to date without
+     * reading /proc, unless we need to scan it for the run queue stats
+     * anyway, or events have been lost (see proc_netlink.c).
+     */
+    if (proc_netlink_pidlist(want_threads, pids) == 0 && runq_stats == NULL)
+	return 0;
+
     pids->count = 0;
     pids->threads = want_threads;
 
@@ -219,29 +183,154 @@ refresh_global_pidlist(int want_threads, proc_runq_t *runq_stats, proc_pid_list_
 	if (isdigit((int)dp->d_name[0])) {
 	    pidlist_append(dp->d_name, pids);
 	    if (want_threads)
-		tasklist_append(dp->d_name, pids);
+		tasklist_append(dirfd(dirp), dp->d_name, pids);
 	    if (runq_stats)
-		proc_runq_append(dp->d_name, runq_stats);
+		proc_runq_append(dirfd(dirp), dp->d_name, runq_stats);
 	}
     }
     closedir(dirp);
 
     qsort(pids->pids, pids->count, sizeof(int), compare_pid);
+    proc_netlink_sync(pids);
     return 0;
 }
 
-static int
-in_hot_active_list(pid_t pid)
+/*
+ * Hotproc sampling.
+ *
+ * Every hotproc_update_interval a background thread scans /proc, then
+ * it and a small pool of worker threads share out the pids (in chunks
+ * of HOTPROC_CHUNK) to read the stat, status, io and schedstat of each
+ * and evaluate the configured predicate.  The result - the sampled
+ * processes sorted by pid, the hot pids, and the CPU time totals - is
+ * published as a new hotproc_set_t, which the PMDA thread swaps in for
+ * the one it is using at its next hotproc refresh.  So a sample never
+ * delays a PDU.  A sample evaluates a snapshot of the predicate taken
+ * under hotproc_lock(), so a configuration change does not wait for a
+ * sample in progress either; the tree it replaces is freed once that
+ * sample is done with it (see hold_tree() in config.c).
+ *
+ * The sampling threads only use their own state (below), the sample
+ * arrays and /proc, nothing from the proc_pid_t of the PMDA thread.
+ */
+
+#define HOTPROC_CHUNK		32	/* pids claimed by a thread at a time */
+#define HOTPROC_MAXTHREADS	8	/* sampling threads, at most */
+
+typedef struct {
+    process_t	node;		/* node.pid == 0 if not sampled */
+    char	*psargs;	/* as for the instance name, kept between samples */
+    int		active;		/* predicate is true */
+    double	cputime_delta;	/* CPU time since the previous sample */
+} hotproc_sample_t;
+
+typedef struct {
+    int		numprocs;	/* sampled processes, sorted by pid */
+    process_t	*procs;
+    int		numactive;	/* hot processes, sorted */
+    pid_t	*active;
+    int		have_totals;
+    double	total_transient;
+    double	total_cpuidle;
+    double	total_active;
+    double	total_inactive;
+} hotproc_set_t;
+
+/* PMDA thread: the set in use, and the latest one published */
+static hotproc_set_t *hot_current;
+static hotproc_set_t *hot_published;
+static pthread_mutex_t hot_publish_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* configuration (conf_gen, the predicate tree) and the sampler schedule */
+static pthread_mutex_t hot_config_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hot_config_changed = PTHREAD_COND_INITIALIZER;
+static struct timeval hot_interval;
+static int hot_reset;
+static int hot_started;
+
+/* a sample in progress, shared out between the sampling threads */
+static pthread_mutex_t hot_work_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hot_work_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t hot_work_done = PTHREAD_COND_INITIALIZER;
+static unsigned int hot_round;
+static int hot_next;		/* next pids[] index to be claimed */
+static int hot_busy;		/* workers yet to finish this round */
+static int hot_nworkers;
+
+/* sampler thread: pid list, current and previous samples */
+static proc_pid_list_t hot_scanpids;
+static hotproc_sample_t *hot_sample[2];
+static int hot_nsample[2];
+static int hot_maxsample[2];
+static int current;
+static int previous = 1;
+static int num_cpus;
+static unsigned long hot_refresh_count;
+static bool_node *hot_tree;	/* predicate snapshot for this sample */
+
+static void
+free_hotproc_set(hotproc_set_t *set)
 {
-    int i;
+    if (set == NULL)
+	return;
+    free(set->procs);
+    free(set->active);
+    free(set);
+}
+
+/*
+ * Pick up the latest sample, if there is a new one.
+ */
+static void
+hotproc_acquire(void)
+{
+    hotproc_set_t *set;
+
+    pthread_mutex_lock(&hot_publish_lock);
+    set = hot_published;
+    hot_published = NULL;
+    pthread_mutex_unlock(&hot_publish_lock);
 
-    for (i = 0; i < hot_numactive; i++) {
-        if (pid == hot_active_list[i])
-            return 1;
+    if (set != NULL) {
+	free_hotproc_set(hot_current);
+	hot_current = set;
+    }
+}
+
+void
+hotproc_lock(void)
+{
+    pthread_mutex_lock(&hot_config_lock);
+}
+
+void
+hotproc_unlock(void)
+{
+    pthread_mutex_unlock(&hot_config_lock);
+}
+
+int 
+get_hot_totals(double * ta, double * ti, double * tt, double * tci )
+{
+    if (hot_current != NULL && hot_current->have_totals) {
+	*ta = hot_current->total_active;
+	*ti = hot_current->total_inactive;
+	*tt = hot_current->total_transient;
+	*tci = hot_current->total_cpuidle;
+	return 1;
     }
     return 0;
 }
 
+static int
+in_hot_active_list(pid_t pid)
+{
+    if (hot_current == NULL || hot_current->numactive == 0)
+	return 0;
+    return bsearch(&pid, hot_current->active, hot_current->numactive,
+		    sizeof(pid_t), compare_pid) != NULL;
+}
+
 static int
 check_if_hot(char *cpid)
 {
@@ -277,77 +366,22 @@ refresh_hotproc_pidlist(proc_pid_list_t *pids)
     return 0;
 }
 
-static int
-init_hotproc_list(void)
-{
-    hot_active_list = (pid_t*)malloc(INIT_HOTPROC_MAX * sizeof(pid_t));
-    hotproc_list[0] = (process_t*)malloc(INIT_HOTPROC_MAX * sizeof(process_t));
-    hotproc_list[1] = (process_t*)malloc(INIT_HOTPROC_MAX * sizeof(process_t));
-    if (hotproc_list[0] == NULL || hotproc_list[1] == NULL || hot_active_list == NULL)
-        return -oserror();
-    return 0;
-}
-
-static void
-init_hot_active_list(void)
-{
-    hot_numactive = 0;
-}
-
-/*
- * add_hot_active_list:
- * - If unsuccessful in add - due to memory then return neg status.
- * - If member of active list return 1
- * - If non-member of active list return 0
- */
-static int
-add_hot_active_list(process_t *node, config_vars *vars)
-{
-    if (eval_tree(vars) == 0) {
-        return 0;
-    }
-    else {
-        /*fprintf(stderr, "Added hotproc %d\n", node->pid);*/
-    }
-
-    if (hot_numactive == hot_maxactive) {
-        pid_t *res;
-        hot_maxactive = hot_numactive*2;
-        res = (pid_t *)realloc(hot_active_list, hot_maxactive * sizeof(pid_t));
-        if (res == NULL)
-            return -1;
-        hot_active_list = res;
-    }
-    hot_active_list[hot_numactive++] = node->pid;
-    return 1;
-}
-
 static int
 compare_pids(const void *n1, const void *n2)
 {
-    return ((process_t*)n2)->pid - ((process_t*)n1)->pid;
+    return ((process_t*)n1)->pid - ((process_t*)n2)->pid;
 }
 
-static process_t *
-lookup_node(int curr_prev, pid_t pid)
+static hotproc_sample_t *
+lookup_sample(int curr_prev, pid_t pid)
 {
     process_t key;
-    process_t *node;
 
     key.pid = pid;
-
-    if ((hot_numprocs[curr_prev] > 0) &&
-        ((node = bsearch(&key, hotproc_list[curr_prev], hot_numprocs[curr_prev],
-			sizeof(process_t), compare_pids)) != NULL)) {
-	return node;
-    }
-    return NULL;
-}
-
-static process_t *
-lookup_curr_node(pid_t pid)
-{
-    return lookup_node(current, pid);
+    if (hot_nsample[curr_prev] == 0)
+	return NULL;
+    return bsearch(&key, hot_sample[curr_prev], hot_nsample[curr_prev],
+			sizeof(hotproc_sample_t), compare_pids);
 }
 
 static double
@@ -373,12 +407,15 @@ diff_counter(double current, double previous, int pmtype)
 int
 get_hotproc_node(pid_t pid, process_t **getnode)
 {
+    process_t key;
+
+    *getnode = NULL;
     if (in_hot_active_list(pid)) {
-	*getnode = lookup_curr_node(pid);
-	return (*getnode != NULL);
+	key.pid = pid;
+	*getnode = bsearch(&key, hot_current->procs, hot_current->numprocs,
+			sizeof(process_t), compare_pids);
     }
-    *getnode = NULL;
-    return 0;
+    return (*getnode != NULL);
 }
 
 /* The idea of this is copied from linux/proc_stat.c */
@@ -401,354 +438,439 @@ get_idle_time(void)
     return idle_time;
 }
 
-/*
- * For each pid, compute stats and store in hotpid array
- * (called by the timer)
- */
 static int
-hotproc_eval_procs(void)
+hotproc_read(int dirfd, const char *file, char *buf, int size)
 {
-    pid_t pid;
-    struct timeval ts;
-    int sts;
-    char                *f;
-    unsigned long       ul;
-    unsigned long long  ull;
-    char                *tail;
-    process_t *oldnode = NULL;      
-    process_t *newnode = NULL;      
-    int np = 0;                    
-    struct timeval p_timestamp;   
-    config_vars vars;
-    proc_pid_entry_t    *statentry;
-    proc_pid_entry_t    *statusentry;
-    proc_pid_entry_t    *ioentry;
-    proc_pid_entry_t    *schedstatentry;
-    __pmHashNode *node;
-    int i;
+    int fd, n;
 
-    /* Still need to compute some of these */
-    static double refresh_time[2];  /* timestamp after refresh */
-    static time_t sysidle[2];       /* sys idle from /proc/stat */
-    double sysidle_delta;           /* system idle delta time since last refresh */
-    double actual_delta;            /* actual delta time since last refresh */
-    double transient_delta;         /* calculated delta time of transient procs */
-    double cputime_delta;           /* delta cpu time for a process */
-    //double syscalls_delta;          /* delta num of syscalls for a process */
-    double vctx_delta;              /* delta num of vol ctx switches for a process */
-    double ictx_delta;              /* delta num of invol ctx switches for a process */
-    double bread_delta;             /* delta num of bytes read */
-    double bwrit_delta;             /* delta num of bytes written */
-    double bwtime_delta;            /* delta num of microsec for waiting for blocked io */
-    double qwtime_delta;            /* delta num of nanosec waiting on run queue */
-    double timestamp_delta;         /* real time delta b/w refreshes for process */
-    double total_cputime = 0;       /* total of cputime_deltas for each process */
-    double total_activetime = 0;    /* total of cputime_deltas for active processes */
-    double total_inactivetime = 0;  /* total of cputime_deltas for inactive processes */
+    if ((fd = openat(dirfd, file, O_RDONLY)) < 0)
+	return -oserror();
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+	return -oserror();
+    buf[n] = '\0';
+    return n;
+}
 
-    if (num_cpus == 0) {
-	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
-    }
+/* value of the "name:" line of a status or io file, or NULL */
+static char *
+hotproc_line(char *buf, const char *name)
+{
+    char *p;
 
-    if (current == 0) {
-        current = 1; previous = 0;
+    for (p = buf; p != NULL; p = strchr(p, '\n')) {
+	if (*p == '\n')
+	    p++;
+	if (strncmp(p, name, strlen(name)) == 0)
+	    return p + strlen(name);
     }
-    else {
-        current = 0; previous = 1;
-    }
-
-    init_hot_active_list();
-
-    memset(&vars, 0, sizeof(config_vars));
-
-    hotpids.count = 0;
-    hotpids.threads = 0;
-
-    /* Whats running right now */
-    refresh_global_pidlist(0, NULL, &hotpids);
-    refresh_proc_pidlist(hotproc_poss_pid, &hotpids);
-
-    for (i=0; i < hotpids.count; i++) {
-
-	pid = hotpids.pids[i];
-
-        node = __pmHashSearch(hotpids.pids[i], &hotproc_poss_pid->pidhash);
-
-	if (node == NULL) {
-	    fprintf(stderr,"hotproc : Hash search failed for Proc %d!\n", i);
-	    continue;
-	}
+    return NULL;
+}
 
-	__pmtimevalNow(&p_timestamp);
+static unsigned long long
+hotproc_value(char *buf, const char *name)
+{
+    char *p = hotproc_line(buf, name);
 
-	/* Collect all the stat/status/statm info */
-	statentry = fetch_proc_pid_stat(pid, hotproc_poss_pid, &sts);
-	statusentry = fetch_proc_pid_status(pid, hotproc_poss_pid, &sts);
-	ioentry = fetch_proc_pid_io(pid, hotproc_poss_pid, &sts);
-	schedstatentry = fetch_proc_pid_schedstat(pid, hotproc_poss_pid, &sts);
+    return p ? strtoull(p, NULL, 0) : 0;
+}
 
-        /* Note: /proc/pid/schedstat and /proc/pid/io not on all platforms */
-	if (!statentry || !statusentry /*|| !ioentry || !schedstatentry */) {
-	    /* Can happen if the process was exiting during
-	     * refresh_proc_pidlist then the above fetch's will fail.
-	     * Would be best if they were not in the list at all
-	     * "np" is used from now on, so hopefully can just continue
-	     */
+/* split a stat buffer into fields, numbered as for proc_pid_stat_field() */
+static int
+hotproc_stat_index(char *p, char **field)
+{
+    char *end;
+    int n = 0;
+
+    if ((end = strchr(p, '(')) != NULL)
+	end = strrchr(end, ')');
+    while (n < NR_PROC_PID_STAT) {
+	while (isspace((int)*p))
+	    p++;
+	if (*p == '\0')
+	    break;
+	if (n == PROC_PID_STAT_CMD && *p == '(' && end != NULL && end > p) {
+	    field[n++] = p + 1;
+	    *end = '\0';
+	    p = end + 1;
 	    continue;
 	}
+	field[n++] = p;
+	while (*p && !isspace((int)*p))
+	    p++;
+	if (*p)
+	    *p++ = '\0';
+    }
+    return n;
+}
 
-	if (np == hot_maxprocs[current]) {
-	    process_t *res;
-	    hot_maxprocs[current] = np*2;
-	    res = (process_t *)realloc(hotproc_list[current],
-		    hot_maxprocs[current] * sizeof(process_t));
-	    if (res == NULL)
-		return -oserror();
-	    hotproc_list[current] = res;
-	}
-
-	newnode = &hotproc_list[current][np++];
-        newnode->pid = pid;
-
-	/* Calc the stats we will need */
-	/* CPU Time is sum of U & S time */
-	
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_UTIME)) == NULL)
-	    newnode->r_cputime = 0;
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	    newnode->r_cputime      = (double)ul / (double)hz;
-	}
-
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_STIME)) == NULL){
-	    /* Nothing */
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	    newnode->r_cputime      += (double)ul / (double)hz;
-	}
-
-	newnode->r_cputimestamp = p_timestamp.tv_sec + p_timestamp.tv_usec / 1000000;
-
-	/* Context Switches : vol and invol */
-
-        if ((f = _pm_getfield(statusentry->status_lines.vctxsw, 1)) == NULL)
-	    newnode->r_vctx = 0;
-	else
-	    newnode->r_vctx = (__uint32_t)strtoul(f, &tail, 0);
-
-	if ((f = _pm_getfield(statusentry->status_lines.nvctxsw, 1)) == NULL)
-	    newnode->r_ictx = 0;
-	else
-	    newnode->r_ictx = (__uint32_t)strtoul(f, &tail, 0);
-
-	/* IO demand */
-	/* Read */
-	
-        if( !ioentry ) /* ioentry is not enabled on all kernels */
-            ull = 0;
-	else if ((f = _pm_getfield(ioentry->io_lines.readb, 1)) == NULL)
-	    ull = 0;
-	else
-	    ull = (__uint64_t)strtoull(f, &tail, 0);
-		
-	newnode->r_bread = ull;
-
-	/* Write */
-
-        if( !ioentry ) /* ioentry is not enabled on all kernels */
-            ull = 0;
-	else if ((f = _pm_getfield(ioentry->io_lines.writeb, 1)) == NULL)
-	    ull = 0;
-	else
-	    ull = (__uint64_t)strtoull(f, &tail, 0);
-		
-	newnode->r_bwrit = ull;
-	
-	/* Block IO wait (delayacct_blkio_ticks) */
+/*
+ * The instance name (less the pid) as refresh_proc_pidlist() would
+ * have it, from cmdline or else the Name: in status.
+ */
+static char *
+hotproc_psargs(int dirfd, char *status)
+{
+    char buf[MAXPATHLEN];
+    char *p;
+    int k;
+
+    if ((k = hotproc_read(dirfd, "cmdline", buf, sizeof(buf))) > 0) {
+	/* skip trailing nils, replace the others with spaces */
+	p = buf + k - 1;
+	while (buf < p && *p == '\0')
+	    p--;
+	for (; buf < p; p--) {
+	    if (*p == '\0')
+		*p = ' ';
+	}
+	return strdup(buf);
+    }
+    if ((p = hotproc_line(status, "Name:")) != NULL) {
+	while (isspace((int)*p))
+	    p++;
+	snprintf(buf, sizeof(buf), "(%.*s)", (int)strcspn(p, "\n"), p);
+	return strdup(buf);
+    }
+    return strdup("<exiting>");
+}
 
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_DELAYACCT_BLKIO_TICKS - 3)) == NULL)  /* Note the offset */
-	    ul = 0;
-	else
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-		
-	newnode->r_bwtime = (double)ul / hz;
-
-	/* Schedwait (run_delay) */
-        if( !schedstatentry ) /* schedstat is not enabled on all kernels */
-            ull =0;
-        else if ((f = _pm_getfield(schedstatentry->schedstat_buf, 1)) == NULL)
-	    ull = 0;
-	else
-	    ull  = (__uint64_t)strtoull(f, &tail, 0);
+/*
+ * Sample one process, compute its rates against the previous sample
+ * and evaluate the predicate.  Returns 0 if the process has gone.
+ */
+static int
+hotproc_sample(pid_t pid, hotproc_sample_t *sp)
+{
+    hotproc_sample_t *oldsp;
+    process_t *newnode = &sp->node;
+    process_t *oldnode;
+    config_vars vars;
+    struct timeval p_timestamp;
+    struct passwd pwd, *pwe;
+    struct group grp, *gre;
+    char path[MAXPATHLEN];
+    char statbuf[1024];
+    char statusbuf[4096];
+    char iobuf[1024];
+    char schedbuf[256];
+    char pwbuf[4096];
+    char *field[NR_PROC_PID_STAT];
+    char *p;
+    int nfield, dirfd, have_io, have_sched;
+    unsigned long ul;
+    double timestamp_delta;
 
-	newnode->r_qwtime = ull;
+    snprintf(path, sizeof(path), "%s/proc/%d", proc_statspath, pid);
+    if ((dirfd = open(path, O_RDONLY|O_DIRECTORY)) < 0)
+	return 0;
 
+    __pmtimevalNow(&p_timestamp);
 
-	/* This is not the first time through, so we can generate rate stats */
-	if ((oldnode = lookup_node(previous, pid)) != NULL) {
+    /* Note: /proc/pid/schedstat and /proc/pid/io not on all platforms */
+    if (hotproc_read(dirfd, "stat", statbuf, sizeof(statbuf)) <= 0 ||
+	hotproc_read(dirfd, "status", statusbuf, sizeof(statusbuf)) <= 0) {
+	/* exiting since the /proc scan */
+	close(dirfd);
+	return 0;
+    }
+    have_io = hotproc_read(dirfd, "io", iobuf, sizeof(iobuf)) > 0;
+    have_sched = hotproc_read(dirfd, "schedstat", schedbuf, sizeof(schedbuf)) > 0;
 
-	    /* CPU */
-	    cputime_delta = diff_counter(newnode->r_cputime, oldnode->r_cputime, PM_TYPE_64);
-	    timestamp_delta = diff_counter(newnode->r_cputimestamp, oldnode->r_cputimestamp, PM_TYPE_64);
+    memset(&vars, 0, sizeof(config_vars));
+    memset(sp, 0, sizeof(*sp));
+    newnode->pid = pid;
 
-	    newnode->r_cpuburn = cputime_delta / timestamp_delta;
-	    vars.cpuburn = newnode->r_cpuburn;
+    if ((oldsp = lookup_sample(previous, pid)) != NULL) {
+	/* each pid is sampled by one thread, so this is safe */
+	sp->psargs = oldsp->psargs;
+	oldsp->psargs = NULL;
+    }
+    else
+	sp->psargs = hotproc_psargs(dirfd, statusbuf);
+    close(dirfd);
+
+    nfield = hotproc_stat_index(statbuf, field);
+#define STAT_FIELD(f)	((f) < nfield ? proc_strtoull(field[(f)]) : 0)
+
+    /* CPU Time is sum of U & S time */
+    ul = (__uint32_t)STAT_FIELD(PROC_PID_STAT_UTIME);
+    newnode->r_cputime = (double)ul / (double)hz;
+    ul = (__uint32_t)STAT_FIELD(PROC_PID_STAT_STIME);
+    newnode->r_cputime += (double)ul / (double)hz;
+    newnode->r_cputimestamp = p_timestamp.tv_sec + p_timestamp.tv_usec / 1000000;
+
+    /* Context Switches : vol and invol */
+    newnode->r_vctx = (__uint32_t)hotproc_value(statusbuf, "voluntary_ctxt_switches:");
+    newnode->r_ictx = (__uint32_t)hotproc_value(statusbuf, "nonvoluntary_ctxt_switches:");
+
+    /* IO demand, io is not enabled on all kernels */
+    newnode->r_bread = have_io ? hotproc_value(iobuf, "read_bytes:") : 0;
+    newnode->r_bwrit = have_io ? hotproc_value(iobuf, "write_bytes:") : 0;
+
+    /* Block IO wait (delayacct_blkio_ticks), note the offset */
+    ul = (__uint32_t)STAT_FIELD(PROC_PID_STAT_DELAYACCT_BLKIO_TICKS - 3);
+    newnode->r_bwtime = (double)ul / hz;
+
+    /* Schedwait (run_delay), schedstat is not enabled on all kernels */
+    newnode->r_qwtime = 0;
+    if (have_sched && (p = strchr(schedbuf, ' ')) != NULL)
+	newnode->r_qwtime = strtoull(p, NULL, 0);
+
+    /* This is not the first time through, so we can generate rate stats */
+    if (oldsp != NULL) {
+	oldnode = &oldsp->node;
+
+	/* CPU */
+	sp->cputime_delta = diff_counter(newnode->r_cputime, oldnode->r_cputime, PM_TYPE_64);
+	timestamp_delta = diff_counter(newnode->r_cputimestamp, oldnode->r_cputimestamp, PM_TYPE_64);
+	newnode->r_cpuburn = sp->cputime_delta / timestamp_delta;
+	vars.cpuburn = newnode->r_cpuburn;
+
+	/* IO */
+	vars.preds.iodemand = (
+		diff_counter((double)newnode->r_bread, (double)oldnode->r_bread, PM_TYPE_64) +
+		diff_counter((double)newnode->r_bwrit, (double)oldnode->r_bwrit, PM_TYPE_64)) /
+		timestamp_delta;
+
+	/* ctx switches */
+	vars.preds.ctxswitch = (
+		diff_counter((double)newnode->r_vctx, (double)oldnode->r_vctx, PM_TYPE_64) +
+		diff_counter((double)newnode->r_ictx, (double)oldnode->r_ictx, PM_TYPE_64)) /
+		timestamp_delta;
+
+	/* IO wait */
+	vars.preds.iowait = diff_counter((double)newnode->r_bwtime,
+		(double)oldnode->r_bwtime, PM_TYPE_64) / timestamp_delta;
+
+	/* schedwait, run_delay in nsec */
+	vars.preds.schedwait = diff_counter((double)newnode->r_qwtime,
+		(double)oldnode->r_qwtime, PM_TYPE_64) / (timestamp_delta * 1000000000);
+    }
 
-	    /* IO */
-	    bread_delta = diff_counter((double)newnode->r_bread,
-                                   (double)oldnode->r_bread, PM_TYPE_64);
-	    bwrit_delta = diff_counter((double)newnode->r_bwrit,
-                                    (double)oldnode->r_bwrit, PM_TYPE_64);
-	    vars.preds.iodemand = (
-                                 (double)bread_delta  +
-                                 (double)bwrit_delta ) /
-                                timestamp_delta;
+    /* Command */
+    if (nfield > PROC_PID_STAT_CMD)
+	strncpy(vars.fname, field[PROC_PID_STAT_CMD], sizeof(vars.fname));
+    else
+	strcpy(vars.fname, "Unknown");
+    vars.fname[sizeof(vars.fname) - 1] = '\0';
 
-	    /* ctx switches */
-	    vctx_delta = diff_counter((double)newnode->r_vctx,
-                                    (double)oldnode->r_vctx, PM_TYPE_64);
-	    ictx_delta = diff_counter((double)newnode->r_ictx,
-                                    (double)oldnode->r_ictx, PM_TYPE_64);
-	    vars.preds.ctxswitch = (vctx_delta + ictx_delta) / timestamp_delta;
+    /* PS Args */
+    if (sp->psargs != NULL)
+	strncpy(vars.psargs, sp->psargs, sizeof(vars.psargs));
+    vars.psargs[sizeof(vars.psargs)-1]='\0';
 
-	    /* IO wait */
-	    bwtime_delta = diff_counter((double)newnode->r_bwtime,
-                                    (double)oldnode->r_bwtime, PM_TYPE_64);
+    /* UID and GID, uname and gname */
+    vars.uid = (__uint32_t)hotproc_value(statusbuf, "Uid:");
+    vars.gid = (__uint32_t)hotproc_value(statusbuf, "Gid:");
 
-	    vars.preds.iowait = bwtime_delta / timestamp_delta;
+    if (getpwuid_r((uid_t)vars.uid, &pwd, pwbuf, sizeof(pwbuf), &pwe) == 0 && pwe != NULL) {
+	strncpy(vars.uname, pwe->pw_name, sizeof(vars.uname));
+	vars.uname[sizeof(vars.uname)-1] = '\0';
+    }
+    else
+	strcpy(vars.uname, "UNKNOWN");
 
-	    /* schedwait */
-	    qwtime_delta = diff_counter((double)newnode->r_qwtime,
-		    (double)oldnode->r_qwtime, PM_TYPE_64);
-	    vars.preds.schedwait = qwtime_delta / (timestamp_delta * 1000000000); /* run_delay in nsec */
+    if (getgrgid_r((gid_t)vars.gid, &grp, pwbuf, sizeof(pwbuf), &gre) == 0 && gre != NULL) {
+	strncpy(vars.gname, gre->gr_name, sizeof(vars.gname));
+	vars.gname[sizeof(vars.gname)-1] = '\0';
+    } 
+    else
+	strcpy(vars.gname, "UNKNOWN");
 
-	}
-        else {
-	    newnode->r_cpuburn = 0;
-	    memset(&newnode->preds, 0, sizeof(newnode->preds));
-	    vars.cpuburn = 0;
-	    //vars.preds.syscalls = 0;
-	    vars.preds.ctxswitch = 0;
-	    vars.preds.iowait = 0;
-	    vars.preds.schedwait = 0;
-	    vars.preds.iodemand = 0;
-	    cputime_delta = 0;
-        }
+    /* VSIZE and RSS from stat */
+    ul = (__uint32_t)STAT_FIELD(PROC_PID_STAT_VSIZE);
+    vars.preds.virtualsize = ul / 1024;
+    ul = (__uint32_t)STAT_FIELD(PROC_PID_STAT_RSS);
+    vars.preds.residentsize = ul * (getpagesize() / 1024);
+#undef STAT_FIELD
 
-        total_cputime += cputime_delta;
+    newnode->preds = vars.preds;
+    sp->active = eval_tree(hot_tree, &vars);
+    return 1;
+}
 
-	/* Command */
+/*
+ * Claim and sample chunks of pids until there are none left,
+ * called from every sampling thread.
+ */
+static void
+hotproc_work(void)
+{
+    hotproc_sample_t *samples = hot_sample[current];
+    int i, first, last;
 
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_CMD)) == NULL) {
-	    strcpy(vars.fname, "Unknown");
-	}
-	else {
-	    char *cmd = f + 1;	/* skip enclosing parentheses */
-	    size_t len = strlen(cmd);
+    for (;;) {
+	pthread_mutex_lock(&hot_work_lock);
+	first = hot_next;
+	hot_next += HOTPROC_CHUNK;
+	pthread_mutex_unlock(&hot_work_lock);
 
-	    strncpy(vars.fname, cmd, sizeof(vars.fname));
-	    if (len < sizeof(vars.fname))
-		vars.fname[len-1] = '\0'; /* Skip the closing parenthesis */
-	    vars.fname[sizeof(vars.fname) - 1] = '\0';
+	if (first >= hot_scanpids.count)
+	    break;
+	if ((last = first + HOTPROC_CHUNK) > hot_scanpids.count)
+	    last = hot_scanpids.count;
+	for (i = first; i < last; i++) {
+	    if (!hotproc_sample(hot_scanpids.pids[i], &samples[i]))
+		samples[i].node.pid = 0;
 	}
+    }
+}
 
-	/* PS Args */
-	strncpy(vars.psargs, statentry->name+7, sizeof(vars.psargs));
-	vars.psargs[sizeof(vars.psargs)-1]='\0';
-
-	/* UID and GID */
-	if ((f = _pm_getfield(statusentry->status_lines.uid, 1)) == NULL) {
-	    ul = 0;
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	}
-	
-	vars.uid = ul;
+static void *
+hotproc_worker(void *arg)
+{
+    unsigned int round = 0;
 
-	if ((f = _pm_getfield(statusentry->status_lines.gid, 1)) == NULL) {
-	    ul = 0;
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	}
+    for (;;) {
+	pthread_mutex_lock(&hot_work_lock);
+	while (hot_round == round)
+	    pthread_cond_wait(&hot_work_start, &hot_work_lock);
+	round = hot_round;
+	pthread_mutex_unlock(&hot_work_lock);
 
-	vars.gid = ul;
+	hotproc_work();
 
-	/* uname and gname */
+	pthread_mutex_lock(&hot_work_lock);
+	if (--hot_busy == 0)
+	    pthread_cond_signal(&hot_work_done);
+	pthread_mutex_unlock(&hot_work_lock);
+    }
+    return NULL;
+}
 
-	struct passwd *pwe;		
+/* Whats running right now, from the sampling thread */
+static int
+hotproc_scan(proc_pid_list_t *pids)
+{
+    DIR *dirp;
+    struct dirent *dp;
+    char path[MAXPATHLEN];
 
-	if ((pwe = getpwuid((uid_t)vars.uid)) != NULL) {
-	    strncpy(vars.uname, pwe->pw_name, sizeof(vars.uname));
-	    vars.uname[sizeof(vars.uname)-1] = '\0';
-	}
-	else {
-	    strcpy(vars.uname, "UNKNOWN");
-	}
+    pids->count = 0;
+    snprintf(path, sizeof(path), "%s/proc", proc_statspath);
+    if ((dirp = opendir(path)) == NULL)
+	return -oserror();
+    while ((dp = readdir(dirp)) != NULL) {
+	if (isdigit((int)dp->d_name[0]))
+	    pidlist_append(dp->d_name, pids);
+    }
+    closedir(dirp);
+    qsort(pids->pids, pids->count, sizeof(int), compare_pid);
+    return 0;
+}
 
-	struct group *gre;
+/*
+ * Sample every process and compute the totals, returning a new set
+ * for the caller to publish (called by the sampler thread, without
+ * hot_config_lock held, evaluating the hot_tree snapshot)
+ */
+static int
+hotproc_eval_procs(hotproc_set_t **setp)
+{
+    hotproc_sample_t *samples;
+    hotproc_set_t *set;
+    struct timeval start, ts;
+    int i, np, na, sts;
 
-	if ((gre = getgrgid((gid_t)vars.gid)) != NULL) {
-	    strncpy(vars.gname, gre->gr_name, sizeof(vars.gname));
-	    vars.gname[sizeof(vars.gname)-1] = '\0';
-	} 
-	else {
-	    strcpy(vars.gname, "UNKNOWN");
-	}
+    /* Still need to compute some of these */
+    static double refresh_time[2];  /* timestamp after refresh */
+    static time_t sysidle[2];       /* sys idle from /proc/stat */
+    double sysidle_delta;           /* system idle delta time since last refresh */
+    double actual_delta;            /* actual delta time since last refresh */
+    double transient_delta;         /* calculated delta time of transient procs */
+    double total_cputime = 0;       /* total of cputime_deltas for each process */
+    double total_activetime = 0;    /* total of cputime_deltas for active processes */
+    double total_inactivetime = 0;  /* total of cputime_deltas for inactive processes */
 
-	/* VSIZE from stat */
+    if (num_cpus == 0) {
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    }
 
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_VSIZE)) == NULL) {
-	    ul = 0;
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	    ul /= 1024;
-	}
+    if (current == 0) {
+        current = 1; previous = 0;
+    }
+    else {
+        current = 0; previous = 1;
+    }
 
-	vars.preds.virtualsize = ul;
+    __pmtimevalNow(&start);
 
-	/* RSS from stat */
+    if ((sts = hotproc_scan(&hot_scanpids)) < 0)
+	return sts;
+    if (hot_scanpids.count > hot_maxsample[current]) {
+	samples = (hotproc_sample_t *)realloc(hot_sample[current],
+			hot_scanpids.count * sizeof(hotproc_sample_t));
+	if (samples == NULL)
+	    return -oserror();
+	hot_sample[current] = samples;
+	hot_maxsample[current] = hot_scanpids.count;
+    }
 
-	if ((f = _pm_getfield(statentry->stat_buf, PROC_PID_STAT_RSS)) == NULL) {
-	    ul = 0;
-	}
-	else {
-	    ul = (__uint32_t)strtoul(f, &tail, 0);
-	    ul *= getpagesize() / 1024;
+    /* share the pids out between this thread and the workers */
+    pthread_mutex_lock(&hot_work_lock);
+    hot_next = 0;
+    hot_busy = hot_nworkers;
+    hot_round++;
+    pthread_cond_broadcast(&hot_work_start);
+    pthread_mutex_unlock(&hot_work_lock);
+
+    hotproc_work();
+
+    pthread_mutex_lock(&hot_work_lock);
+    while (hot_busy > 0)
+	pthread_cond_wait(&hot_work_done, &hot_work_lock);
+    pthread_mutex_unlock(&hot_work_lock);
+
+    /* drop processes that have gone, keeping pid order */
+    samples = hot_sample[current];
+    for (i = np = na = 0; i < hot_scanpids.count; i++) {
+	if (samples[i].node.pid == 0)
+	    continue;
+	if (np != i)
+	    samples[np] = samples[i];
+	total_cputime += samples[np].cputime_delta;
+	if (samples[np].active) {
+	    total_activetime += samples[np].cputime_delta;
+	    na++;
 	}
-
-	vars.preds.residentsize = ul;
-
-	//  Struct copy.  I think it was a bug before.  Copy should be after rss and vm calcs
-	newnode->preds = vars.preds;
-
-	if ((sts = add_hot_active_list(newnode, &vars)) < 0) {
-	    return sts;
-       	}
-
-       	if (sts == 0)
-	    total_inactivetime += cputime_delta;
 	else
-	    total_activetime += cputime_delta;
-
+	    total_inactivetime += samples[np].cputime_delta;
+	np++;
     }
+    hot_nsample[current] = np;
 
-    hot_numprocs[current] = np;
+    /* the previous sample is finished with, except for these */
+    for (i = 0; i < hot_nsample[previous]; i++) {
+	free(hot_sample[previous][i].psargs);
+	hot_sample[previous][i].psargs = NULL;
+    }
 
     __pmtimevalNow(&ts);
     refresh_time[current] = ts.tv_sec + ts.tv_usec / 1000000;
 
-    double hptime = (ts.tv_sec - p_timestamp.tv_sec) + (ts.tv_usec - p_timestamp.tv_usec)/1000000.0;
-
     if (pmDebug & DBG_TRACE_LIBPMDA)
-	fprintf(stderr, "Hotproc Update took %f time\n", hptime);
+	fprintf(stderr, "Hotproc Update took %f time, %d threads\n",
+		__pmtimevalSub(&ts, &start), hot_nworkers + 1);
 
     /* Idle */
     sysidle[current] = get_idle_time();
 
+    if ((set = (hotproc_set_t *)calloc(1, sizeof(hotproc_set_t))) == NULL ||
+	(np > 0 && (set->procs = (process_t *)malloc(np * sizeof(process_t))) == NULL) ||
+	(na > 0 && (set->active = (pid_t *)malloc(na * sizeof(pid_t))) == NULL)) {
+	sts = -oserror();
+	free_hotproc_set(set);
+	return sts;
+    }
+    for (i = 0; i < np; i++) {
+	set->procs[i] = samples[i].node;
+	if (samples[i].active)
+	    set->active[set->numactive++] = samples[i].node.pid;
+    }
+    set->numprocs = np;
+
     /* Handle rollover */
     hot_refresh_count++;
     if (hot_refresh_count == 0)
@@ -761,68 +883,148 @@ hotproc_eval_procs(void)
 	if (transient_delta < 0) /* sanity check */
 	    transient_delta = 0;
 
-        hot_have_totals = 1;
-        hot_total_transient = transient_delta / actual_delta;
-        hot_total_cpuidle = sysidle_delta / actual_delta;
-        hot_total_active = total_activetime / actual_delta;
-        hot_total_inactive = total_inactivetime / actual_delta;
+        set->have_totals = 1;
+        set->total_transient = transient_delta / actual_delta;
+        set->total_cpuidle = sysidle_delta / actual_delta;
+        set->total_active = total_activetime / actual_delta;
+        set->total_inactive = total_inactivetime / actual_delta;
     }
 
-    qsort(hotproc_list[current], hot_numprocs[current],
-          sizeof(process_t), compare_pids);
-
+    *setp = set;
     return 0;
 }
 
+static void *
+hotproc_sampler(void *arg)
+{
+    struct timespec deadline = { 0, 0 };
+    struct timeval now;
+    hotproc_set_t *set = NULL;
+    int sts;
+
+    pthread_mutex_lock(&hot_config_lock);
+    for (;;) {
+	if (!conf_gen) {
+	    pthread_cond_wait(&hot_config_changed, &hot_config_lock);
+	    continue;
+	}
+	if (hot_reset) {
+	    hot_reset = 0;
+	    __pmtimevalNow(&now);
+	    deadline.tv_sec = now.tv_sec + hot_interval.tv_sec;
+	    deadline.tv_nsec = now.tv_usec * 1000;
+	}
+	sts = pthread_cond_timedwait(&hot_config_changed, &hot_config_lock, &deadline);
+	if (sts != ETIMEDOUT || !conf_gen || hot_reset)
+	    continue;
+
+	/*
+	 * Sample against a snapshot of the configuration, so that stores
+	 * to hotproc.control.* are not held up for the whole sample, and
+	 * publish the result only if hotproc has not been disabled since.
+	 */
+	hot_tree = hold_tree();
+	pthread_mutex_unlock(&hot_config_lock);
+	sts = hotproc_eval_procs(&set);
+	pthread_mutex_lock(&hot_config_lock);
+	release_tree();
+	hot_tree = NULL;
+	if (sts < 0)
+	    __pmNotifyErr(LOG_ERR, "hotproc sample failed: %s", pmErrStr(sts));
+	else if (conf_gen) {
+	    pthread_mutex_lock(&hot_publish_lock);
+	    free_hotproc_set(hot_published);
+	    hot_published = set;
+	    pthread_mutex_unlock(&hot_publish_lock);
+	}
+	else
+	    free_hotproc_set(set);
+	deadline.tv_sec += hot_interval.tv_sec;
+	__pmtimevalNow(&now);
+	if (deadline.tv_sec <= now.tv_sec)	/* sample overran, skip */
+	    deadline.tv_sec = now.tv_sec + hot_interval.tv_sec;
+    }
+    return NULL;
+}
+
 static void
-hotproc_timer(int sig, void *ptr)
+hotproc_start(void)
 {
-    hotproc_eval_procs();
+    pthread_t tid;
+    int i, sts, nthreads;
+
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > HOTPROC_MAXTHREADS)
+	nthreads = HOTPROC_MAXTHREADS;
+    for (i = 1; i < nthreads; i++) {
+	if (pthread_create(&tid, NULL, hotproc_worker, NULL) != 0)
+	    break;
+	hot_nworkers++;
+    }
+    if ((sts = pthread_create(&tid, NULL, hotproc_sampler, NULL)) != 0) {
+	__pmNotifyErr(LOG_ERR, "error starting hotproc sampler thread: %s",
+			pmErrStr(-sts));
+	exit(1);
+    }
+    hot_started = 1;
 }
 
 void
-init_hotproc_pid(proc_pid_t *_hotproc_poss_pid)
+init_hotproc_pid(void)
 {
-    hotproc_poss_pid = _hotproc_poss_pid;
     hotproc_update_interval.tv_sec = 10;
-    init_hotproc_list();
     reset_hotproc_timer();
 }
 
 void
 reset_hotproc_timer(void)
 {
-    int	sts;
-
-    /* Only reset/enable timer when a valid configuration is present. */
+    /* Only start the sampler when a valid configuration is present. */
     if (!conf_gen)
 	return;
 
-    __pmAFunregister(hotproc_timer_id);
-    sts = __pmAFregister(&hotproc_update_interval, NULL, hotproc_timer);
-    if (sts < 0) {
-	__pmNotifyErr(LOG_ERR, "error registering hotproc timer: %s",
-			pmErrStr(sts));
-	exit(1);
-    }
-    hotproc_timer_id = sts;
+    pthread_mutex_lock(&hot_config_lock);
+    hot_interval = hotproc_update_interval;
+    if (hot_interval.tv_sec < 1)
+	hot_interval.tv_sec = 1;
+    hot_reset = 1;
+    pthread_cond_signal(&hot_config_changed);
+    pthread_mutex_unlock(&hot_config_lock);
+
+    if (!hot_started)
+	hotproc_start();
 }
 
 void
 disable_hotproc(void)
 {
-    /* Clear out the hotlist */
-    init_hot_active_list();
-    /* Disable the timer */
-    __pmAFunregister(hotproc_timer_id);
+    /* Stop sampling, a sample in progress is not published */
+    pthread_mutex_lock(&hot_config_lock);
     conf_gen = 0;
+    pthread_mutex_unlock(&hot_config_lock);
+
+    /* Clear out the hotlist */
+    pthread_mutex_lock(&hot_publish_lock);
+    free_hotproc_set(hot_published);
+    hot_published = NULL;
+    pthread_mutex_unlock(&hot_publish_lock);
+    free_hotproc_set(hot_current);
+    hot_current = NULL;
 }
 
+/*
+ * Each refresh of the pid list starts a new generation.  Entries for
+ * pids already known (the common case) just have their generation and
+ * flags updated, the instance name (from cmdline) and any open /proc
+ * directory are kept, and the hash table is only walked to harvest
+ * exited pids if fewer entries than before were seen.
+ */
 static void
 refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 {
     int i;
     int fd;
+    int seen = 0;
     char *p;
     char buf[MAXPATHLEN];
     __pmHashNode *node, *next, *prev;
@@ -834,15 +1036,8 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 						pids->count * sizeof(pmdaInstid));
     indomp->it_numinst = pids->count;
 
-    /*
-     * invalidate all entries so we can harvest pids that have exited
-     */
-    for (i=0; i < proc_pid->pidhash.hsize; i++) {
-	for (node=proc_pid->pidhash.hash[i]; node != NULL; node = node->next) {
-	    ep = (proc_pid_entry_t *)node->data;
-	    ep->flags = 0;
-	}
-    }
+    if (++proc_pid->gen == 0)
+	proc_pid->gen = 1;	/* 0 is never current, see below */
 
     /*
      * walk pid list and add new pids to the hash table,
@@ -857,9 +1052,9 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 	    memset(ep, 0, sizeof(proc_pid_entry_t));
 
 	    ep->id = pids->pids[i];
+	    ep->dirfd = -1;
 
-	    snprintf(buf, sizeof(buf), "%s/proc/%d/cmdline", proc_statspath, pids->pids[i]);
-	    if ((fd = open(buf, O_RDONLY)) >= 0) {
+	    if ((fd = proc_open("cmdline", ep)) >= 0) {
 		int numlen = sprintf(buf, "%06d ", pids->pids[i]);
 		if ((k = read(fd, buf+numlen, sizeof(buf)-numlen)) > 0) {
 		    p = buf + k + numlen;
@@ -879,22 +1074,13 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 		}
 		close(fd);
 	    }
-#if PCP_DEBUG
-	    else {
-		if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
-		    char ebuf[1024];
-		    fprintf(stderr, "refresh_proc_pidlist: open(\"%s\", O_RDONLY) failed: %s\n", buf, pmErrStr_r(-oserror(), ebuf, sizeof(ebuf)));
-		}
-	    }
-#endif
 	    if (k == 0) {
 		/*
 		 * If a process is swapped out, /proc/<pid>/cmdline
 		 * returns an empty string so we have to get it
 		 * from /proc/<pid>/status or /proc/<pid>/stat
 		 */
-		sprintf(buf, "%s/proc/%d/status", proc_statspath, pids->pids[i]);
-		if ((fd = open(buf, O_RDONLY)) >= 0) {
+		if ((fd = proc_open("status", ep)) >= 0) {
 		    /* We engage in a bit of a hanky-panky here:
 		     * the string should look like "123456 (name)",
 		     * we get it from /proc/XX/status as "Name:   name\n...",
@@ -920,14 +1106,6 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 		    }
 		    close(fd);
 		}
-#if PCP_DEBUG
-		else {
-		    if ((pmDebug & (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) == (DBG_TRACE_LIBPMDA|DBG_TRACE_DESPERATE)) {
-			char ebuf[1024];
-			fprintf(stderr, "refresh_proc_pidlist: open(\"%s\", O_RDONLY) failed: %s\n", buf, pmErrStr_r(-oserror(), ebuf, sizeof(ebuf)));
-		    }
-		}
-#endif
 	    }
 
 	    if (k <= 0) {
@@ -938,13 +1116,18 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 	    ep->name = strdup(buf);
 
 	    __pmHashAdd(pids->pids[i], (void *)ep, &proc_pid->pidhash);
+	    proc_pid->nentries++;
 	    //fprintf(stderr, "key %d : ADDED \"%s\" to hash table\n", pids->pids[i], buf);
 	}
 	else
 	    ep = (proc_pid_entry_t *)node->data;
 	
-	/* mark pid as still existing */
-	ep->flags |= PROC_PID_FLAG_VALID;
+	/* mark pid as still existing, nothing fetched yet this time */
+	if (ep->gen != proc_pid->gen) {
+	    ep->gen = proc_pid->gen;
+	    ep->flags = PROC_PID_FLAG_VALID;
+	    seen++;
+	}
 
 	/* refresh the indom pointer */
 	indomp->it_set[i].i_inst = ep->id;
@@ -954,14 +1137,17 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
     /* 
      * harvest exited pids from the pid hash table
      */
+    if (seen == proc_pid->nentries)
+	return;
     for (i=0; i < proc_pid->pidhash.hsize; i++) {
 	for (prev=NULL, node=proc_pid->pidhash.hash[i]; node != NULL;) {
 	    next = node->next;
 	    ep = (proc_pid_entry_t *)node->data;
 	    // fprintf(stderr, "CHECKING key=%d node=" PRINTF_P_PFX "%p prev=" PRINTF_P_PFX "%p next=" PRINTF_P_PFX "%p ep=" PRINTF_P_PFX "%p valid=%d\n",
 	    	// ep->id, node, prev, node->next, ep, ep->valid);
-	    if (!(ep->flags & PROC_PID_FLAG_VALID)) {
+	    if (ep->gen != proc_pid->gen) {
 	        //fprintf(stderr, "DELETED key=%d name=\"%s\"\n", ep->id, ep->name);
+		proc_dirfd_close(ep);
 		if (ep->name != NULL)
 		    free(ep->name);
 		if (ep->stat_buf != NULL)
@@ -987,6 +1173,7 @@ refresh_proc_pidlist(proc_pid_t *proc_pid, proc_pid_list_t *pids)
 		    prev->next = node->next;
 		free(ep);
 		free(node);
+		proc_pid->nentries--;
 	    }
 	    else {
 	    	prev = node;
@@ -1055,6 +1242,8 @@ refresh_hotproc_pid(proc_pid_t *proc_pid, int threads, const char *cgroups)
 
     int sts;
 
+    hotproc_acquire();
+
     hotpids.count = 0;
     hotpids.threads = threads;
 
@@ -1069,6 +1258,73 @@ refresh_hotproc_pid(proc_pid_t *proc_pid, int threads, const char *cgroups)
 
 
 
+/*
+ * The /proc/<pid> (or /proc/<pid>/task/<pid>) directory of each pid is
+ * kept open in its entry while the pid exists, so that the per-pid files
+ * are opened with openat(2) relative to it rather than by a full path
+ * lookup each time.  A fetch visits every pid once for each cluster, so
+ * a cache holding fewer directories than there are pids would just cycle
+ * through them; instead one is kept for each pid, up to half of the open
+ * file limit.  Pids beyond that are never given one - their files are
+ * opened by path, exactly as without the cache.
+ */
+static int dirfd_max = -1;
+static int dirfd_count;
+
+static void
+proc_dirfd_close(proc_pid_entry_t *ep)
+{
+    if (ep->dirfd >= 0) {
+	close(ep->dirfd);
+	ep->dirfd = -1;
+	dirfd_count--;
+    }
+}
+
+static int
+proc_dirfd(proc_pid_entry_t *ep)
+{
+    struct rlimit rlim;
+    char buf[128];
+    int flags = O_RDONLY|O_DIRECTORY;
+    int fd = -1;
+
+    if (ep->dirfd >= 0) {
+	if (ep->dirtask == procpids.threads)
+	    return ep->dirfd;
+	proc_dirfd_close(ep);
+    }
+
+    if (dirfd_max < 0) {
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+	    dirfd_max = 0;
+	else if (rlim.rlim_cur == RLIM_INFINITY || rlim.rlim_cur / 2 > INT_MAX)
+	    dirfd_max = INT_MAX;
+	else
+	    dirfd_max = rlim.rlim_cur / 2;
+    }
+    if (dirfd_count >= dirfd_max)
+	return -1;
+
+#ifdef O_CLOEXEC
+    flags |= O_CLOEXEC;
+#endif
+    if (procpids.threads) {
+	sprintf(buf, "%s/proc/%d/task/%d", proc_statspath, ep->id, ep->id);
+	fd = open(buf, flags);
+    }
+    if (fd < 0) {
+	sprintf(buf, "%s/proc/%d", proc_statspath, ep->id);
+	fd = open(buf, flags);
+    }
+    if (fd >= 0) {
+	ep->dirfd = fd;
+	ep->dirtask = procpids.threads;
+	dirfd_count++;
+    }
+    return fd;
+}
+
 /*
  * Open a proc file, taking into account that we may want thread info
  * rather than process information.
@@ -1082,11 +1338,24 @@ static int
 proc_open(const char *base, proc_pid_entry_t *ep)
 {
     int fd;
+    int dfd;
     char buf[128];
 
+    if ((dfd = proc_dirfd(ep)) >= 0) {
+	if ((fd = openat(dfd, base, O_RDONLY)) >= 0)
+	    return fd;
+	/*
+	 * Either there is no such file, or the directory is stale (the
+	 * process exited, and the pid may have been reused) ... use the
+	 * path below, and if that works drop the stale directory.
+	 */
+    }
+
     if (procpids.threads) {
 	sprintf(buf, "%s/proc/%d/task/%d/%s", proc_statspath, ep->id, ep->id, base);
 	if ((fd = open(buf, O_RDONLY)) >= 0) {
+	    if (dfd >= 0)
+		proc_dirfd_close(ep);
 	    return fd;
 	}
 #if PCP_DEBUG
@@ -1109,6 +1378,8 @@ proc_open(const char *base, proc_pid_entry_t *ep)
 	}
     }
 #endif
+    if (fd >= 0 && dfd >= 0)
+	proc_dirfd_close(ep);
     return fd;
 }
 
@@ -1116,11 +1387,22 @@ static DIR *
 proc_opendir(const char *base, proc_pid_entry_t *ep)
 {
     DIR *dir;
+    int fd;
+    int dfd;
     char buf[128];
 
+    if ((dfd = proc_dirfd(ep)) >= 0 &&
+	(fd = openat(dfd, base, O_RDONLY|O_DIRECTORY)) >= 0) {
+	if ((dir = fdopendir(fd)) != NULL)
+	    return dir;
+	close(fd);
+    }
+
     if (procpids.threads) {
 	sprintf(buf, "%s/proc/%d/task/%d/%s", proc_statspath, ep->id, ep->id, base);
 	if ((dir = opendir(buf)) != NULL) {
+	    if (dfd >= 0)
+		proc_dirfd_close(ep);
 	    return dir;
 	}
 #if PCP_DEBUG
@@ -1143,6 +1425,8 @@ proc_opendir(const char *base, proc_pid_entry_t *ep)
 	}
     }
 #endif
+    if (dir != NULL && dfd >= 0)
+	proc_dirfd_close(ep);
     return dir;
 }
 
@@ -1162,6 +1446,72 @@ maperr(void)
     return sts;
 }
 
+/*
+ * Split /proc/<pid>/stat into fields in place, once per read, rather
+ * than scanning from the start of the buffer for each field fetched.
+ * The cmd field is "(cmd)" and cmd may contain spaces and parentheses,
+ * so it ends at the last ')'.
+ */
+static void
+proc_pid_stat_index(proc_pid_entry_t *ep)
+{
+    char	*p = ep->stat_buf;
+    char	*end;
+    int		n = 0;
+
+    if ((end = strchr(p, '(')) != NULL)
+	end = strrchr(end, ')');
+    while (n < NR_PROC_PID_STAT) {
+	while (isspace((int)*p))
+	    p++;
+	if (*p == '\0')
+	    break;
+	if (n == PROC_PID_STAT_CMD && *p == '(' && end != NULL && end > p) {
+	    ep->stat_field[n++] = p + 1 - ep->stat_buf;
+	    *end = '\0';
+	    p = end + 1;
+	    continue;
+	}
+	ep->stat_field[n++] = p - ep->stat_buf;
+	while (*p && !isspace((int)*p))
+	    p++;
+	if (*p)
+	    *p++ = '\0';
+    }
+    ep->stat_nfield = n;
+}
+
+char *
+proc_pid_stat_field(proc_pid_entry_t *ep, int field)
+{
+    static char	empty[] = "";
+
+    if (ep->stat_buf == NULL)
+	return NULL;
+    if (field < 0 || field >= ep->stat_nfield)
+	return empty;	/* as for _pm_getfield() past the end */
+    return &ep->stat_buf[ep->stat_field[field]];
+}
+
+__uint64_t
+proc_strtoull(const char *p)
+{
+    __uint64_t	value = 0;
+    int		negative = 0;
+
+    while (isspace((int)*p))
+	p++;
+    if (*p == '-') {
+	negative = 1;
+	p++;
+    }
+    else if (*p == '+')
+	p++;
+    while (*p >= '0' && *p <= '9')
+	value = value * 10 + (*p++ - '0');
+    return negative ? -value : value;
+}
+
 /*
  * fetch a proc/<pid>/stat entry for pid
  */
@@ -1198,6 +1548,7 @@ fetch_proc_pid_stat(int id, proc_pid_t *proc_pid, int *sts)
     if (!(ep->flags & PROC_PID_FLAG_STAT_FETCHED)) {
 	if (ep->stat_buflen > 0)
 	    ep->stat_buf[0] = '\0';
+	ep->stat_nfield = 0;
 	if ((fd = proc_open("stat", ep)) < 0)
 	    *sts = maperr();
 	else if ((n = read(fd, buf, sizeof(buf))) < 0) {
@@ -1228,6 +1579,7 @@ fetch_proc_pid_stat(int id, proc_pid_t *proc_pid, int *sts)
 		}
 		memcpy(ep->stat_buf, buf, n);
 		ep->stat_buf[n-1] = '\0';
+		proc_pid_stat_index(ep);
 	    }
 	}
 	if (fd >= 0)
@@ -243,10 +243,15 @@ typedef struct {
     int			id;	/* pid, hash key and internal instance id */
     int			flags;	/* combinations of PROC_PID_FLAG_* values */
     char		*name;	/* external instance name (<pid> cmdline) */
+    unsigned int	gen;	/* last pid list refresh that saw this pid */
+    int			dirfd;	/* open /proc/<pid> directory, else -1 */
+    int			dirtask; /* =1 dirfd is /proc/<pid>/task/<pid> */
 
     /* /proc/<pid>/stat cluster */
     int			stat_buflen;
     char		*stat_buf;
+    int			stat_nfield;	/* fields split out in stat_buf */
+    int			stat_field[NR_PROC_PID_STAT];
 
     /* /proc/<pid>/statm and /proc/<pid>/maps cluster */
     int			statm_buflen;
@@ -291,6 +296,8 @@ typedef struct {
 typedef struct {
     __pmHashCtl		pidhash;	/* hash table for current pids */
     pmdaIndom		*indom;		/* instance domain table */
+    unsigned int	gen;		/* pid list refresh generation */
+    int			nentries;	/* entries in pidhash */
 } proc_pid_t;
 
 typedef struct {
@@ -319,7 +326,11 @@ extern void reset_hotproc_timer(void);
 extern void disable_hotproc();
 
 /* init the hotproc data structures */
-extern void init_hotproc_pid(proc_pid_t *);
+extern void init_hotproc_pid(void);
+
+/* serialise hotproc configuration changes with the sampling threads */
+extern void hotproc_lock(void);
+extern void hotproc_unlock(void);
 
 /* fetch a proc/<pid>/stat entry for pid */
 extern proc_pid_entry_t *fetch_proc_pid_stat(int, proc_pid_t *, int *);
@@ -351,4 +362,10 @@ extern proc_pid_entry_t *fetch_proc_pid_label(int, proc_pid_t *, int *);
 /* extract the ith space separated field from a buffer */
 extern char *_pm_getfield(char *, int);
 
+/* the ith field of /proc/<pid>/stat, cmd without the parentheses */
+extern char *proc_pid_stat_field(proc_pid_entry_t *, int);
+
+/* decimal value of a /proc field, as strtoull(3) without the overheads */
+extern __uint64_t proc_strtoull(const char *);
+
 #endif /* _PROC_PID_H */
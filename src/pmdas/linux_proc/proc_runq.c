@@ -24,15 +24,16 @@
 #include "indom.h"
 
 int
-proc_runq_append(const char *process, proc_runq_t *proc_runq)
+proc_runq_append(int procfd, const char *process, proc_runq_t *proc_runq)
 {
     int fd, sname;
     ssize_t sz;
     char *p, buf[4096];
     static int unknown_count;
 
-    snprintf(buf, sizeof(buf), "%s/proc/%s/stat", proc_statspath, process);
-    if ((fd = open(buf, O_RDONLY)) < 0)
+    /* procfd is the open /proc directory being scanned by the caller */
+    snprintf(buf, sizeof(buf), "%s/stat", process);
+    if ((fd = openat(procfd, buf, O_RDONLY)) < 0)
 	return fd;
 
     sz = read(fd, buf, sizeof(buf));
@@ -26,6 +26,6 @@ typedef struct {
     int unknown;
 } proc_runq_t;
 
-extern int proc_runq_append(const char *, proc_runq_t *);
+extern int proc_runq_append(int, const char *, proc_runq_t *);
 
 #endif /* _PROC_RUNQ_H */
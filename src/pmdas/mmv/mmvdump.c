@@ -103,6 +103,9 @@ metrictype(int mtype)
     case MMV_TYPE_ELAPSED:
 	type = "elapsed";
 	break;
+    case MMV_TYPE_HISTOGRAM:
+	type = "histogram";
+	break;
     default:
 	type = "?";
 	break;
@@ -146,10 +149,10 @@ dump_metrics(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
     for (i = 0; i < count; i++) {
 	__uint64_t off = offset + i * sizeof(mmv_disk_metric_t);
 	printf("  [%u/%"PRIi64"] %s\n", m[i].item, off, m[i].name);
-	printf("       type=%s (0x%x), sem=%s (0x%x), pad=0x%x\n",
+	printf("       type=%s (0x%x), sem=%s (0x%x), seq=0x%x\n",
 		metrictype(m[i].type), m[i].type,
 		metricsem(m[i].semantics), m[i].semantics,
-		m[i].padding);
+		m[i].sequence);
 	printf("       units=%s\n", pmUnitsStr(&m[i].dimension));
 	if (m[i].indom != PM_INDOM_NULL && m[i].indom != 0)
 	    printf("       indom=%d\n", m[i].indom);
@@ -172,10 +175,47 @@ dump_metrics(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
     }
 }
 
+/* sum the shards of a sharded counter into the value */
+static pmAtomValue
+sum_shards(void *addr, mmv_disk_metric_t *m, mmv_disk_value_t *v)
+{
+    mmv_disk_shard_t * sh = (mmv_disk_shard_t *)((char *)addr + v->extra);
+    pmAtomValue sum;
+    int i;
+
+    memset(&sum, 0, sizeof(sum));
+    for (i = 0; i < MMV_SHARDS; i++) {
+	switch (m->type) {
+	case MMV_TYPE_I32:
+	    sum.l += sh[i].value.l;
+	    break;
+	case MMV_TYPE_U32:
+	    sum.ul += sh[i].value.ul;
+	    break;
+	case MMV_TYPE_I64:
+	    sum.ll += sh[i].value.ll;
+	    break;
+	case MMV_TYPE_U64:
+	    sum.ull += sh[i].value.ull;
+	    break;
+	case MMV_TYPE_FLOAT:
+	    sum.f += sh[i].value.f;
+	    break;
+	case MMV_TYPE_DOUBLE:
+	    sum.d += sh[i].value.d;
+	    break;
+	default:
+	    break;
+	}
+    }
+    return sum;
+}
+
 void
 dump_values(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
 {
     int i;
+    int version = ((mmv_disk_header_t *)addr)->version;
     mmv_disk_value_t * vals = (mmv_disk_value_t *)
 			((char *)addr + offset);
 
@@ -186,6 +226,7 @@ dump_values(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
 	mmv_disk_string_t * string;
 	mmv_disk_metric_t * m = (mmv_disk_metric_t *)
 				((char *)addr + vals[i].metric);
+	pmAtomValue value;
 	__uint64_t off = offset + i * sizeof(mmv_disk_value_t);
 
 	printf("  [%u/%"PRIu64"] %s", m->item, off, m->name);
@@ -196,24 +237,32 @@ dump_values(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
 		    indom->internal, indom->external);
 	}
 
+	if (version >= 2 && vals[i].extra && m->type != MMV_TYPE_STRING &&
+	    m->type != MMV_TYPE_ELAPSED && m->type != MMV_TYPE_HISTOGRAM) {
+	    printf(" (shards at %"PRIi64")", vals[i].extra);
+	    value = sum_shards(addr, m, &vals[i]);
+	}
+	else
+	    value = vals[i].value;
+
 	switch (m->type) {
 	case MMV_TYPE_I32:
-	    printf(" = %d", vals[i].value.l);
+	    printf(" = %d", value.l);
 	    break;
 	case MMV_TYPE_U32:
-	    printf(" = %u", vals[i].value.ul);
+	    printf(" = %u", value.ul);
 	    break;
 	case MMV_TYPE_I64:
-	    printf(" = %" PRIi64, vals[i].value.ll);
+	    printf(" = %" PRIi64, value.ll);
 	    break;
 	case MMV_TYPE_U64:
-	    printf(" = %" PRIu64, vals[i].value.ull);
+	    printf(" = %" PRIu64, value.ull);
 	    break;
 	case MMV_TYPE_FLOAT:
-	    printf(" = %f", vals[i].value.f);
+	    printf(" = %f", value.f);
 	    break;
 	case MMV_TYPE_DOUBLE:
-	    printf(" = %lf", vals[i].value.d);
+	    printf(" = %lf", value.d);
 	    break;
 	case MMV_TYPE_STRING:
 	    string = (mmv_disk_string_t *)((char *)addr + vals[i].extra);
@@ -233,6 +282,14 @@ dump_values(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
 		printf("Bad ELAPSED 'extra' value found!");
 	    break;
 	}
+	case MMV_TYPE_HISTOGRAM: {
+	    mmv_disk_histogram_t *h = (mmv_disk_histogram_t *)
+				((char *)addr + vals[i].extra);
+
+	    printf(" = count %"PRIu64", sum %"PRIu64" (histogram at %"PRIi64")",
+			h->count, h->sum, vals[i].extra);
+	    break;
+	}
 	default:
 	    printf("Unknown type %d", m->type);
 	}
@@ -240,6 +297,38 @@ dump_values(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
     }
 }
 
+void
+dump_shards(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
+{
+    printf("\nTOC[%d]: offset %ld, shards offset %"PRIu64" (%d entries, %d per value)\n",
+		idx, base, offset, count, MMV_SHARDS);
+}
+
+void
+dump_histograms(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
+{
+    int i, b;
+    mmv_disk_histogram_t * h = (mmv_disk_histogram_t *)
+			((char *)addr + offset);
+
+    printf("\nTOC[%d]: offset %ld, histograms offset %"PRIu64" (%d entries)\n",
+		idx, base, offset, count);
+
+    for (i = 0; i < count; i++) {
+	printf("  [%u/%"PRIu64"] count=%"PRIu64" sum=%"PRIu64"\n",
+		i+1, offset + i * sizeof(mmv_disk_histogram_t),
+		h[i].count, h[i].sum);
+	for (b = 0; b < MMV_HIST_BUCKETS; b++) {
+	    if (h[i].buckets[b] == 0)
+		continue;
+	    printf("       [%"PRIu64"-%"PRIu64"] %"PRIu64"\n",
+		(__uint64_t)MMV_HIST_LOWER(b),
+		(__uint64_t)(MMV_HIST_LOWER(b) + MMV_HIST_WIDTH(b) - 1),
+		h[i].buckets[b]);
+	}
+    }
+}
+
 void
 dump_strings(void *addr, int idx, long base, __uint64_t offset, __int32_t count)
 {
@@ -270,7 +359,7 @@ dump(const char *file, void *addr)
 		hdr->magic[0], hdr->magic[1], hdr->magic[2]);
 	return 1;
     }
-    if (hdr->version != MMV_VERSION) {
+    if (hdr->version < 1 || hdr->version > MMV_VERSION) {
 	printf("version %d not supported\n", hdr->version);
 	return 1;
     }
@@ -306,6 +395,12 @@ dump(const char *file, void *addr)
 	case MMV_TOC_STRINGS:
 	    dump_strings(addr, i, base, toc[i].offset, toc[i].count);
 	    break;
+	case MMV_TOC_SHARDS:
+	    dump_shards(addr, i, base, toc[i].offset, toc[i].count);
+	    break;
+	case MMV_TOC_HISTOGRAMS:
+	    dump_histograms(addr, i, base, toc[i].offset, toc[i].count);
+	    break;
 	default:
 	    printf("Unrecognised TOC[%d] type: 0x%x\n", i, toc[i].type);
 	}
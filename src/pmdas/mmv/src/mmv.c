@@ -67,6 +67,32 @@ static char * pcppmdasdir;		/* probably /var/pcp/pmdas */
 static char pmnsdir[MAXPATHLEN];	/* pcpvardir/pmns */
 static char statsdir[MAXPATHLEN];	/* pcptmpdir/<prefix> */
 
+/*
+ * Each histogram value (version 3) is exported as several metrics, named
+ * by suffixing the histogram's name.  The count keeps the histogram's own
+ * PMID, the others are given item numbers unused by the client.
+ */
+enum { HIST_COUNT, HIST_SUM, HIST_BUCKET, HIST_P50, HIST_P90, HIST_P99,
+       HIST_P999, NHIST };
+
+static const struct {
+    char *	suffix;
+    double	quantile;
+} histmetrics[NHIST] = {
+    { "count" }, { "sum" }, { "bucket" },
+    { "p50", 0.5 }, { "p90", 0.9 }, { "p99", 0.99 }, { "p999", 0.999 },
+};
+
+typedef struct {
+    pmID	pmid;			/* derived metric identifier */
+    int		kind;			/* HIST_COUNT ... HIST_P999 */
+    mmv_disk_metric_t * m;		/* histogram metric desc in mmap */
+    int		si;			/* owning stats file, index in slist */
+    mmv_disk_instance_t * insts;	/* instances of its indom, if any */
+    int		ninsts;			/* number of instances */
+    char *	names;			/* bucket instance names (HIST_BUCKET) */
+} hist_t;
+
 typedef struct {
     char *	name;			/* strdup client name */
     void *	addr;			/* mmap */
@@ -76,8 +102,14 @@ typedef struct {
     int		mcnt;			/* number of metrics */
     pid_t	pid;			/* process identifier */
     int		cluster;		/* cluster identifier */
+    int		version;		/* MMV file format version */
     __int64_t	len;			/* mmap region len */
     __uint64_t	gen;			/* generation number on open */
+    __pmHashCtl	mindex;			/* item -> metric desc */
+    __pmHashCtl	vindex;			/* item,inst -> value */
+    mmv_disk_value_t ** first;		/* first value of each metric */
+    hist_t *	hists;			/* histogram derived metrics */
+    int		hcnt;			/* number of derived metrics */
 } stats_t;
 
 static stats_t * slist;
@@ -137,7 +169,7 @@ create_client_stat(const char *client, const char *path, size_t size)
 		return -EINVAL;
 	    }
 
-	    if (hdr->version != MMV_VERSION) {
+	    if (hdr->version < 1 || hdr->version > MMV_VERSION) {
 		__pmNotifyErr(LOG_ERR, "%s: %s client version %d "
 				"not supported (current is %d)",
 				pmProgname, prefix, hdr->version, MMV_VERSION);
@@ -170,8 +202,17 @@ create_client_stat(const char *client, const char *path, size_t size)
 		slist[scnt].addr = m;
 		slist[scnt].pid = (pid_t)((hdr->flags & MMV_FLAG_PROCESS)? hdr->process : 0);
 		slist[scnt].cluster = cluster;
+		slist[scnt].version = hdr->version;
+		slist[scnt].metrics = NULL;
+		slist[scnt].values = NULL;
 		slist[scnt].mcnt = 0;
+		slist[scnt].vcnt = 0;
 		slist[scnt].gen = hdr->g1;
+		__pmHashInit(&slist[scnt].mindex);
+		__pmHashInit(&slist[scnt].vindex);
+		slist[scnt].first = NULL;
+		slist[scnt].hists = NULL;
+		slist[scnt].hcnt = 0;
 		slist[scnt].len = size;
 		scnt++;
 	    } else {
@@ -313,7 +354,7 @@ update_indom(pmdaExt *pmda, stats_t *s, mmv_disk_indom_t *id, pmdaIndom *ip)
     for (i = 0; i < id->count; i++) {
 	for (j = 0; j < ip->it_numinst; j++)
 	    if (ip->it_set[j].i_inst == in[i].internal)
-		continue;
+		break;
 	if (j == ip->it_numinst)
 	    newinsts++;
     }
@@ -327,8 +368,8 @@ update_indom(pmdaExt *pmda, stats_t *s, mmv_disk_indom_t *id, pmdaIndom *ip)
     if (ip->it_set != NULL) {
 	for (i = 0; i < id->count; i++) {
 	    for (j = 0; j < ip->it_numinst; j++)
-		if (ip->it_set[j].i_inst == in[j].internal)
-		    continue;
+		if (ip->it_set[j].i_inst == in[i].internal)
+		    break;
 	    if (j == ip->it_numinst) {
 		ip->it_set[j].i_inst = in[i].internal;
 		ip->it_set[j].i_name = in[i].external;
@@ -379,6 +420,379 @@ create_indom(pmdaExt *pmda, stats_t *s, mmv_disk_indom_t *id, pmInDom indom)
     return 0;
 }
 
+/*
+ * Index the values of a stats file by (item,instance), so each fetched
+ * value is found without scanning every metric and value in the file.
+ * Built as each file is mapped, so a change of generation number (which
+ * forces a reload) also rebuilds it.
+ */
+static unsigned int
+value_key(unsigned int item, unsigned int inst)
+{
+    return item ^ (inst * 2654435761U);
+}
+
+static __pmHashWalkState
+free_index_node(const __pmHashNode *hp, void *cdata)
+{
+    (void)hp;
+    (void)cdata;
+    return PM_HASH_WALK_DELETE_NEXT;
+}
+
+static void
+free_index(stats_t *s)
+{
+    __pmHashWalkCB(free_index_node, NULL, &s->mindex);
+    __pmHashClear(&s->mindex);
+    __pmHashInit(&s->mindex);
+    __pmHashWalkCB(free_index_node, NULL, &s->vindex);
+    __pmHashClear(&s->vindex);
+    __pmHashInit(&s->vindex);
+    free(s->first);
+    s->first = NULL;
+}
+
+static mmv_disk_metric_t *
+index_metric(stats_t *s, unsigned int item)
+{
+    __pmHashNode *hp;
+
+    for (hp = __pmHashSearch(item, &s->mindex); hp != NULL; hp = hp->next) {
+	if (hp->key == item)
+	    return (mmv_disk_metric_t *)hp->data;
+    }
+    return NULL;
+}
+
+static mmv_disk_value_t *
+index_value(stats_t *s, mmv_disk_metric_t *m, unsigned int inst)
+{
+    unsigned int key = value_key(m->item, inst);
+    __pmHashNode *hp;
+
+    for (hp = __pmHashSearch(key, &s->vindex); hp != NULL; hp = hp->next) {
+	mmv_disk_value_t *v = (mmv_disk_value_t *)hp->data;
+	mmv_disk_instance_t *is = (mmv_disk_instance_t *)
+			((char *)s->addr + v->instance);
+
+	if (hp->key == key && (char *)s->addr + v->metric == (char *)m &&
+	    is->internal == inst)
+	    return v;
+    }
+    return NULL;
+}
+
+static int
+index_stats(stats_t *s)
+{
+    mmv_disk_metric_t * m;
+    mmv_disk_value_t * v;
+    __uint64_t moff, off;
+    int mi, vi, sts;
+
+    if (s->mcnt == 0)
+	return 0;
+    if ((s->first = calloc(s->mcnt, sizeof(mmv_disk_value_t *))) == NULL)
+	return -ENOMEM;
+
+    /* first metric with each item number wins, as for a linear search */
+    for (mi = 0; mi < s->mcnt; mi++) {
+	m = &s->metrics[mi];
+	if (index_metric(s, m->item) != NULL)
+	    continue;
+	if ((sts = __pmHashAdd(m->item, m, &s->mindex)) < 0)
+	    return sts;
+    }
+
+    moff = (__uint64_t)((char *)s->metrics - (char *)s->addr);
+    for (vi = 0; vi < s->vcnt; vi++) {
+	v = &s->values[vi];
+	off = v->metric - moff;
+	if (v->metric < moff || off % sizeof(*m) != 0 ||
+	    off / sizeof(*m) >= s->mcnt)
+	    continue;	/* not a metric descriptor */
+	mi = off / sizeof(*m);
+	m = &s->metrics[mi];
+	if (s->first[mi] == NULL)
+	    s->first[mi] = v;
+	if (m->indom == PM_INDOM_NULL || m->indom == 0)
+	    continue;
+	if (v->instance + sizeof(mmv_disk_instance_t) > s->len)
+	    continue;
+	if (index_value(s, m, ((mmv_disk_instance_t *)
+			((char *)s->addr + v->instance))->internal) != NULL)
+	    continue;
+	if ((sts = __pmHashAdd(value_key(m->item, ((mmv_disk_instance_t *)
+			((char *)s->addr + v->instance))->internal),
+			v, &s->vindex)) < 0)
+	    return sts;
+    }
+    return 0;
+}
+
+static void
+free_hists(stats_t *s)
+{
+    int i;
+
+    for (i = 0; i < s->hcnt; i++)
+	free(s->hists[i].names);
+    free(s->hists);
+    s->hists = NULL;
+    s->hcnt = 0;
+}
+
+static mmv_disk_indom_t *
+lookup_disk_indom(stats_t *s, __int32_t serial)
+{
+    mmv_disk_header_t * hdr = (mmv_disk_header_t *)s->addr;
+    mmv_disk_toc_t * toc = (mmv_disk_toc_t *)
+			((char *)s->addr + sizeof(mmv_disk_header_t));
+    mmv_disk_indom_t * id;
+    int i, j;
+
+    for (i = 0; i < hdr->tocs; i++) {
+	if (toc[i].type != MMV_TOC_INDOMS)
+	    continue;
+	id = (mmv_disk_indom_t *)((char *)s->addr + toc[i].offset);
+	for (j = 0; j < toc[i].count; j++)
+	    if (id[j].serial == serial)
+		return &id[j];
+    }
+    return NULL;
+}
+
+/*
+ * The bucket metric has an indom of its own, with an instance for each
+ * bucket of each instance of the histogram, named by the largest value
+ * counted in the bucket (prefixed by the histogram's instance name).
+ */
+static int
+create_bucket_indom(pmdaExt *pmda, stats_t *s, hist_t *h, pmInDom indom)
+{
+    int i, b, n, len, size = 0;
+    pmdaInstid *set;
+    pmdaIndom *ip;
+    char *p;
+
+    n = (h->insts ? h->ninsts : 1) * MMV_HIST_BUCKETS;
+    for (i = 0; i < n; i += MMV_HIST_BUCKETS) {
+	for (b = 0; b < MMV_HIST_BUCKETS; b++) {
+	    __uint64_t upper = MMV_HIST_LOWER(b) + MMV_HIST_WIDTH(b) - 1;
+	    if (h->insts)
+		size += snprintf(NULL, 0, "%s::%llu",
+			h->insts[i / MMV_HIST_BUCKETS].external,
+			(unsigned long long)upper) + 1;
+	    else
+		size += snprintf(NULL, 0, "%llu", (unsigned long long)upper) + 1;
+	}
+    }
+
+    if ((h->names = malloc(size)) == NULL ||
+	(set = calloc(n, sizeof(pmdaInstid))) == NULL) {
+	__pmNotifyErr(LOG_ERR, "%s: cannot get memory for instance list in %s",
+			pmProgname, s->name);
+	free(h->names);
+	h->names = NULL;
+	return -ENOMEM;
+    }
+    if ((ip = realloc(indoms, sizeof(pmdaIndom) * (incnt + 1))) == NULL) {
+	__pmNotifyErr(LOG_ERR, "%s: cannot grow indom list in %s",
+			pmProgname, s->name);
+	free(h->names);
+	h->names = NULL;
+	free(set);
+	return -ENOMEM;
+    }
+    indoms = ip;
+    ip = &indoms[incnt++];
+    ip->it_indom = indom;
+    ip->it_numinst = n;
+    ip->it_set = set;
+
+    for (i = 0, p = h->names; i < n; i++) {
+	b = i % MMV_HIST_BUCKETS;
+	if (h->insts)
+	    len = sprintf(p, "%s::%llu", h->insts[i / MMV_HIST_BUCKETS].external,
+		(unsigned long long)(MMV_HIST_LOWER(b) + MMV_HIST_WIDTH(b) - 1));
+	else
+	    len = sprintf(p, "%llu",
+		(unsigned long long)(MMV_HIST_LOWER(b) + MMV_HIST_WIDTH(b) - 1));
+	set[i].i_inst = i;
+	set[i].i_name = p;
+	p += len + 1;
+    }
+    return 0;
+}
+
+static int
+create_hist_metric(pmdaExt *pmda, stats_t *s, hist_t *h, char *name,
+	pmID pmid, pmInDom indom)
+{
+    pmdaMetric *mp;
+
+    if (pmDebug & DBG_TRACE_APPL0)
+	__pmNotifyErr(LOG_DEBUG, "MMV: create_hist_metric: %s - %s",
+			name, pmIDStr(pmid));
+
+    if ((mp = realloc(metrics, sizeof(pmdaMetric) * (mcnt + 1))) == NULL) {
+	__pmNotifyErr(LOG_ERR, "cannot grow MMV metric list: %s", s->name);
+	return -ENOMEM;
+    }
+    metrics = mp;
+    mp = &metrics[mcnt];
+    mp->m_user = h;
+    mp->m_desc.pmid = pmid;
+    mp->m_desc.indom = indom;
+    switch (h->kind) {
+	case HIST_COUNT:
+	case HIST_BUCKET: {
+	    pmUnits count = PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE);
+	    mp->m_desc.type = PM_TYPE_U64;
+	    mp->m_desc.sem = PM_SEM_COUNTER;
+	    mp->m_desc.units = count;
+	    break;
+	}
+	case HIST_SUM:
+	    mp->m_desc.type = PM_TYPE_U64;
+	    mp->m_desc.sem = PM_SEM_COUNTER;
+	    mp->m_desc.units = h->m->dimension;
+	    break;
+	default:
+	    mp->m_desc.type = PM_TYPE_DOUBLE;
+	    mp->m_desc.sem = PM_SEM_INSTANT;
+	    mp->m_desc.units = h->m->dimension;
+	    break;
+    }
+
+    mcnt++;
+    __pmAddPMNSNode(pmns, pmid, name);
+    return 0;
+}
+
+/*
+ * Is an item number in use on a cluster, by a metric or by a metric
+ * derived from a histogram?  Clusters may be shared between files.
+ */
+static int
+cluster_item_used(int cluster, unsigned int item)
+{
+    stats_t * s;
+    int si, hi;
+
+    for (si = 0; si < scnt; si++) {
+	s = &slist[si];
+	if (s->cluster != cluster)
+	    continue;
+	if (index_metric(s, item) != NULL)
+	    return 1;
+	for (hi = 0; hi < s->hcnt; hi++)
+	    if (pmid_item(s->hists[hi].pmid) == item)
+		return 1;
+    }
+    return 0;
+}
+
+/* export the metrics derived from each histogram in a stats file */
+static void
+create_histograms(pmdaExt *pmda, int si)
+{
+    stats_t * s = &slist[si];
+    mmv_disk_header_t * hdr = (mmv_disk_header_t *)s->addr;
+    mmv_disk_indom_t * id;
+    mmv_disk_metric_t * m;
+    pmInDom indom, bucketindom;
+    pmdaIndom * ip;
+    hist_t * h;
+    char name[MAXPATHLEN + 16];
+    char base[MAXPATHLEN];
+    int item = (1 << 10) - 1;	/* derived items, from the top down */
+    int serial = (1 << 11) - 1;	/* bucket indoms, from the top down */
+    int items[NHIST];
+    int mi, k, n = 0;
+
+    for (mi = 0; mi < s->mcnt; mi++)
+	if (s->metrics[mi].type == MMV_TYPE_HISTOGRAM)
+	    n++;
+    if (n == 0)
+	return;
+    if ((s->hists = calloc(n * NHIST, sizeof(hist_t))) == NULL) {
+	__pmNotifyErr(LOG_ERR, "%s: cannot get memory for histograms in %s",
+			pmProgname, s->name);
+	return;
+    }
+
+    for (mi = 0; mi < s->mcnt; mi++) {
+	m = &s->metrics[mi];
+	if (m->type != MMV_TYPE_HISTOGRAM)
+	    continue;
+
+	if (hdr->flags & MMV_FLAG_NOPREFIX)
+	    snprintf(base, sizeof(base), "%s.%s", prefix, m->name);
+	else
+	    snprintf(base, sizeof(base), "%s.%s.%s", prefix, s->name, m->name);
+	if (verify_metric_item(m->item, base, s) != 0)
+	    continue;
+	for (k = 0; k < NHIST; k++) {
+	    snprintf(name, sizeof(name), "%s.%s", base, histmetrics[k].suffix);
+	    if (verify_metric_name(name, mi, s) != 0)
+		break;
+	}
+	if (k < NHIST)
+	    continue;
+
+	h = &s->hists[s->hcnt];
+	h->m = m;
+	h->si = si;
+	if (m->indom == PM_INDOM_NULL || m->indom == 0) {
+	    indom = PM_INDOM_NULL;
+	} else if ((id = lookup_disk_indom(s, m->indom)) != NULL &&
+		   id->offset + id->count * sizeof(mmv_disk_instance_t) <= s->len) {
+	    indom = pmInDom_build(pmda->e_domain, (s->cluster << 11) | m->indom);
+	    h->insts = (mmv_disk_instance_t *)((char *)s->addr + id->offset);
+	    h->ninsts = id->count;
+	} else {
+	    __pmNotifyErr(LOG_WARNING, "invalid indom %d for %s in %s, ignored",
+			    m->indom, base, s->name);
+	    continue;
+	}
+
+	/* next serial unused by any indom in this file */
+	while (serial > 0 && verify_indom_serial(pmda, serial, s,
+					&bucketindom, &ip) == -EEXIST)
+	    serial--;
+	/* and item numbers unused by any metric on this cluster */
+	items[HIST_COUNT] = m->item;
+	for (k = 1; k < NHIST; k++) {
+	    while (item >= 0 && cluster_item_used(s->cluster, item))
+		item--;
+	    items[k] = item--;
+	}
+	if (serial <= 0 || items[NHIST-1] < 0) {
+	    __pmNotifyErr(LOG_WARNING, "no identifiers left for histogram %s "
+			    "in %s, ignored", base, s->name);
+	    return;
+	}
+
+	for (k = 0; k < NHIST; k++) {
+	    h[k] = h[0];
+	    h[k].kind = k;
+	    h[k].pmid = pmid_build(pmda->e_domain, s->cluster, items[k]);
+	}
+	if (create_bucket_indom(pmda, s, &h[HIST_BUCKET], bucketindom) < 0)
+	    return;
+	s->hcnt += NHIST;
+
+	for (k = 0; k < NHIST; k++) {
+	    snprintf(name, sizeof(name), "%s.%s", base, histmetrics[k].suffix);
+	    if (create_hist_metric(pmda, s, &h[k], name, h[k].pmid,
+			k == HIST_BUCKET ? bucketindom : indom) < 0)
+		return;
+	}
+    }
+}
+
 static void
 map_stats(pmdaExt *pmda)
 {
@@ -417,6 +831,8 @@ map_stats(pmdaExt *pmda)
     if (slist != NULL) {
 	for (i = 0; i < scnt; i++) {
 	    free(slist[i].name);
+	    free_index(&slist[i]);
+	    free_hists(&slist[i]);
 	    __pmMemoryUnmap(slist[i].addr, slist[i].len);
 	}
 	free(slist);
@@ -465,6 +881,10 @@ map_stats(pmdaExt *pmda)
 			char name[MAXPATHLEN];
 			pmID pmid;
 
+			/* exported once indexed, see create_histograms() */
+			if (ml[k].type == MMV_TYPE_HISTOGRAM)
+			    continue;
+
 			/* build name, check its legitimate and unique */
 			if (hdr->flags & MMV_FLAG_NOPREFIX)
 			    sprintf(name, "%s.", prefix);
@@ -515,8 +935,19 @@ map_stats(pmdaExt *pmda)
 		    break;
 	    }
 	}
+
+	if ((sts = index_stats(s)) < 0) {
+	    __pmNotifyErr(LOG_ERR, "%s: cannot index values in %s: %s",
+			    pmProgname, s->name, pmErrStr(sts));
+	    free_index(s);
+	}
     }
 
+    /* once every file is indexed, so derived items avoid all their items */
+    for (i = 0; i < scnt; i++)
+	if (slist[i].version >= 3 && slist[i].first != NULL)
+	    create_histograms(pmda, i);
+
     pmdaTreeRebuildHash(pmns, mcnt);	/* for reverse (pmid->name) lookups */
     reload = need_reload;
 }
@@ -529,41 +960,198 @@ mmv_lookup_stat_metric_value(pmID pmid, unsigned int inst,
     mmv_disk_metric_t * m;
     mmv_disk_value_t * v;
     stats_t * s;
-    int si, mi, vi;
-    int sts = PM_ERR_PMID;
+    int si, sts = PM_ERR_PMID;
 
+    /* a later file may share the cluster, so keep looking for a value */
     for (si = 0; si < scnt; si++) {
 	s = &slist[si];
 	if (s->cluster != id->cluster)
 	    continue;
+	if ((m = index_metric(s, id->item)) == NULL)
+	    continue;
 
-	m = s->metrics;
-	for (mi = 0; mi < s->mcnt; mi++) {
-	    if (m[mi].item != id->item)
-		continue;
-
+	if (m->indom == PM_INDOM_NULL || m->indom == 0 || inst == PM_IN_NULL)
+	    v = s->first[m - s->metrics];
+	else
+	    v = index_value(s, m, inst);
+	if (v == NULL) {
 	    sts = PM_ERR_INST;
-	    v = s->values;
-	    for (vi = 0; vi < s->vcnt; vi++) {
-		mmv_disk_metric_t * mt = (mmv_disk_metric_t *)
-			((char *)s->addr + v[vi].metric);
-		mmv_disk_instance_t * is = (mmv_disk_instance_t *)
-			((char *)s->addr + v[vi].instance);
-
-		if ((mt == &m[mi]) &&
-		    (mt->indom == PM_INDOM_NULL || mt->indom == 0 ||
-		     inst == PM_IN_NULL || is->internal == inst)) {
-		    *sout = s;
-		    *mout = &m[mi];
-		    *vout = &v[vi];
-		    return 0;
-		}
-	    }
+	    continue;
 	}
+	*sout = s;
+	*mout = m;
+	*vout = v;
+	return 0;
     }
     return sts;
 }
 
+/* find the histogram a derived metric is exported from, and its file */
+static mmv_disk_metric_t *
+mmv_lookup_hist_metric(pmID pmid, stats_t **sout)
+{
+    __pmID_int * id = (__pmID_int *)&pmid;
+    stats_t * s;
+    int si, hi;
+
+    for (si = 0; si < scnt; si++) {
+	s = &slist[si];
+	if (s->cluster != id->cluster)
+	    continue;
+	for (hi = 0; hi < s->hcnt; hi++) {
+	    if (s->hists[hi].pmid == pmid) {
+		*sout = &slist[s->hists[hi].si];
+		return s->hists[hi].m;
+	    }
+	}
+    }
+    return NULL;
+}
+
+/* sum the per-thread shards of a counter value (version 2) */
+static int
+sum_shards(stats_t *s, mmv_disk_metric_t *m, mmv_disk_value_t *v,
+	pmAtomValue *atom)
+{
+    mmv_disk_shard_t * sh;
+    pmAtomValue a;
+    int i;
+
+    if (v->extra < 0 ||
+	v->extra + MMV_SHARDS * sizeof(mmv_disk_shard_t) > s->len)
+	return PM_ERR_VALUE;
+    sh = (mmv_disk_shard_t *)((char *)s->addr + v->extra);
+
+    memset(atom, 0, sizeof(pmAtomValue));
+    for (i = 0; i < MMV_SHARDS; i++) {
+	__atomic_load(&sh[i].value.ull, &a.ull, __ATOMIC_RELAXED);
+	switch (m->type) {
+	    case MMV_TYPE_I32:
+		atom->l += a.l;
+		break;
+	    case MMV_TYPE_U32:
+		atom->ul += a.ul;
+		break;
+	    case MMV_TYPE_I64:
+		atom->ll += a.ll;
+		break;
+	    case MMV_TYPE_U64:
+		atom->ull += a.ull;
+		break;
+	    case MMV_TYPE_FLOAT:
+		atom->f += a.f;
+		break;
+	    case MMV_TYPE_DOUBLE:
+		atom->d += a.d;
+		break;
+	    default:
+		return PM_ERR_TYPE;
+	}
+    }
+    return 0;
+}
+
+/*
+ * Strings and elapsed times are written under a seqlock in the metric
+ * desc (odd while a write is in progress).  Retry a read that overlaps
+ * a write, but not forever - the writer may have died mid-update.
+ */
+#define SEQ_RETRIES	1000
+
+static __uint32_t
+read_begin(mmv_disk_metric_t *m)
+{
+    return __atomic_load_n(&m->sequence, __ATOMIC_ACQUIRE);
+}
+
+static int
+read_retry(mmv_disk_metric_t *m, __uint32_t seq, int tries)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (tries >= SEQ_RETRIES)
+	return 0;
+    return (seq & 1) || __atomic_load_n(&m->sequence, __ATOMIC_RELAXED) != seq;
+}
+
+/*
+ * Histograms are updated without locking, so a fetch reads each bucket
+ * once, and computes a percentile from its own copy of the buckets by
+ * interpolating within the bucket holding it.  No value while empty.
+ */
+static int
+hist_percentile(mmv_disk_histogram_t *hp, double quantile, pmAtomValue *atom)
+{
+    __uint64_t counts[MMV_HIST_BUCKETS];
+    double total = 0, seen = 0, rank;
+    int b;
+
+    for (b = 0; b < MMV_HIST_BUCKETS; b++) {
+	counts[b] = __atomic_load_n(&hp->buckets[b], __ATOMIC_RELAXED);
+	total += counts[b];
+    }
+    if (total == 0)
+	return 0;
+    if ((rank = quantile * total) < 1)
+	rank = 1;
+
+    for (b = 0; b < MMV_HIST_BUCKETS - 1; b++) {
+	if (counts[b] && seen + counts[b] >= rank)
+	    break;
+	seen += counts[b];
+    }
+    atom->d = MMV_HIST_LOWER(b) + (double)(MMV_HIST_WIDTH(b) - 1) *
+		(counts[b] ? (rank - seen) / counts[b] : 1);
+    return 1;
+}
+
+static int
+hist_fetch(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
+{
+    hist_t * h = (hist_t *)mdesc->m_user;
+    mmv_disk_histogram_t * hp;
+    mmv_disk_value_t * v;
+    stats_t * s;
+    int bucket = 0;
+
+    /* the file the histogram is in, not just one on the same cluster */
+    if (h->si >= scnt || (s = &slist[h->si])->first == NULL)
+	return PM_ERR_PMID;
+
+    if (h->kind == HIST_BUCKET) {
+	bucket = inst % MMV_HIST_BUCKETS;
+	inst /= MMV_HIST_BUCKETS;
+	if (h->insts == NULL)
+	    v = inst ? NULL : s->first[h->m - s->metrics];
+	else
+	    v = inst < h->ninsts ?
+		index_value(s, h->m, h->insts[inst].internal) : NULL;
+    } else if (h->insts == NULL || inst == PM_IN_NULL) {
+	v = s->first[h->m - s->metrics];
+    } else {
+	v = index_value(s, h->m, inst);
+    }
+    if (v == NULL)
+	return PM_ERR_INST;
+    if (v->extra <= 0 || v->extra + sizeof(mmv_disk_histogram_t) > s->len)
+	return PM_ERR_VALUE;
+    hp = (mmv_disk_histogram_t *)((char *)s->addr + v->extra);
+
+    switch (h->kind) {
+	case HIST_COUNT:
+	    atom->ull = __atomic_load_n(&hp->count, __ATOMIC_RELAXED);
+	    break;
+	case HIST_SUM:
+	    atom->ull = __atomic_load_n(&hp->sum, __ATOMIC_RELAXED);
+	    break;
+	case HIST_BUCKET:
+	    atom->ull = __atomic_load_n(&hp->buckets[bucket], __ATOMIC_RELAXED);
+	    return atom->ull != 0;	/* only buckets in use */
+	default:
+	    return hist_percentile(hp, histmetrics[h->kind].quantile, atom);
+    }
+    return 1;
+}
+
 /*
  * callback provided to pmdaFetch
  */
@@ -580,11 +1168,17 @@ mmv_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	return PM_ERR_PMID;
 
     } else if (scnt > 0) {	/* We have at least one source of metrics */
+	static char buffer[MMV_STRINGMAX];
 	mmv_disk_string_t * str;
 	mmv_disk_metric_t * m;
 	mmv_disk_value_t * v;
 	stats_t * s;
-	int rv;
+	__uint32_t seq;
+	__int64_t extra;
+	int rv, tries;
+
+	if (mdesc->m_user != NULL)	/* derived from a histogram */
+	    return hist_fetch(mdesc, inst, atom);
 
 	rv = mmv_lookup_stat_metric_value(mdesc->m_desc.pmid, inst, &s, &m, &v);
 	if (rv < 0)
@@ -597,22 +1191,36 @@ mmv_fetchCallBack(pmdaMetric *mdesc, unsigned int inst, pmAtomValue *atom)
 	    case MMV_TYPE_U64:
 	    case MMV_TYPE_FLOAT:
 	    case MMV_TYPE_DOUBLE:
+		if (s->version >= 2 && v->extra)
+		    return (rv = sum_shards(s, m, v, atom)) < 0 ? rv : 1;
 		memcpy(atom, &v->value, sizeof(pmAtomValue));
 		break;
 	    case MMV_TYPE_ELAPSED: {
-		atom->ll = v->value.ll;
-		if (v->extra < 0) {	/* inside a timed section */
+		tries = 0;
+		do {
+		    seq = read_begin(m);
+		    atom->ll = v->value.ll;
+		    extra = v->extra;
+		} while (read_retry(m, seq, tries++));
+		if (extra < 0) {	/* inside a timed section */
 		    struct timeval tv; 
 		    __pmtimevalNow(&tv); 
-		    atom->ll += (tv.tv_sec * 1e6 + tv.tv_usec) + v->extra;
+		    atom->ll += (tv.tv_sec * 1e6 + tv.tv_usec) + extra;
 		}
 		break;
 	    }
 	    case MMV_TYPE_STRING: {
 		str = (mmv_disk_string_t *)((char *)s->addr + v->extra);
-		atom->cp = str->payload;
+		tries = 0;
+		do {
+		    seq = read_begin(m);
+		    memcpy(buffer, str->payload, sizeof(buffer));
+		} while (read_retry(m, seq, tries++));
+		buffer[sizeof(buffer)-1] = '\0';
+		atom->cp = buffer;
 		break;
 	    }
+	    case MMV_TYPE_HISTOGRAM:
 	    case MMV_TYPE_NOSUPPORT:
 		return PM_ERR_APPVERSION;
 	}
@@ -730,7 +1338,8 @@ mmv_text(int ident, int type, char **buffer, pmdaExt *ep)
 	mmv_disk_value_t * v;
 	stats_t * s;
 
-	if (mmv_lookup_stat_metric_value(ident, PM_IN_NULL, &s, &m, &v) != 0)
+	if (mmv_lookup_stat_metric_value(ident, PM_IN_NULL, &s, &m, &v) != 0 &&
+	    (m = mmv_lookup_hist_metric(ident, &s)) == NULL)
 	    return PM_ERR_PMID;
 
 	if ((type & PM_TEXT_ONELINE) && m->shorttext) {
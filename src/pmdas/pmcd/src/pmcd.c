@@ -79,6 +79,16 @@ static pmDesc	desctab[] = {
     { PMDA_PMID(0,20), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
 /* hostname -- local hostname -- for pmlogger */
     { PMDA_PMID(0,21), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
+/* control.coalesce */
+    { PMDA_PMID(0,22), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,1,0,0,PM_TIME_MSEC,0) },
+/* buf.hit */
+    { PMDA_PMID(0,23), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* buf.miss */
+    { PMDA_PMID(0,24), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* buf.large */
+    { PMDA_PMID(0,25), PM_TYPE_U64, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* buf.slabs */
+    { PMDA_PMID(0,26), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_INSTANT, PMDA_PMUNITS(0,0,0,0,0,0) },
 
 /* pdu_in.error */
     { PMDA_PMID(1,0), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
@@ -167,6 +177,10 @@ static pmDesc	desctab[] = {
     { PMDA_PMID(4,0), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
 /* agent.status */
     { PMDA_PMID(4,1), PM_TYPE_32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
+/* agent.fetch */
+    { PMDA_PMID(4,2), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* agent.coalesced */
+    { PMDA_PMID(4,3), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
 
 /* pmie.configfile */
     { PMDA_PMID(5,0), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
@@ -188,6 +202,12 @@ static pmDesc	desctab[] = {
     { PMDA_PMID(5,8), PM_TYPE_FLOAT, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,-1,1,0,PM_TIME_SEC,PM_COUNT_ONE) },
 /* pmie.eval.actual */
     { PMDA_PMID(5,9), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_COUNTER, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* pmie.expr.total */
+    { PMDA_PMID(5,10), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* pmie.expr.shared */
+    { PMDA_PMID(5,11), PM_TYPE_U32, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,1,0,0,PM_COUNT_ONE) },
+/* pmie.expr.ratio */
+    { PMDA_PMID(5,12), PM_TYPE_FLOAT, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
 
 /* client.whoami */
     { PMDA_PMID(6,0), PM_TYPE_STRING, PM_INDOM_NULL, PM_SEM_DISCRETE, PMDA_PMUNITS(0,0,0,0,0,0) },
@@ -484,7 +504,8 @@ refresh_pmie_indom(void)
 				fullpath, osstrerror());
 		    continue;
 		}
-		if (statbuf.st_size != sizeof(pmiestats_t))
+		if (statbuf.st_size != sizeof(pmiestats_t) &&
+		    statbuf.st_size != PMIE_STATS_V1_SIZE)
 		    continue;
 		if  ((endp = strdup(dp->d_name)) == NULL) {
 		    __pmNoMem("pmie iname", strlen(dp->d_name), PM_RECOV_ERR);
@@ -509,7 +530,8 @@ refresh_pmie_indom(void)
 		    free(endp);
 		    continue;
 		}
-		else if (((pmiestats_t *)ptr)->version != 1) {
+		else if (((pmiestats_t *)ptr)->version != 1 &&
+			 ((pmiestats_t *)ptr)->version != PMIE_STATS_VERSION) {
 		    __pmNotifyErr(LOG_WARNING, "incompatible pmie version: %s",
 				fullpath);
 		    __pmMemoryUnmap(ptr, statbuf.st_size);
@@ -1268,6 +1290,7 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
     __pmID_int		*pmidp;
     pmAtomValue		atom;
     __pmLogPort		*lpp;
+    __pmPDUBufStats	bufstats;
 
     if (numpmid > maxnpmids) {
 	if (res != NULL)
@@ -1451,6 +1474,25 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 				need = pmda->e_context;	/* client context ID */
 				host = fetch_hostname(need, &atom, host);
 				break;
+
+			case 22:	/* control.coalesce */
+				atom.ul = _pmcd_coalesce;
+				break;
+
+			case 23:	/* buf.hit */
+			case 24:	/* buf.miss */
+			case 25:	/* buf.large */
+			case 26:	/* buf.slabs */
+				__pmGetPDUBufStats(&bufstats);
+				if (pmidp->item == 23)
+				    atom.ull = bufstats.hit;
+				else if (pmidp->item == 24)
+				    atom.ull = bufstats.miss;
+				else if (pmidp->item == 25)
+				    atom.ull = bufstats.large;
+				else
+				    atom.ul = bufstats.slabs;
+				break;
 			default:
 				sts = atom.l = PM_ERR_PMID;
 				break;
@@ -1566,6 +1608,12 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 			    else
 				atom.l = agent[j].reason;
 			    break;
+			case 2:		/* agent.fetch */
+			    atom.ul = agent[j].fetchSent;
+			    break;
+			case 3:		/* agent.coalesced */
+			    atom.ul = agent[j].fetchShared;
+			    break;
 			default:
 			    sts = atom.l = PM_ERR_PMID;
 			    break;
@@ -1635,6 +1683,18 @@ pmcd_fetch(int numpmid, pmID pmidlist[], pmResult **resp, pmdaExt *pmda)
 			case 9:		/* pmie.eval.actual */
 			    atom.ul = pmie->eval_actual;
 			    break;
+			case 10:	/* pmie.expr.total */
+			    atom.ul = pmie->version < 2 ? 0 : pmie->subexprs;
+			    break;
+			case 11:	/* pmie.expr.shared */
+			    atom.ul = pmie->version < 2 ? 0 : pmie->shared;
+			    break;
+			case 12:	/* pmie.expr.ratio */
+			    if (pmie->version < 2 || pmie->subexprs == 0)
+				atom.f = 0;
+			    else
+				atom.f = (float)pmie->shared / pmie->subexprs;
+			    break;
 			default:
 			    sts = atom.l = PM_ERR_PMID;
 			    break;
@@ -1846,6 +1906,14 @@ pmcd_store(pmResult *result, pmdaExt *pmda)
 		raise(SIGHUP);
 #endif
 	    }
+	    else if (pmidp->item == 22) { /* pmcd.control.coalesce */
+		val = vsp->vlist[0].value.lval;
+		if (val < 0) {
+		    sts = PM_ERR_SIGN;
+		    break;
+		}
+		_pmcd_coalesce = val;
+	    }
 	    else {
 		sts = PM_ERR_PMID;
 		break;
@@ -59,6 +59,7 @@ char		*stopFlag;			/* end time specified? */
 char		*alignFlag;			/* align time specified? */
 char		*offsetFlag;			/* offset time specified? */
 RealTime	runTime;			/* run time interval */
+int		fetchThreads = THREADS_DFLT;	/* concurrent host fetches */
 int		hostZone;			/* timezone from host? */
 char		*timeZone;			/* timezone from command line */
 int		quiet;				/* suppress default diagnostics */
@@ -68,6 +69,8 @@ int		isdaemon;			/* run as a daemon */
 int		agent;				/* secret agent mode? */
 int		applet;				/* applet mode? */
 int		dowrap;				/* counter wrap? default no */
+int		dofuse = 1;			/* fuse operator evaluation? */
+int		doshare = 1;			/* share common subexpressions? */
 int		doexit;				/* time to exit stage left? */
 int		dorotate;			/* is a log rotation pending? */
 pmiestats_t	*perf;				/* live performance data */
@@ -585,6 +588,7 @@ void
 freeFetch(Fetch *f)
 {
     if (f->profiles == NULL) {
+	fetchWait(f->host);
 	if (f->next) f->next->prev = f->prev;
 	if (f->prev) f->prev->next = f->next;
 	else {
@@ -592,6 +596,7 @@ freeFetch(Fetch *f)
 	    freeHost(f->host);
 	}
 	pmDestroyContext(f->handle);
+	if (f->fresult) pmFreeResult(f->fresult);
 	if (f->result) pmFreeResult(f->result);
 	if (f->pmids) free(f->pmids);
 	free(f);
@@ -653,9 +658,10 @@ freeExpr(Expr *x)
     int		i;
 
     if (x) {
-	if (x->arg1 && x->arg1->parent == x)
+	forgetExpr(x);
+	if (x->arg1 && !unshareExpr(x->arg1, x) && x->arg1->parent == x)
 	    freeExpr(x->arg1);
-	if (x->arg2 && x->arg2->parent == x)
+	if (x->arg2 && !unshareExpr(x->arg2, x) && x->arg2->parent == x)
 	    freeExpr(x->arg2);
 	if (x->metrics && x->op == CND_FETCH) {
 	    for (m = x->metrics, i = 0; i < x->hdom; m++, i++)
@@ -666,6 +672,8 @@ freeExpr(Expr *x)
 	     */
 	    free(x->metrics);
 	}
+	unfuseExpr(x);
+	if (x->share) free(x->share);
 	if (x->ring) free(x->ring);
 	free(x);
     }
@@ -752,6 +760,8 @@ changeSmpls(Expr **p, int nsmpls)
 
     *p = x;
     newRingBfr(x);
+    /* fused trees may refer to the node before it moved */
+    staleFuse(x);
 }
 
 
@@ -764,6 +774,7 @@ instExpr(Expr *x)
     Expr    *arg1 = x->arg1;
     Expr    *arg2 = x->arg2;
     Expr    *arg = primary(arg1, arg2);
+    int	    i;
 
     /* semantics ... */
     if (x->sem == SEM_UNKNOWN) {
@@ -830,8 +841,12 @@ instExpr(Expr *x)
 	newRingBfr(x);
     }
 
-    if (up && x->parent)
-	instExpr(x->parent);
+    if (up) {
+	if (x->parent)
+	    instExpr(x->parent);
+	for (i = 0; i < x->nshare; i++)
+	    instExpr(x->share[i]);
+    }
 }
 
 
@@ -901,6 +916,12 @@ instFetchExpr(Expr *x)
 	    instExpr(x->parent);
 	}
     }
+    for (i = 0; i < x->nshare; i++) {
+	if (up ||
+	    (UNITS_UNKNOWN(x->share[i]->units) && !UNITS_UNKNOWN(x->units))) {
+	    instExpr(x->share[i]);
+	}
+    }
 }
 
 
@@ -1036,6 +1057,7 @@ static struct {
     { cndFetch_1,	"cndFetch_1" },
     { cndFetch_all,	"cndFetch_all" },
     { cndFetch_n,	"cndFetch_n" },
+    { cndFused,		"cndFused" },
     { cndGt_1_1,	"cndGt_1_1" },
     { cndGt_1_n,	"cndGt_1_n" },
     { cndGt_n_1,	"cndGt_n_1" },
@@ -1124,8 +1146,11 @@ __dumpExpr(int level, Expr *x)
     fprintf(stderr, "Expr dump @ " PRINTF_P_PFX "%p\n", x);
     if (x == NULL) return;
     for (i = 0; i < level; i++) fprintf(stderr, ".. ");
-    fprintf(stderr, "  op=%d (%s) arg1=" PRINTF_P_PFX "%p arg2=" PRINTF_P_PFX "%p parent=" PRINTF_P_PFX "%p\n",
+    fprintf(stderr, "  op=%d (%s) arg1=" PRINTF_P_PFX "%p arg2=" PRINTF_P_PFX "%p parent=" PRINTF_P_PFX "%p",
 	x->op, opStrings(x->op), x->arg1, x->arg2, x->parent);
+    if (x->nshare)
+	fprintf(stderr, " (+%d shared)", x->nshare);
+    fputc('\n', stderr);
     for (i = 0; i < level; i++) fprintf(stderr, ".. ");
     fprintf(stderr, "  eval=");
     for (j = 0; fn_map[j].addr; j++) {
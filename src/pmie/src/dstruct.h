@@ -64,6 +64,7 @@ typedef double		RealTime;	/* wall clock time or interval */
 #define DELAY_MAX	32		/* maximum initial evaluation delay */
 #define RETRY		5		/* retry interval */
 #define DELTA_DFLT	10		/* default sample interval */
+#define THREADS_DFLT	16		/* default concurrent host fetches */
 #define DELTA_MIN	0.1		/* minimum sample interval */
 
 
@@ -74,6 +75,9 @@ typedef double		RealTime;	/* wall clock time or interval */
 /* evaluator function */
 typedef void (Eval)(struct expr *);
 
+/* fused evaluation of an operator tree, see fuse.c */
+typedef struct fuse Fuse;
+
 
 /***********************************************************************
  * internal representation of rule expressions and their values
@@ -106,10 +110,14 @@ typedef struct expr {
     struct expr	    *arg1;	/* NULL || (Expr *) */
     struct expr     *arg2;	/* NULL || (Expr *) */
     struct expr	    *parent;	/* parent of this Expr */
+    int		    nshare;	/* number of other parents, see share.c */
+    struct expr	    **share;	/* other parents of a shared Expr */
 
     /* evaluator */
     Eval	    *eval;	/* evaluator function */
     int		    valid;	/* number of valid samples */
+    Fuse	    *fuse;	/* NULL || fused evaluator for subtree */
+    unsigned int    epoch;	/* last evaluation of a shared Expr */
 
     /* description of value matrix */
     int		    hdom;	/* cardinality of host dimension */
@@ -184,6 +192,7 @@ typedef struct fetch {
     int		   npmids;	/* number of metrics in fetch */
     pmID	   *pmids;	/* array of metric ids to fetch */
     pmResult       *result;     /* result of fetch */
+    pmResult       *fresult;    /* result from a fetch thread */
 } Fetch;
 
 /* set of bundled fetches for single host (may be archive or live):
@@ -199,6 +208,9 @@ typedef struct host {
     int	    	    down;	/* host is not delivering metrics */
     Metric	    *waits;	/* wait list of Metrics */
     Metric          *duds;	/* bad Metrics discovered during evaluation */
+    int		    fetching;	/* fetch thread state, see taskFetch() */
+    int		    fsts;	/* status from the fetch thread */
+    int		    late;	/* fetch missed its deadline */
 } Host;
 
 /* element of evaluator task queue */
@@ -400,6 +412,7 @@ extern RealTime	   last;	/* archive end point */
 extern char	   *dfltHostConn;  /* host connspec or archive path  */
 extern RealTime	   dfltDelta;	/* default sample interval */
 extern RealTime    runTime;	/* run time interval */
+extern int	   fetchThreads; /* concurrent host fetches, -P */
 extern int	   hostZone;	/* timezone from host? */
 extern char	   *timeZone;	/* timezone from command line */
 extern int	   quiet;	/* suppress default diagnostics */
@@ -409,6 +422,8 @@ extern int	   isdaemon;	/* run as a daemon */
 extern int         agent;	/* secret agent mode? */
 extern int         applet;	/* applet mode? */
 extern int	   dowrap;	/* counter wrap? default no */
+extern int	   dofuse;	/* fuse operator evaluation? default yes */
+extern int	   doshare;	/* share common subexpressions? default yes */
 extern int	   doexit;	/* signalled its time to exit */
 extern int	   dorotate;	/* log rotation was requested */
 extern pmiestats_t *perf;	/* pmie performance data ptr */
@@ -202,6 +202,9 @@ eval(Task *task)
     /* fetch metrics */
     taskFetch(task);
 
+    /* shared subexpressions are evaluated again from here on */
+    shareEpoch++;
+
     /* evaluate rule expressions */
     s = task->rules;
     for (i = 0; i < task->nrules; i++) {
@@ -741,6 +744,9 @@ findEval(Expr *x)
 	 x->op == ACT_PRINT || x->op == ACT_STOMP)) {
 	x->eval = actFake;
     }
+
+    /* combine with any arithmetic and relational operands */
+    fuseExpr(x);
 }
 
 
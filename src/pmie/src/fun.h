@@ -23,9 +23,14 @@
 
 #include "dstruct.h"
 #include "andor.h"
+#include "fuse.h"
+#include "share.h"
 
 #define ROTATE(x)  if ((x)->nsmpls > 1) rotate(x);
-#define EVALARG(x) if ((x)->op < NOP) ((x)->eval)(x);
+/* a shared Expr is evaluated once per pass, see share.c */
+#define EVALARG(x) if ((x)->op < NOP && \
+		       ((x)->nshare == 0 || (x)->epoch != shareEpoch)) { \
+		       (x)->epoch = shareEpoch; ((x)->eval)(x); }
 
 /* expression evaluator function prototypes */
 void rule(Expr *);
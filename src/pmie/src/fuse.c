@@ -0,0 +1,600 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/***********************************************************************
+ * fuse.c
+ *
+ * The evaluators generated from the skeletons by './meta' each make a
+ * complete pass over the values of one operator, so for an expression
+ * such as
+ *	some_inst (disk.dev.read + disk.dev.write > 10 * disk.dev.avactive)
+ * there are four passes over arrays as long as the instance domain,
+ * each one reading back the arrays written by the passes before it.
+ *
+ * Here a tree of arithmetic and relational operators, optionally
+ * topped by an _inst aggregate or quantifier, is compiled into a list
+ * of steps in evaluation order.  The operands outside the tree (metric
+ * fetches, rates, time aggregates, ...) are evaluated first, then the
+ * steps are applied one block of instances at a time, so the values of
+ * a block are still in the cache when the next step reads them, and
+ * each step is a plain loop over contiguous arrays that the compiler
+ * can vectorise.
+ *
+ * Every operator still writes its own value buffer and maintains its
+ * own valid count and time stamp, exactly as its skeleton evaluator
+ * would, so that actions, dumpExpr() and the -v output are unchanged.
+ ***********************************************************************/
+
+#include "pmapi.h"
+#include "impl.h"
+#include "dstruct.h"
+#include "fun.h"
+#include "fuse.h"
+
+#define FUSE_BLOCK	256	/* instances per pass over the steps */
+#define FUSE_STEPS	32	/* most operators in one fused tree */
+
+/* kinds of operator */
+#define K_UNARY		0	/* arithmetic, one operand */
+#define K_BINARY	1	/* arithmetic or relational, two operands */
+#define K_REDUCE	2	/* _inst aggregate or quantifier, top only */
+
+typedef struct {
+    Eval	*eval;		/* skeleton evaluator */
+    int		op;		/* operator */
+    int		kind;		/* K_UNARY, ... */
+    int		arity;		/* as in findEval() */
+} Kernel;
+
+/*
+ * the evaluators that may be fused, arity bits are
+ *	1	arg1 has one value
+ *	2	arg2 has one value
+ */
+static Kernel kernels[] = {
+    { cndNeg_n,		CND_NEG,	K_UNARY,	0 },
+    { cndNeg_1,		CND_NEG,	K_UNARY,	1 },
+    { cndAdd_n_n,	CND_ADD,	K_BINARY,	0 },
+    { cndAdd_1_n,	CND_ADD,	K_BINARY,	1 },
+    { cndAdd_n_1,	CND_ADD,	K_BINARY,	2 },
+    { cndAdd_1_1,	CND_ADD,	K_BINARY,	3 },
+    { cndSub_n_n,	CND_SUB,	K_BINARY,	0 },
+    { cndSub_1_n,	CND_SUB,	K_BINARY,	1 },
+    { cndSub_n_1,	CND_SUB,	K_BINARY,	2 },
+    { cndSub_1_1,	CND_SUB,	K_BINARY,	3 },
+    { cndMul_n_n,	CND_MUL,	K_BINARY,	0 },
+    { cndMul_1_n,	CND_MUL,	K_BINARY,	1 },
+    { cndMul_n_1,	CND_MUL,	K_BINARY,	2 },
+    { cndMul_1_1,	CND_MUL,	K_BINARY,	3 },
+    { cndDiv_n_n,	CND_DIV,	K_BINARY,	0 },
+    { cndDiv_1_n,	CND_DIV,	K_BINARY,	1 },
+    { cndDiv_n_1,	CND_DIV,	K_BINARY,	2 },
+    { cndDiv_1_1,	CND_DIV,	K_BINARY,	3 },
+    { cndEq_n_n,	CND_EQ,		K_BINARY,	0 },
+    { cndEq_1_n,	CND_EQ,		K_BINARY,	1 },
+    { cndEq_n_1,	CND_EQ,		K_BINARY,	2 },
+    { cndEq_1_1,	CND_EQ,		K_BINARY,	3 },
+    { cndNeq_n_n,	CND_NEQ,	K_BINARY,	0 },
+    { cndNeq_1_n,	CND_NEQ,	K_BINARY,	1 },
+    { cndNeq_n_1,	CND_NEQ,	K_BINARY,	2 },
+    { cndNeq_1_1,	CND_NEQ,	K_BINARY,	3 },
+    { cndLt_n_n,	CND_LT,		K_BINARY,	0 },
+    { cndLt_1_n,	CND_LT,		K_BINARY,	1 },
+    { cndLt_n_1,	CND_LT,		K_BINARY,	2 },
+    { cndLt_1_1,	CND_LT,		K_BINARY,	3 },
+    { cndLte_n_n,	CND_LTE,	K_BINARY,	0 },
+    { cndLte_1_n,	CND_LTE,	K_BINARY,	1 },
+    { cndLte_n_1,	CND_LTE,	K_BINARY,	2 },
+    { cndLte_1_1,	CND_LTE,	K_BINARY,	3 },
+    { cndGt_n_n,	CND_GT,		K_BINARY,	0 },
+    { cndGt_1_n,	CND_GT,		K_BINARY,	1 },
+    { cndGt_n_1,	CND_GT,		K_BINARY,	2 },
+    { cndGt_1_1,	CND_GT,		K_BINARY,	3 },
+    { cndGte_n_n,	CND_GTE,	K_BINARY,	0 },
+    { cndGte_1_n,	CND_GTE,	K_BINARY,	1 },
+    { cndGte_n_1,	CND_GTE,	K_BINARY,	2 },
+    { cndGte_1_1,	CND_GTE,	K_BINARY,	3 },
+    { cndSum_inst,	CND_SUM_INST,	K_REDUCE,	0 },
+    { cndAvg_inst,	CND_AVG_INST,	K_REDUCE,	0 },
+    { cndMax_inst,	CND_MAX_INST,	K_REDUCE,	0 },
+    { cndMin_inst,	CND_MIN_INST,	K_REDUCE,	0 },
+    { cndAll_inst,	CND_ALL_INST,	K_REDUCE,	0 },
+    { cndSome_inst,	CND_SOME_INST,	K_REDUCE,	0 },
+    { cndCount_inst,	CND_COUNT_INST,	K_REDUCE,	0 },
+};
+static int	nkernels = sizeof(kernels) / sizeof(kernels[0]);
+
+/* one operator of a fused tree */
+typedef struct {
+    Expr	*x;		/* operator node */
+    Kernel	*k;		/* how to evaluate it */
+    int		n;		/* values to compute, 0 if none */
+    double	a;		/* K_REDUCE running value */
+} Step;
+
+struct fuse {
+    Eval	*eval;			/* skeleton evaluator replaced */
+    int		stale;			/* tree changed, compile again */
+    int		nplan;			/* steps compiled or pending */
+    int		nleaf;
+    Expr	*leaf[2 * FUSE_STEPS];	/* operands outside the tree */
+    int		nstep;
+    Step	step[FUSE_STEPS];	/* operators, in evaluation order */
+};
+
+
+/***********************************************************************
+ * compilation
+ ***********************************************************************/
+
+static Kernel *
+findKernel(Expr *x)
+{
+    Eval	*eval = x->fuse ? x->fuse->eval : x->eval;
+    int		i;
+
+    for (i = 0; i < nkernels; i++) {
+	if (kernels[i].eval == eval)
+	    return &kernels[i];
+    }
+    return NULL;
+}
+
+static void compile(Fuse *, Expr *, Kernel *);
+
+static void
+operand(Fuse *f, Expr *x, Expr *arg)
+{
+    Kernel	*k = findKernel(arg);
+
+    if (arg->parent == x && arg->nshare == 0 && k != NULL &&
+	k->kind != K_REDUCE && f->nplan < FUSE_STEPS) {
+	compile(f, arg, k);
+	/* evaluated as part of this tree from now on */
+	unfuseExpr(arg);
+    }
+    else if (arg->op < NOP)
+	f->leaf[f->nleaf++] = arg;
+}
+
+static void
+compile(Fuse *f, Expr *x, Kernel *k)
+{
+    Step	*s;
+
+    f->nplan++;
+    operand(f, x, x->arg1);
+    if (k->kind == K_BINARY)
+	operand(f, x, x->arg2);
+    s = &f->step[f->nstep++];
+    s->x = x;
+    s->k = k;
+}
+
+
+/***********************************************************************
+ * evaluation
+ ***********************************************************************/
+
+#define F_NEG(x)	(-(x))
+#define F_ADD(x,y)	((x) + (y))
+#define F_SUB(x,y)	((x) - (y))
+#define F_MUL(x,y)	((x) * (y))
+#define F_DIV(x,y)	((x) / (y))
+#define F_EQ(x,y)	((x) == (y))
+#define F_NEQ(x,y)	((x) != (y))
+#define F_LT(x,y)	((x) < (y))
+#define F_LTE(x,y)	((x) <= (y))
+#define F_GT(x,y)	((x) > (y))
+#define F_GTE(x,y)	((x) >= (y))
+
+/*
+ * Results are built in a local array, which the compiler knows cannot
+ * overlap the operands, and a full block has a constant trip count,
+ * so these loops are vectorised at the usual optimisation level.
+ */
+#define LOOP(STMT)							\
+	if (len == FUSE_BLOCK) {					\
+	    for (i = 0; i < FUSE_BLOCK; i++)				\
+		STMT;							\
+	}								\
+	else {								\
+	    for (i = 0; i < len; i++)					\
+		STMT;							\
+	}
+
+#define UNARY(OTYPE, OP) {						\
+	OTYPE	t[FUSE_BLOCK];						\
+	double	*ip = (double *)x->arg1->smpls[0].ptr + base;		\
+	LOOP(t[i] = OP(ip[i]))						\
+	memcpy((OTYPE *)x->smpls[0].ptr + base, t, len * sizeof(OTYPE)); \
+    }
+
+#define BINARY(OTYPE, OP) {						\
+	OTYPE	t[FUSE_BLOCK];						\
+	double	*ip1 = (double *)x->arg1->smpls[0].ptr;			\
+	double	*ip2 = (double *)x->arg2->smpls[0].ptr;			\
+	double	iv;							\
+	switch (s->k->arity) {						\
+	case 0:								\
+	    ip1 += base;						\
+	    ip2 += base;						\
+	    LOOP(t[i] = OP(ip1[i], ip2[i]))				\
+	    break;							\
+	case 1:								\
+	    iv = *ip1;							\
+	    ip2 += base;						\
+	    LOOP(t[i] = OP(iv, ip2[i]))					\
+	    break;							\
+	case 2:								\
+	    iv = *ip2;							\
+	    ip1 += base;						\
+	    LOOP(t[i] = OP(ip1[i], iv))					\
+	    break;							\
+	default:							\
+	    t[0] = OP(*ip1, *ip2);					\
+	}								\
+	memcpy((OTYPE *)x->smpls[0].ptr + base, t, len * sizeof(OTYPE)); \
+    }
+
+/* width of the values aggregated by a K_REDUCE step */
+static size_t
+reduceSize(Step *s)
+{
+    switch (s->k->op) {
+    case CND_ALL_INST:
+    case CND_SOME_INST:
+    case CND_COUNT_INST:
+	return sizeof(Boolean);
+    }
+    return sizeof(double);
+}
+
+/* aggregate len values, starting afresh if first is set */
+static void
+reduce(Step *s, void *ptr, int first, int len)
+{
+    double	*ip = (double *)ptr;
+    Boolean	*bp = (Boolean *)ptr;
+    double	a = s->a;
+    int		i = 0;
+
+    switch (s->k->op) {
+    case CND_SUM_INST:
+    case CND_AVG_INST:
+	if (first) a = ip[i++];
+	for (; i < len; i++)
+	    a += ip[i];
+	break;
+    case CND_MAX_INST:
+	if (first) a = ip[i++];
+	for (; i < len; i++)
+	    if (ip[i] > a) a = ip[i];
+	break;
+    case CND_MIN_INST:
+	if (first) a = ip[i++];
+	for (; i < len; i++)
+	    if (ip[i] < a) a = ip[i];
+	break;
+    case CND_ALL_INST:
+	if (first) a = bp[i++];
+	for (; i < len; i++) {
+	    if (bp[i] == B_FALSE) a = B_FALSE;
+	    else if (bp[i] == B_UNKNOWN && a != B_UNKNOWN) a = B_UNKNOWN;
+	}
+	break;
+    case CND_SOME_INST:
+	if (first) a = bp[i++];
+	for (; i < len; i++) {
+	    if (bp[i] == B_TRUE) a = B_TRUE;
+	    else if (bp[i] == B_UNKNOWN && a != B_UNKNOWN) a = B_UNKNOWN;
+	}
+	break;
+    case CND_COUNT_INST:
+	if (first) a = bp[i++] == B_TRUE ? 1 : 0;
+	for (; i < len; i++)
+	    if (bp[i] == B_TRUE) a++;
+	break;
+    }
+    s->a = a;
+}
+
+/* store the aggregate of n values as the i'th value of the step */
+static void
+reduceValue(Step *s, int i, int n)
+{
+    void	*op = s->x->smpls[0].ptr;
+
+    switch (s->k->op) {
+    case CND_AVG_INST:
+	((double *)op)[i] = s->a / n;
+	break;
+    case CND_ALL_INST:
+    case CND_SOME_INST:
+	((Boolean *)op)[i] = (Boolean)s->a;
+	break;
+    default:
+	((double *)op)[i] = s->a;
+    }
+}
+
+/* no instances to aggregate, as @NOTVALID in the skeleton */
+static void
+reduceNotValid(Step *s, int i)
+{
+    Expr	*x = s->x;
+
+    if (s->k->op == CND_ALL_INST || s->k->op == CND_SOME_INST) {
+	((Boolean *)x->smpls[0].ptr)[i] = B_UNKNOWN;
+	x->smpls[0].stamp = x->arg1->smpls[0].stamp;
+	x->valid++;
+    }
+    else
+	x->valid = 0;
+}
+
+/*
+ * decide whether the operator has values this time, with the same
+ * conditions as the skeleton evaluator, and how many to compute
+ */
+static void
+prepare(Step *s)
+{
+    Expr	*x = s->x;
+    Expr	*arg1 = x->arg1;
+    Expr	*arg2 = x->arg2;
+    RealTime	stamp;
+    int		ok;
+
+    ROTATE(x)
+    s->n = 0;
+
+    if (s->k->kind == K_REDUCE) {
+	if (arg1->valid && x->hdom != 0) {
+	    if (abs(x->hdom) != 1)
+		s->n = -1;		/* aggregate per host, see finish() */
+	    else if (arg1->e_idom < 1)
+		reduceNotValid(s, 0);
+	    else
+		s->n = arg1->e_idom;
+	}
+	else
+	    x->valid = 0;
+	return;
+    }
+
+    if (s->k->kind == K_UNARY) {
+	if (s->k->arity & 1)
+	    ok = arg1->valid;
+	else
+	    ok = arg1->valid && x->tspan > 0;
+	stamp = arg1->smpls[0].stamp;
+    }
+    else {
+	ok = arg1->valid && arg2->valid;
+	switch (s->k->arity) {
+	case 0:
+	    ok = ok && x->tspan > 0 && x->tspan == arg1->tspan &&
+			x->tspan == arg2->tspan;
+	    break;
+	case 1:
+	    ok = ok && x->tspan > 0 && x->tspan == arg2->tspan;
+	    break;
+	case 2:
+	    ok = ok && x->tspan > 0 && x->tspan == arg1->tspan;
+	    break;
+	}
+	stamp = arg1->smpls[0].stamp;
+	if (arg2->smpls[0].stamp > stamp)
+	    stamp = arg2->smpls[0].stamp;
+    }
+
+    if (ok) {
+	s->n = (s->k->arity == 3 || (s->k->kind == K_UNARY && s->k->arity)) ?
+		1 : x->tspan;
+	x->smpls[0].stamp = stamp;
+	x->valid++;
+    }
+    else
+	x->valid = 0;
+}
+
+/* compute values base .. base+len-1 of the operator */
+static void
+block(Step *s, int base, int len)
+{
+    Expr	*x = s->x;
+    int		i;
+
+    switch (s->k->op) {
+    case CND_NEG:
+	UNARY(double, F_NEG)
+	break;
+    case CND_ADD:
+	BINARY(double, F_ADD)
+	break;
+    case CND_SUB:
+	BINARY(double, F_SUB)
+	break;
+    case CND_MUL:
+	BINARY(double, F_MUL)
+	break;
+    case CND_DIV:
+	BINARY(double, F_DIV)
+	break;
+    case CND_EQ:
+	BINARY(Boolean, F_EQ)
+	break;
+    case CND_NEQ:
+	BINARY(Boolean, F_NEQ)
+	break;
+    case CND_LT:
+	BINARY(Boolean, F_LT)
+	break;
+    case CND_LTE:
+	BINARY(Boolean, F_LTE)
+	break;
+    case CND_GT:
+	BINARY(Boolean, F_GT)
+	break;
+    case CND_GTE:
+	BINARY(Boolean, F_GTE)
+	break;
+    default:
+	reduce(s, (char *)x->arg1->smpls[0].ptr + base * reduceSize(s),
+		base == 0, len);
+	break;
+    }
+}
+
+/* complete an aggregate or quantifier once its operand is computed */
+static void
+finish(Step *s)
+{
+    Expr	*x = s->x;
+    Metric	*m;
+    char	*ip;
+    int		i;
+
+    if (s->n > 0)
+	reduceValue(s, 0, s->n);
+    else {
+	ip = (char *)x->arg1->smpls[0].ptr;
+	m = x->metrics;
+	for (i = 0; i < x->hdom; i++) {
+	    if (m->m_idom < 1) {
+		reduceNotValid(s, i);
+		return;
+	    }
+	    reduce(s, ip, 1, m->m_idom);
+	    reduceValue(s, i, m->m_idom);
+	    /*
+	     * the skeleton leaves ip at the last value of this host, and
+	     * that is where the next host starts ... keep the same values
+	     */
+	    ip += (m->m_idom - 1) * reduceSize(s);
+	    m++;
+	}
+    }
+    x->smpls[0].stamp = x->arg1->smpls[0].stamp;
+    x->valid++;
+}
+
+
+/***********************************************************************
+ * exported functions
+ ***********************************************************************/
+
+/* fused expression evaluator */
+void
+cndFused(Expr *x)
+{
+    Fuse	*f = x->fuse;
+    Step	*s;
+    Step	*last;
+    int		nmax = 0;
+    int		base;
+    int		len;
+    int		i;
+
+    if (f->stale) {
+	f->nleaf = f->nstep = f->nplan = 0;
+	compile(f, x, findKernel(x));
+	f->stale = 0;
+    }
+    last = &f->step[f->nstep - 1];
+
+    for (i = 0; i < f->nleaf; i++)
+	EVALARG(f->leaf[i])
+
+    for (s = f->step; s <= last; s++) {
+	prepare(s);
+	if (s->n > nmax)
+	    nmax = s->n;
+    }
+
+    for (base = 0; base < nmax; base += FUSE_BLOCK) {
+	for (s = f->step; s <= last; s++) {
+	    if (s->n <= base)
+		continue;
+	    len = s->n - base;
+	    if (len > FUSE_BLOCK)
+		len = FUSE_BLOCK;
+	    block(s, base, len);
+	}
+    }
+
+    if (last->k->kind == K_REDUCE && last->n != 0)
+	finish(last);
+
+#if PCP_DEBUG
+    if (pmDebug & DBG_TRACE_APPL2) {
+	for (s = f->step; s <= last; s++) {
+	    fprintf(stderr, "cndFused(" PRINTF_P_PFX "%p) step %d ...\n",
+		    x, (int)(s - f->step));
+	    dumpExpr(s->x);
+	}
+    }
+#endif
+}
+
+/* recompile fused trees that include x before their next evaluation */
+void
+staleFuse(Expr *x)
+{
+    int		i;
+
+    for (; x != NULL; x = x->parent) {
+	if (x->fuse)
+	    x->fuse->stale = 1;
+	for (i = 0; i < x->nshare; i++)
+	    staleFuse(x->share[i]);
+    }
+}
+
+/* after findEval(), replace the evaluator of x by a fused one */
+void
+fuseExpr(Expr *x)
+{
+    Kernel	*k;
+    Fuse	*f;
+
+    staleFuse(x->parent);
+    unfuseExpr(x);
+    if (!dofuse || (k = findKernel(x)) == NULL)
+	return;
+
+    f = (Fuse *) zalloc(sizeof(Fuse));
+    f->eval = x->eval;
+    compile(f, x, k);
+    if (f->nstep < 2) {
+	/* nothing to fuse */
+	free(f);
+	return;
+    }
+    x->fuse = f;
+    x->eval = cndFused;
+}
+
+/* release the fused evaluator of x */
+void
+unfuseExpr(Expr *x)
+{
+    if (x->fuse) {
+	if (x->eval == cndFused)
+	    x->eval = x->fuse->eval;
+	free(x->fuse);
+	x->fuse = NULL;
+    }
+}
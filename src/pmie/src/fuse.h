@@ -0,0 +1,32 @@
+/***********************************************************************
+ * fuse.h - fused evaluation of operator chains
+ ***********************************************************************
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef FUSE_H
+#define FUSE_H
+
+/* replace the evaluator of x by a fused one, if possible */
+void fuseExpr(Expr *);
+
+/* release the fused evaluator of x */
+void unfuseExpr(Expr *);
+
+/* recompile fused trees that include x before their next evaluation */
+void staleFuse(Expr *);
+
+/* fused expression evaluator */
+void cndFused(Expr *);
+
+#endif /* FUSE_H */
@@ -100,6 +100,7 @@ static pmLongOptions longopts[] = {
     { "", 0, 'H', NULL }, /* was: no DNS lookup on the default hostname */
     { "", 1, 'j', "FILE", "stomp protocol (JMS) file" },
     { "logfile", 1, 'l', "FILE", "send status and error messages to FILE" },
+    { "threads", 1, 'P', "N", "fetch from at most N hosts concurrently [default 16]" },
     { "username", 1, 'U', "USER", "run as named USER in daemon mode [default pcp]" },
     PMAPI_OPTIONS_HEADER("Reporting options"),
     { "buffer", 0, 'b', 0, "one line buffered output stream, stdout on stderr" },
@@ -115,7 +116,7 @@ static pmLongOptions longopts[] = {
 
 static pmOptions opts = {
     .flags = PM_OPTFLAG_STDOUT_TZ,
-    .short_options = "a:A:bc:CdD:efHh:j:l:n:O:qS:t:T:U:vVWXxzZ:?",
+    .short_options = "a:A:bc:CdD:efHh:j:l:n:O:P:qS:t:T:U:vVWXxzZ:?",
     .long_options = longopts,
     .short_usage = "[options] [filename ...]",
     .override = override,
@@ -380,7 +381,7 @@ startmonitor(void)
     strncpy(perf->defaultfqdn, "(uninitialized)", sizeof(perf->defaultfqdn));
     perf->defaultfqdn[sizeof(perf->defaultfqdn)-1] = '\0';
 
-    perf->version = 1;
+    perf->version = PMIE_STATS_VERSION;
 }
 
 
@@ -465,6 +466,7 @@ getargs(int argc, char *argv[])
     char		*subopts;
     char		*subopt;
     char		*msg;
+    char		*endnum;
     int			checkFlag = 0;
     int			foreground = 0;
     int			sts;
@@ -571,6 +573,15 @@ getargs(int argc, char *argv[])
 	    isdaemon = 1;
 	    break;
 
+	case 'P':			/* concurrent host fetches */
+	    fetchThreads = (int)strtol(opts.optarg, &endnum, 10);
+	    if (*endnum != '\0' || fetchThreads < 0) {
+		pmprintf("%s: -P requires a non-negative number of threads\n",
+			pmProgname);
+		opts.errors++;
+	    }
+	    break;
+
 	case 'U': 			/* run as named user */
 	    username = opts.optarg;
 	    isdaemon = 1;
@@ -931,6 +942,14 @@ main(int argc, char **argv)
     if (getenv("PCP_COUNTER_WRAP") != NULL)
 	dowrap = 1;
 
+    /* PMIE_NOFUSE in environment evaluates each operator separately */
+    if (getenv("PMIE_NOFUSE") != NULL)
+	dofuse = 0;
+
+    /* PMIE_NOSHARE in environment evaluates each rule separately */
+    if (getenv("PMIE_NOSHARE") != NULL)
+	doshare = 0;
+
     getargs(argc, argv);
 
     if (interactive)
@@ -25,11 +25,13 @@
 
 #include <math.h>
 #include <ctype.h>
+#include <signal.h>
 #include "pmapi.h"
 #include "impl.h"
 #include "dstruct.h"
 #include "eval.h"
 #include "pragmatics.h"
+#include "share.h"
 #if defined(HAVE_IEEEFP_H)
 #include <ieeefp.h>
 #endif
@@ -272,6 +274,9 @@ findFetch(Host *h, Metric *m)
     pmID	    *p;
     struct timeval  tv;
 
+    /* a fetch thread may still be using the Fetch bundle */
+    fetchWait(h);
+
     /* find existing Fetch bundle */
     f = h->fetches;
 
@@ -402,6 +407,9 @@ bundle(Task *t, Expr *x)
     int		i;
 
     if (x->op == CND_FETCH) {
+	if (x->metrics->host != NULL)
+	    /* shared with a rule bundled before, see share.c */
+	    return;
 	m = x->metrics;
 	for (i = 0; i < x->hdom; i++) {
 	    h = findHost(t, m);
@@ -809,6 +817,60 @@ end:
 }
 
 
+/*
+ * re-shape, starting here are working up the expression until
+ * we reach the top of the tree or the designated metrics
+ * associated with the node are not the same
+ */
+static void
+reshape(Expr *x, Metric *m)
+{
+    int		i;
+
+    while (x) {
+	/*
+	 * only re-shape expressions that may have set values
+	 */
+	if (x->op == CND_FETCH ||
+	    x->op == CND_NEG || x->op == CND_ADD || x->op == CND_SUB ||
+	    x->op == CND_MUL || x->op == CND_DIV ||
+	    x->op == CND_SUM_HOST || x->op == CND_SUM_INST ||
+	    x->op == CND_SUM_TIME ||
+	    x->op == CND_AVG_HOST || x->op == CND_AVG_INST ||
+	    x->op == CND_AVG_TIME ||
+	    x->op == CND_MAX_HOST || x->op == CND_MAX_INST ||
+	    x->op == CND_MAX_TIME ||
+	    x->op == CND_MIN_HOST || x->op == CND_MIN_INST ||
+	    x->op == CND_MIN_TIME ||
+	    x->op == CND_EQ || x->op == CND_NEQ ||
+	    x->op == CND_LT || x->op == CND_LTE ||
+	    x->op == CND_GT || x->op == CND_GTE ||
+	    x->op == CND_NOT || x->op == CND_AND || x->op == CND_OR ||
+	    x->op == CND_RISE || x->op == CND_FALL || x->op == CND_INSTANT ||
+	    x->op == CND_MATCH || x->op == CND_NOMATCH) {
+	    instFetchExpr(x);
+	    findEval(x);
+#if PCP_DEBUG
+	    if (pmDebug & DBG_TRACE_APPL1) {
+		fprintf(stderr, "reinitMetric: re-shaped ...\n");
+		dumpExpr(x);
+	    }
+#endif
+	}
+	/* the other parents of a shared subexpression, see share.c */
+	for (i = 0; i < x->nshare; i++) {
+	    if (x->share[i]->metrics == m)
+		reshape(x->share[i], m);
+	}
+	if (x->parent) {
+	    x = x->parent;
+	    if (x->metrics == m)
+		continue;
+	}
+	break;
+    }
+}
+
 /* reinitialize Metric - only for live host */
 int      /* 1: ok, 0: try again later, -1: fail */
 reinitMetric(Metric *m)
@@ -960,51 +1022,8 @@ reinitMetric(Metric *m)
 	}
     }
 
-    if (ret >= 0) {
-	/*
-	 * re-shape, starting here are working up the expression until
-	 * we reach the top of the tree or the designated metrics
-	 * associated with the node are not the same
-	 */
-	Expr	*x = m->expr;
-	while (x) {
-	    /*
-	     * only re-shape expressions that may have set values
-	     */
-	    if (x->op == CND_FETCH ||
-		x->op == CND_NEG || x->op == CND_ADD || x->op == CND_SUB ||
-		x->op == CND_MUL || x->op == CND_DIV ||
-		x->op == CND_SUM_HOST || x->op == CND_SUM_INST ||
-		x->op == CND_SUM_TIME ||
-		x->op == CND_AVG_HOST || x->op == CND_AVG_INST ||
-		x->op == CND_AVG_TIME ||
-		x->op == CND_MAX_HOST || x->op == CND_MAX_INST ||
-		x->op == CND_MAX_TIME ||
-		x->op == CND_MIN_HOST || x->op == CND_MIN_INST ||
-		x->op == CND_MIN_TIME ||
-		x->op == CND_EQ || x->op == CND_NEQ ||
-		x->op == CND_LT || x->op == CND_LTE ||
-		x->op == CND_GT || x->op == CND_GTE ||
-		x->op == CND_NOT || x->op == CND_AND || x->op == CND_OR ||
-		x->op == CND_RISE || x->op == CND_FALL || x->op == CND_INSTANT ||
-		x->op == CND_MATCH || x->op == CND_NOMATCH) {
-		instFetchExpr(x);
-		findEval(x);
-#if PCP_DEBUG
-		if (pmDebug & DBG_TRACE_APPL1) {
-		    fprintf(stderr, "reinitMetric: re-shaped ...\n");
-		    dumpExpr(x);
-		}
-#endif
-	    }
-	    if (x->parent) {
-		x = x->parent;
-		if (x->metrics == m)
-		    continue;
-	    }
-	    break;
-	}
-    }
+    if (ret >= 0)
+	reshape(m->expr, m);
 
 end:
     /* destroy temporary context */
@@ -1060,6 +1079,7 @@ pragmatics(Symbol rule, RealTime delta)
 
     if (x->op != NOP) {
 	t = findTask(delta);
+	shareExpr(t, x);
 	bundle(t, x);
 	t->nrules++;
 	t->rules = (Symbol *) ralloc(t->rules, t->nrules * sizeof(Symbol));
@@ -1093,6 +1113,235 @@ mark_all(Host *hdown)
     }
 }
 
+/*
+ * Concurrent fetches for the Hosts of a Task.
+ *
+ * Each live Host is queued for a pool of fetch threads (started on
+ * demand, at most fetchThreads of them), which pmFetch from all of the
+ * Host's contexts into f->fresult - the current context is private to
+ * each thread.  The evaluator waits until every Host is done, or until
+ * half a sample interval has passed, so evaluation takes as long as the
+ * slowest Host rather than the sum of all of them.  A Host that is
+ * still busy then is evaluated without values, and the result that it
+ * eventually returns is used for the next evaluation (rather than
+ * fetching again), so a slow pmcd never holds up the other Hosts.
+ *
+ * h->fetching is FETCH_IDLE while the evaluator owns the Host, and is
+ * only changed with fetchlock held.  All Host state changes and error
+ * reporting happen here, in the evaluator thread.
+ */
+#define FETCH_IDLE	0	/* not queued, results (if any) collected */
+#define FETCH_BUSY	1	/* queued or being fetched by a thread */
+#define FETCH_DONE	2	/* fetched, results not yet collected */
+
+#define LATE_NO		0	/* h->late: fetches are on time */
+#define LATE_YES	1	/* missed the deadline */
+#define LATE_RETRY	2	/* was late, fetching again */
+
+static pthread_mutex_t	fetchlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	fetchwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	fetchdone = PTHREAD_COND_INITIALIZER;
+static Host		**fetchq;	/* Hosts waiting for a fetch thread */
+static int		fetchqhead;
+static int		fetchqtail;
+static int		fetchqsize;
+static int		nthreads;	/* fetch threads started */
+
+static void *
+fetchThread(void *arg)
+{
+    Host	*h;
+    Fetch	*f;
+    int		sts;
+
+    pthread_mutex_lock(&fetchlock);
+    for ( ; ; ) {
+	while (fetchqhead == fetchqtail)
+	    pthread_cond_wait(&fetchwork, &fetchlock);
+	h = fetchq[fetchqhead++ % fetchqsize];
+	if (fetchqhead == fetchqtail)
+	    fetchqhead = fetchqtail = 0;
+	pthread_mutex_unlock(&fetchlock);
+
+	sts = 0;
+	for (f = h->fetches; f; f = f->next)
+	    f->fresult = NULL;
+	for (f = h->fetches; f; f = f->next) {
+	    if ((sts = pmUseContext(f->handle)) < 0 ||
+		(sts = pmFetch(f->npmids, f->pmids, &f->fresult)) < 0) {
+		f->fresult = NULL;
+		break;
+	    }
+	}
+
+	pthread_mutex_lock(&fetchlock);
+	h->fsts = sts;
+	h->fetching = FETCH_DONE;
+	pthread_cond_broadcast(&fetchdone);
+    }
+    return NULL;
+}
+
+/* start fetch threads (up to fetchThreads), returns number running */
+static int
+fetchThreadStart(int want)
+{
+    pthread_attr_t	attr;
+    pthread_t		tid;
+    sigset_t		all, save;
+    int			sts;
+
+    if (want > fetchThreads)
+	want = fetchThreads;
+    if (nthreads >= want)
+	return nthreads;
+
+    /* signals are for the evaluator, not the fetch threads */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &save);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    while (nthreads < want) {
+	if ((sts = pthread_create(&tid, &attr, fetchThread, NULL)) != 0) {
+	    __pmNotifyErr(LOG_WARNING, "cannot start fetch thread: %s\n",
+			pmErrStr(-sts));
+	    fetchThreads = nthreads;	/* do not try again */
+	    break;
+	}
+	nthreads++;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &save, NULL);
+    return nthreads;
+}
+
+/* queue Host for a fetch thread, called with fetchlock held */
+static void
+fetchQueue(Host *h)
+{
+    Host	**q;
+    int		i, n;
+
+    if (fetchqtail - fetchqhead == fetchqsize) {
+	n = fetchqsize ? 2 * fetchqsize : 32;
+	q = (Host **)alloc(n * sizeof(Host *));
+	for (i = 0; fetchqhead + i < fetchqtail; i++)
+	    q[i] = fetchq[(fetchqhead + i) % fetchqsize];
+	if (fetchq) free(fetchq);
+	fetchq = q;
+	fetchqsize = n;
+	fetchqhead = 0;
+	fetchqtail = i;
+    }
+    h->fetching = FETCH_BUSY;
+    fetchq[fetchqtail++ % fetchqsize] = h;
+}
+
+void
+fetchWait(Host *h)
+{
+    pthread_mutex_lock(&fetchlock);
+    while (h->fetching == FETCH_BUSY)
+	pthread_cond_wait(&fetchdone, &fetchlock);
+    pthread_mutex_unlock(&fetchlock);
+}
+
+/* collect fetch thread results for Host, called with fetchlock held */
+static void
+fetchCollect(Host *h)
+{
+    Fetch	*f;
+
+    for (f = h->fetches; f; f = f->next) {
+	if (f->result) pmFreeResult(f->result);
+	f->result = f->fresult;
+	f->fresult = NULL;
+    }
+    h->fetching = FETCH_IDLE;
+    if (h->late == LATE_RETRY) {
+	/* was late, but this fetch made its deadline */
+	if (! quiet)
+	    __pmNotifyErr(LOG_INFO, "pmFetch from %s is no longer late\n",
+			symName(h->name));
+	h->late = LATE_NO;
+    }
+    if (h->fsts < 0) {
+	__pmNotifyErr(LOG_ERR, "pmFetch from %s failed: %s\n",
+			symName(h->name), pmErrStr(h->fsts));
+	host_state_changed(symName(h->conn), STATE_LOSTCONN);
+	h->down = 1;
+	mark_all(h);
+	for (f = h->fetches; f; f = f->next) {
+	    if (f->result) pmFreeResult(f->result);
+	    f->result = NULL;
+	}
+    }
+}
+
+/* do all fetches for Task concurrently, false if that is not possible */
+static int
+taskFetchThreads(Task *t)
+{
+    Host		*h;
+    Fetch		*f;
+    struct timeval	tv;
+    struct timespec	deadline;
+    int			n = 0;
+    int			busy;
+
+    for (h = t->hosts; h; h = h->next)
+	n++;
+    if (n < 2 || fetchThreadStart(n) == 0)
+	return 0;
+
+    pthread_mutex_lock(&fetchlock);
+    for (h = t->hosts; h; h = h->next) {
+	if (h->fetching != FETCH_IDLE)
+	    continue;	/* late from a previous evaluation */
+	for (f = h->fetches; f; f = f->next) {
+	    if (f->result) pmFreeResult(f->result);
+	    f->result = NULL;
+	}
+	if (! h->down && h->fetches) {
+	    if (h->late)
+		h->late = LATE_RETRY;
+	    fetchQueue(h);
+	}
+    }
+    pthread_cond_broadcast(&fetchwork);
+
+    /*
+     * wait for all Hosts, for at most half a sample interval, leaving
+     * the other half for evaluation and the sleep until the next one
+     */
+    gettimeofday(&tv, NULL);
+    __pmtimevalFromReal(__pmtimevalToReal(&tv) + t->delta / 2, &tv);
+    deadline.tv_sec = tv.tv_sec;
+    deadline.tv_nsec = tv.tv_usec * 1000;
+    for ( ; ; ) {
+	for (busy = 0, h = t->hosts; h; h = h->next) {
+	    if (h->fetching == FETCH_BUSY)
+		busy++;
+	}
+	if (! busy ||
+	    pthread_cond_timedwait(&fetchdone, &fetchlock, &deadline) == ETIMEDOUT)
+	    break;
+    }
+
+    for (h = t->hosts; h; h = h->next) {
+	if (h->fetching == FETCH_DONE)
+	    fetchCollect(h);
+	else if (h->fetching == FETCH_BUSY) {
+	    if (h->late == LATE_NO && ! quiet)
+		__pmNotifyErr(LOG_WARNING, "pmFetch from %s is late, "
+			"evaluating without it\n", symName(h->name));
+	    h->late = LATE_YES;
+	}
+    }
+    pthread_mutex_unlock(&fetchlock);
+    return 1;
+}
+
 /* execute fetches for given Task */
 void
 taskFetch(Task *t)
@@ -1107,29 +1356,31 @@ taskFetch(Task *t)
     int		sts;
 
     /* do all fetches, quick as you can */
-    h = t->hosts;
-    while (h) {
-	f = h->fetches;
-	while (f) {
-	    if (f->result) pmFreeResult(f->result);
-	    if (! h->down) {
-		pmUseContext(f->handle);
-		if ((sts = pmFetch(f->npmids, f->pmids, &f->result)) < 0) {
-		    if (! archives) {
-			__pmNotifyErr(LOG_ERR, "pmFetch from %s failed: %s\n",
-				symName(f->host->name), pmErrStr(sts));
-			host_state_changed(symName(f->host->conn), STATE_LOSTCONN);
-			h->down = 1;
-			mark_all(h);
+    if (archives || fetchThreads <= 0 || ! taskFetchThreads(t)) {
+	h = t->hosts;
+	while (h) {
+	    f = h->fetches;
+	    while (f) {
+		if (f->result) pmFreeResult(f->result);
+		if (! h->down) {
+		    pmUseContext(f->handle);
+		    if ((sts = pmFetch(f->npmids, f->pmids, &f->result)) < 0) {
+			if (! archives) {
+			    __pmNotifyErr(LOG_ERR, "pmFetch from %s failed: %s\n",
+				    symName(f->host->name), pmErrStr(sts));
+			    host_state_changed(symName(f->host->conn), STATE_LOSTCONN);
+			    h->down = 1;
+			    mark_all(h);
+			}
+			f->result = NULL;
 		    }
-		    f->result = NULL;
 		}
+		else
+		    f->result = NULL;
+		f = f->next;
 	    }
-	    else
-		f->result = NULL;
-	    f = f->next;
+	    h = h->next;
 	}
-	h = h->next;
     }
 
     /* sort and distribute pmValueSets to requesting Metrics */
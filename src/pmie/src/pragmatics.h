@@ -67,6 +67,9 @@ void pragmatics(Symbol, RealTime);
 /* execute fetches for given Task */
 void taskFetch(Task *);
 
+/* wait for any fetch thread still busy with Host */
+void fetchWait(Host *);
+
 /* convert Expr value to pmValueSet value */
 void fillVSet(Expr *, pmValueSet *);
 
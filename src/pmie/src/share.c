@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/***********************************************************************
+ * share.c
+ *
+ * Rules generated by pmieconf repeat the same subexpressions, e.g.
+ *	kernel.all.cpu.user / hinv.ncpu
+ * in dozens of rules, and each copy is fetched, converted and evaluated
+ * separately.  As each rule is handed to pragmatics analysis, its
+ * subexpressions are looked up (bottom up) in a table of those already
+ * seen for the same Task, and an identical subexpression found there
+ * replaces the new copy, so it is evaluated only once per sample.
+ *
+ * A shared Expr keeps its first parent in x->parent and the others in
+ * x->share[], so that changes in the instance domain reach all of them.
+ * EVALARG() evaluates a shared Expr only on the first call for each
+ * pass of eval(), the other parents use the values already computed.
+ *
+ * The root of a rule is never shared, nor is anything below an
+ * action.  A metric below an "instant" operator is not converted to
+ * a rate, so subexpressions are only shared with others in the same
+ * context.
+ ***********************************************************************/
+
+#include "pmapi.h"
+#include "impl.h"
+#include "dstruct.h"
+#include "fun.h"
+#include "show.h"
+
+unsigned int	shareEpoch = 1;
+
+/* entry in the table of shareable subexpressions */
+typedef struct {
+    Expr	*x;
+    Task	*task;		/* Task evaluating x */
+    int		instant;	/* below a CND_INSTANT operator? */
+} Share;
+
+static __pmHashCtl	table;
+
+
+/***********************************************************************
+ * identity of subexpressions
+ ***********************************************************************/
+
+#define MIX(h, v)	((h) * 31 + (unsigned int)(v))
+
+static unsigned int
+hashPtr(unsigned int h, const void *p)
+{
+    __psint_t	v = (__psint_t)p;
+
+    h = MIX(h, v);
+    if (sizeof(v) > sizeof(h))
+	h = MIX(h, (__uint64_t)v >> 32);
+    return h;
+}
+
+static unsigned int
+hashBytes(unsigned int h, const void *p, size_t len)
+{
+    const unsigned char	*c = (const unsigned char *)p;
+
+    while (len-- > 0)
+	h = MIX(h, *c++);
+    return h;
+}
+
+/* constants that can be compared by value */
+static int
+isConst(Expr *x)
+{
+    if (x->smpls[0].ptr == NULL)
+	return 0;
+    return x->sem == SEM_NUMCONST || x->sem == SEM_BOOLEAN ||
+	   x->sem == SEM_CHAR;
+}
+
+static unsigned int
+hashArg(unsigned int h, Expr *x)
+{
+    if (x == NULL)
+	return MIX(h, 0);
+    if (x->op != NOP)
+	return hashPtr(h, x);
+    h = MIX(h, x->sem);
+    switch (x->sem) {
+    case SEM_NUMCONST:
+	return hashBytes(h, x->smpls[0].ptr, sizeof(double));
+    case SEM_BOOLEAN:
+	return hashBytes(h, x->smpls[0].ptr, sizeof(Boolean));
+    case SEM_CHAR:
+	return hashBytes(h, x->smpls[0].ptr, strlen((char *)x->smpls[0].ptr));
+    }
+    return hashPtr(h, x);
+}
+
+/*
+ * only fields that do not change after parsing are used here, so the
+ * hash of an Expr in the table can be found again by forgetExpr()
+ */
+static unsigned int
+hashExpr(Expr *x)
+{
+    unsigned int	h = x->op;
+    Metric		*m;
+    int			i, j;
+
+    h = MIX(h, x->hdom);
+    h = MIX(h, x->tdom);
+    h = MIX(h, x->nsmpls);
+    h = hashArg(h, x->arg1);
+    h = hashArg(h, x->arg2);
+    if (x->op == CND_FETCH) {
+	for (m = x->metrics, i = 0; i < x->hdom; m++, i++) {
+	    h = hashPtr(h, m->mname);
+	    h = hashPtr(h, m->hconn);
+	    h = MIX(h, m->specinst);
+	    for (j = 0; j < m->specinst; j++)
+		h = hashBytes(h, m->inames[j], strlen(m->inames[j]));
+	}
+    }
+    return h;
+}
+
+static int
+sameArg(Expr *a, Expr *b)
+{
+    if (a == b)
+	return 1;
+    if (a == NULL || b == NULL || a->op != NOP || b->op != NOP)
+	return 0;
+    if (a->sem != b->sem || !isConst(a) || !isConst(b))
+	return 0;
+    switch (a->sem) {
+    case SEM_NUMCONST:
+	return *(double *)a->smpls[0].ptr == *(double *)b->smpls[0].ptr;
+    case SEM_BOOLEAN:
+	return *(Boolean *)a->smpls[0].ptr == *(Boolean *)b->smpls[0].ptr;
+    }
+    return strcmp((char *)a->smpls[0].ptr, (char *)b->smpls[0].ptr) == 0;
+}
+
+static int
+sameMetrics(Expr *a, Expr *b)
+{
+    Metric	*ma = a->metrics;
+    Metric	*mb = b->metrics;
+    int		i, j;
+
+    for (i = 0; i < a->hdom; i++, ma++, mb++) {
+	if (ma->mname != mb->mname || ma->hconn != mb->hconn ||
+	    ma->specinst != mb->specinst || ma->m_idom != mb->m_idom)
+	    return 0;
+	for (j = 0; j < ma->specinst; j++) {
+	    if (strcmp(ma->inames[j], mb->inames[j]) != 0)
+		return 0;
+	}
+    }
+    return 1;
+}
+
+static int
+sameExpr(Share *s, Task *t, int instant, Expr *x)
+{
+    Expr	*y = s->x;
+
+    if (s->task != t || s->instant != instant)
+	return 0;
+    if (y->op != x->op || y->hdom != x->hdom || y->e_idom != x->e_idom ||
+	y->tdom != x->tdom || y->nsmpls != x->nsmpls ||
+	y->tspan != x->tspan || y->sem != x->sem ||
+	memcmp(&y->units, &x->units, sizeof(pmUnits)) != 0)
+	return 0;
+    if (!sameArg(y->arg1, x->arg1) || !sameArg(y->arg2, x->arg2))
+	return 0;
+    if (x->op == CND_FETCH && !sameMetrics(y, x))
+	return 0;
+    return 1;
+}
+
+/* operators whose value depends only on their operands */
+static int
+shareable(int op)
+{
+    return (op >= CND_FETCH && op <= CND_MIN_TIME) ||
+	   (op >= CND_EQ && op <= CND_GTE) ||
+	   (op >= CND_NOT && op <= CND_NOMATCH) ||
+	   (op >= CND_ALL_HOST && op <= CND_COUNT_TIME);
+}
+
+
+/***********************************************************************
+ * replacement
+ ***********************************************************************/
+
+/* add another parent to a shared Expr */
+static void
+addParent(Expr *x, Expr *parent)
+{
+    if (x->parent == NULL) {
+	x->parent = parent;
+	return;
+    }
+    x->share = (Expr **) ralloc(x->share, (x->nshare + 1) * sizeof(Expr *));
+    x->share[x->nshare++] = parent;
+}
+
+/* replace operand *argp of x, a copy of y, by y */
+static void
+replace(Expr *x, Expr **argp, Expr *y)
+{
+    Expr	*old = *argp;
+    Expr	*p;
+
+    /* parents inherited the Metrics of the copy, see newExpr() */
+    for (p = x; p != NULL; p = p->parent) {
+	if (p->metrics == old->metrics)
+	    p->metrics = y->metrics;
+    }
+
+    *argp = y;
+    addParent(y, x);
+    freeExpr(old);
+
+    /* fused trees cannot evaluate a shared Expr as one of their steps */
+    fuseExpr(y);
+    staleFuse(x);
+}
+
+/*
+ * look up the subexpressions of x bottom up, and return the Expr that
+ * x should be replaced by (x itself if it is not to be replaced) ...
+ * *ok is set if the result can be an operand of a shared subexpression
+ */
+static Expr *
+cons(Task *t, Expr *x, int root, int instant, int *ok)
+{
+    __pmHashNode	*hp;
+    Share		*s;
+    Expr		*y;
+    unsigned int	h;
+    int			ok1 = 1;
+    int			ok2 = 1;
+
+    *ok = 0;
+    if (x->op == NOP) {
+	*ok = isConst(x);
+	return x;
+    }
+    if (x->op >= ACT_SEQ)
+	return x;
+
+    if (x->op == CND_INSTANT)
+	instant = 1;
+    if (x->arg1) {
+	y = cons(t, x->arg1, 0, instant, &ok1);
+	if (y != x->arg1)
+	    replace(x, &x->arg1, y);
+    }
+    if (x->arg2) {
+	y = cons(t, x->arg2, 0, instant, &ok2);
+	if (y != x->arg2)
+	    replace(x, &x->arg2, y);
+    }
+
+    if (root || !shareable(x->op) || !ok1 || !ok2)
+	return x;
+
+    perf->subexprs++;
+    *ok = 1;
+    h = hashExpr(x);
+    for (hp = __pmHashSearch(h, &table); hp != NULL; hp = hp->next) {
+	if (hp->key != h)
+	    continue;
+	s = (Share *)hp->data;
+	if (sameExpr(s, t, instant, x)) {
+	    perf->shared++;
+#if PCP_DEBUG
+	    if (pmDebug & DBG_TRACE_APPL1) {
+		fprintf(stderr, "shareExpr: " PRINTF_P_PFX "%p replaced by " PRINTF_P_PFX "%p\n", x, s->x);
+		__dumpExpr(1, s->x);
+	    }
+#endif
+	    return s->x;
+	}
+    }
+
+    s = (Share *) alloc(sizeof(Share));
+    s->x = x;
+    s->task = t;
+    s->instant = instant;
+    if (__pmHashAdd(h, s, &table) < 0)
+	__pmNoMem("pmie.shareExpr", sizeof(__pmHashNode), PM_FATAL_ERR);
+    return x;
+}
+
+
+/***********************************************************************
+ * exported functions
+ ***********************************************************************/
+
+/* replace subexpressions of a rule by identical ones already in Task */
+void
+shareExpr(Task *t, Expr *x)
+{
+    int		ok;
+
+    if (doshare)
+	cons(t, x, 1, 0, &ok);
+}
+
+/* drop parent from a shared Expr, return 1 if others still use it */
+int
+unshareExpr(Expr *x, Expr *parent)
+{
+    int		i;
+
+    if (x->nshare == 0)
+	return 0;
+    if (x->parent == parent)
+	x->parent = x->share[--x->nshare];
+    else {
+	for (i = 0; i < x->nshare; i++) {
+	    if (x->share[i] == parent) {
+		x->share[i] = x->share[--x->nshare];
+		break;
+	    }
+	}
+    }
+    return 1;
+}
+
+/* remove Expr from the table of shareable subexpressions */
+void
+forgetExpr(Expr *x)
+{
+    __pmHashNode	*hp;
+    unsigned int	h;
+
+    if (table.nodes == 0 || x->op == NOP || !shareable(x->op))
+	return;
+    h = hashExpr(x);
+    for (hp = __pmHashSearch(h, &table); hp != NULL; hp = hp->next) {
+	if (hp->key == h && ((Share *)hp->data)->x == x) {
+	    void	*data = hp->data;
+
+	    __pmHashDel(h, data, &table);
+	    free(data);
+	    return;
+	}
+    }
+}
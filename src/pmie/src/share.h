@@ -0,0 +1,32 @@
+/***********************************************************************
+ * share.h - common subexpressions shared between rules
+ ***********************************************************************
+ *
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+#ifndef SHARE_H
+#define SHARE_H
+
+/* evaluation pass, advanced once per Task evaluation */
+extern unsigned int shareEpoch;
+
+/* replace subexpressions of a rule by identical ones already in Task */
+void shareExpr(Task *, Expr *);
+
+/* drop parent from a shared Expr, return 1 if others still use it */
+int unshareExpr(Expr *, Expr *);
+
+/* remove Expr from the table of shareable subexpressions */
+void forgetExpr(Expr *);
+
+#endif /* SHARE_H */
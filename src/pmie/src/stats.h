@@ -14,6 +14,7 @@
 #ifndef STATS_H
 #define STATS_H
 
+#include <stddef.h>
 #include <sys/types.h>
 #include <sys/param.h>
 
@@ -33,6 +34,13 @@ typedef struct {
     unsigned int	eval_unknown;		/* pmcd.pmie.eval.unknown  */
     unsigned int	eval_actual;		/* pmcd.pmie.eval.actual   */
     unsigned int	version;
+    /* version 2 and later */
+    unsigned int	subexprs;		/* pmcd.pmie.expr.total    */
+    unsigned int	shared;			/* pmcd.pmie.expr.shared   */
 } pmiestats_t;
 
+#define PMIE_STATS_VERSION	2
+/* size of the version 1 layout */
+#define PMIE_STATS_V1_SIZE	offsetof(pmiestats_t, subexprs)
+
 #endif /* STATS_H */
@@ -63,8 +63,11 @@ CONTROLDIR=$PCP_PMLOGGERCONTROL_PATH.d
 CULLAFTER=14
 
 # default compression program and days until starting compression
+# (bounded xz block sizes let libpcp seek within compressed volumes,
+# but --block-size needs xz 5.2 or later)
 # 
-COMPRESS=xz
+COMPRESS="xz --block-size=1MiB"
+echo | $COMPRESS >/dev/null 2>&1 || COMPRESS=xz
 COMPRESSAFTER=""
 COMPRESSREGEX="\.(meta|index|Z|gz|bz2|zip|xz|lzma|lzo|lz4)$"
 
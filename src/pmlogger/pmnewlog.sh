@@ -65,10 +65,13 @@ pmnewlog options:
 
 pmlogger options:
   --debug
+  -b=SIZE, --writebuf=SIZE queue up to SIZE bytes for the archive writer thread
   -c=FILE, --config=FILE  file to load configuration from
+  -F=POLICY, --sync=POLICY flush archive writes to disk: none or index
   -l=FILE, --log=FILE     redirect diagnostics and trace output
   -L, --linger            run even if not primary logger instance and nothing to log
   -m=MSG, --note=MSG      descriptive note to be added to the port map file
+  -M=NAME, --mmv=NAME     export archive writer statistics as mmv.NAME metrics
   -n=FILE, --namespace=FILE use an alternative PMNS
   -K=SPEC, --spec-local=SPEC optional additional PMDA spec for local connection
   -o, --local-PMDA        metrics source is local connection to a PMDA
@@ -283,7 +286,7 @@ do
 		args="${args}$1 "
 		;;
 
-	-D|-K|-m|-t|-T|-v)
+	-b|-D|-F|-K|-m|-M|-t|-T|-v)
 		args="${args}$1 $2 "
 		shift
 		;;
@@ -569,7 +569,7 @@ do_work(task_t *tp)
 		fprintf(stderr, "__pmLogPutResult2: %s\n", pmErrStr(sts));
 		exit(1);
 	    }
-	    __pmOverrideLastFd(fileno(logctl.l_mfp));
+	    __pmOverrideLastFd(writer_fileno(logctl.l_mfp));
 	}
 	resp = NULL; /* silence coverity */
 	if ((sts = __pmDecodeResult(pb, &resp)) < 0) {
@@ -596,7 +596,7 @@ do_work(task_t *tp)
 		if (IS_DERIVED(vsp->pmid))
 		    vsp->pmid = SET_DERIVED_LOGGED(vsp->pmid);
 	    }
-	    if ((sts = __pmEncodeResult(fileno(logctl.l_mfp), resp, &pdubuf)) < 0) {
+	    if ((sts = __pmEncodeResult(writer_fileno(logctl.l_mfp), resp, &pdubuf)) < 0) {
 		fprintf(stderr, "__pmEncodeResult: %s\n", pmErrStr(sts));
 		exit(1);
 	    }
@@ -605,7 +605,7 @@ do_work(task_t *tp)
 		exit(1);
 	    }
 	    __pmUnpinPDUBuf(pdubuf);
-	    __pmOverrideLastFd(fileno(logctl.l_mfp));
+	    __pmOverrideLastFd(writer_fileno(logctl.l_mfp));
 	    for (i = 0; i < resp->numpmid; i++) {
 		pmValueSet	*vsp = resp->vset[i];
 		if (IS_DERIVED_LOGGED(vsp->pmid))
@@ -1359,12 +1359,12 @@ do_request(__pmPDU *pb)
 
 	case LOG_REQUEST_SYNC:
 	    /*
-	     * Don't need to check access controls, as this is now
-	     * a no-op with unbuffered I/O from pmlogger.
-	     *
-	     * Do nothing, simply send status 0 back to pmlc.
+	     * Don't need to check access controls, as this only waits
+	     * for the archive writer to catch up (all I/O is otherwise
+	     * unbuffered from pmlogger).
 	     */
-	    sts = __pmSendError(clientfd, FROM_ANON, 0);
+	    sts = writer_sync();
+	    sts = __pmSendError(clientfd, FROM_ANON, sts);
 	    break;
 
 	/*
@@ -175,6 +175,18 @@ extern __int64_t	exit_bytes;
 extern __int64_t	vol_bytes;
 extern int		exit_code;
 
+/* asynchronous archive writer, see writer.c */
+#define WRITER_SYNC_NONE	0	/* leave flushing to the kernel */
+#define WRITER_SYNC_INDEX	1	/* fdatasync before temporal index entries */
+extern int	writer_bufsize;
+extern int	writer_policy;
+extern FILE *writer_open(FILE *, int);
+extern int writer_fileno(FILE *);
+extern int writer_sync(void);
+extern void writer_stop(void);
+extern void writer_abort(void);
+extern void writer_mmv(const char *);
+
 /* event record handling */
 extern int do_events(pmValueSet *);
 
@@ -464,13 +464,16 @@ failed:
 
 static pmLongOptions longopts[] = {
     PMAPI_OPTIONS_HEADER("Options"),
+    { "writebuf", 1, 'b', "SIZE", "queue up to SIZE bytes for the archive writer thread [default 1Mb]" },
     { "config", 1, 'c', "FILE", "file to load configuration from" },
     { "check", 0, 'C', 0, "parse configuration and exit" },
     PMOPT_DEBUG,
     PMOPT_HOST,
     { "log", 1, 'l', "FILE", "redirect diagnostics and trace output" },
+    { "sync", 1, 'F', "POLICY", "flush archive writes to disk: none or index [default none]" },
     { "linger", 0, 'L', 0, "run even if not primary logger instance and nothing to log" },
     { "note", 1, 'm', "MSG", "descriptive note to be added to the port map file" },
+    { "mmv", 1, 'M', "NAME", "export archive writer statistics as mmv.NAME metrics" },
     PMOPT_SPECLOCAL,
     { "local-PMDA", 0, 'o', 0, "metrics sourced without connecting to pmcd" },
     PMOPT_NAMESPACE,
@@ -491,7 +494,7 @@ static pmLongOptions longopts[] = {
 };
 
 static pmOptions opts = {
-    .short_options = "c:CD:h:l:K:Lm:n:op:Prs:T:t:uU:v:V:x:y?",
+    .short_options = "b:c:CD:F:h:l:K:Lm:M:n:op:Prs:T:t:uU:v:V:x:y?",
     .long_options = longopts,
     .short_usage = "[options] archive",
 };
@@ -559,6 +562,10 @@ main(int argc, char **argv)
     __pmContext  	*ctxp;		/* pmlogger has just this one context */
     int			niter;
     pid_t               target_pid = 0;
+    char		*mmvname = NULL;
+    int			samples;
+    __int64_t		bytes;
+    struct timeval	interval;
 
     __pmGetUsername(&username);
     sep = __pmPathSeparator();
@@ -572,6 +579,19 @@ main(int argc, char **argv)
     while ((c = pmgetopt_r(argc, argv, &opts)) != EOF) {
 	switch (c) {
 
+	case 'b':		/* archive writer queue size */
+	    if (strcmp(opts.optarg, "0") == 0)
+		writer_bufsize = 0;
+	    else if (ParseSize(opts.optarg, &samples, &bytes, &interval) < 0 ||
+		     interval.tv_sec > 0 || bytes > INT_MAX || samples > INT_MAX) {
+		pmprintf("%s: illegal size argument '%s' for writer queue size\n",
+			pmProgname, opts.optarg);
+		opts.errors++;
+	    }
+	    else	/* a plain number is bytes here */
+		writer_bufsize = (bytes > 0) ? (int)bytes : samples;
+	    break;
+
 	case 'c':		/* config file */
 	    if (access(opts.optarg, F_OK) == 0)
 		configfile = strdup(opts.optarg);
@@ -607,6 +627,18 @@ main(int argc, char **argv)
 		pmDebug |= sts;
 	    break;
 
+	case 'F':		/* archive writer sync policy */
+	    if (strcmp(opts.optarg, "none") == 0)
+		writer_policy = WRITER_SYNC_NONE;
+	    else if (strcmp(opts.optarg, "index") == 0)
+		writer_policy = WRITER_SYNC_INDEX;
+	    else {
+		pmprintf("%s: -F requires a policy of \"none\" or \"index\"\n",
+			pmProgname);
+		opts.errors++;
+	    }
+	    break;
+
 	case 'h':		/* hostname for PMCD to contact */
 	    pmcd_host_conn = opts.optarg;
 	    break;
@@ -633,6 +665,10 @@ main(int argc, char **argv)
 			(strcmp(note, "pmlogger_daily") == 0));
 	    break;
 
+	case 'M':		/* export writer statistics via MMV */
+	    mmvname = opts.optarg;
+	    break;
+
 	case 'n':		/* alternative name space file */
 	    pmnsfile = opts.optarg;
 	    break;
@@ -909,6 +945,12 @@ main(int argc, char **argv)
 	exit(1);
     }
     else {
+	if (mmvname != NULL)
+	    writer_mmv(mmvname);
+	logctl.l_tifp = writer_open(logctl.l_tifp, PM_LOG_VOL_TI);
+	logctl.l_mdfp = writer_open(logctl.l_mdfp, PM_LOG_VOL_META);
+	logctl.l_mfp = writer_open(logctl.l_mfp, 0);
+
 	/*
 	 * try and establish $TZ from the remote PMCD ...
 	 * Note the label record has been set up, but not written yet
@@ -1241,6 +1283,7 @@ newvolume(int vol_switch_type)
     }
 
     if ((newfp = __pmLogNewFile(archBase, nextvol)) != NULL) {
+	newfp = writer_open(newfp, nextvol);
 	if (logctl.l_state == PM_LOG_STATE_NEW) {
 	    /*
 	     * nothing has been logged as yet, force out the label records
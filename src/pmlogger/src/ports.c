@@ -42,15 +42,8 @@ int		ctlfds[CFD_NUM] = {-1, -1, -1};/* fds for control ports: */
 int		ctlport;	/* pmlogger control port number */
 
 static void
-cleanup(void)
+remove_ctlfiles(void)
 {
-    /*
-     * flush all stdio buffers, _then_ remove the control files ...
-     * we have QA than camps on the control file(s) and assumes the
-     * log file is complete once the control file(s) is removed.
-     */
-    fflush(NULL);
-
     if (linkfile != NULL)
 	unlink(linkfile);
     if (ctlfile != NULL)
@@ -61,6 +54,31 @@ cleanup(void)
 	unlink(socketPath);
 }
 
+static void
+cleanup(void)
+{
+    /*
+     * flush all stdio buffers, _then_ remove the control files ...
+     * we have QA than camps on the control file(s) and assumes the
+     * log file is complete once the control file(s) is removed.
+     */
+    fflush(NULL);
+    writer_stop();
+    remove_ctlfiles();
+}
+
+/*
+ * As for cleanup(), but from a signal handler, where the archive
+ * writer thread cannot be stopped and waited for.
+ */
+static void
+sig_cleanup(void)
+{
+    fflush(NULL);
+    writer_abort();
+    remove_ctlfiles();
+}
+
 static void
 sigexit_handler(int sig)
 {
@@ -68,7 +86,7 @@ sigexit_handler(int sig)
     if (pmDebug & DBG_TRACE_DESPERATE)
 	fprintf(stderr, "pmlogger: Signalled (signal=%d), exiting\n", sig);
 #endif
-    cleanup();
+    sig_cleanup();
     _exit(sig);
 }
 
@@ -95,7 +113,7 @@ sigcore_handler(int sig)
 	fprintf(stderr, "pmlogger: Signalled (signal=%d), exiting (core dumped)\n", sig);
 #endif
     __pmSetSignalHandler(SIGABRT, SIG_DFL);	/* Don't come back here */
-    cleanup();
+    sig_cleanup();
     _exit(sig);
 }
 
@@ -0,0 +1,657 @@
+/*
+ * Copyright (c) 2017 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+/*
+ * Asynchronous archive writer.
+ *
+ * Each archive file (data volume, metadata and temporal index) is
+ * replaced by a stdio stream (via fopencookie) that tracks the file
+ * position itself and queues each record written, with its offset, on
+ * a bounded ring.  A writer thread takes records off the ring in order
+ * and pwrite(2)s them, so the fetching, decoding and bookkeeping in
+ * do_work() overlap with the disk I/O, and only wait for the disk when
+ * more than writer_bufsize bytes are outstanding.
+ *
+ * Contiguous records for the same file are coalesced into one write.
+ * Records are written in the order they were queued, so a temporal
+ * index entry never reaches the disk before the data and metadata it
+ * refers to; with the "index" sync policy, these are also flushed
+ * with fdatasync(2) before each index entry is written.
+ *
+ * Write errors are reported on the next record queued for any file,
+ * so they take the usual error paths for a failed fwrite(3).
+ */
+
+#include "logger.h"
+#include "mmv_stats.h"
+
+int		writer_bufsize = 1024 * 1024;	/* bytes queued, 0 to not queue */
+int		writer_policy = WRITER_SYNC_NONE;
+
+#define WRITER_SLOTS	256		/* records queued */
+
+/* writer statistics, optionally exported via MMV */
+enum {
+    WS_QUEUED,		/* records queued, not yet written */
+    WS_QUEUED_BYTES,	/* bytes queued, not yet written */
+    WS_RECORDS,		/* records written */
+    WS_BYTES,		/* bytes written */
+    WS_WRITES,		/* write calls, after coalescing */
+    WS_STALLS,		/* times a record waited for queue space */
+    WS_LATENCY,		/* usec from queueing to written, all records */
+    WS_WRITE_TIME,	/* usec in pwrite */
+    WS_SYNC_TIME,	/* usec in fdatasync */
+    WS_NSTATS
+};
+
+static mmv_metric_t writer_metrics[] = {
+    {   .name = "writer.queued",
+	.item = WS_QUEUED,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_INSTANT,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+	.shorttext = "archive records queued for writing",
+    },
+    {   .name = "writer.queued_bytes",
+	.item = WS_QUEUED_BYTES,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_INSTANT,
+	.dimension = MMV_UNITS(1,0,0,PM_SPACE_BYTE,0,0),
+	.shorttext = "archive bytes queued for writing",
+    },
+    {   .name = "writer.records",
+	.item = WS_RECORDS,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+	.shorttext = "archive records written",
+    },
+    {   .name = "writer.bytes",
+	.item = WS_BYTES,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(1,0,0,PM_SPACE_BYTE,0,0),
+	.shorttext = "archive bytes written",
+    },
+    {   .name = "writer.writes",
+	.item = WS_WRITES,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+	.shorttext = "write system calls, after coalescing records",
+    },
+    {   .name = "writer.stalls",
+	.item = WS_STALLS,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,0,1,0,0,PM_COUNT_ONE),
+	.shorttext = "times logging waited for space in the writer queue",
+    },
+    {   .name = "writer.latency",
+	.item = WS_LATENCY,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,1,0,0,PM_TIME_USEC,0),
+	.shorttext = "total time from queueing to writing, over all records",
+    },
+    {   .name = "writer.write_time",
+	.item = WS_WRITE_TIME,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,1,0,0,PM_TIME_USEC,0),
+	.shorttext = "time spent writing archive records",
+    },
+    {   .name = "writer.sync_time",
+	.item = WS_SYNC_TIME,
+	.type = MMV_TYPE_U64,
+	.semantics = MMV_SEM_COUNTER,
+	.dimension = MMV_UNITS(0,1,0,0,PM_TIME_USEC,0),
+	.shorttext = "time spent in fdatasync for the index sync policy",
+    },
+};
+
+static __uint64_t	stats[WS_NSTATS];
+static pmAtomValue	*mmv_stats[WS_NSTATS];
+
+/*
+ * Export the writer statistics as mmv.<name>.writer.* ... the MMV
+ * cluster is derived from the name, so it is stable across restarts.
+ */
+void
+writer_mmv(const char *name)
+{
+    void		*map;
+    const char		*p;
+    unsigned int	cluster = 0;
+    int			i;
+
+    for (p = name; *p; p++)
+	cluster = cluster * 31 + (unsigned char)*p;
+    cluster = 1 + cluster % 4000;
+
+    if ((map = mmv_stats_init(name, cluster, MMV_FLAG_PROCESS, writer_metrics,
+		sizeof(writer_metrics) / sizeof(writer_metrics[0]), NULL, 0)) == NULL) {
+	fprintf(stderr, "%s: cannot export writer statistics as \"%s\": %s\n",
+		pmProgname, name, osstrerror());
+	return;
+    }
+    for (i = 0; i < WS_NSTATS; i++)
+	mmv_stats[i] = mmv_lookup_value_desc(map, writer_metrics[i].name, NULL);
+}
+
+#ifdef HAVE_FOPENCOOKIE
+
+static void
+stats_add(int stat, __uint64_t value)
+{
+    stats[stat] += value;
+    if (mmv_stats[stat] != NULL)
+	mmv_stats[stat]->ull = stats[stat];
+}
+
+static void
+stats_set(int stat, __uint64_t value)
+{
+    stats[stat] = value;
+    if (mmv_stats[stat] != NULL)
+	mmv_stats[stat]->ull = value;
+}
+
+#define WR_INDEX	0x1		/* temporal index record */
+#define WR_CLOSE	0x2		/* close fp once preceding records are done */
+
+typedef struct {
+    int			fd;
+    int			flags;
+    FILE		*fp;		/* for WR_CLOSE */
+    off_t		offset;
+    size_t		length;
+    size_t		size;		/* allocated size of buf */
+    char		*buf;
+    struct timeval	queued;
+} record_t;
+
+typedef struct wfile {
+    struct wfile	*next;
+    FILE		*fp;		/* stream handed out */
+    FILE		*orig;		/* from __pmLogNewFile, owns fd */
+    int			fd;
+    int			index;		/* temporal index file? */
+    off_t		posn;		/* stream position */
+    off_t		end;		/* end of data written */
+} wfile_t;
+
+static wfile_t		*wfiles;	/* main thread only */
+
+static pthread_mutex_t	ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	ring_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t	ring_done = PTHREAD_COND_INITIALIZER;
+static pthread_t	writer_thread;
+static record_t		ring[WRITER_SLOTS];
+static int		head;		/* oldest record */
+static int		count;		/* records in ring */
+static size_t		bytes;		/* bytes in ring */
+static int		busy;		/* ring[head] is being written */
+static int		running;	/* writer thread started, not stopped */
+static int		stopping;
+static int		error;		/* from a failed write, reported once */
+
+static int
+write_all(int fd, const char *buf, size_t length, off_t offset)
+{
+    ssize_t	sts;
+
+    while (length > 0) {
+	if ((sts = pwrite(fd, buf, length, offset)) < 0) {
+	    if (oserror() == EINTR)
+		continue;
+	    return -oserror();
+	}
+	buf += sts;
+	length -= sts;
+	offset += sts;
+    }
+    return 0;
+}
+
+static void
+sync_fd(int fd)
+{
+    struct timeval	before, after;
+
+    __pmtimevalNow(&before);
+    (void)fdatasync(fd);
+    __pmtimevalNow(&after);
+    stats_add(WS_SYNC_TIME, (__uint64_t)(__pmtimevalSub(&after, &before) * 1000000));
+}
+
+/*
+ * Files written since the last temporal index entry, flushed ahead of
+ * the next one for WRITER_SYNC_INDEX ... only a handful of archive
+ * files are ever open at once.
+ */
+static int	dirty[8];
+static int	ndirty;
+
+static void
+mark_dirty(int fd)
+{
+    int		i;
+
+    for (i = 0; i < ndirty; i++)
+	if (dirty[i] == fd)
+	    return;
+    if (ndirty < (int)(sizeof(dirty) / sizeof(dirty[0])))
+	dirty[ndirty++] = fd;
+    else
+	sync_fd(fd);
+}
+
+static void
+clear_dirty(int fd)
+{
+    int		i;
+
+    for (i = 0; i < ndirty; i++) {
+	if (dirty[i] == fd) {
+	    dirty[i] = dirty[--ndirty];
+	    return;
+	}
+    }
+}
+
+static void *
+writer(void *arg)
+{
+    record_t		*rp;
+    struct timeval	before, after;
+    int			sts;
+    int			i;
+
+    (void)arg;
+    pthread_mutex_lock(&ring_lock);
+    for (;;) {
+	while (count == 0 && !stopping)
+	    pthread_cond_wait(&ring_queued, &ring_lock);
+	if (count == 0)
+	    break;
+	rp = &ring[head];
+	busy = 1;
+	pthread_mutex_unlock(&ring_lock);
+
+	sts = 0;
+	if (rp->flags & WR_CLOSE) {
+	    if (writer_policy != WRITER_SYNC_NONE)
+		sync_fd(rp->fd);
+	    clear_dirty(rp->fd);
+	    fclose(rp->fp);
+	}
+	else {
+	    if ((rp->flags & WR_INDEX) && writer_policy == WRITER_SYNC_INDEX) {
+		for (i = 0; i < ndirty; i++)
+		    if (dirty[i] != rp->fd)
+			sync_fd(dirty[i]);
+		ndirty = 0;
+	    }
+	    __pmtimevalNow(&before);
+	    sts = write_all(rp->fd, rp->buf, rp->length, rp->offset);
+	    __pmtimevalNow(&after);
+	    stats_add(WS_WRITE_TIME, (__uint64_t)(__pmtimevalSub(&after, &before) * 1000000));
+	    stats_add(WS_LATENCY, (__uint64_t)(__pmtimevalSub(&after, &rp->queued) * 1000000));
+	    stats_add(WS_WRITES, 1);
+	    stats_add(WS_BYTES, rp->length);
+	    if (writer_policy == WRITER_SYNC_INDEX) {
+		if (rp->flags & WR_INDEX)
+		    sync_fd(rp->fd);
+		else
+		    mark_dirty(rp->fd);
+	    }
+	}
+
+	pthread_mutex_lock(&ring_lock);
+	if (sts < 0 && error == 0)
+	    error = sts;
+	busy = 0;
+	bytes -= rp->length;
+	head = (head + 1) % WRITER_SLOTS;
+	count--;
+	stats_set(WS_QUEUED, count);
+	stats_set(WS_QUEUED_BYTES, bytes);
+	pthread_cond_broadcast(&ring_done);
+    }
+    pthread_mutex_unlock(&ring_lock);
+    return NULL;
+}
+
+/*
+ * Queue a record, called with ring_lock held.  Returns 0, else -errno
+ * for an earlier failed write.
+ */
+static int
+enqueue(wfile_t *wp, int flags, const char *buf, size_t length)
+{
+    record_t	*rp;
+    char	*p;
+    int		sts;
+
+    if (error < 0 && !(flags & WR_CLOSE)) {
+	sts = error;
+	error = 0;
+	return sts;
+    }
+
+    if (count > 0 && !(flags & (WR_INDEX|WR_CLOSE))) {
+	/* append to the last record if it is contiguous */
+	rp = &ring[(head + count - 1) % WRITER_SLOTS];
+	if (rp->fd == wp->fd && rp->flags == 0 &&
+	    rp->offset + rp->length == wp->posn &&
+	    !(count == 1 && busy) &&
+	    bytes + length <= (size_t)writer_bufsize) {
+	    if (rp->length + length > rp->size) {
+		if ((p = (char *)realloc(rp->buf, rp->length + length)) == NULL)
+		    return -ENOMEM;
+		rp->buf = p;
+		rp->size = rp->length + length;
+	    }
+	    memcpy(rp->buf + rp->length, buf, length);
+	    rp->length += length;
+	    bytes += length;
+	    stats_add(WS_RECORDS, 1);
+	    stats_set(WS_QUEUED_BYTES, bytes);
+	    return 0;
+	}
+    }
+
+    /*
+     * wait for space ... but a record larger than the buffer can go
+     * alone, and a close is always queued (after any write error) so
+     * the stream is only closed once the records before it are done
+     */
+    if (count == WRITER_SLOTS || (count > 0 && bytes + length > (size_t)writer_bufsize)) {
+	stats_add(WS_STALLS, 1);
+	while ((error == 0 || (flags & WR_CLOSE)) && (count == WRITER_SLOTS ||
+	       (count > 0 && bytes + length > (size_t)writer_bufsize)))
+	    pthread_cond_wait(&ring_done, &ring_lock);
+    }
+    if (error < 0 && !(flags & WR_CLOSE)) {
+	sts = error;
+	error = 0;
+	return sts;
+    }
+
+    rp = &ring[(head + count) % WRITER_SLOTS];
+    if (length > rp->size) {
+	if ((p = (char *)realloc(rp->buf, length)) == NULL)
+	    return -ENOMEM;
+	rp->buf = p;
+	rp->size = length;
+    }
+    if (length > 0)
+	memcpy(rp->buf, buf, length);
+    rp->fd = wp->fd;
+    rp->flags = flags;
+    rp->fp = (flags & WR_CLOSE) ? wp->orig : NULL;
+    rp->offset = wp->posn;
+    rp->length = length;
+    __pmtimevalNow(&rp->queued);
+    bytes += length;
+    count++;
+    if (!(flags & WR_CLOSE))
+	stats_add(WS_RECORDS, 1);
+    stats_set(WS_QUEUED, count);
+    stats_set(WS_QUEUED_BYTES, bytes);
+    pthread_cond_signal(&ring_queued);
+    return 0;
+}
+
+static ssize_t
+writer_write(void *cookie, const char *buf, size_t length)
+{
+    wfile_t	*wp = (wfile_t *)cookie;
+    int		sts;
+
+    if (length == 0)
+	return 0;
+    pthread_mutex_lock(&ring_lock);
+    if (running)
+	sts = enqueue(wp, wp->index ? WR_INDEX : 0, buf, length);
+    else
+	sts = write_all(wp->fd, buf, length, wp->posn);
+    pthread_mutex_unlock(&ring_lock);
+    if (sts < 0) {
+	setoserror(-sts);
+	return -1;
+    }
+    wp->posn += length;
+    if (wp->posn > wp->end)
+	wp->end = wp->posn;
+    return length;
+}
+
+static int
+writer_seek(void *cookie, off64_t *offset, int whence)
+{
+    wfile_t	*wp = (wfile_t *)cookie;
+    off_t	posn;
+
+    if (whence == SEEK_SET)
+	posn = *offset;
+    else if (whence == SEEK_CUR)
+	posn = wp->posn + *offset;
+    else if (whence == SEEK_END)
+	posn = wp->end + *offset;
+    else
+	posn = -1;
+    if (posn < 0) {
+	setoserror(EINVAL);
+	return -1;
+    }
+    wp->posn = posn;
+    *offset = posn;
+    return 0;
+}
+
+static int
+writer_close(void *cookie)
+{
+    wfile_t	*wp = (wfile_t *)cookie;
+    wfile_t	**wpp;
+    int		sts = 0;
+
+    for (wpp = &wfiles; *wpp != NULL; wpp = &(*wpp)->next) {
+	if (*wpp == wp) {
+	    *wpp = wp->next;
+	    break;
+	}
+    }
+    pthread_mutex_lock(&ring_lock);
+    if (running) {
+	/* report an earlier failed write, the close is queued regardless */
+	sts = error;
+	error = 0;
+	enqueue(wp, WR_CLOSE, NULL, 0);
+    }
+    pthread_mutex_unlock(&ring_lock);
+    if (!running)
+	fclose(wp->orig);
+    free(wp);
+    if (sts < 0) {
+	setoserror(-sts);
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * Replace a stream from __pmLogNewFile (vol is a data volume number,
+ * or PM_LOG_VOL_META or PM_LOG_VOL_TI) with one whose writes are
+ * queued for the writer thread.  If that is not possible, the original
+ * stream is returned and writes to it remain synchronous.
+ */
+FILE *
+writer_open(FILE *f, int vol)
+{
+    cookie_io_functions_t	io = { NULL, writer_write, writer_seek, writer_close };
+    wfile_t			*wp;
+    sigset_t			all, save;
+    long			posn;
+    int				sts;
+
+    if (writer_bufsize <= 0 || f == NULL)
+	return f;
+    if (!running && !stopping) {
+	/* signals are for the main thread, not the writer */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &save);
+	sts = pthread_create(&writer_thread, NULL, writer, NULL);
+	pthread_sigmask(SIG_SETMASK, &save, NULL);
+	if (sts != 0) {
+	    fprintf(stderr, "%s: cannot create writer thread, writing synchronously: %s\n",
+		    pmProgname, pmErrStr(-sts));
+	    writer_bufsize = 0;
+	    return f;
+	}
+	running = 1;
+    }
+    if ((posn = ftell(f)) < 0 || (wp = (wfile_t *)calloc(1, sizeof(*wp))) == NULL)
+	return f;
+    wp->orig = f;
+    wp->fd = fileno(f);
+    wp->index = (vol == PM_LOG_VOL_TI);
+    wp->posn = wp->end = posn;
+    if ((wp->fp = fopencookie(wp, "w", io)) == NULL) {
+	free(wp);
+	return f;
+    }
+    /* one fwrite, one record ... as for __pmLogNewFile */
+    setvbuf(wp->fp, NULL, _IONBF, 0);
+    wp->next = wfiles;
+    wfiles = wp;
+    return wp->fp;
+}
+
+/*
+ * fileno(3) for archive streams, which may have come from writer_open
+ */
+int
+writer_fileno(FILE *f)
+{
+    wfile_t	*wp;
+
+    for (wp = wfiles; wp != NULL; wp = wp->next) {
+	if (wp->fp == f)
+	    return wp->fd;
+    }
+    return fileno(f);
+}
+
+/*
+ * Wait until everything queued so far has been written, e.g. for a
+ * pmlc flush request.  Returns 0, else -errno from a failed write.
+ */
+int
+writer_sync(void)
+{
+    int		sts;
+
+    pthread_mutex_lock(&ring_lock);
+    while (count > 0)
+	pthread_cond_wait(&ring_done, &ring_lock);
+    sts = error;
+    error = 0;
+    pthread_mutex_unlock(&ring_lock);
+    return sts;
+}
+
+/*
+ * Drain the queue and stop the writer thread, at exit ... any later
+ * writes are made synchronously.
+ */
+void
+writer_stop(void)
+{
+    pthread_mutex_lock(&ring_lock);
+    if (!running) {
+	pthread_mutex_unlock(&ring_lock);
+	return;
+    }
+    stopping = 1;
+    pthread_cond_signal(&ring_queued);
+    pthread_mutex_unlock(&ring_lock);
+    pthread_join(writer_thread, NULL);
+    pthread_mutex_lock(&ring_lock);
+    running = 0;
+    pthread_mutex_unlock(&ring_lock);
+}
+
+/*
+ * From a signal handler, just before _exit ... write whatever is queued
+ * with pwrite(2) directly, without waiting: nothing is written if the
+ * ring is locked or the writer thread is part way through a record,
+ * and at most WRITER_SLOTS records are written.  Anything else here is
+ * not async-signal-safe, so the stop and drain in writer_stop() is only
+ * for the normal exit path.
+ */
+void
+writer_abort(void)
+{
+    record_t	*rp;
+    int		i;
+
+    if (pthread_mutex_trylock(&ring_lock) != 0)
+	return;
+    if (running && !busy) {
+	for (i = 0; i < count; i++) {
+	    rp = &ring[(head + i) % WRITER_SLOTS];
+	    if (!(rp->flags & WR_CLOSE))
+		(void)write_all(rp->fd, rp->buf, rp->length, rp->offset);
+	}
+	count = 0;
+	bytes = 0;
+    }
+    pthread_mutex_unlock(&ring_lock);
+}
+
+#else /* !HAVE_FOPENCOOKIE */
+
+FILE *
+writer_open(FILE *f, int vol)
+{
+    (void)vol;
+    return f;
+}
+
+int
+writer_fileno(FILE *f)
+{
+    return fileno(f);
+}
+
+int
+writer_sync(void)
+{
+    return 0;
+}
+
+void
+writer_stop(void)
+{
+}
+
+void
+writer_abort(void)
+{
+}
+
+#endif
@@ -44,6 +44,18 @@ unsigned graphite_archivedir = 0; /* set by -I option */
 string logfile = "";		/* set by -l option */
 string fatalfile = "/dev/tty";	/* fatal messages at startup go here */
 
+/*
+ * With -M, /pmapi and /graphite requests are handed to the worker pool,
+ * so that a long graphite render does not hold up everyone else.  The
+ * connection is suspended meanwhile, and resumed by the worker once it
+ * has queued a response; the pipe wakes up our select loop for that.
+ */
+#if defined(HAVE_PTHREAD_H) && (MHD_VERSION >= 0x00093400)
+#define PMWEBD_ASYNC_RESPOND 1
+static int async_respond;	/* cleared by -L; local contexts are single-threaded */
+static int wakeup_fds[2] = { -1, -1 };
+#endif
+
 
 
 /* Print a best-effort message as a plain-text http response; anything
@@ -120,11 +132,19 @@ mhd_get_iterator (void *cls, enum MHD_ValueKind kind, const char *key, const cha
 // during the processing of an http request, and we need to save state
 // between them.
 
+enum mhd_api { mhd_api_none, mhd_api_pmapi, mhd_api_graphite };
+
 struct mhd_connection_context {
     struct MHD_PostProcessor *pp;
     http_params params;
-
-    mhd_connection_context ():pp (0) {
+    // Saved for the final call, in case it's made from a worker thread.
+    struct MHD_Connection *connection;
+    enum mhd_api api;
+    vector <string> url_tokens;
+    string url;
+    bool dispatched;		// handed to a worker; mhd_respond_async()
+
+    mhd_connection_context ():pp (0), connection (0), api (mhd_api_none), dispatched (false) {
     }
 };
 
@@ -156,6 +176,66 @@ vector <string> http_params::find_all (const string & s) const
 }
 
 
+/* Final call for a /pmapi or /graphite request. */
+static int
+mhd_respond_api (mhd_connection_context * mhd_cc)
+{
+    if (mhd_cc->api == mhd_api_pmapi) {
+        return pmwebapi_respond (mhd_cc->connection, mhd_cc->params, mhd_cc->url_tokens);
+    }
+    assert (mhd_cc->api == mhd_api_graphite);
+    return pmgraphite_respond (mhd_cc->connection, mhd_cc->params, mhd_cc->url_tokens,
+                               mhd_cc->url);
+}
+
+
+#ifdef PMWEBD_ASYNC_RESPOND
+/* Worker side of a dispatched request.  By the time the connection is
+   resumed, a response has been queued; if not (an MHD_NO), mhd_respond
+   gets called again and closes the connection.  NB: the mhd_cc may be
+   gone as soon as the connection is resumed. */
+static void
+mhd_respond_async (void *cls)
+{
+    mhd_connection_context *mhd_cc = (mhd_connection_context *) cls;
+    struct MHD_Connection *connection = mhd_cc->connection;
+
+    try {
+        (void) mhd_respond_api (mhd_cc);
+    } catch (...) {
+        connstamp (cerr, connection) << "c++ exception caught" << endl;
+    }
+
+    MHD_resume_connection (connection);
+    if (wakeup_fds[1] >= 0) {
+        char c = 0;
+        (void) write (wakeup_fds[1], &c, 1);	// EAGAIN: a wakeup is pending anyway
+    }
+}
+#endif
+
+
+/* Serve a /pmapi or /graphite request on a worker thread if we can,
+   right here otherwise. */
+static int
+mhd_respond_dispatch (struct MHD_Connection *connection, mhd_connection_context * mhd_cc)
+{
+    mhd_cc->connection = connection;
+#ifdef PMWEBD_ASYNC_RESPOND
+    if (async_respond && pmweb_workers_size () > 0) {
+        mhd_cc->dispatched = true;
+        MHD_suspend_connection (connection);
+        if (pmweb_workers_submit (&mhd_respond_async, mhd_cc) == 0) {
+            return MHD_YES;
+        }
+        MHD_resume_connection (connection);
+        mhd_cc->dispatched = false;
+    }
+#endif
+    return mhd_respond_api (mhd_cc);
+}
+
+
 /*
  * Respond to a new incoming HTTP request.  It may be
  * one of three general categories:
@@ -191,15 +271,20 @@ mhd_respond (void *cls, struct MHD_Connection *connection, const char *url0,
             return MHD_YES;		// expect another call shortly
         }
 
+        // Get our context
+        mhd_connection_context * mhd_cc = (mhd_connection_context *) (*con_cls);
+        assert (mhd_cc);
+
+        // Called again after a worker failed to queue a response?
+        if (mhd_cc->dispatched) {
+            return MHD_NO;
+        }
+
         // Collect simple utilization info if desired
         if (dumpstats > 0) {
             clients_usage[conninfo (connection, false)] ++;
         }
 
-        // Get our context
-        mhd_connection_context * mhd_cc = (mhd_connection_context *) (*con_cls);
-        assert (mhd_cc);
-
         // Intermediate call?  Store away POST parameters, if any.
         if (method == "POST") {
             MHD_post_process (mhd_cc->pp, upload_data, *upload_data_size);
@@ -240,14 +325,14 @@ mhd_respond (void *cls, struct MHD_Connection *connection, const char *url0,
 
         /* pmwebapi? */
         if (url1 == uriprefix) {
-            return pmwebapi_respond (connection, mhd_cc->params, url_tokens);
+            mhd_cc->api = mhd_api_pmapi;
         }
 
         /* graphite? */
         else if (graphite_p && (method == "GET" || method == "POST") && (url1 == "graphite")
                  && ((url2 == "render") || (url2 == "metrics") || (url2 == "rawdata")
                      || (url2 == "browser") || (url2 == "graphlot" && url3 == "findmetric"))) {
-            return pmgraphite_respond (connection, mhd_cc->params, url_tokens, url);
+            mhd_cc->api = mhd_api_graphite;
         }
         // graphite dashboard idiosyncracy; note absence of /graphite top level
         else if (graphite_p && (method == "GET" || method == "POST") && 
@@ -255,16 +340,22 @@ mhd_respond (void *cls, struct MHD_Connection *connection, const char *url0,
                   (url1 == "render"))) {
             url_tokens.insert (url_tokens.begin() + 1 /* empty #0 */,
                                string("graphite"));
-            return pmgraphite_respond (connection, mhd_cc->params, url_tokens, url);
+            mhd_cc->api = mhd_api_graphite;
         }
 
-        /* pmresapi? */
+        /* pmresapi?  (cheap enough to serve right here) */
         else if ((resourcedir != "") && (method == "GET")) {
             return pmwebres_respond (connection, mhd_cc->params, url);
         }
 
         /* fall through */
-        return mhd_notify_error (connection, -EINVAL);
+        else {
+            return mhd_notify_error (connection, -EINVAL);
+        }
+
+        mhd_cc->url_tokens = url_tokens;
+        mhd_cc->url = url;
+        return mhd_respond_dispatch (connection, mhd_cc);
 
     } catch (...) {
         connstamp (cerr, connection) << "c++ exception caught" << endl;
@@ -405,7 +496,12 @@ server_dump_configuration ()
         clog << "\tPeriodic client statistics not dumped" << endl;
     }
 #if HAVE_PTHREAD_H
-    clog << "\tUsing up to " << multithread << " auxiliary threads" << endl;
+    clog << "\tUsing a pool of " << multithread << " worker threads" << endl;
+#ifdef PMWEBD_ASYNC_RESPOND
+    if (multithread && ! async_respond) {
+        clog << "\tServing requests on the main thread only (local context)" << endl;
+    }
+#endif
 #endif
 }
 
@@ -424,7 +520,10 @@ pmweb_init_random_seed (void)
 static void
 pmweb_shutdown (struct MHD_Daemon *d4, struct MHD_Daemon *d6)
 {
-    /* Shut down cleanly, out of a misplaced sense of propriety. */
+    /* Shut down cleanly, out of a misplaced sense of propriety.  Workers
+       go first, finishing (quickly, since exit_p is set) & resuming any
+       connections they hold. */
+    pmweb_workers_stop ();
     if (d4) {
         MHD_stop_daemon (d4);
     }
@@ -702,18 +801,33 @@ main (int argc, char *argv[])
 
     /*
      * Start microhttp daemon.  Use the application-driven threading
-     * model, so we don't complicate things with threads.  In the
-     * future, if this daemon becomes safe to run multithreaded,
-     * we could make use of MHD_USE_THREAD_PER_CONNECTION; we'd need
-     * to add ample locking over pmwebd context structures etc.
+     * model: all network I/O happens on this thread.  With -M, requests
+     * are served by our own pool of worker threads (see mhd_respond_dispatch),
+     * rather than MHD_USE_THREAD_PER_CONNECTION, so the thread count stays
+     * bounded; this relies on MHD's suspend/resume support.
      */
+    int mhd_flags = 0;
+#ifdef PMWEBD_ASYNC_RESPOND
+    async_respond = (multithread > 0 && ! localmode);
+    if (async_respond) {
+        mhd_flags |= MHD_USE_SUSPEND_RESUME;
+        if (pipe (wakeup_fds) < 0) {
+            timestamp (cerr) << "Cannot create wakeup pipe: " << strerror (errno) << endl;
+            pmweb_dont_start ();
+        }
+        for (int i = 0; i < 2; i++) {
+            (void) fcntl (wakeup_fds[i], F_SETFL, fcntl (wakeup_fds[i], F_GETFL) | O_NONBLOCK);
+            (void) fcntl (wakeup_fds[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+#endif
     if (mhd_ipv4)
-        d4 = MHD_start_daemon (0, port, NULL, NULL,	/* default accept policy */
+        d4 = MHD_start_daemon (mhd_flags, port, NULL, NULL,	/* default accept policy */
                                &mhd_respond, NULL,	/* handler callback */
                                MHD_OPTION_CONNECTION_TIMEOUT, maxtimeout, MHD_OPTION_NOTIFY_COMPLETED,
                                &mhd_respond_completed, NULL, MHD_OPTION_END);
     if (mhd_ipv6)
-        d6 = MHD_start_daemon (MHD_USE_IPv6, port, NULL, NULL,	/* default accept policy */
+        d6 = MHD_start_daemon (mhd_flags | MHD_USE_IPv6, port, NULL, NULL,	/* default accept policy */
                                &mhd_respond, NULL,	/* handler callback */
                                MHD_OPTION_CONNECTION_TIMEOUT, maxtimeout, MHD_OPTION_NOTIFY_COMPLETED,
                                &mhd_respond_completed, NULL, MHD_OPTION_END);
@@ -781,6 +895,9 @@ main (int argc, char *argv[])
     /* Setup randomness for calls to random() */
     pmweb_init_random_seed ();
 
+    /* Start the worker threads, now that our identity & stdio are settled. */
+    pmweb_workers_start (multithread);
+
     // A place to track utilization
     /* Block indefinitely. */
     while (!exit_p) {
@@ -800,6 +917,14 @@ main (int argc, char *argv[])
         if (d6 && MHD_YES != MHD_get_fdset (d6, &rs, &ws, &es, &maxsock)) {
             break;		/* fatal internal error */
         }
+#ifdef PMWEBD_ASYNC_RESPOND
+        if (wakeup_fds[0] >= 0) {
+            FD_SET (wakeup_fds[0], &rs);
+            if (wakeup_fds[0] > maxsock) {
+                maxsock = wakeup_fds[0];
+            }
+        }
+#endif
 
         /*
          * Find the next expiry.  We don't need to bound it by
@@ -824,6 +949,14 @@ main (int argc, char *argv[])
 
         select (maxsock + 1, &rs, &ws, &es, &tv);
 
+#ifdef PMWEBD_ASYNC_RESPOND
+        if (wakeup_fds[0] >= 0 && FD_ISSET (wakeup_fds[0], &rs)) {
+            char buf[64];
+            while (read (wakeup_fds[0], buf, sizeof (buf)) > 0)
+                ;	// resumed connections get picked up by MHD_run below
+        }
+#endif
+
         if (d4) {
             MHD_run (d4);
         }
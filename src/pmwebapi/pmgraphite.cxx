@@ -39,6 +39,7 @@ extern "C"
 #include <fts.h>
 #endif
 #include <fnmatch.h>
+#include <dirent.h>
 #include <regex.h>
 #ifdef HAVE_PTHREAD_H
 #include <pthread.h>
@@ -191,43 +192,163 @@ pmgraphite_metric_decode (const string & foo)
 // ------------------------------------------------------------------------
 
 
-typedef multimap<pmInDom,string> pmis_t;
+// A trivial parallel work queue: jobs are handed out to the shared
+// worker pool (see workers.cxx), with the calling thread pitching in.
+template <class Spec>
+struct fetch_series_jobqueue {
+    vector<Spec> jobs; // vector itself read-only
+    typedef void (*runner_t) (Spec *);
+    runner_t runner;
 
-struct pmg_enum_context {
-    const vector <string> *patterns;
-    vector <string> *output;
-    string archivepart;
-    pmis_t indom_instance_parts; // filtered indom instance names
-};
+    fetch_series_jobqueue (runner_t r): runner (r) {}
 
+    static void run_one (void *, unsigned);
 
+    void run ();
+};
 
-// Callback from pmTraversePMNS_r.  We have a working archive, we just received
-// a working metric name.  All we need now is to enumerate
-void
-pmg_enumerate_pmns (const char *name, void *cls)
+
+template <class Spec>
+void fetch_series_jobqueue<Spec>::run_one (void *cls, unsigned my_jobid)
 {
-    pmg_enum_context *c = (pmg_enum_context *) cls;
-    string metricpart = name;
+    fetch_series_jobqueue<Spec>* q = (fetch_series_jobqueue<Spec>*) cls;
+    assert (q != 0);
 
     if (exit_p) {
         return;
     }
+    (*q->runner) (& q->jobs[my_jobid]);
+}
 
-    // Filter out mismatches of the metric name components
-    vector <string> metric_parts = split (metricpart, '.');
-    for (unsigned i = 0; i < metric_parts.size (); i++) {
-        if (c->patterns->size () > i + 1) {
-            // patterns[0] was already used for the archive name
-            const string & metricpart = metric_parts[i];
-            const string & pattern = (*c->patterns)[i + 1];
-            if (fnmatch (pattern.c_str (), metricpart.c_str (), FNM_NOESCAPE) != 0) {
-                return;
-            }
+
+template <class Spec>
+void fetch_series_jobqueue<Spec>::run ()
+{
+    // Permute the job queue randomly, to make it less likely that
+    // concurrent threads are processing the same archive.
+    // ... but some experimentaton shows harm rather than benefit.
+    // random_shuffle (this->jobs.begin(), this->jobs.end());
+    // ... plus we'd have to unshuffle before results are collected.
+
+    pmweb_workers_for (this->jobs.size (), & this->run_one, (void *) this);
+}
+
+
+// ------------------------------------------------------------------------
+
+
+// Graphite metric namespace index.  Enumerating the metrics of all
+// archives means opening every one of them, which takes far too long to
+// repeat for each /metrics/find request against a large archive tree.
+// So the graphite names of each archive's numeric metrics & instances are
+// kept here as a prefix tree of name components, and rebuilt only for
+// archives whose metadata has changed since.
+//
+// With -M, requests are served by a pool of worker threads, so several
+// may enumerate at once: the index is only read or changed with
+// pmg_index_lock held (see below).  The auxiliary threads used to
+// (re)build entries work on private copies.
+
+struct pmg_name_node {
+    map <string, pmg_name_node *> children; // empty for leaves
+
+    ~pmg_name_node ();
+    pmg_name_node *child (const string & name);
+};
+
+pmg_name_node::~pmg_name_node ()
+{
+    for (map <string, pmg_name_node *>::iterator it = children.begin ();
+            it != children.end (); it++) {
+        delete it->second;
+    }
+}
+
+pmg_name_node *
+pmg_name_node::child (const string & name)
+{
+    pmg_name_node *&node = children[name];
+    if (node == 0) {
+        node = new pmg_name_node;
+    }
+    return node;
+}
+
+struct pmg_archive_index {
+    string archive; // .meta file or archive directory
+    time_t mtime;   // latest modification time of the metadata
+    off_t size;     // total size of the metadata
+    bool usable;    // opened fine as an archive
+    pmg_name_node *names; // graphite names below the archive part
+
+    pmg_archive_index (): mtime (0), size (0), usable (false), names (0) {}
+};
+
+static map <string, pmg_archive_index> pmg_index;
+#ifdef HAVE_PTHREAD_H
+// Held by one enumeration at a time, across its indexing & querying.  The
+// parallel indexing jobs themselves only touch their own pmg_archive_index.
+static pthread_mutex_t pmg_index_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+// Compute the signature of an archive's metadata: the latest mtime and
+// total size of the .meta file (or the .meta files of the archive
+// directory, plus the directory itself, which changes as archives come
+// and go).  Return false if it cannot be examined.
+static bool
+pmg_archive_signature (const string & archive, bool dir_p, time_t & mtime, off_t & size)
+{
+    struct stat st;
+
+    if (stat (archive.c_str (), &st) < 0) {
+        return false;
+    }
+    mtime = st.st_mtime;
+    size = dir_p ? 0 : st.st_size;
+    if (!dir_p) {
+        return true;
+    }
+
+    DIR *d = opendir (archive.c_str ());
+    if (d == NULL) {
+        return false;
+    }
+    struct dirent *de;
+    while ((de = readdir (d)) != NULL) {
+        if (fnmatch ("*.meta*", de->d_name, FNM_NOESCAPE) != 0) {
+            continue;
+        }
+        string meta = archive + (char) __pmPathSeparator () + de->d_name;
+        if (stat (meta.c_str (), &st) < 0) {
+            continue;
+        }
+        if (st.st_mtime > mtime) {
+            mtime = st.st_mtime;
         }
+        size += st.st_size;
     }
+    closedir (d);
+    return true;
+}
+
+
+struct pmg_index_context {
+    pmg_name_node *names;
+    map <pmInDom, vector <string> > instance_parts; // encoded instance names
+};
+
+
+// Callback from pmTraversePMNS_r.  We have a working archive, we just received
+// a working metric name.  Add it (fanned out to its instances) to the index.
+void
+pmg_index_pmns (const char *name, void *cls)
+{
+    pmg_index_context *c = (pmg_index_context *) cls;
 
-    string final_metric_name = c->archivepart + "." + metricpart;
+    if (exit_p) {
+        return;
+    }
 
     // look up the metric to make sure it exists; fan out to instance domains while at it
     char *namelist[1];
@@ -258,50 +379,149 @@ pmg_enumerate_pmns (const char *name, void *cls)
         return;
     }
 
-    if (pmd.indom == PM_INDOM_NULL) { // no more
-        c->output->push_back (final_metric_name);
-    } else { // has instance domain - get one more graphite name component
+    vector <string> *instance_parts = 0;
+    if (pmd.indom != PM_INDOM_NULL) { // has instance domain - get one more graphite name component
         // check indom instance cache
-        if (c->indom_instance_parts.find(pmd.indom) == c->indom_instance_parts.end()) {
+        map <pmInDom, vector <string> >::iterator it = c->instance_parts.find (pmd.indom);
+        if (it == c->instance_parts.end ()) {
             // populate it
+            it = c->instance_parts.insert (make_pair (pmd.indom, vector <string> ())).first;
             int *instlist;
             char **namelist;
             sts = pmGetInDomArchive (pmd.indom, &instlist, &namelist);
             if (sts >= 1) {
                 for (int i=0; i<sts; i++) {
-                    string instance_part = pmgraphite_metric_encode (namelist[i]);
-                    // must filter out mismatches here too!
-                    if (c->patterns->size () > metric_parts.size ()+1) {
-                        const string & pattern = (*c->patterns)[metric_parts.size ()+1];
-                        if (fnmatch (pattern.c_str (), instance_part.c_str (), FNM_NOESCAPE) != 0) {
-                            continue;
-                        }
-                    }
-                    c->indom_instance_parts.insert(make_pair(pmd.indom, instance_part));
+                    it->second.push_back (pmgraphite_metric_encode (namelist[i]));
                 }
                 free (instlist);
                 free (namelist);
-            } else {
-                // should not happen
             }
         }
+        instance_parts = & it->second;
+        if (instance_parts->empty ()) {
+            return;
+        }
+    }
 
-        // iterate across instance cache
-        pair<pmis_t::iterator,pmis_t::iterator> range = c->indom_instance_parts.equal_range(pmd.indom);
-        for (pmis_t::iterator a = range.first; a != range.second; a++) {
-            c->output->push_back (final_metric_name + "." + a->second);
+    vector <string> metric_parts = split (name, '.');
+    pmg_name_node *node = c->names;
+    for (unsigned i = 0; i < metric_parts.size (); i++) {
+        node = node->child (metric_parts[i]);
+    }
+    if (instance_parts) {
+        for (unsigned i = 0; i < instance_parts->size (); i++) {
+            (void) node->child ((*instance_parts)[i]);
         }
     }
 }
 
+
+// (Re)build the index entry of one archive; may run in an auxiliary thread.
+void
+pmg_index_archive (pmg_archive_index *ix)
+{
+    ix->names = new pmg_name_node;
+    int ctx = pmNewContext (PM_CONTEXT_ARCHIVE, ix->archive.c_str ());
+    if (ctx < 0) {
+        return;
+    }
+
+    // Wondertastic.  We have an archive.  Let's open 'er up and
+    // enumerate them metrics.
+    pmg_index_context c;
+    c.names = ix->names;
+    (void) pmTraversePMNS_r ("", &pmg_index_pmns, &c);
+
+    pmDestroyContext (ctx);
+    ix->usable = ! exit_p; // an interrupted traversal is incomplete
+}
+
+
+// Return the index entry of the given archive if it is up to date, else
+// add a fresh entry to stale[] to be built, and return NULL.
+static pmg_archive_index *
+pmg_index_check (const string & archive, bool dir_p, vector <pmg_archive_index> & stale)
+{
+    time_t mtime;
+    off_t size;
+
+    if (! pmg_archive_signature (archive, dir_p, mtime, size)) {
+        return 0;
+    }
+    map <string, pmg_archive_index>::iterator it = pmg_index.find (archive);
+    if (it != pmg_index.end () && it->second.mtime == mtime && it->second.size == size) {
+        return & it->second;
+    }
+    pmg_archive_index ix;
+    ix.archive = archive;
+    ix.mtime = mtime;
+    ix.size = size;
+    stale.push_back (ix);
+    return 0;
+}
+
+
+// Replace an archive's index entry with a freshly built one.
+static pmg_archive_index *
+pmg_index_install (const pmg_archive_index & ix)
+{
+    pmg_archive_index & old = pmg_index[ix.archive];
+    delete old.names;
+    old = ix;
+    return & old;
+}
+
+
+// Collect the graphite names below the given index node that match the
+// remaining pattern components.  Literal components are looked up
+// directly; only wildcard components are matched against each child.
+static void
+pmg_index_find (const pmg_name_node *node, const vector <string> & patterns,
+                unsigned level, const string & prefix, vector <string> & output)
+{
+    if (node->children.empty ()) {
+        output.push_back (prefix);
+        return;
+    }
+
+    map <string, pmg_name_node *>::const_iterator it;
+    if (level < patterns.size ()) {
+        const string & pattern = patterns[level];
+        if (pattern.find_first_of ("*?[") == string::npos) {
+            it = node->children.find (pattern);
+            if (it != node->children.end ()) {
+                pmg_index_find (it->second, patterns, level + 1, prefix + "." + it->first, output);
+            }
+            return;
+        }
+        for (it = node->children.begin (); it != node->children.end (); it++) {
+            if (fnmatch (pattern.c_str (), it->first.c_str (), FNM_NOESCAPE) == 0) {
+                pmg_index_find (it->second, patterns, level + 1, prefix + "." + it->first, output);
+            }
+        }
+        return;
+    }
+    for (it = node->children.begin (); it != node->children.end (); it++) {
+        pmg_index_find (it->second, patterns, level + 1, prefix + "." + it->first, output);
+    }
+}
+
+
 // Heavy lifter.  Enumerate all archives, all metrics, all instances.
 // This is not unbearably slow, since it involves only a scan of
-// directories & metadata.
+// directories, plus the metadata of archives not already indexed.
 
 vector <string> pmgraphite_enumerate_metrics (struct MHD_Connection * connection,
                                               const vector<string> & patterns_tok)
 {
     vector <string> output;
+    vector <pair <string, string> > archives; // index key, graphite archive part
+    vector <pmg_archive_index> stale;
+    set <string> seen;
+    unsigned indexed = 0;
+    struct timeval start, finish;
+
+    (void) gettimeofday (&start, NULL);
 
     // The javascript guis may feed us wildcardy partial metric names.  We
     // apply them (via componentwise fnsearch(3)) as an optimization.
@@ -332,6 +552,9 @@ vector <string> pmgraphite_enumerate_metrics (struct MHD_Connection * connection
         connstamp (cerr, connection) << "cannot fts_open " << archivesdir << endl;
         goto out;
     }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock (& pmg_index_lock);
+#endif
     for (FTSENT * ent = fts_read (f); ent != NULL; ent = fts_read (f)) {
         if (exit_p) {
             break; // don't bypass the fts_close()
@@ -363,6 +586,32 @@ vector <string> pmgraphite_enumerate_metrics (struct MHD_Connection * connection
             fnmatch ("*.meta", ent->fts_path, FNM_NOESCAPE) != 0)
             continue;
 
+        if (ent->fts_info == FTS_F) {
+            // PR1099: compressed archives can take too long to open &
+            // check, because libpcp completely decompresses them into a
+            // temporary directory ... every time a context is created for
+            // them.  Perhaps we could tolerate very small ones, but for
+            // now let's just skip them completely.
+            //
+            // We use a heuristic to determine whether the archive's
+            // compressed or not: simply whether there is a .0 file for a
+            // .meta.
+            //
+            // Where libpcp reads xz volumes in place, the .0.xz files that
+            // pmlogger_daily produces are cheap enough to take too.
+            string vol0 = archive.substr(0, archive.size()-strlen(".meta")) + ".0";
+            bool readable = (access (vol0.c_str(), R_OK) == 0);
+#ifdef HAVE_LZMA_DECOMPRESSION
+            if (! readable) {
+                readable = (access ((vol0 + ".xz").c_str(), R_OK) == 0);
+            }
+#endif
+            if (! readable) {
+                continue;
+            }
+        }
+        seen.insert (archive);
+
         // Abbrevate archive to clip off the archivesdir prefix (if
         // it's there).
         string archivepart = archive;
@@ -390,46 +639,75 @@ vector <string> pmgraphite_enumerate_metrics (struct MHD_Connection * connection
             continue;
         }
 
-        if (ent->fts_info == FTS_F) {
-            // PR1099: compressed archives can take too long to open &
-            // check, because libpcp completely decompresses them into a
-            // temporary directory ... every time a context is created for
-            // them.  Perhaps we could tolerate very small ones, but for
-            // now let's just skip them completely.
-            //
-            // We use a heuristic to determine whether the archive's
-            // compressed or not: simply whether there is a .0 file for a
-            // .meta.
-            string vol0 = archive.substr(0, archive.size()-strlen(".meta")) + ".0";
-            if (access (vol0.c_str(), R_OK) != 0) {
+        if (ent->fts_info == FTS_D) {
+            // Whether to recurse depends on the archive-directory opening
+            // successfully, so bring its index entry up to date right now.
+            pmg_archive_index *ix = pmg_index_check (archive, true, stale);
+            if (ix == 0 && ! stale.empty () && stale.back ().archive == archive) {
+                pmg_index_archive (& stale.back ());
+                ix = pmg_index_install (stale.back ());
+                stale.pop_back ();
+                indexed++;
+            }
+            if (ix == 0 || ! ix->usable) {
                 continue;
             }
+            // Don't recurse if this was a successfully opened archive-directory
+            (void) fts_set (f, ent, FTS_SKIP);
+        } else {
+            (void) pmg_index_check (archive, false, stale);
         }
-        int ctx = pmNewContext (PM_CONTEXT_ARCHIVE, archive.c_str ());
-        if (ctx < 0) {
-            continue;
-        }
-
-        // Wondertastic.  We have an archive.  Let's open 'er up and
-        // enumerate them metrics.
-        pmg_enum_context c;
-        c.patterns = &patterns_tok;
-        c.output = &output;
-        c.archivepart = archivepart;
-
-        (void) pmTraversePMNS_r ("", &pmg_enumerate_pmns, &c);
+        archives.push_back (make_pair (archive, archivepart));
+    }
+    fts_close (f);
 
-        pmDestroyContext (ctx);
+    // Index new & changed archives, in parallel.
+    if (! stale.empty () && ! exit_p) {
+        fetch_series_jobqueue <pmg_archive_index> q (& pmg_index_archive);
+        q.jobs = stale;
+        q.run ();
+        for (unsigned i = 0; i < q.jobs.size (); i++) {
+            if (q.jobs[i].names == 0) // not reached due to exit_p
+                continue;
+            (void) pmg_index_install (q.jobs[i]);
+            indexed++;
+        }
+    }
 
-        // Don't recurse if this was a successfully opened archive-directory
-        if ((ent->fts_info == FTS_D) && graphite_archivedir)
-            (void) fts_set (f, ent, FTS_SKIP);
+    // Forget archives that have gone away.
+    if (! exit_p) {
+        for (map <string, pmg_archive_index>::iterator it = pmg_index.begin ();
+                it != pmg_index.end (); ) {
+            if (seen.find (it->first) == seen.end ()) {
+                delete it->second.names;
+                pmg_index.erase (it++);
+            } else {
+                it++;
+            }
+        }
     }
-    fts_close (f);
 
+    // Now serve the query from the index.
+    for (unsigned i = 0; i < archives.size () && ! exit_p; i++) {
+        map <string, pmg_archive_index>::iterator it = pmg_index.find (archives[i].first);
+        if (it == pmg_index.end () || ! it->second.usable ||
+            it->second.names->children.empty ())
+            continue;
+        pmg_index_find (it->second.names, patterns_tok, 1, archives[i].second, output);
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock (& pmg_index_lock);
+#endif
 #endif
 
 out:
+    (void) gettimeofday (&finish, NULL);
+    if (verbosity > 1 && indexed > 0) {
+        connstamp (clog, connection) << "indexed " << indexed << " of "
+                                     << seen.size () << " archives"
+                                     << ", in " << __pmtimevalSub (&finish,&start)*1000 << "ms "
+                                     << endl;
+    }
     if (verbosity > 2) {
         connstamp (clog, connection) << "enumerated " << output.size () << " metrics" << endl;
     }
@@ -720,102 +998,368 @@ struct fetch_series_jobspec {
 };
 
 
-template <class Spec>
-struct fetch_series_jobqueue {
+// A graphite target resolved against an archive's metadata.
+struct pmg_target {
+    pmID pmid;      // 0 if the target could not be resolved
+    pmDesc desc;
+    int inst;       // -1 for PM_INDOM_NULL
+    string message; // why not, if not
+    unsigned long last_used;
+};
+
+
+// Archive contexts are kept open between render requests, along with
+// the archive time bounds and the targets already resolved against them,
+// so dashboard refreshes of the same targets skip all metadata work.
+// The pool is bounded in size, evicting the least recently used idle
+// contexts, as is the number of targets kept per context.  A context is
+// reopened (and its targets forgotten) when the archive files change,
+// i.e. the archive has grown.
+struct pmg_archive_context {
+    string archive;
+    int pmc;
+    bool pooled;    // in pmg_contexts, else private to one job
+    bool busy;      // in use by a fetch_series job
+    unsigned long last_used;
+    time_t mtime;   // signature of the archive files when opened
+    off_t size;
+    pmLogLabel label;
+    struct timeval end;
+    map <string, pmg_target> targets;
+    unsigned long targets_clock;
+
+    pmg_archive_context (): pmc (-1), pooled (false), busy (false), last_used (0),
+        mtime (0), size (0), targets_clock (0) {}
+};
+
+static const unsigned pmg_contexts_max = 32;
+static const unsigned pmg_targets_max = 4096;   // per context
+static map <string, pmg_archive_context> pmg_contexts;
+static unsigned long pmg_contexts_clock;
 #ifdef HAVE_PTHREAD_H
-    pthread_mutex_t lock; // protects following field
+static pthread_mutex_t pmg_contexts_lock = PTHREAD_MUTEX_INITIALIZER; // protects the above
 #endif
-    unsigned next_job_nr;
-
-    vector<Spec> jobs; // vector itself read-only
-    typedef void (*runner_t) (Spec *);
-    runner_t runner;
 
-    fetch_series_jobqueue (runner_t);
-    ~fetch_series_jobqueue ();
 
-    static void* thread_main (void *);
+// Compute the signature of all the files of an archive (or of all the
+// archives in an archive directory): their latest mtime and total size.
+static bool
+pmg_archive_files_signature (const string & archive, time_t & mtime, off_t & size)
+{
+    struct stat st;
+    string dir, base;
 
-    void run ();
-};
+    if (stat (archive.c_str (), &st) == 0 && S_ISDIR (st.st_mode)) {
+        dir = archive;
+    } else {
+        string::size_type slash = archive.rfind ((char) __pmPathSeparator ());
+        if (slash == string::npos) {
+            dir = ".";
+            base = archive;
+        } else {
+            dir = archive.substr (0, slash);
+            base = archive.substr (slash + 1);
+        }
+        // foo.meta -> foo.*
+        string metastring = ".meta";
+        if (base.size () > metastring.size () &&
+            base.compare (base.size () - metastring.size (), metastring.size (), metastring) == 0)
+            base.erase (base.size () - metastring.size ());
+        base += '.';
+    }
+
+    mtime = 0;
+    size = 0;
+    DIR *d = opendir (dir.c_str ());
+    if (d == NULL) {
+        return false;
+    }
+    struct dirent *de;
+    while ((de = readdir (d)) != NULL) {
+        if (strncmp (de->d_name, base.c_str (), base.size ()) != 0) {
+            continue;
+        }
+        string file = dir + (char) __pmPathSeparator () + de->d_name;
+        if (stat (file.c_str (), &st) < 0 || ! S_ISREG (st.st_mode)) {
+            continue;
+        }
+        if (st.st_mtime > mtime) {
+            mtime = st.st_mtime;
+        }
+        size += st.st_size;
+    }
+    closedir (d);
+    return true;
+}
 
 
-template <class Spec>
-fetch_series_jobqueue<Spec>::fetch_series_jobqueue (runner_t r)
+// Return an archive context from the pool to it, and close the least
+// recently used idle contexts beyond the pool limit.
+static void
+pmg_context_put (pmg_archive_context *c)
 {
+    vector <int> victims;
+
+    if (! c->pooled) {
+        if (c->pmc >= 0)
+            pmDestroyContext (c->pmc);
+        delete c;
+        return;
+    }
+
 #ifdef HAVE_PTHREAD_H
-    pthread_mutex_init (& this->lock, NULL);
+    pthread_mutex_lock (& pmg_contexts_lock);
 #endif
-    this->runner = r;
-    this->next_job_nr = 0;
+    c->busy = false;
+    c->last_used = ++pmg_contexts_clock;
+    if (c->pmc < 0) {
+        pmg_contexts.erase (c->archive);
+    }
+    while (pmg_contexts.size () > pmg_contexts_max) {
+        map <string, pmg_archive_context>::iterator it, lru = pmg_contexts.end ();
+        for (it = pmg_contexts.begin (); it != pmg_contexts.end (); it++) {
+            if (it->second.busy)
+                continue;
+            if (lru == pmg_contexts.end () || it->second.last_used < lru->second.last_used)
+                lru = it;
+        }
+        if (lru == pmg_contexts.end ()) // all busy
+            break;
+        victims.push_back (lru->second.pmc);
+        pmg_contexts.erase (lru);
+    }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock (& pmg_contexts_lock);
+#endif
+
+    for (unsigned i = 0; i < victims.size (); i++) {
+        pmDestroyContext (victims[i]);
+    }
 }
 
 
-template <class Spec>
-fetch_series_jobqueue<Spec>::~fetch_series_jobqueue ()
+// Forget the least recently used resolved targets of a context beyond the
+// limit, other than those of the current request (stamped with the clock).
+static void
+pmg_targets_trim (pmg_archive_context *c)
 {
-#ifdef HAVE_PTHREAD_H
-    pthread_mutex_destroy (& this->lock);
-#endif
+    if (c->targets.size () <= pmg_targets_max)
+        return;
+
+    vector <unsigned long> stamps;
+    map <string, pmg_target>::iterator it;
+    for (it = c->targets.begin (); it != c->targets.end (); it++)
+        stamps.push_back (it->second.last_used);
+    // keep the pmg_targets_max most recent, i.e. evict those below cutoff
+    vector <unsigned long>::iterator nth = stamps.end () - pmg_targets_max;
+    nth_element (stamps.begin (), nth, stamps.end ());
+    unsigned long cutoff = min (*nth, c->targets_clock);
+
+    for (it = c->targets.begin (); it != c->targets.end ();) {
+        if (it->second.last_used < cutoff)
+            c->targets.erase (it++);
+        else
+            it++;
+    }
 }
 
 
-template <class Spec>
-void* fetch_series_jobqueue<Spec>::thread_main (void *cls)
+// Get an open context for the archive, made current, with its time bounds.
+// Idle pooled contexts are reused unless the archive has changed since they
+// were opened; if another job is using the pooled one, open a private one.
+static pmg_archive_context *
+pmg_context_get (const string & archive, stringstream & message)
 {
-    fetch_series_jobqueue<Spec>* q = (fetch_series_jobqueue<Spec>*) cls;
-    assert (q != 0);
+    pmg_archive_context *c = 0;
+    time_t mtime;
+    off_t size;
+
+    if (! pmg_archive_files_signature (archive, mtime, size)) {
+        mtime = 0; // let pmNewContext() sort it out
+        size = 0;
+    }
 
-    while (1) {
 #ifdef HAVE_PTHREAD_H
-        pthread_mutex_lock (& q->lock);
+    pthread_mutex_lock (& pmg_contexts_lock);
 #endif
-        unsigned my_jobid = q->next_job_nr++;
+    map <string, pmg_archive_context>::iterator it = pmg_contexts.find (archive);
+    if (it == pmg_contexts.end ()) {
+        c = & pmg_contexts[archive];
+        c->archive = archive;
+        c->pooled = true;
+    } else if (! it->second.busy) {
+        c = & it->second;
+    }
+    if (c != 0) {
+        c->busy = true;
+    }
 #ifdef HAVE_PTHREAD_H
-        pthread_mutex_unlock (& q->lock);
+    pthread_mutex_unlock (& pmg_contexts_lock);
 #endif
+    if (c == 0) {
+        c = new pmg_archive_context;
+        c->archive = archive;
+    }
 
-        if ((my_jobid >= q->jobs.size ()) || exit_p) {
-            break;
+    if (c->pmc >= 0) {
+        if (c->mtime == mtime && c->size == size && pmUseContext (c->pmc) == 0) {
+            return c;
         }
+        pmDestroyContext (c->pmc);
+        c->pmc = -1;
+    }
 
-        (*q->runner) (& q->jobs[my_jobid]);
+    // Open the bad boy.
+    c->targets.clear ();
+    c->mtime = mtime;
+    c->size = size;
+    c->pmc = pmNewContext (PM_CONTEXT_ARCHIVE, archive.c_str ());
+    if (c->pmc < 0) {
+        // error already noted XXX where?
+        pmg_context_put (c);
+        return 0;
     }
-    return 0;
-}
 
+    // Fetch end of archive time boundaries, to avoid having libpcp
+    // iterate across vast regions of void.  This would be especially
+    // bad if libpcp worries the archive might have grown since last
+    // call, go and do an fstat(2)/lseek(2) every point.
+    int sts = pmGetArchiveLabel (& c->label);
+    if (sts < 0) {
+        message << "cannot find archive label";
+    } else {
+        sts = pmGetArchiveEnd (& c->end);
+        if (sts < 0) {
+            message << "cannot find archive end";
+        }
+    }
+    if (sts < 0) {
+        pmDestroyContext (c->pmc);
+        c->pmc = -1;
+        pmg_context_put (c);
+        return 0;
+    }
+    return c;
+}
 
 
-// simple contention
-template <class Spec>
-void fetch_series_jobqueue<Spec>::run ()
+// Parse graphite "target" name into metric names, and (if appropriate)
+// instances within metric indom, in the current archive context.
+static void
+pmg_resolve_target (const string & target, pmg_target & t)
 {
-    // Permute the job queue randomly, to make it less likely that
-    // concurrent threads are processing the same archive.
-    // ... but some experimentaton shows harm rather than benefit.
-    // random_shuffle (this->jobs.begin(), this->jobs.end());
-    // ... plus we'd have to unshuffle before results are collected.
+    stringstream message;
+    string last_component;
 
-#ifdef HAVE_PTHREAD_H
-    vector<pthread_t> threads;
-    for (unsigned i=0; i<multithread; i++) {
-        pthread_t x;
-        int rc = pthread_create (&x, NULL, & this->thread_main, (void*) this);
-        if (rc == 0) {
-            threads.push_back (x);
+    t.pmid = 0; // always invalid
+    t.inst = -1;
+    memset (& t.desc, 0, sizeof (t.desc));
+
+    vector <string> target_tok = split (target, '.');
+    if (target_tok.size () < 2) {
+        message << target << ": not enough target components";
+        t.message = message.str ();
+        return;
+    }
+    for (unsigned i = 0; i < target_tok.size (); i++)
+        if (target_tok[i] == "") {
+            message << target << ": empty target components";
+            t.message = message.str ();
+            return;
         }
+
+    // We need to decide whether the next dotted components represent
+    // a metric name, or whether there is an instance name squished at
+    // the end.
+    string metric_name = "";
+    for (unsigned i = 1; i < target_tok.size () - 1; i++) {
+        const string & piece = target_tok[i];
+        if (i > 1) {
+            metric_name += '.';
+        }
+        metric_name += piece;
     }
-#endif
-    // have main thread also have a go
-    (void)this->thread_main (this);
+    last_component = target_tok[target_tok.size () - 1];
 
-#ifdef HAVE_PTHREAD_H
-    for (unsigned i=0; i<threads.size (); i++) {
-        (void) pthread_join (threads[i], NULL);
+    char *namelist[1];
+    pmID pmidlist[1]; // fetch here instead of t.pmid, so an early error return leaves latter zero
+    namelist[0] = (char *) metric_name.c_str ();
+    int sts = pmLookupName (1, namelist, & pmidlist[0]);
+
+    if (sts == 1) {
+        // found ... last name must be instance domain name
+        sts = pmLookupDesc (pmidlist[0], &t.desc);
+        if (sts != 0) {
+            message << "cannot find metric descriptor " << metric_name;
+            t.message = message.str ();
+            return;
+        }
+        // check that there is an instance domain, in order to use that last component
+        if (t.desc.indom == PM_INDOM_NULL) {
+            message << "metric " << metric_name << " lacks expected indom "
+                    << last_component;
+            t.message = message.str ();
+            return;
+        }
+        // look up that instance name
+        string instance_name = pmgraphite_metric_decode (last_component);
+        int inst = pmLookupInDomArchive (t.desc.indom,
+                                         (char *) instance_name.c_str ());	// XXX: why not pmLookupInDom?
+        if (inst < 0) {
+            message << "metric " << metric_name << " lacks recognized indom "
+                    << last_component;
+            t.message = message.str ();
+            return;
+        }
+        t.inst = inst;
+        // NB: don't mess with instance domain profiles.  We may have multiple
+        // contradictory sets for different metrics in the same fetch loop.
+        // Instead we receive them all and search through them via pminst[i].
+    } else {
+        // not found ... ok, try again with that last component
+        metric_name = metric_name + '.' + last_component;
+        namelist[0] = (char *) metric_name.c_str ();
+        int sts = pmLookupName (1, namelist, pmidlist);
+        if (sts != 1) {
+            // still not found .. give up
+            message << "cannot find metric name " << metric_name;
+            t.message = message.str ();
+            return;
+        }
+
+        sts = pmLookupDesc (pmidlist[0], &t.desc);
+        if (sts != 0) {
+            message << "cannot find metric descriptor " << metric_name;
+            t.message = message.str ();
+            return;
+        }
+        // check that there is no instance domain
+        if (t.desc.indom != PM_INDOM_NULL) {
+            message << "metric " << metric_name << " has unexpected indom " << t.desc.indom;
+            t.message = message.str ();
+            return;
+        }
+
+        t.inst = -1; // PMAPI magic value for pmResult inst for PM_INDOM_NULL
     }
-#endif
-}
 
+    // Check that the pmDesc type is numeric
+    switch (t.desc.type) {
+    case PM_TYPE_32:
+    case PM_TYPE_U32:
+    case PM_TYPE_64:
+    case PM_TYPE_U64:
+    case PM_TYPE_FLOAT:
+    case PM_TYPE_DOUBLE:
+        break;
+    default:
+        message << "metric " << metric_name << " has unsupported type " << t.desc.type;
+        t.message = message.str ();
+        return;
+    }
+
+    t.pmid = pmidlist[0]; // Now we're committed to trying to fetch this pmid.
+}
 
 
 // Heavy lifter.  Parse graphite "target" name into archive
@@ -839,21 +1383,23 @@ void pmgraphite_fetch_series (fetch_series_jobspec *spec)
     time_t t_end = spec->t_end;
     time_t t_step = spec->t_step;
     int sts;
-    string last_component;
-    int pmc;
+    pmg_archive_context *c;
     string archive;
     string archive_part;
     unsigned entries_good = 0, entries;
     stringstream message;
     pmLogLabel archive_label;
     struct timeval archive_end;
-    int pmSetMode_called_p = 0;
     vector<pmID> pmids;
     vector<pmDesc> pmdescs;
     vector<int> pminsts;
 
     set<pmID> pmids_set;
-    vector<pmID> unique_pmids;
+    vector<unsigned> fetch_targets;
+    vector<pmID> fetch_pmids;
+    vector<int> fetch_insts;
+    vector<double> fetch_values;
+    unsigned first, last;
 
     // ^^^ several of these declarations are here (instead of at
     // point-of-use) only because we jump to an exit point, and may
@@ -861,8 +1407,6 @@ void pmgraphite_fetch_series (fetch_series_jobspec *spec)
 
     // XXX: in future, parse graphite functions-of-metrics
     // http://graphite.readthedocs.org/en/latest/functions.html
-    //
-    // XXX: in future, cache the pmid/pmdesc/inst# -> pcp-context
 
     // -------------------- PART 1 - per-archive processing
 
@@ -879,30 +1423,15 @@ void pmgraphite_fetch_series (fetch_series_jobspec *spec)
         goto out0;
     }
 
-    // Open the bad boy.
-    pmc = pmNewContext (PM_CONTEXT_ARCHIVE, archive.c_str ());
-    if (pmc < 0) {
-        // error already noted XXX where?
+    // Get a (possibly already open) context for the bad boy.
+    c = pmg_context_get (archive, message);
+    if (c == 0) {
         goto out0;
     }
+    archive_label = c->label;
+    archive_end = c->end;
 
-    // NB: past this point, exit via 'goto out;' to release pmc
-
-    // Fetch end of archive time boundaries, to avoid having libpcp
-    // iterate across vast regions of void.  This would be especially
-    // bad if libpcp worries the archive might have grown since last
-    // call, go and do an fstat(2)/lseek(2) every point.
-    sts = pmGetArchiveLabel (& archive_label);
-    if (sts < 0) {
-        message << "cannot find archive label";
-        goto out;
-    }
-
-    sts = pmGetArchiveEnd (& archive_end);
-    if (sts < 0) {
-        message << "cannot find archive end";
-        goto out;
-    }
+    // NB: past this point, c must be released via pmg_context_put()
 
     if (verbosity > 3) {
         message << "[" << archive_label.ll_start.tv_sec
@@ -914,120 +1443,46 @@ void pmgraphite_fetch_series (fetch_series_jobspec *spec)
     pmids.resize(spec->targets.size());
     pmdescs.resize(spec->targets.size());
     pminsts.resize(spec->targets.size());
+    c->targets_clock++;
 
     for (unsigned j=0; j<spec->targets.size(); j++) {
         if (exit_p)
             break;
 
         const string& target = spec->targets[j];
-        pmids[j] = 0; // always invalid
-
-        vector <string> target_tok = split (target, '.');
-        if (target_tok.size () < 2) {
-            message << target << ": not enough target components";
-            continue;
+        map <string, pmg_target>::iterator it = c->targets.find (target);
+        if (it == c->targets.end ()) {
+            pmg_target t;
+            pmg_resolve_target (target, t);
+            it = c->targets.insert (make_pair (target, t)).first;
         }
-        for (unsigned i = 0; i < target_tok.size (); i++)
-            if (target_tok[i] == "") {
-                message << target << ": empty target components";
-                continue;
-            }
-
-        // We need to decide whether the next dotted components represent
-        // a metric name, or whether there is an instance name squished at
-        // the end.
-        string metric_name = "";
-        for (unsigned i = 1; i < target_tok.size () - 1; i++) {
-            const string & piece = target_tok[i];
-            if (i > 1) {
-                metric_name += '.';
-            }
-            metric_name += piece;
-        }
-        last_component = target_tok[target_tok.size () - 1];
+        it->second.last_used = c->targets_clock;
+        const pmg_target& t = it->second;
 
-        char *namelist[1];
-        pmID pmidlist[1]; // fetch here instead of pmids[i], so an early error continue leaves latter zero
-        namelist[0] = (char *) metric_name.c_str ();
-        int sts = pmLookupName (1, namelist, & pmidlist[0]);
-
-        if (sts == 1) {
-            // found ... last name must be instance domain name
-            sts = pmLookupDesc (pmidlist[0], &pmdescs[j]);
-            if (sts != 0) {
-                message << "cannot find metric descriptor " << metric_name;
-                continue;
-            }
-            // check that there is an instance domain, in order to use that last component
-            if (pmdescs[j].indom == PM_INDOM_NULL) {
-                message << "metric " << metric_name << " lacks expected indom "
-                        << last_component;
-                continue;
-            }
-            // look up that instance name
-            string instance_name = pmgraphite_metric_decode (last_component);
-            int inst = pmLookupInDomArchive (pmdescs[j].indom,
-                                             (char *) instance_name.c_str ());	// XXX: why not pmLookupInDom?
-            if (inst < 0) {
-                message << "metric " << metric_name << " lacks recognized indom "
-                        << last_component;
-                continue;
-            }
-            pminsts[j] = inst;
-            // NB: don't mess with instance domain profiles.  We may have multiple
-            // contradictory sets for different metrics in the same fetch loop.
-            // Instead we receive them all and search through them via pminst[i].
-        } else {
-            // not found ... ok, try again with that last component
-            metric_name = metric_name + '.' + last_component;
-            namelist[0] = (char *) metric_name.c_str ();
-            int sts = pmLookupName (1, namelist, pmidlist);
-            if (sts != 1) {
-                // still not found .. give up
-                message << "cannot find metric name " << metric_name;
-                continue;
-            }
-
-            sts = pmLookupDesc (pmidlist[0], &pmdescs[j]);
-            if (sts != 0) {
-                message << "cannot find metric descriptor " << metric_name;
-                continue;
-            }
-            // check that there is no instance domain
-            if (pmdescs[j].indom != PM_INDOM_NULL) {
-                message << "metric " << metric_name << " has unexpected indom " << pmdescs[j].indom;
-                continue;
-            }
+        message << t.message;
+        pmids[j] = t.pmid;
+        pmdescs[j] = t.desc;
+        pminsts[j] = t.inst;
+    }
+    pmg_targets_trim (c);
 
-            pminsts[j] = -1; // PMAPI magic value for pmResult inst for PM_INDOM_NULL
-        }
+    // -------------------- PART 3 - giant fetch
 
-        // Check that the pmDesc type is numeric
-        switch (pmdescs[j].type) {
-        case PM_TYPE_32:
-        case PM_TYPE_U32:
-        case PM_TYPE_64:
-        case PM_TYPE_U64:
-        case PM_TYPE_FLOAT:
-        case PM_TYPE_DOUBLE:
-            break;
-        default:
-            message << "metric " << metric_name << " has unsupported type " << pmdescs[j].type;
+    // only the targets that resolved to a numeric metric are fetched,
+    // the others remain all-NaN
+    for (unsigned i=0; i<spec->targets.size(); i++) {
+        if (pmids[i] == 0)
             continue;
-        }
-
-        pmids[j] = pmidlist[0]; // Now we're committed to trying to fetch this pmid.
+        pmids_set.insert(pmids[i]);
+        fetch_targets.push_back(i);
+        fetch_pmids.push_back(pmids[i]);
+        fetch_insts.push_back(pminsts[i]);
     }
 
-    // -------------------- PART 3 - giant fetch loop
-
-    // compute unique subset of pmids; we search through pmResult
-    pmids_set.insert(pmids.begin(), pmids.end());
-    unique_pmids.insert(unique_pmids.begin(), pmids_set.begin(), pmids_set.end());
-
     // inclusive iteration from t_start to t_end
     entries = 0;
-    pmSetMode_called_p = 0;
+    for (time_t iteration_time = t_start; iteration_time <= t_end; iteration_time += t_step)
+        entries++;
 
     // initialize the outputs vectors with a bunch of NaNs
     for (unsigned i=0; i<spec->targets.size(); i++)
@@ -1039,90 +1494,62 @@ void pmgraphite_fetch_series (fetch_series_jobspec *spec)
             spec->outputs[i]->push_back(x);
         }
 
+    // We only want to fetch within known time boundaries of the archive,
+    // i.e. entries [first, last) of (*outputs[i]).
+    first = 0;
+    while (first < entries &&
+            t_start + (time_t) first * t_step < archive_label.ll_start.tv_sec)
+        first++;
+    last = first;
+    while (last < entries &&
+            t_start + (time_t) last * t_step <= archive_end.tv_sec)
+        last++;
+
+    if (last > first && fetch_pmids.size() > 0 && ! exit_p) {
+        // One pass over the archive for the whole window, rather than a
+        // pmFetch per time step; values come back one column per target.
+        unsigned count = last - first;
+        struct timeval start_timeval, step_timeval;
+        start_timeval.tv_sec = t_start + (time_t) first * t_step;
+        start_timeval.tv_usec = 0;
+        step_timeval.tv_sec = t_step;
+        step_timeval.tv_usec = 0;
+
+        fetch_values.resize(fetch_pmids.size() * count);
+        sts = pmFetchInterpRange (fetch_pmids.size(), & fetch_pmids[0], & fetch_insts[0],
+                                  &start_timeval, &step_timeval, count, & fetch_values[0]);
+        if (sts < 0) {
+            message << "cannot fetch values: " << pmErrStr (sts);
+        } else {
+            for (unsigned j=0; j<fetch_targets.size(); j++) {
+                unsigned i = fetch_targets[j];
 
-    entries = 0; // index in (*outputs[i]) to fill - i.e., a scaled time coordinate
-    for (time_t iteration_time = t_start; iteration_time <= t_end; iteration_time += t_step, entries++) {
-        if (exit_p)
-            break;
-
-        pmResult *result;
+                // supply the pmDesc to caller
+                *(spec->output_descs[i]) = pmdescs[i];
 
-        // We only want to pmFetch within known time boundaries of the archive.
-        if (iteration_time >= archive_label.ll_start.tv_sec &&
-                iteration_time <= archive_end.tv_sec) {
+                for (unsigned k=0; k<count; k++) {
+                    double value = fetch_values[j * count + k];
+                    if (pmgraphite_isnand (value))
+                        continue;
 
-            if (! pmSetMode_called_p) {
-                struct timeval start_timeval;
-                start_timeval.tv_sec = iteration_time;
-                start_timeval.tv_usec = 0;
-                sts = pmSetMode (PM_MODE_INTERP | PM_XTB_SET (PM_TIME_SEC), &start_timeval, t_step);
-                if (sts != 0) {
-                    message << "cannot set time mode origin/delta";
-                    break;
+                    // overwrite the pre-prepared NaN with our genuine value
+                    (*spec->outputs[i])[first + k].what = (float) value;
+                    entries_good++;
                 }
-
-                pmSetMode_called_p = 1;
             }
 
-            // fetch all unique metrics
-            int sts = pmFetch (unique_pmids.size(), & unique_pmids[0], &result);
             if (verbosity > 4) {
-                message << "\n@" << iteration_time; // also == result->timestamp.tv_sec
-                if (sts < 0)
-                    message << "?";
-                message << " ";
-            }
-
-            if (sts >= 0) {
-                assert ((size_t)result->numpmid == unique_pmids.size()); // PMAPI guarantee?
-
-                // search them all for matching pmid/inst tuples
-                for (unsigned i=0; i<spec->targets.size(); i++) {
-
-                    timestamped_float x;
-                    x.when.tv_sec = iteration_time;
-                    x.when.tv_usec = 0;
-                    x.what = nanf ("");	// initialize to a NaN
-
-                    for (unsigned j=0; j<unique_pmids.size(); j++) { // for indexing over result->vset
-                        if (result->vset[j]->pmid != pmids[i])
-                            continue;
-
-                        // supply the pmDesc to caller
-                        *(spec->output_descs[i]) = pmdescs[i];
-
-                        for (int k=0; k<result->vset[j]->numval; k++) {
-                            if (result->vset[j]->vlist[k].inst != pminsts[i])
-                                continue;
-
-                            // yey, found our (pmid,inst) value!!
-
-                            pmAtomValue value;
-                            sts = pmExtractValue (result->vset[j]->valfmt,
-                                                  &result->vset[j]->vlist[k],	// we know: one pmid, one instance
-                                                  pmdescs[i].type, &value, PM_TYPE_FLOAT);
-                            if (sts == 0) {
-                                x.when = result->timestamp;	// should generally match iteration_time
-                                x.what = value.f;
-                                if (verbosity > 4)
-                                    message << value.f << " ";
-                                entries_good++;
-                            }
-
-                            // overwrite the pre-prepared NaN with our genuine value
-                            (*spec->outputs[i])[entries] = x;
-
-                            j = unique_pmids.size(); // arrange to exit the valuesets iteration too
-                            break;
-                        } // search over instances
-                    } // search over valuesets
-
-                } // done iterating over all targets
-
-                pmFreeResult (result);
+                for (unsigned k=0; k<count; k++) {
+                    message << "\n@" << start_timeval.tv_sec + (time_t) k * t_step << " ";
+                    for (unsigned j=0; j<fetch_targets.size(); j++) {
+                        double value = fetch_values[j * count + k];
+                        if (! pmgraphite_isnand (value))
+                            message << (float) value << " ";
+                    }
+                }
             }
         }
-    } // iterate over time
+    }
 
     // -------------------- PART 4 - rate-conversion post-processing
     // Rate conversion for COUNTER semantics values; perhaps should be a libpcp feature.
@@ -1178,8 +1605,7 @@ void pmgraphite_fetch_series (fetch_series_jobspec *spec)
         message << ", " << entries_good << "/" << entries*spec->targets.size() << " values";
     }
 
- out:
-    pmDestroyContext (pmc);
+    pmg_context_put (c);
  out0:
     // vector output already returned via jobspec pointer
 
@@ -1502,7 +1928,12 @@ void notcairo_parse_color (const string& name, double& r, double& g, double& b)
 
 try_name:
     // try to look up the name in the Official(tm) CSS3/SVG color map
+    // (renders may run concurrently on worker threads, so fill it only once)
     static map<string,rgb> colormap;
+#ifdef HAVE_PTHREAD_H
+    static pthread_mutex_t colormap_lock = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock (& colormap_lock);
+#endif
     if (colormap.size () == 0) {
         // http://www.w3.org/TR/SVG/types.html#ColorKeywords
         colormap["aliceblue"] = rgb (240, 248, 255);
@@ -1654,6 +2085,9 @@ try_name:
         colormap["yellow"] = rgb (255, 255, 0);
         colormap["yellowgreen"] = rgb (154, 205, 50);
     }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock (& colormap_lock);
+#endif
 
     map<string,rgb>::iterator it = colormap.find (name);
     if (it != colormap.end ()) {
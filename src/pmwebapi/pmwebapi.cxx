@@ -49,6 +49,13 @@
 
 using namespace std;
 
+extern "C"
+{
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+}
+
 /* ------------------------------------------------------------------------ */
 
 struct webcontext {
@@ -59,7 +66,12 @@ struct webcontext {
     unsigned mypolltimeout;
     time_t expires;		/* poll timeout, 0 if never expires */
     int context;			/* PMAPI context handle; owned */
+    unsigned refs;		/* requests in flight; protected by contexts_lock */
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_t lock;	/* held by the request using the PMAPI context */
+#endif
 
+    webcontext ();
     ~webcontext ();
 };
 
@@ -67,6 +79,36 @@ struct webcontext {
 typedef map <int, webcontext *>context_map;
 static context_map contexts;	// map from webcontext#
 
+/* Requests may be served concurrently by the worker threads (-M), so:
+   - the contexts map, and each webcontext's expires & refs fields, are
+     protected by contexts_lock;
+   - a request looking up a webcontext takes a reference on it under
+     contexts_lock, so the gc leaves it alone until the request is done;
+   - a request then holds the webcontext's own lock for as long as it
+     uses the PMAPI context, so each PMAPI context is driven by at most
+     one thread at a time.  (libpcp's current context is per-thread, so
+     each thread pmUseContext()s for itself.)
+   Never take contexts_lock while holding a webcontext lock. */
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static inline void
+contexts_lock_acquire (void)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock (& contexts_lock);
+#endif
+}
+
+static inline void
+contexts_lock_release (void)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock (& contexts_lock);
+#endif
+}
+
 
 
 
@@ -81,6 +123,7 @@ pmwebapi_gc ()
     (void) time (&now);
     time_t soonest = 0;
 
+    contexts_lock_acquire ();
     for (context_map::iterator it = contexts.begin (); it != contexts.end (); /* null */) {
 
         if (it->second->expires == 0) {
@@ -89,7 +132,7 @@ pmwebapi_gc ()
             continue;
         }
 
-        if (it->second->expires < now) {
+        if (it->second->expires < now && it->second->refs == 0) {
             if (verbosity) {
                 timestamp (clog) << "context (web" << it->first << "=pm" << it->second->context <<
                                  ") expired." << endl;
@@ -109,11 +152,24 @@ pmwebapi_gc ()
             it++;
         }
     }
+    contexts_lock_release ();
 
+    if (soonest != 0 && soonest < now) {
+        // only busy ones have expired; look again shortly
+        soonest = now + 1;
+    }
     return soonest ? (unsigned) (soonest - now) : maxtimeout;
 }
 
 
+webcontext::webcontext (): mypolltimeout (0), expires (0), context (-1), refs (0)
+{
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_init (& this->lock, NULL);
+#endif
+}
+
+
 webcontext::~webcontext ()
 {
     if (this->context >= 0) {
@@ -123,6 +179,9 @@ webcontext::~webcontext ()
                              endl;
         }
     }
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_destroy (& this->lock);
+#endif
 }
 
 
@@ -140,7 +199,7 @@ pmwebapi_deallocate_all ()
 
 
 /* Allocate an zeroed webcontext structure, and enroll it in the
-   hash table with the given context#. */
+   hash table with the given context#.  Caller holds contexts_lock. */
 static int
 webcontext_allocate (int webapi_ctx, struct webcontext **wc)
 {
@@ -158,16 +217,17 @@ int
 pmwebapi_bind_permanent (int webapi_ctx, int pcp_context)
 {
     struct webcontext *c;
+    contexts_lock_acquire ();
     int rc = webcontext_allocate (webapi_ctx, &c);
-    if (rc < 0) {
-        return rc;
+    if (rc == 0) {
+        assert (c);
+        assert (pcp_context >= 0);
+        c->context = pcp_context;
+        c->mypolltimeout = ~0;
+        c->expires = 0;
     }
-    assert (c);
-    assert (pcp_context >= 0);
-    c->context = pcp_context;
-    c->mypolltimeout = ~0;
-    c->expires = 0;
-    return 0;
+    contexts_lock_release ();
+    return rc;
 }
 
 
@@ -288,11 +348,13 @@ pmwebapi_respond_new_context (struct MHD_Connection *connection,
         struct webcontext *c = NULL;
         /* Create a new context key for the webapi.  We just use a random integer within
            a reasonable range: 1..INT_MAX */
+        contexts_lock_acquire ();
         while (1) {
             /* Preclude infinite looping here, for example due to a badly behaving
                random(3) implementation. */
             iterations++;
             if (iterations > 100) {
+                contexts_lock_release ();
                 connstamp (cerr, connection) << "webapi_ctx allocation failed" << endl;
                 pmDestroyContext (context);
                 rc = -EMFILE;
@@ -318,6 +380,7 @@ pmwebapi_respond_new_context (struct MHD_Connection *connection,
         c->expires += c->mypolltimeout;
         c->userid = userid;		/* may be empty */
         c->password = password;	/* ditto */
+        contexts_lock_release ();
         /* Errors beyond this point don't require instant cleanup; the
            periodic context GC will do it all. */
     }
@@ -1296,61 +1359,13 @@ out:
 /* ------------------------------------------------------------------------ */
 
 
-int
-pmwebapi_respond (struct MHD_Connection *connection, const http_params & params,
-                  const vector <string> &url)
+/* Serve a $CTX/command request, with the given webcontext referenced & locked. */
+static int
+pmwebapi_respond_context (struct MHD_Connection *connection, const http_params & params,
+                          struct webcontext *c, long webapi_ctx, const string & context_command)
 {
-    /* We emit CORS header for all successful json replies, namely:
-       Access-Control-Access-Origin: *
-       https://developer.mozilla.org/en-US/docs/HTTP/Access_control_CORS */
-
-    /* NB: url is already edited to remove the /pmapi/ prefix. */
-    long webapi_ctx;
-    struct webcontext *c;
-    char *context_end;
-    string context_command;
     int rc = 0;
-    context_map::iterator it;
 
-    /* Decode the calls to the web API. */
-    /* -------------------------------------------------------------------- */
-    /* context creation */
-    /* if-multithreaded: write-lock contexts */
-    if (new_contexts_p &&		/* permitted */
-            (url.size () == 3 && url[2] == "context")) {
-        return pmwebapi_respond_new_context (connection, params);
-    }
-
-    /* -------------------------------------------------------------------- */
-    /* All other calls use $CTX/command, so we parse $CTX
-       generally and map it to the webcontext* */
-    if (url.size () != 4) {
-	connstamp (cerr, connection) << "url.size() " << url.size() << " not 4, url[2]=" << url[2] << ", new_contexts_p=" << new_contexts_p << endl;
-        rc = -EINVAL;
-        goto out;
-    }
-
-    errno = 0;
-    webapi_ctx = strtol (url[2].c_str (), &context_end, 10);	/* matches %d above */
-    if (errno != 0 || webapi_ctx <= 0	/* range check, plus string-nonemptyness check */
-            || webapi_ctx > INT_MAX	/* matches random() loop above */
-            || *context_end != '\0') {
-        /* fully parsed */
-        connstamp (cerr, connection) << "unrecognized web context #" << url[2] << endl;
-        rc = -EINVAL;
-        goto out;
-    }
-    context_command = url[3];
-
-    it = contexts.find ((int) webapi_ctx);
-    if (it == contexts.end ()) {
-        connstamp (cerr, connection) << "unknown web context #" << webapi_ctx << endl;
-        rc = PM_ERR_NOCONTEXT;
-        goto out;
-    }
-
-    c = it->second;
-    assert (c != NULL);
     /* Process HTTP Basic userid/password, if supplied.  Both returned strings
        need to be free(3)'d later.  */
     if (c->userid != "") {
@@ -1411,13 +1426,14 @@ pmwebapi_respond (struct MHD_Connection *connection, const http_params & params,
     }
 
     /* Update last-use of this connection. */
+    contexts_lock_acquire ();
     if (c->expires != 0) {
         time (&c->expires);
         c->expires += c->mypolltimeout;
     }
+    contexts_lock_release ();
 
-    /* Switch to this context for subsequent operations. */
-    /* if-multithreaded: watch out. */
+    /* Switch to this context for subsequent operations, in this thread. */
     rc = pmUseContext (c->context);
     if (rc) {
         char pmmsg[PM_MAXERRMSGLEN];
@@ -1450,3 +1466,80 @@ pmwebapi_respond (struct MHD_Connection *connection, const http_params & params,
 out:
     return mhd_notify_error (connection, rc);
 }
+
+
+int
+pmwebapi_respond (struct MHD_Connection *connection, const http_params & params,
+                  const vector <string> &url)
+{
+    /* We emit CORS header for all successful json replies, namely:
+       Access-Control-Access-Origin: *
+       https://developer.mozilla.org/en-US/docs/HTTP/Access_control_CORS */
+
+    /* NB: url is already edited to remove the /pmapi/ prefix. */
+    long webapi_ctx;
+    struct webcontext *c;
+    char *context_end;
+    string context_command;
+    int rc = 0;
+    context_map::iterator it;
+
+    /* Decode the calls to the web API. */
+    /* -------------------------------------------------------------------- */
+    /* context creation */
+    if (new_contexts_p &&		/* permitted */
+            (url.size () == 3 && url[2] == "context")) {
+        return pmwebapi_respond_new_context (connection, params);
+    }
+
+    /* -------------------------------------------------------------------- */
+    /* All other calls use $CTX/command, so we parse $CTX
+       generally and map it to the webcontext* */
+    if (url.size () != 4) {
+	connstamp (cerr, connection) << "url.size() " << url.size() << " not 4, url[2]=" << url[2] << ", new_contexts_p=" << new_contexts_p << endl;
+        rc = -EINVAL;
+        goto out;
+    }
+
+    errno = 0;
+    webapi_ctx = strtol (url[2].c_str (), &context_end, 10);	/* matches %d above */
+    if (errno != 0 || webapi_ctx <= 0	/* range check, plus string-nonemptyness check */
+            || webapi_ctx > INT_MAX	/* matches random() loop above */
+            || *context_end != '\0') {
+        /* fully parsed */
+        connstamp (cerr, connection) << "unrecognized web context #" << url[2] << endl;
+        rc = -EINVAL;
+        goto out;
+    }
+    context_command = url[3];
+
+    contexts_lock_acquire ();
+    it = contexts.find ((int) webapi_ctx);
+    if (it == contexts.end ()) {
+        contexts_lock_release ();
+        connstamp (cerr, connection) << "unknown web context #" << webapi_ctx << endl;
+        rc = PM_ERR_NOCONTEXT;
+        goto out;
+    }
+
+    c = it->second;
+    assert (c != NULL);
+    c->refs++;
+    contexts_lock_release ();
+
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock (& c->lock);
+#endif
+    rc = pmwebapi_respond_context (connection, params, c, webapi_ctx, context_command);
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock (& c->lock);
+#endif
+
+    contexts_lock_acquire ();
+    c->refs--;
+    contexts_lock_release ();
+    return rc;
+
+out:
+    return mhd_notify_error (connection, rc);
+}
@@ -104,6 +104,14 @@ extern void json_quote (std::ostream & o, const std::string & value);
 extern struct MHD_Response *NOTMHD_compressible_response(struct MHD_Connection *connection,
                                                          const std::string& buf);
 
+// workers.cxx
+typedef void (*pmweb_task_t) (void *);
+extern void pmweb_workers_start (unsigned nthreads);
+extern void pmweb_workers_stop (void);
+extern unsigned pmweb_workers_size (void);
+extern int pmweb_workers_submit (pmweb_task_t fn, void *arg);
+extern void pmweb_workers_for (unsigned count, void (*fn) (void *, unsigned), void *arg);
+
 
 // inlined right here
 
@@ -0,0 +1,386 @@
+/*
+ * JSON web bridge for PMAPI.
+ *
+ * Copyright (c) 2016 Red Hat.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ */
+
+#include "pmwebapi.h"
+
+#include <deque>
+
+using namespace std;
+
+extern "C"
+{
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+}
+
+
+// A long-lived pool of -M worker threads, shared by all requests.
+//
+// Each worker owns a deque of tasks.  Tasks submitted from a worker go
+// onto the back of its own deque, and the worker pops from the back, so
+// nested work (e.g. the series of a graphite render) stays warm on the
+// thread that spawned it.  Tasks submitted from outside the pool (the
+// microhttpd thread) are dealt round-robin.  An idle worker steals from
+// the front of the other workers' deques, i.e., the oldest work first.
+//
+// Nothing in here knows about MHD or PMAPI contexts; the rules about who
+// may touch what while a task is running live with the callers.
+
+#ifdef HAVE_PTHREAD_H
+
+struct pmweb_task {
+    pmweb_task_t fn;
+    void *arg;
+};
+
+struct pmweb_worker {
+    pthread_t thread;
+    pthread_mutex_t lock;	// protects the following field
+    deque <pmweb_task> tasks;
+    unsigned nr;
+    bool started;
+};
+
+static vector <pmweb_worker *> workers;
+static pthread_key_t workers_self;	// pmweb_worker* of the calling thread, if any
+
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;	// protects the following
+static pthread_cond_t workers_idle = PTHREAD_COND_INITIALIZER;
+static unsigned workers_pending;	// tasks sitting in some deque
+static unsigned workers_sleeping;
+static unsigned workers_next;		// round-robin target for outside submissions
+static unsigned workers_stopping;
+
+
+// Take a task: our own newest one, or failing that, someone else's oldest.
+static bool
+pmweb_worker_take (pmweb_worker *self, pmweb_task & t)
+{
+    bool found = false;
+
+    pthread_mutex_lock (& self->lock);
+    if (! self->tasks.empty ()) {
+        t = self->tasks.back ();
+        self->tasks.pop_back ();
+        found = true;
+    }
+    pthread_mutex_unlock (& self->lock);
+
+    for (unsigned i = 1; ! found && i < workers.size (); i++) {
+        pmweb_worker *victim = workers[(self->nr + i) % workers.size ()];
+        pthread_mutex_lock (& victim->lock);
+        if (! victim->tasks.empty ()) {
+            t = victim->tasks.front ();
+            victim->tasks.pop_front ();
+            found = true;
+        }
+        pthread_mutex_unlock (& victim->lock);
+    }
+
+    if (found) {
+        pthread_mutex_lock (& workers_lock);
+        workers_pending--;
+        pthread_mutex_unlock (& workers_lock);
+    }
+    return found;
+}
+
+
+static void *
+pmweb_worker_main (void *cls)
+{
+    pmweb_worker *self = (pmweb_worker *) cls;
+    pmweb_task t;
+
+    (void) pthread_setspecific (workers_self, self);
+
+    while (1) {
+        if (pmweb_worker_take (self, t)) {
+            (*t.fn) (t.arg);
+            continue;
+        }
+
+        // Nothing to be found anywhere; sleep unless something arrived
+        // in the mean time.  Only quit once every deque is drained, so
+        // that no submitted task is ever dropped.
+        pthread_mutex_lock (& workers_lock);
+        if (workers_pending == 0) {
+            if (workers_stopping) {
+                pthread_mutex_unlock (& workers_lock);
+                break;
+            }
+            workers_sleeping++;
+            pthread_cond_wait (& workers_idle, & workers_lock);
+            workers_sleeping--;
+        }
+        pthread_mutex_unlock (& workers_lock);
+    }
+    return 0;
+}
+
+
+void
+pmweb_workers_start (unsigned nthreads)
+{
+    assert (workers.empty ());
+    if (nthreads == 0) {
+        return;
+    }
+
+    (void) pthread_key_create (& workers_self, NULL);
+    for (unsigned i = 0; i < nthreads; i++) {
+        pmweb_worker *w = new pmweb_worker ();
+        pthread_mutex_init (& w->lock, NULL);
+        w->nr = workers.size ();
+        w->started = false;
+        workers.push_back (w);
+    }
+
+    // Start threads only once the vector is complete, since workers
+    // index into it without locking.  A worker whose thread could not be
+    // started still gets its share of submissions; they get stolen.
+    unsigned started = 0;
+    for (unsigned i = 0; i < workers.size (); i++) {
+        int rc = pthread_create (& workers[i]->thread, NULL, & pmweb_worker_main, workers[i]);
+        if (rc != 0) {
+            timestamp (cerr) << "cannot create worker thread: " << strerror (rc) << endl;
+        } else {
+            workers[i]->started = true;
+            started++;
+        }
+    }
+    if (started == 0) {
+        for (unsigned i = 0; i < workers.size (); i++) {
+            pthread_mutex_destroy (& workers[i]->lock);
+            delete workers[i];
+        }
+        workers.clear ();
+    }
+}
+
+
+void
+pmweb_workers_stop (void)
+{
+    if (workers.empty ()) {
+        return;
+    }
+
+    pthread_mutex_lock (& workers_lock);
+    workers_stopping = 1;
+    pthread_cond_broadcast (& workers_idle);
+    pthread_mutex_unlock (& workers_lock);
+
+    for (unsigned i = 0; i < workers.size (); i++) {
+        if (workers[i]->started) {
+            (void) pthread_join (workers[i]->thread, NULL);
+        }
+    }
+    for (unsigned i = 0; i < workers.size (); i++) {
+        assert (workers[i]->tasks.empty ());
+        pthread_mutex_destroy (& workers[i]->lock);
+        delete workers[i];
+    }
+    workers.clear ();
+}
+
+
+unsigned
+pmweb_workers_size (void)
+{
+    return workers.size ();
+}
+
+
+int
+pmweb_workers_submit (pmweb_task_t fn, void *arg)
+{
+    pmweb_worker *w;
+    pmweb_task t;
+
+    if (workers.empty ()) {
+        return -EOPNOTSUPP;
+    }
+
+    t.fn = fn;
+    t.arg = arg;
+
+    w = (pmweb_worker *) pthread_getspecific (workers_self);
+    pthread_mutex_lock (& workers_lock);
+    if (workers_stopping) {
+        pthread_mutex_unlock (& workers_lock);
+        return -EAGAIN;
+    }
+    if (w == NULL) {
+        w = workers[workers_next++ % workers.size ()];
+    }
+    workers_pending++;
+    pthread_mutex_unlock (& workers_lock);
+
+    // NB: counted before being pushed, so that a worker that finds the
+    // count nonzero but the deques empty merely spins around once more.
+    pthread_mutex_lock (& w->lock);
+    w->tasks.push_back (t);
+    pthread_mutex_unlock (& w->lock);
+
+    pthread_mutex_lock (& workers_lock);
+    if (workers_sleeping > 0) {
+        pthread_cond_signal (& workers_idle);
+    }
+    pthread_mutex_unlock (& workers_lock);
+    return 0;
+}
+
+
+// The shared state of one pmweb_workers_for() call.  Helper tasks may
+// outlive the call itself (if they only get to run after the caller has
+// done all the work), so it is reference-counted and never refers back
+// to the caller's data once all job numbers have been handed out.
+struct pmweb_batch {
+    pthread_mutex_t lock;	// protects the following fields
+    pthread_cond_t done;
+    unsigned next;
+    unsigned count;
+    unsigned running;
+    unsigned refs;
+    void (*fn) (void *, unsigned);
+    void *arg;
+};
+
+
+static void
+pmweb_batch_unref (pmweb_batch *b)
+{
+    pthread_mutex_lock (& b->lock);
+    bool last = (--b->refs == 0);
+    pthread_mutex_unlock (& b->lock);
+
+    if (last) {
+        pthread_cond_destroy (& b->done);
+        pthread_mutex_destroy (& b->lock);
+        delete b;
+    }
+}
+
+
+static void
+pmweb_batch_drain (pmweb_batch *b)
+{
+    pthread_mutex_lock (& b->lock);
+    while (b->next < b->count) {
+        unsigned i = b->next++;
+        b->running++;
+        pthread_mutex_unlock (& b->lock);
+
+        (*b->fn) (b->arg, i);
+
+        pthread_mutex_lock (& b->lock);
+        b->running--;
+    }
+    if (b->running == 0) {
+        pthread_cond_broadcast (& b->done);
+    }
+    pthread_mutex_unlock (& b->lock);
+}
+
+
+static void
+pmweb_batch_helper (void *cls)
+{
+    pmweb_batch *b = (pmweb_batch *) cls;
+
+    pmweb_batch_drain (b);
+    pmweb_batch_unref (b);
+}
+
+#else /* !HAVE_PTHREAD_H */
+
+void
+pmweb_workers_start (unsigned)
+{
+}
+
+void
+pmweb_workers_stop (void)
+{
+}
+
+unsigned
+pmweb_workers_size (void)
+{
+    return 0;
+}
+
+int
+pmweb_workers_submit (pmweb_task_t, void *)
+{
+    return -EOPNOTSUPP;
+}
+
+#endif /* HAVE_PTHREAD_H */
+
+
+// Run fn(arg, 0) ... fn(arg, count-1) in parallel, returning once all of
+// them have finished.  The calling thread works through the jobs too, so
+// this is safe to use from within a worker task: even with every other
+// worker busy, the caller simply ends up doing all of the jobs itself.
+void
+pmweb_workers_for (unsigned count, void (*fn) (void *, unsigned), void *arg)
+{
+#ifdef HAVE_PTHREAD_H
+    unsigned helpers = workers.size ();
+    if (count > 1 && helpers > 0) {
+        if (helpers > count - 1) {
+            helpers = count - 1;
+        }
+
+        pmweb_batch *b = new pmweb_batch ();
+        pthread_mutex_init (& b->lock, NULL);
+        pthread_cond_init (& b->done, NULL);
+        b->next = 0;
+        b->count = count;
+        b->running = 0;
+        b->refs = 1 + helpers;
+        b->fn = fn;
+        b->arg = arg;
+
+        for (unsigned i = 0; i < helpers; i++) {
+            if (pmweb_workers_submit (& pmweb_batch_helper, b) < 0) {
+                pthread_mutex_lock (& b->lock);
+                b->refs -= helpers - i;
+                pthread_mutex_unlock (& b->lock);
+                break;
+            }
+        }
+
+        pmweb_batch_drain (b);
+
+        // Wait for jobs taken by helpers; the ones not yet started are
+        // left to find nothing to do.
+        pthread_mutex_lock (& b->lock);
+        while (b->running > 0) {
+            pthread_cond_wait (& b->done, & b->lock);
+        }
+        pthread_mutex_unlock (& b->lock);
+        pmweb_batch_unref (b);
+        return;
+    }
+#endif
+    for (unsigned i = 0; i < count; i++) {
+        (*fn) (arg, i);
+    }
+}
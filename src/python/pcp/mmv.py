@@ -169,6 +169,10 @@ LIBPCP_MMV.mmv_inc_value.argtypes = [c_void_p, POINTER(pmAtomValue), c_double]
 LIBPCP_MMV.mmv_set_value.restype = None
 LIBPCP_MMV.mmv_set_value.argtypes = [c_void_p, POINTER(pmAtomValue), c_double]
 
+LIBPCP_MMV.mmv_record_value.restype = None
+LIBPCP_MMV.mmv_record_value.argtypes = [
+    c_void_p, POINTER(pmAtomValue), c_double]
+
 LIBPCP_MMV.mmv_set_string.restype = None
 LIBPCP_MMV.mmv_set_string.argtypes = [
     c_void_p, POINTER(pmAtomValue), c_char_p, c_int]
@@ -182,6 +186,9 @@ LIBPCP_MMV.mmv_stats_inc.argtypes = [c_void_p, c_char_p, c_char_p]
 LIBPCP_MMV.mmv_stats_set.restype = None
 LIBPCP_MMV.mmv_stats_set.argtypes = [c_void_p, c_char_p, c_char_p, c_double]
 
+LIBPCP_MMV.mmv_stats_record.restype = None
+LIBPCP_MMV.mmv_stats_record.argtypes = [c_void_p, c_char_p, c_char_p, c_double]
+
 LIBPCP_MMV.mmv_stats_add_fallback.restype = None
 LIBPCP_MMV.mmv_stats_add_fallback.argtypes = [
     c_void_p, c_char_p, c_char_p, c_char_p, c_double]
@@ -314,6 +321,10 @@ class MemoryMappedValues(object):
         """ Set the mapped metric to a given value """
         LIBPCP_MMV.mmv_set_value(self._handle, mapping, value)
 
+    def record(self, mapping, value):
+        """ Record a value in the mapped histogram metric """
+        LIBPCP_MMV.mmv_record_value(self._handle, mapping, value)
+
     def set_string(self, mapping, value):
         """ Set the string mapped metric to a given value """
         if type(value) != type(b''):
@@ -355,6 +366,14 @@ class MemoryMappedValues(object):
             inst = inst.encode('utf-8')
         LIBPCP_MMV.mmv_stats_set(self._handle, name, inst, value)
 
+    def lookup_record(self, name, inst, value):
+        """ Lookup the named histogram metric[instance] and record a value """
+        if type(name) != type(b''):
+            name = name.encode('utf-8')
+        if type(inst) != type(b''):
+            inst = inst.encode('utf-8')
+        LIBPCP_MMV.mmv_stats_record(self._handle, name, inst, value)
+
     def lookup_interval_start(self, name, inst):
         """ Lookup the named metric[instance] and start an interval
             The opaque handle returned is passed to interval_end().